@@ -29,6 +29,7 @@
 #include "clang/Frontend/CompilerInstance.h"
 #include "clang/Frontend/FrontendActions.h"
 #include "clang/Frontend/FrontendDiagnostic.h"
+#include "clang/Frontend/LevitationFrontendActions.h"
 #include "clang/Frontend/MultiplexConsumer.h"
 #include "clang/Frontend/TextDiagnosticPrinter.h"
 #include "clang/Lex/PPCallbacks.h"
@@ -535,7 +536,20 @@ runClangTidy(clang::tidy::ClangTidyContext &Context,
                   IntrusiveRefCntPtr<llvm::vfs::OverlayFileSystem> BaseFS)
         : ConsumerFactory(Context, BaseFS) {}
     std::unique_ptr<FrontendAction> create() override {
-      return std::make_unique<Action>(&ConsumerFactory);
+      std::unique_ptr<FrontendAction> Act =
+          std::make_unique<Action>(&ConsumerFactory);
+
+      // C++ Levitation
+      // Unit dependencies are loaded from decl-asts, instead of
+      // being parsed along with unit.
+      if (LevitationOpts)
+        Act = std::make_unique<LevitationBuildObjectAction>(
+            std::move(Act), LevitationOpts->LevitationPreambleFileName,
+            LevitationOpts->LevitationDependencyDeclASTs,
+            /*WriteOutputs=*/false);
+      // end of C++ Levitation
+
+      return Act;
     }
 
     bool runInvocation(std::shared_ptr<CompilerInvocation> Invocation,
@@ -544,6 +558,15 @@ runClangTidy(clang::tidy::ClangTidyContext &Context,
                        DiagnosticConsumer *DiagConsumer) override {
       // Explicitly ask to define __clang_analyzer__ macro.
       Invocation->getPreprocessorOpts().SetUpStaticAnalyzer = true;
+
+      // C++ Levitation
+      LevitationOpts = Invocation->getLangOpts()->isLevitationMode(
+                           LangOptions::LBSK_BuildObjectFile,
+                           LangOptions::LBSK_BuildDeclAST)
+                           ? &Invocation->getFrontendOpts()
+                           : nullptr;
+      // end of C++ Levitation
+
       return FrontendActionFactory::runInvocation(
           Invocation, Files, PCHContainerOps, DiagConsumer);
     }
@@ -562,6 +585,11 @@ runClangTidy(clang::tidy::ClangTidyContext &Context,
     };
 
     ClangTidyASTConsumerFactory ConsumerFactory;
+
+    // C++ Levitation
+    // Options of invocation being run, if it is Levitation unit build.
+    const FrontendOptions *LevitationOpts = nullptr;
+    // end of C++ Levitation
   };
 
   ActionFactory Factory(Context, BaseFS);
@@ -29,6 +29,7 @@
 #include "clang/Frontend/CompilerInstance.h"
 #include "clang/Frontend/CompilerInvocation.h"
 #include "clang/Frontend/FrontendActions.h"
+#include "clang/Frontend/LevitationFrontendActions.h"
 #include "clang/Frontend/Utils.h"
 #include "clang/Index/IndexDataConsumer.h"
 #include "clang/Index/IndexingAction.h"
@@ -282,7 +283,26 @@ ParsedAST::build(llvm::StringRef Filename, const ParseInputs &Inputs,
   if (!Clang)
     return None;
 
-  auto Action = std::make_unique<ClangdFrontendAction>();
+  auto ClangdAction = std::make_unique<ClangdFrontendAction>();
+  auto *TopLevelDeclsCollector = ClangdAction.get();
+  std::unique_ptr<FrontendAction> Action = std::move(ClangdAction);
+
+  // C++ Levitation
+  // Unit commands written by cppl --compile-commands load preamble and
+  // dependencies decl-asts, which are imported before main file is parsed.
+  const auto &FrontendOpts = Clang->getFrontendOpts();
+  if (Clang->getLangOpts().isLevitationMode(
+      LangOptions::LBSK_BuildObjectFile,
+      LangOptions::LBSK_BuildDeclAST
+  ))
+    Action = std::make_unique<LevitationBuildObjectAction>(
+        std::move(Action),
+        FrontendOpts.LevitationPreambleFileName,
+        FrontendOpts.LevitationDependencyDeclASTs,
+        /*WriteOutputs=*/false
+    );
+  // end of C++ Levitation
+
   const FrontendInputFile &MainInput = Clang->getFrontendOpts().Inputs[0];
   if (!Action->BeginSourceFile(*Clang, MainInput)) {
     log("BeginSourceFile() failed when building AST for {0}",
@@ -421,7 +441,7 @@ ParsedAST::build(llvm::StringRef Filename, const ParseInputs &Inputs,
   // tokens from running the preprocessor inside the checks (only
   // modernize-use-trailing-return-type does that today).
   syntax::TokenBuffer Tokens = std::move(CollectTokens).consume();
-  std::vector<Decl *> ParsedDecls = Action->takeTopLevelDecls();
+  std::vector<Decl *> ParsedDecls = TopLevelDeclsCollector->takeTopLevelDecls();
   // AST traversals should exclude the preamble, to avoid performance cliffs.
   Clang->getASTContext().setTraversalScope(ParsedDecls);
   {
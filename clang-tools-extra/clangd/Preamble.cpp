@@ -297,6 +297,18 @@ std::shared_ptr<const PreambleData>
 buildPreamble(PathRef FileName, CompilerInvocation CI,
               const ParseInputs &Inputs, bool StoreInMemory,
               PreambleParsedCallback PreambleCallback) {
+  // C++ Levitation
+  // Unit's preamble and dependencies are loaded from decl-asts built by
+  // cppl, includes and imports are not parsed as part of the unit.
+  if (CI.getLangOpts()->isLevitationMode(
+      LangOptions::LBSK_BuildObjectFile,
+      LangOptions::LBSK_BuildDeclAST
+  )) {
+    vlog("Skipping preamble of C++ Levitation unit {0}", FileName);
+    return nullptr;
+  }
+  // end of C++ Levitation
+
   // Note that we don't need to copy the input contents, preamble can live
   // without those.
   auto ContentsBuffer =
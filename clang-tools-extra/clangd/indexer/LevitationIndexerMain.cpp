@@ -0,0 +1,350 @@
+//===--- LevitationIndexerMain.cpp -------------------------------*- C++-*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// clangd-levitation-indexer produces background index shards for C++
+// Levitation units out of declaration ASTs of a finished cppl build.
+// Sources are not parsed: unit decl-ast is loaded on top of its preamble and
+// dependencies, exactly as object build does, and its declarations are
+// indexed. Unit is indexed again only if its decl-ast hash has changed.
+//
+//===----------------------------------------------------------------------===//
+
+#include "SourceCode.h"
+#include "URI.h"
+#include "index/Background.h"
+#include "index/Serialization.h"
+#include "index/SymbolCollector.h"
+#include "support/Logger.h"
+#include "clang/Basic/FileManager.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/CompilerInvocation.h"
+#include "clang/Frontend/FrontendAction.h"
+#include "clang/Frontend/LevitationFrontendActions.h"
+#include "clang/Frontend/TextDiagnosticPrinter.h"
+#include "clang/Frontend/Utils.h"
+#include "clang/Index/IndexingAction.h"
+#include "clang/Levitation/Common/CreatableSingleton.h"
+#include "clang/Levitation/Common/SimpleLogger.h"
+#include "clang/Levitation/DeclASTMeta/DeclASTMetaLoader.h"
+#include "clang/Levitation/Driver/DriverDefaults.h"
+#include "clang/Levitation/FileExtensions.h"
+#include "clang/Tooling/JSONCompilationDatabase.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Signals.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/raw_ostream.h"
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+namespace clang {
+namespace clangd {
+namespace {
+
+using levitation::tools::DriverDefaults;
+using levitation::FileExtensions;
+
+static llvm::cl::opt<std::string>
+    SourcesRoot("root", llvm::cl::desc("Project sources root"),
+                llvm::cl::init(DriverDefaults::SOURCES_ROOT));
+
+static llvm::cl::opt<std::string>
+    BuildRoot("buildRoot", llvm::cl::desc("Build root of finished cppl build"),
+              llvm::cl::init(DriverDefaults::BUILD_ROOT));
+
+static llvm::cl::opt<std::string> CompileCommandsFile(
+    "compile-commands",
+    llvm::cl::desc("Compilation database written by cppl --compile-commands, "
+                   "shards are stored in .clangd/index next to it"),
+    llvm::cl::Required);
+
+static llvm::cl::opt<unsigned>
+    Jobs("j",
+         llvm::cl::desc("Number of parallel indexing jobs, 0 means all cores"),
+         llvm::cl::init(0));
+
+/// Decl-ast hashes units were indexed with, stored next to shards.
+constexpr llvm::StringLiteral StampsFile = "levitation.stamps";
+
+struct Unit {
+  std::string Source;
+  std::string DeclAST;
+  std::string Hash;
+  tooling::CompileCommand Cmd;
+};
+
+/// Indexes declarations of main decl-ast which come from unit's source,
+/// declarations of dependencies are indexed with their own units.
+/// Nothing is parsed, so it is run directly instead of AST consumer.
+class DeclASTIndexAction : public ASTFrontendAction {
+  const FileEntry *&SourceFile;
+  SymbolCollector::Options &Opts;
+  IndexFileIn &Result;
+
+public:
+  DeclASTIndexAction(const FileEntry *&SourceFile,
+                     SymbolCollector::Options &Opts, IndexFileIn &Result)
+      : SourceFile(SourceFile), Opts(Opts), Result(Result) {}
+
+protected:
+  std::unique_ptr<ASTConsumer> CreateASTConsumer(CompilerInstance &CI,
+                                                 StringRef) override {
+    return std::make_unique<ASTConsumer>();
+  }
+
+  void ExecuteAction() override {
+    CompilerInstance &CI = getCompilerInstance();
+    ASTContext &Ctx = CI.getASTContext();
+    const SourceManager &SM = Ctx.getSourceManager();
+
+    std::vector<const Decl *> Decls;
+    for (const Decl *D : Ctx.getTranslationUnitDecl()->decls()) {
+      auto Loc = SM.getFileLoc(D->getLocation());
+      if (Loc.isValid() && SM.getFileEntryForID(SM.getFileID(Loc)) == SourceFile)
+        Decls.push_back(D);
+    }
+
+    SymbolCollector Collector(Opts);
+    Collector.setPreprocessor(CI.getPreprocessorPtr());
+
+    index::IndexingOptions IndexOpts;
+    IndexOpts.SystemSymbolFilter =
+        index::IndexingOptions::SystemSymbolFilterKind::All;
+    IndexOpts.IndexFunctionLocals = false;
+    index::indexTopLevelDecls(Ctx, CI.getPreprocessor(), Decls, Collector,
+                              IndexOpts);
+
+    Result.Symbols = Collector.takeSymbols();
+    Result.Refs = Collector.takeRefs();
+    Result.Relations = Collector.takeRelations();
+  }
+};
+
+llvm::StringMap<std::string> loadStamps(StringRef Path) {
+  llvm::StringMap<std::string> Stamps;
+  auto Buffer = llvm::MemoryBuffer::getFile(Path);
+  if (!Buffer)
+    return Stamps;
+
+  llvm::SmallVector<StringRef, 64> Lines;
+  Buffer->get()->getBuffer().split(Lines, '\n', -1, false);
+  for (StringRef L : Lines) {
+    StringRef Hash, Source;
+    std::tie(Hash, Source) = L.split(' ');
+    if (Source.size())
+      Stamps[Source] = Hash.str();
+  }
+  return Stamps;
+}
+
+void saveStamps(StringRef Path, const llvm::StringMap<std::string> &Stamps) {
+  std::error_code EC;
+  llvm::raw_fd_ostream Out(Path, EC);
+  if (EC) {
+    elog("Failed to write stamps {0}: {1}", Path, EC.message());
+    return;
+  }
+  for (const auto &S : Stamps)
+    Out << S.second << " " << S.first() << "\n";
+}
+
+/// Finds decl-ast and its hash for each unit of compilation database.
+std::vector<Unit> collectUnits(const tooling::CompilationDatabase &CDB) {
+  std::vector<Unit> Units;
+  llvm::SmallString<128> Root(SourcesRoot);
+  llvm::sys::fs::make_absolute(Root);
+
+  for (auto &Cmd : CDB.getAllCompileCommands()) {
+    llvm::SmallString<128> Source(Cmd.Filename);
+    llvm::sys::fs::make_absolute(Cmd.Directory, Source);
+
+    StringRef Rel = Source;
+    if (!Rel.consume_front(Root))
+      continue;
+    Rel = Rel.ltrim("/\\");
+
+    llvm::SmallString<128> DeclAST(BuildRoot);
+    llvm::sys::path::append(DeclAST, Rel);
+    llvm::sys::path::replace_extension(DeclAST,
+                                       FileExtensions::DeclarationAST);
+
+    levitation::DeclASTMeta Meta;
+    llvm::SmallString<128> MetaFile(DeclAST);
+    llvm::sys::path::replace_extension(MetaFile, FileExtensions::DeclASTMeta);
+    if (!llvm::sys::fs::exists(MetaFile))
+      MetaFile = DeclAST; // Embedded meta, see --embed-meta.
+
+    if (!levitation::DeclASTMetaLoader::fromFile(Meta, BuildRoot, MetaFile)) {
+      vlog("No decl-ast for {0}, skipped", Source);
+      continue;
+    }
+
+    Units.push_back({Source.str().str(), DeclAST.str().str(),
+                     llvm::toHex(Meta.getDeclASTHash()), Cmd});
+  }
+  return Units;
+}
+
+/// Loads unit decl-ast with its dependencies and preamble and indexes it.
+bool indexUnit(const Unit &U, BackgroundIndexStorage &Storage) {
+  std::vector<const char *> Argv;
+  for (const auto &A : U.Cmd.CommandLine)
+    Argv.push_back(A.c_str());
+
+  IgnoringDiagConsumer IgnoreDiags;
+  auto Diags = CompilerInstance::createDiagnostics(new DiagnosticOptions,
+                                                   &IgnoreDiags, false);
+  auto CI = createInvocationFromCommandLine(Argv, Diags);
+  if (!CI) {
+    elog("Failed to create invocation for {0}", U.Source);
+    return false;
+  }
+
+  auto &FrontendOpts = CI->getFrontendOpts();
+  FrontendOpts.Inputs.clear();
+  FrontendOpts.Inputs.emplace_back(
+      U.DeclAST, InputKind(Language::CXX, InputKind::Precompiled));
+  FrontendOpts.OutputFile.clear();
+  FrontendOpts.LevitationDeclASTMeta.clear();
+
+  CompilerInstance Clang;
+  Clang.setInvocation(std::move(CI));
+  Clang.createDiagnostics(new TextDiagnosticPrinter(
+      llvm::errs(), &Clang.getDiagnosticOpts()));
+
+  const FileEntry *SourceFile = nullptr;
+  if (auto F = Clang.createFileManager()->getFile(U.Source))
+    SourceFile = *F;
+
+  auto SourceContents = llvm::MemoryBuffer::getFile(U.Source);
+  if (!SourceFile || !SourceContents) {
+    elog("Failed to read {0}", U.Source);
+    return false;
+  }
+
+  SymbolCollector::Options Opts;
+  Opts.CountReferences = true;
+  Opts.RefFilter = RefKind::All;
+  Opts.RefsInHeaders = true;
+  Opts.FileFilter = [&](const SourceManager &SM, FileID FID) {
+    return SM.getFileEntryForID(FID) == SourceFile;
+  };
+
+  IndexFileIn Result;
+  LevitationBuildObjectAction Action(
+      std::make_unique<DeclASTIndexAction>(SourceFile, Opts, Result),
+      FrontendOpts.LevitationPreambleFileName,
+      FrontendOpts.LevitationDependencyDeclASTs,
+      /*WriteOutputs=*/false);
+
+  if (!Clang.ExecuteAction(Action) || !Result.Symbols) {
+    elog("Failed to index {0}", U.Source);
+    return false;
+  }
+
+  // Digest is one of the source, so that clangd background index
+  // considers shard up-to-date and doesn't parse unit itself.
+  auto URI = URI::create(U.Source).toString();
+  IncludeGraph Sources;
+  auto &Node = Sources[URI];
+  Node.URI = Sources.find(URI)->getKey();
+  Node.Digest = digest(SourceContents->get()->getBuffer());
+  Node.Flags = IncludeGraphNode::SourceFlag::IsTU;
+  Result.Sources = std::move(Sources);
+  Result.Cmd = U.Cmd;
+
+  if (auto Err = Storage.storeShard(U.Source, IndexFileOut(Result))) {
+    elog("Failed to store shard for {0}: {1}", U.Source, std::move(Err));
+    return false;
+  }
+  return true;
+}
+
+} // namespace
+} // namespace clangd
+} // namespace clang
+
+int main(int argc, const char **argv) {
+  using namespace clang;
+  using namespace clang::clangd;
+
+  llvm::sys::PrintStackTraceOnErrorSignal(argv[0]);
+
+  const char *Overview = R"(
+  Creates clangd background index shards for C++ Levitation units,
+  out of declaration ASTs of a finished cppl build.
+
+  Example usage:
+
+  $ cppl -root=. -buildRoot=.build --compile-commands=compile_commands.json
+  $ clangd-levitation-indexer -root=. -buildRoot=.build \
+        -compile-commands=compile_commands.json
+  )";
+
+  llvm::cl::ParseCommandLineOptions(argc, argv, Overview);
+
+  std::string Error;
+  auto CDB = tooling::JSONCompilationDatabase::loadFromFile(
+      CompileCommandsFile, Error, tooling::JSONCommandLineSyntax::AutoDetect);
+  if (!CDB) {
+    llvm::errs() << Error << "\n";
+    return 1;
+  }
+
+  // Meta loader reports through levitation logger and reads
+  // files by means of global file manager.
+  levitation::log::Logger::createLogger(levitation::log::Level::Warning);
+  levitation::CreatableSingleton<FileManager>::create(FileSystemOptions());
+
+  llvm::SmallString<128> ProjectRoot(CompileCommandsFile);
+  llvm::sys::fs::make_absolute(ProjectRoot);
+  llvm::sys::path::remove_filename(ProjectRoot);
+
+  auto StorageFactory = BackgroundIndexStorage::createDiskBackedStorageFactory(
+      [&](PathRef) { return ProjectInfo{ProjectRoot.str().str()}; });
+
+  llvm::SmallString<128> Stamps(ProjectRoot);
+  llvm::sys::path::append(Stamps, ".clangd", "index", StampsFile);
+  auto Indexed = loadStamps(Stamps);
+
+  std::vector<Unit> Units = collectUnits(*CDB);
+
+  std::mutex IndexedMu;
+  std::atomic<unsigned> Failed(0), NumIndexed(0);
+  {
+    llvm::ThreadPool Pool(llvm::heavyweight_hardware_concurrency(Jobs));
+    for (const auto &U : Units) {
+      auto Found = Indexed.find(U.Source);
+      if (Found != Indexed.end() && Found->second == U.Hash)
+        continue;
+
+      Pool.async([&] {
+        if (!indexUnit(U, *StorageFactory(U.Source))) {
+          ++Failed;
+          return;
+        }
+        ++NumIndexed;
+        std::lock_guard<std::mutex> Lock(IndexedMu);
+        Indexed[U.Source] = U.Hash;
+      });
+    }
+    Pool.wait();
+  }
+
+  saveStamps(Stamps, Indexed);
+
+  log("Indexed {0} of {1} units, {2} failed", NumIndexed.load(),
+      Units.size(), Failed.load());
+  return Failed ? 1 : 0;
+}
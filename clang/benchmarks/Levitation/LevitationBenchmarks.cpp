@@ -0,0 +1,324 @@
+//===--- C++ Levitation LevitationBenchmarks.cpp ----------------*- C++ -*-===//
+//
+// Part of the C++ Levitation Project,
+// under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file defines C++ Levitation microbenchmarks of dependencies
+//  graph, solver, and dependencies and meta serialization. Each benchmark
+//  runs on synthetic data of 1k to 100k nodes, and reports number of
+//  allocations and allocated bytes per iteration besides of time.
+//
+//===----------------------------------------------------------------------===//
+
+#include "clang/Levitation/Common/CreatableSingleton.h"
+#include "clang/Levitation/Common/SimpleLogger.h"
+#include "clang/Levitation/DeclASTMeta/DeclASTMeta.h"
+#include "clang/Levitation/Dependencies.h"
+#include "clang/Levitation/DependenciesSolver/DependenciesGraph.h"
+#include "clang/Levitation/DependenciesSolver/ParsedDependencies.h"
+#include "clang/Levitation/DependenciesSolver/SolvedDependenciesInfo.h"
+#include "clang/Levitation/Serialization.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include "benchmark/benchmark.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <random>
+#include <string>
+
+using namespace llvm;
+using namespace clang;
+using namespace levitation;
+using namespace levitation::dependencies_solver;
+
+//===----------------------------------------------------------------------===//
+// Allocations counting
+
+namespace {
+std::atomic<size_t> NumAllocations(0);
+std::atomic<size_t> NumAllocatedBytes(0);
+}
+
+void *operator new(size_t Size) {
+  ++NumAllocations;
+  NumAllocatedBytes += Size;
+  if (void *Ptr = std::malloc(Size ? Size : 1))
+    return Ptr;
+  report_bad_alloc_error("Allocation failed");
+}
+
+void operator delete(void *Ptr) noexcept { std::free(Ptr); }
+void operator delete(void *Ptr, size_t) noexcept { std::free(Ptr); }
+
+namespace {
+
+/// Reports allocations made since its creation, divided by
+/// number of benchmark iterations.
+class AllocationsCounter {
+  benchmark::State &State;
+  size_t StartAllocations;
+  size_t StartBytes;
+public:
+  AllocationsCounter(benchmark::State &state)
+  : State(state),
+    StartAllocations(NumAllocations),
+    StartBytes(NumAllocatedBytes)
+  {}
+
+  ~AllocationsCounter() {
+    double Iterations = std::max<size_t>(State.iterations(), 1);
+    State.counters["allocs"] =
+        double(NumAllocations - StartAllocations) / Iterations;
+    State.counters["alloc_bytes"] =
+        double(NumAllocatedBytes - StartBytes) / Iterations;
+  }
+};
+
+//===----------------------------------------------------------------------===//
+// Synthetic data
+
+constexpr unsigned FanOut = 4;
+
+/// Dependencies are picked among units with close indices, so graph
+/// is deep rather than wide, as real projects usually are.
+constexpr unsigned Window = 64;
+
+DependenciesStringsPool &getStrings() {
+  return CreatableSingleton<DependenciesStringsPool>::get();
+}
+
+std::string getUnitName(size_t Idx) {
+  return "Bench/Unit" + std::to_string(Idx);
+}
+
+/// Builds parsed dependencies of NumUnits units, each unit imports
+/// FanOut units with lower indices, every fourth import is body one.
+/// If WithCycles is set, each tenth unit and unit next to it import
+/// each other.
+std::unique_ptr<ParsedDependencies> buildParsed(
+    size_t NumUnits,
+    bool WithCycles
+) {
+  auto &Strings = getStrings();
+  auto Parsed = std::make_unique<ParsedDependencies>(Strings);
+
+  std::mt19937 Rnd(NumUnits);
+
+  for (size_t i = 0; i != NumUnits; ++i) {
+    DependenciesData Data;
+    Data.IsPublic = false;
+    Data.IsBodyOnly = false;
+
+    for (unsigned d = 0; i && d != FanOut; ++d) {
+      size_t Lowest = i > Window ? i - Window : 0;
+      size_t DepIdx = Lowest + Rnd() % (i - Lowest);
+
+      Declaration Dep(Data.Strings->addItem(getUnitName(DepIdx)));
+      if (d % 4 == 3)
+        Data.DefinitionDependencies.insert(Dep);
+      else
+        Data.DeclarationDependencies.insert(Dep);
+    }
+
+    if (WithCycles && i % 10 == 0 && i + 1 != NumUnits)
+      Data.DeclarationDependencies.insert(
+          Declaration(Data.Strings->addItem(getUnitName(i + 1)))
+      );
+
+    if (WithCycles && i % 10 == 1)
+      Data.DeclarationDependencies.insert(
+          Declaration(Data.Strings->addItem(getUnitName(i - 1)))
+      );
+
+    Parsed->add(Strings.addItem(getUnitName(i)), Data);
+  }
+
+  return Parsed;
+}
+
+std::shared_ptr<DependenciesGraph> buildGraph(size_t NumUnits) {
+  return DependenciesGraph::build(*buildParsed(NumUnits, false), {});
+}
+
+void fillPackageDependencies(
+    PackageDependencies &Deps,
+    size_t NumDependencies
+) {
+  for (size_t i = 0; i != NumDependencies; ++i)
+    if (i % 4 == 3)
+      Deps.addDefinitionPath(getUnitName(i));
+    else
+      Deps.addDeclarationPath(getUnitName(i));
+}
+
+/// Builds meta with NumDecls declaration hashes and skipped fragments,
+/// and with used declarations of NumDecls / 10 dependencies.
+DeclASTMeta buildMeta(size_t NumDecls) {
+  HashVectorTy Hash(16, 0xAB);
+  DeclASTMeta Meta(Hash, Hash, {});
+  Meta.setInterfaceHash(Hash);
+
+  for (size_t i = 0; i != NumDecls; ++i) {
+    Meta.addSkippedFragment(
+        {i * 100, i * 100 + 50, SourceFragmentAction::ReplaceWithSemicolon}
+    );
+    Meta.addDeclHash({"Bench::Decl" + std::to_string(i), i * 2654435761u});
+  }
+
+  for (size_t i = 0; i != NumDecls / 10; ++i) {
+    auto &Used = Meta.addUsedDeclsDependency(getUnitName(i) + ".decl-ast");
+    for (size_t n = 0; n != 10; ++n)
+      Used.Names.push_back("Bench::Decl" + std::to_string(i * 10 + n));
+  }
+
+  return Meta;
+}
+
+//===----------------------------------------------------------------------===//
+// Graph and solver
+
+void BM_DependenciesGraphBuild(benchmark::State &State) {
+  auto Parsed = buildParsed(State.range(0), false);
+  AllocationsCounter Allocations(State);
+  for (auto _ : State)
+    benchmark::DoNotOptimize(DependenciesGraph::build(*Parsed, {}));
+}
+
+/// processCycles is run by DependenciesGraph::build, so it is
+/// measured as the difference with acyclic graph build.
+void BM_DependenciesGraphBuildWithCycles(benchmark::State &State) {
+  auto Parsed = buildParsed(State.range(0), true);
+  AllocationsCounter Allocations(State);
+  for (auto _ : State)
+    benchmark::DoNotOptimize(DependenciesGraph::build(*Parsed, {}));
+}
+
+/// Components walk processCycles is based on.
+void BM_StronglyConnectedComponents(benchmark::State &State) {
+  using NodeIndex = DependenciesGraph::NodeIndex;
+
+  auto Graph = buildGraph(State.range(0));
+  AllocationsCounter Allocations(State);
+  for (auto _ : State) {
+    DependenciesGraph::StronglyConnectedComponents SCC(*Graph);
+    size_t NumCycles = 0;
+    for (NodeIndex Idx = 0, e = Graph->getNumNodes(); Idx != e; ++Idx)
+      SCC.walk(Idx, [&] (ArrayRef<NodeIndex> C) {
+        NumCycles += SCC.isCycle(C);
+      });
+    benchmark::DoNotOptimize(NumCycles);
+  }
+}
+
+void BM_SolvedDependenciesInfo(benchmark::State &State) {
+  auto Graph = buildGraph(State.range(0));
+  AllocationsCounter Allocations(State);
+  for (auto _ : State)
+    benchmark::DoNotOptimize(SolvedDependenciesInfo::build(Graph));
+}
+
+//===----------------------------------------------------------------------===//
+// Serialization
+
+void BM_DependenciesBitstreamWriter(benchmark::State &State) {
+  PackageDependencies Deps;
+  fillPackageDependencies(Deps, State.range(0));
+  AllocationsCounter Allocations(State);
+  for (auto _ : State) {
+    std::string Buffer;
+    raw_string_ostream OS(Buffer);
+    CreateBitstreamWriter(OS)->writeAndFinalize(Deps);
+    OS.flush();
+    benchmark::DoNotOptimize(Buffer.data());
+  }
+}
+
+void BM_DependenciesBitstreamReader(benchmark::State &State) {
+  PackageDependencies Deps;
+  fillPackageDependencies(Deps, State.range(0));
+  std::string Buffer;
+  {
+    raw_string_ostream OS(Buffer);
+    CreateBitstreamWriter(OS)->writeAndFinalize(Deps);
+  }
+  auto MemBuf = MemoryBuffer::getMemBuffer(Buffer, "", false);
+
+  AllocationsCounter Allocations(State);
+  for (auto _ : State) {
+    DependenciesData Loaded;
+    if (!CreateBitstreamReader(*MemBuf)->read(Loaded)) {
+      State.SkipWithError("Failed to read dependencies");
+      break;
+    }
+    benchmark::DoNotOptimize(Loaded.DeclarationDependencies.size());
+  }
+}
+
+void BM_DeclASTMetaBitstreamWriter(benchmark::State &State) {
+  auto Meta = buildMeta(State.range(0));
+  AllocationsCounter Allocations(State);
+  for (auto _ : State) {
+    std::string Buffer;
+    raw_string_ostream OS(Buffer);
+    CreateMetaBitstreamWriter(OS)->writeAndFinalize(Meta);
+    OS.flush();
+    benchmark::DoNotOptimize(Buffer.data());
+  }
+}
+
+void BM_DeclASTMetaBitstreamReader(benchmark::State &State) {
+  auto Meta = buildMeta(State.range(0));
+  std::string Buffer;
+  {
+    raw_string_ostream OS(Buffer);
+    CreateMetaBitstreamWriter(OS)->writeAndFinalize(Meta);
+  }
+  auto MemBuf = MemoryBuffer::getMemBuffer(Buffer, "", false);
+
+  AllocationsCounter Allocations(State);
+  for (auto _ : State) {
+    DeclASTMeta Loaded;
+    if (!CreateMetaBitstreamReader(*MemBuf)->read(Loaded)) {
+      State.SkipWithError("Failed to read meta");
+      break;
+    }
+    benchmark::DoNotOptimize(Loaded.getDeclHashes().size());
+  }
+}
+
+} // end anonymous namespace
+
+#define LEVITATION_BENCHMARK(Name) \
+  BENCHMARK(Name) \
+      ->RangeMultiplier(10) \
+      ->Range(1000, 100000) \
+      ->Unit(benchmark::kMillisecond)
+
+LEVITATION_BENCHMARK(BM_DependenciesGraphBuild);
+LEVITATION_BENCHMARK(BM_DependenciesGraphBuildWithCycles);
+LEVITATION_BENCHMARK(BM_StronglyConnectedComponents);
+LEVITATION_BENCHMARK(BM_SolvedDependenciesInfo);
+LEVITATION_BENCHMARK(BM_DependenciesBitstreamWriter);
+LEVITATION_BENCHMARK(BM_DependenciesBitstreamReader);
+LEVITATION_BENCHMARK(BM_DeclASTMetaBitstreamWriter);
+LEVITATION_BENCHMARK(BM_DeclASTMetaBitstreamReader);
+
+int main(int argc, char **argv) {
+  // Cycles are reported as errors, they are expected here.
+  log::Logger::createLogger(log::Level::Null);
+
+  // Solver traces nodes with global strings pool.
+  CreatableSingleton<DependenciesStringsPool>::create();
+
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv))
+    return 1;
+  benchmark::RunSpecifiedBenchmarks();
+  return 0;
+}
@@ -0,0 +1,160 @@
+//===--- C++ Levitation TasksManagerBenchmarks.cpp --------------*- C++ -*-===//
+//
+// Part of the C++ Levitation Project,
+// under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file defines C++ Levitation TasksManager benchmarks: scheduling
+//  overhead of flat fans of tasks, recursive trees of tasks waiting for
+//  their children, DAGs of continuations, and wakeup latency of idle
+//  worker. Each benchmark runs with 1 to 128 workers, for both shared
+//  and work stealing queues, so that any other queue kind can be
+//  compared against them.
+//
+//===----------------------------------------------------------------------===//
+
+#include "clang/Levitation/TasksManager/TasksManager.h"
+#include "benchmark/benchmark.h"
+
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <vector>
+
+using namespace clang::levitation::tasks;
+
+namespace {
+
+using TaskContext = TasksManager::TaskContext;
+
+TasksManager::QueueKind getQueueKind(const benchmark::State &State) {
+  return State.range(1) ?
+      TasksManager::QueueKind::WorkStealing :
+      TasksManager::QueueKind::Shared;
+}
+
+/// Workers number goes as first argument, and queue kind as second one.
+void applyWorkersAndQueues(benchmark::internal::Benchmark *B) {
+  for (int Kind : {0, 1})
+    for (int Workers = 1; Workers <= 128; Workers *= 2)
+      B->Args({Workers, Kind});
+}
+
+/// Empty tasks added from main thread, then all of them are waited for.
+/// Time per task is scheduling overhead.
+void BM_TasksFlatFan(benchmark::State &State) {
+  const int FanSize = 1000;
+
+  TasksManager TM(State.range(0), getQueueKind(State));
+  for (auto _ : State) {
+    for (int i = 0; i != FanSize; ++i)
+      TM.addTask([] (TaskContext &) {});
+    TM.waitForTasks();
+  }
+
+  State.SetItemsProcessed(State.iterations() * FanSize);
+}
+
+/// Balanced binary tree of tasks, each one runs its children
+/// and blocks until they are complete. Children are run with runTask,
+/// so they are executed by parent itself, once there are no free workers.
+void BM_TasksRecursiveTree(benchmark::State &State) {
+  const int Depth = 10;
+
+  TasksManager TM(State.range(0), getQueueKind(State));
+
+  std::function<void(int)> Spawn = [&] (int Level) {
+    if (!Level)
+      return;
+
+    auto L = TM.runTask([&, Level] (TaskContext &) { Spawn(Level - 1); });
+    auto R = TM.runTask([&, Level] (TaskContext &) { Spawn(Level - 1); });
+    TM.waitForTasks({L, R});
+  };
+
+  for (auto _ : State) {
+    Spawn(Depth);
+    TM.waitForTasks();
+  }
+
+  State.SetItemsProcessed(State.iterations() * ((2 << Depth) - 2));
+}
+
+/// Layers of continuations, each task waits for two random tasks of
+/// previous layer. Nobody blocks, tasks are queued by workers which
+/// complete their last predecessors.
+void BM_TasksContinuationsDAG(benchmark::State &State) {
+  const int NumLayers = 20;
+  const int LayerSize = 50;
+
+  TasksManager TM(State.range(0), getQueueKind(State));
+  std::mt19937 Rnd(0);
+
+  for (auto _ : State) {
+    std::vector<TasksManager::TaskID> Prev, Current;
+
+    for (int l = 0; l != NumLayers; ++l) {
+      for (int i = 0; i != LayerSize; ++i) {
+        if (Prev.empty()) {
+          Current.push_back(TM.addTask([] (TaskContext &) {}));
+          continue;
+        }
+
+        Current.push_back(TM.whenAll(
+            { Prev[Rnd() % Prev.size()], Prev[Rnd() % Prev.size()] },
+            [] (TaskContext &) {}
+        ));
+      }
+      Prev.swap(Current);
+      Current.clear();
+    }
+
+    TM.waitForTasks();
+  }
+
+  State.SetItemsProcessed(State.iterations() * NumLayers * LayerSize);
+}
+
+/// Time from adding task till it is started by idle worker.
+void BM_TasksWakeupLatency(benchmark::State &State) {
+  using ClockTy = std::chrono::steady_clock;
+
+  TasksManager TM(State.range(0), getQueueKind(State));
+
+  for (auto _ : State) {
+    ClockTy::time_point Started;
+
+    auto Added = ClockTy::now();
+    auto TID = TM.addTask([&] (TaskContext &) { Started = ClockTy::now(); });
+    TM.waitForTasks({TID});
+
+    State.SetIterationTime(
+        std::chrono::duration<double>(Started - Added).count()
+    );
+  }
+}
+
+} // end anonymous namespace
+
+BENCHMARK(BM_TasksFlatFan)
+    ->Apply(applyWorkersAndQueues)
+    ->Unit(benchmark::kMicrosecond)
+    ->UseRealTime();
+
+BENCHMARK(BM_TasksRecursiveTree)
+    ->Apply(applyWorkersAndQueues)
+    ->Unit(benchmark::kMicrosecond)
+    ->UseRealTime();
+
+BENCHMARK(BM_TasksContinuationsDAG)
+    ->Apply(applyWorkersAndQueues)
+    ->Unit(benchmark::kMicrosecond)
+    ->UseRealTime();
+
+BENCHMARK(BM_TasksWakeupLatency)
+    ->Apply(applyWorkersAndQueues)
+    ->Unit(benchmark::kMicrosecond)
+    ->UseManualTime();
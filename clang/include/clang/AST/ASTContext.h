@@ -43,6 +43,7 @@
 #include "llvm/ADT/APSInt.h"
 #include "llvm/ADT/ArrayRef.h"
 #include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
 #include "llvm/ADT/FoldingSet.h"
 #include "llvm/ADT/IntrusiveRefCntPtr.h"
 #include "llvm/ADT/MapVector.h"
@@ -2745,6 +2746,34 @@ public:
   GVALinkage GetGVALinkageForFunction(const FunctionDecl *FD) const;
   GVALinkage GetGVALinkageForVariable(const VarDecl *VD);
 
+  // C++ Levitation
+  /// Whether FD is a discardable definition (inline function or implicit
+  /// instantiation) of current unit, which is emitted by the unit's object
+  /// only, see LangOptions::LevitationModulesCodegen.
+  bool isLevitationHomeDefinition(const FunctionDecl *FD) const;
+
+  /// Whether RD is a class definition of current unit, whose complete
+  /// debug info is emitted by the unit's object only,
+  /// see LangOptions::LevitationModulesDebugInfo.
+  bool isLevitationHomeRecord(const CXXRecordDecl *RD) const;
+
+  /// Whether FD is a non-inline function of current unit, whose body is
+  /// kept in Declaration AST, so that dependents may inline it,
+  /// see LangOptions::LevitationExportBodies.
+  bool isLevitationExportedBody(const FunctionDecl *FD) const {
+    return LevitationExportedBodies.count(FD);
+  }
+
+  void addLevitationExportedBody(const FunctionDecl *FD) {
+    LevitationExportedBodies.insert(FD);
+  }
+
+private:
+  llvm::DenseSet<const FunctionDecl *> LevitationExportedBodies;
+
+public:
+  // end of C++ Levitation
+
   /// Determines if the decl can be CodeGen'ed or deserialized from PCH
   /// lazily, only when used; this is only relevant for function or file scoped
   /// var definitions.
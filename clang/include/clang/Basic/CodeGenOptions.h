@@ -208,6 +208,16 @@ public:
   /// Output filename for the split debug info, not used in the skeleton CU.
   std::string SplitDwarfOutput;
 
+  /// C++ Levitation: files for object partitions past the first one,
+  /// which are code generated in parallel, the first one is written
+  /// to main output.
+  std::vector<std::string> LevitationCodeGenPartitions;
+
+  /// C++ Levitation: directory where code of partitions is kept by
+  /// hashes of their IR, so that only partitions with changed functions
+  /// are code generated again.
+  std::string LevitationCodeGenCache;
+
   /// The name of the relocation model to use.
   llvm::Reloc::Model RelocationModel;
 
@@ -51,6 +51,10 @@ class Sema;
 class SourceManager;
 class TargetInfo;
 
+namespace levitation {
+struct HashingOStreamState;
+}
+
 /// CompilerInstance - Helper class for managing a single instance of the Clang
 /// compiler.
 ///
@@ -179,6 +183,15 @@ class CompilerInstance : public ModuleLoader {
   /// The list of active output files.
   std::list<OutputFile> OutputFiles;
 
+  // C++ Levitation
+
+  /// Hash of output file, calculated while it is written,
+  /// see getLevitationOutputHash.
+  std::shared_ptr<levitation::HashingOStreamState> LevitationOutputHash;
+  unsigned LevitationNumHashedOutputs = 0;
+
+  // end of C++ Levitation
+
   /// Force an output buffer.
   std::unique_ptr<llvm::raw_pwrite_stream> OutputStream;
 
@@ -600,6 +613,12 @@ public:
   /// \return
   StringRef getCurrentOutputFilePath();
 
+  /// Gives hash of output file, calculated while output was written,
+  /// with meta hash algorithm. Only done for invocations which
+  /// write C++ Levitation meta, and for sequentially written outputs.
+  /// \return false if output was not hashed, so it should be read.
+  bool getLevitationOutputHash(SmallVectorImpl<uint8_t> &Hash);
+
   // end of C++ Levitation
 
   /// }
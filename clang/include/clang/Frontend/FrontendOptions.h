@@ -460,6 +460,32 @@ public:
   std::string LevitationDeclASTMeta;
   std::string LevitationUnitID;
 
+  /// Parse import stage with several inputs writes dependencies
+  /// and meta file for each input, outputs are matched with inputs
+  /// by position.
+  std::vector<std::string> LevitationDependenciesOutputFiles;
+  std::vector<std::string> LevitationDeclASTMetas;
+
+  /// Hash algorithm of source and output hashes in meta files,
+  /// MD5 if empty.
+  std::string LevitationHash;
+
+  /// Main file hash calculated by levitation driver,
+  /// see levitation::parseSourceDigest.
+  std::string LevitationSourceDigest;
+
+  /// Compiler and flags fingerprint calculated by levitation driver,
+  /// kept in meta file as is.
+  std::string LevitationCommandHash;
+
+  /// File -ftime-trace output is written to, if empty,
+  /// it is named after output file.
+  std::string LevitationTimeTraceOutput;
+
+  /// File dependencies deserialization stats are written to,
+  /// see levitation::DeserializationStatsCollector.
+  std::string LevitationStatsOutput;
+
   bool LevitationASTPrint;
 
   std::string LevitationPreambleFileName;
@@ -468,9 +494,50 @@ public:
   /// Declaration AST files current translation unit depends on.
   std::vector<std::string> LevitationDependencyDeclASTs;
 
+  /// Optional identifier index of dependencies Declaration AST files.
+  std::string LevitationNameIndex;
+
+  /// If set, Declaration AST files and object metas keep paths within
+  /// sources root relative to it, so that they don't depend on
+  /// location of sources.
+  std::string LevitationSourcesRoot;
+
+  /// Preamble and dependencies were already checked by Levitation driver,
+  /// so don't validate their input files, options and versions.
+  bool LevitationTrustDependencies;
+
+  /// Store declaration hashes in Declaration AST meta, and declarations
+  /// used by object in object meta, so that driver may skip object
+  /// rebuild if none of used declarations was changed.
+  bool LevitationEarlyCutoff;
+
+  /// Comments are not written into Declaration AST.
+  bool LevitationCompactDeclAST;
+
+  /// Declaration AST meta is appended to Declaration AST as trailing
+  /// bitstream block, rather than written into LevitationDeclASTMeta.
+  bool LevitationEmbedMeta;
+
+  /// Don't replace outputs which have same contents, so that tools
+  /// relying on modification time don't redo their work.
+  bool LevitationKeepUnchangedOutputs;
+
+  /// AST and Sema are released after IR generation,
+  /// and only then backend is run.
+  bool LevitationReleaseAST;
+
   bool LevitationBuildObject;
   bool LevitationBuildDeclaration;
 
+  /// Files Declaration AST building stage generates from source
+  /// fragments it has collected, so that driver doesn't read source
+  /// and meta again.
+  std::string LevitationHeaderOutput;
+  std::string LevitationDeclOutput;
+  std::string LevitationHeaderPreamble;
+  std::vector<std::string> LevitationHeaderIncludes;
+  std::vector<std::string> LevitationDeclImports;
+
   // end of C++ Levitation Mode
   //
   //===--------------------------------------------------------------------===//
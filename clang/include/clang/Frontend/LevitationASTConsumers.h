@@ -40,8 +40,12 @@ namespace levitation {
     void HandlePreprocessor(Preprocessor &PP) override;
   };
 
+/// Creates consumer which writes dependencies of current input.
+/// \param CurrentFile current input, used to choose outputs when
+/// several inputs are processed by one invocation.
 std::unique_ptr<LevitationPreprocessorConsumer> CreateDependenciesASTProcessor(
-    CompilerInstance &CI
+    CompilerInstance &CI,
+    StringRef CurrentFile
 );
 
 std::unique_ptr<ASTConsumer> CreateUnitNamespaceVerifier(
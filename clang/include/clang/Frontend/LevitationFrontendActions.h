@@ -16,12 +16,12 @@
 
 namespace clang {
 
-class ASTImporter;
-class ASTImporterLookupTable;
 class TranslationUnitDecl;
 
 namespace levitation {
   class LevitationPreprocessorConsumer;
+  class UsedDeclsCollector;
+  class DeserializationStatsCollector;
 }
 
 // FIXME Levitation: move into levitation namespace
@@ -51,15 +51,27 @@ public:
 class LevitationBuildObjectAction : public ASTMergeAction {
   StringRef PreambleFileName;
   ASTConsumer *Consumer = nullptr;
+
+  /// Owned by ASTReader, set in early cutoff mode only.
+  levitation::UsedDeclsCollector *UsedDeclsCollector = nullptr;
+
+  /// Owned by ASTReader, set if -levitation-stats is given.
+  levitation::DeserializationStatsCollector *StatsCollector = nullptr;
+
+  /// Whether meta and derived files are written, clangd
+  /// only needs AST and doesn't write anything.
+  bool WriteOutputs;
 public:
 
   LevitationBuildObjectAction(
       std::unique_ptr<FrontendAction> &&AdaptedAction,
       StringRef preambleFileName,
-      ArrayRef<std::string> DependencyASTs
+      ArrayRef<std::string> DependencyASTs,
+      bool writeOutputs = true
   ) :
     ASTMergeAction(std::move(AdaptedAction), DependencyASTs),
-    PreambleFileName(preambleFileName)
+    PreambleFileName(preambleFileName),
+    WriteOutputs(writeOutputs)
   {}
 
   /// 1. Completes infrastructure for final AST, at this stage we should get created:
@@ -73,7 +85,8 @@ public:
   /// * CodeCompletion consumer (if any)
   /// * Sema
   ///
-  /// 2. Imports C++ Levitation dependencies (if any) by means of ASTImporter
+  /// 2. Loads C++ Levitation dependencies (if any) by means of ASTReader,
+  ///    nothing is imported with ASTImporter
   /// 3. Adds main AST contents:
   /// * If input file is AST, it is also to be loaded
   ///   (directly into main context)
@@ -100,6 +113,8 @@ protected:
   void loadASTFiles();
 
   void setupDeserializationListener(ASTReader &Reader);
+
+  void writeDependencyStats();
 };
 
 }  // end namespace clang
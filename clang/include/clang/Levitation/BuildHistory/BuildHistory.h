@@ -0,0 +1,215 @@
+//===--- BuildHistory.h - C++ BuildHistory class ----------------*- C++ -*-===//
+//
+// Part of the C++ Levitation Project,
+// under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file contains build history data class. Build history keeps
+//  durations and peak memory usage of build steps performed for each unit
+//  during previous builds, and how many times interface of each unit
+//  has changed.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_LEVITATION_BUILDHISTORY_H
+#define LLVM_LEVITATION_BUILDHISTORY_H
+
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+namespace clang { namespace levitation {
+
+  class BuildHistory {
+  public:
+
+    enum struct StepKind {
+      ParseImport = 0,
+      BuildDecl,
+      BuildObject,
+      NumKinds
+    };
+
+    static constexpr unsigned NumStepKinds = (unsigned)StepKind::NumKinds;
+
+    /// Duration in microseconds.
+    using DurationTy = uint64_t;
+
+    /// Peak resident set size in bytes.
+    using MemoryTy = uint64_t;
+
+  private:
+
+    /// Durations for each step kind, keyed by unit path.
+    llvm::StringMap<DurationTy> Durations[NumStepKinds];
+
+    /// Peak memory usage for each step kind, keyed by unit path.
+    /// Only recorded for steps run in subprocesses.
+    llvm::StringMap<MemoryTy> PeakMemory[NumStepKinds];
+
+    /// Number of builds which have changed unit interface,
+    /// keyed by unit path.
+    llvm::StringMap<unsigned> InterfaceChanges;
+
+  public:
+
+    BuildHistory() = default;
+
+    void setDuration(StepKind Kind, llvm::StringRef UnitPath, DurationTy D) {
+      Durations[(unsigned)Kind][UnitPath] = D;
+    }
+
+    llvm::Optional<DurationTy> getDuration(
+        StepKind Kind, llvm::StringRef UnitPath
+    ) const {
+      const auto &KindDurations = Durations[(unsigned)Kind];
+      auto Found = KindDurations.find(UnitPath);
+      if (Found == KindDurations.end())
+        return llvm::None;
+      return Found->second;
+    }
+
+    /// Average duration of all known steps of given kind,
+    /// or None if there were no such steps.
+    llvm::Optional<DurationTy> getAverageDuration(StepKind Kind) const {
+      const auto &KindDurations = Durations[(unsigned)Kind];
+      if (KindDurations.empty())
+        return llvm::None;
+
+      DurationTy Total = 0;
+      for (const auto &Item : KindDurations)
+        Total += Item.second;
+
+      return Total / KindDurations.size();
+    }
+
+    /// Duration which given percent of known steps of given kind
+    /// don't exceed, or None if there were no such steps.
+    llvm::Optional<DurationTy> getDurationPercentile(
+        StepKind Kind, unsigned Percent
+    ) const {
+      const auto &KindDurations = Durations[(unsigned)Kind];
+      if (KindDurations.empty())
+        return llvm::None;
+
+      std::vector<DurationTy> Sorted;
+      Sorted.reserve(KindDurations.size());
+      for (const auto &Item : KindDurations)
+        Sorted.push_back(Item.second);
+
+      size_t N = std::min<size_t>(
+          Sorted.size() * Percent / 100, Sorted.size() - 1
+      );
+      std::nth_element(Sorted.begin(), Sorted.begin() + N, Sorted.end());
+      return Sorted[N];
+    }
+
+    void setPeakMemory(StepKind Kind, llvm::StringRef UnitPath, MemoryTy M) {
+      PeakMemory[(unsigned)Kind][UnitPath] = M;
+    }
+
+    llvm::Optional<MemoryTy> getPeakMemory(
+        StepKind Kind, llvm::StringRef UnitPath
+    ) const {
+      const auto &KindMemory = PeakMemory[(unsigned)Kind];
+      auto Found = KindMemory.find(UnitPath);
+      if (Found == KindMemory.end())
+        return llvm::None;
+      return Found->second;
+    }
+
+    /// Average peak memory of all known steps of given kind,
+    /// or None if there were no such steps.
+    llvm::Optional<MemoryTy> getAveragePeakMemory(StepKind Kind) const {
+      const auto &KindMemory = PeakMemory[(unsigned)Kind];
+      if (KindMemory.empty())
+        return llvm::None;
+
+      MemoryTy Total = 0;
+      for (const auto &Item : KindMemory)
+        Total += Item.second;
+
+      return Total / KindMemory.size();
+    }
+
+    void addInterfaceChanges(llvm::StringRef UnitPath, unsigned N = 1) {
+      InterfaceChanges[UnitPath] += N;
+    }
+
+    unsigned getInterfaceChanges(llvm::StringRef UnitPath) const {
+      auto Found = InterfaceChanges.find(UnitPath);
+      return Found != InterfaceChanges.end() ? Found->second : 0;
+    }
+
+    /// Overrides existing durations and peak memory records
+    /// by records from Src, interface changes of Src are added.
+    void merge(const BuildHistory &Src) {
+      Src.forEach([&] (StepKind Kind, llvm::StringRef UnitPath, DurationTy D) {
+        setDuration(Kind, UnitPath, D);
+      });
+      Src.forEachPeakMemory(
+          [&] (StepKind Kind, llvm::StringRef UnitPath, MemoryTy M) {
+            setPeakMemory(Kind, UnitPath, M);
+          }
+      );
+      Src.forEachInterfaceChanges([&] (llvm::StringRef UnitPath, unsigned N) {
+        addInterfaceChanges(UnitPath, N);
+      });
+    }
+
+    void forEach(
+        std::function<void(StepKind, llvm::StringRef, DurationTy)> &&Fn
+    ) const {
+      for (unsigned Kind = 0; Kind != NumStepKinds; ++Kind)
+        for (const auto &Item : Durations[Kind])
+          Fn((StepKind)Kind, Item.first(), Item.second);
+    }
+
+    void forEachPeakMemory(
+        std::function<void(StepKind, llvm::StringRef, MemoryTy)> &&Fn
+    ) const {
+      for (unsigned Kind = 0; Kind != NumStepKinds; ++Kind)
+        for (const auto &Item : PeakMemory[Kind])
+          Fn((StepKind)Kind, Item.first(), Item.second);
+    }
+
+    void forEachInterfaceChanges(
+        std::function<void(llvm::StringRef, unsigned)> &&Fn
+    ) const {
+      for (const auto &Item : InterfaceChanges)
+        Fn(Item.first(), Item.second);
+    }
+
+    bool empty() const {
+      for (const auto &KindDurations : Durations)
+        if (!KindDurations.empty())
+          return false;
+      for (const auto &KindMemory : PeakMemory)
+        if (!KindMemory.empty())
+          return false;
+      return InterfaceChanges.empty();
+    }
+
+    static llvm::StringRef getStepKindName(StepKind Kind) {
+      switch (Kind) {
+        case StepKind::ParseImport:
+          return "parse-import";
+        case StepKind::BuildDecl:
+          return "decl-ast";
+        case StepKind::BuildObject:
+          return "object";
+        default:
+          return "<unknown>";
+      }
+    }
+  };
+}}
+
+#endif //LLVM_LEVITATION_BUILDHISTORY_H
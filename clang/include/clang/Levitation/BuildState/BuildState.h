@@ -0,0 +1,154 @@
+//===--- BuildState.h - C++ BuildState class --------------------*- C++ -*-===//
+//
+// Part of the C++ Levitation Project,
+// under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file contains build state data class. Build state keeps
+//  stamps and hashes of sources and products as they were after previous
+//  build, so that up-to-date checks don't need to load metas and rehash
+//  sources that were not touched since then.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_LEVITATION_BUILDSTATE_H
+#define LLVM_LEVITATION_BUILDSTATE_H
+
+#include "clang/Levitation/Common/Utility.h"
+
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/VirtualFileSystem.h"
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace clang { namespace levitation {
+
+  class BuildState {
+  public:
+
+    /// File properties which can be obtained with single stat call.
+    struct FileStamp {
+      /// Modification time, nanoseconds since epoch.
+      uint64_t MTime = 0;
+      uint64_t Size = 0;
+
+      bool operator==(const FileStamp &RHS) const {
+        return MTime == RHS.MTime && Size == RHS.Size;
+      }
+
+      bool operator!=(const FileStamp &RHS) const {
+        return !(*this == RHS);
+      }
+    };
+
+    /// Stamp of legacy header product was built from.
+    struct IncludeState {
+      std::string Path;
+
+      /// Empty stamp if header contents are not known to match
+      /// product meta, so that header is rechecked next time.
+      FileStamp Stamp;
+    };
+
+    /// State of product and its source as it was
+    /// after product was built or checked last time.
+    struct ProductState {
+      FileStamp Source;
+      HashVectorTy SourceHash;
+      FileStamp Product;
+
+      /// Hash of product, as it is recorded in product meta.
+      HashVectorTy ProductHash;
+
+      /// Headers recorded in product meta, see DeclASTMeta::getIncludes.
+      std::vector<IncludeState> Includes;
+
+      /// Compiler and flags fingerprint, as it is recorded in product meta.
+      HashVectorTy CommandHash;
+    };
+
+  private:
+
+    /// Products states, keyed by product path.
+    llvm::StringMap<ProductState> Products;
+
+  public:
+
+    BuildState() = default;
+
+    ProductState &set(llvm::StringRef ProductPath, ProductState State) {
+      auto &Item = Products[ProductPath];
+      Item = std::move(State);
+      return Item;
+    }
+
+    const ProductState *get(llvm::StringRef ProductPath) const {
+      auto Found = Products.find(ProductPath);
+      if (Found == Products.end())
+        return nullptr;
+      return &Found->second;
+    }
+
+    /// Overrides existing states by states from Src.
+    void merge(const BuildState &Src) {
+      Src.forEach([&] (llvm::StringRef ProductPath, const ProductState &S) {
+        set(ProductPath, S);
+      });
+    }
+
+    void forEach(
+        std::function<void(llvm::StringRef, const ProductState&)> &&Fn
+    ) const {
+      for (const auto &Item : Products)
+        Fn(Item.first(), Item.second);
+    }
+
+    bool empty() const { return Products.empty(); }
+
+    /// Same as getStamp(Path), but status is taken from given
+    /// file system, e.g. from driver's files cache.
+    static llvm::Optional<FileStamp> getStamp(
+        llvm::vfs::FileSystem &FS,
+        llvm::StringRef Path
+    ) {
+      auto Status = FS.status(Path);
+      if (!Status || !Status->exists())
+        return llvm::None;
+
+      FileStamp Stamp;
+      Stamp.MTime = std::chrono::duration_cast<std::chrono::nanoseconds>(
+          Status->getLastModificationTime().time_since_epoch()
+      ).count();
+      Stamp.Size = Status->getSize();
+      return Stamp;
+    }
+
+    static llvm::Optional<FileStamp> getStamp(llvm::StringRef Path) {
+      llvm::sys::fs::file_status Status;
+      if (llvm::sys::fs::status(Path, Status))
+        return llvm::None;
+
+      if (!llvm::sys::fs::exists(Status))
+        return llvm::None;
+
+      FileStamp Stamp;
+      Stamp.MTime = std::chrono::duration_cast<std::chrono::nanoseconds>(
+          Status.getLastModificationTime().time_since_epoch()
+      ).count();
+      Stamp.Size = Status.getSize();
+      return Stamp;
+    }
+  };
+}}
+
+#endif //LLVM_LEVITATION_BUILDSTATE_H
@@ -65,6 +65,12 @@ public:
     return get();
   }
 
+  /// \return whether instance was created, so that optional
+  /// facilities (e.g. workers) may be used if they are available.
+  static bool isCreated() {
+    return (bool)accessPtr();
+  }
+
   static DerivedTy &get() {
     auto &Ptr = accessPtr();
 
@@ -0,0 +1,111 @@
+//===--- C++ Levitation DependencyStats.h -----------------------*- C++ -*-===//
+//
+// Part of the C++ Levitation Project,
+// under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file defines dependencies deserialization stats. Frontend run
+//  with -levitation-stats counts what it deserialized from each
+//  dependency it loaded, and writes it as JSON, so that driver can tell
+//  which dependencies are expensive, and which are not used at all.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_CLANG_LEVITATION_DEPENDENCYSTATS_H
+#define LLVM_CLANG_LEVITATION_DEPENDENCYSTATS_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <string>
+#include <vector>
+
+namespace clang { namespace levitation {
+
+struct DependencyStats {
+
+  /// AST file stats are collected for.
+  std::string File;
+
+  uint64_t Decls = 0;
+  uint64_t Types = 0;
+  uint64_t Identifiers = 0;
+
+  /// Estimated size of declaration and type records read.
+  uint64_t Bytes = 0;
+
+  /// Time spent on loading file, in microseconds.
+  uint64_t LoadTime = 0;
+
+  bool isUnused() const { return !Decls && !Types; }
+
+  static void write(
+      llvm::raw_ostream &Out,
+      llvm::ArrayRef<DependencyStats> Stats
+  ) {
+    llvm::json::OStream J(Out, /*IndentSize=*/2);
+    J.object([&] {
+      J.attributeArray("dependencies", [&] {
+        for (const auto &S : Stats) {
+          J.object([&] {
+            J.attribute("file", S.File);
+            J.attribute("decls", (int64_t)S.Decls);
+            J.attribute("types", (int64_t)S.Types);
+            J.attribute("identifiers", (int64_t)S.Identifiers);
+            J.attribute("bytes", (int64_t)S.Bytes);
+            J.attribute("load_us", (int64_t)S.LoadTime);
+          });
+        }
+      });
+    });
+  }
+
+  /// \return false if contents is not a stats file.
+  static bool parse(
+      llvm::StringRef Contents,
+      std::vector<DependencyStats> &Stats
+  ) {
+    auto Parsed = llvm::json::parse(Contents);
+    if (!Parsed) {
+      llvm::consumeError(Parsed.takeError());
+      return false;
+    }
+
+    const auto *Root = Parsed->getAsObject();
+    const auto *Deps = Root ? Root->getArray("dependencies") : nullptr;
+    if (!Deps)
+      return false;
+
+    auto getUInt = [] (const llvm::json::Object &O, llvm::StringRef Key) {
+      auto V = O.getInteger(Key);
+      return uint64_t(V && *V > 0 ? *V : 0);
+    };
+
+    for (const auto &V : *Deps) {
+      const auto *D = V.getAsObject();
+      auto File = D ? D->getString("file") : llvm::None;
+      if (!File)
+        return false;
+
+      DependencyStats S;
+      S.File = File->str();
+      S.Decls = getUInt(*D, "decls");
+      S.Types = getUInt(*D, "types");
+      S.Identifiers = getUInt(*D, "identifiers");
+      S.Bytes = getUInt(*D, "bytes");
+      S.LoadTime = getUInt(*D, "load_us");
+      Stats.emplace_back(std::move(S));
+    }
+
+    return true;
+  }
+};
+
+}}
+
+#endif //LLVM_CLANG_LEVITATION_DEPENDENCYSTATS_H
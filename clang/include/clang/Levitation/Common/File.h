@@ -46,9 +46,51 @@ class File {
     SmallString<128> TempPath;
     std::unique_ptr<llvm::raw_fd_ostream> OutputStream;
     StatusEnum Status;
+
+    /// If set, existing file with same contents is left untouched,
+    /// so that its modification time is not bumped.
+    bool KeepIfUnchanged;
+    bool Unchanged = false;
   public:
-    File(StringRef targetFileName)
-      : TargetFileName(targetFileName), Status(Good) {}
+
+    using ObserverTy = void (*)(StringRef Path);
+
+    /// Observer is notified about files which are written or removed,
+    /// e.g. so that cached status of file is dropped. Not set by default.
+    static ObserverTy &observer() {
+      static ObserverTy Observer = nullptr;
+      return Observer;
+    }
+
+    /// Files changed by other means than File should be reported here.
+    static void notifyChanged(StringRef Path) {
+      if (auto O = observer())
+        O(Path);
+    }
+    File(StringRef targetFileName, bool keepIfUnchanged = false)
+      : TargetFileName(targetFileName),
+        Status(Good),
+        KeepIfUnchanged(keepIfUnchanged) {}
+
+    /// Compares sizes first, so that contents are only read
+    /// if files are likely the same.
+    static bool isSameContents(StringRef LHS, StringRef RHS) {
+      llvm::sys::fs::file_status LHSStatus, RHSStatus;
+      if (
+        llvm::sys::fs::status(LHS, LHSStatus) ||
+        llvm::sys::fs::status(RHS, RHSStatus) ||
+        !llvm::sys::fs::is_regular_file(RHSStatus) ||
+        LHSStatus.getSize() != RHSStatus.getSize()
+      )
+        return false;
+
+      auto LHSBuf = MemoryBuffer::getFile(LHS, -1, false);
+      auto RHSBuf = MemoryBuffer::getFile(RHS, -1, false);
+
+      return
+          LHSBuf && RHSBuf &&
+          LHSBuf.get()->getBuffer() == RHSBuf.get()->getBuffer();
+    }
 
     // TODO Levitation: we could introduce some generic template,
     //   something like scope_exit, but with ability to convert it to bool.
@@ -91,10 +133,22 @@ class File {
         Status = HasStreamErrors;
       }
 
+      if (
+        Status == Good && KeepIfUnchanged &&
+        isSameContents(TempPath, TargetFileName)
+      ) {
+        llvm::sys::fs::remove(TempPath);
+        Unchanged = true;
+        return;
+      }
+
       if (llvm::sys::fs::rename(TempPath, TargetFileName)) {
         llvm::sys::fs::remove(TempPath);
         Status = FiledToRename;
+        return;
       }
+
+      notifyChanged(TargetFileName);
     }
 
     bool hasErrors() const {
@@ -105,6 +159,9 @@ class File {
       return Status;
     }
 
+    /// Whether existing file was kept, since it had same contents.
+    bool isUnchanged() const { return Unchanged; }
+
     StringRef getPath() const { return TargetFileName; }
   };
 
@@ -17,14 +17,18 @@
 
 #include "clang/Basic/FileManager.h"
 #include "clang/Levitation/Common/CreatableSingleton.h"
+#include "clang/Levitation/Common/File.h"
 #include "clang/Levitation/Common/Path.h"
 #include "clang/Levitation/Common/SimpleLogger.h"
+#include "clang/Levitation/TasksManager/TasksManager.h"
 
 #include "llvm/ADT/StringRef.h"
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/VirtualFileSystem.h"
 #include "llvm/Support/Path.h"
 #include <memory>
+#include <utility>
+#include <vector>
 
 namespace llvm {
   class raw_ostream;
@@ -86,8 +90,81 @@ public:
     }
   }
 
+  /// Same as collectFiles, but directories of each level are listed
+  /// concurrently on tasks manager pool. Result has the same order
+  /// as collectFiles would give.
+  template <typename FilesVectorTy>
+  static void collectFilesParallel(
+      FilesVectorTy &Files,
+      llvm::StringRef Root,
+      llvm::StringRef Extension,
+      std::initializer_list<StringRef> IgnoreDirs = {}
+  ) {
+    auto &FM = CreatableSingleton<FileManager>::get();
+    auto &FS = FM.getVirtualFileSystem();
+    auto &TM = tasks::TasksManager::get();
+
+    SmallVector<SinglePath, 2> IgnoreDirsAbsVec;
+    DenseSet<StringRef> IgnoreDirsAbs;
+
+    // Keep StringRefs in IgnoreDirsAbs valid.
+    IgnoreDirsAbsVec.reserve(IgnoreDirs.size());
+
+    for (auto IgnoreDir : IgnoreDirs) {
+      auto IgnoreDirAbs = Path::makeAbsolute<SinglePath>(IgnoreDir);
+      IgnoreDirsAbsVec.push_back(std::move(IgnoreDirAbs));
+      IgnoreDirsAbs.insert(IgnoreDirsAbsVec.back().str());
+    }
+
+    std::string FileExtension = ".";
+    FileExtension += Extension;
+
+    using DirItems = std::vector<SinglePath>;
+
+    // Files and subdirectories found in particular directory.
+    using Listing = std::pair<DirItems, DirItems>;
+
+    DirItems SubDirs;
+    SubDirs.push_back(Root);
+
+    while (SubDirs.size()) {
+      std::vector<Listing> Listings(SubDirs.size());
+
+      for (size_t i = 0, e = SubDirs.size(); i != e; ++i) {
+        llvm::StringRef CurDir = SubDirs[i];
+
+        if (
+          !IgnoreDirsAbs.empty() &&
+          IgnoreDirsAbs.count(Path::makeAbsolute<SinglePath>(CurDir))
+        )
+          continue;
+
+        Listing *L = &Listings[i];
+        TM.runTask([=, &FS] (tasks::TasksManager::TaskContext &TC) {
+          collectFilesWithExtension(
+              L->first, L->second, FS, CurDir, FileExtension
+          );
+          TC.Successful = true;
+        });
+      }
+
+      TM.waitForTasks();
+
+      DirItems NewSubDirs;
+      for (auto &L : Listings) {
+        for (auto &F : L.first)
+          Files.push_back(F);
+        for (auto &D : L.second)
+          NewSubDirs.push_back(std::move(D));
+      }
+
+      SubDirs.swap(NewSubDirs);
+    }
+  }
+
   static void copy(StringRef Src, StringRef Dest) {
     llvm::sys::fs::copy_file(Src, Dest);
+    File::notifyChanged(Dest);
   }
 
 protected:
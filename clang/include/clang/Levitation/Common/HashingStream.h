@@ -0,0 +1,228 @@
+//===--- C++ Levitation HashingStream.h -------------------------*- C++ -*-===//
+//
+// Part of the C++ Levitation Project,
+// under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file defines incremental hash and output stream which hashes
+//  written bytes on the fly, so that output hash is known once output
+//  is written, without holding output in memory or reading it back.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_CLANG_LEVITATION_HASHINGSTREAM_H
+#define LLVM_CLANG_LEVITATION_HASHINGSTREAM_H
+
+#include "clang/Levitation/Common/Utility.h"
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <cstring>
+#include <memory>
+
+namespace clang { namespace levitation {
+
+/// Calculates hash of data given by parts,
+/// results are same as calcHash gives for whole data.
+class IncrementalHash {
+  HashKind Kind;
+
+  llvm::MD5 MD5;
+
+  // XXH64 state, same algorithm as llvm::xxHash64 with zero seed.
+  static const uint64_t PRIME64_1 = 11400714785074694791ULL;
+  static const uint64_t PRIME64_2 = 14029467366897019727ULL;
+  static const uint64_t PRIME64_3 = 1609587929392839161ULL;
+  static const uint64_t PRIME64_4 = 9650029242287828579ULL;
+  static const uint64_t PRIME64_5 = 2870177450012600261ULL;
+
+  uint64_t V[4] = {
+    PRIME64_1 + PRIME64_2, PRIME64_2, 0, (uint64_t)0 - PRIME64_1
+  };
+  uint8_t Tail[32];
+  size_t TailSize = 0;
+  uint64_t Length = 0;
+
+  static uint64_t rotl64(uint64_t X, size_t R) {
+    return (X << R) | (X >> (64 - R));
+  }
+
+  static uint64_t round(uint64_t Acc, uint64_t Input) {
+    Acc += Input * PRIME64_2;
+    Acc = rotl64(Acc, 31);
+    Acc *= PRIME64_1;
+    return Acc;
+  }
+
+  static uint64_t mergeRound(uint64_t Acc, uint64_t Val) {
+    Val = round(0, Val);
+    Acc ^= Val;
+    Acc = Acc * PRIME64_1 + PRIME64_4;
+    return Acc;
+  }
+
+  void consumeStripe(const uint8_t *P) {
+    using namespace llvm::support;
+    for (unsigned i = 0; i != 4; ++i, P += 8)
+      V[i] = round(V[i], endian::read64le(P));
+  }
+
+  void updateXXH64(llvm::StringRef Data) {
+    const uint8_t *P = Data.bytes_begin();
+    const uint8_t *const End = Data.bytes_end();
+    Length += Data.size();
+
+    if (TailSize) {
+      size_t Fill = std::min<size_t>(sizeof(Tail) - TailSize, End - P);
+      std::memcpy(Tail + TailSize, P, Fill);
+      TailSize += Fill;
+      P += Fill;
+
+      if (TailSize != sizeof(Tail))
+        return;
+
+      consumeStripe(Tail);
+      TailSize = 0;
+    }
+
+    for (; End - P >= (ptrdiff_t)sizeof(Tail); P += sizeof(Tail))
+      consumeStripe(P);
+
+    std::memcpy(Tail, P, End - P);
+    TailSize = End - P;
+  }
+
+  uint64_t finalXXH64() const {
+    using namespace llvm::support;
+
+    uint64_t H64;
+    if (Length >= sizeof(Tail)) {
+      H64 = rotl64(V[0], 1) + rotl64(V[1], 7) +
+            rotl64(V[2], 12) + rotl64(V[3], 18);
+      for (auto Vi : V)
+        H64 = mergeRound(H64, Vi);
+    } else {
+      H64 = PRIME64_5;
+    }
+
+    H64 += Length;
+
+    const uint8_t *P = Tail;
+    const uint8_t *const End = Tail + TailSize;
+
+    for (; P + 8 <= End; P += 8) {
+      H64 ^= round(0, endian::read64le(P));
+      H64 = rotl64(H64, 27) * PRIME64_1 + PRIME64_4;
+    }
+
+    if (P + 4 <= End) {
+      H64 ^= (uint64_t)(endian::read32le(P)) * PRIME64_1;
+      H64 = rotl64(H64, 23) * PRIME64_2 + PRIME64_3;
+      P += 4;
+    }
+
+    for (; P != End; ++P) {
+      H64 ^= (*P) * PRIME64_5;
+      H64 = rotl64(H64, 11) * PRIME64_1;
+    }
+
+    H64 ^= H64 >> 33;
+    H64 *= PRIME64_2;
+    H64 ^= H64 >> 29;
+    H64 *= PRIME64_3;
+    H64 ^= H64 >> 32;
+
+    return H64;
+  }
+
+public:
+
+  IncrementalHash(HashKind kind) : Kind(kind) {}
+
+  HashKind getKind() const { return Kind; }
+
+  void update(llvm::StringRef Data) {
+    switch (Kind) {
+      case HashKind::MD5:
+        MD5.update(Data);
+        break;
+      case HashKind::XXH64:
+        updateXXH64(Data);
+        break;
+    }
+  }
+
+  /// Finishes hashing, no updates are allowed after that.
+  HashVectorTy final() {
+    HashVectorTy Res;
+    switch (Kind) {
+      case HashKind::MD5: {
+        llvm::MD5::MD5Result MD5Res;
+        MD5.final(MD5Res);
+        Res.assign(MD5Res.Bytes.begin(), MD5Res.Bytes.end());
+        break;
+      }
+      case HashKind::XXH64:
+        Res.resize(sizeof(uint64_t));
+        llvm::support::endian::write64le(Res.data(), finalXXH64());
+        break;
+    }
+    return Res;
+  }
+};
+
+struct HashingOStreamState {
+  IncrementalHash Hash;
+
+  /// Whether output was written sequentially.
+  bool Valid = true;
+
+  HashingOStreamState(HashKind Kind) : Hash(Kind) {}
+};
+
+/// Passes written bytes to underlying stream and to hash.
+/// Stream is unbuffered, so hash is complete once writer is done,
+/// regardless of when underlying stream is flushed.
+///
+/// Hash is only valid for outputs written sequentially,
+/// once pwrite patches already written bytes, it is dropped,
+/// and output should be hashed as file.
+class HashingOStream : public llvm::raw_pwrite_stream {
+  std::unique_ptr<llvm::raw_pwrite_stream> Out;
+  std::shared_ptr<HashingOStreamState> S;
+
+  void write_impl(const char *Ptr, size_t Size) override {
+    S->Hash.update(llvm::StringRef(Ptr, Size));
+    Out->write(Ptr, Size);
+  }
+
+  void pwrite_impl(const char *Ptr, size_t Size, uint64_t Offset) override {
+    S->Valid = false;
+    Out->pwrite(Ptr, Size, Offset);
+  }
+
+  uint64_t current_pos() const override { return Out->tell(); }
+
+public:
+
+  HashingOStream(
+      std::unique_ptr<llvm::raw_pwrite_stream> out,
+      std::shared_ptr<HashingOStreamState> s
+  )
+  : raw_pwrite_stream(/*Unbuffered=*/true),
+    Out(std::move(out)), S(std::move(s)) {}
+
+  ~HashingOStream() override {
+    flush();
+  }
+};
+
+}}
+
+#endif //LLVM_CLANG_LEVITATION_HASHINGSTREAM_H
@@ -15,8 +15,15 @@
 #define LLVM_CLANG_LEVITATION_INDEXEDSET_H
 
 #include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/iterator_range.h"
+#include "llvm/Support/Allocator.h"
 
-#include <map>
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <utility>
+#include <vector>
 
 namespace clang { namespace levitation {
 
@@ -28,28 +35,30 @@ namespace clang { namespace levitation {
   /// The advantage is that ID type is known to IndexedSet user and thus
   /// it is easier to serialize it and perform some other manipulations.
   ///
+  /// Items are strings. They are copied into arena once, both hash table
+  /// and IDs table refer to them. IDs are indices in IDs table,
+  /// so getItem is an array lookup.
+  ///
   /// \tparam IdTy type of identifier number, it should be integer
   ///     or at least mimic integer type behaviour
   ///    (by means of overloaded operators and so on).
-  /// \tparam ItemTy type of items to be stored in set.
-  ///
-  /// \tparam ItemRefTy type of item reference, if provided allows
-  ///    to reduce memory required by index collection.
-  template <typename IdTy, typename ItemTy, typename ItemRefTy = ItemTy>
+  template <typename IdTy>
   class IndexedSet {
 
-      // TODO Levitation: so far, I give up and use std::map.
-      typedef typename std::map<ItemTy, IdTy> SetTy;
-      typedef typename SetTy::iterator set_iterator;
-
-      typedef typename llvm::DenseMap<IdTy, ItemTy> IndexTy;
-      typedef typename IndexTy::const_iterator const_iterator;
+      typedef typename llvm::DenseMap<llvm::StringRef, IdTy> SetTy;
+      typedef std::pair<IdTy, llvm::StringRef> IndexItemTy;
+      typedef std::vector<IndexItemTy> IndexTy;
 
+      llvm::BumpPtrAllocator Arena;
 
       SetTy Set;
+
+      // Item with null data is absent, since IDs may be assigned
+      // explicitly and have gaps. Zero slot is reserved for invalid ID.
       IndexTy Index;
 
-      IdTy LastIndex;
+      // Frozen set has no hash table, it is rebuilt by next addItem.
+      bool Frozen = false;
 
       static IdTy getInvalidIndex() {
         static IdTy Invalid = IdTy();
@@ -59,70 +68,148 @@ namespace clang { namespace levitation {
   public:
 
       typedef IdTy key_type;
-      typedef ItemTy value_type;
-
-      IndexedSet() : LastIndex(getInvalidIndex()) {}
+      typedef llvm::StringRef value_type;
+
+      /// Iterates over present items, (ID, item) pairs.
+      class const_iterator {
+        typename IndexTy::const_iterator Cur, End;
+
+        void skipAbsent() {
+          while (Cur != End && !Cur->second.data())
+            ++Cur;
+        }
+
+      public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef IndexItemTy value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const IndexItemTy* pointer;
+        typedef const IndexItemTy& reference;
+
+        const_iterator(
+            typename IndexTy::const_iterator cur,
+            typename IndexTy::const_iterator end
+        ) : Cur(cur), End(end) {
+          skipAbsent();
+        }
+
+        reference operator*() const { return *Cur; }
+        pointer operator->() const { return &*Cur; }
+
+        const_iterator &operator++() {
+          ++Cur;
+          skipAbsent();
+          return *this;
+        }
+
+        bool operator==(const const_iterator &RHS) const {
+          return Cur == RHS.Cur;
+        }
+
+        bool operator!=(const const_iterator &RHS) const {
+          return Cur != RHS.Cur;
+        }
+      };
+
+      IndexedSet() : Index(1, IndexItemTy(getInvalidIndex(), llvm::StringRef())) {}
+
+      IndexedSet(const IndexedSet&) = delete;
+      IndexedSet &operator=(const IndexedSet&) = delete;
 
       llvm::iterator_range<const_iterator> items() const {
-        return llvm::iterator_range<const_iterator>(Index.begin(), Index.end());
+        return llvm::iterator_range<const_iterator>(
+            const_iterator(Index.begin(), Index.end()),
+            const_iterator(Index.end(), Index.end())
+        );
       }
 
-      bool addItem(IdTy Id, const ItemTy& Item) {
-        auto Res = Set.emplace(Item, Id);
+      /// Adds item with given ID, used by deserialization.
+      /// \return false if item is already present.
+      bool addItem(IdTy Id, llvm::StringRef Item) {
+        thaw();
+
+        auto Res = Set.insert({ Item, Id });
 
         if (!Res.second)
           return false;
 
-        setIndex(Id, Item);
+        if (Index.size() <= (size_t)Id)
+          Index.resize((size_t)Id + 1);
 
+        if (Index[Id].second.data())
+          llvm_unreachable("Index should be new");
+
+        setIndex(Res.first, Id);
         return true;
       }
 
-      IdTy addItem(ItemTy&& Item) {
-        auto Res = Set.emplace(std::move(Item), getInvalidIndex());
-
-        if (Res.second)
-          return addIndex(Res.first);
+      IdTy addItem(llvm::StringRef Item) {
+        thaw();
 
-        return Res.first->second;
-      }
-
-      IdTy addItem(const ItemTy& Item) {
         auto Res = Set.insert({ Item, getInvalidIndex() });
 
-        if (Res.second)
-          return addIndex(Res.first);
+        if (!Res.second)
+          return Res.first->second;
+
+        IdTy NewIndex = (IdTy)Index.size();
+        Index.emplace_back();
 
-        return Res.first->second;
+        setIndex(Res.first, NewIndex);
+        return NewIndex;
       }
 
-      const ItemTy* getItem(const IdTy &Id) const {
-        const auto Found = Index.find(Id);
-        if (Found != Index.end())
-          return &Found->second;
+      const llvm::StringRef* getItem(const IdTy &Id) const {
+        if ((size_t)Id < Index.size() && Index[Id].second.data())
+          return &Index[Id].second;
 
         return nullptr;
       }
 
+      /// Releases hash table, so that only items and IDs table remain.
+      /// Set is read-only until next addItem, which rebuilds the table.
+      /// getItem doesn't depend on hash table and may be called
+      /// from any thread without locks, unless set is modified.
+      void freeze() {
+        if (Frozen)
+          return;
+
+        SetTy Empty;
+        Set.swap(Empty);
+        Frozen = true;
+      }
+
+      bool isFrozen() const {
+        return Frozen;
+      }
+
   private:
 
-      IdTy addIndex(set_iterator &SetIt) {
-        IdTy NewIndex = LastIndex + 1;
+      void thaw() {
+        if (!Frozen)
+          return;
 
-        SetIt->second = NewIndex;
-        Index.insert({ NewIndex, ItemRefTy(SetIt->first) });
+        Set.reserve(Index.size());
+        for (const auto &Item : items())
+          Set.insert({ Item.second, Item.first });
 
-        LastIndex = NewIndex;
-        return LastIndex;
+        Frozen = false;
       }
 
-      void setIndex(IdTy NewIndex, const ItemTy &Item) {
-        auto Res = Index.insert({ NewIndex, ItemRefTy(Item) });
-        if (!Res.second)
-          llvm_unreachable("Index should be new");
+      /// Copies new item into arena, so that set key refers to it as well.
+      void setIndex(typename SetTy::iterator SetIt, IdTy NewIndex) {
+        llvm::StringRef Item = SetIt->first;
+
+        // Always allocate at least one byte, null data means absent item.
+        char *Data = Arena.Allocate<char>(std::max<size_t>(Item.size(), 1));
+        std::memcpy(Data, Item.data(), Item.size());
+
+        llvm::StringRef Stored(Data, Item.size());
+
+        // Same hash and equal, so key may be safely replaced in place.
+        const_cast<llvm::StringRef&>(SetIt->first) = Stored;
+        SetIt->second = NewIndex;
 
-        if (LastIndex <= NewIndex)
-          LastIndex = NewIndex + 1;
+        Index[NewIndex] = { NewIndex, Stored };
       }
   };
 
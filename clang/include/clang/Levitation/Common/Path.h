@@ -39,7 +39,7 @@ using namespace llvm;
   // TODO Levitation: rename to Path
   using SinglePath = llvm::SmallString<256>;
   using Paths = llvm::SmallVector<SinglePath, 64>;
-  using PathsPoolTy = StringsPool<256>;
+  using PathsPoolTy = StringsPool;
   using PathIDsSet = DenseSet<StringID>;
 
   // TODO Levitation: rename to PathUtils
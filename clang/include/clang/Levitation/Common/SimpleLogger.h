@@ -9,6 +9,12 @@
 //
 //  This file defines C++ Levitation very simple Logger class.
 //
+//  Level is checked before message is formatted, so manipulators passed
+//  to disabled level are never run, and LEVITATION_LOG macros don't even
+//  evaluate their arguments. In buffered mode verbose and trace messages
+//  are formatted into per thread buffers without locking, and written
+//  out in batches.
+//
 //===----------------------------------------------------------------------===//
 
 #ifndef LLVM_CLANG_LEVITATION_SIMPLELOGGER_H
@@ -17,10 +23,28 @@
 #include "clang/Levitation/Common/WithOperator.h"
 
 #include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallString.h"
 #include "llvm/Support/raw_ostream.h"
+#include <atomic>
 #include <memory>
 #include <mutex>
 #include <functional>
+
+/// Logs message only if level is enabled, arguments are not evaluated
+/// otherwise. Use it whenever arguments are expensive to build.
+#define LEVITATION_LOG(LOG, LEVEL, ...) \
+  do { \
+    auto &LevitationLog_ = (LOG); \
+    if (LevitationLog_.isEnabled(LEVEL)) \
+      LevitationLog_.log(LEVEL, __VA_ARGS__); \
+  } while (false)
+
+#define LEVITATION_LOG_VERBOSE(LOG, ...) \
+  LEVITATION_LOG(LOG, ::clang::levitation::log::Level::Verbose, __VA_ARGS__)
+
+#define LEVITATION_LOG_TRACE(LOG, ...) \
+  LEVITATION_LOG(LOG, ::clang::levitation::log::Level::Trace, __VA_ARGS__)
+
 namespace clang { namespace levitation { namespace log {
 
 enum class Level {
@@ -51,10 +75,41 @@ using manipulator_t = std::function<void(llvm::raw_ostream &out)>;
 ///  }
 
 class Logger {
-  Level LogLevel;
+public:
+  /// Receives messages once they're formatted, see setSink.
+  using sink_t = std::function<void(Level, llvm::StringRef)>;
+
+private:
+  std::atomic<Level> LogLevel;
   llvm::raw_ostream &Out;
   std::mutex Locker;
 
+  std::atomic<bool> Buffered { false };
+
+  sink_t Sink;
+
+  /// Whether status line is shown, see setStatus.
+  bool StatusShown = false;
+
+  /// Buffer is written out once it grows over this size.
+  static constexpr size_t FlushThreshold = 16 * 1024;
+
+  /// Messages of current thread, not yet written out.
+  /// Remaining part is written out once thread exits.
+  struct ThreadBuffer {
+    llvm::SmallString<256> Data;
+
+    ~ThreadBuffer() {
+      if (Data.size() && accessLoggerPtr())
+        accessLoggerPtr()->flushBuffer(*this);
+    }
+  };
+
+  static ThreadBuffer &getThreadBuffer() {
+    static thread_local ThreadBuffer Buffer;
+    return Buffer;
+  }
+
   Logger(Level LogLevel, llvm::raw_ostream &Out)
   : LogLevel(LogLevel), Out(Out)
   {}
@@ -72,6 +127,9 @@ public:
     llvm::raw_ostream &Out = LogLevel > Level::Warning ?
         llvm::outs() : llvm::errs();
 
+    if (accessLoggerPtr())
+      accessLoggerPtr()->flush();
+
     accessLoggerPtr() = std::unique_ptr<Logger>(new Logger(LogLevel, Out));
 
     return get();
@@ -81,6 +139,57 @@ public:
     LogLevel = L;
   }
 
+  bool isEnabled(Level L) const {
+    return L != Level::Null && L <= LogLevel;
+  }
+
+  /// In buffered mode verbose and trace messages are kept in per thread
+  /// buffer, and only buffer flush takes the lock. Messages of same
+  /// thread keep their order, while messages of different threads are
+  /// interleaved by batches. Other messages flush buffer of their
+  /// thread, and are written out immediately.
+  void setBuffered(bool V) {
+    if (!V)
+      flush();
+    Buffered = V;
+  }
+
+  /// Passes each enabled message to Sink as well, e.g. to report
+  /// driver diagnostics to library client. Messages of scopes are
+  /// only written out. Sink is called under logger lock, so it should
+  /// not log itself. It should be set while nothing is logged.
+  void setSink(sink_t S) {
+    auto _ = lockFlushed();
+    Sink = std::move(S);
+  }
+
+  /// Whether messages go to terminal.
+  bool isDisplayed() const {
+    return Out.is_displayed();
+  }
+
+  /// Shows single status line at the bottom of terminal output, in place
+  /// of previous one. Messages erase it, and new status line is shown
+  /// below them once it is set again. Should only be used if output
+  /// is displayed.
+  void setStatus(llvm::StringRef Line) {
+    auto _ = lockFlushed();
+    (Out << "\r" << Line << "\x1b[K").flush();
+    StatusShown = true;
+  }
+
+  void clearStatus() {
+    auto _ = lockFlushed();
+    Out.flush();
+  }
+
+  /// Writes out messages buffered by current thread.
+  void flush() {
+    auto &Buffer = getThreadBuffer();
+    if (Buffer.Data.size())
+      flushBuffer(Buffer);
+  }
+
   static Logger &get() {
     auto &LoggerPtr = accessLoggerPtr();
     assert(LoggerPtr && "Logger should be created");
@@ -130,7 +239,10 @@ public:
     llvm::raw_ostream &s;
 
     Scope(Logger &log, Level level)
-    : lock(log.lock()),
+    : lock(
+        log.isEnabled(level) ?
+        log.lockFlushed() : std::unique_lock<std::mutex>()
+      ),
       s(log.getStream(level))
     {}
 
@@ -144,40 +256,114 @@ public:
     }
   };
 
+  /// Scope which body is skipped if level is disabled, so that nothing
+  /// is formatted for nothing. Body should only do logging.
+  class LazyScope : public Scope {
+    bool Enabled;
+  public:
+    LazyScope(Logger &log, Level level)
+    : Scope(log, level), Enabled(log.isEnabled(level))
+    {}
+
+    LazyScope(LazyScope &&dying) = default;
+
+    operator bool() const { return Enabled; }
+  };
+
   Scope acquire(Level level) {
     Scope scope(*this, level);
     return scope;
   }
 
+  LazyScope acquireIfEnabled(Level level) {
+    LazyScope scope(*this, level);
+    return scope;
+  }
+
 protected:
 
   template <typename ...ArgsT>
   void logImpl(Level level, ArgsT &&...args) {
+    if (!isEnabled(level))
+      return;
+
+    if (Sink) {
+      llvm::SmallString<256> Message;
+      {
+        llvm::raw_svector_ostream MessageOut(Message);
+        logSuffix(MessageOut, args...);
+      }
+      auto _ = lock();
+      Sink(level, Message);
+    }
+
+    if (Buffered && level > Level::Info) {
+      auto &Buffer = getThreadBuffer();
+      {
+        llvm::raw_svector_ostream BufferOut(Buffer.Data);
+        logSuffix(BufferOut, std::forward<ArgsT>(args)...);
+        BufferOut << "\n";
+      }
+      if (Buffer.Data.size() >= FlushThreshold)
+        flushBuffer(Buffer);
+      return;
+    }
+
+    auto _ = lockFlushed();
+    logSuffix(Out, std::forward<ArgsT>(args)...);
+    (Out << "\n").flush();
+  }
+
+  /// Locks output, and writes out messages buffered
+  /// by current thread, so that they go before new ones.
+  std::unique_lock<std::mutex> lockFlushed() {
+    auto Lock = lock();
+    eraseStatus();
+    auto &Buffer = getThreadBuffer();
+    if (Buffer.Data.size()) {
+      Out << Buffer.Data;
+      Buffer.Data.clear();
+    }
+    return Lock;
+  }
+
+  /// Should be called under lock, before anything is written.
+  void eraseStatus() {
+    if (!StatusShown)
+      return;
+    Out << "\r\x1b[K";
+    StatusShown = false;
+  }
+
+  void flushBuffer(ThreadBuffer &Buffer) {
     auto _ = lock();
-    logSuffix(level, std::forward<ArgsT>(args)...);
-    (getStream(level) << "\n").flush();
+    eraseStatus();
+    (Out << Buffer.Data).flush();
+    Buffer.Data.clear();
   }
 
-  void logSuffix(Level level) {
+  static void logSuffix(llvm::raw_ostream &S) {
   }
 
-  void logSuffix(Level level, manipulator_t Arg) {
-    Arg(getStream(level));
+  static void logSuffix(llvm::raw_ostream &S, const manipulator_t &Arg) {
+    Arg(S);
   }
 
   template <typename FirstArgT>
-  void logSuffix(Level level, FirstArgT Arg) {
-    getStream(level) << Arg;
+  static void logSuffix(llvm::raw_ostream &S, const FirstArgT &Arg) {
+    S << Arg;
   }
 
   template <typename FirstArgT, typename ...ArgsT>
-  void logSuffix(Level level, FirstArgT first, ArgsT&&...args) {
-    logSuffix(level, first);
-    logSuffix(level, std::forward<ArgsT>(args)...);
+  static void logSuffix(
+      llvm::raw_ostream &S, const FirstArgT &first, ArgsT&&...args
+  ) {
+    logSuffix(S, first);
+    logSuffix(S, std::forward<ArgsT>(args)...);
   }
 
   llvm::raw_ostream &getStream(Level ForLevel) {
-    if (ForLevel <= LogLevel)
+    if (isEnabled(ForLevel))
       return Out;
     return llvm::nulls();
   }
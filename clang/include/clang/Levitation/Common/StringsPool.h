@@ -16,14 +16,12 @@
 #define LLVM_CLANG_LEVITATION_STRINGSPOOL_H
 
 #include "clang/Levitation/Common/IndexedSet.h"
-#include "llvm/ADT/SmallString.h"
 
 namespace clang { namespace levitation {
 
 using StringID = uint32_t;
 
-template<unsigned N>
-using StringsPool = IndexedSet<StringID, llvm::SmallString<N> >;
+using StringsPool = IndexedSet<StringID>;
 
 }}
 
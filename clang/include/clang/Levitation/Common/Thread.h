@@ -14,8 +14,19 @@
 #ifndef LLVM_CLANG_LEVITATION_THREAD_H
 #define LLVM_CLANG_LEVITATION_THREAD_H
 
+#include "llvm/Config/llvm-config.h"
+
 #include <mutex>
 
+#ifdef LLVM_ON_UNIX
+#include <sys/resource.h>
+#endif
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 namespace clang { namespace levitation {
 
 using MutexLock = std::unique_lock<std::mutex>;
@@ -23,6 +34,26 @@ inline MutexLock lock(std::mutex &M) {
   return MutexLock(M);
 }
 
+/// Lowers CPU and I/O priority of given process. On Linux Pid 0
+/// means calling thread only, elsewhere it means whole process.
+/// Does nothing where priorities are not supported.
+inline void lowerPriority(int Pid = 0) {
+#ifdef LLVM_ON_UNIX
+  setpriority(PRIO_PROCESS, Pid, 10);
+#endif
+#if defined(__linux__) && defined(SYS_ioprio_set)
+  // Lowest level of best-effort class, unlike idle class it
+  // still gets disk time while disk is busy.
+  const int IOPRIO_WHO_PROCESS = 1;
+  const int IOPRIO_CLASS_BE = 2;
+  const int IOPRIO_CLASS_SHIFT = 13;
+  syscall(
+      SYS_ioprio_set, IOPRIO_WHO_PROCESS, Pid,
+      (IOPRIO_CLASS_BE << IOPRIO_CLASS_SHIFT) | 7
+  );
+#endif
+}
+
 }}
 
 #endif //LLVM_CLANG_LEVITATION_THREAD_H
@@ -15,15 +15,24 @@
 #define LLVM_CLANG_LEVITATION_UTILITY_H
 
 #include "clang/Basic/FileManager.h"
+#include "clang/Basic/SourceManager.h"
 #include "clang/Levitation/Common/StringBuilder.h"
 #include "clang/Levitation/Common/CreatableSingleton.h"
 
 #include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
 #include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/FileSystem.h"
 #include "llvm/Support/MD5.h"
+#include "llvm/Support/xxhash.h"
 
 
 #include <algorithm>
+#include <chrono>
+#include <string>
 #include <utility>
 
 namespace clang { namespace levitation {
@@ -53,6 +62,130 @@ static inline bool calcMD5FromFile(
     return false;
 }
 
+/// Algorithms source and output hashes are calculated with.
+/// Values are stored in meta files, so they should never be changed.
+enum class HashKind : uint8_t {
+  MD5 = 0,
+
+  /// Non-cryptographic 64 bit hash, several times faster than MD5,
+  /// which matters for large declaration ASTs.
+  XXH64 = 1
+};
+
+static inline llvm::StringRef getHashKindName(HashKind Kind) {
+  switch (Kind) {
+    case HashKind::MD5: return "md5";
+    case HashKind::XXH64: return "xxh64";
+  }
+  llvm_unreachable("Unknown hash kind.");
+}
+
+/// \return false if Name is not a known hash algorithm.
+static inline bool parseHashKind(llvm::StringRef Name, HashKind &Kind) {
+  for (auto K : { HashKind::MD5, HashKind::XXH64 }) {
+    if (Name == getHashKindName(K)) {
+      Kind = K;
+      return true;
+    }
+  }
+  return false;
+}
+
+static inline HashVectorTy calcHash(HashKind Kind, llvm::StringRef Buff) {
+  HashVectorTy Res;
+  switch (Kind) {
+    case HashKind::MD5: {
+      auto MD5 = calcMD5(Buff);
+      Res.assign(MD5.Bytes.begin(), MD5.Bytes.end());
+      break;
+    }
+    case HashKind::XXH64: {
+      Res.resize(sizeof(uint64_t));
+      llvm::support::endian::write64le(Res.data(), llvm::xxHash64(Buff));
+      break;
+    }
+  }
+  return Res;
+}
+
+static inline bool calcHashFromFile(
+    FileManager &FM,
+    HashKind Kind,
+    HashVectorTy &Res,
+    llvm::StringRef FileName
+) {
+  if (auto Buffer = FM.getBufferForFile(FileName)) {
+    Res = calcHash(Kind, Buffer.get()->getBuffer());
+    return true;
+  }
+  return false;
+}
+
+/// Source digest is passed by driver to frontend jobs, so that each
+/// source is hashed once per build. Digest keeps size and modification
+/// time (ns since epoch) source had when it was hashed, and it is
+/// only trusted while source still has them.
+static inline std::string formatSourceDigest(
+    HashRef Hash, uint64_t Size, uint64_t MTime
+) {
+  return (
+      llvm::toHex(Hash, /*LowerCase=*/true) + ":" +
+      llvm::Twine(Size) + ":" + llvm::Twine(MTime)
+  ).str();
+}
+
+/// \return false if digest is malformed, was calculated by other
+/// algorithm, or if file was touched since digest was calculated.
+/// In this case file should be hashed as usual.
+static inline bool parseSourceDigest(
+    llvm::StringRef Digest,
+    llvm::StringRef FileName,
+    HashKind Kind,
+    HashVectorTy &Res
+) {
+  llvm::StringRef HexHash, SizeStr, MTimeStr;
+  std::tie(HexHash, SizeStr) = Digest.split(':');
+  std::tie(SizeStr, MTimeStr) = SizeStr.split(':');
+
+  uint64_t Size, MTime;
+  if (SizeStr.getAsInteger(10, Size) || MTimeStr.getAsInteger(10, MTime))
+    return false;
+
+  if (HexHash.size() != calcHash(Kind, "").size() * 2 ||
+      !llvm::all_of(HexHash, llvm::isHexDigit))
+    return false;
+
+  llvm::sys::fs::file_status Status;
+  if (llvm::sys::fs::status(FileName, Status))
+    return false;
+
+  auto FileMTime = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      Status.getLastModificationTime().time_since_epoch()
+  ).count();
+
+  if (Status.getSize() != Size || (uint64_t)FileMTime != MTime)
+    return false;
+
+  auto Bytes = llvm::fromHex(HexHash);
+  Res.assign(Bytes.begin(), Bytes.end());
+  return true;
+}
+
+/// Returns hash of main file, digest given by driver is used
+/// instead of hashing file contents, while it is valid.
+static inline HashVectorTy calcMainFileHash(
+    SourceManager &SM, HashKind Kind, llvm::StringRef Digest
+) {
+  auto MainFID = SM.getMainFileID();
+  const auto *Entry = SM.getFileEntryForID(MainFID);
+
+  HashVectorTy Res;
+  if (Digest.size() && Entry &&
+      parseSourceDigest(Digest, Entry->getName(), Kind, Res))
+    return Res;
+
+  return calcHash(Kind, SM.getBufferData(MainFID));
+}
 
 template <typename ArrLeftT, typename ArrRightT>
 bool equal(const ArrLeftT &L, const ArrRightT &R) {
@@ -16,11 +16,17 @@
 
 #include "llvm/ADT/ArrayRef.h"
 #include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Support/MD5.h"
 
 #include "clang/Levitation/Common/Utility.h"
 #include "clang/Levitation/Common/Path.h"
 
+#include <string>
 #include <utility>
+#include <vector>
 
 namespace clang { namespace levitation {
 
@@ -32,7 +38,11 @@ namespace clang { namespace levitation {
     StartUnit,
     StartUnitFirstDecl,
     EndUnit,
-    EndUnitEOF
+    EndUnitEOF,
+
+    /// Exported function body, see LangOptions::LevitationExportBodies.
+    /// It is not a part of header, but still a part of interface.
+    ReplaceWithSemicolonInHeaderOnly
   };
 
 
@@ -48,12 +58,75 @@ namespace clang { namespace levitation {
 
     typedef SmallVector<FragmentTy, 64> FragmentsVectorTy;
 
+    /// Hash of all namespace level declarations with same qualified name.
+    /// Declarations without name and macros are kept under empty name.
+    struct DeclHashTy {
+      std::string Name;
+      uint64_t Hash;
+    };
+
+    typedef std::vector<DeclHashTy> DeclHashesVectorTy;
+
+    /// Names of namespace level declarations object has deserialized
+    /// from particular dependency.
+    struct UsedDeclsTy {
+      std::string DeclAST;
+      std::vector<std::string> Names;
+    };
+
+    typedef std::vector<UsedDeclsTy> UsedDeclsVectorTy;
+
+    /// Legacy header parsed along with the unit, that is header
+    /// #include'd by unit itself or by other headers.
+    struct IncludeTy {
+      std::string Path;
+
+      /// Modification time (seconds since epoch) and size,
+      /// as header was seen by compiler.
+      uint64_t MTime = 0;
+      uint64_t Size = 0;
+
+      /// Hash of header contents, same algorithm source hash uses.
+      HashVectorTy Hash;
+    };
+
+    typedef std::vector<IncludeTy> IncludesVectorTy;
+
+    /// Names of declarations which differ between two metas,
+    /// see diffDecls.
+    struct DeclsDiffTy {
+      std::vector<std::string> Added;
+      std::vector<std::string> Removed;
+      std::vector<std::string> Changed;
+
+      bool empty() const {
+        return Added.empty() && Removed.empty() && Changed.empty();
+      }
+    };
+
   private:
 
+    /// Algorithm source and decl-ast hashes are calculated with,
+    /// interface and declaration hashes always use MD5.
+    HashKind Hash = HashKind::MD5;
+
     HashVectorTy SourceHash;
     HashVectorTy DeclASTHash;
+    HashVectorTy InterfaceHash;
     FragmentsVectorTy FragmentsToSkip;
 
+    bool HasDeclHashes = false;
+    DeclHashesVectorTy DeclHashes;
+
+    bool HasUsedDecls = false;
+    UsedDeclsVectorTy UsedDecls;
+
+    IncludesVectorTy Includes;
+
+    HashVectorTy CommandHash;
+
+    bool Codeless = false;
+
   public:
 
     DeclASTMeta() = default;
@@ -71,6 +144,16 @@ namespace clang { namespace levitation {
       return FragmentsToSkip;
     }
 
+    /// Hash algorithm of source and decl-ast hashes, MD5 for metas
+    /// written by older versions.
+    HashKind getHashKind() const {
+      return Hash;
+    }
+
+    void setHashKind(HashKind Kind) {
+      Hash = Kind;
+    }
+
     const HashVectorTy &getSourceHash() const {
       return SourceHash;
     }
@@ -79,10 +162,92 @@ namespace clang { namespace levitation {
       return DeclASTHash;
     }
 
+    /// Hash of declarations source, that is source with skipped
+    /// bodies and initializers excluded. Unlike decl-ast hash, it doesn't
+    /// depend on source locations, so edits inside bodies keep it same.
+    /// Empty for metas written by older versions.
+    const HashVectorTy &getInterfaceHash() const {
+      return InterfaceHash;
+    }
+
+    /// Declaration hashes, sorted by name. Only present in declaration
+    /// AST metas built with early cutoff enabled.
+    bool hasDeclHashes() const {
+      return HasDeclHashes;
+    }
+
+    const DeclHashesVectorTy &getDeclHashes() const {
+      return DeclHashes;
+    }
+
+    /// Declarations used by object, grouped by dependencies, only present
+    /// in object metas built with early cutoff enabled.
+    bool hasUsedDecls() const {
+      return HasUsedDecls;
+    }
+
+    const UsedDeclsVectorTy &getUsedDecls() const {
+      return UsedDecls;
+    }
+
+    /// Legacy headers, sorted by path. Empty for units without
+    /// #include directives, and for metas written by older versions.
+    const IncludesVectorTy &getIncludes() const {
+      return Includes;
+    }
+
+    void setIncludes(IncludesVectorTy &&Incs) {
+      Includes = std::move(Incs);
+    }
+
+    IncludeTy &addInclude(llvm::StringRef Path) {
+      Includes.push_back({Path.str(), 0, 0, {}});
+      return Includes.back();
+    }
+
+    /// Fingerprint of compiler and flags product was built with,
+    /// as it was passed by levitation driver. Empty if unknown.
+    const HashVectorTy &getCommandHash() const {
+      return CommandHash;
+    }
+
+    /// Whether unit definition emits no code, that is unit only has
+    /// declarations, inline functions and templates, which are emitted
+    /// by their users. Only set in declaration AST metas. False if unit
+    /// may emit code, and for metas written by older versions.
+    bool isCodeless() const {
+      return Codeless;
+    }
+
+    void setCodeless(bool V = true) {
+      Codeless = V;
+    }
+
     void addSkippedFragment(const FragmentTy &Fragment) {
       FragmentsToSkip.push_back(Fragment);
     }
 
+    void setDeclHashes(DeclHashesVectorTy &&Hashes) {
+      DeclHashes = std::move(Hashes);
+      HasDeclHashes = true;
+    }
+
+    void addDeclHash(DeclHashTy &&Hash) {
+      DeclHashes.push_back(std::move(Hash));
+      HasDeclHashes = true;
+    }
+
+    void setUsedDecls(UsedDeclsVectorTy &&Used) {
+      UsedDecls = std::move(Used);
+      HasUsedDecls = true;
+    }
+
+    UsedDeclsTy &addUsedDeclsDependency(llvm::StringRef DeclAST) {
+      UsedDecls.push_back({DeclAST.str(), {}});
+      HasUsedDecls = true;
+      return UsedDecls.back();
+    }
+
     template <typename RecordTy>
     void setSourceHash(const RecordTy &Record) {
       SourceHash.insert(SourceHash.begin(), Record.begin(), Record.end());
@@ -92,6 +257,123 @@ namespace clang { namespace levitation {
     void setDeclASTHash(const RecordTy &Record) {
       DeclASTHash.insert(DeclASTHash.begin(), Record.begin(), Record.end());
     }
+
+    template <typename RecordTy>
+    void setCommandHash(const RecordTy &Record) {
+      CommandHash.assign(Record.begin(), Record.end());
+    }
+
+    template <typename RecordTy>
+    void setInterfaceHash(const RecordTy &Record) {
+      InterfaceHash.insert(InterfaceHash.begin(), Record.begin(), Record.end());
+    }
+
+    /// Calculates interface hash for given source.
+    /// \param Source main file contents.
+    /// \param Fragments fragments skipped by declaration parser.
+    static llvm::MD5::MD5Result calcInterfaceHash(
+        llvm::StringRef Source,
+        const FragmentsVectorTy &Fragments
+    ) {
+      llvm::MD5 Md5Builder;
+
+      size_t Pos = 0;
+      for (const auto &F : Fragments) {
+        if (
+          F.Action != SourceFragmentAction::Skip &&
+          F.Action != SourceFragmentAction::ReplaceWithSemicolon
+        )
+          continue;
+
+        if (F.Start > Pos)
+          Md5Builder.update(Source.slice(Pos, F.Start));
+
+        if (F.End > Pos)
+          Pos = F.End;
+      }
+
+      if (Pos < Source.size())
+        Md5Builder.update(Source.substr(Pos));
+
+      llvm::MD5::MD5Result Result;
+      Md5Builder.final(Result);
+      return Result;
+    }
+
+    /// Compares declaration hashes of two metas of same unit.
+    /// \param Changed names of declarations with different hashes.
+    /// \return false if difference is unknown, that is either of metas
+    /// has no declaration hashes, or declarations were added or removed.
+    static bool diffDeclHashes(
+        const DeclASTMeta &Old,
+        const DeclASTMeta &New,
+        llvm::StringSet<> &Changed
+    ) {
+      if (!Old.hasDeclHashes() || !New.hasDeclHashes())
+        return false;
+
+      llvm::StringMap<uint64_t> OldHashes;
+      for (const auto &H : Old.getDeclHashes())
+        OldHashes[H.Name] = H.Hash;
+
+      // Added declaration may change lookup results anywhere,
+      // so we only trust metas with same set of names.
+      if (OldHashes.size() != New.getDeclHashes().size())
+        return false;
+
+      for (const auto &H : New.getDeclHashes()) {
+        auto Found = OldHashes.find(H.Name);
+        if (Found == OldHashes.end())
+          return false;
+        if (Found->second != H.Hash)
+          Changed.insert(H.Name);
+      }
+
+      return true;
+    }
+
+    /// Compares declaration hashes of two metas of same unit, unlike
+    /// diffDeclHashes also reports added and removed declarations.
+    /// Names in each list keep order of declaration hashes, that is
+    /// they are sorted.
+    /// \return false if either of metas has no declaration hashes.
+    static bool diffDecls(
+        const DeclASTMeta &Old,
+        const DeclASTMeta &New,
+        DeclsDiffTy &Diff
+    ) {
+      if (!Old.hasDeclHashes() || !New.hasDeclHashes())
+        return false;
+
+      const auto &OldHashes = Old.getDeclHashes();
+      const auto &NewHashes = New.getDeclHashes();
+
+      size_t i = 0, j = 0;
+      while (i != OldHashes.size() || j != NewHashes.size()) {
+        if (
+          j == NewHashes.size() ||
+          (i != OldHashes.size() && OldHashes[i].Name < NewHashes[j].Name)
+        ) {
+          Diff.Removed.push_back(OldHashes[i++].Name);
+          continue;
+        }
+
+        if (
+          i == OldHashes.size() ||
+          NewHashes[j].Name < OldHashes[i].Name
+        ) {
+          Diff.Added.push_back(NewHashes[j++].Name);
+          continue;
+        }
+
+        if (OldHashes[i].Hash != NewHashes[j].Hash)
+          Diff.Changed.push_back(NewHashes[j].Name);
+        ++i;
+        ++j;
+      }
+
+      return true;
+    }
   };
 }}
 
@@ -31,6 +31,9 @@ namespace clang { namespace levitation {
 
   public:
 
+    /// Loads meta either from stand-alone meta file, or from
+    /// declaration AST it is embedded into (see --embed-meta).
+    /// Large files are mapped, so only their tail is actually read.
     static bool fromFile(
         DeclASTMeta &Meta, StringRef BuildRoot, StringRef FileName
     ) {
@@ -41,7 +44,14 @@ namespace clang { namespace levitation {
       if (auto Buffer = FM.getBufferForFile(FileName)) {
         llvm::MemoryBuffer &MemBuf = *Buffer.get();
 
-        if (!fromBuffer(Meta, MemBuf))
+        StringRef Embedded;
+        std::unique_ptr<llvm::MemoryBuffer> EmbeddedBuf;
+        if (findEmbeddedMeta(MemBuf.getBuffer(), Embedded))
+          EmbeddedBuf = llvm::MemoryBuffer::getMemBuffer(
+              Embedded, FileName, /*RequiresNullTerminator=*/false
+          );
+
+        if (!fromBuffer(Meta, EmbeddedBuf ? *EmbeddedBuf : MemBuf))
           Log.log_error("Failed to read dependencies for '", FileName);
       } else
        Log.log_error("Failed to open file '", FileName);
@@ -23,6 +23,8 @@
 #include "clang/Levitation/Common/Thread.h"
 #include "clang/Levitation/TasksManager/TasksManager.h"
 
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/BitVector.h"
 #include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/DenseSet.h"
 #include "llvm/ADT/StringRef.h"
@@ -30,7 +32,11 @@
 #include "llvm/Support/raw_ostream.h"
 
 #include <algorithm>
+#include <array>
+#include <condition_variable>
 #include <mutex>
+#include <tuple>
+#include <vector>
 
 namespace clang { namespace levitation { namespace dependencies_solver {
 
@@ -90,6 +96,7 @@ public:
   using NodesSet = llvm::DenseSet<NodeID::Type>;
   using NodesList = llvm::SmallVector<NodeID::Type, 16>;
   using UnitsMap = llvm::DenseMap<StringID, std::unique_ptr<LevitationUnitInfo>>;
+  using NodesWeights = llvm::DenseMap<NodeID::Type, uint64_t>;
 
   struct Node {
     Node(NodeID::Type id, NodeKind kind)
@@ -102,6 +109,22 @@ public:
     NodesSet DependentNodes;
   };
 
+  /// Dense node index in compact form of graph.
+  ///
+  /// Once graph is built, it is finalized into immutable compact form:
+  /// nodes are numbered in order of their IDs, edges of all nodes
+  /// are kept in two arrays with offsets tables (CSR), and node flags
+  /// are kept in bitsets. Walks use it instead of nodes sets.
+  using NodeIndex = uint32_t;
+
+  enum class NodeFlag {
+    Root,
+    Terminal,
+    Public,
+    External,
+    NumFlags
+  };
+
 private:
 
   log::Logger &Log = log::Logger::get();
@@ -129,6 +152,16 @@ private:
 
   bool Invalid = false;
 
+  // Compact form of graph.
+  bool Finalized = false;
+  std::vector<const Node*> IndexedNodes;
+  llvm::DenseMap<NodeID::Type, NodeIndex> NodeIndices;
+  std::vector<NodeIndex> DependenciesOffsets;
+  std::vector<NodeIndex> DependenciesEdges;
+  std::vector<NodeIndex> DependentsOffsets;
+  std::vector<NodeIndex> DependentsEdges;
+  std::array<llvm::BitVector, (size_t)NodeFlag::NumFlags> Flags;
+
   /// Mark node as publicly available (present in library interface)
   /// \param NID Node ID to be marked.
   void setPublic(NodeID::Type NID) { PublicNodes.insert(NID); }
@@ -223,22 +256,167 @@ public:
     // Scan for regular terminal nodes
     DGraphPtr->collectTerminals();
 
-    // Look for cycles and may be even fix them.
+    // Look for cycles and cut them, so graph is always acyclic.
     // Note: cycles processing starts from
     // terminals.
+    DGraphPtr->finalize();
     DGraphPtr->processCycles();
 
     // Scan for publically available terminal nodes.
     DGraphPtr->collectPublicNodes();
 
+    DGraphPtr->finalize();
+
     return DGraphPtr;
   }
 
+  bool isFinalized() const { return Finalized; }
+
+  size_t getNumNodes() const { return IndexedNodes.size(); }
+
+  NodeIndex getNodeIndex(NodeID::Type ID) const {
+    assert(Finalized && "Graph should be finalized");
+    auto Found = NodeIndices.find(ID);
+    assert(
+        Found != NodeIndices.end() &&
+        "Node with current ID should be present in graph"
+    );
+    return Found->second;
+  }
+
+  const Node &getNodeByIndex(NodeIndex Idx) const {
+    return *IndexedNodes[Idx];
+  }
+
+  llvm::ArrayRef<NodeIndex> getDependencies(NodeIndex Idx) const {
+    return getEdges(DependenciesOffsets, DependenciesEdges, Idx);
+  }
+
+  llvm::ArrayRef<NodeIndex> getDependentNodes(NodeIndex Idx) const {
+    return getEdges(DependentsOffsets, DependentsEdges, Idx);
+  }
+
+  bool hasFlag(NodeIndex Idx, NodeFlag Flag) const {
+    return Flags[(size_t)Flag].test(Idx);
+  }
+
+  /// Finds strongly connected components of finalized graph by means of
+  /// iterative Tarjan's algorithm, so deep graphs don't exhaust the stack.
+  /// Components are reported in reverse topological order, that is each
+  /// component goes after all components it depends on.
+  /// Walks may be started from several nodes, overall time is O(V+E).
+  class StronglyConnectedComponents {
+    static constexpr NodeIndex NotVisited = ~NodeIndex(0);
+
+    const DependenciesGraph &G;
+
+    /// Visit order of node, or NotVisited.
+    std::vector<NodeIndex> Order;
+    std::vector<NodeIndex> LowLink;
+
+    /// Component number of node, or NotVisited while node
+    /// is not assigned to any component yet.
+    std::vector<NodeIndex> Components;
+
+    std::vector<NodeIndex> Stack;
+
+    struct Frame {
+      NodeIndex Idx;
+      size_t NextDependency;
+    };
+    std::vector<Frame> Frames;
+
+    NodeIndex NumVisited = 0;
+    NodeIndex NumComponents = 0;
+
+    void visit(NodeIndex Idx) {
+      Order[Idx] = LowLink[Idx] = NumVisited++;
+      Stack.push_back(Idx);
+      Frames.push_back({Idx, 0});
+    }
+
+  public:
+    StronglyConnectedComponents(const DependenciesGraph &G)
+    : G(G),
+      Order(G.getNumNodes(), NodeIndex(NotVisited)),
+      LowLink(G.getNumNodes(), NodeIndex(NotVisited)),
+      Components(G.getNumNodes(), NodeIndex(NotVisited))
+    {}
+
+    bool isVisited(NodeIndex Idx) const {
+      return Order[Idx] != NotVisited;
+    }
+
+    /// Component of node, only valid once node's component was reported.
+    NodeIndex getComponent(NodeIndex Idx) const {
+      return Components[Idx];
+    }
+
+    /// Whether component contains more than one node, or node
+    /// depends on itself.
+    bool isCycle(llvm::ArrayRef<NodeIndex> Component) const {
+      if (Component.size() > 1)
+        return true;
+      auto Deps = G.getDependencies(Component.front());
+      return std::binary_search(Deps.begin(), Deps.end(), Component.front());
+    }
+
+    /// Reports all components reachable from Start, and not
+    /// reported before.
+    /// \param OnComponent called with nodes of each component in
+    ///        order they were visited.
+    template <typename OnComponentFn>
+    void walk(NodeIndex Start, OnComponentFn &&OnComponent) {
+      if (isVisited(Start))
+        return;
+
+      visit(Start);
+
+      while (!Frames.empty()) {
+        auto &F = Frames.back();
+        NodeIndex Idx = F.Idx;
+        auto Deps = G.getDependencies(Idx);
+
+        if (F.NextDependency != Deps.size()) {
+          NodeIndex DepIdx = Deps[F.NextDependency++];
+          if (!isVisited(DepIdx))
+            visit(DepIdx);
+          else if (Components[DepIdx] == NotVisited)
+            LowLink[Idx] = std::min(LowLink[Idx], Order[DepIdx]);
+          continue;
+        }
+
+        Frames.pop_back();
+
+        if (!Frames.empty()) {
+          auto &Parent = LowLink[Frames.back().Idx];
+          Parent = std::min(Parent, LowLink[Idx]);
+        }
+
+        if (LowLink[Idx] != Order[Idx])
+          continue;
+
+        size_t Begin = Stack.size();
+        do {
+          --Begin;
+          Components[Stack[Begin]] = NumComponents;
+        } while (Stack[Begin] != Idx);
+        ++NumComponents;
+
+        OnComponent(llvm::makeArrayRef(Stack).slice(Begin));
+        Stack.resize(Begin);
+      }
+    }
+  };
+
   /// Whether node is public
   /// \param NID Node ID to be checked
   /// \return true if node should be present in library public interface
   bool isPublic(NodeID::Type NID) const { return PublicNodes.count(NID); }
 
+  /// Whether some of units were marked with #public directive.
+  bool hasPublicNodes() const { return !PublicNodes.empty(); }
+
   /// Whether node belongs to external package.
   /// \param NID Node ID to be checked
   /// \return true if external
@@ -266,6 +444,8 @@ public:
   /// Implements deep search first walk, and runs job on each node
   /// it meets.
   /// Starts from terminal nodes going down to roots.
+  /// Walk itself is done by main thread, it registers job for each node as
+  /// continuation of its subnodes jobs, so workers never wait for subnodes.
   /// \param OnNode Action to be launched to process current node
   ///        but not its subnodes.
   /// \return true is walk was successful.
@@ -275,16 +455,17 @@ public:
   ) const {
     JobsContext Jobs(std::move(OnNode));
 
-    std::mutex VisitedMutex;
-    NodesSet Visited;
+    Jobs.Tasks.assign(getNumNodes(), tasks::TasksManager::TaskID(NoJob));
 
-    return dsfJobsOnNode(
-        VisitedMutex,
-        Visited,
-        nullptr,
-        StartingPoints,
-        Jobs
-    );
+    for (auto NID : StartingPoints)
+      dsfJobsOnNode(getNodeIndex(NID), Jobs);
+
+    // Failure of subnode completes its dependent jobs at once, while
+    // independent jobs still may use context. So wait for all of them.
+    auto Tasks = Jobs.getJobs();
+
+    auto &TM = tasks::TasksManager::get();
+    return TM.waitForTasks(Tasks) && TM.allSuccessfull(Tasks);
   }
 
   bool dsfJobs(
@@ -293,6 +474,178 @@ public:
     return dsfJobs(Terminals, std::move(OnNode));
   }
 
+  /// Runs job on each node reachable from starting points, in
+  /// topological order (dependencies first).
+  /// Unlike dsfJobs, it doesn't register all jobs in advance.
+  /// Each node keeps counter of not yet processed dependencies,
+  /// and once counter reaches zero, node is pushed into ready queue.
+  /// Main thread dispatches ready nodes and participates in execution
+  /// if there are no free workers.
+  /// If job fails, then its dependent nodes are not processed,
+  /// though independent branches are completed, unless tasks
+  /// manager is cancelled. Once it is, ready nodes are not started
+  /// anymore, and walk finishes as soon as running jobs are done.
+  /// \param StartingPoints nodes to start walk from (usually terminals).
+  /// \param OnNode Action to be launched to process current node.
+  /// \param Priorities if provided, then among ready nodes the one with
+  ///        highest priority is started first, otherwise nodes are started
+  ///        in order they became ready.
+  /// \param Domain if provided, returns domain of workers node
+  ///        job should preferably run on, or -1 if any worker fits,
+  ///        see TasksManager::runTask.
+  /// \return true if all reachable nodes were processed successfully.
+  bool readyQueueJobs(
+      const NodesSet& StartingPoints,
+      std::function<bool(const Node&)> &&OnNode,
+      const NodesWeights *Priorities = nullptr,
+      std::function<int(const Node&)> &&Domain = nullptr
+  ) const {
+    ReadyQueueContext Jobs(*this, std::move(OnNode), Priorities);
+
+    collectSubgraph(Jobs, StartingPoints);
+
+    for (NodeIndex Idx = 0, e = getNumNodes(); Idx != e; ++Idx)
+      if (Jobs.InSubgraph.test(Idx) && !Jobs.RemainedDependencies[Idx])
+        Jobs.pushReady(Idx);
+
+    auto &TM = tasks::TasksManager::get();
+
+    while (true) {
+      NodeIndex Idx;
+
+      with (auto Lock = Jobs.lock()) {
+        Jobs.ReadyNotifier.wait(Lock, [&] {
+          return (!Jobs.Ready.empty() && !TM.isCancelled()) || !Jobs.InFlight;
+        });
+
+        if (Jobs.Ready.empty() || TM.isCancelled())
+          break;
+
+        Idx = Jobs.popReady();
+        ++Jobs.InFlight;
+      }
+
+      TM.runTask([&, Idx] (tasks::TasksManager::TaskContext &TC) {
+        const Node &N = getNodeByIndex(Idx);
+        TC.Successful = !TM.isCancelled() && Jobs.OnNode(N);
+        onReadyQueueJobFinished(Jobs, Idx, TC.Successful);
+      }, Domain ? Domain(getNodeByIndex(Idx)) : -1);
+    }
+
+    return !Jobs.Failed && Jobs.Processed == Jobs.SubgraphSize;
+  }
+
+  bool readyQueueJobs(
+      std::function<bool(const Node&)> &&OnNode,
+      const NodesWeights *Priorities = nullptr,
+      std::function<int(const Node&)> &&Domain = nullptr
+  ) const {
+    return readyQueueJobs(
+        Terminals, std::move(OnNode), Priorities, std::move(Domain)
+    );
+  }
+
+  /// For each node calculates weight of the heaviest path which starts
+  /// from this node and goes through its dependent nodes up to terminals,
+  /// node itself included. In other words it is how much of work remains
+  /// once node is started. Nodes with biggest values form critical path.
+  /// \param Weight returns weight of particular node, e.g. its
+  ///        expected compilation time.
+  /// \return map node ID -> critical path weight.
+  NodesWeights calcCriticalPaths(
+      std::function<uint64_t(const Node&)> &&Weight
+  ) const {
+    size_t NumNodes = getNumNodes();
+    std::vector<uint64_t> IndexedPaths(NumNodes);
+    llvm::BitVector Done(NumNodes);
+
+    // Stack items are (node, whether its dependents were already pushed).
+    llvm::SmallVector<std::pair<NodeIndex, bool>, 64> Stack;
+    for (NodeIndex Idx = 0; Idx != NumNodes; ++Idx)
+      Stack.push_back({Idx, false});
+
+    while (!Stack.empty()) {
+      auto Item = Stack.pop_back_val();
+      if (Done.test(Item.first))
+        continue;
+
+      if (!Item.second) {
+        Stack.push_back({Item.first, true});
+        for (auto DependentIdx : getDependentNodes(Item.first))
+          if (!Done.test(DependentIdx))
+            Stack.push_back({DependentIdx, false});
+        continue;
+      }
+
+      uint64_t HeaviestDependent = 0;
+      for (auto DependentIdx : getDependentNodes(Item.first))
+        if (Done.test(DependentIdx))
+          HeaviestDependent =
+              std::max(HeaviestDependent, IndexedPaths[DependentIdx]);
+
+      IndexedPaths[Item.first] =
+          Weight(getNodeByIndex(Item.first)) + HeaviestDependent;
+      Done.set(Item.first);
+    }
+
+    NodesWeights Paths;
+    Paths.reserve(NumNodes);
+    for (NodeIndex Idx = 0; Idx != NumNodes; ++Idx)
+      Paths[getNodeByIndex(Idx).ID] = IndexedPaths[Idx];
+
+    return Paths;
+  }
+
+  /// For each node calculates number of nodes reachable from it,
+  /// node itself excluded. Walking by dependents gives number of nodes
+  /// affected once node changes, walking by dependencies gives number
+  /// of nodes it needs. Closures are kept as bitsets, so memory is
+  /// quadratic, one bit per pair of nodes.
+  /// \return closure sizes, indexed by node index.
+  std::vector<size_t> calcClosureSizes(bool ByDependents) const {
+    size_t NumNodes = getNumNodes();
+    std::vector<llvm::BitVector> Closures(NumNodes);
+    llvm::BitVector Done(NumNodes);
+
+    auto getNext = [&] (NodeIndex Idx) {
+      return ByDependents ? getDependentNodes(Idx) : getDependencies(Idx);
+    };
+
+    // Stack items are (node, whether its next nodes were already pushed).
+    llvm::SmallVector<std::pair<NodeIndex, bool>, 64> Stack;
+    for (NodeIndex Idx = 0; Idx != NumNodes; ++Idx)
+      Stack.push_back({Idx, false});
+
+    while (!Stack.empty()) {
+      auto Item = Stack.pop_back_val();
+      if (Done.test(Item.first))
+        continue;
+
+      if (!Item.second) {
+        Stack.push_back({Item.first, true});
+        for (auto NextIdx : getNext(Item.first))
+          if (!Done.test(NextIdx))
+            Stack.push_back({NextIdx, false});
+        continue;
+      }
+
+      auto &Closure = Closures[Item.first];
+      Closure.resize(NumNodes);
+      for (auto NextIdx : getNext(Item.first)) {
+        Closure.set(NextIdx);
+        if (Done.test(NextIdx))
+          Closure |= Closures[NextIdx];
+      }
+      Done.set(Item.first);
+    }
+
+    std::vector<size_t> Sizes(NumNodes);
+    for (NodeIndex Idx = 0; Idx != NumNodes; ++Idx)
+      Sizes[Idx] = Closures[Idx].count();
+
+    return Sizes;
+  }
+
   bool isInvalid() const { return Invalid; }
 
   // Do BFS graph walk and dump each node
@@ -468,60 +821,61 @@ protected:
       bool SkipVisited,
       OnNodeFn &&OnNode
   ) const {
-    NodesSet Worklist = Roots;
+    std::vector<NodeIndex> Worklist;
+    for (auto NID : Roots)
+      Worklist.push_back(getNodeIndex(NID));
+    std::sort(Worklist.begin(), Worklist.end());
 
-    NodesSet NewWorklist;
+    std::vector<NodeIndex> NewWorklist;
+    llvm::BitVector InNewWorklist(getNumNodes());
 
     while (Worklist.size()) {
       NewWorklist.clear();
-      for (auto NID : Worklist) {
+      for (auto Idx : Worklist) {
+        const auto &Node = getNodeByIndex(Idx);
 
-        if (SkipVisited && !VisitedNodes.insert(NID).second)
+        if (SkipVisited && !VisitedNodes.insert(Node.ID).second)
           continue;
 
-        const auto &Node = getNode(NID);
-
         if (!OnNode(Node))
           return false;
 
-        NewWorklist.insert(Node.DependentNodes.begin(), Node.DependentNodes.end());
+        for (auto DependentIdx : getDependentNodes(Idx)) {
+          if (!InNewWorklist.test(DependentIdx)) {
+            InNewWorklist.set(DependentIdx);
+            NewWorklist.push_back(DependentIdx);
+          }
+        }
       }
+
+      for (auto Idx : NewWorklist)
+        InNewWorklist.reset(Idx);
+
       Worklist.swap(NewWorklist);
     }
     return true;
   }
 
-  class JobsContext {
-
-    using TasksMapType =
-        llvm::DenseMap<NodeID::Type, tasks::TasksManager::TaskID>;
+  static constexpr tasks::TasksManager::TaskID NoJob = -1;
 
-    TasksMapType Tasks;
+  class JobsContext {
 
     OnNodeFn OnNode;
-    std::mutex Mutex;
-
-    MutexLock lockTasks() {
-      return lock(Mutex);
-    }
 
   public:
 
-    JobsContext(OnNodeFn &&onNode) : OnNode(onNode) {}
+    /// Job of each node, indexed by node index, NoJob if not registered.
+    /// Only accessed by thread which walks graph.
+    std::vector<tasks::TasksManager::TaskID> Tasks;
 
-    tasks::TasksManager::TaskID getJobForNode(
-        NodeID::Type NID,
-        tasks::TasksManager::ActionFn &&Fn,
-        bool SameThread
-    ) {
-      auto &TM = tasks::TasksManager::get();
-      auto TID = SameThread ?
-          TM.addTask(std::move(Fn), true) :
-          TM.runTask(std::move(Fn));
+    JobsContext(OnNodeFn &&onNode) : OnNode(onNode) {}
 
-      auto _ = lockTasks();
-      auto Res = Tasks.insert({NID, TID});
-      return Res.first->second;
+    tasks::TasksManager::TasksSet getJobs() const {
+      tasks::TasksManager::TasksSet Jobs;
+      for (auto TID : Tasks)
+        if (TID != NoJob)
+          Jobs.insert(TID);
+      return Jobs;
     }
 
     bool onNode(const Node &N) {
@@ -529,62 +883,147 @@ protected:
     }
   };
 
-  bool dsfJobsOnNode(
-      std::mutex &VisitedMutex,
-      NodesSet &Visited,
-      const Node *N,
-      const NodesSet &SubNodes,
-      JobsContext &Jobs
+  struct ReadyQueueContext {
+
+    ReadyQueueContext(
+        const DependenciesGraph &graph,
+        OnNodeFn &&onNode,
+        const NodesWeights *priorities
+    )
+    : Graph(graph), OnNode(onNode), Priorities(priorities),
+      RemainedDependencies(graph.getNumNodes()),
+      InSubgraph(graph.getNumNodes()) {}
+
+    const DependenciesGraph &Graph;
+    OnNodeFn OnNode;
+    const NodesWeights *Priorities;
+
+    /// Number of not yet processed dependencies for each node
+    /// of subgraph we walk, indexed by node index.
+    std::vector<size_t> RemainedDependencies;
+    llvm::BitVector InSubgraph;
+    size_t SubgraphSize = 0;
+
+    /// Heap of ready nodes, (priority, sequence number, node index).
+    /// Sequence number keeps FIFO order for nodes with same priority.
+    using ReadyItem = std::tuple<uint64_t, int64_t, NodeIndex>;
+    std::vector<ReadyItem> Ready;
+    int64_t NextSequence = 0;
+
+    size_t InFlight = 0;
+    size_t Processed = 0;
+    bool Failed = false;
+
+    std::mutex Mutex;
+    std::condition_variable ReadyNotifier;
+
+    MutexLock lock() {
+      return levitation::lock(Mutex);
+    }
+
+    void pushReady(NodeIndex Idx) {
+      uint64_t Priority = 0;
+      if (Priorities) {
+        auto Found = Priorities->find(Graph.getNodeByIndex(Idx).ID);
+        if (Found != Priorities->end())
+          Priority = Found->second;
+      }
+
+      // Earlier nodes should go first, so negate sequence number.
+      Ready.emplace_back(Priority, -NextSequence++, Idx);
+      std::push_heap(Ready.begin(), Ready.end());
+    }
+
+    NodeIndex popReady() {
+      std::pop_heap(Ready.begin(), Ready.end());
+      auto Idx = std::get<2>(Ready.back());
+      Ready.pop_back();
+      return Idx;
+    }
+  };
+
+  void collectSubgraph(
+      ReadyQueueContext &Jobs,
+      const NodesSet &StartingPoints
   ) const {
+    llvm::SmallVector<NodeIndex, 16> Worklist;
+    for (auto NID : StartingPoints)
+      Worklist.push_back(getNodeIndex(NID));
+
+    while (!Worklist.empty()) {
+      auto Idx = Worklist.pop_back_val();
+
+      if (Jobs.InSubgraph.test(Idx))
+        continue;
 
-    bool Successful = true;
+      auto Dependencies = getDependencies(Idx);
 
-    if (SubNodes.size()) {
+      Jobs.InSubgraph.set(Idx);
+      Jobs.RemainedDependencies[Idx] = Dependencies.size();
+      ++Jobs.SubgraphSize;
 
-      tasks::TasksManager::TasksSet NodeTasks;
+      Worklist.append(Dependencies.begin(), Dependencies.end());
+    }
+  }
 
-      // Some tricky way to go over DenseMap, and
-      // detect the last node in collection
-      size_t NumSubNodes = SubNodes.size();
-      size_t SubNodeIdx = 0;
+  void onReadyQueueJobFinished(
+      ReadyQueueContext &Jobs,
+      NodeIndex Idx,
+      bool Successful
+  ) const {
+    with (auto Lock = Jobs.lock()) {
+      --Jobs.InFlight;
 
-      for (auto NID : SubNodes) {
-        const auto &SubNode = getNode(NID);
+      if (Successful) {
+        ++Jobs.Processed;
+        for (auto DependentIdx : getDependentNodes(Idx)) {
 
-        with (auto _ = lock(VisitedMutex)) {
-          auto VisitIt = Visited.insert(NID);
-          if (!VisitIt.second)
+          // Dependent node may be out of subgraph we walk.
+          if (!Jobs.InSubgraph.test(DependentIdx))
             continue;
+
+          auto &Remained = Jobs.RemainedDependencies[DependentIdx];
+          assert(Remained && "Dependencies counter underflow");
+
+          if (--Remained == 0)
+            Jobs.pushReady(DependentIdx);
         }
+      } else
+        Jobs.Failed = true;
 
-        auto TID = Jobs.getJobForNode(
-            SubNode.ID,
-            [&](tasks::TasksManager::TaskContext &TC) {
-              TC.Successful = dsfJobsOnNode(
-                  VisitedMutex,
-                  Visited,
-                  &SubNode,
-                  SubNode.Dependencies,
-                  Jobs
-              );
-            },
-            // Process last subnode in same thread
-            /*Same thread*/++SubNodeIdx == NumSubNodes
-        );
+      // Notify while still holding the lock: once InFlight drops to zero
+      // the main thread may leave readyQueueJobs and destroy the context.
+      Jobs.ReadyNotifier.notify_all();
+    }
+  }
 
-        NodeTasks.insert(TID);
+  /// Registers job for node, after jobs for its subnodes.
+  /// \return job ID.
+  tasks::TasksManager::TaskID dsfJobsOnNode(
+      NodeIndex Idx,
+      JobsContext &Jobs
+  ) const {
+    if (Jobs.Tasks[Idx] != NoJob)
+      return Jobs.Tasks[Idx];
 
-        auto &TM = tasks::TasksManager::get();
+    const Node &N = getNodeByIndex(Idx);
 
-        TM.waitForTasks(NodeTasks);
-        Successful = TM.allSuccessfull(NodeTasks);
-      }
-    }
+    tasks::TasksManager::TasksSet SubTasks;
+    for (auto SubIdx : getDependencies(Idx))
+      SubTasks.insert(dsfJobsOnNode(SubIdx, Jobs));
+
+    auto &TM = tasks::TasksManager::get();
 
-    if (Successful && N)
-      Successful = Jobs.onNode(*N);
+    // Job is not executed if any of subnodes failed.
+    auto TID = TM.whenAll(
+        SubTasks,
+        [&] (tasks::TasksManager::TaskContext &TC) {
+          TC.Successful = !TM.isCancelled() && Jobs.onNode(N);
+        }
+    );
 
-    return Successful;
+    Jobs.Tasks[Idx] = TID;
+    return TID;
   }
 
 
@@ -683,129 +1122,147 @@ protected:
     return *InsertionRes.first->second;
   }
 
+  /// Reports cycles and cuts edges inside of them, so that rest of
+  /// graph processing always terminates. Graph should be finalized,
+  /// and should be finalized again if any edge was cut.
   void processCycles() {
     // Sometimes graph contains cycle.
 
-    bool Success = true;
-
-    NodesSet Visited;
-    NodesSet PathNodes;
-    NodesList Path;
-
     Log.log_trace("Checking for cycles...");
 
-    for (auto NID : Terminals) {
-      with (auto tr = Log.acquire(log::Level::Trace)) {
-        auto &trace = tr.s;
-        trace << "Checking cycles from terminal '";
-        dumpNodeID(trace.indent(4), NID);
-        trace << "'\n";
-      }
-
-      auto &Node = getNode(NID);
+    StronglyConnectedComponents SCC(*this);
 
-      Visited.insert(NID);
+    typedef std::pair<NodeID::Type, NodeID::Type> EdgeTy;
+    SmallVector<EdgeTy, 8> CutEdges;
 
-      PathNodes.insert(NID);
-      Path.push_back(NID);
+    auto onComponent = [&] (llvm::ArrayRef<NodeIndex> Component) {
+      if (!SCC.isCycle(Component))
+        return;
 
-      Success &= processCyclesRecursive(Visited, PathNodes, Path, Node);
-
-      Path.pop_back();
-      PathNodes.erase(NID);
-    }
-
-    if (Visited.size() < AllNodes.size()) {
-
-      Log.log_error("Found isolated nodes.");
-
-      // Some nodes are not reachable from roots, so that means
-      // they belong to isolated cycles.
-      NodesSet Isolated;
-      for (auto &kv : AllNodes) {
-        if (!Visited.count(kv.first)) {
-          Isolated.insert(kv.first);
+      with (auto err = Log.acquire(log::Level::Error)) {
+        auto &s = err.s;
+        s << "Found unresolvable cycle:\n";
+        for (auto Idx : Component) {
+          s.indent(4);
+          dumpNodeID(s, getNodeByIndex(Idx).ID);
+          s << "\n";
+        }
+      }
 
-          with (auto err = Log.acquire(log::Level::Error)) {
-            auto &out = err.s;
+      for (auto Idx : Component) {
+        auto ComponentID = SCC.getComponent(Idx);
+        for (auto DepIdx : getDependencies(Idx))
+          if (SCC.getComponent(DepIdx) == ComponentID)
+            CutEdges.push_back({
+              getNodeByIndex(Idx).ID, getNodeByIndex(DepIdx).ID
+            });
+      }
+    };
 
-            out.indent(4);
-            dumpNodeID(out, kv.first);
-            out << "\n";
-          }
+    for (auto NID : Terminals)
+      SCC.walk(getNodeIndex(NID), onComponent);
+
+    // Some nodes are not reachable from terminals, so that means
+    // they belong to isolated cycles.
+    SmallVector<NodeIndex, 8> Isolated;
+    for (NodeIndex Idx = 0, e = getNumNodes(); Idx != e; ++Idx)
+      if (!SCC.isVisited(Idx))
+        Isolated.push_back(Idx);
+
+    for (auto Idx : Isolated)
+      SCC.walk(Idx, onComponent);
+
+    if (!Isolated.empty()) {
+      with (auto err = Log.acquire(log::Level::Error)) {
+        auto &out = err.s;
+        out << "Found isolated nodes.\n";
+        for (auto Idx : Isolated) {
+          out.indent(4);
+          dumpNodeID(out, getNodeByIndex(Idx).ID);
+          out << "\n";
         }
       }
-      Invalid = true;
     }
 
-    Invalid = !Success;
+    for (const auto &Edge : CutEdges) {
+      getNode(Edge.first).Dependencies.erase(Edge.second);
+      getNode(Edge.second).DependentNodes.erase(Edge.first);
+    }
+
+    if (!CutEdges.empty() || !Isolated.empty())
+      Invalid = true;
   }
 
-  bool processCyclesRecursive(
-      NodesSet &Visited,
-      NodesSet &PathNodes,
-      NodesList &Path,
-      Node &Parent
+  static llvm::ArrayRef<NodeIndex> getEdges(
+      const std::vector<NodeIndex> &Offsets,
+      const std::vector<NodeIndex> &Edges,
+      NodeIndex Idx
   ) {
+    return llvm::makeArrayRef(Edges).slice(
+        Offsets[Idx], Offsets[Idx + 1] - Offsets[Idx]
+    );
+  }
 
-    bool Success = true;
-
-    NodesSet cutSet;
+  /// Builds compact form of graph. Graph should not be modified after that.
+  void finalize() {
+    IndexedNodes.clear();
+    IndexedNodes.reserve(AllNodes.size());
+    for (const auto &NKV : AllNodes)
+      IndexedNodes.push_back(NKV.second.get());
+
+    // Same graph gets same indices.
+    std::sort(
+        IndexedNodes.begin(), IndexedNodes.end(),
+        [] (const Node *L, const Node *R) { return L->ID < R->ID; }
+    );
 
-    auto dumpParentChild =
-    [&] (llvm::raw_ostream &out, const NodesList &Path, NodeID::Type Child) {
+    size_t NumNodes = IndexedNodes.size();
 
-      out << "Existing path:\n";
+    NodeIndices.clear();
+    NodeIndices.reserve(NumNodes);
+    for (NodeIndex Idx = 0; Idx != NumNodes; ++Idx)
+      NodeIndices[IndexedNodes[Idx]->ID] = Idx;
 
-      int indent = 2;
-      for (auto NID : Path) {
-        out.indent(indent);
-        dumpNodeID(out, NID);
-        out << " <--\n";
-        indent += 2;
+    auto buildEdges = [&] (
+        std::vector<NodeIndex> &Offsets,
+        std::vector<NodeIndex> &Edges,
+        NodesSet Node::*Adjacent
+    ) {
+      Offsets.assign(1, 0);
+      Offsets.reserve(NumNodes + 1);
+      Edges.clear();
+
+      for (const Node *N : IndexedNodes) {
+        size_t Begin = Edges.size();
+        for (auto NID : N->*Adjacent)
+          Edges.push_back(NodeIndices.lookup(NID));
+        std::sort(Edges.begin() + Begin, Edges.end());
+        Offsets.push_back(Edges.size());
       }
 
-      out.indent(indent) << "(new) ";
-      dumpNodeID(out, Child);
-      out << "\n";
+      Edges.shrink_to_fit();
     };
 
-    NodesSet NotVisitedDependencies = Parent.Dependencies;
-
-    while (NotVisitedDependencies.size()) {
-      auto NID = *NotVisitedDependencies.begin();
-      NotVisitedDependencies.erase(NID);
-
-      auto ins = PathNodes.insert(NID);
-      auto &Node = getNode(NID);
-
-      if (!ins.second) {
-
-        Success = false;
-        with (auto err = Log.acquire(log::Level::Error)) {
-          auto &s = err.s;
-          s << "Found unresolvable cycle:\n";
-          dumpParentChild(s, Path, NID);
-        }
-
-        cutSet.insert(NID);
-        Node.DependentNodes.erase(Parent.ID);
-      } else {
-        Path.push_back(NID);
-        ins = Visited.insert(NID);
-        if (ins.second)
-          Success &= processCyclesRecursive(Visited, PathNodes, Path, Node);
-        Path.pop_back();
+    buildEdges(DependenciesOffsets, DependenciesEdges, &Node::Dependencies);
+    buildEdges(DependentsOffsets, DependentsEdges, &Node::DependentNodes);
+
+    auto buildFlag = [&] (NodeFlag Flag, const NodesSet &Nodes) {
+      auto &Bits = Flags[(size_t)Flag];
+      Bits.clear();
+      Bits.resize(NumNodes);
+      for (auto NID : Nodes) {
+        auto Found = NodeIndices.find(NID);
+        if (Found != NodeIndices.end())
+          Bits.set(Found->second);
       }
+    };
 
-      PathNodes.erase(NID);
-    }
-
-    for (auto CutNID : cutSet) {
-      Parent.Dependencies.erase(CutNID);
-    }
+    buildFlag(NodeFlag::Root, Roots);
+    buildFlag(NodeFlag::Terminal, Terminals);
+    buildFlag(NodeFlag::Public, PublicNodes);
+    buildFlag(NodeFlag::External, ExternalNodes);
 
-    return Success;
+    Finalized = true;
   }
 
   void collectTerminals() {
@@ -822,16 +1279,19 @@ protected:
       bool MarkPublic,
       unsigned depth
   ) {
-    with (auto trace = Log.acquire(log::Level::Trace)) {
+    with (auto trace = Log.acquireIfEnabled(log::Level::Trace)) {
       auto &s = trace.s;
       s.indent(depth) << "collectPublicNodes, recursive: ";
       dumpNodeID(s, ForNode);
       s << "\n";
     }
 
+    // Visit without propagation adds nothing to any previous visit,
+    // so non public parts of graph are walked once, rather than
+    // once per path.
     auto insRes = Visited.insert(ForNode);
-    if (!insRes.second && isPublic(ForNode)) {
-      Log.log_trace(std::string(depth, ' '), "- skip as visited and already public.");
+    if (!insRes.second && (isPublic(ForNode) || !MarkPublic)) {
+      LEVITATION_LOG_TRACE(Log, std::string(depth, ' '), "- skip as visited.");
       return;
     }
 
@@ -841,7 +1301,7 @@ protected:
       PublicNodes.insert(ForNode);
 
     if (MarkPublic)
-      Log.log_trace(std::string(depth, ' '), "- propogate public");
+      LEVITATION_LOG_TRACE(Log, std::string(depth, ' '), "- propogate public");
 
     const auto &N = getNode(ForNode);
     for (auto DepN : N.Dependencies)
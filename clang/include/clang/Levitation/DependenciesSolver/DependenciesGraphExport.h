@@ -0,0 +1,298 @@
+//===--- DependenciesGraphExport.h ------------------------------*- C++ -*-===//
+//
+// Part of the C++ Levitation Project,
+// under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file defines export of dependencies graph into DOT and JSON,
+//  with cost of each node: its fan-in and fan-out, how many nodes it
+//  affects and needs transitively, its compile time and peak memory,
+//  and its position on critical path. It is used to find units whose
+//  changes invalidate most of the tree, or which slow down their
+//  dependents.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_LEVITATION_DEPENDENCIESGRAPHEXPORT_H
+#define LLVM_LEVITATION_DEPENDENCIESGRAPHEXPORT_H
+
+#include "clang/Levitation/DependenciesSolver/DependenciesGraph.h"
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace clang { namespace levitation { namespace dependencies_solver {
+
+class DependenciesGraphExport {
+public:
+
+  enum class Format { Dot, Json };
+
+  struct NodeCosts {
+    /// Last compile time, in microseconds, 0 if unknown.
+    uint64_t Duration = 0;
+
+    /// Last peak resident set size, in bytes, 0 if unknown.
+    uint64_t PeakMemory = 0;
+  };
+
+  using CostsFn = std::function<NodeCosts(const DependenciesGraph::Node&)>;
+
+  struct NodeRecord {
+    std::string ID;
+    std::string Unit;
+    DependenciesGraph::NodeKind Kind;
+    bool IsPublic;
+    bool IsExternal;
+
+    size_t NumDependencies;
+    size_t NumDependents;
+    size_t NumTransitiveDependencies;
+    size_t NumTransitiveDependents;
+
+    NodeCosts Costs;
+
+    /// Weight of heaviest path from node up to terminals, node included.
+    uint64_t CriticalPath;
+
+    /// Position on critical path, counted from its start, or -1
+    /// if node is not on it.
+    int CriticalPathPosition = -1;
+  };
+
+private:
+
+  const DependenciesGraph &Graph;
+
+  /// Indexed by node index.
+  std::vector<NodeRecord> Records;
+
+  uint64_t CriticalPathLength = 0;
+
+  void collect(const DependenciesStringsPool &Strings, const CostsFn &Costs) {
+    using NodeIndex = DependenciesGraph::NodeIndex;
+
+    size_t NumNodes = Graph.getNumNodes();
+
+    auto Dependencies = Graph.calcClosureSizes(/*ByDependents=*/false);
+    auto Dependents = Graph.calcClosureSizes(/*ByDependents=*/true);
+
+    Records.resize(NumNodes);
+    for (NodeIndex Idx = 0; Idx != NumNodes; ++Idx) {
+      const auto &N = Graph.getNodeByIndex(Idx);
+      auto &R = Records[Idx];
+
+      llvm::raw_string_ostream IDOut(R.ID);
+      Graph.dumpNodeID(IDOut, N.ID);
+      IDOut.flush();
+
+      R.Unit = Strings.getItem(
+          N.LevitationUnit ?
+          N.LevitationUnit->UnitPath :
+          DependenciesGraph::NodeID::getKindAndPathID(N.ID).second
+      )->str();
+
+      R.Kind = N.Kind;
+      R.IsPublic = Graph.hasFlag(Idx, DependenciesGraph::NodeFlag::Public);
+      R.IsExternal = Graph.hasFlag(Idx, DependenciesGraph::NodeFlag::External);
+      R.NumDependencies = Graph.getDependencies(Idx).size();
+      R.NumDependents = Graph.getDependentNodes(Idx).size();
+      R.NumTransitiveDependencies = Dependencies[Idx];
+      R.NumTransitiveDependents = Dependents[Idx];
+      R.Costs = Costs(N);
+    }
+
+    // Unknown costs count as smallest ones, so that path
+    // still goes through longest chain of nodes.
+    auto Paths = Graph.calcCriticalPaths(
+        [&] (const DependenciesGraph::Node &N) {
+          return std::max<uint64_t>(
+              Records[Graph.getNodeIndex(N.ID)].Costs.Duration, 1
+          );
+        }
+    );
+
+    NodeIndex Current = NumNodes;
+    for (NodeIndex Idx = 0; Idx != NumNodes; ++Idx) {
+      auto &R = Records[Idx];
+      R.CriticalPath = Paths[Graph.getNodeByIndex(Idx).ID];
+      if (R.CriticalPath > CriticalPathLength) {
+        CriticalPathLength = R.CriticalPath;
+        Current = Idx;
+      }
+    }
+
+    // Path goes by heaviest dependents.
+    for (int Pos = 0; Current != NumNodes; ++Pos) {
+      Records[Current].CriticalPathPosition = Pos;
+
+      NodeIndex Next = NumNodes;
+      for (auto DependentIdx : Graph.getDependentNodes(Current))
+        if (
+          Records[DependentIdx].CriticalPathPosition == -1 &&
+          (Next == NumNodes ||
+           Records[DependentIdx].CriticalPath > Records[Next].CriticalPath)
+        )
+          Next = DependentIdx;
+
+      Current = Next;
+    }
+  }
+
+  static const char *getKindName(DependenciesGraph::NodeKind Kind) {
+    return Kind == DependenciesGraph::NodeKind::Declaration ?
+        "declaration" : "definition";
+  }
+
+  void writeDot(llvm::raw_ostream &Out) const {
+    using NodeIndex = DependenciesGraph::NodeIndex;
+
+    size_t NumNodes = Records.size();
+
+    Out
+    << "digraph levitation {\n"
+    << "  node [shape=box, style=filled];\n";
+
+    for (NodeIndex Idx = 0; Idx != NumNodes; ++Idx) {
+      const auto &R = Records[Idx];
+
+      // The more nodes are affected by node, the redder it is.
+      double Affected = NumNodes > 1 ?
+          double(R.NumTransitiveDependents) / (NumNodes - 1) : 0;
+
+      Out
+      << "  n" << Idx << " [label=\"" << R.Unit << "\\n"
+      << (R.Kind == DependenciesGraph::NodeKind::Declaration ? "DECL" : "DEF")
+      << (R.IsPublic ? ", public" : "")
+      << (R.IsExternal ? ", external" : "") << "\\n"
+      << R.Costs.Duration / 1000 << " ms, "
+      << R.Costs.PeakMemory / (1024 * 1024) << " MB\\n"
+      << "affects " << R.NumTransitiveDependents
+      << ", needs " << R.NumTransitiveDependencies << "\""
+      << ", fillcolor=\"0.000 " << llvm::format("%.3f", Affected) << " 1.000\"";
+
+      if (R.CriticalPathPosition != -1)
+        Out << ", penwidth=3";
+
+      Out << "];\n";
+    }
+
+    for (NodeIndex Idx = 0; Idx != NumNodes; ++Idx)
+      for (auto DependentIdx : Graph.getDependentNodes(Idx)) {
+        Out << "  n" << Idx << " -> n" << DependentIdx;
+
+        bool Critical =
+            Records[Idx].CriticalPathPosition != -1 &&
+            Records[DependentIdx].CriticalPathPosition ==
+                Records[Idx].CriticalPathPosition + 1;
+
+        if (Critical)
+          Out << " [color=red, penwidth=3]";
+
+        Out << ";\n";
+      }
+
+    Out << "}\n";
+  }
+
+  void writeJson(llvm::raw_ostream &Out) const {
+    using NodeIndex = DependenciesGraph::NodeIndex;
+
+    llvm::json::OStream J(Out, /*IndentSize=*/2);
+
+    J.object([&] {
+      J.attribute("critical_path_us", (int64_t)CriticalPathLength);
+
+      J.attributeArray("nodes", [&] {
+        for (const auto &R : Records) {
+          J.object([&] {
+            J.attribute("id", R.ID);
+            J.attribute("unit", R.Unit);
+            J.attribute("kind", getKindName(R.Kind));
+            J.attribute("public", R.IsPublic);
+            J.attribute("external", R.IsExternal);
+            J.attribute("fan_in", (int64_t)R.NumDependencies);
+            J.attribute("fan_out", (int64_t)R.NumDependents);
+            J.attribute(
+                "transitive_dependencies", (int64_t)R.NumTransitiveDependencies
+            );
+            J.attribute(
+                "transitive_dependents", (int64_t)R.NumTransitiveDependents
+            );
+            J.attribute("duration_us", (int64_t)R.Costs.Duration);
+            J.attribute("peak_rss", (int64_t)R.Costs.PeakMemory);
+            J.attribute("critical_path_us", (int64_t)R.CriticalPath);
+            J.attribute("critical_path_position", R.CriticalPathPosition);
+          });
+        }
+      });
+
+      J.attributeArray("edges", [&] {
+        for (NodeIndex Idx = 0, e = Records.size(); Idx != e; ++Idx)
+          for (auto DependentIdx : Graph.getDependentNodes(Idx))
+            J.object([&] {
+              J.attribute("dependency", Records[Idx].ID);
+              J.attribute("dependent", Records[DependentIdx].ID);
+            });
+      });
+    });
+  }
+
+public:
+
+  /// \param Costs returns costs of particular node, e.g. durations
+  ///        and memory recorded by build history.
+  DependenciesGraphExport(
+      const DependenciesGraph &graph,
+      const DependenciesStringsPool &Strings,
+      const CostsFn &Costs
+  ) : Graph(graph) {
+    assert(Graph.isFinalized() && "Graph should be finalized");
+    collect(Strings, Costs);
+  }
+
+  /// Format is picked by file extension: .dot or .gv for DOT,
+  /// .json for JSON.
+  /// \return false if extension is not known.
+  static bool getFormat(llvm::StringRef File, Format &F) {
+    auto Ext = llvm::sys::path::extension(File);
+    if (Ext == ".dot" || Ext == ".gv") {
+      F = Format::Dot;
+      return true;
+    }
+    if (Ext == ".json") {
+      F = Format::Json;
+      return true;
+    }
+    return false;
+  }
+
+  llvm::ArrayRef<NodeRecord> getRecords() const { return Records; }
+
+  uint64_t getCriticalPathLength() const { return CriticalPathLength; }
+
+  void write(llvm::raw_ostream &Out, Format F) const {
+    switch (F) {
+      case Format::Dot:
+        writeDot(Out);
+        break;
+      case Format::Json:
+        writeJson(Out);
+        break;
+    }
+  }
+};
+
+}}} // end of clang::levitation::dependencies_solver namespace
+
+#endif //LLVM_LEVITATION_DEPENDENCIESGRAPHEXPORT_H
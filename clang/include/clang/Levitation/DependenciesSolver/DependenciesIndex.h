@@ -0,0 +1,125 @@
+//===--- DependenciesIndex.h - C++ Levitation DependenciesIndex -*- C++ -*-===//
+//
+// Part of the C++ Levitation Project,
+// under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file defines project-wide dependencies index. Index keeps
+//  dependencies of all units in single file with shared strings table,
+//  so that solver doesn't have to open .ldeps file of each unit
+//  on every build.
+//
+//  File layout, all numbers are 32 bit little endian:
+//    header:  magic, version, number of strings, number of units,
+//             size of strings blob
+//    strings: offsets table (number of strings + 1 items), then blob
+//             padded to 4 bytes
+//    units:   for each unit: path string, flags, source hash size,
+//             number of declaration and definition dependencies,
+//             then source hash padded to 4 bytes, then dependencies
+//             string indices.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_LEVITATION_DEPENDENCIESINDEX_H
+#define LLVM_LEVITATION_DEPENDENCIESINDEX_H
+
+#include "clang/Levitation/Common/Failable.h"
+#include "clang/Levitation/Common/StringsPool.h"
+#include "clang/Levitation/Common/Utility.h"
+#include "clang/Levitation/Serialization.h"
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+
+#include <functional>
+
+namespace llvm {
+  class MemoryBuffer;
+  class raw_ostream;
+}
+
+namespace clang { namespace levitation { namespace dependencies_solver {
+
+class DependenciesIndex {
+public:
+
+  /// Dependencies of single unit, as they were loaded from its .ldeps.
+  struct UnitRecord {
+    /// Hash of source .ldeps were built from.
+    HashVectorTy SourceHash;
+
+    bool IsPublic = false;
+    bool IsBodyOnly = false;
+
+    /// Dependencies, as IDs in index strings pool.
+    llvm::SmallVector<StringID, 8> DeclarationDependencies;
+    llvm::SmallVector<StringID, 8> DefinitionDependencies;
+  };
+
+private:
+
+  DependenciesStringsPool Strings;
+
+  /// Units records, keyed by unit path.
+  llvm::StringMap<UnitRecord> Units;
+
+  /// Whether index was modified since it was loaded or saved.
+  bool Changed = false;
+
+  static void addDependencies(
+      DependenciesStringsPool &DestStrings,
+      DependenciesData::DeclarationsBlock &Dest,
+      const DependenciesStringsPool &SrcStrings,
+      llvm::ArrayRef<StringID> Src
+  );
+
+public:
+
+  DependenciesIndex() = default;
+  DependenciesIndex(const DependenciesIndex&) = delete;
+  DependenciesIndex &operator=(const DependenciesIndex&) = delete;
+
+  /// Reads dependencies of unit, if index has record of it
+  /// made for same source.
+  /// \param Data destination, dependencies are added into its own
+  ///        strings pool.
+  /// \return false if there is no such record, or source has changed
+  ///         since record was made.
+  bool getDependencies(
+      DependenciesData &Data,
+      llvm::StringRef UnitPath,
+      HashRef SourceHash
+  ) const;
+
+  /// Adds or replaces record of unit.
+  void setDependencies(
+      llvm::StringRef UnitPath,
+      HashRef SourceHash,
+      const DependenciesData &Data
+  );
+
+  /// Removes records of units for which ShouldRemove returns true.
+  void removeUnits(std::function<bool(llvm::StringRef)> &&ShouldRemove);
+
+  size_t size() const { return Units.size(); }
+
+  bool isChanged() const { return Changed; }
+
+  /// Loads index, existing records are dropped. Index file is mapped
+  /// into memory as is, so it is read with single mmap.
+  Failable load(llvm::StringRef IndexFile);
+  Failable read(const llvm::MemoryBuffer &Buffer);
+
+  /// Writes index into temporary file, and then renames it to IndexFile.
+  Failable save(llvm::StringRef IndexFile);
+  void write(llvm::raw_ostream &OS) const;
+};
+
+}}} // end of clang::levitation::dependencies_solver namespace
+
+#endif //LLVM_LEVITATION_DEPENDENCIESINDEX_H
@@ -16,6 +16,7 @@
 
 #include "clang/Levitation/Common/Failable.h"
 #include "clang/Levitation/Common/Path.h"
+#include "clang/Levitation/Common/Utility.h"
 #include "clang/Levitation/Driver/PackageFiles.h"
 
 #include "llvm/ADT/DenseMap.h"
@@ -23,6 +24,7 @@
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/StringRef.h"
 
+#include <functional>
 #include <memory>
 
 namespace llvm {
@@ -33,13 +35,30 @@ namespace clang {
   class FileManager;
 }
 
+namespace clang { namespace levitation {
+  struct DependenciesData;
+}}
+
 namespace clang { namespace levitation { namespace dependencies_solver {
 
+class DependenciesIndex;
+class ParsedDependencies;
 class SolvedDependenciesInfo;
 class DependenciesSolver : public Failable {
   llvm::StringRef SourcesRoot;
   llvm::StringRef BuildRoot;
   bool Verbose = false;
+
+  std::shared_ptr<ParsedDependencies> PrevParsedDeps;
+  std::shared_ptr<SolvedDependenciesInfo> PrevSolvedInfo;
+  const PathIDsSet *UpdatedPackages = nullptr;
+
+  DependenciesIndex *Index = nullptr;
+  std::function<HashVectorTy(StringID)> GetSourceHash;
+
+  std::function<void(ParsedDependencies&)> Refine;
+
+  std::shared_ptr<ParsedDependencies> ParsedDeps;
 public:
 
   void setVerbose(bool Verbose) {
@@ -54,6 +73,52 @@ public:
     DependenciesSolver::BuildRoot = BuildRoot;
   }
 
+  /// Enables incremental solving. Only .ldeps of updated and new
+  /// packages are loaded, dependencies of other packages are taken
+  /// from previous result. If no package has changed its dependencies,
+  /// previous solution is reused as is.
+  /// \param Parsed dependencies loaded during previous solve,
+  /// will be updated in place.
+  /// \param Solved previous solution.
+  /// \param Updated packages whose .ldeps were rebuilt since previous solve.
+  void setPreviousResult(
+      std::shared_ptr<ParsedDependencies> Parsed,
+      std::shared_ptr<SolvedDependenciesInfo> Solved,
+      const PathIDsSet &Updated
+  ) {
+    PrevParsedDeps = std::move(Parsed);
+    PrevSolvedInfo = std::move(Solved);
+    UpdatedPackages = &Updated;
+  }
+
+  /// Enables project-wide dependencies index. Packages whose sources
+  /// have same hash as recorded in index are loaded from index, rather
+  /// than from their .ldeps. Other packages are loaded from .ldeps
+  /// and recorded in index. Records of absent packages are removed.
+  /// \param Index index to be used and updated.
+  /// \param GetSourceHash returns hash of package source .ldeps were
+  /// built from, or empty hash if it is unknown.
+  void setIndex(
+      DependenciesIndex &Index,
+      std::function<HashVectorTy(StringID)> &&GetSourceHash
+  ) {
+    DependenciesSolver::Index = &Index;
+    DependenciesSolver::GetSourceHash = std::move(GetSourceHash);
+  }
+
+  /// Sets callback which may change loaded dependencies before
+  /// graph is built, e.g. demote some declaration dependencies.
+  /// Since result depends on all packages, incremental solving
+  /// is disabled then, see setPreviousResult.
+  void setRefine(std::function<void(ParsedDependencies&)> &&Refine) {
+    DependenciesSolver::Refine = std::move(Refine);
+  }
+
+  /// \return dependencies loaded during last solve.
+  std::shared_ptr<ParsedDependencies> getParsedDependencies() const {
+    return ParsedDeps;
+  }
+
   // TODO Levitation: pass <PackageID, LDepPath> instead.
   std::shared_ptr<SolvedDependenciesInfo> solve(
       const PathIDsSet &ExternalPackages,
@@ -62,6 +127,11 @@ public:
 
   bool solve();
 
+  /// Reads dependencies of single package.
+  /// Dependencies are kept in Data's own strings pool.
+  /// \return false if file can't be read.
+  static bool loadDependencies(DependenciesData &Data, llvm::StringRef LDepPath);
+
   friend class DependenciesSolverImpl;
 };
 
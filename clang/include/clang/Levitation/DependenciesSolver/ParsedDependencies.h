@@ -31,6 +31,57 @@ public:
 
   void add(StringID PackageID, const DependenciesData &Deps) {
 
+    auto LevitationPackage = remap(PackageID, Deps);
+
+    auto InsertionRes = Map.insert({PackageID, std::move(LevitationPackage)});
+    if (!InsertionRes.second)
+      llvm_unreachable("Loaded dependencies has been already added");
+  }
+
+  /// Adds or replaces dependencies of given package.
+  /// \return true if package is new or its dependencies were changed.
+  bool replace(StringID PackageID, const DependenciesData &Deps) {
+    auto LevitationPackage = remap(PackageID, Deps);
+
+    auto &Existing = Map[PackageID];
+    bool Changed = !Existing || !isSame(*Existing, *LevitationPackage);
+
+    Existing = std::move(LevitationPackage);
+    return Changed;
+  }
+
+  void remove(StringID PackageID) {
+    Map.erase(PackageID);
+  }
+
+  /// Turns declaration dependency of given package into
+  /// definition one, so that it is not propagated to package dependents.
+  /// \return false if package has no such declaration dependency.
+  bool demote(StringID PackageID, StringID DepID) {
+    auto Found = Map.find(PackageID);
+    if (
+      Found == Map.end() ||
+      !Found->second->DeclarationDependencies.erase(Declaration(DepID))
+    )
+      return false;
+
+    Found->second->DefinitionDependencies.insert(Declaration(DepID));
+    return true;
+  }
+
+  bool contains(StringID PackageID) const {
+    return Map.count(PackageID);
+  }
+
+  DependenciesMap::const_iterator begin() const { return Map.begin(); }
+  DependenciesMap::const_iterator end() const { return Map.end(); }
+
+private:
+
+  std::unique_ptr<DependenciesData> remap(
+      StringID PackageID,
+      const DependenciesData &Deps
+  ) {
     auto OldToNew = makeOldToNew(*Deps.Strings);
 
     auto LevitationPackage = createPackageFor(PackageID);
@@ -48,15 +99,29 @@ public:
       LevitationPackage->DefinitionDependencies.insert(Declaration(NewDepID));
     }
 
-    auto InsertionRes = Map.insert({PackageID, std::move(LevitationPackage)});
-    if (!InsertionRes.second)
-      llvm_unreachable("Loaded dependencies has been already added");
+    return LevitationPackage;
   }
 
-  DependenciesMap::const_iterator begin() const { return Map.begin(); }
-  DependenciesMap::const_iterator end() const { return Map.end(); }
+  static bool isSame(
+      const DependenciesData::DeclarationsBlock &L,
+      const DependenciesData::DeclarationsBlock &R
+  ) {
+    if (L.size() != R.size())
+      return false;
 
-private:
+    for (const auto &D : L)
+      if (!R.count(D))
+        return false;
+
+    return true;
+  }
+
+  static bool isSame(const DependenciesData &L, const DependenciesData &R) {
+    return L.IsPublic == R.IsPublic &&
+           L.IsBodyOnly == R.IsBodyOnly &&
+           isSame(L.DeclarationDependencies, R.DeclarationDependencies) &&
+           isSame(L.DefinitionDependencies, R.DefinitionDependencies);
+  }
 
   llvm::DenseMap<StringID, StringID> makeOldToNew(const DependenciesStringsPool& OldStrings) {
 
@@ -18,7 +18,9 @@
 #include "clang/Levitation/Common/Failable.h"
 #include "clang/Levitation/Common/WithOperator.h"
 #include "clang/Levitation/Serialization.h"
+#include "clang/Levitation/TasksManager/TasksManager.h"
 
+#include "llvm/ADT/BitVector.h"
 #include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/DenseSet.h"
 #include "llvm/ADT/SmallVector.h"
@@ -28,9 +30,11 @@
 
 #include <algorithm>
 #include <assert.h>
+#include <cstdint>
+#include <functional>
 #include <memory>
-#include <map>
 #include <utility>
+#include <vector>
 
 namespace clang { namespace levitation { namespace dependencies_solver {
 
@@ -38,31 +42,28 @@ class SolvedDependenciesInfo : public Failable {
 
   using NodeID = DependenciesGraph::NodeID;
   using Node = DependenciesGraph::Node;
-  using NodesSet = DependenciesGraph::NodesSet;
-
-  typedef DenseMap<NodeID::Type, size_t> TopologicallyOrderedNodesTy;
-  TopologicallyOrderedNodesTy TopologicallyOrderedNodes;
+  using NodeIndex = DependenciesGraph::NodeIndex;
 
   typedef DenseMap<NodeID::Type, size_t /*distance from terminal*/> PathTy;
   typedef SmallVector<PathTy, 4> CyclesTy;
 
 public:
-  using RangedDependenciesMap = std::map<size_t, NodeID::Type>;
-  struct NodeStackInfo {
-    size_t StackSize;
-    RangedDependenciesMap FullDependencies;
-  };
-
-  using FullDepsMapTy =
-      llvm::DenseMap<NodeID::Type, NodeStackInfo>;
-
-  using OnDiagCyclesFoundFn = std::function<void(
-      const RangedDependenciesMap &, NodeID::Type
-  )>;
+  using NodesList = DependenciesGraph::NodesList;
 
 private:
   std::shared_ptr<DependenciesGraph> DGraph;
-  FullDepsMapTy FullDepsMap;
+
+  /// Topological rank of node, indexed by node index. Every node
+  /// has greater rank than all its dependencies.
+  std::vector<size_t> Ranks;
+
+  /// Nodes in topological order, that is indexed by rank.
+  std::vector<NodeIndex> RankedNodes;
+
+  /// Direct and indirect dependencies of each node, as set of ranks,
+  /// indexed by node index. Empty for nodes without dependencies.
+  std::vector<llvm::BitVector> Closures;
+
   CyclesTy Cycles;
 
   SolvedDependenciesInfo(
@@ -78,180 +79,127 @@ private:
     Cycles.push_back(C);
   }
 
-  /// Finds topological order by means of DFS, and for each node
-  /// collects direct or indirect dependencies set (topologically ordered deps, aka TOD).
-  /// Note, there is no stack of topological ordered nodes. It's only
-  /// current stack size of that stack (Range) we need to create TOD for each node.
-  /// \param G Graph method operates on
-  /// \param N Current node
-  /// \param DistFromTerm distance from terminal node, which was used as root
-  ///        for recursive call. Is required for diagnostics, for proper cycles info.
-  /// \param StackSize distance from leaf node, equal to stack size which is used in
-  ///        classical DFS topological ordering algorithm.
-  /// \param CycleCandidate Set of nodes which are currently participate
-  ///        recursive call chain. If on some call we bump into duplicate,
-  ///        then it's a cycle.
-  void dfsSolve(
-      const DependenciesGraph &G,
-      const Node &N,
-      size_t DistFromTerm,
-      size_t &StackSize,
-      PathTy& CycleCandidate
-  ) {
-
-#if 1
-    static auto &Strings = CreatableSingleton<DependenciesStringsPool>::get();
-
-    with (auto TraceScope = log::Logger::get().acquire(log::Level::Verbose)) {
-      auto &Trace = TraceScope.s;
-      Trace.indent(DistFromTerm)
-          << "dfsSolve for ";
-      G.dumpNodeShort(Trace, N.ID, Strings);
-      Trace << "\n";
-    }
-#endif
-
-    // Detect cycles if any.
-    auto InsCycle = CycleCandidate.insert({N.ID, DistFromTerm});
-    if (!InsCycle.second) {
-      addCycle(CycleCandidate);
-      return;
-    }
-
-    // Guard CycleCandidate, so current node would be removed automatically,
-    // once we exit this call.
-    with (auto _ = on_exit([&] { CycleCandidate.erase(N.ID); }))
-    {
-      // Don't go through already visited nodes.
-      auto InsRes = FullDepsMap.insert({N.ID, NodeStackInfo()});
-      if (!InsRes.second)
+  /// Finds topological order and cycles, if any. Strongly connected
+  /// components are reported with dependencies first, so in acyclic
+  /// graph each node gets rank, which is equal to number of nodes
+  /// ranked before it.
+  void solve(const DependenciesGraph &G) {
+    using SCCTy = DependenciesGraph::StronglyConnectedComponents;
+    SCCTy SCC(G);
+
+    auto onComponent = [&] (llvm::ArrayRef<NodeIndex> Component) {
+      if (SCC.isCycle(Component)) {
+        PathTy Cycle;
+        for (size_t i = 0, e = Component.size(); i != e; ++i)
+          Cycle.insert({G.getNodeByIndex(Component[i]).ID, i});
+        addCycle(Cycle);
         return;
+      }
 
-      // Go over all dependency nodes and do DFS.
-
-      size_t NextDistFromTerm = DistFromTerm + 1;
-
-      for (auto InNID : N.Dependencies) {
-        const auto &InN = G.getNode(InNID);
-
-        dfsSolve(G, InN, NextDistFromTerm, StackSize, CycleCandidate);
-
-        assert(
-          FullDepsMap.count(InNID) &&
-          "Info for all in Nodes should be added it deeper recursive calls"
-        );
-
-        // As long as we're working with DenseMap, its contents invalidated
-        // after each insertion, and thus if we would obtain NodeInfo->FullDeps before loop
-        // with dfs calls we couldn't rely on its contents all the way.
-        auto &FullDeps = FullDepsMap[N.ID].FullDependencies;
+      auto Idx = Component.front();
+      Ranks[Idx] = RankedNodes.size();
+      RankedNodes.push_back(Idx);
+    };
 
-        const auto &InNodeInfo = FullDepsMap[InNID];
-        const auto &InNodeFullDeps = InNodeInfo.FullDependencies;
-        for (const auto &InDepkv : InNodeFullDeps) {
-          FullDeps.insert(InDepkv);
-#if 1
-          with (auto TraceScope = log::Logger::get().acquire(log::Level::Verbose)) {
-            auto &Trace = TraceScope.s;
+    for (auto &NID : G.terminals())
+      SCC.walk(G.getNodeIndex(NID), onComponent);
 
-            Trace.indent(DistFromTerm) << " copy chain item { " << InDepkv.first << " : ";
-            G.dumpNodeShort(Trace, InDepkv.second, Strings);
-            Trace.indent(DistFromTerm) << " }\n";
-          }
-#endif
-        }
-#if 1
-        with (auto TraceScope = log::Logger::get().acquire(log::Level::Verbose)) {
-          auto &Trace = TraceScope.s;
+    // Nodes which are not reachable from terminals belong to isolated
+    // cycles, or depend on them.
+    for (NodeIndex Idx = 0, e = G.getNumNodes(); Idx != e; ++Idx)
+      SCC.walk(Idx, onComponent);
+  }
 
-          Trace.indent(DistFromTerm) << " insert { " << InNodeInfo.StackSize << " : ";
-          G.dumpNodeShort(Trace, InNID, Strings);
-          Trace.indent(DistFromTerm) << " }\n";
-        }
-#endif
-        FullDeps.insert({InNodeInfo.StackSize, InNID});
-      }
+  /// Levels smaller than this are not worth parallel processing.
+  static const size_t MIN_PARALLEL_LEVEL = 64;
 
-      FullDepsMap[N.ID].StackSize = StackSize++;
-#if 1
-      with (auto TraceScope = log::Logger::get().acquire(log::Level::Verbose)) {
-        auto &Trace = TraceScope.s;
-        Trace.indent(DistFromTerm) << "Stack size " << StackSize << "\n";
-      }
-#endif
-    }
-  }
+  void buildClosure(const DependenciesGraph &G, NodeIndex Idx) {
+    auto Dependencies = G.getDependencies(Idx);
+    if (Dependencies.empty())
+      return;
 
-  void dfsSolveRoot(const DependenciesGraph &G, const Node &N, size_t &Range) {
-    PathTy CycleCandidate;
-    dfsSolve(G, N, 0, Range, CycleCandidate);
-  }
+    auto &Closure = Closures[Idx];
+    Closure.resize(RankedNodes.size());
 
-  void findCycles(const DependenciesGraph &G, const NodesSet &SubGraph) {
-    NodesSet Visited;
-    for (auto &NID : SubGraph) {
-      if (!Visited.count(NID)) {
-        PathTy CycleCandidate;
-        findCyclesDfs(G, SubGraph, NID, Visited, 0, CycleCandidate);
-      }
+    for (auto InIdx : Dependencies) {
+      assert(Ranks[InIdx] < Ranks[Idx] && "Broken topological order");
+      Closure |= Closures[InIdx];
+      Closure.set(Ranks[InIdx]);
     }
   }
 
-  void findCyclesDfs(
-      const DependenciesGraph &G,
-      const NodesSet &SubGraph,
-      NodeID::Type NID,
-      NodesSet &Visited,
-      size_t DistFromRoot,
-      PathTy &CycleCandidate
-  ) {
-    auto InsCycle = CycleCandidate.insert({NID, DistFromRoot});
-    if (!InsCycle.second) {
-      addCycle(CycleCandidate);
-      return;
+  /// Collects full dependencies of each node. Nodes are processed
+  /// level by level, where node's level is greater than levels of all
+  /// its dependencies, so closures of dependencies are complete
+  /// by the moment they are merged into dependent node closure.
+  /// Nodes of same level don't depend on each other, so wide levels
+  /// are split between TasksManager workers, if there are any.
+  void buildClosures(const DependenciesGraph &G) {
+    std::vector<size_t> Levels(G.getNumNodes());
+    std::vector<std::vector<NodeIndex>> LevelNodes;
+
+    for (auto Idx : RankedNodes) {
+      size_t Level = 0;
+      for (auto InIdx : G.getDependencies(Idx))
+        Level = std::max(Level, Levels[InIdx] + 1);
+
+      Levels[Idx] = Level;
+      if (Level == LevelNodes.size())
+        LevelNodes.emplace_back();
+      LevelNodes[Level].push_back(Idx);
     }
 
-    with (auto _ = on_exit([&] { CycleCandidate.erase(NID); })) {
-      auto InsRes = Visited.insert(NID);
-      if (!InsRes.second)
-        return;
+    tasks::TasksManager *TM =
+        tasks::TasksManager::isCreated() ? &tasks::TasksManager::get() : nullptr;
 
-      auto &N = G.getNode(NID);
-      auto NextDist = DistFromRoot + 1;
+    size_t NumChunks =
+        TM && TM->getWorkersNumber() > 0 ? TM->getWorkersNumber() * 4 : 1;
 
-      for (auto InNID : N.Dependencies) if (SubGraph.count(InNID))
-        findCyclesDfs(G, SubGraph, InNID, Visited, NextDist, CycleCandidate);
-    }
-  }
+    // Roots have empty closures.
+    for (size_t Level = 1, e = LevelNodes.size(); Level < e; ++Level) {
+      auto &Nodes = LevelNodes[Level];
 
-  void findIsolatedCycles(const DependenciesGraph &G) {
-    const auto &AllNodes = G.allNodes();
-    NodesSet IsolatedCycles;
+      if (NumChunks == 1 || Nodes.size() < MIN_PARALLEL_LEVEL) {
+        for (auto Idx : Nodes)
+          buildClosure(G, Idx);
+        continue;
+      }
 
-    if (TopologicallyOrderedNodes.size() != AllNodes.size()) {
-      for (const auto &Nkv : AllNodes) {
-        auto NID = Nkv.first;
-        if (!TopologicallyOrderedNodes.count(NID))
-          IsolatedCycles.insert(NID);
+      size_t ChunkSize = (Nodes.size() + NumChunks - 1) / NumChunks;
+
+      tasks::TasksManager::TasksSet Tasks;
+      for (size_t Begin = 0; Begin < Nodes.size(); Begin += ChunkSize) {
+        size_t End = std::min(Begin + ChunkSize, Nodes.size());
+        auto TID = TM->runTask([&, Begin, End] (
+            tasks::TasksManager::TaskContext &TC
+        ) {
+          for (size_t i = Begin; i != End; ++i)
+            buildClosure(G, Nodes[i]);
+          TC.Successful = true;
+        });
+        Tasks.insert(TID);
       }
-      findCycles(G, IsolatedCycles);
+
+      TM->waitForTasks(Tasks);
     }
   }
 
   void build() {
     const auto &G = getDependenciesGraph();
 
-    size_t Range = 0;
+    size_t NumNodes = G.getNumNodes();
+    Ranks.resize(NumNodes);
+    RankedNodes.reserve(NumNodes);
+    Closures.resize(NumNodes);
 
-    for (auto &NID : G.terminals())
-      dfsSolveRoot(G, G.getNode(NID), Range);
-
-    findIsolatedCycles(G);
+    solve(G);
 
     if (!Cycles.empty()) {
       setFailure("Found cycles.");
       return;
     }
+
+    buildClosures(G);
   }
 
 public:
@@ -269,19 +217,158 @@ public:
     return *DGraph;
   }
 
-  const FullDepsMapTy &getDependenciesMap() const {
-    return FullDepsMap;
+  /// Returns direct and indirect dependencies of node in topological
+  /// order, so each dependency goes after its own dependencies.
+  NodesList getFullDependencies(NodeID::Type NID) const {
+    NodesList FullDeps;
+
+    if (Closures.empty())
+      return FullDeps;
+
+    const auto &G = getDependenciesGraph();
+    for (auto Rank : Closures[G.getNodeIndex(NID)].set_bits())
+      FullDeps.push_back(G.getNodeByIndex(RankedNodes[Rank]).ID);
+
+    return FullDeps;
   }
 
-  const RangedDependenciesMap &getRangedDependencies(NodeID::Type NID) const {
-    static RangedDependenciesMap EmptyMap;
+  /// Node ID -> worker index.
+  using WorkersMap = llvm::DenseMap<NodeID::Type, unsigned>;
+
+  using NodesLess = std::function<bool(const Node&, const Node&)>;
+
+  /// Splits graph between NumWorkers workers, so that nodes which
+  /// share dependencies go to same worker and their products are
+  /// shipped to it only once.
+  /// Nodes are placed in topological order. Each node goes to worker
+  /// which already keeps most of its full dependencies, or to least
+  /// loaded worker, if none keeps any. Worker load, as sum of node
+  /// weights, is kept within MaxImbalance of average load.
+  /// Nodes of zero weight are not placed, though they are still kept
+  /// by workers of their dependent nodes.
+  /// \param Less if set, breaks ties of topological order, so that
+  ///        partition doesn't depend on order graph was built in.
+  WorkersMap partitionWorkers(
+      unsigned NumWorkers,
+      std::function<uint64_t(const Node&)> &&Weight,
+      double MaxImbalance = 0.1,
+      const NodesLess &Less = nullptr
+  ) const {
+    WorkersMap Workers;
+
+    if (!NumWorkers || Closures.empty())
+      return Workers;
+
+    const auto &G = getDependenciesGraph();
+    size_t NumRanked = RankedNodes.size();
+
+    std::vector<NodeIndex> Order =
+        Less ? getOrderedNodes(Less) : RankedNodes;
+
+    std::vector<uint64_t> Weights(NumRanked);
+    uint64_t Total = 0;
+    for (size_t Rank = 0; Rank != NumRanked; ++Rank) {
+      Weights[Rank] = Weight(G.getNodeByIndex(RankedNodes[Rank]));
+      Total += Weights[Rank];
+    }
 
-    auto Found = FullDepsMap.find(NID);
+    uint64_t Capacity =
+        (uint64_t)((double)Total / NumWorkers * (1.0 + MaxImbalance)) + 1;
 
-    if (Found == FullDepsMap.end())
-      return EmptyMap;
+    std::vector<uint64_t> Loads(NumWorkers);
+
+    // Ranks of nodes whose products are kept by worker.
+    std::vector<llvm::BitVector> Resident(
+        NumWorkers, llvm::BitVector(NumRanked)
+    );
+
+    for (auto Idx : Order) {
+      size_t Rank = Ranks[Idx];
+      if (!Weights[Rank])
+        continue;
+
+      const auto &Closure = Closures[Idx];
+
+      unsigned LeastLoaded =
+          std::min_element(Loads.begin(), Loads.end()) - Loads.begin();
+
+      unsigned Best = LeastLoaded;
+      size_t BestAffinity = 0;
+
+      // Workers are visited in order of their indices, and ties are
+      // resolved with lower load, so partition is deterministic.
+      llvm::BitVector Shared;
+      for (unsigned W = 0; W != NumWorkers; ++W) {
+        if (W != LeastLoaded && Loads[W] + Weights[Rank] > Capacity)
+          continue;
+
+        size_t Affinity = 0;
+        if (!Closure.empty()) {
+          Shared = Closure;
+          Shared &= Resident[W];
+          Affinity = Shared.count();
+        }
+
+        if (
+          Affinity > BestAffinity ||
+          (Affinity == BestAffinity && Loads[W] < Loads[Best])
+        ) {
+          Best = W;
+          BestAffinity = Affinity;
+        }
+      }
+
+      Loads[Best] += Weights[Rank];
+
+      auto &BestResident = Resident[Best];
+      if (!Closure.empty())
+        BestResident |= Closure;
+      BestResident.set(Rank);
+
+      Workers[G.getNodeByIndex(Idx).ID] = Best;
+    }
+
+    return Workers;
+  }
+
+  /// Returns nodes in topological order, where nodes which may go in
+  /// any order are sorted with Less.
+  std::vector<NodeIndex> getOrderedNodes(const NodesLess &Less) const {
+    const auto &G = getDependenciesGraph();
+
+    std::vector<NodeIndex> Order;
+    Order.reserve(RankedNodes.size());
+
+    auto Greater = [&] (NodeIndex L, NodeIndex R) {
+      return Less(G.getNodeByIndex(R), G.getNodeByIndex(L));
+    };
+
+    std::vector<NodeIndex> Ready;
+    std::vector<size_t> NumPending(G.getNumNodes());
+
+    for (auto Idx : RankedNodes) {
+      NumPending[Idx] = G.getDependencies(Idx).size();
+      if (!NumPending[Idx])
+        Ready.push_back(Idx);
+    }
+
+    std::make_heap(Ready.begin(), Ready.end(), Greater);
+
+    while (!Ready.empty()) {
+      std::pop_heap(Ready.begin(), Ready.end(), Greater);
+      auto Idx = Ready.back();
+      Ready.pop_back();
+
+      Order.push_back(Idx);
+
+      for (auto DependentIdx : G.getDependentNodes(Idx))
+        if (!--NumPending[DependentIdx]) {
+          Ready.push_back(DependentIdx);
+          std::push_heap(Ready.begin(), Ready.end(), Greater);
+        }
+    }
 
-    return Found->second.FullDependencies;
+    return Order;
   }
 
   void dump(
@@ -293,7 +380,7 @@ public:
 
     DGraphRef.bsfWalkSkipVisited([&](const Node &N) {
       auto NID = N.ID;
-      const RangedDependenciesMap &FullDeps = getRangedDependencies(NID);
+      auto FullDeps = getFullDependencies(NID);
 
       const auto &Path = *Strings.getItem(N.LevitationUnit->UnitPath);
       out << "[";
@@ -305,12 +392,12 @@ public:
         out
                 << "    Full dependencies:\n";
 
-        for (const auto &DepSzNID : FullDeps) {
-          const auto &Dep = DGraphRef.getNode(DepSzNID.second);
+        for (auto DepNID : FullDeps) {
+          const auto &Dep = DGraphRef.getNode(DepNID);
           const auto &DepPath = *Strings.getItem(Dep.LevitationUnit->UnitPath);
 
           out.indent(8) << "[";
-          DGraphRef.dumpNodeID(out, DepSzNID.second);
+          DGraphRef.dumpNodeID(out, DepNID);
           out
                   << "]: " << DepPath << "\n";
         }
@@ -17,11 +17,23 @@
 
 #include "clang/AST/ASTContext.h"
 #include "clang/AST/Decl.h"
+#include "clang/AST/DeclCXX.h"
+#include "clang/Levitation/Common/DependencyStats.h"
+#include "clang/Levitation/DeclASTMeta/DeclASTMeta.h"
 #include "clang/Serialization/ASTDeserializationListener.h"
+#include "clang/Serialization/ASTReader.h"
+#include "clang/Serialization/ModuleFile.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringSet.h"
 #include "llvm/Support/Casting.h"
 #include "llvm/Support/raw_ostream.h"
 
+#include <algorithm>
 #include <set>
+#include <string>
+#include <vector>
 
 namespace clang { namespace levitation {
 
@@ -123,6 +135,271 @@ public:
   }
 };
 
+/// Returns namespace level declaration D belongs to, e.g. class
+/// for its members. Returns nullptr for namespaces, linkage specs and
+/// template parameters.
+inline const Decl *getNamespaceLevelDecl(const Decl *D) {
+  if (D->isTemplateParameter())
+    return nullptr;
+
+  while (
+    !isa<TranslationUnitDecl>(D) &&
+    !isa<NamespaceDecl>(D) &&
+    !isa<LinkageSpecDecl>(D) &&
+    !isa<ExportDecl>(D)
+  ) {
+    const DeclContext *DC = D->getDeclContext();
+    if (!DC)
+      return nullptr;
+
+    if (DC->getRedeclContext()->isFileContext())
+      return D;
+
+    D = Decl::castFromDeclContext(DC);
+  }
+  return nullptr;
+}
+
+/// Returns key of namespace level declaration D, as it is used by
+/// DeclASTMeta declaration hashes. Declarations without name
+/// get empty key.
+inline std::string getDeclHashKey(const Decl *D) {
+  const auto *ND = dyn_cast<NamedDecl>(D);
+  if (!ND || isa<UsingDirectiveDecl>(ND) || ND->getDeclName().isEmpty())
+    return std::string();
+  return ND->getQualifiedNameAsString();
+}
+
+/// Collects namespace level declarations deserialized from each
+/// dependency, so that driver may find out whether changes in
+/// dependency affect current object.
+class UsedDeclsCollector : public DelegatingDeserializationListener {
+  ASTReader &Reader;
+
+  // Namespace level declaration may be still incomplete when
+  // its part is being read, so we find it only at the end.
+  llvm::DenseSet<const Decl*> Decls;
+
+public:
+  UsedDeclsCollector(ASTReader &Reader,
+                     ASTDeserializationListener *Previous,
+                     bool DeletePrevious)
+      : DelegatingDeserializationListener(Previous, DeletePrevious),
+        Reader(Reader) {}
+
+  void DeclRead(serialization::DeclID ID, const Decl *D) override {
+    Decls.insert(D);
+    DelegatingDeserializationListener::DeclRead(ID, D);
+  }
+
+  /// Returns declarations used for each loaded AST file, even if
+  /// nothing was used from it.
+  DeclASTMeta::UsedDeclsVectorTy getUsedDecls() const {
+    llvm::StringMap<llvm::StringSet<>> Names;
+
+    for (const auto &MF : Reader.getModuleManager())
+      Names[MF.FileName];
+
+    for (const auto *D : Decls) {
+      const auto *Top = getNamespaceLevelDecl(D);
+      if (!Top || !Top->isFromASTFile())
+        continue;
+
+      auto Key = getDeclHashKey(Top);
+      if (Key.empty())
+        continue;
+
+      if (auto *MF = Reader.getOwningModuleFile(Top))
+        Names[MF->FileName].insert(Key);
+    }
+
+    DeclASTMeta::UsedDeclsVectorTy Used;
+    for (const auto &FileNames : Names) {
+      DeclASTMeta::UsedDeclsTy Item;
+      Item.DeclAST = FileNames.first().str();
+      for (const auto &Name : FileNames.second)
+        Item.Names.push_back(Name.first().str());
+      std::sort(Item.Names.begin(), Item.Names.end());
+      Used.push_back(std::move(Item));
+    }
+
+    std::sort(Used.begin(), Used.end(), [] (
+        const DeclASTMeta::UsedDeclsTy &LHS,
+        const DeclASTMeta::UsedDeclsTy &RHS
+    ) {
+      return LHS.DeclAST < RHS.DeclAST;
+    });
+
+    return Used;
+  }
+};
+
+/// Counts declarations, types and identifiers deserialized from each
+/// loaded AST file, see -levitation-stats.
+class DeserializationStatsCollector : public DelegatingDeserializationListener {
+  ASTReader &Reader;
+
+  // Global IDs are attributed to files only at the end,
+  // so that reading is not slowed down by lookups.
+  std::vector<serialization::DeclID> DeclIDs;
+  std::vector<serialization::TypeID> TypeIndices;
+  std::vector<serialization::IdentID> IdentIDs;
+
+  llvm::DenseMap<const serialization::ModuleFile*, uint64_t> LoadTimes;
+
+  using ModuleFile = serialization::ModuleFile;
+  using ModuleRangesTy = std::vector<std::pair<uint64_t, const ModuleFile*>>;
+
+  /// Finds file which owns given global index,
+  /// ranges should be sorted by base index.
+  static const ModuleFile *find(const ModuleRangesTy &Ranges, uint64_t Index) {
+    auto Found = std::upper_bound(
+        Ranges.begin(), Ranges.end(), Index,
+        [] (uint64_t I, const std::pair<uint64_t, const ModuleFile*> &R) {
+          return I < R.first;
+        }
+    );
+    if (Found == Ranges.begin())
+      return nullptr;
+    return (--Found)->second;
+  }
+
+  /// Record size is estimated as distance to next record,
+  /// sorted bit offsets of all file records are expected.
+  static uint64_t getRecordBytes(
+      const std::vector<uint64_t> &Offsets,
+      uint64_t Offset
+  ) {
+    auto Next = std::upper_bound(Offsets.begin(), Offsets.end(), Offset);
+    return Next != Offsets.end() ? (*Next - Offset) / 8 : 0;
+  }
+
+public:
+  DeserializationStatsCollector(ASTReader &Reader,
+                                ASTDeserializationListener *Previous,
+                                bool DeletePrevious)
+      : DelegatingDeserializationListener(Previous, DeletePrevious),
+        Reader(Reader) {}
+
+  void IdentifierRead(serialization::IdentID ID,
+                      IdentifierInfo *II) override {
+    IdentIDs.push_back(ID);
+    DelegatingDeserializationListener::IdentifierRead(ID, II);
+  }
+
+  void TypeRead(serialization::TypeIdx Idx, QualType T) override {
+    TypeIndices.push_back(Idx.getIndex());
+    DelegatingDeserializationListener::TypeRead(Idx, T);
+  }
+
+  void DeclRead(serialization::DeclID ID, const Decl *D) override {
+    DeclIDs.push_back(ID);
+    DelegatingDeserializationListener::DeclRead(ID, D);
+  }
+
+  void addLoadTime(const ModuleFile &MF, uint64_t Microseconds) {
+    LoadTimes[&MF] += Microseconds;
+  }
+
+  /// Returns stats for each loaded AST file, even if
+  /// nothing was deserialized from it.
+  std::vector<DependencyStats> getStats() const {
+    ModuleRangesTy DeclRanges, TypeRanges, IdentRanges;
+    llvm::DenseMap<const ModuleFile*, DependencyStats> Stats;
+
+    for (const auto &MF : Reader.getModuleManager()) {
+      auto &S = Stats[&MF];
+      S.File = MF.FileName;
+
+      auto FoundTime = LoadTimes.find(&MF);
+      if (FoundTime != LoadTimes.end())
+        S.LoadTime = FoundTime->second;
+
+      if (MF.LocalNumDecls)
+        DeclRanges.emplace_back(MF.BaseDeclID, &MF);
+      if (MF.LocalNumTypes)
+        TypeRanges.emplace_back(MF.BaseTypeIndex, &MF);
+      if (MF.LocalNumIdentifiers)
+        IdentRanges.emplace_back(MF.BaseIdentifierID, &MF);
+    }
+
+    for (auto *Ranges : { &DeclRanges, &TypeRanges, &IdentRanges })
+      std::sort(Ranges->begin(), Ranges->end());
+
+    llvm::DenseMap<const ModuleFile*, std::vector<uint64_t>> DeclOffsets;
+    for (auto ID : DeclIDs) {
+      if (ID < serialization::NUM_PREDEF_DECL_IDS)
+        continue;
+
+      uint64_t Index = ID - serialization::NUM_PREDEF_DECL_IDS;
+      const auto *MF = find(DeclRanges, Index);
+      if (!MF || Index - MF->BaseDeclID >= MF->LocalNumDecls)
+        continue;
+
+      auto &S = Stats[MF];
+      ++S.Decls;
+
+      auto &Offsets = DeclOffsets[MF];
+      if (Offsets.empty()) {
+        for (unsigned i = 0; i != MF->LocalNumDecls; ++i)
+          Offsets.push_back(MF->DeclOffsets[i].getBitOffset());
+        std::sort(Offsets.begin(), Offsets.end());
+      }
+      S.Bytes += getRecordBytes(
+          Offsets, MF->DeclOffsets[Index - MF->BaseDeclID].getBitOffset()
+      );
+    }
+
+    llvm::DenseMap<const ModuleFile*, std::vector<uint64_t>> TypeOffsets;
+    for (auto ID : TypeIndices) {
+      if (ID < serialization::NUM_PREDEF_TYPE_IDS)
+        continue;
+
+      uint64_t Index = ID - serialization::NUM_PREDEF_TYPE_IDS;
+      const auto *MF = find(TypeRanges, Index);
+      if (!MF || Index - MF->BaseTypeIndex >= MF->LocalNumTypes)
+        continue;
+
+      auto &S = Stats[MF];
+      ++S.Types;
+
+      auto &Offsets = TypeOffsets[MF];
+      if (Offsets.empty()) {
+        for (unsigned i = 0; i != MF->LocalNumTypes; ++i)
+          Offsets.push_back(MF->TypeOffsets[i].getBitOffset());
+        std::sort(Offsets.begin(), Offsets.end());
+      }
+      S.Bytes += getRecordBytes(
+          Offsets, MF->TypeOffsets[Index - MF->BaseTypeIndex].getBitOffset()
+      );
+    }
+
+    for (auto ID : IdentIDs) {
+      // Identifier IDs are 1-based, 0 is for null identifier.
+      if (!ID)
+        continue;
+
+      uint64_t Index = ID - 1;
+      const auto *MF = find(IdentRanges, Index);
+      if (MF && Index - MF->BaseIdentifierID < MF->LocalNumIdentifiers)
+        ++Stats[MF].Identifiers;
+    }
+
+    std::vector<DependencyStats> Res;
+    for (auto &S : Stats)
+      Res.emplace_back(std::move(S.second));
+
+    std::sort(Res.begin(), Res.end(), [] (
+        const DependencyStats &LHS,
+        const DependencyStats &RHS
+    ) {
+      return LHS.File < RHS.File;
+    });
+
+    return Res;
+  }
+};
+
 }} // end of clang::levitation
 
 #endif // #ifndef LLVM_CLANG_FRONTEND_LEVITATION_DESERIALIZATIONLISTENERS_H
@@ -0,0 +1,73 @@
+//===--- ArtifactLock.h - C++ ArtifactLock class ----------------*- C++ -*-===//
+//
+// Part of the C++ Levitation Project,
+// under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file contains advisory lock of build artifact, used when several
+//  driver invocations share same build root. While artifact is built,
+//  '<artifact>.lock' marker is kept next to it, it keeps host and pid of
+//  its owner. Other invocation which wants same artifact waits until
+//  marker is gone, and then checks whether artifact is up-to-date,
+//  instead of building it once again. If owner has died, marker is
+//  considered stale and lock is taken over.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_LEVITATION_ARTIFACTLOCK_H
+#define LLVM_LEVITATION_ARTIFACTLOCK_H
+
+#include "clang/Levitation/Common/Path.h"
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/LockFileManager.h"
+
+#include <memory>
+
+namespace clang { namespace levitation { namespace tools {
+
+  class ArtifactLock {
+    std::unique_ptr<llvm::LockFileManager> Lock;
+  public:
+
+    /// Takes lock of given artifact. If other invocation holds it,
+    /// waits until it is released, and takes it then. If lock can't
+    /// be created at all, artifact is left unlocked.
+    /// \return true if other invocation was waited for.
+    bool acquire(llvm::StringRef Artifact) {
+      Path::createDirsForFile(Artifact);
+
+      bool Waited = false;
+      while (true) {
+        Lock = std::make_unique<llvm::LockFileManager>(Artifact);
+
+        switch (Lock->getState()) {
+          case llvm::LockFileManager::LFS_Owned:
+            return Waited;
+
+          case llvm::LockFileManager::LFS_Error:
+            Lock.reset();
+            return Waited;
+
+          case llvm::LockFileManager::LFS_Shared:
+            // Owner is alive, it is just a long job. Dead owner is
+            // detected, and lock is tried once again.
+            Waited = true;
+            Lock->waitForUnlock();
+            Lock.reset();
+            continue;
+        }
+      }
+    }
+
+    bool isOwned() const { return (bool)Lock; }
+
+    /// Removes marker, so that waiting invocations may go on.
+    void release() { Lock.reset(); }
+  };
+}}}
+
+#endif //LLVM_LEVITATION_ARTIFACTLOCK_H
@@ -0,0 +1,136 @@
+//===--- ArtifactPack.h - C++ ArtifactPack class ----------------*- C++ -*-===//
+//
+// Part of the C++ Levitation Project,
+// under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file contains packed artifacts store. Store keeps small build
+//  artifacts in two files instead of one file per artifact:
+//    artifacts.pack        - artifacts contents, append-only
+//    artifacts.pack-index  - append-only log of index records,
+//                            last record of path wins.
+//  Contents are written before index record, so interrupted build
+//  leaves at most unreferenced bytes, which are dropped by compaction.
+//
+//  Packed artifacts are read through virtual file system, which
+//  puts real file system on top of the pack, so artifacts which were
+//  written again and not packed yet are taken from disk.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_LEVITATION_ARTIFACTPACK_H
+#define LLVM_LEVITATION_ARTIFACTPACK_H
+
+#include "clang/Levitation/Common/CreatableSingleton.h"
+#include "clang/Levitation/Common/Failable.h"
+#include "clang/Levitation/Common/Path.h"
+
+#include "llvm/ADT/IntrusiveRefCntPtr.h"
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/FileSystem.h"
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+namespace llvm {
+  class MemoryBuffer;
+  class raw_fd_ostream;
+  namespace vfs {
+    class FileSystem;
+  }
+}
+
+namespace clang { namespace levitation { namespace tools {
+
+  class ArtifactPack : public CreatableSingleton<ArtifactPack> {
+  public:
+
+    struct Entry {
+      uint64_t Offset = 0;
+      uint64_t Size = 0;
+
+      /// Modification time of packed file, nanoseconds since epoch.
+      uint64_t MTime = 0;
+    };
+
+  private:
+
+    SinglePath PackFile;
+    SinglePath IndexFile;
+
+    /// Entries keyed by absolute path of artifact.
+    llvm::StringMap<Entry> Entries;
+
+    /// Size of pack file, including unreferenced contents.
+    uint64_t PackSize = 0;
+
+    /// Size of contents referenced by entries.
+    uint64_t LiveSize = 0;
+
+    std::unique_ptr<llvm::raw_fd_ostream> PackOS;
+    std::unique_ptr<llvm::raw_fd_ostream> IndexOS;
+    llvm::sys::fs::file_t ReadFD = llvm::sys::fs::kInvalidFile;
+
+    mutable std::mutex Locker;
+
+    Failable readIndex();
+    Failable openStreams();
+    void closeStreams();
+    void writeIndexRecord(llvm::StringRef Path, const Entry &E);
+
+    static SinglePath getKey(llvm::StringRef Path);
+
+  protected:
+
+    ArtifactPack() = default;
+
+    friend CreatableSingleton<ArtifactPack>;
+
+  public:
+
+    ~ArtifactPack();
+
+    /// Opens or creates pack in given directory.
+    Failable open(llvm::StringRef Dir);
+
+    bool isEnabled() const { return (bool)PackOS; }
+
+    /// Puts artifact contents into pack, overriding previous contents
+    /// of same path, if any.
+    bool add(llvm::StringRef Path, llvm::StringRef Contents, uint64_t MTime);
+
+    /// Moves file into pack, that is file is packed and then removed.
+    /// \return false if file doesn't exist or can't be packed.
+    bool addFile(llvm::StringRef Path);
+
+    void remove(llvm::StringRef Path);
+
+    llvm::Optional<Entry> getEntry(llvm::StringRef Path) const;
+
+    /// Returns contents of artifact, large artifacts are mapped
+    /// into memory rather than read.
+    std::unique_ptr<llvm::MemoryBuffer> getBuffer(llvm::StringRef Path) const;
+
+    size_t size() const;
+
+    /// Whether most of pack contents are not referenced anymore.
+    bool needsCompaction() const;
+
+    /// Rewrites pack with referenced contents only.
+    Failable compact();
+
+    /// Creates file system which serves packed artifacts, with
+    /// given disk file system put on top of it.
+    llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> createFileSystem(
+        llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> DiskFS
+    );
+  };
+}}}
+
+#endif //LLVM_LEVITATION_ARTIFACTPACK_H
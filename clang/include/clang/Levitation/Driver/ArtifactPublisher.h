@@ -0,0 +1,157 @@
+//===--- ArtifactPublisher.h - C++ ArtifactPublisher class ------*- C++ -*-===//
+//
+// Part of the C++ Levitation Project,
+// under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file contains artifacts publisher. Once artifact is written
+//  into build directory, its dependents may be started, while
+//  whatever else the artifact is needed for (cache upload and
+//  compression, .h and .decl generation) is done by publisher
+//  in background, by low priority I/O threads.
+//
+//  Queue is bounded, once it is full, jobs which publish
+//  artifacts wait for free slot, so that slow storage
+//  doesn't grow memory and pending work unboundedly.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_LEVITATION_ARTIFACTPUBLISHER_H
+#define LLVM_LEVITATION_ARTIFACTPUBLISHER_H
+
+#include "clang/Levitation/Common/CreatableSingleton.h"
+#include "clang/Levitation/Common/Thread.h"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace clang { namespace levitation { namespace tools {
+
+  class ArtifactPublisher : public CreatableSingleton<ArtifactPublisher> {
+  public:
+
+    /// Publication action, returns false if it failed.
+    using ActionFn = std::function<bool()>;
+
+  private:
+
+    unsigned MaxDepth;
+    unsigned NumThreads;
+
+    std::mutex Locker;
+    std::condition_variable HasWork;
+    std::condition_variable HasRoom;
+    std::condition_variable Drained;
+
+    std::deque<ActionFn> Queue;
+    unsigned NumRunning = 0;
+    unsigned NumFailed = 0;
+    bool Stopping = false;
+
+    std::vector<std::thread> Threads;
+
+    void startThreads() {
+      if (Threads.size())
+        return;
+
+      for (unsigned i = 0; i != NumThreads; ++i)
+        Threads.emplace_back([this] { worker(); });
+    }
+
+    void worker() {
+#ifdef __linux__
+      // On Linux it only affects calling thread, so compilation
+      // jobs keep their priority.
+      lowerPriority();
+#endif
+
+      while (true) {
+        ActionFn Action;
+
+        {
+          auto L = lock(Locker);
+          HasWork.wait(L, [&] { return Stopping || Queue.size(); });
+          if (Queue.empty())
+            return;
+
+          Action = std::move(Queue.front());
+          Queue.pop_front();
+          ++NumRunning;
+          HasRoom.notify_one();
+        }
+
+        bool Successful = Action();
+
+        {
+          auto _ = lock(Locker);
+          --NumRunning;
+          if (!Successful)
+            ++NumFailed;
+          if (Queue.empty() && !NumRunning)
+            Drained.notify_all();
+        }
+      }
+    }
+
+  protected:
+
+    /// \param maxDepth maximum number of pending actions,
+    /// 0 means actions are run by publishing thread right away.
+    ArtifactPublisher(unsigned maxDepth, unsigned numThreads = 2)
+    : MaxDepth(maxDepth), NumThreads(numThreads ? numThreads : 1) {}
+
+    friend CreatableSingleton<ArtifactPublisher>;
+
+  public:
+
+    ~ArtifactPublisher() {
+      {
+        auto _ = lock(Locker);
+        Stopping = true;
+        HasWork.notify_all();
+      }
+
+      for (auto &T : Threads)
+        T.join();
+    }
+
+    bool isAsync() const { return MaxDepth; }
+
+    /// Puts action into queue, waits for free slot if queue is full.
+    void publish(ActionFn &&Action) {
+      if (!isAsync()) {
+        bool Successful = Action();
+        auto _ = lock(Locker);
+        if (!Successful)
+          ++NumFailed;
+        return;
+      }
+
+      auto L = lock(Locker);
+      startThreads();
+      HasRoom.wait(L, [&] { return Queue.size() < MaxDepth; });
+      Queue.emplace_back(std::move(Action));
+      HasWork.notify_one();
+    }
+
+    /// Waits until all published actions are done.
+    /// \return number of actions failed since previous wait.
+    unsigned wait() {
+      auto L = lock(Locker);
+      Drained.wait(L, [&] { return Queue.empty() && !NumRunning; });
+
+      unsigned Failed = NumFailed;
+      NumFailed = 0;
+      return Failed;
+    }
+  };
+}}}
+
+#endif //LLVM_LEVITATION_ARTIFACTPUBLISHER_H
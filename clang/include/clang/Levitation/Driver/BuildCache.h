@@ -0,0 +1,267 @@
+//===--- BuildCache.h - C++ BuildCache class --------------------*- C++ -*-===//
+//
+// Part of the C++ Levitation Project,
+// under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file contains content-addressed build cache. Build artifacts
+//  (.ldeps, .decl-ast, .o and their metas) are stored under key, which
+//  is calculated from everything that affects artifact contents.
+//  Cache may have several backends, e.g. local directory and remote
+//  storage. Backends are looked up in order they were added.
+//
+//  Large artifacts (.decl-ast, .o) may be stored compressed, in small
+//  container: magic, uncompressed size, zlib stream. Containers are
+//  recognized by magic on fetch, so compressed and plain entries may be
+//  mixed in same storage. Build directory always keeps plain files.
+//
+//  Local storage may be bounded by size and age, fetched entries are
+//  touched, so that least recently used ones are removed first.
+//
+//  Artifacts nothing may need locally may be deferred: on hit only their
+//  entry keys are recorded, and they're fetched once some job actually
+//  reads them, see --lazy-cache-fetch.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_LEVITATION_BUILDCACHE_H
+#define LLVM_LEVITATION_BUILDCACHE_H
+
+#include "clang/Levitation/Common/CreatableSingleton.h"
+#include "clang/Levitation/Common/Path.h"
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/MD5.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace clang { namespace levitation { namespace tools {
+
+  /// Storage for cached artifacts.
+  /// Implementations must be thread-safe.
+  class BuildCacheBackend {
+  public:
+    virtual ~BuildCacheBackend() = default;
+
+    virtual llvm::StringRef getName() const = 0;
+
+    /// Copies entry with given key into DestFile.
+    /// \return true if entry exists and was copied.
+    virtual bool fetch(llvm::StringRef Key, llvm::StringRef DestFile) = 0;
+
+    /// Puts SrcFile contents under given key.
+    /// \return true if entry was stored.
+    virtual bool store(llvm::StringRef Key, llvm::StringRef SrcFile) = 0;
+
+    /// Removes least recently used entries, until storage fits limits.
+    /// Storages which can't be trimmed by driver keep everything.
+    /// \param MaxSize maximum total size in bytes, 0 means no limit.
+    /// \param MaxAge maximum time in seconds since entry was used,
+    /// 0 means no limit.
+    /// \return number of removed entries.
+    virtual unsigned trim(uint64_t MaxSize, uint64_t MaxAge) { return 0; }
+  };
+
+  /// Keeps entries in local directory, as <dir>/<key[0:2]>/<key>.
+  /// Entries are reflinked where file system allows it, see FileClone.
+  class LocalDirectoryCacheBackend : public BuildCacheBackend {
+    SinglePath Directory;
+
+    /// Whether entries are hard linked with artifacts, see
+    /// --cache-hardlinks. Entry and artifact share modification time
+    /// then, so fetch of entry invalidates stamps of other copies.
+    bool Hardlinks;
+  public:
+    LocalDirectoryCacheBackend(llvm::StringRef directory, bool hardlinks = false)
+    : Directory(directory), Hardlinks(hardlinks) {}
+
+    llvm::StringRef getName() const override { return "local"; }
+    bool fetch(llvm::StringRef Key, llvm::StringRef DestFile) override;
+    bool store(llvm::StringRef Key, llvm::StringRef SrcFile) override;
+
+    /// Artifacts of same step are removed together, since step
+    /// can't be reused if any of them is missing.
+    unsigned trim(uint64_t MaxSize, uint64_t MaxAge) override;
+
+  private:
+    SinglePath getEntryPath(llvm::StringRef Key) const;
+  };
+
+  /// Delegates storage to external program, so any remote storage
+  /// (HTTP, gRPC, cloud bucket) can be plugged in with a small script:
+  ///   <program> get <key> <dest file>
+  ///   <program> put <key> <src file>
+  /// Program should return zero exit code on success.
+  class CommandCacheBackend : public BuildCacheBackend {
+    SinglePath Program;
+  public:
+    CommandCacheBackend(llvm::StringRef program)
+    : Program(program) {}
+
+    llvm::StringRef getName() const override { return "remote"; }
+    bool fetch(llvm::StringRef Key, llvm::StringRef DestFile) override;
+    bool store(llvm::StringRef Key, llvm::StringRef SrcFile) override;
+
+  private:
+    bool run(llvm::StringRef Action, llvm::StringRef Key, llvm::StringRef File);
+  };
+
+  /// Cache key builder.
+  class BuildCacheKey {
+    llvm::MD5 Md5Builder;
+  public:
+
+    BuildCacheKey &add(llvm::StringRef Value) {
+      Md5Builder.update(Value);
+      // Separator, so that ("ab", "c") and ("a", "bc") give different keys.
+      Md5Builder.update(llvm::StringRef("\0", 1));
+      return *this;
+    }
+
+    BuildCacheKey &add(llvm::ArrayRef<uint8_t> Hash) {
+      Md5Builder.update(Hash);
+      Md5Builder.update(llvm::StringRef("\0", 1));
+      return *this;
+    }
+
+    template <typename ValuesT>
+    BuildCacheKey &addAll(const ValuesT &Values) {
+      for (const auto &V : Values)
+        add(llvm::StringRef(V));
+      return *this;
+    }
+
+    std::string done() {
+      llvm::MD5::MD5Result Result;
+      Md5Builder.final(Result);
+      return std::string(Result.digest().str());
+    }
+  };
+
+  class BuildCache : public CreatableSingleton<BuildCache> {
+  public:
+
+    /// Single file produced by build step.
+    struct Artifact {
+      /// Name which distinguishes artifact among others
+      /// produced by same step, e.g. 'decl-ast' or 'meta'.
+      llvm::StringRef Name;
+      llvm::StringRef Path;
+
+      /// Whether artifact is not fetched on hit, but once
+      /// it is needed, see materialize.
+      bool Deferred = false;
+    };
+
+  private:
+
+    std::vector<std::unique_ptr<BuildCacheBackend>> Backends;
+
+    std::atomic<unsigned> Hits;
+    std::atomic<unsigned> Misses;
+
+    struct DeferredArtifact {
+      std::string EntryKey;
+
+      /// Backend entry was found in, it is tried first.
+      size_t Backend = 0;
+
+      /// Whether some job is fetching artifact right now,
+      /// others wait for it then.
+      bool Fetching = false;
+    };
+
+    /// Deferred artifacts by path.
+    llvm::StringMap<DeferredArtifact> Deferred;
+    std::atomic<unsigned> NumDeferred { 0 };
+    std::atomic<unsigned> NumMaterialized { 0 };
+    std::mutex DeferredLocker;
+    std::condition_variable DeferredFetched;
+
+    /// zlib compression level, 0 means artifacts are stored as is.
+    int CompressionLevel = 0;
+
+    static std::string getEntryKey(llvm::StringRef Key, const Artifact &A) {
+      return (Key + "." + A.Name).str();
+    }
+
+    bool fetch(
+        BuildCacheBackend &Backend,
+        llvm::StringRef Key,
+        llvm::ArrayRef<Artifact> Artifacts
+    );
+
+    /// Puts artifacts into first NumBackends backends.
+    void store(
+        size_t NumBackends,
+        llvm::StringRef Key,
+        llvm::ArrayRef<Artifact> Artifacts
+    );
+
+    static bool isCompressible(const Artifact &A);
+
+  protected:
+
+    BuildCache() : Hits(0), Misses(0) {}
+
+    friend CreatableSingleton<BuildCache>;
+
+  public:
+
+    void addBackend(std::unique_ptr<BuildCacheBackend> &&Backend) {
+      Backends.emplace_back(std::move(Backend));
+    }
+
+    bool isEnabled() const { return !Backends.empty(); }
+
+    /// Enables compression of large artifacts with given zlib level.
+    /// \return false if zlib is not available.
+    bool setCompressionLevel(int Level);
+
+    /// Fetches all artifacts for given key. If entry was found in one
+    /// of subsequent backends, it is also put into previous ones.
+    /// Deferred artifacts are only recorded, previous records of
+    /// artifacts paths are dropped anyway, since they're rewritten.
+    /// \return true if all artifacts were fetched.
+    bool fetch(llvm::StringRef Key, llvm::ArrayRef<Artifact> Artifacts);
+
+    /// Fetches those of Files, which were deferred.
+    /// \return false if some of them are not in cache anymore.
+    bool materialize(llvm::ArrayRef<llvm::StringRef> Files);
+
+    /// Puts artifacts into all backends.
+    void store(llvm::StringRef Key, llvm::ArrayRef<Artifact> Artifacts) {
+      store(Backends.size(), Key, Artifacts);
+    }
+
+    /// Trims all backends, see BuildCacheBackend::trim.
+    /// \return number of removed entries.
+    unsigned trim(uint64_t MaxSize, uint64_t MaxAge) {
+      unsigned Removed = 0;
+      for (auto &B : Backends)
+        Removed += B->trim(MaxSize, MaxAge);
+      return Removed;
+    }
+
+    unsigned getHits() const { return Hits; }
+    unsigned getMisses() const { return Misses; }
+
+    /// Number of artifacts deferred so far, and number
+    /// of them fetched since then.
+    unsigned getNumDeferred() const { return NumDeferred; }
+    unsigned getNumMaterialized() const { return NumMaterialized; }
+  };
+}}}
+
+#endif //LLVM_LEVITATION_BUILDCACHE_H
@@ -0,0 +1,206 @@
+//===--- BuildJournal.h - C++ Levitation BuildJournal class -----*- C++ -*-===//
+//
+// Part of the C++ Levitation Project,
+// under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file contains build journal. Journal is append-only file in build
+//  root, where each completed dependency node is recorded as soon as it is
+//  done, along with whether its declaration was updated. Build state is only
+//  saved once build finishes, so if build is interrupted, next build
+//  resumes from journal: dependents of updated declarations are rebuilt,
+//  and products recorded in journal don't need their sources rehashed.
+//
+//  Journal is removed once build succeeds. Each record is single line:
+//
+//    <D|O> <updated> <source mtime> <source size> \
+//      <product mtime> <product size> <product path>
+//
+//  Records which were torn by interruption are skipped.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_LEVITATION_BUILDJOURNAL_H
+#define LLVM_LEVITATION_BUILDJOURNAL_H
+
+#include "clang/Levitation/BuildState/BuildState.h"
+#include "clang/Levitation/Common/Path.h"
+#include "clang/Levitation/Common/Thread.h"
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <memory>
+#include <mutex>
+
+namespace clang { namespace levitation { namespace tools {
+
+  class BuildJournal {
+  public:
+
+    struct Entry {
+      /// Whether product is declaration AST, object or IR otherwise.
+      bool Declaration = false;
+
+      /// Whether dependents are affected, always set for objects.
+      bool Updated = false;
+
+      BuildState::FileStamp Source;
+      BuildState::FileStamp Product;
+    };
+
+    /// Entries by product path.
+    using EntriesMap = llvm::StringMap<Entry>;
+
+  private:
+
+    SinglePath JournalFile;
+    std::unique_ptr<llvm::raw_fd_ostream> Out;
+    std::mutex Locker;
+
+  public:
+
+    static void write(
+        llvm::raw_ostream &Out, llvm::StringRef ProductPath, const Entry &E
+    ) {
+      Out << (E.Declaration ? 'D' : 'O') << " " << (E.Updated ? 1 : 0) << " "
+          << E.Source.MTime << " " << E.Source.Size << " "
+          << E.Product.MTime << " " << E.Product.Size << " "
+          << ProductPath << "\n";
+    }
+
+    /// Reads records into Entries. Node may be recorded several times,
+    /// e.g. by builds interrupted in a row, then last stamps win, and
+    /// node is updated if any of its records says so.
+    static void parse(llvm::StringRef Buffer, EntriesMap &Entries) {
+      while (!Buffer.empty()) {
+        auto Line = Buffer.split('\n');
+
+        // Interrupted before end of record.
+        if (Line.first.size() == Buffer.size())
+          return;
+        Buffer = Line.second;
+
+        llvm::StringRef Rest = Line.first;
+        auto pop = [&] {
+          auto Field = Rest.split(' ');
+          Rest = Field.second;
+          return Field.first;
+        };
+
+        auto Kind = pop();
+        auto Updated = pop();
+
+        Entry E;
+        bool Valid =
+            (Kind == "D" || Kind == "O") &&
+            (Updated == "0" || Updated == "1") &&
+            !pop().getAsInteger(10, E.Source.MTime) &&
+            !pop().getAsInteger(10, E.Source.Size) &&
+            !pop().getAsInteger(10, E.Product.MTime) &&
+            !pop().getAsInteger(10, E.Product.Size);
+
+        if (!Valid || Rest.empty())
+          continue;
+
+        E.Declaration = Kind == "D";
+        E.Updated = Updated == "1";
+
+        auto &Item = Entries[Rest];
+        E.Updated = E.Updated || Item.Updated;
+        Item = E;
+      }
+    }
+
+    /// Loads journal left by interrupted build, if any.
+    static bool load(llvm::StringRef JournalFile, EntriesMap &Entries) {
+      auto Buffer = llvm::MemoryBuffer::getFile(
+          JournalFile, /*FileSize=*/-1, /*RequiresNullTerminator=*/false
+      );
+      if (!Buffer)
+        return false;
+      parse((*Buffer)->getBuffer(), Entries);
+      return true;
+    }
+
+    /// Starts new journal, with Carried entries left by previous
+    /// interrupted builds, so that they survive if this build is
+    /// interrupted too. Written through temporary file, so that old
+    /// journal is kept until new one is complete.
+    /// \return true if successful.
+    bool open(llvm::StringRef File, const EntriesMap &Carried) {
+      auto _ = lock(Locker);
+
+      JournalFile = File;
+      Out.reset();
+
+      SinglePath Tmp;
+      int FD;
+      if (llvm::sys::fs::createUniqueFile(File + ".tmp-%%%%%%%%", FD, Tmp))
+        return false;
+
+      {
+        llvm::raw_fd_ostream TmpOut(FD, /*shouldClose=*/true);
+        for (const auto &Item : Carried)
+          write(TmpOut, Item.first(), Item.second);
+        TmpOut.close();
+        if (TmpOut.has_error()) {
+          TmpOut.clear_error();
+          llvm::sys::fs::remove(Tmp);
+          return false;
+        }
+      }
+
+      if (llvm::sys::fs::rename(Tmp, File)) {
+        llvm::sys::fs::remove(Tmp);
+        return false;
+      }
+
+      std::error_code EC;
+      Out = std::make_unique<llvm::raw_fd_ostream>(
+          File, EC, llvm::sys::fs::OF_Append
+      );
+      if (EC) {
+        Out.reset();
+        return false;
+      }
+
+      return true;
+    }
+
+    bool isOpen() const { return (bool)Out; }
+
+    /// Records completed node. Record is flushed right away, so that
+    /// it survives if driver is killed.
+    void append(llvm::StringRef ProductPath, const Entry &E) {
+      auto _ = lock(Locker);
+      if (!Out)
+        return;
+      write(*Out, ProductPath, E);
+      Out->flush();
+    }
+
+    /// Stops journaling.
+    /// \param Remove whether journal is not needed anymore,
+    ///        that is build has completed.
+    void close(bool Remove) {
+      auto _ = lock(Locker);
+      if (Out) {
+        Out->close();
+        if (Out->has_error())
+          Out->clear_error();
+        Out.reset();
+      }
+      if (Remove && JournalFile.size())
+        llvm::sys::fs::remove(JournalFile);
+    }
+  };
+}}}
+
+#endif //LLVM_LEVITATION_BUILDJOURNAL_H
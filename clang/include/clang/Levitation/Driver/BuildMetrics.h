@@ -0,0 +1,202 @@
+//===--- BuildMetrics.h - C++ BuildMetrics class ----------------*- C++ -*-===//
+//
+// Part of the C++ Levitation Project,
+// under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file contains build metrics, see --metrics. After each build driver
+//  collects its counters, steps durations and critical path into set of
+//  gauges, and writes them either in Prometheus text exposition format,
+//  ready for pushgateway, or as OTLP/JSON metrics export request, ready
+//  for OpenTelemetry collector HTTP receiver.
+//
+//  Driver doesn't speak HTTP itself, metrics file is pushed by external
+//  program, see --metrics-push.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_LEVITATION_BUILDMETRICS_H
+#define LLVM_LEVITATION_BUILDMETRICS_H
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace clang { namespace levitation { namespace tools {
+
+  class BuildMetrics {
+  public:
+
+    enum struct Format {
+      Prometheus,
+      OTLP
+    };
+
+    using LabelsTy = std::vector<std::pair<std::string, std::string>>;
+
+    struct Sample {
+      LabelsTy Labels;
+      double Value;
+    };
+
+    struct Metric {
+      /// Name without "cppl_" prefix, e.g. "build_duration_seconds".
+      std::string Name;
+      std::string Help;
+
+      /// UCUM unit for OTLP, e.g. "s" or "By".
+      std::string Unit;
+
+      std::vector<Sample> Samples;
+    };
+
+  private:
+
+    /// Metrics in order they were added.
+    std::vector<Metric> Metrics;
+    llvm::StringMap<size_t> Indices;
+
+    static void writeLabelValue(llvm::raw_ostream &Out, llvm::StringRef V) {
+      for (char C : V) {
+        switch (C) {
+          case '\\': Out << "\\\\"; break;
+          case '"': Out << "\\\""; break;
+          case '\n': Out << "\\n"; break;
+          default: Out << C;
+        }
+      }
+    }
+
+  public:
+
+    /// Picks format by file extension: OTLP for '.json',
+    /// Prometheus text format otherwise.
+    static Format getFormat(llvm::StringRef File) {
+      return llvm::sys::path::extension(File) == ".json" ?
+          Format::OTLP : Format::Prometheus;
+    }
+
+    /// Adds sample of gauge. Metric is created by its first sample,
+    /// help and unit of later samples are ignored.
+    BuildMetrics &add(
+        llvm::StringRef Name,
+        llvm::StringRef Help,
+        llvm::StringRef Unit,
+        double Value,
+        LabelsTy Labels = {}
+    ) {
+      auto Inserted = Indices.try_emplace(Name, Metrics.size());
+      if (Inserted.second)
+        Metrics.push_back({Name.str(), Help.str(), Unit.str(), {}});
+
+      Metrics[Inserted.first->second].Samples.push_back(
+          {std::move(Labels), Value}
+      );
+      return *this;
+    }
+
+    const std::vector<Metric> &getMetrics() const { return Metrics; }
+
+    /// Writes metrics in Prometheus text exposition format.
+    void writePrometheus(llvm::raw_ostream &Out) const {
+      for (const auto &M : Metrics) {
+        Out << "# HELP cppl_" << M.Name << " " << M.Help << "\n";
+        Out << "# TYPE cppl_" << M.Name << " gauge\n";
+
+        for (const auto &S : M.Samples) {
+          Out << "cppl_" << M.Name;
+          if (S.Labels.size()) {
+            Out << "{";
+            for (size_t i = 0, e = S.Labels.size(); i != e; ++i) {
+              if (i)
+                Out << ",";
+              Out << S.Labels[i].first << "=\"";
+              writeLabelValue(Out, S.Labels[i].second);
+              Out << "\"";
+            }
+            Out << "}";
+          }
+          Out << " " << llvm::format("%.15g", S.Value) << "\n";
+        }
+      }
+    }
+
+    /// Writes metrics as OTLP/JSON ExportMetricsServiceRequest.
+    /// \param TimeUnixNano time of all data points.
+    void writeOTLP(llvm::raw_ostream &Out, uint64_t TimeUnixNano) const {
+      // 64-bit integers are strings in OTLP/JSON.
+      std::string Time = std::to_string(TimeUnixNano);
+
+      auto writeAttributes = [] (
+          llvm::json::OStream &J, const LabelsTy &Labels
+      ) {
+        J.attributeArray("attributes", [&] {
+          for (const auto &L : Labels)
+            J.object([&] {
+              J.attribute("key", L.first);
+              J.attributeObject("value", [&] {
+                J.attribute("stringValue", L.second);
+              });
+            });
+        });
+      };
+
+      llvm::json::OStream J(Out, /*IndentSize=*/2);
+      J.object([&] {
+        J.attributeArray("resourceMetrics", [&] {
+          J.object([&] {
+            J.attributeObject("resource", [&] {
+              writeAttributes(J, {{"service.name", "cppl"}});
+            });
+            J.attributeArray("scopeMetrics", [&] {
+              J.object([&] {
+                J.attributeObject("scope", [&] {
+                  J.attribute("name", "cppl");
+                });
+                J.attributeArray("metrics", [&] {
+                  for (const auto &M : Metrics)
+                    J.object([&] {
+                      J.attribute("name", "cppl." + M.Name);
+                      J.attribute("description", M.Help);
+                      J.attribute("unit", M.Unit);
+                      J.attributeObject("gauge", [&] {
+                        J.attributeArray("dataPoints", [&] {
+                          for (const auto &S : M.Samples)
+                            J.object([&] {
+                              writeAttributes(J, S.Labels);
+                              J.attribute("timeUnixNano", Time);
+                              J.attribute("asDouble", S.Value);
+                            });
+                        });
+                      });
+                    });
+                });
+              });
+            });
+          });
+        });
+      });
+      Out << "\n";
+    }
+
+    void write(llvm::raw_ostream &Out, Format F, uint64_t TimeUnixNano) const {
+      if (F == Format::OTLP)
+        writeOTLP(Out, TimeUnixNano);
+      else
+        writePrometheus(Out);
+    }
+  };
+}}}
+
+#endif //LLVM_LEVITATION_BUILDMETRICS_H
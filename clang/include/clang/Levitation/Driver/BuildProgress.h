@@ -0,0 +1,204 @@
+//===--- BuildProgress.h - C++ BuildProgress class --------------*- C++ -*-===//
+//
+// Part of the C++ Levitation Project,
+// under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file contains build progress of declaration AST and object jobs.
+//  Once dirty nodes are known, scheduler may still discover jobs lazily,
+//  but their number and expected durations are known in advance, so
+//  driver reports
+//
+//    [done/total] phase unit, ETA 1m20s
+//
+//  either as status line on terminal, or, see --status-fd, as stream
+//  of JSON lines, one per event:
+//
+//    {"event":"finished","phase":"obj","unit":"net::http","done":12,
+//     "total":340,"running":8,"elapsed_ms":5120,"eta_ms":80000}
+//
+//  ETA is remaining expected work divided by parallelism, until some
+//  jobs are done. Then it is remaining expected work divided by rate
+//  expected work is actually done at, so that it accounts for history
+//  being off, and for jobs waiting for each other.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_LEVITATION_BUILDPROGRESS_H
+#define LLVM_LEVITATION_BUILDPROGRESS_H
+
+#include "clang/Levitation/Common/Thread.h"
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+namespace clang { namespace levitation { namespace tools {
+
+  class BuildProgress {
+  public:
+
+    /// Microseconds.
+    using DurationTy = uint64_t;
+
+    enum struct EventKind {
+      Started,
+      Finished
+    };
+
+    struct Snapshot {
+      size_t Done = 0;
+      size_t Total = 0;
+      size_t Running = 0;
+      DurationTy Elapsed = 0;
+      llvm::Optional<DurationTy> ETA;
+    };
+
+  private:
+
+    std::mutex Locker;
+    std::chrono::steady_clock::time_point Start;
+
+    size_t Total = 0;
+    size_t Done = 0;
+    size_t Running = 0;
+    DurationTy TotalExpected = 0;
+    DurationTy DoneExpected = 0;
+    unsigned Parallelism = 1;
+
+    Snapshot snapshot() const {
+      Snapshot S;
+      S.Done = Done;
+      S.Total = Total;
+      S.Running = Running;
+      S.Elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - Start
+      ).count();
+      S.ETA = estimate(
+          TotalExpected, DoneExpected, S.Elapsed, Parallelism
+      );
+      return S;
+    }
+
+  public:
+
+    /// \param TotalExpected sum of expected durations of all jobs,
+    ///        0 if history is empty.
+    void start(size_t NumJobs, DurationTy TotalExpected, unsigned Parallelism) {
+      auto _ = lock(Locker);
+      Start = std::chrono::steady_clock::now();
+      Total = NumJobs;
+      Done = Running = 0;
+      this->TotalExpected = TotalExpected;
+      DoneExpected = 0;
+      this->Parallelism = std::max(1u, Parallelism);
+    }
+
+    Snapshot onStarted() {
+      auto _ = lock(Locker);
+      ++Running;
+      return snapshot();
+    }
+
+    /// \param Expected expected duration of finished job.
+    Snapshot onFinished(DurationTy Expected) {
+      auto _ = lock(Locker);
+      if (Running)
+        --Running;
+      // Jobs discovered besides dirty set still count as done.
+      Total = std::max(Total, ++Done);
+      DoneExpected += Expected;
+      return snapshot();
+    }
+
+    /// \return time left, or None if there is no history.
+    static llvm::Optional<DurationTy> estimate(
+        DurationTy TotalExpected,
+        DurationTy DoneExpected,
+        DurationTy Elapsed,
+        unsigned Parallelism
+    ) {
+      if (!TotalExpected)
+        return llvm::None;
+
+      double Remaining =
+          TotalExpected > DoneExpected ? TotalExpected - DoneExpected : 0;
+
+      if (!DoneExpected || !Elapsed)
+        return DurationTy(Remaining / std::max(1u, Parallelism));
+
+      double Rate = (double)DoneExpected / Elapsed;
+      return DurationTy(Remaining / Rate);
+    }
+
+    /// Writes duration as "1h05m", "4m20s" or "12s".
+    static void writeDuration(llvm::raw_ostream &Out, DurationTy D) {
+      uint64_t Seconds = (D + 500000) / 1000000;
+      uint64_t Minutes = Seconds / 60;
+      uint64_t Hours = Minutes / 60;
+
+      auto write2 = [&] (uint64_t V) {
+        if (V < 10)
+          Out << "0";
+        Out << V;
+      };
+
+      if (Hours) {
+        Out << Hours << "h";
+        write2(Minutes % 60);
+        Out << "m";
+      } else if (Minutes) {
+        Out << Minutes << "m";
+        write2(Seconds % 60);
+        Out << "s";
+      } else {
+        Out << Seconds << "s";
+      }
+    }
+
+    static void writeLine(
+        llvm::raw_ostream &Out,
+        const Snapshot &S,
+        llvm::StringRef Phase,
+        llvm::StringRef Unit
+    ) {
+      Out << "[" << S.Done << "/" << S.Total << "] " << Phase << " " << Unit;
+      if (S.ETA) {
+        Out << ", ETA ";
+        writeDuration(Out, *S.ETA);
+      }
+    }
+
+    static void writeEvent(
+        llvm::raw_ostream &Out,
+        const Snapshot &S,
+        EventKind Kind,
+        llvm::StringRef Phase,
+        llvm::StringRef Unit
+    ) {
+      llvm::json::OStream J(Out);
+      J.object([&] {
+        J.attribute("event", Kind == EventKind::Started ? "started" : "finished");
+        J.attribute("phase", Phase);
+        J.attribute("unit", Unit);
+        J.attribute("done", (int64_t)S.Done);
+        J.attribute("total", (int64_t)S.Total);
+        J.attribute("running", (int64_t)S.Running);
+        J.attribute("elapsed_ms", (int64_t)(S.Elapsed / 1000));
+        if (S.ETA)
+          J.attribute("eta_ms", (int64_t)(*S.ETA / 1000));
+      });
+      Out << "\n";
+    }
+  };
+}}}
+
+#endif //LLVM_LEVITATION_BUILDPROGRESS_H
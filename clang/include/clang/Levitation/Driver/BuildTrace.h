@@ -0,0 +1,186 @@
+//===--- BuildTrace.h - C++ BuildTrace class --------------------*- C++ -*-===//
+//
+// Part of the C++ Levitation Project,
+// under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file contains build trace recorder. It collects spans of
+//  driver phases and executed commands, and writes them in Chrome trace
+//  event format, so build can be inspected in chrome://tracing or Perfetto.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_LEVITATION_BUILDTRACE_H
+#define LLVM_LEVITATION_BUILDTRACE_H
+
+#include "clang/Levitation/Common/CreatableSingleton.h"
+#include "clang/Levitation/Common/File.h"
+#include "clang/Levitation/Common/Path.h"
+#include "clang/Levitation/Common/Thread.h"
+#include "clang/Levitation/Common/WithOperator.h"
+#include "clang/Levitation/TasksManager/TasksManager.h"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/JSON.h"
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace clang { namespace levitation { namespace tools {
+
+  class BuildTrace : public CreatableSingleton<BuildTrace> {
+
+    using ClockTy = std::chrono::steady_clock;
+
+    struct Event {
+      std::string Name;
+      std::string Category;
+      std::string Unit;
+      uint64_t Start;
+      uint64_t Duration;
+      int ThreadID;
+    };
+
+    SinglePath OutputFile;
+    ClockTy::time_point StartTime;
+
+    std::mutex EventsLocker;
+    std::vector<Event> Events;
+
+    uint64_t now() const {
+      return std::chrono::duration_cast<std::chrono::microseconds>(
+          ClockTy::now() - StartTime
+      ).count();
+    }
+
+    static int getThreadID() {
+      auto WID = tasks::TasksManager::get().getWorkerID();
+
+      // Main thread goes as 0.
+      return tasks::TasksManager::isValid(WID) ? WID + 1 : 0;
+    }
+
+    void addEvent(Event &&E) {
+      auto _ = lock(EventsLocker);
+      Events.emplace_back(std::move(E));
+    }
+
+  protected:
+
+    BuildTrace(llvm::StringRef outputFile)
+    : OutputFile(outputFile),
+      StartTime(ClockTy::now())
+    {}
+
+    friend CreatableSingleton<BuildTrace>;
+
+  public:
+
+    /// Span of traced activity. Event is recorded when span is destroyed.
+    class Span : public WithOperand {
+      BuildTrace *Trace;
+      Event E;
+    public:
+      Span(BuildTrace *trace, Event &&e) : Trace(trace), E(std::move(e)) {}
+      Span(Span &&Src) : Trace(Src.Trace), E(std::move(Src.E)) {
+        Src.Trace = nullptr;
+      }
+
+      ~Span() {
+        if (!Trace)
+          return;
+        E.Duration = Trace->now() - E.Start;
+        Trace->addEvent(std::move(E));
+      }
+    };
+
+    bool isEnabled() const { return !OutputFile.empty(); }
+
+    /// \return time since trace start, in microseconds.
+    uint64_t elapsed() const { return now(); }
+
+    /// \return trace thread ID of calling thread.
+    static int getCurrentThreadID() { return getThreadID(); }
+
+    /// Adds event recorded elsewhere, e.g. by frontend job.
+    /// \param Start event start, see elapsed().
+    void addExternalEvent(
+        std::string Name,
+        llvm::StringRef Category,
+        llvm::StringRef Unit,
+        uint64_t Start,
+        uint64_t Duration,
+        int ThreadID
+    ) {
+      if (!isEnabled())
+        return;
+
+      addEvent(Event {
+        std::move(Name), Category.str(), Unit.str(), Start, Duration, ThreadID
+      });
+    }
+
+    /// Starts new span.
+    /// \param Name activity name, e.g. command or phase name.
+    /// \param Category activity category, e.g. 'driver' or 'decl-ast'.
+    /// \param Unit optional unit the activity is performed for.
+    /// \return span object, which should be kept alive until activity ends.
+    Span span(
+        llvm::StringRef Name,
+        llvm::StringRef Category,
+        llvm::StringRef Unit = ""
+    ) {
+      if (!isEnabled())
+        return Span(nullptr, Event());
+
+      return Span(this, Event {
+        Name.str(), Category.str(), Unit.str(), now(), 0, getThreadID()
+      });
+    }
+
+    /// Writes collected events into output file.
+    /// \return true if successful.
+    bool write() {
+      if (!isEnabled())
+        return true;
+
+      File F(OutputFile);
+      with (auto Scope = F.open()) {
+        llvm::json::OStream J(Scope.getOutputStream());
+
+        auto _ = lock(EventsLocker);
+
+        J.object([&] {
+          J.attributeArray("traceEvents", [&] {
+            for (const auto &E : Events) {
+              J.object([&] {
+                J.attribute("name", E.Name);
+                J.attribute("cat", E.Category);
+                J.attribute("ph", "X");
+                J.attribute("ts", (int64_t)E.Start);
+                J.attribute("dur", (int64_t)E.Duration);
+                J.attribute("pid", 1);
+                J.attribute("tid", E.ThreadID);
+                if (!E.Unit.empty())
+                  J.attributeObject("args", [&] {
+                    J.attribute("unit", E.Unit);
+                  });
+              });
+            }
+          });
+          J.attribute("displayTimeUnit", "ms");
+        });
+      }
+
+      return !F.hasErrors();
+    }
+  };
+}}}
+
+#endif //LLVM_LEVITATION_BUILDTRACE_H
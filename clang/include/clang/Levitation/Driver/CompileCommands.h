@@ -0,0 +1,146 @@
+//===--- CompileCommands.h - C++ CompileCommands class ----------*- C++ -*-===//
+//
+// Part of the C++ Levitation Project,
+// under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file contains compilation database recorder. When recording is
+//  started, commands are not executed, but collected and written
+//  as compile_commands.json, by default one object entry per unit. Each command loads
+//  preamble and declaration ASTs of unit dependencies, so clangd and
+//  other tools parse only the unit itself.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_LEVITATION_COMPILECOMMANDS_H
+#define LLVM_LEVITATION_COMPILECOMMANDS_H
+
+#include "clang/Levitation/Common/CreatableSingleton.h"
+#include "clang/Levitation/Common/File.h"
+#include "clang/Levitation/Common/Path.h"
+#include "clang/Levitation/Common/Thread.h"
+#include "clang/Levitation/Common/WithOperator.h"
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace clang { namespace levitation { namespace tools {
+
+  class CompileCommands : public CreatableSingleton<CompileCommands> {
+  public:
+
+    struct Entry {
+      std::string Directory;
+      std::string File;
+      std::vector<std::string> Args;
+      std::string Output;
+    };
+
+  private:
+
+    SinglePath OutputFile;
+    std::atomic<bool> Recording { false };
+
+    std::mutex EntriesLocker;
+    std::vector<Entry> Entries;
+
+  protected:
+
+    CompileCommands(llvm::StringRef outputFile) : OutputFile(outputFile) {}
+
+    friend CreatableSingleton<CompileCommands>;
+
+  public:
+
+    bool isEnabled() const { return !OutputFile.empty(); }
+
+    /// While recording, commands are added to database
+    /// instead of being executed.
+    void startRecording() { Recording = true; }
+    void stopRecording() { Recording = false; }
+    bool isRecording() const { return Recording; }
+
+    /// \param File source file command compiles, paths are
+    ///        relative to current directory.
+    void add(
+        llvm::ArrayRef<llvm::StringRef> Args,
+        llvm::StringRef File,
+        llvm::StringRef Output
+    ) {
+      SinglePath Directory;
+      llvm::sys::fs::current_path(Directory);
+
+      Entry E {
+        Directory.str().str(),
+        Path::makeAbsolute<SinglePath>(File).str().str(),
+        std::vector<std::string>(Args.begin(), Args.end()),
+        Output.str()
+      };
+
+      auto _ = lock(EntriesLocker);
+      Entries.emplace_back(std::move(E));
+    }
+
+    /// Writes recorded entries into output file. File is kept untouched
+    /// if database is same, so that tools don't reload it.
+    /// \return true if successful.
+    bool write() {
+      if (!isEnabled())
+        return true;
+
+      File F(OutputFile, /*KeepIfUnchanged=*/true);
+      with (auto Scope = F.open()) {
+        auto _ = lock(EntriesLocker);
+        write(Scope.getOutputStream(), Entries);
+      }
+
+      return !F.hasErrors();
+    }
+
+    /// Writes entries in order of their files, so that same database
+    /// always gives same file, whatever order commands were recorded in.
+    /// Commands of same file are kept in order they were recorded in,
+    /// tools which pick one command per file take first one.
+    static void write(llvm::raw_ostream &Out, llvm::ArrayRef<Entry> Entries) {
+      std::vector<const Entry*> Sorted;
+      for (const auto &E : Entries)
+        Sorted.push_back(&E);
+
+      std::stable_sort(Sorted.begin(), Sorted.end(), [] (
+          const Entry *L, const Entry *R
+      ) {
+        return L->File < R->File;
+      });
+
+      llvm::json::OStream J(Out, /*IndentSize=*/2);
+      J.array([&] {
+        for (const auto *E : Sorted)
+          J.object([&] {
+            J.attribute("directory", E->Directory);
+            J.attribute("file", E->File);
+            J.attributeArray("arguments", [&] {
+              for (const auto &A : E->Args)
+                J.value(A);
+            });
+            if (E->Output.size())
+              J.attribute("output", E->Output);
+          });
+      });
+      Out << "\n";
+    }
+  };
+}}}
+
+#endif //LLVM_LEVITATION_COMPILECOMMANDS_H
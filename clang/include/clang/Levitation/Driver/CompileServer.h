@@ -0,0 +1,117 @@
+//===--- CompileServer.h - C++ CompileServer class --------------*- C++ -*-===//
+//
+// Part of the C++ Levitation Project,
+// under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file contains compile server classes. Compile server is
+//  a long-lived worker process which receives clang++ command lines
+//  over a pipe and executes them with in-process compiler.
+//  Each server executes one job at a time, so a crash of compiler
+//  affects only the job it was running.
+//
+//  Once server has opened both pipes, it writes "READY\n", until then
+//  driver checks it is still alive. Request:
+//    JOB <N>\n
+//    <arg 0 length>\n<arg 0>
+//    ...
+//    <arg N-1 length>\n<arg N-1>
+//  Response:
+//    DONE <0|1> <message length>\n
+//    <message>
+//  Server exits on EOF or on "EXIT\n" request.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_LEVITATION_COMPILESERVER_H
+#define LLVM_LEVITATION_COMPILESERVER_H
+
+#include "clang/Levitation/Common/CreatableSingleton.h"
+#include "clang/Levitation/Common/Failable.h"
+#include "clang/Levitation/Common/Path.h"
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace clang { namespace levitation { namespace tools {
+
+  /// Server side of compile server.
+  class CompileServer {
+  public:
+
+    /// Option which switches levitation-cppl into compile server mode:
+    ///   cppl -cppl-compile-server <requests pipe> <responses pipe> [-cppl-warm-preamble]
+    static llvm::StringRef getServerOption() {
+      return "-cppl-compile-server";
+    }
+
+    /// Optional last server argument, see InProcessCompiler::setWarmPreamble.
+    static llvm::StringRef getWarmPreambleOption() {
+      return "-cppl-warm-preamble";
+    }
+
+    /// Serves requests until EOF or EXIT request.
+    /// \return process exit code.
+    static int serve(
+        llvm::StringRef RequestsPipe,
+        llvm::StringRef ResponsesPipe,
+        bool WarmPreamble = false
+    );
+  };
+
+  /// Driver side of compile server. Keeps pool of running servers,
+  /// and dispatches jobs across them.
+  class CompileServersPool : public CreatableSingleton<CompileServersPool> {
+
+    struct Server;
+
+    SinglePath ServerExecutable;
+    SinglePath PipesDir;
+    bool WarmPreamble;
+
+    std::vector<std::unique_ptr<Server>> Servers;
+
+    std::mutex Locker;
+    std::condition_variable FreeServerNotifier;
+    std::vector<Server*> FreeServers;
+
+    Server *acquireServer();
+    void releaseServer(Server *S);
+
+    Failable startServer(Server &S);
+    void stopServer(Server &S);
+
+  protected:
+
+    CompileServersPool(
+        llvm::StringRef serverExecutable,
+        unsigned ServersNumber,
+        bool warmPreamble = false
+    );
+
+    friend CreatableSingleton<CompileServersPool>;
+
+  public:
+
+    ~CompileServersPool();
+
+    /// Whether compile servers are supported on this host.
+    static bool isSupported();
+
+    /// Executes command on one of free servers, blocks until
+    /// some server is free. Crashed servers are restarted.
+    /// \param Args command line, first item is clang++ executable path.
+    /// \return execution status.
+    Failable run(llvm::ArrayRef<llvm::StringRef> Args);
+  };
+}}}
+
+#endif //LLVM_LEVITATION_COMPILESERVER_H
@@ -0,0 +1,116 @@
+//===--- DiagnosticsReplay.h - C++ DiagnosticsReplay class ------*- C++ -*-===//
+//
+// Part of the C++ Levitation Project,
+// under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file contains reader of serialized diagnostics, which decl-ast and
+//  object jobs write next to their products (--serialize-diagnostics),
+//  see --replay-diagnostics. Once product is up-to-date or is taken from
+//  build cache, driver prints what its job reported, so warnings don't
+//  disappear from incremental builds.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_LEVITATION_DIAGNOSTICSREPLAY_H
+#define LLVM_LEVITATION_DIAGNOSTICSREPLAY_H
+
+#include "clang/Frontend/SerializedDiagnosticReader.h"
+#include "clang/Frontend/SerializedDiagnostics.h"
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <string>
+#include <system_error>
+
+namespace clang { namespace levitation { namespace tools {
+
+  class DiagnosticsReplay : public serialized_diags::SerializedDiagnosticReader {
+
+    llvm::DenseMap<unsigned, std::string> Files;
+    llvm::DenseMap<unsigned, std::string> Flags;
+
+    llvm::raw_string_ostream Out;
+    unsigned NumDiagnostics = 0;
+
+    static llvm::StringRef getLevelName(unsigned Severity) {
+      switch (Severity) {
+        case serialized_diags::Note: return "note";
+        case serialized_diags::Warning: return "warning";
+        case serialized_diags::Error: return "error";
+        case serialized_diags::Fatal: return "fatal error";
+        case serialized_diags::Remark: return "remark";
+        default: return "";
+      }
+    }
+
+  protected:
+
+    std::error_code visitFilenameRecord(
+        unsigned ID, unsigned Size, unsigned Timestamp, llvm::StringRef Name
+    ) override {
+      Files[ID] = Name.str();
+      return {};
+    }
+
+    std::error_code visitDiagFlagRecord(
+        unsigned ID, llvm::StringRef Name
+    ) override {
+      Flags[ID] = Name.str();
+      return {};
+    }
+
+    std::error_code visitDiagnosticRecord(
+        unsigned Severity,
+        const serialized_diags::Location &Location,
+        unsigned Category,
+        unsigned Flag,
+        llvm::StringRef Message
+    ) override {
+      auto Level = getLevelName(Severity);
+      if (Level.empty())
+        return {};
+
+      // Same format text diagnostics printer uses.
+      auto File = Files.find(Location.FileID);
+      if (File != Files.end())
+        Out
+        << File->second << ":" << Location.Line << ":" << Location.Col
+        << ": ";
+
+      Out << Level << ": " << Message;
+
+      auto FlagName = Flags.find(Flag);
+      if (FlagName != Flags.end() && FlagName->second.size())
+        Out << " [" << FlagName->second << "]";
+
+      Out << "\n";
+
+      if (Severity != serialized_diags::Note)
+        ++NumDiagnostics;
+      return {};
+    }
+
+    DiagnosticsReplay(std::string &Text) : Out(Text) {}
+
+  public:
+
+    /// Reads diagnostics file into Text, one diagnostic per line.
+    /// \return number of diagnostics, notes are not counted,
+    /// or -1 if file can't be read.
+    static int read(llvm::StringRef DiagnosticsFile, std::string &Text) {
+      DiagnosticsReplay Replay(Text);
+      if (Replay.readDiagnostics(DiagnosticsFile))
+        return -1;
+      Replay.Out.flush();
+      return Replay.NumDiagnostics;
+    }
+  };
+}}}
+
+#endif //LLVM_LEVITATION_DIAGNOSTICSREPLAY_H
@@ -17,13 +17,17 @@
 #define LLVM_LEVITATION_DRIVER_H
 
 #include "clang/Levitation/Common/Path.h"
+#include "clang/Levitation/Common/SimpleLogger.h"
 #include "clang/Levitation/Common/StringOrRef.h"
 #include "clang/Levitation/Driver/DriverDefaults.h"
 #include "llvm/ADT/StringRef.h"
 #include "llvm/ADT/Twine.h"
+#include "llvm/Support/VirtualFileSystem.h"
 
-namespace clang { namespace levitation { namespace log {
-  class Logger;
+#include <memory>
+
+namespace clang { namespace levitation { namespace tasks {
+  class ConcurrencyController;
 }}}
 
 namespace clang { namespace levitation { namespace tools {
@@ -31,6 +35,41 @@ namespace clang { namespace levitation { namespace tools {
   class LevitationDriver {
   public:
     using Args = llvm::SmallVector<StringOrRef, 8>;
+
+    /// Objects layer, built from the same declaration ASTs
+    /// with its own codegen flags.
+    struct BuildConfig {
+      std::string Name;
+      Args CodeGenArgs;
+    };
+
+    enum class SchedulingMode {
+      // Recursive deep search first walk, each job waits for its
+      // dependencies.
+      DepthFirst,
+
+      // Topological walk, node is started once all its dependencies
+      // are complete. Workers never wait for each other.
+      ReadyQueue,
+
+      // Same as ReadyQueue, but among ready nodes the one with longest
+      // remaining path to terminals is started first.
+      CriticalPath,
+
+      Unknown
+    };
+
+    enum class ExecutionMode {
+      // Each compiler job is executed in separate clang++ process.
+      Subprocess,
+
+      // Compiler jobs are executed in driver process.
+      InProcess,
+
+      // Compiler jobs are sent to long-lived compile server processes.
+      CompileServer
+    };
+
   private:
 
     enum VerboseLevel {
@@ -41,18 +80,97 @@ namespace clang { namespace levitation { namespace tools {
 
     VerboseLevel Verbose = VerboseLevel0;
 
+    levitation::SinglePath CommandPath;
     levitation::SinglePath BinDir;
+
+    /// File system driver reads sources through, real one if not set,
+    /// see LevitationDriverSession.
+    llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> FileSystem;
+
+    /// Receives driver messages besides log, see LevitationDriverSession.
+    log::Logger::sink_t LogSink;
+
+    /// Whether driver facilities are created, see init.
+    bool Initialized = false;
+    std::shared_ptr<tasks::ConcurrencyController> Concurrency;
+
     llvm::StringRef SourcesRoot = DriverDefaults::SOURCES_ROOT;
     llvm::SmallVector<SinglePath, 16> Includes;
     llvm::SmallVector<llvm::StringRef, 16> LevitationLibs;
+
+    /// Prebuilt levitation libraries, see LibraryBundle.
+    llvm::SmallVector<llvm::StringRef, 4> LevitationBundles;
     llvm::StringRef BuildRoot = DriverDefaults::BUILD_ROOT;
     StringRef LibsOutSubDir = DriverDefaults::LIBS_OUTPUT_SUBDIR;
     llvm::StringRef PreambleSource;
     levitation::SinglePath PreambleOutput;
     levitation::SinglePath PreambleOutputMeta;
 
+    /// Preambles main preamble is chained on, in order.
+    llvm::SmallVector<llvm::StringRef, 4> PreambleChainSources;
+
+    /// Prebuilt standard library preamble chain starts with,
+    /// see --stdlib-preamble. "auto" stands for preamble installed
+    /// along with toolchain for selected standard library.
+    llvm::StringRef StdLibPreamble;
+
+    /// Resolved StdLibPreamble, empty if it is not used.
+    levitation::SinglePath StdLibPreambleFile;
+
+    /// Preamble of units in given directory, see --subtree-preamble.
+    /// It is built on top of main preamble, if any, and units
+    /// of directory load it instead of main preamble.
+    struct SubtreePreamble {
+      /// Directory, relative to sources root, and its absolute path.
+      llvm::StringRef Dir;
+      levitation::SinglePath AbsDir;
+
+      llvm::StringRef Source;
+      levitation::SinglePath Output;
+      levitation::SinglePath OutputMeta;
+    };
+    llvm::SmallVector<SubtreePreamble, 4> SubtreePreambles;
+
+    /// Legacy headers built into separate declaration ASTs,
+    /// see --header-unit.
+    llvm::SmallVector<llvm::StringRef, 8> HeaderUnits;
+
     int JobsNumber = DriverDefaults::JOBS_NUMBER;
 
+    /// Whether number of running jobs is adjusted at runtime from
+    /// host pressure and jobs throughput, see -j auto.
+    bool AutoJobs = false;
+
+    /// Whether workers are split between NUMA nodes, and nodes jobs
+    /// are run on NUMA node their dependencies were built on.
+    bool Numa = false;
+
+    /// Whether workers are pinned to CPUs of their NUMA nodes.
+    bool PinWorkers = false;
+
+    /// Whether object jobs off critical path run with lower CPU
+    /// and I/O priority.
+    bool JobPriorities = false;
+
+    /// Memory budget for all jobs, e.g. "48G", empty means unlimited.
+    llvm::StringRef MaxMemory;
+
+    /// Jobs limits of pools, each is "<pool>=<N>[,<pool>=<N>...]".
+    llvm::SmallVector<llvm::StringRef, 2> Pools;
+
+    /// GNU make jobserver mode, either "auto", "serve" or "off".
+    llvm::StringRef JobserverMode = DriverDefaults::JOBSERVER;
+
+    /// Number of failed steps after which build is cancelled,
+    /// 0 means build keeps going whatever fails.
+    int FailuresLimit = DriverDefaults::FAILURES_LIMIT;
+
+    /// Whether running subprocesses are killed once build is cancelled.
+    bool FailFast = false;
+
+    llvm::StringRef ScheduleName = DriverDefaults::SCHEDULE;
+    SchedulingMode Schedule = SchedulingMode::Unknown;
+
     bool OutputHeadersDirDefault = true;
     levitation::SinglePath OutputHeadersDir;
 
@@ -65,15 +183,339 @@ namespace clang { namespace levitation { namespace tools {
 
     bool DryRun = false;
 
+    bool Watch = false;
+
+    /// Units whose nodes and their dependencies ready queue starts
+    /// before anything else, see --focus.
+    llvm::SmallVector<llvm::StringRef, 4> FocusUnits;
+
+    /// File with IDs of focused units, one per line, which is read
+    /// again by each build, see --focus-file.
+    llvm::StringRef FocusFile;
+
+    llvm::StringRef SourcesManifest;
+
+    ExecutionMode Execution = ExecutionMode::Subprocess;
+
+    /// Preamble is kept loaded by process which runs compiler jobs,
+    /// see InProcessCompiler::setWarmPreamble.
+    bool WarmPreamble = false;
+
+    bool ImportScannerEnabled = true;
+
+    /// Max number of sources parsed by one parse import invocation,
+    /// only used for sources import scanner can't handle.
+    int ParseImportBatchSize = 1;
+
+    bool NameIndexEnabled = true;
+
+    bool ModulesCodegen = false;
+
+    bool ModulesDebugInfo = false;
+
+    bool InstantiateInterface = false;
+
+    /// Max tokens of out-of-line function body, which is kept in
+    /// declaration AST, so that dependents may inline it,
+    /// 0 if bodies are never kept, see --export-bodies.
+    int ExportBodies = 0;
+
+    bool EarlyCutoff = false;
+
+    bool CompactDeclAST = false;
+
+    /// Declaration AST meta is stored in declaration AST itself.
+    bool EmbedMeta = false;
+
+    bool PackArtifacts = false;
+
+    /// Keep sources location out of artifacts and cache keys.
+    bool Reproducible = false;
+
+    /// Absolute sources root in reproducible mode, empty otherwise.
+    levitation::SinglePath PortableSourcesRoot;
+
+    bool HidePrivateUnits = false;
+    bool ExportAllUnits = false;
+
+    bool KeepIR = false;
+
+    /// Whether object jobs release AST and Sema once IR is generated,
+    /// before optimization pipeline is run, see --release-ast.
+    bool ReleaseAST = false;
+
+    /// Milliseconds, object job of previous build should run longer
+    /// than, for unit to be code generated as several partitions in
+    /// parallel, 0 if objects are never split, see --split-codegen.
+    int SplitCodeGenAfter = 0;
+
+    /// Whether code of split objects partitions is cached by hashes
+    /// of their IR, see --incremental-codegen.
+    bool IncrementalCodeGen = false;
+
+    bool ProfileGenerate = false;
+    levitation::SinglePath ProfileUse;
+
+    /// Instrumented profile, or list of units, objects of hot units
+    /// get HotOptLevel, and cold ones get ColdOptLevel, see --hot-units.
+    levitation::SinglePath HotUnitsFile;
+    llvm::StringRef HotOptLevel = DriverDefaults::HOT_OPT_LEVEL;
+    llvm::StringRef ColdOptLevel = DriverDefaults::COLD_OPT_LEVEL;
+
+    /// Debug info of objects goes into .dwo files next to them,
+    /// linker only gets skeleton units, see --split-dwarf.
+    bool SplitDwarf = false;
+
+    /// Linked executables get .dwp packages of their .dwo files,
+    /// see --dwp.
+    bool DwarfPackage = false;
+
+    /// lld symbol ordering file, or instrumented profile to make it of,
+    /// see --symbol-ordering.
+    levitation::SinglePath SymbolOrdering;
+
+    llvm::StringRef LTOName;
+    bool ThinLTO = false;
+
+    /// Classes of units out of public interface get hidden LTO
+    /// visibility, so that ThinLTO devirtualizes their virtual calls,
+    /// see --whole-program-vtables.
+    bool WholeProgramVTables = false;
+    llvm::StringRef ThinLTOExecutor;
+
+    /// Program declaration AST and object jobs are delegated to.
+    llvm::StringRef RemoteExecutor;
+
+    /// Number of workers behind remote executor, jobs are assigned
+    /// to workers so that shared declaration ASTs stay on them.
+    int RemoteWorkers = 0;
+
+    /// Percent of expected duration, after which delegated critical
+    /// path job is duplicated, 0 if jobs are never duplicated.
+    int SpeculateAfter = 0;
+
+    /// Part of definitions this build compiles, as "<i>/<n>",
+    /// see ShardIndex and NumShards.
+    llvm::StringRef Shard;
+
+    /// Main units build is restricted to, all project
+    /// is built if empty.
+    llvm::SmallVector<llvm::StringRef, 4> Targets;
+
+    /// Whether executable is only made of units reachable from its
+    /// main unit, see --link-reachable.
+    bool LinkReachable = false;
+
+    /// Whether linked executables are run as tests, see --test.
+    /// Each target is run as soon as it is linked.
+    bool RunTests = false;
+
+    /// JUnit report of tests, see --junit.
+    levitation::SinglePath JUnitFile;
+
+    /// Unit which defines main, DriverDefaults::MAIN_UNIT if empty.
+    llvm::StringRef MainUnit;
+
+    /// Whether driver should only print units affected by ChangedFiles,
+    /// rather than build anything.
+    bool AffectedQuery = false;
+    llvm::SmallVector<llvm::StringRef, 16> ChangedFiles;
+
+    /// File preamble suggested by build inputs is written to,
+    /// if set, driver doesn't build anything.
+    llvm::StringRef SuggestPreamble;
+
+    /// Whether driver should only print units ranked by rebuild impact
+    /// and load cost, with split suggestions, rather than build anything.
+    bool Advise = false;
+
+    /// Whether driver should only fetch declaration ASTs and objects
+    /// of dirty nodes from build cache, rather than build anything,
+    /// see --prewarm-cache.
+    bool PrewarmCache = false;
+
+    /// Ninja file build plan is written to, if set, driver
+    /// only parses imports and solves dependencies.
+    llvm::StringRef EmitNinja;
+
+    /// Whether driver should only remove artifacts of units which
+    /// don't exist anymore, and trim build cache, rather than build.
+    bool GC = false;
+
+    /// Whether garbage is also collected after each successful build.
+    bool AutoGC = false;
+
+    /// Shard index counted from 1, and number of shards,
+    /// both are 0 if build is not sharded.
+    unsigned ShardIndex = 0;
+    unsigned NumShards = 0;
+
+    bool Streaming = false;
+
+    /// Whether declaration ASTs dependents of running jobs need
+    /// are read into page cache in background.
+    bool Prefetch = false;
+
+    bool TimeReport = false;
+
+    /// Whether decl-ast and object jobs are run with -ftime-trace,
+    /// and report of their traces is printed after build.
+    bool UnitTimeTrace = false;
+
+    /// Whether decl-ast and object jobs write numbers of declarations,
+    /// types and identifiers they deserialized from each dependency.
+    bool DependencyStats = false;
+
+    /// Whether decl-ast and object jobs serialize their diagnostics,
+    /// so that they're printed again for up-to-date and cached
+    /// products, see --replay-diagnostics.
+    bool ReplayDiagnostics = false;
+
+    /// Whether declaration level imports, unit declaration doesn't use
+    /// according to dependencies stats, are treated as [bodydep] ones,
+    /// see --private-imports.
+    bool PrivateImports = false;
+
+    /// Whether definitions, whose declaration ASTs tell they emit
+    /// no code, are neither compiled, nor linked,
+    /// see --skip-empty-objects.
+    bool SkipEmptyObjects = false;
+
+    /// Whether driver counters are printed after build, see --stats.
+    bool Stats = false;
+
+    /// Whether reason of each node rebuild is printed after build.
+    bool Explain = false;
+
+    /// File rebuild reasons are written to as JSON, see --explain-json.
+    llvm::StringRef ExplainOutput;
+
+    /// File dependencies graph with nodes costs is exported to,
+    /// in DOT or JSON format, depending on extension.
+    llvm::StringRef ExportGraph;
+
+    /// File build metrics are written to after each build, in Prometheus
+    /// text format, or as OTLP/JSON if it has .json extension.
+    llvm::StringRef MetricsOutput;
+
+    /// Program metrics file is pushed with, see --metrics-push.
+    llvm::StringRef MetricsPushCommand;
+
+    /// Performance budgets units are checked against after
+    /// each build, see PerformanceBudgets.
+    levitation::SinglePath BudgetsFile;
+
+    /// Whether exceeded budgets fail build, otherwise they
+    /// are only reported as warnings.
+    bool EnforceBudgets = false;
+
+    /// Whether "[done/total] phase unit" status line is shown
+    /// on terminal, see BuildProgress.
+    bool Progress = true;
+
+    /// File descriptor progress events are written to as JSON
+    /// lines, -1 if not set.
+    int StatusFD = -1;
+
+    /// File compilation database of unit objects is written to,
+    /// so that clangd and other tools can parse .cppl units.
+    llvm::StringRef CompileCommands;
+
+    /// Whether compilation database also gets parse-import and decl-ast
+    /// commands of each unit, see --compile-commands-phases.
+    bool CompileCommandsPhases = false;
+
+    /// Whether clang-tidy is run over each unit definition, see --tidy.
+    bool Tidy = false;
+
+    /// Checks clang-tidy is run with, default ones if empty.
+    llvm::StringRef TidyChecks;
+
+    /// Whether unit definitions are only parsed and checked against
+    /// their dependencies, with neither objects, nor link, see --check.
+    bool Check = false;
+
+    llvm::StringRef TraceOutput;
+
+    llvm::StringRef CacheDir;
+    llvm::StringRef RemoteCacheCommand;
+
+    /// Whether local cache entries are hard linked with build root
+    /// artifacts instead of being copied, see --cache-hardlinks.
+    bool CacheHardlinks = false;
+
+    /// Whether declaration ASTs found in build cache are only fetched
+    /// once some local job reads them, see --lazy-cache-fetch.
+    bool LazyCacheFetch = false;
+
+    /// Build root fresh build root is seeded from, see --seed-build-root.
+    llvm::StringRef SeedBuildRoot;
+
+    /// Machine-wide cache of libraries artifacts, see --library-cache.
+    llvm::StringRef LibraryCacheDir;
+
+    /// Whether artifacts are locked while built, so that several
+    /// invocations may share build root, see --shared-build-root.
+    bool SharedBuildRoot = false;
+
+    /// zlib level for large cache entries, 0 means no compression.
+    int CacheCompression = 0;
+
+    /// Hash algorithm of new metas and cache keys, "md5" or "xxh64".
+    llvm::StringRef Hash = "md5";
+
+    /// Maximum number of artifacts waiting for publication,
+    /// 0 means artifacts are published by jobs which built them.
+    int PublishQueueDepth = 64;
+
+    /// Local build cache limits, in megabytes and days since entry
+    /// was last used, 0 means no limit. Applied by garbage collection.
+    int CacheMaxSize = 0;
+    int CacheMaxAge = 0;
+
     llvm::StringRef StdLib = DriverDefaults::STDLIB;
     bool CanUseLibStdCppForLinker = true;
 
+    /// Linker name for -fuse-ld, empty means default linker
+    /// of clang driver.
+    llvm::StringRef Linker = DriverDefaults::LINKER;
+    int LinkerThreads = 0;
+    bool PartialLink = false;
+    bool SharedPackages = false;
+
+    /// Static archive objects are put into in library (-c) mode,
+    /// empty if archive is not requested.
+    llvm::StringRef Archive;
+    bool ThinArchive = false;
+
+    /// Library bundle project units are put into in library (-c) mode,
+    /// empty if bundle is not requested.
+    llvm::StringRef MakeBundle;
+
+    /// Single header all project's public headers are put into
+    /// in library (-c) mode, empty if it is not requested.
+    llvm::StringRef AmalgamatedHeader;
+
+    /// Whether clang module map of public headers is written into
+    /// output headers directory in library (-c) mode.
+    bool EmitModuleMap = false;
+
+    /// PCH public headers are precompiled into in library (-c)
+    /// mode, empty if it is not requested.
+    llvm::StringRef HeadersPCH;
+
+    bool Unity = false;
+    int UnitySize = DriverDefaults::UNITY_SIZE;
+
     Args ExtraPreambleArgs;
     Args ExtraParseArgs;
     Args ExtraParseImportArgs;
     Args ExtraCodeGenArgs;
+    Args ExtraBackendArgs;
     Args ExtraLinkerArgs;
 
+    llvm::SmallVector<BuildConfig, 4> Configs;
+
   public:
 
     LevitationDriver(llvm::StringRef CommandPath);
@@ -127,6 +569,29 @@ namespace clang { namespace levitation { namespace tools {
       LevitationDriver::PreambleSource = PreambleSource;
     }
 
+    /// Adds preamble to the end of preambles chain. Last added
+    /// preamble becomes the main one, which is included into all units.
+    void addPreambleSource(llvm::StringRef Source) {
+      if (PreambleSource.size())
+        PreambleChainSources.push_back(PreambleSource);
+      PreambleSource = Source;
+    }
+
+    void setStdLibPreamble(llvm::StringRef Preamble) {
+      StdLibPreamble = Preamble;
+    }
+
+    void addHeaderUnit(llvm::StringRef Header) {
+      HeaderUnits.push_back(Header);
+    }
+
+    /// \param Spec preamble for directory, as <dir>=<preamble>.
+    void addSubtreePreamble(llvm::StringRef Spec) {
+      SubtreePreamble P;
+      std::tie(P.Dir, P.Source) = Spec.split('=');
+      SubtreePreambles.push_back(std::move(P));
+    }
+
     void setStdLib(llvm::StringRef StdLib) {
       LevitationDriver::StdLib = StdLib;
     }
@@ -139,6 +604,10 @@ namespace clang { namespace levitation { namespace tools {
       LevitationLibs.push_back(Path);
     }
 
+    void addLevitationBundle(llvm::StringRef Path) {
+      LevitationBundles.push_back(Path);
+    }
+
     int getJobsNumber() const {
       return JobsNumber;
     }
@@ -147,6 +616,50 @@ namespace clang { namespace levitation { namespace tools {
       LevitationDriver::JobsNumber = JobsNumber;
     }
 
+    void setAutoJobs() {
+      AutoJobs = true;
+    }
+
+    void setNuma() {
+      Numa = true;
+    }
+
+    void setPinWorkers() {
+      PinWorkers = true;
+    }
+
+    void setJobPriorities() {
+      JobPriorities = true;
+    }
+
+    void setMaxMemory(llvm::StringRef Size) {
+      MaxMemory = Size;
+    }
+
+    void addPools(llvm::StringRef Limits) {
+      Pools.push_back(Limits);
+    }
+
+    void setFailuresLimit(int Limit) {
+      FailuresLimit = Limit;
+    }
+
+    void setFailFast() {
+      FailFast = true;
+    }
+
+    void setJobserverMode(llvm::StringRef Mode) {
+      JobserverMode = Mode;
+    }
+
+    void setSchedule(llvm::StringRef Name) {
+      ScheduleName = Name;
+    }
+
+    SchedulingMode getSchedule() const {
+      return Schedule;
+    }
+
     llvm::StringRef getOutput() const {
       return Output;
     }
@@ -193,6 +706,209 @@ namespace clang { namespace levitation { namespace tools {
       LinkPhaseEnabled = false;
     }
 
+    void disableImportScanner() {
+      ImportScannerEnabled = false;
+    }
+
+    void setParseImportBatchSize(int Size) {
+      ParseImportBatchSize = Size;
+    }
+
+    void disableNameIndex() {
+      NameIndexEnabled = false;
+    }
+
+    void setModulesCodegen() {
+      ModulesCodegen = true;
+    }
+
+    void setModulesDebugInfo() {
+      ModulesDebugInfo = true;
+    }
+
+    void setInstantiateInterface() {
+      InstantiateInterface = true;
+    }
+
+    void setExportBodies(int MaxTokens) {
+      ExportBodies = MaxTokens;
+    }
+
+    void setEarlyCutoff() {
+      EarlyCutoff = true;
+    }
+
+    void setCompactDeclAST() {
+      CompactDeclAST = true;
+    }
+
+    void setEmbedMeta() {
+      EmbedMeta = true;
+    }
+
+    void setPackArtifacts() {
+      PackArtifacts = true;
+    }
+
+    void setReproducible() {
+      Reproducible = true;
+    }
+
+    void setHidePrivateUnits() {
+      HidePrivateUnits = true;
+    }
+
+    void setExportAllUnits() {
+      ExportAllUnits = true;
+    }
+
+    void setKeepIR() {
+      KeepIR = true;
+    }
+
+    void enableReleaseAST() {
+      ReleaseAST = true;
+    }
+
+    void setSplitCodeGenAfter(int Milliseconds) {
+      SplitCodeGenAfter = Milliseconds;
+    }
+
+    void enableIncrementalCodeGen() {
+      IncrementalCodeGen = true;
+    }
+
+    void setProfileGenerate() {
+      ProfileGenerate = true;
+    }
+
+    void setProfileUse(llvm::StringRef ProfData) {
+      ProfileUse = ProfData;
+    }
+
+    void setHotUnits(llvm::StringRef File) {
+      HotUnitsFile = File;
+    }
+
+    void setHotOptLevel(llvm::StringRef Level) {
+      HotOptLevel = Level;
+    }
+
+    void setColdOptLevel(llvm::StringRef Level) {
+      ColdOptLevel = Level;
+    }
+
+    void setSymbolOrdering(llvm::StringRef File) {
+      SymbolOrdering = File;
+    }
+
+    /// Objects built with different profile modes are kept
+    /// side by side, so that switching between modes
+    /// doesn't rebuild declaration ASTs, or objects built before.
+    /// \return objects extension prefix, or empty string
+    /// if profile mode is not set.
+    llvm::StringRef getProfileVariant() const {
+      if (ProfileGenerate)
+        return "profgen";
+      if (ProfileUse.size())
+        return "profuse";
+      return "";
+    }
+
+    void setLTO(llvm::StringRef Name) {
+      LTOName = Name;
+    }
+
+    void setSplitDwarf() {
+      SplitDwarf = true;
+    }
+
+    void setDwarfPackage() {
+      DwarfPackage = true;
+    }
+
+    void setWholeProgramVTables() {
+      WholeProgramVTables = true;
+    }
+
+    void setThinLTOExecutor(llvm::StringRef Program) {
+      ThinLTOExecutor = Program;
+    }
+
+    void setRemoteExecutor(llvm::StringRef Program) {
+      RemoteExecutor = Program;
+    }
+
+    void setRemoteWorkers(int N) {
+      RemoteWorkers = N;
+    }
+
+    void setSpeculateAfter(int Percent) {
+      SpeculateAfter = Percent;
+    }
+
+    void setShard(llvm::StringRef IndexAndNumber) {
+      Shard = IndexAndNumber;
+    }
+
+    void addTarget(llvm::StringRef UnitID) {
+      Targets.push_back(UnitID);
+    }
+
+    void setLinkReachable() {
+      LinkReachable = true;
+    }
+
+    void setRunTests() {
+      RunTests = true;
+    }
+
+    void setJUnitFile(llvm::StringRef File) {
+      JUnitFile = File;
+    }
+
+    void setMainUnit(llvm::StringRef UnitID) {
+      MainUnit = UnitID;
+    }
+
+    /// Adds comma separated list of changed files, see AffectedQuery.
+    void addChangedFiles(llvm::StringRef Files) {
+      AffectedQuery = true;
+      Files.split(ChangedFiles, ',', /*MaxSplit=*/-1, /*KeepEmpty=*/false);
+    }
+
+    void setStreaming() {
+      Streaming = true;
+    }
+
+    void setPrefetch() {
+      Prefetch = true;
+    }
+
+    void setSuggestPreamble(llvm::StringRef File) {
+      SuggestPreamble = File;
+    }
+
+    void setAdvise() {
+      Advise = true;
+    }
+
+    void setPrewarmCache() {
+      PrewarmCache = true;
+    }
+
+    void setEmitNinja(llvm::StringRef File) {
+      EmitNinja = File;
+    }
+
+    void setGC() {
+      GC = true;
+    }
+
+    void setAutoGC() {
+      AutoGC = true;
+    }
+
     bool isDryRun() const {
       return DryRun;
     }
@@ -201,22 +917,257 @@ namespace clang { namespace levitation { namespace tools {
       DryRun = true;
     }
 
+    bool isWatchMode() const {
+      return Watch;
+    }
+
+    void setWatchMode() {
+      Watch = true;
+    }
+
+    void addFocus(llvm::StringRef UnitID) {
+      FocusUnits.push_back(UnitID);
+    }
+
+    void setFocusFile(llvm::StringRef File) {
+      FocusFile = File;
+    }
+
+    ExecutionMode getExecutionMode() const {
+      return Execution;
+    }
+
+    void setExecutionMode(ExecutionMode Mode) {
+      Execution = Mode;
+    }
+
+    void setWarmPreamble() {
+      WarmPreamble = true;
+    }
+
+    bool isTimeReportEnabled() const {
+      return TimeReport;
+    }
+
+    void enableTimeReport() {
+      TimeReport = true;
+    }
+
+    void enableUnitTimeTrace() {
+      UnitTimeTrace = true;
+    }
+
+    void enableDependencyStats() {
+      DependencyStats = true;
+    }
+
+    void enableReplayDiagnostics() {
+      ReplayDiagnostics = true;
+    }
+
+    void enablePrivateImports() {
+      PrivateImports = true;
+    }
+
+    void setSkipEmptyObjects() {
+      SkipEmptyObjects = true;
+    }
+
+    void enableStats() {
+      Stats = true;
+    }
+
+    void enableExplain() {
+      Explain = true;
+    }
+
+    void setExplainOutput(llvm::StringRef File) {
+      Explain = true;
+      ExplainOutput = File;
+    }
+
+    void setExportGraph(llvm::StringRef File) {
+      ExportGraph = File;
+    }
+
+    void setMetricsOutput(llvm::StringRef File) {
+      MetricsOutput = File;
+    }
+
+    void setMetricsPushCommand(llvm::StringRef Command) {
+      MetricsPushCommand = Command;
+    }
+
+    void setBudgetsFile(llvm::StringRef File) {
+      BudgetsFile = File;
+    }
+
+    void setEnforceBudgets() {
+      EnforceBudgets = true;
+    }
+
+    void disableProgress() {
+      Progress = false;
+    }
+
+    void setStatusFD(int FD) {
+      StatusFD = FD;
+    }
+
+    void setCompileCommands(llvm::StringRef File) {
+      CompileCommands = File;
+    }
+
+    void setCompileCommandsPhases() {
+      CompileCommandsPhases = true;
+    }
+
+    void setTidy() {
+      Tidy = true;
+    }
+
+    void setTidyChecks(llvm::StringRef Checks) {
+      Tidy = true;
+      TidyChecks = Checks;
+    }
+
+    void setCheck() {
+      Check = true;
+    }
+
+    void setTraceOutput(llvm::StringRef TraceOutput) {
+      LevitationDriver::TraceOutput = TraceOutput;
+    }
+
+    void setSourcesManifest(llvm::StringRef SourcesManifest) {
+      LevitationDriver::SourcesManifest = SourcesManifest;
+    }
+
+    void setCacheDir(llvm::StringRef CacheDir) {
+      LevitationDriver::CacheDir = CacheDir;
+    }
+
+    void setRemoteCacheCommand(llvm::StringRef Command) {
+      RemoteCacheCommand = Command;
+    }
+
+    void setCacheHardlinks() {
+      CacheHardlinks = true;
+    }
+
+    void setLazyCacheFetch() {
+      LazyCacheFetch = true;
+    }
+
+    void setSeedBuildRoot(llvm::StringRef Dir) {
+      SeedBuildRoot = Dir;
+    }
+
+    void setLibraryCacheDir(llvm::StringRef Dir) {
+      LibraryCacheDir = Dir;
+    }
+
+    void setSharedBuildRoot() {
+      SharedBuildRoot = true;
+    }
+
+    void setCacheCompression(int Level) {
+      CacheCompression = Level;
+    }
+
+    void setHash(llvm::StringRef Name) {
+      Hash = Name;
+    }
+
+    void setPublishQueueDepth(int Depth) {
+      PublishQueueDepth = Depth;
+    }
+
+    void setCacheMaxSize(int MB) {
+      CacheMaxSize = MB;
+    }
+
+    void setCacheMaxAge(int Days) {
+      CacheMaxAge = Days;
+    }
+
     void disableUseLibStdCppForLinker() {
       LevitationDriver::CanUseLibStdCppForLinker = false;
     }
 
+    void setLinker(llvm::StringRef Name) {
+      Linker = Name == "system" ? llvm::StringRef() : Name;
+    }
+
+    void setLinkerThreads(int Threads) {
+      LinkerThreads = Threads;
+    }
+
+    void setPartialLink() {
+      PartialLink = true;
+    }
+
+    void setSharedPackages() {
+      SharedPackages = true;
+    }
+
+    void setArchive(llvm::StringRef File) {
+      Archive = File;
+    }
+
+    void setThinArchive() {
+      ThinArchive = true;
+    }
+
+    void setMakeBundle(llvm::StringRef File) {
+      MakeBundle = File;
+    }
+
+    void setAmalgamatedHeader(llvm::StringRef File) {
+      AmalgamatedHeader = File;
+    }
+
+    void setEmitModuleMap() {
+      EmitModuleMap = true;
+    }
+
+    void setHeadersPCH(llvm::StringRef File) {
+      HeadersPCH = File;
+    }
+
+    void setUnity() {
+      Unity = true;
+    }
+
+    void setUnitySize(int Size) {
+      UnitySize = Size;
+    }
+
     void setExtraPreambleArgs(StringRef Args);
     void setExtraParserArgs(StringRef Args);
     void setExtraCodeGenArgs(StringRef Args);
+    void setExtraBackendArgs(StringRef Args);
+
+    /// Adds build configuration.
+    /// \param NameAndArgs configuration in form <name>:<codegen args>
+    void addConfig(StringRef NameAndArgs);
     void setExtraLinkerArgs(StringRef Args);
 
     bool run();
 
     friend class LevitationDriverImpl;
+    friend class LevitationDriverSession;
 
   protected:
 
-    void initParameters();
+    /// Creates driver facilities and checks options, only once,
+    /// so that session may run several builds.
+    /// \return false if options are wrong.
+    bool init();
+
+    bool initParameters();
+    bool initJobserver();
+    bool initPools();
     void dumpParameters();
     void dumpExtraFlags(llvm::raw_ostream& Out, StringRef Phase, const Args &args);
     void dumpIncludes(llvm::raw_ostream& Out);
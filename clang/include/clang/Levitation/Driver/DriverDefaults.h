@@ -25,12 +25,43 @@ namespace clang { namespace levitation { namespace tools {
       static constexpr char SOURCES_ROOT [] = ".";
       static constexpr char BUILD_ROOT [] = ".build";
       static constexpr char LIBS_OUTPUT_SUBDIR [] = "levitation-libs";
+      static constexpr char HEADER_UNITS_SUBDIR [] = "header-units";
       static constexpr char STDLIB[] = "";
       static constexpr int JOBS_NUMBER = 1;
+      static constexpr int UNITY_SIZE = 8;
+      static constexpr int FAILURES_LIMIT = 1;
+      static constexpr int CODEGEN_PARTITIONS = 4;
+      static constexpr int INCREMENTAL_CODEGEN_PARTITIONS = 16;
+      static constexpr int ADVISED_UNITS = 10;
+      static constexpr int WORKER_WARM_REQUESTS = 256;
+      static constexpr char HOT_OPT_LEVEL [] = "3";
+      static constexpr char COLD_OPT_LEVEL [] = "s";
+      static constexpr int HOT_UNITS_PERCENT = 90;
+      static constexpr char HOT_UNITS [] = "hot-units.txt";
+      static constexpr char LINKER [] = "lld";
       static constexpr char OUTPUT_EXECUTABLE [] = "a.out";
       static constexpr char OUTPUT_OBJECTS_DIR [] = "a.dir";
+      static constexpr char MAIN_UNIT [] = "main";
       static constexpr char PREAMBLE_OUT [] = "preamble.pch";
       static constexpr char PREAMBLE_OUT_META [] = "preamble.meta";
+      static constexpr char SCHEDULE [] = "ready-queue";
+      static constexpr char JOBSERVER [] = "auto";
+      static constexpr char BUILD_HISTORY [] = "build.history";
+      static constexpr char BUILD_STATE [] = "build.state";
+      static constexpr char BUILD_JOURNAL [] = "build.journal";
+      static constexpr char NAME_INDEX [] = "names.idx";
+      static constexpr char DEPENDENCIES_INDEX [] = "deps.idx";
+      static constexpr char THINLTO_CACHE_DIR [] = "thinlto-cache";
+      static constexpr char PARTIAL_LINKS_DIR [] = "partial";
+      static constexpr char SHARED_PACKAGES_DIR [] = "shared";
+      static constexpr char SYMBOL_ORDERING [] = "symbol-ordering.txt";
+      static constexpr char UNSAVED_FILES_DIR [] = "unsaved";
+      static constexpr char UNSAVED_FILES_OVERLAY [] = "overlay.yaml";
+      static constexpr char LIBRARY_INTERFACE [] = "interface.fingerprint";
+      static constexpr char STDLIB_PREAMBLES_DIR [] = "../share/cppl/preambles";
+      static constexpr char CODEGEN_CACHE_DIR [] = "codegen-cache";
+      static constexpr char MODULE_MAP [] = "module.modulemap";
+      static constexpr char PUBLIC_HEADERS [] = "public-headers.h";
   };
 }}}
 
@@ -0,0 +1,110 @@
+//===--- DriverSession.h - C++ Levitation Driver session --------*- C++ -*-===//
+//
+// Part of the C++ Levitation Project,
+// under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file defines driver session, library interface of C++ Levitation
+//  driver for long-lived clients, e.g. IDE plugins or build system
+//  workers. Session keeps driver warm between builds: driver facilities
+//  are created once, and each build reuses sources, dependencies and
+//  build state of previous one, same as watch mode does.
+//
+//  Example of use:
+//
+//    LevitationDriver Driver(Argv0);
+//    Driver.setSourcesRoot(Root);
+//    // ...
+//
+//    LevitationDriverSession::Callbacks CB;
+//    CB.Diagnostic = [&] (log::Level L, StringRef Message) { /*...*/ };
+//    LevitationDriverSession Session(Driver, std::move(CB));
+//
+//    Session.setUnsavedFile(EditedFile, EditorBuffer);
+//    Session.build();
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_LEVITATION_DRIVERSESSION_H
+#define LLVM_LEVITATION_DRIVERSESSION_H
+
+#include "clang/Levitation/Common/SimpleLogger.h"
+#include "llvm/ADT/StringRef.h"
+
+#include <functional>
+#include <memory>
+
+namespace clang { namespace levitation { namespace tools {
+
+  class LevitationDriver;
+
+  class LevitationDriverSession {
+  public:
+
+    /// Callbacks are called by threads which run build,
+    /// so they should be thread safe.
+    struct Callbacks {
+      /// Called once build step is started, e.g. declaration AST
+      /// or object of unit.
+      /// \param Step kind of step, same as in time report.
+      /// \param Unit path of unit, or of its source.
+      std::function<void(
+          llvm::StringRef Step, llvm::StringRef Unit
+      )> JobStarted;
+
+      /// Called once build step is finished.
+      std::function<void(
+          llvm::StringRef Step, llvm::StringRef Unit, bool Successful
+      )> JobFinished;
+
+      /// Called for each driver message session log level allows.
+      /// Compiler diagnostics are written out by compiler jobs.
+      std::function<void(
+          log::Level Level, llvm::StringRef Message
+      )> Diagnostic;
+    };
+
+  private:
+
+    class Impl;
+    std::unique_ptr<Impl> Session;
+
+  public:
+
+    /// Driver options should be set before session is created,
+    /// and driver should outlive session.
+    LevitationDriverSession(
+        LevitationDriver &Driver, Callbacks CB = Callbacks()
+    );
+
+    ~LevitationDriverSession();
+
+    /// Builds project, incrementally if session has built it before.
+    /// Driver facilities are created by first call.
+    /// \return true if build was successful.
+    bool build();
+
+    /// Cancels running build, may be called by other thread.
+    void cancel();
+
+    /// Tells session source was changed on disk since previous build,
+    /// so that its stamp is not trusted.
+    void notifyChanged(llvm::StringRef Path);
+
+    /// Tells session sources were added or removed,
+    /// so that they're collected again.
+    void notifySourcesSetChanged();
+
+    /// Overlays existing file with unsaved buffer, both for driver
+    /// and for compiler jobs.
+    void setUnsavedFile(llvm::StringRef Path, llvm::StringRef Contents);
+
+    /// Drops unsaved buffer, e.g. once it is saved or discarded.
+    void removeUnsavedFile(llvm::StringRef Path);
+  };
+}}}
+
+#endif //LLVM_LEVITATION_DRIVERSESSION_H
@@ -0,0 +1,77 @@
+//===--- FileClone.h - C++ Levitation FileClone class -----------*- C++ -*-===//
+//
+// Part of the C++ Levitation Project,
+// under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file contains artifacts materialization, which avoids copying
+//  bytes where file system allows it. Artifacts are cloned with FICLONE
+//  reflink on Linux (btrfs, XFS, overlayfs on top of them), and with
+//  clonefile on macOS (APFS), so that copy shares extents with original.
+//  Otherwise copy_file_range is tried, which at least keeps data in
+//  kernel, and plain copy goes last.
+//
+//  Immutable artifacts, that is ones which are only ever replaced by
+//  rename and never written in place, may also be hard linked.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_LEVITATION_FILECLONE_H
+#define LLVM_LEVITATION_FILECLONE_H
+
+#include "llvm/ADT/StringRef.h"
+
+#include <system_error>
+
+namespace clang { namespace levitation { namespace tools {
+
+  class FileClone {
+  public:
+
+    enum struct Method {
+      Hardlink,
+      Reflink,
+      CopyRange,
+      Copy
+    };
+
+    /// Copies contents of Src into empty file opened as DestFD.
+    /// \param Used set to method which has worked.
+    static std::error_code copy(
+        llvm::StringRef Src, int DestFD, Method &Used
+    );
+
+    /// Makes Dest a copy of Src. Copy is made through temporary file
+    /// in destination directory, so that readers never see partially
+    /// written file.
+    /// \param AllowHardlink whether Dest may be hard link of Src, only
+    ///        for files which are never modified in place. Hard link is
+    ///        tried first, if Src and Dest are on same file system.
+    /// \param PreserveTime whether Dest gets modification time of Src,
+    ///        so that stamps recorded for Src stay valid for Dest.
+    ///        Hard link shares it anyway.
+    /// \return true if successful.
+    static bool materialize(
+        llvm::StringRef Src,
+        llvm::StringRef Dest,
+        bool AllowHardlink,
+        bool PreserveTime = false,
+        Method *Used = nullptr
+    );
+
+    static llvm::StringRef getMethodName(Method M) {
+      switch (M) {
+        case Method::Hardlink: return "hardlink";
+        case Method::Reflink: return "reflink";
+        case Method::CopyRange: return "copy_file_range";
+        case Method::Copy: return "copy";
+      }
+      return "<unknown>";
+    }
+  };
+}}}
+
+#endif //LLVM_LEVITATION_FILECLONE_H
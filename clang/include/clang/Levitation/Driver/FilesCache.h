@@ -0,0 +1,126 @@
+//===--- FilesCache.h - C++ FilesCache class --------------------*- C++ -*-===//
+//
+// Part of the C++ Levitation Project,
+// under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file contains files cache shared by all driver phases.
+//  Each file is stat'ed and read at most once per build, repeated
+//  existence checks and reads are served from memory.
+//
+//  Cache is thread-safe, entries are split into shards, each with
+//  its own lock, so that workers rarely wait for each other.
+//
+//  Build writes its artifacts while cache is alive, so files written
+//  by commands, by levitation::File, or fetched from build cache
+//  are dropped from cache, see invalidate.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_LEVITATION_FILESCACHE_H
+#define LLVM_LEVITATION_FILESCACHE_H
+
+#include "clang/Levitation/Common/CreatableSingleton.h"
+
+#include "llvm/ADT/IntrusiveRefCntPtr.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/ErrorOr.h"
+#include "llvm/Support/VirtualFileSystem.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+namespace llvm {
+  class MemoryBuffer;
+}
+
+namespace clang { namespace levitation { namespace tools {
+
+  class FilesCache : public CreatableSingleton<FilesCache> {
+
+    struct Entry {
+      bool HasStatus = false;
+      std::error_code StatusError;
+      llvm::vfs::Status Status;
+
+      /// Contents are shared with buffers given to readers,
+      /// so that entry may be dropped while contents are in use.
+      std::shared_ptr<llvm::MemoryBuffer> Contents;
+    };
+
+    struct Shard {
+      std::mutex Locker;
+      llvm::StringMap<Entry> Entries;
+
+      /// Bumped once any of shard files is invalidated, so that
+      /// results of stats and reads which were started before
+      /// are not put into cache.
+      uint64_t Generation = 0;
+    };
+
+    static const unsigned NUM_SHARDS = 32;
+
+    llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> Underlying;
+    llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> FS;
+
+    Shard Shards[NUM_SHARDS];
+
+    std::atomic<unsigned> StatHits { 0 };
+    std::atomic<unsigned> StatMisses { 0 };
+    std::atomic<unsigned> ReadHits { 0 };
+    std::atomic<unsigned> ReadMisses { 0 };
+
+    Shard &getShard(llvm::StringRef Key);
+
+    static std::string getKey(const llvm::Twine &Path);
+
+  protected:
+
+    FilesCache(
+        llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> underlying =
+            llvm::vfs::getRealFileSystem()
+    );
+
+    friend CreatableSingleton<FilesCache>;
+
+  public:
+
+    ~FilesCache();
+
+    /// File system which serves files through the cache,
+    /// directories are listed by underlying file system.
+    llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> getFileSystem() {
+      return FS;
+    }
+
+    llvm::ErrorOr<llvm::vfs::Status> status(const llvm::Twine &Path);
+
+    bool exists(const llvm::Twine &Path) {
+      auto S = status(Path);
+      return S && S->exists();
+    }
+
+    /// Returns contents of file, it is read once and then shared
+    /// by all readers.
+    llvm::ErrorOr<std::shared_ptr<llvm::MemoryBuffer>>
+    getContents(const llvm::Twine &Path);
+
+    /// Drops cached status and contents of file,
+    /// it should be called once file is written or removed.
+    void invalidate(llvm::StringRef Path);
+
+    /// Drops all entries, e.g. before next build in watch mode.
+    void clear();
+
+    unsigned getNumHits() const { return StatHits + ReadHits; }
+    unsigned getNumMisses() const { return StatMisses + ReadMisses; }
+  };
+}}}
+
+#endif //LLVM_LEVITATION_FILESCACHE_H
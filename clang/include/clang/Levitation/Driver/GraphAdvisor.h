@@ -0,0 +1,197 @@
+//===--- GraphAdvisor.h - C++ GraphAdvisor class ----------------*- C++ -*-===//
+//
+// Part of the C++ Levitation Project,
+// under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file contains dependencies graph advisor, see --advise.
+//  Units are ranked by rebuild impact, that is how often unit interface
+//  changes, times time it takes to rebuild everything which depends on
+//  it, and by load cost, that is how much dependents deserialize from
+//  unit declaration AST.
+//
+//  For top units advisor tells, whether declaration level imports of
+//  unit could be [bodydep], and whether unit interface is worth to be
+//  split, since its dependents only use small part of it.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_LEVITATION_GRAPHADVISOR_H
+#define LLVM_LEVITATION_GRAPHADVISOR_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SmallVector.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace clang { namespace levitation { namespace tools {
+
+  class GraphAdvisor {
+  public:
+
+    /// Job of dependencies graph, either declaration AST
+    /// or object of unit.
+    struct Node {
+      /// Nodes which import this one directly.
+      llvm::SmallVector<unsigned, 8> Dependents;
+
+      /// Duration of node job in previous builds, microseconds.
+      uint64_t Duration = 0;
+    };
+
+    struct Unit {
+      /// Declaration node of unit.
+      unsigned Decl = 0;
+
+      /// Number of builds which have changed unit interface.
+      unsigned InterfaceChanges = 0;
+
+      /// Declaration nodes which import unit, though use nothing
+      /// from it, so that import could be [bodydep].
+      llvm::SmallVector<unsigned, 4> BodyOnlyDependents;
+
+      /// Size of unit declaration AST.
+      uint64_t DeclASTSize = 0;
+
+      /// Total of bytes dependents have deserialized from unit
+      /// declaration AST, and number of jobs which have loaded it.
+      uint64_t LoadedBytes = 0;
+      unsigned NumLoads = 0;
+    };
+
+    struct Advice {
+      /// Index of unit in Units.
+      unsigned U;
+
+      /// Number of jobs which are rerun once unit interface changes,
+      /// and total of their durations.
+      size_t NumAffected = 0;
+      uint64_t AffectedTime = 0;
+
+      /// Interface changes times affected time.
+      uint64_t Impact = 0;
+
+      /// Affected time which would be saved, if imports of
+      /// BodyOnlyDependents were [bodydep].
+      uint64_t BodyDepSavedTime = 0;
+
+      /// Whether dependents only use small part of unit interface,
+      /// so that unit is worth to be split.
+      bool SuggestSplit = false;
+
+      /// Average bytes dependents read, percent of declaration AST.
+      unsigned LoadedPercent = 0;
+    };
+
+    /// Dependents which read at most this percent of declaration AST
+    /// on average make unit split candidate.
+    static constexpr unsigned SplitLoadedPercent = 25;
+
+    /// Split is only suggested for units with at least this many
+    /// loading jobs, otherwise there are too few users to split for.
+    static constexpr unsigned SplitMinLoads = 3;
+
+  private:
+
+    /// Gathers all nodes reachable from Start by dependents edges,
+    /// edges from Start to Cut nodes are skipped.
+    static void collectAffected(
+        llvm::ArrayRef<Node> Nodes,
+        unsigned Start,
+        llvm::ArrayRef<unsigned> Cut,
+        llvm::BitVector &Affected
+    ) {
+      Affected.clear();
+      Affected.resize(Nodes.size());
+
+      llvm::SmallVector<unsigned, 32> Worklist;
+      for (auto D : Nodes[Start].Dependents)
+        if (std::find(Cut.begin(), Cut.end(), D) == Cut.end())
+          Worklist.push_back(D);
+
+      // Cycles are reported by solver, Start may be reached again.
+      while (!Worklist.empty()) {
+        unsigned Idx = Worklist.pop_back_val();
+        if (Idx == Start || Affected.test(Idx))
+          continue;
+        Affected.set(Idx);
+        for (auto D : Nodes[Idx].Dependents)
+          Worklist.push_back(D);
+      }
+    }
+
+    static uint64_t getTotalDuration(
+        llvm::ArrayRef<Node> Nodes, const llvm::BitVector &Affected
+    ) {
+      uint64_t Total = 0;
+      for (auto Idx : Affected.set_bits())
+        Total += Nodes[Idx].Duration;
+      return Total;
+    }
+
+  public:
+
+    /// Ranks units, most expensive first.
+    /// \return advices, for each unit whose interface has changed, or
+    /// which dependents load.
+    static std::vector<Advice> advise(
+        llvm::ArrayRef<Node> Nodes,
+        llvm::ArrayRef<Unit> Units
+    ) {
+      std::vector<Advice> Res;
+      llvm::BitVector Affected;
+
+      for (unsigned U = 0, e = Units.size(); U != e; ++U) {
+        const auto &Info = Units[U];
+        if (!Info.InterfaceChanges && !Info.LoadedBytes)
+          continue;
+
+        Advice A;
+        A.U = U;
+
+        collectAffected(Nodes, Info.Decl, {}, Affected);
+        A.NumAffected = Affected.count();
+        A.AffectedTime = getTotalDuration(Nodes, Affected);
+        A.Impact = Info.InterfaceChanges * A.AffectedTime;
+
+        if (Info.BodyOnlyDependents.size()) {
+          // Objects of such dependents import unit directly,
+          // so they are still affected.
+          collectAffected(Nodes, Info.Decl, Info.BodyOnlyDependents, Affected);
+          uint64_t Time = getTotalDuration(Nodes, Affected);
+          if (Time < A.AffectedTime)
+            A.BodyDepSavedTime = A.AffectedTime - Time;
+        }
+
+        if (Info.NumLoads && Info.DeclASTSize) {
+          A.LoadedPercent = std::min<uint64_t>(
+              100, Info.LoadedBytes * 100 / (Info.NumLoads * Info.DeclASTSize)
+          );
+          A.SuggestSplit =
+              Info.NumLoads >= SplitMinLoads &&
+              A.LoadedPercent <= SplitLoadedPercent;
+        }
+
+        Res.push_back(A);
+      }
+
+      std::stable_sort(Res.begin(), Res.end(), [&] (
+          const Advice &L, const Advice &R
+      ) {
+        if (L.Impact != R.Impact)
+          return L.Impact > R.Impact;
+        return Units[L.U].LoadedBytes > Units[R.U].LoadedBytes;
+      });
+
+      return Res;
+    }
+  };
+}}}
+
+#endif //LLVM_LEVITATION_GRAPHADVISOR_H
@@ -7,7 +7,10 @@
 //
 //===----------------------------------------------------------------------===//
 //
-//  This file contains .h files generator class
+//  This file contains .h files generator class.
+//  Generator is also used by decl-ast frontend job, which emits .h
+//  and .decl files from fragments it has collected, so it doesn't
+//  depend on driver's state.
 //
 //===----------------------------------------------------------------------===//
 
@@ -42,8 +45,6 @@ class HeaderGenerator {
 
   bool CreateDecl;
 
-  log::Logger &Log;
-
 public:
   HeaderGenerator(
       llvm::StringRef UnitID,
@@ -64,8 +65,7 @@ public:
     SkippedBytes(SkippedBytes),
     Verbose(Verbose),
     DryRun(DryRun),
-    CreateDecl(CreateDecl),
-    Log(log::Logger::get())
+    CreateDecl(CreateDecl)
   {}
 
   std::unique_ptr<MemoryBuffer> getSourceFileBuffer() {
@@ -80,196 +80,17 @@ public:
   }
 
   bool execute() {
-
-    auto dumpLevel = Verbose ? log::Level::Verbose :
-                     DryRun ? log::Level::Info :
-                     log::Level::Null;
-
-    if (dumpLevel != log::Level::Null) {
-      with (auto out = Log.acquire(dumpLevel)) {
-        dump(out.s);
-      }
-    }
+    dumpAction();
 
     if (DryRun)
       return true;
 
     if (auto InPtr = getSourceFileBuffer()) {
-      const auto &In = *InPtr;
-      const char *InStart = In.getBufferStart();
-      size_t InSize = In.getBufferSize();
-
-      File OutF(OutputFile);
-      if (auto OpenedFile = OutF.open()) {
-        auto &out = OpenedFile.getOutputStream();
-
-        emitHeadComment(out);
-
-        emitHeader(out);
-
-        emitAfterIncludesComment(out);
-
-        size_t Start = 0;
-        StringRef NewLine("\n");
-        for (const auto &skippedRange : SkippedBytes) {
-
-          bool IgnoreAction = false;
-
-          if (CreateDecl) {
-            switch (skippedRange.Action) {
-              case SourceFragmentAction::SkipInHeaderOnly:
-              case SourceFragmentAction::StartUnit:
-              case SourceFragmentAction::StartUnitFirstDecl:
-              case SourceFragmentAction::EndUnit:
-              case SourceFragmentAction::EndUnitEOF:
-                IgnoreAction = true;
-                break;
-              default:
-                break;
-            }
-          }
-
-          if (IgnoreAction)
-            continue;
-
-          // possible skip cases:
-          //
-          // Case 1:
-          // [keep part] [skip part] [keep part]
-          //
-          // Case 2:
-          // [keep] [skip]
-          // [keep (new line)]
-          //
-          // Case 3:
-          // [keep]
-          // [skip] [keep]
-          //
-          // Case 4:
-          // [keep]
-          // [skip]
-          // [keep]
-
-
-          assert(InSize - Start >= skippedRange.size());
-
-          // Detect new line in the end of [keep] fragment.
-          // If present, strip trailing spaces, but remember indentation.
-          auto *KeepPtr = InStart + Start;
-          size_t KeepWriteCount = skippedRange.Start - Start;
-          size_t KeepWriteCountStripped = KeepWriteCount;
-
-          bool AfterKeepNewLine = false;
-
-          stripTrailingSpaces(KeepPtr, KeepWriteCountStripped);
-
-          size_t AfterKeepSpaces = KeepWriteCount - KeepWriteCountStripped;
-
-          StringRef Keep(KeepPtr, KeepWriteCountStripped);
-
-          // TODO Levitation: create action description class,
-          //   it should include flags we check for particular actions
-          //   subset below, like
-          //   * `StripNewLineBefore`
-          //   * `ReplaceWith` text
-          //   * etc.
-
-          bool StripNewLineBefore = true;
-          switch (skippedRange.Action) {
-            case SourceFragmentAction::StartUnit:
-            case SourceFragmentAction::StartUnitFirstDecl:
-            case SourceFragmentAction::EndUnit:
-            case SourceFragmentAction ::EndUnitEOF:
-              StripNewLineBefore = false;
-              break;
-            default:
-              break;
-          };
-
-          if (StripNewLineBefore && Keep.endswith(NewLine)) {
-            KeepWriteCountStripped -= NewLine.size();
-            AfterKeepNewLine = true;
-          }
-
-          KeepWriteCount = KeepWriteCountStripped;
-
-          out.write(KeepPtr, KeepWriteCount);
-
-          switch (skippedRange.Action) {
-            case SourceFragmentAction::ReplaceWithSemicolon:
-              out << ";";
-              break;
-            case SourceFragmentAction::StartUnit:
-            case SourceFragmentAction::StartUnitFirstDecl:
-              out << "namespace " << UnitID << " {";
-              if (skippedRange.Action == SourceFragmentAction::StartUnitFirstDecl)
-                out << "\n";
-              break;
-            case SourceFragmentAction::EndUnit:
-            case SourceFragmentAction::EndUnitEOF:
-              if (skippedRange.Action == SourceFragmentAction::EndUnitEOF)
-                out << "\n";
-              out << "}";
-              break;
-            default:
-              break;
-          }
-
-          Start = skippedRange.End;
-
-          // If skipped fragment was ended with new line, or \n\s+
-          // preserve new line, but not trailing spaces.
-          auto SkippedFragmentStartPtr = InStart + skippedRange.Start;
-          auto SkippedFragmentSize = skippedRange.End - skippedRange.Start;
-          auto OldSize = SkippedFragmentSize;
-          bool AfterSkipNewLine = false;
-
-          stripTrailingSpaces(SkippedFragmentStartPtr, SkippedFragmentSize);
-
-          StringRef Skip(
-              SkippedFragmentStartPtr, SkippedFragmentSize
-          );
-
-          auto AfterSkipSpaces = OldSize - SkippedFragmentSize;
-
-          if (Skip.endswith(NewLine))
-            AfterSkipNewLine = true;
-
-          // Case 1: [keep] and [skip] on same line:
-          //   emit spaces we found after [skip]
-          if (!AfterKeepNewLine && !AfterSkipNewLine) {
-            out.indent((unsigned) AfterSkipSpaces);
-          } else
-
-          // Case 2: [keep] [skip] \n [some spaces]
-          // Case 4: [keep]\n  [skip]\n
-          // Do the same for both cases:
-          //   emit new line
-          //   emit spaces after skip
-          if (AfterSkipNewLine) {
-            out << "\n";
-            out.indent((unsigned)AfterSkipSpaces);
-          } else
-
-          // Case 3: [keep]\n  [skip (without new line)]
-          //   emit new line
-          //   emit spaces after keep
-          {
-            out << "\n";
-            out.indent((unsigned)AfterKeepSpaces);
-          }
-
-          if (skippedRange.Action == SourceFragmentAction::PutExtern)
-            out << "extern ";
-        }
-
-        auto KeepPtr = InStart + Start;
-        auto KeepWriteCount = InSize - Start;
-
-        stripTrailingSpaces(KeepPtr, KeepWriteCount);
-
-        out.write(KeepPtr, KeepWriteCount);
-      }
+      // Generated files are consumed by external tools, keep
+      // their timestamps if contents are same.
+      File OutF(OutputFile, /*KeepIfUnchanged=*/true);
+      if (auto OpenedFile = OutF.open())
+        emit(OpenedFile.getOutputStream(), InPtr->getBuffer());
 
       if (OutF.hasErrors()) {
         diagOutFileIOIssues(OutF.getStatus());
@@ -283,14 +104,302 @@ public:
     return true;
   }
 
+  /// Generates header and decl files of same source, source is
+  /// read once and fragments are walked once for both outputs.
+  static bool execute(HeaderGenerator &Header, HeaderGenerator &Decl) {
+    assert(
+        &Header.SkippedBytes == &Decl.SkippedBytes &&
+        Header.SourceFile == Decl.SourceFile &&
+        "Header and decl should be generated from same source"
+    );
+
+    Header.dumpAction();
+    Decl.dumpAction();
+
+    if (Header.DryRun)
+      return true;
+
+    auto InPtr = Header.getSourceFileBuffer();
+    if (!InPtr) {
+      Header.diagInFileIOIssues();
+      return false;
+    }
+
+    File HeaderF(Header.OutputFile, /*KeepIfUnchanged=*/true);
+    File DeclF(Decl.OutputFile, /*KeepIfUnchanged=*/true);
+
+    {
+      auto OpenedHeader = HeaderF.open();
+      auto OpenedDecl = DeclF.open();
+      if (OpenedHeader && OpenedDecl)
+        emit(
+            Header, OpenedHeader.getOutputStream(),
+            Decl, OpenedDecl.getOutputStream(),
+            InPtr->getBuffer()
+        );
+    }
+
+    bool Success = true;
+    for (auto *F : { &HeaderF, &DeclF }) {
+      if (F->hasErrors()) {
+        (F == &HeaderF ? Header : Decl).diagOutFileIOIssues(F->getStatus());
+        Success = false;
+      }
+    }
+
+    return Success;
+  }
+
+  /// Writes generated file for given source contents.
+  void emit(llvm::raw_ostream &out, StringRef Source) {
+    EmitState State(out, Source);
+
+    emitPrologue(State.Buffer);
+
+    for (const auto &skippedRange : SkippedBytes)
+      emitFragment(State, Source, skippedRange);
+
+    emitEpilogue(State, Source);
+  }
+
+  /// Writes both generated files in single pass over fragments.
+  static void emit(
+      HeaderGenerator &Header, llvm::raw_ostream &HeaderOut,
+      HeaderGenerator &Decl, llvm::raw_ostream &DeclOut,
+      StringRef Source
+  ) {
+    EmitState HeaderState(HeaderOut, Source);
+    EmitState DeclState(DeclOut, Source);
+
+    Header.emitPrologue(HeaderState.Buffer);
+    Decl.emitPrologue(DeclState.Buffer);
+
+    for (const auto &skippedRange : Header.SkippedBytes) {
+      Header.emitFragment(HeaderState, Source, skippedRange);
+      Decl.emitFragment(DeclState, Source, skippedRange);
+    }
+
+    Header.emitEpilogue(HeaderState, Source);
+    Decl.emitEpilogue(DeclState, Source);
+  }
+
 protected:
 
+  /// Output is mostly a copy of source, so it is collected in
+  /// buffer preallocated for the whole source, and then written
+  /// at once, instead of writing each kept fragment to stream.
+  struct EmitState {
+    SmallString<0> Storage;
+    llvm::raw_svector_ostream Buffer;
+    llvm::raw_ostream &Out;
+    size_t Start = 0;
+
+    EmitState(llvm::raw_ostream &Out, StringRef Source)
+    : Buffer(Storage), Out(Out) {
+      Storage.reserve(Source.size() + 4096);
+    }
+  };
+
+  void emitPrologue(llvm::raw_ostream &out) {
+    emitHeadComment(out);
+
+    emitHeader(out);
+
+    emitAfterIncludesComment(out);
+  }
+
+  void emitFragment(
+      EmitState &State,
+      StringRef Source,
+      const DeclASTMeta::FragmentTy &skippedRange
+  ) {
+    auto &out = State.Buffer;
+    const char *InStart = Source.data();
+    size_t InSize = Source.size();
+    StringRef NewLine("\n");
+
+    bool IgnoreAction = false;
+
+    if (CreateDecl) {
+      switch (skippedRange.Action) {
+        case SourceFragmentAction::SkipInHeaderOnly:
+        case SourceFragmentAction::ReplaceWithSemicolonInHeaderOnly:
+        case SourceFragmentAction::StartUnit:
+        case SourceFragmentAction::StartUnitFirstDecl:
+        case SourceFragmentAction::EndUnit:
+        case SourceFragmentAction::EndUnitEOF:
+          IgnoreAction = true;
+          break;
+        default:
+          break;
+      }
+    }
+
+    if (IgnoreAction)
+      return;
+
+    // possible skip cases:
+    //
+    // Case 1:
+    // [keep part] [skip part] [keep part]
+    //
+    // Case 2:
+    // [keep] [skip]
+    // [keep (new line)]
+    //
+    // Case 3:
+    // [keep]
+    // [skip] [keep]
+    //
+    // Case 4:
+    // [keep]
+    // [skip]
+    // [keep]
+
+
+    assert(InSize - State.Start >= skippedRange.size());
+
+    // Detect new line in the end of [keep] fragment.
+    // If present, strip trailing spaces, but remember indentation.
+    auto *KeepPtr = InStart + State.Start;
+    size_t KeepWriteCount = skippedRange.Start - State.Start;
+    size_t KeepWriteCountStripped = KeepWriteCount;
+
+    bool AfterKeepNewLine = false;
+
+    stripTrailingSpaces(KeepPtr, KeepWriteCountStripped);
+
+    size_t AfterKeepSpaces = KeepWriteCount - KeepWriteCountStripped;
+
+    StringRef Keep(KeepPtr, KeepWriteCountStripped);
+
+    // TODO Levitation: create action description class,
+    //   it should include flags we check for particular actions
+    //   subset below, like
+    //   * `StripNewLineBefore`
+    //   * `ReplaceWith` text
+    //   * etc.
+
+    bool StripNewLineBefore = true;
+    switch (skippedRange.Action) {
+      case SourceFragmentAction::StartUnit:
+      case SourceFragmentAction::StartUnitFirstDecl:
+      case SourceFragmentAction::EndUnit:
+      case SourceFragmentAction ::EndUnitEOF:
+        StripNewLineBefore = false;
+        break;
+      default:
+        break;
+    };
+
+    if (StripNewLineBefore && Keep.endswith(NewLine)) {
+      KeepWriteCountStripped -= NewLine.size();
+      AfterKeepNewLine = true;
+    }
+
+    KeepWriteCount = KeepWriteCountStripped;
+
+    out.write(KeepPtr, KeepWriteCount);
+
+    switch (skippedRange.Action) {
+      case SourceFragmentAction::ReplaceWithSemicolon:
+      case SourceFragmentAction::ReplaceWithSemicolonInHeaderOnly:
+        out << ";";
+        break;
+      case SourceFragmentAction::StartUnit:
+      case SourceFragmentAction::StartUnitFirstDecl:
+        out << "namespace " << UnitID << " {";
+        if (skippedRange.Action == SourceFragmentAction::StartUnitFirstDecl)
+          out << "\n";
+        break;
+      case SourceFragmentAction::EndUnit:
+      case SourceFragmentAction::EndUnitEOF:
+        if (skippedRange.Action == SourceFragmentAction::EndUnitEOF)
+          out << "\n";
+        out << "}";
+        break;
+      default:
+        break;
+    }
+
+    State.Start = skippedRange.End;
+
+    // If skipped fragment was ended with new line, or \n\s+
+    // preserve new line, but not trailing spaces.
+    auto SkippedFragmentStartPtr = InStart + skippedRange.Start;
+    auto SkippedFragmentSize = skippedRange.End - skippedRange.Start;
+    auto OldSize = SkippedFragmentSize;
+    bool AfterSkipNewLine = false;
+
+    stripTrailingSpaces(SkippedFragmentStartPtr, SkippedFragmentSize);
+
+    StringRef Skip(
+        SkippedFragmentStartPtr, SkippedFragmentSize
+    );
+
+    auto AfterSkipSpaces = OldSize - SkippedFragmentSize;
+
+    if (Skip.endswith(NewLine))
+      AfterSkipNewLine = true;
+
+    // Case 1: [keep] and [skip] on same line:
+    //   emit spaces we found after [skip]
+    if (!AfterKeepNewLine && !AfterSkipNewLine) {
+      out.indent((unsigned) AfterSkipSpaces);
+    } else
+
+    // Case 2: [keep] [skip] \n [some spaces]
+    // Case 4: [keep]\n  [skip]\n
+    // Do the same for both cases:
+    //   emit new line
+    //   emit spaces after skip
+    if (AfterSkipNewLine) {
+      out << "\n";
+      out.indent((unsigned)AfterSkipSpaces);
+    } else
+
+    // Case 3: [keep]\n  [skip (without new line)]
+    //   emit new line
+    //   emit spaces after keep
+    {
+      out << "\n";
+      out.indent((unsigned)AfterKeepSpaces);
+    }
+
+    if (skippedRange.Action == SourceFragmentAction::PutExtern)
+      out << "extern ";
+  }
+
+  void emitEpilogue(EmitState &State, StringRef Source) {
+    auto KeepPtr = Source.data() + State.Start;
+    auto KeepWriteCount = Source.size() - State.Start;
+
+    stripTrailingSpaces(KeepPtr, KeepWriteCount);
+
+    State.Buffer.write(KeepPtr, KeepWriteCount);
+
+    State.Out << State.Buffer.str();
+  }
+
+  void dumpAction() {
+    auto dumpLevel = Verbose ? log::Level::Verbose :
+                     DryRun ? log::Level::Info :
+                     log::Level::Null;
+
+    if (dumpLevel != log::Level::Null) {
+      with (auto out = log::Logger::get().acquire(dumpLevel)) {
+        dump(out.s);
+      }
+    }
+  }
+
+
   void diagInFileIOIssues() {
-    Log.log_error("Failed to open file '", SourceFileFullPath);
+    log::Logger::get().log_error("Failed to open file '", SourceFileFullPath);
   }
 
   void diagOutFileIOIssues(File::StatusEnum Status) {
-    with (auto error = Log.acquire(log::Level::Error)) {
+    with (auto error = log::Logger::get().acquire(log::Level::Error)) {
       auto &err = error.s;
       err << "Failed to open file '" << OutputFileFullPath << "': ";
 
@@ -313,13 +422,22 @@ protected:
   }
 
   void emitHeadComment(llvm::raw_ostream &out) {
-    out << "//===--------------------- C++ Levitation generated file --------*- C++ -*-===//\n"
-        << "//\n"
-        << "//                             Don't edit this file.\n"
-        << "//\n"
-        << "//===----------------------------------------------------------------------===//\n\n";
+    out << getHeadComment();
   }
 
+public:
+
+  static StringRef getHeadComment() {
+    return
+        "//===--------------------- C++ Levitation generated file --------*- C++ -*-===//\n"
+        "//\n"
+        "//                             Don't edit this file.\n"
+        "//\n"
+        "//===----------------------------------------------------------------------===//\n\n";
+  }
+
+protected:
+
   void emitAfterIncludesComment(llvm::raw_ostream &out) {
     out << "// C++ Levitation: below follows stripped ."
         << FileExtensions::SourceCode
@@ -0,0 +1,219 @@
+//===--- HotUnits.h - C++ HotUnits class ------------------------*- C++ -*-===//
+//
+// Part of the C++ Levitation Project,
+// under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file contains hot units classification, see --hot-units.
+//  Objects of hot units are compiled with --hot-opt optimization level,
+//  objects of cold ones with --cold-opt level, and warm units keep
+//  level of extra code generation args.
+//
+//  Units are classified either by instrumented profile, or by list:
+//
+//    # Comment.
+//    default cold      (level of unlisted units, "cold" if omitted)
+//    A/B               (hot unit)
+//    cold C/D
+//    warm E
+//
+//  Unit may override its class or level by pragma, on its own line:
+//
+//    #pragma cppl optimize(hot|cold|warm|0|1|2|3|s|z)
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_LEVITATION_HOTUNITS_H
+#define LLVM_LEVITATION_HOTUNITS_H
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <tuple>
+#include <vector>
+
+namespace clang { namespace levitation { namespace tools {
+
+  class HotUnits {
+  public:
+
+    enum struct Temperature {
+      Warm,
+      Hot,
+      Cold
+    };
+
+    /// Sum of profile counts of unit functions.
+    using WeightTy = uint64_t;
+
+    static llvm::StringRef getName(Temperature T) {
+      switch (T) {
+        case Temperature::Hot: return "hot";
+        case Temperature::Cold: return "cold";
+        default: return "warm";
+      }
+    }
+
+    /// \return true if Name is one of "hot", "cold" or "warm".
+    static bool parseName(llvm::StringRef Name, Temperature &T) {
+      if (Name == "hot")
+        T = Temperature::Hot;
+      else if (Name == "cold")
+        T = Temperature::Cold;
+      else if (Name == "warm")
+        T = Temperature::Warm;
+      else
+        return false;
+      return true;
+    }
+
+    /// Parses optimization level, e.g. "3", "O3" or "s".
+    /// \return level without "O", or empty string if level is unknown.
+    static llvm::StringRef parseLevel(llvm::StringRef Level) {
+      Level.consume_front("O");
+      bool Known = llvm::StringSwitch<bool>(Level)
+          .Cases("0", "1", "2", "3", true)
+          .Cases("s", "z", "g", true)
+          .Default(false);
+      return Known ? Level : llvm::StringRef();
+    }
+
+    /// Finds argument of "#pragma cppl optimize(<argument>)".
+    /// \return argument, or empty string if there is no such pragma.
+    static llvm::StringRef scanPragma(llvm::StringRef Source) {
+      while (!Source.empty()) {
+        llvm::StringRef Line;
+        std::tie(Line, Source) = Source.split('\n');
+
+        Line = Line.ltrim();
+        if (!Line.consume_front("#"))
+          continue;
+
+        Line = Line.ltrim();
+        if (!Line.consume_front("pragma"))
+          continue;
+
+        Line = Line.ltrim();
+        if (!Line.consume_front("cppl"))
+          continue;
+
+        Line = Line.ltrim();
+        if (!Line.consume_front("optimize"))
+          continue;
+
+        Line = Line.ltrim();
+        if (!Line.consume_front("("))
+          continue;
+
+        auto Close = Line.find(')');
+        if (Close != llvm::StringRef::npos)
+          return Line.take_front(Close).trim();
+      }
+      return llvm::StringRef();
+    }
+
+    /// Units which run HotPercent of all counts together, hottest
+    /// first, are hot, units which never run are cold, rest are warm.
+    static void classify(
+        const llvm::StringMap<WeightTy> &Weights,
+        unsigned HotPercent,
+        llvm::StringMap<Temperature> &Res
+    ) {
+      std::vector<std::pair<WeightTy, llvm::StringRef>> Sorted;
+      WeightTy Total = 0;
+      for (const auto &W : Weights) {
+        Sorted.emplace_back(W.second, W.first());
+        Total += W.second;
+      }
+
+      std::sort(Sorted.begin(), Sorted.end(), [] (
+          const std::pair<WeightTy, llvm::StringRef> &L,
+          const std::pair<WeightTy, llvm::StringRef> &R
+      ) {
+        return L.first != R.first ? L.first > R.first : L.second < R.second;
+      });
+
+      // Counts may be huge, so percents are taken of total.
+      WeightTy HotTotal = Total / 100 * HotPercent +
+                          Total % 100 * HotPercent / 100;
+      WeightTy Sum = 0;
+
+      for (const auto &W : Sorted) {
+        if (!W.first)
+          Res[W.second] = Temperature::Cold;
+        else if (Sum < HotTotal)
+          Res[W.second] = Temperature::Hot;
+        else
+          Res[W.second] = Temperature::Warm;
+        Sum += W.first;
+      }
+    }
+
+    /// Parses units list, see file header.
+    /// \param Res [out] classes of listed units.
+    /// \param Default [out] class of unlisted units.
+    /// \return false if list is malformed.
+    static bool parse(
+        llvm::StringRef Contents,
+        llvm::StringMap<Temperature> &Res,
+        Temperature &Default
+    ) {
+      Default = Temperature::Cold;
+
+      while (!Contents.empty()) {
+        llvm::StringRef Line;
+        std::tie(Line, Contents) = Contents.split('\n');
+
+        Line = Line.trim();
+        if (Line.empty() || Line.startswith("#"))
+          continue;
+
+        llvm::StringRef First, Second;
+        std::tie(First, Second) = Line.split(' ');
+        Second = Second.trim();
+
+        if (Second.empty()) {
+          Res[First] = Temperature::Hot;
+          continue;
+        }
+
+        Temperature T;
+        if (First == "default") {
+          if (!parseName(Second, Default))
+            return false;
+          continue;
+        }
+
+        if (!parseName(First, T))
+          return false;
+
+        Res[Second] = T;
+      }
+
+      return true;
+    }
+
+    static void write(
+        llvm::raw_ostream &Out,
+        const llvm::StringMap<Temperature> &Units,
+        Temperature Default
+    ) {
+      std::vector<llvm::StringRef> Sorted;
+      for (const auto &U : Units)
+        Sorted.push_back(U.first());
+      std::sort(Sorted.begin(), Sorted.end());
+
+      Out << "default " << getName(Default) << "\n";
+      for (auto U : Sorted)
+        Out << getName(Units.lookup(U)) << " " << U << "\n";
+    }
+  };
+}}}
+
+#endif //LLVM_LEVITATION_HOTUNITS_H
@@ -0,0 +1,79 @@
+//===--- InProcessCompiler.h - C++ InProcessCompiler class ------*- C++ -*-===//
+//
+// Part of the C++ Levitation Project,
+// under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file contains in-process compiler. It runs clang++ command lines
+//  within driver process, so that we don't pay for process startup
+//  for each compiled unit.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_LEVITATION_INPROCESSCOMPILER_H
+#define LLVM_LEVITATION_INPROCESSCOMPILER_H
+
+#include "clang/Levitation/Common/Failable.h"
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
+
+#include <memory>
+#include <string>
+
+namespace clang { namespace levitation { namespace tools {
+
+  class InProcessCompiler {
+  public:
+    /// Runs clang++ command line in current process.
+    /// Command line is passed through clang driver, and then
+    /// each frontend job is executed in-process with its own
+    /// CompilerInstance and diagnostics, while the rest jobs
+    /// (e.g. external assembler) are executed as subprocesses.
+    /// Command lines starting with "<clang> -cc1" are executed by
+    /// frontend directly.
+    /// Method is thread-safe and may be called from worker threads.
+    /// \param Args command line, first item is clang++ executable path.
+    /// \param Diagnostics if set, compiler messages are appended to it,
+    /// rather than printed.
+    /// \return execution status.
+    static Failable run(
+        llvm::ArrayRef<llvm::StringRef> Args,
+        std::string *Diagnostics = nullptr
+    );
+
+    /// Keeps preamble PCH loaded between frontend jobs of current
+    /// process, and provides it to AST readers of jobs instead of
+    /// opening and mapping it again. Preamble is reloaded once its
+    /// size or modification time is changed, so it survives rebuilds
+    /// of --watch mode, unless preamble itself is rebuilt.
+    static void setWarmPreamble(bool Enabled);
+
+    /// While batch is alive, frontend jobs run on current thread
+    /// share file manager and in-memory cache of AST files. So
+    /// dependencies common for jobs of batch are opened and read once.
+    /// Jobs still have their own CompilerInstance and AST context.
+    class Batch {
+    public:
+      struct State;
+
+    private:
+      std::unique_ptr<State> S;
+      State *Prev;
+
+    public:
+      Batch();
+      ~Batch();
+
+      Batch(const Batch &) = delete;
+      Batch &operator=(const Batch &) = delete;
+
+      static State *getCurrent();
+    };
+  };
+}}}
+
+#endif //LLVM_LEVITATION_INPROCESSCOMPILER_H
@@ -0,0 +1,133 @@
+//===--- JUnitReport.h - C++ JUnitReport class ------------------*- C++ -*-===//
+//
+// Part of the C++ Levitation Project,
+// under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file contains JUnit XML writer for results of linked targets
+//  run as tests, see --test and --junit.
+//
+//  Each target is a test case of single test suite, targets which exit
+//  with non-zero code are failures, output of target goes to its
+//  <system-out>.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_LEVITATION_JUNITREPORT_H
+#define LLVM_LEVITATION_JUNITREPORT_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <cstdint>
+#include <string>
+
+namespace clang { namespace levitation { namespace tools {
+
+  class JUnitReport {
+  public:
+
+    struct TestCase {
+      std::string Name;
+
+      /// Exit code of test, -1 if it couldn't be run,
+      /// -2 if it has crashed.
+      int ExitCode = 0;
+
+      /// Test duration, microseconds.
+      uint64_t Duration = 0;
+
+      /// Combined stdout and stderr of test.
+      std::string Output;
+
+      bool failed() const { return ExitCode != 0; }
+    };
+
+    /// Escapes XML special characters. Control characters XML 1.0
+    /// doesn't allow are dropped, since tests may print anything.
+    static void writeEscaped(llvm::raw_ostream &Out, llvm::StringRef Text) {
+      for (char C : Text) {
+        switch (C) {
+          case '&': Out << "&amp;"; break;
+          case '<': Out << "&lt;"; break;
+          case '>': Out << "&gt;"; break;
+          case '"': Out << "&quot;"; break;
+          case '\'': Out << "&apos;"; break;
+          default:
+            if ((unsigned char)C < 0x20 && C != '\t' && C != '\n' && C != '\r')
+              break;
+            Out << C;
+        }
+      }
+    }
+
+    static void write(
+        llvm::raw_ostream &Out,
+        llvm::StringRef SuiteName,
+        llvm::ArrayRef<TestCase> Cases
+    ) {
+      unsigned NumFailures = 0;
+      uint64_t Total = 0;
+      for (const auto &C : Cases) {
+        NumFailures += C.failed();
+        Total += C.Duration;
+      }
+
+      auto writeTime = [&] (uint64_t Duration) {
+        Out << llvm::format("%.3f", Duration / 1e6);
+      };
+
+      Out << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n";
+      Out << "<testsuites tests=\"" << Cases.size()
+          << "\" failures=\"" << NumFailures << "\" time=\"";
+      writeTime(Total);
+      Out << "\">\n";
+
+      Out << "  <testsuite name=\"";
+      writeEscaped(Out, SuiteName);
+      Out << "\" tests=\"" << Cases.size()
+          << "\" failures=\"" << NumFailures << "\" time=\"";
+      writeTime(Total);
+      Out << "\">\n";
+
+      for (const auto &C : Cases) {
+        Out << "    <testcase name=\"";
+        writeEscaped(Out, C.Name);
+        Out << "\" classname=\"";
+        writeEscaped(Out, SuiteName);
+        Out << "\" time=\"";
+        writeTime(C.Duration);
+        Out << "\">\n";
+
+        if (C.failed()) {
+          Out << "      <failure message=\"";
+          if (C.ExitCode == -2)
+            Out << "crashed";
+          else if (C.ExitCode == -1)
+            Out << "could not be run";
+          else
+            Out << "exit code " << C.ExitCode;
+          Out << "\"/>\n";
+        }
+
+        if (C.Output.size()) {
+          Out << "      <system-out>";
+          writeEscaped(Out, C.Output);
+          Out << "</system-out>\n";
+        }
+
+        Out << "    </testcase>\n";
+      }
+
+      Out << "  </testsuite>\n";
+      Out << "</testsuites>\n";
+    }
+  };
+}}}
+
+#endif //LLVM_LEVITATION_JUNITREPORT_H
@@ -0,0 +1,108 @@
+//===--- Jobserver.h - C++ Levitation Jobserver class -----------*- C++ -*-===//
+//
+// Part of the C++ Levitation Project,
+// under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file contains GNU make jobserver client and server.
+//
+//  Jobserver is a pipe (or named fifo) with one byte per job slot.
+//  Process acquires slot by reading a byte, and releases it by writing
+//  same byte back. Each process owns one implicit slot, which is
+//  not in the pipe, so it always can run one job.
+//
+//  Client connects to jobserver described by MAKEFLAGS:
+//    --jobserver-auth=<R>,<W>     (make 4.x, inherited descriptors)
+//    --jobserver-fds=<R>,<W>      (make 3.x)
+//    --jobserver-auth=fifo:<path> (make 4.4)
+//  Server creates its own pipe and exports it through MAKEFLAGS,
+//  so that nested tools which support the protocol share its slots.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_LEVITATION_JOBSERVER_H
+#define LLVM_LEVITATION_JOBSERVER_H
+
+#include "clang/Levitation/Common/CreatableSingleton.h"
+#include "clang/Levitation/Common/Failable.h"
+
+#include "llvm/ADT/StringRef.h"
+
+#include <mutex>
+
+namespace clang { namespace levitation { namespace tools {
+
+  class Jobserver : public CreatableSingleton<Jobserver> {
+
+    int ReadFD = -1;
+    int WriteFD = -1;
+
+    /// Whether descriptors were opened by us and should be closed.
+    bool OwnsFDs = false;
+
+    std::mutex Locker;
+    bool ImplicitSlotFree = true;
+
+    bool takeImplicitSlot();
+    void releaseSlot(bool Implicit, char Value);
+
+  protected:
+
+    Jobserver() = default;
+
+    friend CreatableSingleton<Jobserver>;
+
+  public:
+
+    /// Acquired job slot, released on destruction.
+    class Slot {
+      Jobserver *Owner;
+      bool Implicit;
+      char Value;
+
+    public:
+      Slot(Jobserver *owner, bool implicit, char value)
+      : Owner(owner), Implicit(implicit), Value(value) {}
+
+      Slot(Slot &&Src)
+      : Owner(Src.Owner), Implicit(Src.Implicit), Value(Src.Value) {
+        Src.Owner = nullptr;
+      }
+
+      Slot(const Slot&) = delete;
+      Slot &operator=(const Slot&) = delete;
+
+      ~Slot() {
+        if (Owner)
+          Owner->releaseSlot(Implicit, Value);
+      }
+    };
+
+    ~Jobserver();
+
+    /// Whether jobserver is supported on this host.
+    static bool isSupported();
+
+    /// Connects to jobserver described by MAKEFLAGS environment variable.
+    /// \param Found set to whether MAKEFLAGS describes jobserver.
+    /// \return failure if jobserver is described, but not accessible.
+    Failable connect(bool &Found);
+
+    /// Creates jobserver with given number of slots, including
+    /// implicit one, and exports it to child processes through MAKEFLAGS.
+    Failable serve(unsigned Jobs);
+
+    bool isEnabled() const {
+      return ReadFD >= 0;
+    }
+
+    /// Blocks until job slot is available. If jobserver is not enabled,
+    /// returns immediately.
+    Slot acquire();
+  };
+}}}
+
+#endif //LLVM_LEVITATION_JOBSERVER_H
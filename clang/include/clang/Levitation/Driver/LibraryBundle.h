@@ -0,0 +1,95 @@
+//===--- LibraryBundle.h - C++ LibraryBundle class --------------*- C++ -*-===//
+//
+// Part of the C++ Levitation Project,
+// under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file defines prebuilt library bundle. Bundle keeps artifacts
+//  of every library unit in single file, so that library may be
+//  distributed and used without its sources tree, and without
+//  rebuilding its declarations in each project which uses it.
+//
+//  File layout, all numbers are little endian:
+//    header: magic, 32 bit version, 32 bit number of units,
+//            32 bit reserved
+//    units:  for each unit: 32 bit mask of present artifacts,
+//            32 bit reserved, then 64 bit offset and size of
+//            unit ID and of each artifact.
+//    data:   unit IDs and artifacts contents, each padded to 8 bytes.
+//
+//  Bundle is mapped into memory as is, so contents of units refer
+//  to mapped file.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_LEVITATION_LIBRARYBUNDLE_H
+#define LLVM_LEVITATION_LIBRARYBUNDLE_H
+
+#include "clang/Levitation/Common/Failable.h"
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
+
+#include <memory>
+#include <vector>
+
+namespace llvm {
+  class MemoryBuffer;
+  class raw_ostream;
+}
+
+namespace clang { namespace levitation { namespace tools {
+
+  class LibraryBundle {
+  public:
+
+    enum ArtifactKind : unsigned {
+      Source,
+      DeclAST,
+      DeclASTMeta,
+      LDeps,
+      LDepsMeta,
+      NumArtifactKinds
+    };
+
+    struct Unit {
+      llvm::StringRef UnitID;
+
+      /// Contents of artifacts, only actual if artifact is present.
+      llvm::StringRef Artifacts[NumArtifactKinds];
+      bool Present[NumArtifactKinds] = {};
+
+      void set(ArtifactKind Kind, llvm::StringRef Contents) {
+        Artifacts[Kind] = Contents;
+        Present[Kind] = true;
+      }
+    };
+
+  private:
+
+    std::unique_ptr<llvm::MemoryBuffer> Buffer;
+    std::vector<Unit> Units;
+
+  public:
+
+    LibraryBundle();
+    LibraryBundle(LibraryBundle &&);
+    LibraryBundle &operator=(LibraryBundle &&);
+    ~LibraryBundle();
+
+    /// Maps bundle into memory and reads its index.
+    Failable open(llvm::StringRef BundleFile);
+    Failable read(std::unique_ptr<llvm::MemoryBuffer> Buffer);
+
+    llvm::ArrayRef<Unit> units() const { return Units; }
+
+    /// Writes bundle into temporary file, and then renames it to BundleFile.
+    static Failable save(llvm::StringRef BundleFile, llvm::ArrayRef<Unit> Units);
+    static void write(llvm::raw_ostream &OS, llvm::ArrayRef<Unit> Units);
+  };
+}}}
+
+#endif //LLVM_LEVITATION_LIBRARYBUNDLE_H
@@ -0,0 +1,87 @@
+//===--- LibraryCache.h - C++ LibraryCache class ----------------*- C++ -*-===//
+//
+// Part of the C++ Levitation Project,
+// under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file contains machine-wide cache of Levitation libraries artifacts
+//  (.ldeps, .decl-ast and their metas). Projects which use same library
+//  version share its artifacts, instead of building them under their
+//  own build roots.
+//
+//  Entries are keyed by library contents hash and compiler fingerprint.
+//  Cache may be used by several driver invocations at once, entry is
+//  filled under lock file, so that other invocations wait for it rather
+//  than build same artifacts themselves.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_LEVITATION_LIBRARYCACHE_H
+#define LLVM_LEVITATION_LIBRARYCACHE_H
+
+#include "clang/Levitation/Common/CreatableSingleton.h"
+#include "clang/Levitation/Common/Path.h"
+#include "clang/Levitation/Driver/BuildCache.h"
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/StringRef.h"
+
+#include <atomic>
+#include <string>
+
+namespace clang { namespace levitation { namespace tools {
+
+  class LibraryCache : public CreatableSingleton<LibraryCache> {
+
+    SinglePath Directory;
+    LocalDirectoryCacheBackend Backend;
+
+    std::atomic<unsigned> Hits;
+    std::atomic<unsigned> Misses;
+
+    bool fetch(llvm::StringRef Key, llvm::ArrayRef<BuildCache::Artifact> Artifacts);
+    bool store(llvm::StringRef Key, llvm::ArrayRef<BuildCache::Artifact> Artifacts);
+
+  protected:
+
+    LibraryCache(llvm::StringRef directory)
+    : Directory(directory), Backend(directory), Hits(0), Misses(0) {}
+
+    friend CreatableSingleton<LibraryCache>;
+
+  public:
+
+    bool isEnabled() const { return !Directory.empty(); }
+
+    /// Fetches artifacts for given key, or produces them with Fn
+    /// and puts into cache. If other invocation is filling same entry,
+    /// waits for it.
+    /// \return true if artifacts were fetched or produced.
+    bool fetchOrFill(
+        llvm::StringRef Key,
+        llvm::ArrayRef<BuildCache::Artifact> Artifacts,
+        llvm::function_ref<bool()> Fn
+    );
+
+    /// Hash of library sources: both their paths relative to
+    /// library root, and their contents.
+    /// \return empty string if some of sources can't be read.
+    static std::string getLibraryHash(
+        llvm::StringRef LibraryRoot,
+        const Paths &Sources
+    );
+
+    /// Version of compiler and stamp of its binary, so that entries
+    /// built by other compiler build are never reused.
+    static std::string getCompilerFingerprint(llvm::StringRef CompilerPath);
+
+    unsigned getHits() const { return Hits; }
+    unsigned getMisses() const { return Misses; }
+  };
+}}}
+
+#endif //LLVM_LEVITATION_LIBRARYCACHE_H
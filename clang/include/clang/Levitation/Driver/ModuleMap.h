@@ -0,0 +1,134 @@
+//===--- ModuleMap.h - C++ ModuleMap class ----------------------*- C++ -*-===//
+//
+// Part of the C++ Levitation Project,
+// under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file contains clang module map writer for generated headers of
+//  public units, see --module-map. Modules mirror unit paths, each unit
+//  is a submodule of its package:
+//
+//    module net {
+//      module http {
+//        header "net/http.h"
+//        export *
+//        module server {
+//          header "net/http/server.h"
+//          export *
+//        }
+//      }
+//    }
+//
+//  Generated headers include headers of units they depend on, so module
+//  dependencies follow unit dependencies, and "export *" re-exports
+//  them, same way unit declarations do.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_LEVITATION_MODULEMAP_H
+#define LLVM_LEVITATION_MODULEMAP_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <map>
+#include <memory>
+#include <string>
+
+namespace clang { namespace levitation { namespace tools {
+
+  class ModuleMap {
+    struct Module {
+      std::string Header;
+
+      // Sorted, so that same units give same module map.
+      std::map<std::string, std::unique_ptr<Module>> Submodules;
+    };
+
+    Module Root;
+
+    void writeModule(
+        llvm::raw_ostream &Out,
+        llvm::StringRef Name,
+        const Module &M,
+        unsigned Indent
+    ) const {
+      Out.indent(Indent) << "module " << Name << " {\n";
+
+      if (M.Header.size()) {
+        Out.indent(Indent + 2) << "header \"";
+        Out.write_escaped(M.Header);
+        Out << "\"\n";
+        Out.indent(Indent + 2) << "export *\n";
+      }
+
+      for (const auto &S : M.Submodules)
+        writeModule(Out, S.first, *S.second, Indent + 2);
+
+      Out.indent(Indent) << "}\n";
+    }
+
+  public:
+
+    /// \return module name for unit path component. Characters which
+    /// are not allowed in identifiers are replaced by '_', and module
+    /// map keywords get '_' suffix.
+    static std::string getModuleName(llvm::StringRef Component) {
+      std::string Name;
+      for (char C : Component) {
+        bool Allowed =
+            (C >= 'a' && C <= 'z') || (C >= 'A' && C <= 'Z') ||
+            (C >= '0' && C <= '9') || C == '_';
+        Name.push_back(Allowed ? C : '_');
+      }
+
+      if (Name.empty() || (Name.front() >= '0' && Name.front() <= '9'))
+        Name.insert(Name.begin(), '_');
+
+      bool IsKeyword = llvm::StringSwitch<bool>(Name)
+          .Cases("config_macros", "conflict", "exclude", "explicit", true)
+          .Cases("extern", "export", "export_as", "framework", true)
+          .Cases("header", "link", "module", "private", true)
+          .Cases("requires", "textual", "umbrella", "use", true)
+          .Default(false);
+      if (IsKeyword)
+        Name.push_back('_');
+
+      return Name;
+    }
+
+    /// Adds unit module.
+    /// \param Components unit path components, e.g. {"net", "http"}.
+    /// \param Header unit header, relative to module map directory.
+    void add(
+        llvm::ArrayRef<llvm::StringRef> Components,
+        llvm::StringRef Header
+    ) {
+      Module *M = &Root;
+      for (auto C : Components) {
+        auto &Sub = M->Submodules[getModuleName(C)];
+        if (!Sub)
+          Sub = std::make_unique<Module>();
+        M = Sub.get();
+      }
+      M->Header = Header.str();
+    }
+
+    bool empty() const { return Root.Submodules.empty(); }
+
+    void write(llvm::raw_ostream &Out) const {
+      Out << "// Generated by C++ Levitation, do not edit.\n";
+      for (const auto &S : Root.Submodules) {
+        Out << "\n";
+        writeModule(Out, S.first, *S.second, 0);
+      }
+    }
+  };
+}}}
+
+#endif //LLVM_LEVITATION_MODULEMAP_H
@@ -0,0 +1,230 @@
+//===--- NinjaPlan.h - C++ NinjaPlan class ----------------------*- C++ -*-===//
+//
+// Part of the C++ Levitation Project,
+// under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file contains build plan recorder. When recording is started,
+//  driver commands are not executed, but collected along with files
+//  they read and write, and then written as ninja build file,
+//  one rule per command category and one edge per command.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_LEVITATION_NINJAPLAN_H
+#define LLVM_LEVITATION_NINJAPLAN_H
+
+#include "clang/Levitation/Common/CreatableSingleton.h"
+#include "clang/Levitation/Common/File.h"
+#include "clang/Levitation/Common/Path.h"
+#include "clang/Levitation/Common/Thread.h"
+#include "clang/Levitation/Common/WithOperator.h"
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace clang { namespace levitation { namespace tools {
+
+  class NinjaPlan : public CreatableSingleton<NinjaPlan> {
+  public:
+
+    struct Edge {
+      std::string Rule;
+      std::vector<std::string> Args;
+      std::vector<std::string> Inputs;
+      std::vector<std::string> Outputs;
+
+      /// File ninja passes arguments through, empty if command
+      /// is short enough to be passed directly.
+      std::string ResponseFile;
+    };
+
+  private:
+
+    SinglePath OutputFile;
+    std::atomic<bool> Recording { false };
+
+    std::mutex EdgesLocker;
+    std::vector<Edge> Edges;
+
+    static std::vector<std::string> toStrings(
+        llvm::ArrayRef<llvm::StringRef> Items
+    ) {
+      return std::vector<std::string>(Items.begin(), Items.end());
+    }
+
+  protected:
+
+    NinjaPlan(llvm::StringRef outputFile) : OutputFile(outputFile) {}
+
+    friend CreatableSingleton<NinjaPlan>;
+
+  public:
+
+    bool isEnabled() const { return !OutputFile.empty(); }
+
+    /// Once recording is started, commands are added to the plan
+    /// instead of being executed.
+    void startRecording() { Recording = true; }
+    bool isRecording() const { return Recording; }
+
+    void add(
+        llvm::StringRef Rule,
+        llvm::ArrayRef<llvm::StringRef> Args,
+        llvm::ArrayRef<llvm::StringRef> Inputs,
+        llvm::ArrayRef<llvm::StringRef> Outputs,
+        llvm::StringRef ResponseFile
+    ) {
+      Edge E {
+        Rule.str(),
+        toStrings(Args), toStrings(Inputs), toStrings(Outputs),
+        ResponseFile.str()
+      };
+
+      auto _ = lock(EdgesLocker);
+      Edges.emplace_back(std::move(E));
+    }
+
+    /// Writes recorded edges into output file. File is kept untouched
+    /// if plan is same, so that ninja doesn't reload it.
+    /// \return true if successful.
+    bool write() {
+      if (!isEnabled())
+        return true;
+
+      File F(OutputFile, /*KeepIfUnchanged=*/true);
+      with (auto Scope = F.open()) {
+        auto _ = lock(EdgesLocker);
+        write(Scope.getOutputStream(), Edges);
+      }
+
+      return !F.hasErrors();
+    }
+
+    /// Writes edges in order of their first outputs, so that same plan
+    /// always gives same file, whatever order commands were recorded in.
+    /// Edges without outputs can't be expressed in ninja and are skipped.
+    static void write(llvm::raw_ostream &Out, llvm::ArrayRef<Edge> Edges) {
+      std::vector<const Edge*> Sorted;
+      std::set<std::string> Rules;
+      for (const auto &E : Edges) {
+        if (E.Outputs.empty())
+          continue;
+        Sorted.push_back(&E);
+        Rules.insert(E.Rule);
+      }
+
+      auto byFirstOutput = [] (const Edge *L, const Edge *R) {
+        return L->Outputs.front() < R->Outputs.front();
+      };
+      std::sort(Sorted.begin(), Sorted.end(), byFirstOutput);
+
+      Out << "# Build plan generated by levitation-cppl.\n"
+          << "# Regenerate it once sources or dependencies are changed.\n";
+
+      // Commands keep outputs untouched when contents are same,
+      // so restat lets ninja skip their dependents.
+      for (const auto &R : Rules) {
+        Out << "\n"
+            << "rule " << R << "\n"
+            << "  command = $cmd\n"
+            << "  description = " << R << " $out\n"
+            << "  restat = 1\n";
+      }
+
+      for (const auto *E : Sorted) {
+        Out << "\nbuild";
+        for (const auto &O : E->Outputs)
+          Out << " " << escapePath(O);
+        Out << ": " << E->Rule;
+        for (const auto &I : E->Inputs)
+          Out << " " << escapePath(I);
+        Out << "\n";
+
+        if (E->ResponseFile.empty()) {
+          Out << "  cmd = " << escapeValue(joinArgs(E->Args, 0)) << "\n";
+          continue;
+        }
+
+        Out << "  rspfile = " << escapePath(E->ResponseFile) << "\n"
+            << "  rspfile_content = "
+            << escapeValue(joinArgs(E->Args, 1)) << "\n"
+            << "  cmd = "
+            << escapeValue(
+                quoteArg(E->Args.front()) + " " +
+                quoteArg("@" + E->ResponseFile)
+            )
+            << "\n";
+      }
+    }
+
+    /// Quotes argument for shell, arguments made of safe characters
+    /// only are kept as is.
+    static std::string quoteArg(llvm::StringRef Arg) {
+      auto isSafe = [] (char C) {
+        return llvm::isAlnum(C) || llvm::StringRef("_-+=/.,:@%").count(C);
+      };
+
+      bool Safe = !Arg.empty() && std::all_of(Arg.begin(), Arg.end(), isSafe);
+
+      if (Safe)
+        return Arg.str();
+
+      std::string Res = "'";
+      for (char C : Arg) {
+        if (C == '\'')
+          Res += "'\\''";
+        else
+          Res += C;
+      }
+      Res += "'";
+      return Res;
+    }
+
+    static std::string escapePath(llvm::StringRef Path) {
+      std::string Res;
+      for (char C : Path) {
+        if (C == '$' || C == ' ' || C == ':')
+          Res += '$';
+        Res += C;
+      }
+      return Res;
+    }
+
+    static std::string escapeValue(llvm::StringRef Value) {
+      std::string Res;
+      for (char C : Value) {
+        if (C == '$')
+          Res += '$';
+        Res += C;
+      }
+      return Res;
+    }
+
+  private:
+
+    static std::string joinArgs(llvm::ArrayRef<std::string> Args, size_t From) {
+      std::string Res;
+      for (size_t i = From, e = Args.size(); i != e; ++i) {
+        if (i != From)
+          Res += " ";
+        Res += quoteArg(Args[i]);
+      }
+      return Res;
+    }
+  };
+}}}
+
+#endif //LLVM_LEVITATION_NINJAPLAN_H
@@ -16,6 +16,9 @@
 #define LLVM_LEVITATION_PACKAGEFILES_H
 
 #include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Allocator.h"
+#include "llvm/Support/StringSaver.h"
 #include "clang/Levitation/Common/Path.h"
 #include "clang/Levitation/Common/SimpleLogger.h"
 #include "clang/Levitation/Common/StringsPool.h"
@@ -23,20 +26,30 @@
 
 namespace clang { namespace levitation { namespace tools {
 
+  /// Paths are kept in arena of FilesMapTy info belongs to,
+  /// see FilesMapTy::intern.
   struct FilesInfo {
 
-    SinglePath Source;
-    SinglePath Header;
-    SinglePath Decl;
-    SinglePath LDeps;
-    SinglePath LDepsMeta;
-    SinglePath DeclASTMetaFile;
-    SinglePath ObjMetaFile;
+    llvm::StringRef Source;
+    llvm::StringRef Header;
+    llvm::StringRef Decl;
+    llvm::StringRef LDeps;
+    llvm::StringRef LDepsMeta;
+    llvm::StringRef DeclASTMetaFile;
+    llvm::StringRef ObjMetaFile;
 
-    SinglePath DeclAST;
-    SinglePath Object;
+    llvm::StringRef DeclAST;
+    llvm::StringRef Object;
+
+    /// Unoptimized bitcode, only built in keep IR mode.
+    llvm::StringRef IR;
+
+    /// Split DWARF of object, only built with --split-dwarf.
+    llvm::StringRef SplitDwarf;
 
     void dump(log::Logger &Log, log::Level Level, unsigned indent = 0) {
+      if (!Log.isEnabled(Level))
+        return;
 
       std::string StrIndent(indent, ' ');
 
@@ -48,34 +61,57 @@ namespace clang { namespace levitation { namespace tools {
       Log.log(Level, StrIndent, "ObjMetaFile: ", ObjMetaFile);
       Log.log(Level, StrIndent, "DeclAST: ", DeclAST);
       Log.log(Level, StrIndent, "Object: ", Object);
+      Log.log(Level, StrIndent, "IR: ", IR);
+      Log.log(Level, StrIndent, "SplitDwarf: ", SplitDwarf);
 
     }
   };
 
+  /// Files infos and their paths are allocated in arena, since there
+  /// is one info per unit, and they live as long as the map does.
+  /// Neither create, nor intern are thread-safe, paths should be set
+  /// before workers start to read them.
   class FilesMapTy {
   public:
-    using UniquePtrMap = llvm::DenseMap<StringID, std::unique_ptr<FilesInfo>>;
+    using MapTy = llvm::DenseMap<StringID, FilesInfo*>;
   private:
-    UniquePtrMap FilesMap;
+    /// Arena is kept by pointer, so that paths stay valid
+    /// when map is moved.
+    std::unique_ptr<llvm::BumpPtrAllocator> Arena;
+    MapTy FilesMap;
+
+    llvm::BumpPtrAllocator &getArena() {
+      if (!Arena)
+        Arena = std::make_unique<llvm::BumpPtrAllocator>();
+      return *Arena;
+    }
+
   public:
 
     FilesInfo& create(StringID PackageID) {
-      auto Res = FilesMap.insert({ PackageID, std::make_unique<FilesInfo>() });
+      auto *Info = new (getArena().Allocate<FilesInfo>()) FilesInfo();
+      auto Res = FilesMap.insert({ PackageID, Info });
       assert(Res.second);
+      (void)Res;
+
+      return *Info;
+    }
 
-      return *Res.first->second;
+    /// Copies path into arena.
+    /// \return null-terminated copy, which lives as long as map does.
+    llvm::StringRef intern(llvm::StringRef Path) {
+      return llvm::StringSaver(getArena()).save(Path);
     }
 
-    UniquePtrMap::size_type count(StringID PackageID) const {
+    MapTy::size_type count(StringID PackageID) const {
       return FilesMap.count(PackageID);
     }
 
     const FilesInfo* tryGet(StringID PackageID) const {
-      static std::unique_ptr<FilesInfo> Empty;
       auto Found = FilesMap.find(PackageID);
 
       if (Found != FilesMap.end())
-        return Found->second.get();
+        return Found->second;
       return nullptr;
     }
 
@@ -86,9 +122,33 @@ namespace clang { namespace levitation { namespace tools {
       llvm_unreachable("FileInfo not found.");
     }
 
-    const UniquePtrMap& getUniquePtrMap() const {
+    const MapTy& getMap() const {
       return FilesMap;
     }
+
+    /// Removes files info of given package from map.
+    /// \return removed info, its paths live as long as map does.
+    FilesInfo take(StringID PackageID) {
+      auto Found = FilesMap.find(PackageID);
+      assert(Found != FilesMap.end());
+
+      FilesInfo Res = *Found->second;
+      FilesMap.erase(Found);
+      return Res;
+    }
+
+    /// Adds files info taken from other map, paths are copied
+    /// into arena of this map.
+    void insert(StringID PackageID, const FilesInfo &Info) {
+      auto &Files = create(PackageID);
+      for (auto Field : {
+        &FilesInfo::Source, &FilesInfo::Header, &FilesInfo::Decl,
+        &FilesInfo::LDeps, &FilesInfo::LDepsMeta, &FilesInfo::DeclASTMetaFile,
+        &FilesInfo::ObjMetaFile, &FilesInfo::DeclAST, &FilesInfo::Object,
+        &FilesInfo::IR
+      })
+        Files.*Field = intern(Info.*Field);
+    }
   };
 }}}
 
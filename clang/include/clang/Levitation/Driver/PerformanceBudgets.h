@@ -0,0 +1,268 @@
+//===--- PerformanceBudgets.h - C++ PerformanceBudgets class ----*- C++ -*-===//
+//
+// Part of the C++ Levitation Project,
+// under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file contains performance budgets, see --budgets. After each build
+//  driver checks metrics of units against budgets, and reports units which
+//  exceed them.
+//
+//  Budgets file lists unit or package, followed by limits:
+//
+//    # Comment.
+//    net::http::server  compile-time=20s peak-rss=1G
+//    net::*             decl-ast=4M closure=400 fan-in=50
+//    *                  compile-time=1m
+//
+//  "<package>::*" matches all units of package, "*" matches all units.
+//  Unit is checked against every matching line. Metrics are:
+//
+//    compile-time  declaration AST and object build time (us, ms, s, m)
+//    peak-rss      peak memory of unit jobs (K, M, G)
+//    decl-ast      size of unit declaration AST (K, M, G)
+//    closure       number of declarations unit needs, directly or not
+//    fan-in        number of units which import unit directly
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_LEVITATION_PERFORMANCEBUDGETS_H
+#define LLVM_LEVITATION_PERFORMANCEBUDGETS_H
+
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace clang { namespace levitation { namespace tools {
+
+  class PerformanceBudgets {
+  public:
+
+    enum struct Metric {
+      CompileTime = 0,
+      PeakRSS,
+      DeclASTSize,
+      Closure,
+      FanIn,
+      NumMetrics
+    };
+
+    static constexpr unsigned NumMetrics = (unsigned)Metric::NumMetrics;
+
+    /// Microseconds for time, bytes for sizes.
+    using ValueTy = uint64_t;
+
+    /// Metrics of unit, unknown ones are None.
+    using MetricsTy = std::array<llvm::Optional<ValueTy>, NumMetrics>;
+
+    struct Budget {
+      std::string Pattern;
+      MetricsTy Limits;
+    };
+
+    struct Violation {
+      std::string UnitID;
+      Metric M;
+      ValueTy Value;
+      ValueTy Limit;
+
+      /// Budget line unit has matched.
+      std::string Pattern;
+    };
+
+  private:
+
+    std::vector<Budget> Budgets;
+
+    static bool isTime(Metric M) { return M == Metric::CompileTime; }
+
+    static bool isSize(Metric M) {
+      return M == Metric::PeakRSS || M == Metric::DeclASTSize;
+    }
+
+  public:
+
+    static llvm::StringRef getMetricName(Metric M) {
+      switch (M) {
+        case Metric::CompileTime: return "compile-time";
+        case Metric::PeakRSS: return "peak-rss";
+        case Metric::DeclASTSize: return "decl-ast";
+        case Metric::Closure: return "closure";
+        case Metric::FanIn: return "fan-in";
+        default: return "<unknown>";
+      }
+    }
+
+    static bool parseMetric(llvm::StringRef Name, Metric &M) {
+      M = llvm::StringSwitch<Metric>(Name)
+          .Case("compile-time", Metric::CompileTime)
+          .Case("peak-rss", Metric::PeakRSS)
+          .Case("decl-ast", Metric::DeclASTSize)
+          .Case("closure", Metric::Closure)
+          .Case("fan-in", Metric::FanIn)
+          .Default(Metric::NumMetrics);
+      return M != Metric::NumMetrics;
+    }
+
+    /// Parses limit, e.g. "1500ms" or "30s" for time, "512M" for sizes,
+    /// time without unit is in seconds, size without unit is in bytes.
+    /// \return false if limit is malformed.
+    static bool parseValue(Metric M, llvm::StringRef V, ValueTy &Res) {
+      size_t DigitsEnd = V.find_if_not([] (char C) {
+        return C >= '0' && C <= '9';
+      });
+      llvm::StringRef Number = V.take_front(DigitsEnd);
+      llvm::StringRef Suffix = V.drop_front(Number.size());
+
+      if (Number.empty() || Number.getAsInteger(10, Res))
+        return false;
+
+      ValueTy Scale;
+      if (isTime(M))
+        Scale = llvm::StringSwitch<ValueTy>(Suffix)
+            .Case("us", 1)
+            .Case("ms", 1000)
+            .Cases("", "s", 1000000)
+            .Case("m", 60000000)
+            .Default(0);
+      else if (isSize(M))
+        Scale = llvm::StringSwitch<ValueTy>(Suffix)
+            .Case("", 1)
+            .Case("K", 1ULL << 10)
+            .Case("M", 1ULL << 20)
+            .Case("G", 1ULL << 30)
+            .Default(0);
+      else
+        Scale = Suffix.empty() ? 1 : 0;
+
+      if (!Scale)
+        return false;
+
+      Res *= Scale;
+      return true;
+    }
+
+    static void writeValue(llvm::raw_ostream &Out, Metric M, ValueTy V) {
+      if (isTime(M))
+        Out << V / 1000 << " ms";
+      else if (isSize(M))
+        Out << (V >> 10) << " KiB";
+      else
+        Out << V;
+    }
+
+    /// \return true if unit matches budget pattern, see file header.
+    static bool matches(llvm::StringRef Pattern, llvm::StringRef UnitID) {
+      if (Pattern == "*" || Pattern == UnitID)
+        return true;
+
+      // Package pattern keeps its separator, so that "net::*"
+      // doesn't match "network::x".
+      return Pattern.endswith("::*") &&
+             UnitID.startswith(Pattern.drop_back());
+    }
+
+    /// Parses budgets, see file header.
+    /// \param Error [out] description of first malformed line.
+    /// \return false if budgets are malformed.
+    bool parse(llvm::StringRef Contents, std::string &Error) {
+      Budgets.clear();
+
+      for (unsigned LineNo = 1; !Contents.empty(); ++LineNo) {
+        llvm::StringRef Line;
+        std::tie(Line, Contents) = Contents.split('\n');
+
+        Line = Line.trim();
+        if (Line.empty() || Line.startswith("#"))
+          continue;
+
+        auto fail = [&] (llvm::StringRef Message) {
+          Error = ("line " + llvm::Twine(LineNo) + ": " + Message).str();
+          return false;
+        };
+
+        llvm::StringRef Pattern, Limits;
+        std::tie(Pattern, Limits) = Line.split(' ');
+
+        Budget B;
+        B.Pattern = Pattern.str();
+
+        bool HasLimits = false;
+        while (!(Limits = Limits.ltrim()).empty()) {
+          llvm::StringRef Item;
+          std::tie(Item, Limits) = Limits.split(' ');
+
+          llvm::StringRef Name, Value;
+          std::tie(Name, Value) = Item.split('=');
+
+          Metric M;
+          if (!parseMetric(Name, M))
+            return fail(("unknown metric '" + Name + "'").str());
+
+          ValueTy Limit;
+          if (!parseValue(M, Value, Limit))
+            return fail(("malformed limit '" + Item + "'").str());
+
+          B.Limits[(unsigned)M] = Limit;
+          HasLimits = true;
+        }
+
+        if (!HasLimits)
+          return fail(("no limits for '" + Pattern + "'").str());
+
+        Budgets.push_back(std::move(B));
+      }
+
+      return true;
+    }
+
+    bool empty() const { return Budgets.empty(); }
+
+    /// \return true if any budget limits given metric.
+    bool limits(Metric M) const {
+      for (const auto &B : Budgets)
+        if (B.Limits[(unsigned)M])
+          return true;
+      return false;
+    }
+
+    /// \return true if any budget matches unit.
+    bool matchesAny(llvm::StringRef UnitID) const {
+      for (const auto &B : Budgets)
+        if (matches(B.Pattern, UnitID))
+          return true;
+      return false;
+    }
+
+    /// Checks known metrics of unit against all matching budgets.
+    void check(
+        llvm::StringRef UnitID,
+        const MetricsTy &Values,
+        std::vector<Violation> &Res
+    ) const {
+      for (const auto &B : Budgets) {
+        if (!matches(B.Pattern, UnitID))
+          continue;
+
+        for (unsigned m = 0; m != NumMetrics; ++m)
+          if (B.Limits[m] && Values[m] && *Values[m] > *B.Limits[m])
+            Res.push_back({
+                UnitID.str(), (Metric)m, *Values[m], *B.Limits[m], B.Pattern
+            });
+      }
+    }
+  };
+}}}
+
+#endif //LLVM_LEVITATION_PERFORMANCEBUDGETS_H
@@ -0,0 +1,376 @@
+//===--- PersistentWorker.h - C++ PersistentWorker class --------*- C++ -*-===//
+//
+// Part of the C++ Levitation Project,
+// under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file contains persistent worker, which lets build systems with
+//  Bazel worker protocol run phases of C++ Levitation (parse-import,
+//  declaration AST and object) as separate actions, without spawning
+//  new compiler for each of them:
+//
+//    levitation-cppl --persistent_worker [--worker-protocol=json|proto]
+//
+//  Each request is either a clang++ command line, or a frontend one,
+//  starting with "-cc1", e.g. "-cc1 -levitation-parse-import ...".
+//  Requests are executed one by one with in-process compiler.
+//
+//  Worker keeps preamble and declaration ASTs loaded between requests.
+//  Bazel sends digests of action inputs with each request, once digest
+//  of known input is changed, or request has no inputs at all, loaded
+//  files are dropped.
+//
+//  Messages are WorkRequest and WorkResponse of Bazel
+//  worker_protocol.proto, either length delimited protobuf (default),
+//  or JSON.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_LEVITATION_PERSISTENTWORKER_H
+#define LLVM_LEVITATION_PERSISTENTWORKER_H
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <cctype>
+#include <istream>
+#include <string>
+#include <vector>
+
+namespace clang { namespace levitation { namespace tools {
+
+  struct WorkRequest {
+    struct Input {
+      std::string Path;
+
+      /// Opaque digest of input contents.
+      std::string Digest;
+    };
+
+    std::vector<std::string> Arguments;
+    std::vector<Input> Inputs;
+    int64_t RequestID = 0;
+    bool Cancel = false;
+    int64_t Verbosity = 0;
+    std::string SandboxDir;
+  };
+
+  struct WorkResponse {
+    int64_t ExitCode = 0;
+    std::string Output;
+    int64_t RequestID = 0;
+  };
+
+  class WorkerProtocol {
+  public:
+
+    enum struct Format {
+      Proto,
+      JSON
+    };
+
+  private:
+
+    // Protobuf wire types.
+    enum {
+      VARINT = 0,
+      FIXED64 = 1,
+      LEN = 2,
+      FIXED32 = 5
+    };
+
+    /// Reads protobuf varint from Data, and drops it from Data.
+    /// \return false if Data is truncated.
+    static bool readVarint(llvm::StringRef &Data, uint64_t &V) {
+      V = 0;
+      for (unsigned Shift = 0; Shift < 64; Shift += 7) {
+        if (Data.empty())
+          return false;
+        uint8_t Byte = Data.front();
+        Data = Data.drop_front();
+        V |= uint64_t(Byte & 0x7f) << Shift;
+        if (!(Byte & 0x80))
+          return true;
+      }
+      return false;
+    }
+
+    static void writeVarint(llvm::raw_ostream &Out, uint64_t V) {
+      do {
+        uint8_t Byte = V & 0x7f;
+        V >>= 7;
+        Out << (char)(V ? Byte | 0x80 : Byte);
+      } while (V);
+    }
+
+    static void writeLen(
+        llvm::raw_ostream &Out, unsigned Field, llvm::StringRef Value
+    ) {
+      writeVarint(Out, (Field << 3) | LEN);
+      writeVarint(Out, Value.size());
+      Out << Value;
+    }
+
+    /// Calls Fn(Field, WireType, Varint, Bytes) for each field of message.
+    /// \return false if message is malformed.
+    template <typename FnTy>
+    static bool parseFields(llvm::StringRef Data, FnTy &&Fn) {
+      while (!Data.empty()) {
+        uint64_t Key, V = 0;
+        if (!readVarint(Data, Key))
+          return false;
+
+        unsigned Field = Key >> 3, WireType = Key & 7;
+        llvm::StringRef Bytes;
+
+        switch (WireType) {
+          case VARINT:
+            if (!readVarint(Data, V))
+              return false;
+            break;
+          case FIXED64:
+          case FIXED32: {
+            size_t Size = WireType == FIXED64 ? 8 : 4;
+            if (Data.size() < Size)
+              return false;
+            Data = Data.drop_front(Size);
+            break;
+          }
+          case LEN:
+            if (!readVarint(Data, V) || Data.size() < V)
+              return false;
+            Bytes = Data.take_front(V);
+            Data = Data.drop_front(V);
+            break;
+          default:
+            return false;
+        }
+
+        if (!Fn(Field, WireType, V, Bytes))
+          return false;
+      }
+      return true;
+    }
+
+    static bool readProto(std::istream &In, WorkRequest &R) {
+      uint64_t Size = 0;
+      for (unsigned Shift = 0;; Shift += 7) {
+        int C = In.get();
+        if (C == EOF || Shift >= 64)
+          return false;
+        Size |= uint64_t(C & 0x7f) << Shift;
+        if (!(C & 0x80))
+          break;
+      }
+
+      std::string Message(Size, '\0');
+      if (Size && !In.read(&Message[0], Size))
+        return false;
+
+      return parseProto(Message, R);
+    }
+
+    /// Reads one JSON object, objects may be separated by whitespaces.
+    static bool readJSON(std::istream &In, WorkRequest &R) {
+      std::string Message;
+      unsigned Depth = 0;
+      bool InString = false, Escaped = false;
+
+      for (int C; (C = In.get()) != EOF;) {
+        if (!Depth && C != '{') {
+          if (isspace(C))
+            continue;
+          return false;
+        }
+
+        Message.push_back(C);
+
+        if (InString) {
+          if (Escaped)
+            Escaped = false;
+          else if (C == '\\')
+            Escaped = true;
+          else if (C == '"')
+            InString = false;
+          continue;
+        }
+
+        if (C == '"')
+          InString = true;
+        else if (C == '{')
+          ++Depth;
+        else if (C == '}' && !--Depth)
+          return parseJSON(Message, R);
+      }
+
+      return false;
+    }
+
+  public:
+
+    /// Parses WorkRequest protobuf message, without length prefix.
+    /// \return false if message is malformed.
+    static bool parseProto(llvm::StringRef Data, WorkRequest &R) {
+      R = WorkRequest();
+      return parseFields(Data, [&] (
+          unsigned Field, unsigned WireType, uint64_t V, llvm::StringRef Bytes
+      ) {
+        switch (Field) {
+          case 1:
+            if (WireType == LEN)
+              R.Arguments.push_back(Bytes.str());
+            break;
+          case 2:
+            if (WireType == LEN) {
+              WorkRequest::Input I;
+              bool Parsed = parseFields(Bytes, [&] (
+                  unsigned Field, unsigned WireType, uint64_t, llvm::StringRef B
+              ) {
+                if (WireType == LEN && Field == 1)
+                  I.Path = B.str();
+                else if (WireType == LEN && Field == 2)
+                  I.Digest = B.str();
+                return true;
+              });
+              if (!Parsed)
+                return false;
+              R.Inputs.push_back(std::move(I));
+            }
+            break;
+          case 3:
+            R.RequestID = (int32_t)V;
+            break;
+          case 4:
+            R.Cancel = V;
+            break;
+          case 5:
+            R.Verbosity = (int32_t)V;
+            break;
+          case 6:
+            if (WireType == LEN)
+              R.SandboxDir = Bytes.str();
+            break;
+          default:
+            // Fields of newer protocol versions.
+            break;
+        }
+        return true;
+      });
+    }
+
+    /// Parses WorkRequest JSON message.
+    /// \return false if message is malformed.
+    static bool parseJSON(llvm::StringRef Data, WorkRequest &R) {
+      R = WorkRequest();
+
+      auto Parsed = llvm::json::parse(Data);
+      if (!Parsed) {
+        llvm::consumeError(Parsed.takeError());
+        return false;
+      }
+
+      const auto *Root = Parsed->getAsObject();
+      if (!Root)
+        return false;
+
+      if (const auto *Args = Root->getArray("arguments"))
+        for (const auto &A : *Args)
+          if (auto S = A.getAsString())
+            R.Arguments.push_back(S->str());
+
+      if (const auto *Inputs = Root->getArray("inputs"))
+        for (const auto &I : *Inputs) {
+          const auto *Obj = I.getAsObject();
+          if (!Obj)
+            continue;
+          WorkRequest::Input Input;
+          if (auto P = Obj->getString("path"))
+            Input.Path = P->str();
+          if (auto D = Obj->getString("digest"))
+            Input.Digest = D->str();
+          R.Inputs.push_back(std::move(Input));
+        }
+
+      if (auto ID = Root->getInteger("requestId"))
+        R.RequestID = *ID;
+      if (auto Cancel = Root->getBoolean("cancel"))
+        R.Cancel = *Cancel;
+      if (auto V = Root->getInteger("verbosity"))
+        R.Verbosity = *V;
+      if (auto Dir = Root->getString("sandboxDir"))
+        R.SandboxDir = Dir->str();
+
+      return true;
+    }
+
+    /// Reads next request.
+    /// \return false on EOF or if request is malformed.
+    static bool read(Format F, std::istream &In, WorkRequest &R) {
+      return F == Format::JSON ? readJSON(In, R) : readProto(In, R);
+    }
+
+    /// Writes response, protobuf message is prefixed with its length.
+    /// Fields with default values are omitted, as proto3 encoders do.
+    static void write(
+        Format F, llvm::raw_ostream &Out, const WorkResponse &R
+    ) {
+      if (F == Format::JSON) {
+        llvm::json::OStream J(Out);
+        J.object([&] {
+          J.attribute("exitCode", R.ExitCode);
+          J.attribute("output", R.Output);
+          J.attribute("requestId", R.RequestID);
+        });
+        Out << "\n";
+        Out.flush();
+        return;
+      }
+
+      std::string Message;
+      llvm::raw_string_ostream MOut(Message);
+
+      if (R.ExitCode) {
+        writeVarint(MOut, (1 << 3) | VARINT);
+        writeVarint(MOut, (uint64_t)R.ExitCode);
+      }
+      if (R.Output.size())
+        writeLen(MOut, 2, R.Output);
+      if (R.RequestID) {
+        writeVarint(MOut, (3 << 3) | VARINT);
+        writeVarint(MOut, (uint64_t)R.RequestID);
+      }
+      MOut.flush();
+
+      writeVarint(Out, Message.size());
+      Out << Message;
+      Out.flush();
+    }
+  };
+
+  class PersistentWorker {
+  public:
+
+    /// Option build systems pass to worker executable.
+    static llvm::StringRef getWorkerOption() {
+      return "--persistent_worker";
+    }
+
+    /// Optional worker option, "--worker-protocol=json" or "=proto".
+    static llvm::StringRef getProtocolOption() {
+      return "--worker-protocol=";
+    }
+
+    /// Serves requests from stdin until EOF, responses are written
+    /// to stdout. Anything else written to stdout by worker or
+    /// by its subprocesses goes to stderr.
+    /// \param ClangPath clang++ frontend requests are run as.
+    /// \return process exit code.
+    static int serve(WorkerProtocol::Format F, llvm::StringRef ClangPath);
+  };
+}}}
+
+#endif //LLVM_LEVITATION_PERSISTENTWORKER_H
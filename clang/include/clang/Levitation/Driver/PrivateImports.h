@@ -0,0 +1,208 @@
+//===--- PrivateImports.h - C++ PrivateImports class ------------*- C++ -*-===//
+//
+// Part of the C++ Levitation Project,
+// under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file contains inference of private imports, see --private-imports.
+//  Declaration level import is private, if unit declaration uses nothing
+//  from imported unit, according to dependencies stats of previous build.
+//  Such import is treated as [bodydep] one, and thus it is not propagated
+//  to closures of unit dependents.
+//
+//  Import is only inferred private, if none of dependents which has
+//  used imported unit (or anything it has dragged in) would lose it,
+//  so that existing code keeps building.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_LEVITATION_PRIVATEIMPORTS_H
+#define LLVM_LEVITATION_PRIVATEIMPORTS_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SmallVector.h"
+
+#include <algorithm>
+#include <functional>
+#include <utility>
+#include <vector>
+
+namespace clang { namespace levitation { namespace tools {
+
+  class PrivateImports {
+  public:
+
+    struct Unit {
+      /// Declaration level imports, as indices of imported units.
+      llvm::SmallVector<unsigned, 8> DeclImports;
+
+      /// Imports of #body and [bodydep] imports.
+      llvm::SmallVector<unsigned, 8> BodyImports;
+
+      /// Whether stats of unit jobs are known. Unit without stats
+      /// is supposed to use everything it has loaded.
+      bool HasStats = false;
+
+      /// Whether unit source is same as when its stats were written,
+      /// only such unit may get private imports.
+      bool Untouched = false;
+
+      /// Units declaration AST job has used something from.
+      llvm::DenseSet<unsigned> UsedByDecl;
+
+      /// Units declaration AST or object job has used something from.
+      llvm::DenseSet<unsigned> Used;
+    };
+
+    /// Import of Units[Unit] which is private.
+    using Demotion = std::pair<unsigned, unsigned>;
+
+  private:
+
+    using Closures = std::vector<llvm::BitVector>;
+
+    static bool isDemoted(
+        const std::vector<Demotion> &Demoted, unsigned U, unsigned I
+    ) {
+      return std::binary_search(Demoted.begin(), Demoted.end(), Demotion(U, I));
+    }
+
+    /// Builds declaration and object closures of all units,
+    /// demoted imports only get into object closure of their unit.
+    static void buildClosures(
+        llvm::ArrayRef<Unit> Units,
+        const std::vector<Demotion> &Demoted,
+        Closures &Decl,
+        Closures &Obj
+    ) {
+      unsigned N = Units.size();
+      Decl.assign(N, llvm::BitVector(N));
+      Obj.assign(N, llvm::BitVector(N));
+
+      // Graph cycles are reported by solver, here they only
+      // have to terminate.
+      llvm::BitVector Done(N), Visiting(N);
+
+      std::function<void(unsigned)> visit = [&] (unsigned U) {
+        if (Done.test(U) || Visiting.test(U))
+          return;
+        Visiting.set(U);
+
+        for (auto I : Units[U].DeclImports) {
+          if (isDemoted(Demoted, U, I))
+            continue;
+          visit(I);
+          Decl[U].set(I);
+          Decl[U] |= Decl[I];
+        }
+
+        Visiting.reset(U);
+        Done.set(U);
+      };
+
+      for (unsigned U = 0; U != N; ++U)
+        visit(U);
+
+      for (unsigned U = 0; U != N; ++U) {
+        auto addImport = [&] (unsigned I) {
+          Obj[U].set(I);
+          Obj[U] |= Decl[I];
+        };
+        for (auto I : Units[U].DeclImports)
+          addImport(I);
+        for (auto I : Units[U].BodyImports)
+          addImport(I);
+      }
+    }
+
+  public:
+
+    /// Infers private imports.
+    /// \return private imports, sorted.
+    static std::vector<Demotion> infer(llvm::ArrayRef<Unit> Units) {
+      std::vector<Demotion> Demoted;
+
+      for (unsigned U = 0, e = Units.size(); U != e; ++U) {
+        const auto &Info = Units[U];
+        if (!Info.HasStats || !Info.Untouched)
+          continue;
+        for (auto I : Info.DeclImports)
+          if (!Info.UsedByDecl.count(I))
+            Demoted.emplace_back(U, I);
+      }
+
+      if (Demoted.empty())
+        return Demoted;
+
+      std::sort(Demoted.begin(), Demoted.end());
+      Demoted.erase(std::unique(Demoted.begin(), Demoted.end()), Demoted.end());
+
+      Closures OldDecl, OldObj;
+      buildClosures(Units, {}, OldDecl, OldObj);
+
+      Closures NewDecl, NewObj;
+
+      // Each round cancels demotions which have cut used unit out of
+      // some closure. Every violation is caused by at least one of
+      // demotions it cancels, so rounds are over eventually.
+      while (!Demoted.empty()) {
+        buildClosures(Units, Demoted, NewDecl, NewObj);
+
+        std::vector<std::pair<unsigned, unsigned>> Lost;
+
+        auto check = [&] (
+            unsigned Z, unsigned Used, const Closures &Old, const Closures &New
+        ) {
+          if (Old[Z].test(Used) && !New[Z].test(Used))
+            Lost.emplace_back(Z, Used);
+        };
+
+        for (unsigned Z = 0, e = Units.size(); Z != e; ++Z) {
+          const auto &Info = Units[Z];
+          if (!Info.HasStats) {
+            for (auto Used : OldObj[Z].set_bits())
+              check(Z, Used, OldObj, NewObj);
+            for (auto Used : OldDecl[Z].set_bits())
+              check(Z, Used, OldDecl, NewDecl);
+            continue;
+          }
+          for (auto Used : Info.Used)
+            check(Z, Used, OldObj, NewObj);
+          for (auto Used : Info.UsedByDecl)
+            check(Z, Used, OldDecl, NewDecl);
+        }
+
+        if (Lost.empty())
+          break;
+
+        // Demotion (A, B) is on the way from Z to Used, if A is Z
+        // or Z depends on A, and Used is B, or B depends on it.
+        auto isOnTheWay = [&] (const Demotion &D) {
+          for (const auto &L : Lost) {
+            unsigned Z = L.first, Used = L.second;
+            if (
+              (D.first == Z || OldObj[Z].test(D.first)) &&
+              (D.second == Used || OldDecl[D.second].test(Used))
+            )
+              return true;
+          }
+          return false;
+        };
+
+        Demoted.erase(
+            std::remove_if(Demoted.begin(), Demoted.end(), isOnTheWay),
+            Demoted.end()
+        );
+      }
+
+      return Demoted;
+    }
+  };
+}}}
+
+#endif //LLVM_LEVITATION_PRIVATEIMPORTS_H
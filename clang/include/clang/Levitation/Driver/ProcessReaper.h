@@ -0,0 +1,137 @@
+//===--- ProcessReaper.h - C++ Levitation ProcessReaper class ---*- C++ -*-===//
+//
+// Part of the C++ Levitation Project,
+// under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file contains subprocesses launcher, which reaps all children
+//  in single event loop, instead of blocking one thread in waitpid per
+//  child.
+//
+//  Children are spawned with llvm::sys::ExecuteNoWait, which uses
+//  posix_spawn where available. Each child gets pidfd, registered in
+//  epoll set of reaper thread. Once child exits, its exit status is
+//  taken without reaping, and callbacks are called from reaper thread:
+//  first one while child is still a zombie, so that its PID is still
+//  reserved, second one after it was reaped, with its exit code and
+//  peak memory.
+//
+//  Reaper is only supported on Linux with pidfd (5.3+), elsewhere
+//  callers wait for their children themselves.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_LEVITATION_PROCESSREAPER_H
+#define LLVM_LEVITATION_PROCESSREAPER_H
+
+#include "clang/Levitation/Common/CreatableSingleton.h"
+#include "clang/Levitation/Common/Thread.h"
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringRef.h"
+
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace clang { namespace levitation { namespace tools {
+
+  class ProcessReaper : public CreatableSingleton<ProcessReaper> {
+  public:
+
+    struct ExitInfo {
+      /// Exit code, -1 if process couldn't be waited for,
+      /// -2 if it has crashed, same as llvm::sys::ExecuteAndWait.
+      int Code = -1;
+
+      /// Peak resident set size in bytes, 0 if unknown.
+      uint64_t PeakMemory = 0;
+
+      std::string ErrorMessage;
+    };
+
+    /// Called once child has exited, but before it is reaped.
+    using ExitingFn = std::function<void(int Pid)>;
+
+    /// Called once child is reaped.
+    using ExitFn = std::function<void(ExitInfo &&Info)>;
+
+    /// Called once child is launched, before its exit may be reported.
+    using SpawnedFn = std::function<void(int Pid)>;
+
+  private:
+
+    struct Child {
+      int Pid = -1;
+      ExitingFn OnExiting;
+      ExitFn OnExit;
+    };
+
+    int EpollFD = -1;
+    int WakeFD = -1;
+
+    std::mutex Locker;
+    bool StopRequested = false;
+
+    /// Children by their pidfd.
+    llvm::DenseMap<int, Child> Children;
+
+    std::thread Thread;
+
+    void run();
+    void reap(int PidFD, Child &&C);
+
+  protected:
+
+    ProcessReaper();
+
+    friend CreatableSingleton<ProcessReaper>;
+
+  public:
+
+    ~ProcessReaper();
+
+    /// Whether host supports event driven reaping. Otherwise
+    /// spawn always fails, and callers should wait for their
+    /// children themselves.
+    bool isEnabled() const { return EpollFD >= 0; }
+
+    /// Launches program. OnSpawned is called from caller thread,
+    /// other callbacks are called from reaper thread.
+    /// \return PID of child, or -1 if it couldn't be launched,
+    ///         then callbacks are never called.
+    int spawn(
+        llvm::StringRef Program,
+        llvm::ArrayRef<llvm::StringRef> Args,
+        std::string &ErrorMessage,
+        SpawnedFn OnSpawned,
+        ExitingFn OnExiting,
+        ExitFn OnExit
+    );
+
+    /// Launches program and blocks until it is reaped.
+    /// \return same value llvm::sys::ExecuteAndWait would return.
+    int execute(
+        llvm::StringRef Program,
+        llvm::ArrayRef<llvm::StringRef> Args,
+        std::string &ErrorMessage,
+        uint64_t &PeakMemory,
+        SpawnedFn OnSpawned = nullptr,
+        ExitingFn OnExiting = nullptr
+    );
+
+    /// \return number of children which are not reaped yet.
+    unsigned getNumChildren() {
+      auto _ = lock(Locker);
+      return Children.size();
+    }
+  };
+}}}
+
+#endif //LLVM_LEVITATION_PROCESSREAPER_H
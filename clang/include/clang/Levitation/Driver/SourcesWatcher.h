@@ -0,0 +1,82 @@
+//===--- SourcesWatcher.h - C++ SourcesWatcher class ------------*- C++ -*-===//
+//
+// Part of the C++ Levitation Project,
+// under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file contains sources watcher, which blocks until some files
+//  in sources root are changed. On Linux it is based on inotify,
+//  on other hosts it falls back to periodic polling of file stamps.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_LEVITATION_SOURCESWATCHER_H
+#define LLVM_LEVITATION_SOURCESWATCHER_H
+
+#include "clang/Levitation/BuildState/BuildState.h"
+#include "clang/Levitation/Common/Path.h"
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/StringSet.h"
+
+namespace clang { namespace levitation { namespace tools {
+
+  class SourcesWatcher {
+  public:
+
+    struct Changes {
+      /// Absolute paths of created, modified or removed files.
+      llvm::StringSet<> Files;
+
+      /// Whether project sources were created or removed,
+      /// so that sources must be collected again.
+      bool SourcesSetChanged = false;
+
+      bool empty() const {
+        return Files.empty() && !SourcesSetChanged;
+      }
+    };
+
+  private:
+
+    SinglePath Root;
+    SinglePath IgnoreDir;
+
+    int InotifyFD = -1;
+    llvm::DenseMap<int, SinglePath> WatchedDirs;
+
+    /// Used in polling mode only.
+    llvm::StringMap<BuildState::FileStamp> Stamps;
+
+    bool isIgnored(llvm::StringRef AbsPath) const;
+
+    void addWatches(llvm::StringRef Dir);
+    bool readEvents(Changes &C, int TimeoutMs);
+
+    void takeSnapshot(llvm::StringMap<BuildState::FileStamp> &Snapshot) const;
+    bool poll(Changes &C);
+
+    void addChange(Changes &C, llvm::StringRef AbsPath, bool SetChanged) const;
+
+  public:
+
+    /// \param Root directory to be watched recursively.
+    /// \param IgnoreDir directory which should not be watched,
+    /// usually build root.
+    SourcesWatcher(llvm::StringRef Root, llvm::StringRef IgnoreDir);
+    ~SourcesWatcher();
+
+    /// Blocks until some files are changed. Changes which come
+    /// shortly after first one (e.g. when editor saves several files)
+    /// are reported as a single batch.
+    /// \return false if watching failed.
+    bool wait(Changes &C);
+  };
+}}}
+
+#endif //LLVM_LEVITATION_SOURCESWATCHER_H
@@ -0,0 +1,223 @@
+//===--- TimeTraceReport.h - C++ TimeTraceReport class ----------*- C++ -*-===//
+//
+// Part of the C++ Levitation Project,
+// under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file contains report of frontend time traces. Decl-ast and
+//  object jobs are run with -ftime-trace, each one writes its own trace,
+//  then traces are summed up per unit, so it can be seen whether unit
+//  is slow itself, or due to templates or dependencies it loads.
+//  Trace events are also merged into driver's build trace.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_LEVITATION_TIMETRACEREPORT_H
+#define LLVM_LEVITATION_TIMETRACEREPORT_H
+
+#include "clang/Levitation/Common/CreatableSingleton.h"
+#include "clang/Levitation/Common/Thread.h"
+#include "clang/Levitation/Driver/BuildTrace.h"
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace clang { namespace levitation { namespace tools {
+
+  class TimeTraceReport : public CreatableSingleton<TimeTraceReport> {
+  public:
+
+    /// Job which was run with time trace.
+    struct Job {
+      std::string Unit;
+      std::string Category;
+      std::string TraceFile;
+
+      /// Job start in driver trace time, see BuildTrace::elapsed.
+      uint64_t Start;
+      int ThreadID;
+    };
+
+    /// Times of unit job, in microseconds.
+    struct UnitTimes {
+      std::string Unit;
+      std::string Category;
+      uint64_t Frontend = 0;
+      uint64_t Templates = 0;
+      uint64_t Dependencies = 0;
+    };
+
+    /// Name of frontend scope dependencies are loaded in.
+    static constexpr const char *LoadDependenciesScope =
+        "LevitationLoadDependencies";
+
+  private:
+
+    bool Enabled;
+
+    std::mutex JobsLocker;
+    std::vector<Job> Jobs;
+    std::vector<UnitTimes> Times;
+
+    static uint64_t getUInt(const llvm::json::Object &O, llvm::StringRef Key) {
+      auto V = O.getInteger(Key);
+      return V && *V > 0 ? *V : 0;
+    }
+
+  protected:
+
+    TimeTraceReport(bool enabled) : Enabled(enabled) {}
+
+    friend CreatableSingleton<TimeTraceReport>;
+
+  public:
+
+    bool isEnabled() const { return Enabled; }
+
+    void addJob(Job &&J) {
+      auto _ = lock(JobsLocker);
+      Jobs.emplace_back(std::move(J));
+    }
+
+    /// Takes totals from clang time trace, and, if Trace is given,
+    /// adds its complete events into it, shifted to job start.
+    /// \return false if trace can't be parsed.
+    static bool parse(
+        llvm::StringRef Contents,
+        UnitTimes &T,
+        BuildTrace *Trace = nullptr,
+        const Job *J = nullptr
+    ) {
+      auto Parsed = llvm::json::parse(Contents);
+      if (!Parsed) {
+        llvm::consumeError(Parsed.takeError());
+        return false;
+      }
+
+      const auto *Root = Parsed->getAsObject();
+      const auto *Events = Root ? Root->getArray("traceEvents") : nullptr;
+      if (!Events)
+        return false;
+
+      for (const auto &V : *Events) {
+        const auto *E = V.getAsObject();
+        if (!E || E->getString("ph") != llvm::StringRef("X"))
+          continue;
+
+        auto Name = E->getString("name");
+        if (!Name)
+          continue;
+
+        uint64_t Duration = getUInt(*E, "dur");
+
+        // Totals of same name sections, nested ones are not counted twice.
+        llvm::StringRef Total = *Name;
+        if (Total.consume_front("Total ")) {
+          if (Total == "ExecuteCompiler")
+            T.Frontend += Duration;
+          else if (Total == "InstantiateClass" || Total == "InstantiateFunction")
+            T.Templates += Duration;
+          else if (Total == LoadDependenciesScope)
+            T.Dependencies += Duration;
+          continue;
+        }
+
+        if (Trace && J) {
+          llvm::StringRef Detail;
+          if (const auto *Args = E->getObject("args"))
+            if (auto D = Args->getString("detail"))
+              Detail = *D;
+
+          Trace->addExternalEvent(
+              Detail.size() ? (*Name + ": " + Detail).str() : Name->str(),
+              "frontend",
+              J->Unit,
+              J->Start + getUInt(*E, "ts"),
+              Duration,
+              J->ThreadID
+          );
+        }
+      }
+
+      return true;
+    }
+
+    /// Reads traces of all jobs.
+    /// \return number of traces which were not read.
+    unsigned collect(BuildTrace *Trace = nullptr) {
+      auto _ = lock(JobsLocker);
+
+      unsigned NumFailed = 0;
+      for (const auto &J : Jobs) {
+        auto Buffer = llvm::MemoryBuffer::getFile(J.TraceFile);
+        UnitTimes T { J.Unit, J.Category };
+        if (!Buffer || !parse(Buffer.get()->getBuffer(), T, Trace, &J)) {
+          ++NumFailed;
+          continue;
+        }
+        Times.emplace_back(std::move(T));
+      }
+
+      Jobs.clear();
+      return NumFailed;
+    }
+
+    llvm::ArrayRef<UnitTimes> getTimes() const { return Times; }
+
+    /// Writes top units by frontend time, template instantiation
+    /// time, and time spent on loading dependencies.
+    void write(llvm::raw_ostream &Out, size_t MaxUnits = 10) const {
+      Out << "\nUnits time trace report:\n";
+
+      if (Times.empty()) {
+        Out << "  No traced jobs.\n";
+        return;
+      }
+
+      auto writeTop = [&] (
+          llvm::StringRef Title,
+          uint64_t UnitTimes::*Field
+      ) {
+        std::vector<const UnitTimes*> Sorted;
+        uint64_t Total = 0;
+        for (const auto &T : Times) {
+          Sorted.push_back(&T);
+          Total += T.*Field;
+        }
+
+        std::stable_sort(Sorted.begin(), Sorted.end(), [&] (
+            const UnitTimes *L, const UnitTimes *R
+        ) {
+          return L->*Field > R->*Field;
+        });
+
+        Out << "\n  " << Title << ", " << Total / 1000 << " ms total:\n";
+        for (size_t i = 0, e = std::min(MaxUnits, Sorted.size()); i != e; ++i) {
+          Out.indent(4)
+          << Sorted[i]->*Field / 1000 << " ms  "
+          << Sorted[i]->Category << "  "
+          << Sorted[i]->Unit << "\n";
+        }
+      };
+
+      writeTop("By frontend time", &UnitTimes::Frontend);
+      writeTop("By template instantiation time", &UnitTimes::Templates);
+      writeTop("By dependencies loading time", &UnitTimes::Dependencies);
+
+      Out << "\n";
+    }
+  };
+}}}
+
+#endif //LLVM_LEVITATION_TIMETRACEREPORT_H
@@ -0,0 +1,214 @@
+//===--- UnsavedFiles.h - C++ Levitation UnsavedFiles class -----*- C++ -*-===//
+//
+// Part of the C++ Levitation Project,
+// under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file contains file system which overlays files with unsaved
+//  buffers, e.g. editor buffers of IDE, see LevitationDriverSession.
+//  Driver reads sources through it, while compiler jobs get overlay file
+//  (-ivfsoverlay), which maps sources to copies of buffers.
+//
+//  Buffers only override existing files, directories are listed
+//  by underlying file system.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_LEVITATION_UNSAVEDFILES_H
+#define LLVM_LEVITATION_UNSAVEDFILES_H
+
+#include "clang/Levitation/Common/Path.h"
+#include "clang/Levitation/Common/Thread.h"
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/Support/Chrono.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/VirtualFileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace clang { namespace levitation { namespace tools {
+
+  class UnsavedFiles : public llvm::vfs::ProxyFileSystem {
+
+    struct Buffer {
+      std::string Contents;
+      llvm::sys::TimePoint<> MTime;
+      llvm::sys::fs::UniqueID ID;
+    };
+
+    class BufferFile : public llvm::vfs::File {
+      llvm::vfs::Status S;
+      std::string Contents;
+
+    public:
+      BufferFile(llvm::vfs::Status S, std::string C)
+      : S(std::move(S)), Contents(std::move(C)) {}
+
+      llvm::ErrorOr<llvm::vfs::Status> status() override { return S; }
+
+      llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> getBuffer(
+          const llvm::Twine &Name,
+          int64_t FileSize,
+          bool RequiresNullTerminator,
+          bool IsVolatile
+      ) override {
+        return llvm::MemoryBuffer::getMemBufferCopy(Contents, Name);
+      }
+
+      std::error_code close() override { return std::error_code(); }
+    };
+
+    mutable std::mutex Locker;
+    llvm::StringMap<Buffer> Buffers;
+
+    static SinglePath getKey(const llvm::Twine &Path) {
+      SinglePath Key = levitation::Path::makeAbsolute<SinglePath>(
+          Path.str()
+      );
+      llvm::sys::path::remove_dots(Key, /*remove_dot_dot=*/true);
+      return Key;
+    }
+
+    static llvm::vfs::Status getStatus(
+        llvm::StringRef Path, const Buffer &B
+    ) {
+      return llvm::vfs::Status(
+          Path, B.ID, B.MTime, /*User=*/0, /*Group=*/0,
+          B.Contents.size(),
+          llvm::sys::fs::file_type::regular_file,
+          llvm::sys::fs::perms::all_read | llvm::sys::fs::perms::owner_write
+      );
+    }
+
+  public:
+
+    UnsavedFiles(
+        llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> FS =
+            llvm::vfs::getRealFileSystem()
+    )
+    : ProxyFileSystem(std::move(FS)) {}
+
+    /// Overlays file with buffer. Each call gives file new modification
+    /// time, so that driver sees it as changed.
+    void set(llvm::StringRef Path, llvm::StringRef Contents) {
+      auto _ = lock(Locker);
+      auto &B = Buffers[getKey(Path)];
+      B.Contents = Contents.str();
+      B.MTime = std::chrono::time_point_cast<std::chrono::nanoseconds>(
+          std::chrono::system_clock::now()
+      );
+      B.ID = llvm::vfs::getNextVirtualUniqueID();
+    }
+
+    /// Drops buffer, e.g. once it is saved or discarded,
+    /// so that file is read from disk again.
+    /// \return false if file had no buffer.
+    bool remove(llvm::StringRef Path) {
+      auto _ = lock(Locker);
+      return Buffers.erase(getKey(Path));
+    }
+
+    void clear() {
+      auto _ = lock(Locker);
+      Buffers.clear();
+    }
+
+    bool empty() const {
+      auto _ = lock(Locker);
+      return Buffers.empty();
+    }
+
+    /// \return absolute paths of overlaid files.
+    std::vector<SinglePath> getPaths() const {
+      auto _ = lock(Locker);
+      std::vector<SinglePath> Res;
+      for (const auto &B : Buffers)
+        Res.emplace_back(B.first());
+      return Res;
+    }
+
+    llvm::ErrorOr<llvm::vfs::Status> status(const llvm::Twine &Path) override {
+      {
+        auto _ = lock(Locker);
+        auto Found = Buffers.find(getKey(Path));
+        if (Found != Buffers.end())
+          return getStatus(Path.str(), Found->second);
+      }
+      return ProxyFileSystem::status(Path);
+    }
+
+    llvm::ErrorOr<std::unique_ptr<llvm::vfs::File>>
+    openFileForRead(const llvm::Twine &Path) override {
+      {
+        auto _ = lock(Locker);
+        auto Found = Buffers.find(getKey(Path));
+        if (Found != Buffers.end())
+          return std::unique_ptr<llvm::vfs::File>(new BufferFile(
+              getStatus(Path.str(), Found->second), Found->second.Contents
+          ));
+      }
+      return ProxyFileSystem::openFileForRead(Path);
+    }
+
+    /// Writes copies of buffers into Dir, and overlay file which maps
+    /// overlaid files to them, so that compiler jobs see buffers too.
+    /// Diagnostics of jobs still refer to overlaid files.
+    /// \return true if successful.
+    bool writeOverlay(llvm::StringRef Dir, llvm::StringRef OverlayFile) {
+      auto _ = lock(Locker);
+
+      if (llvm::sys::fs::create_directories(Dir))
+        return false;
+
+      llvm::vfs::YAMLVFSWriter Writer;
+      Writer.setUseExternalNames(false);
+
+      unsigned Idx = 0;
+      for (const auto &B : Buffers) {
+        SinglePath Copy;
+        llvm::raw_svector_ostream(Copy)
+            << Dir << "/" << Idx++ << "-"
+            << llvm::sys::path::filename(B.first());
+
+        std::error_code EC;
+        llvm::raw_fd_ostream Out(Copy, EC);
+        if (EC)
+          return false;
+        Out << B.second.Contents;
+        Out.close();
+        if (Out.has_error()) {
+          Out.clear_error();
+          return false;
+        }
+
+        Writer.addFileMapping(B.first(), Copy);
+      }
+
+      std::error_code EC;
+      llvm::raw_fd_ostream Out(OverlayFile, EC);
+      if (EC)
+        return false;
+      Writer.write(Out);
+      Out.close();
+      if (Out.has_error()) {
+        Out.clear_error();
+        return false;
+      }
+
+      return true;
+    }
+  };
+}}}
+
+#endif //LLVM_LEVITATION_UNSAVEDFILES_H
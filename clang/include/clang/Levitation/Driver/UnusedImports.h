@@ -0,0 +1,120 @@
+//===--- UnusedImports.h - C++ UnusedImports class --------------*- C++ -*-===//
+//
+// Part of the C++ Levitation Project,
+// under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file contains detection of unnecessary imports, based on
+//  dependencies stats written by decl-ast and object jobs. Declaration
+//  level import adds graph edge to every dependent of unit, so imports
+//  nothing is deserialized from, and imports only #body needs,
+//  are worth reporting.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_LEVITATION_UNUSEDIMPORTS_H
+#define LLVM_LEVITATION_UNUSEDIMPORTS_H
+
+#include "clang/Levitation/Common/DependencyStats.h"
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+
+#include <string>
+#include <vector>
+
+namespace clang { namespace levitation { namespace tools {
+
+  class UnusedImports {
+  public:
+
+    enum class Kind {
+      /// Nothing was deserialized from imported unit.
+      Unused,
+
+      /// Declaration level import used by unit #body only,
+      /// it could be [bodydep].
+      BodyOnly
+    };
+
+    struct Import {
+      /// Unit ID as it is written in #import.
+      std::string UnitID;
+
+      /// Decl-ast file of imported unit, as it appears in stats.
+      std::string DeclAST;
+    };
+
+    struct Finding {
+      std::string UnitID;
+      Kind K;
+    };
+
+  private:
+
+    using UsageMap = llvm::StringMap<bool>;
+
+    static UsageMap getUsage(llvm::ArrayRef<DependencyStats> Stats) {
+      UsageMap Used;
+      for (const auto &S : Stats)
+        Used[S.File] = !S.isUnused();
+      return Used;
+    }
+
+    /// \return true if import was loaded and nothing was used from it.
+    static bool isUnused(const UsageMap &Usage, const Import &I) {
+      auto Found = Usage.find(I.DeclAST);
+      return Found != Usage.end() && !Found->second;
+    }
+
+  public:
+
+    /// Checks unit imports.
+    /// Imports which weren't loaded by job at all are not reported,
+    /// since there is no data about them.
+    /// \param DeclStats stats of unit decl-ast job,
+    ///   or empty if unit is body only, or its stats are missing.
+    /// \param ObjStats stats of unit object job.
+    /// \param DeclImports declaration level imports.
+    /// \param BodyImports imports of #body and [bodydep] imports.
+    static std::vector<Finding> find(
+        llvm::ArrayRef<DependencyStats> DeclStats,
+        llvm::ArrayRef<DependencyStats> ObjStats,
+        llvm::ArrayRef<Import> DeclImports,
+        llvm::ArrayRef<Import> BodyImports
+    ) {
+      std::vector<Finding> Findings;
+
+      auto DeclUsage = getUsage(DeclStats);
+      auto ObjUsage = getUsage(ObjStats);
+
+      if (DeclStats.size())
+        for (const auto &I : DeclImports) {
+          if (!isUnused(DeclUsage, I))
+            continue;
+
+          // Without object stats we only know declaration doesn't
+          // need it, so it is not reported.
+          auto FoundObj = ObjUsage.find(I.DeclAST);
+          if (FoundObj == ObjUsage.end())
+            continue;
+
+          Findings.push_back({
+            I.UnitID, FoundObj->second ? Kind::BodyOnly : Kind::Unused
+          });
+        }
+
+      for (const auto &I : BodyImports)
+        if (isUnused(ObjUsage, I))
+          Findings.push_back({I.UnitID, Kind::Unused});
+
+      return Findings;
+    }
+  };
+}}}
+
+#endif //LLVM_LEVITATION_UNUSEDIMPORTS_H
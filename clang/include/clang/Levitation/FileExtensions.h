@@ -26,11 +26,22 @@ struct FileExtensions {
   static constexpr char ObjMeta [] = "o.meta";
 
   static constexpr char Object [] = "o";
+  static constexpr char IR [] = "ir.bc";
+  static constexpr char SplitDwarf [] = "dwo";
+  static constexpr char DwarfPackage [] = "dwp";
   static constexpr char DeclarationAST [] = "decl-ast";
   static constexpr char ParsedDependencies [] = "ldeps";
   static constexpr char ParsedDependenciesMeta [] = "ldeps.meta";
   static constexpr char DirectDependencies [] = "d";
   static constexpr char FullDependencies [] = "fulld";
+  static constexpr char ResponseFile [] = "rsp";
+  static constexpr char TimeTrace [] = "time-trace.json";
+  static constexpr char DependencyStats [] = "stats.json";
+  static constexpr char SerializedDiagnostics [] = "dia";
+  static constexpr char SharedLibrary [] = "so";
+  static constexpr char TidyFixes [] = "tidy.yaml";
+  static constexpr char CheckStamp [] = "check";
+  static constexpr char TestLog [] = "test.log";
 };
 
 }
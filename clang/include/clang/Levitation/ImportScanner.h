@@ -0,0 +1,89 @@
+//===--- ImportScanner.h - C++ Levitation ImportScanner class ---*- C++ -*-===//
+//
+// Part of the C++ Levitation Project,
+// under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file defines C++ Levitation import scanner. Scanner collects
+//  #import, #public and #body directives without running preprocessor,
+//  so that package dependencies may be obtained in-process, without
+//  launching clang for each package.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_CLANG_LEVITATION_IMPORTSCANNER_H
+#define LLVM_CLANG_LEVITATION_IMPORTSCANNER_H
+
+#include "clang/Levitation/Common/Failable.h"
+#include "clang/Levitation/Dependencies.h"
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/StringSet.h"
+
+namespace clang { namespace levitation {
+
+  /// Scans source the same way clang does it on parse-import stage,
+  /// but only skips over comments, literals and other tokens, without
+  /// preprocessing or lexing them, similar to dependency directives
+  /// minimizer.
+  ///
+  /// Scanner doesn't try to evaluate preprocessor. Whenever source
+  /// contains something which may change the result of parse-import
+  /// (Levitation directive within conditional block, import identifier
+  /// which is defined as macro, #import after #include, etc.),
+  /// scanner fails and clang should be used instead. Clang is also
+  /// responsible for reporting all errors, so scanner fails on
+  /// malformed directives rather than diagnoses them.
+  ///
+  /// Note: macros, defined in preamble or by command line are
+  /// invisible for scanner, and import identifiers are taken as written.
+  class ImportScanner : public Failable {
+
+    llvm::StringRef Source;
+    const char *Cur;
+    const char *End;
+
+    bool AtLineStart = true;
+    bool HasTokens = false;
+    bool FirstDirective = true;
+    bool BodyDirectiveMet = false;
+    bool IncludeMet = false;
+    unsigned ConditionalDepth = 0;
+
+    llvm::StringSet<> DefinedMacros;
+
+    typedef llvm::SmallVector<llvm::StringRef, 16> TokensTy;
+
+    bool skipSplice();
+    void skipLineComment();
+    void skipBlockComment();
+    void skipQuoted(char Quote);
+    void skipRawString();
+    void skipIdentifier();
+    void skipNumber();
+
+    void readDirectiveLine(llvm::SmallVectorImpl<char> &Line);
+    static void tokenizeDirective(llvm::StringRef Line, TokensTy &Tokens);
+
+    bool handleDirective(PackageDependencies &Deps);
+    bool handleImport(const TokensTy &Tokens, PackageDependencies &Deps);
+
+    bool unsupported(llvm::StringRef Reason);
+
+  public:
+
+    ImportScanner(llvm::StringRef source)
+    : Source(source), Cur(source.begin()), End(source.end()) {}
+
+    /// Scans source and fills Deps with its dependencies.
+    /// \return false if source can't be handled by scanner,
+    /// in this case reason is available as error message.
+    bool scan(PackageDependencies &Deps);
+  };
+}}
+
+#endif //LLVM_CLANG_LEVITATION_IMPORTSCANNER_H
@@ -15,6 +15,8 @@
 #define LLVM_CLANG_LEVITATION_SERIALIZATION_H
 
 #include "clang/Basic/SourceLocation.h"
+#include "clang/Levitation/BuildHistory/BuildHistory.h"
+#include "clang/Levitation/BuildState/BuildState.h"
 #include "clang/Levitation/Common/IndexedSet.h"
 #include "clang/Levitation/Common/Path.h"
 #include "clang/Levitation/Common/StringsPool.h"
@@ -141,6 +143,32 @@ namespace levitation {
     virtual const Failable &getStatus() const = 0;
   };
 
+  class BuildHistoryWriter {
+  public:
+    virtual ~BuildHistoryWriter() = default;
+    virtual void writeAndFinalize(const BuildHistory &History) = 0;
+  };
+
+  class BuildHistoryReader {
+  public:
+    virtual ~BuildHistoryReader() = default;
+    virtual bool read(BuildHistory &History) = 0;
+    virtual const Failable &getStatus() const = 0;
+  };
+
+  class BuildStateWriter {
+  public:
+    virtual ~BuildStateWriter() = default;
+    virtual void writeAndFinalize(const BuildState &State) = 0;
+  };
+
+  class BuildStateReader {
+  public:
+    virtual ~BuildStateReader() = default;
+    virtual bool read(BuildState &State) = 0;
+    virtual const Failable &getStatus() const = 0;
+  };
+
   enum DependenciesRecordTypes {
       DEPS_INVALID_RECORD_ID = 0,
       DEPS_DECLARATION_RECORD_ID = 1,
@@ -168,14 +196,78 @@ namespace levitation {
     META_TOP_LEVEL_FIELDS_RECORD_ID = 1,
     META_SOURCE_HASH_RECORD_ID,
     META_DECL_AST_HASH_RECORD_ID,
-    META_SKIPPED_FRAGMENT_RECORD_ID
+    META_SKIPPED_FRAGMENT_RECORD_ID,
+    META_INTERFACE_HASH_RECORD_ID,
+    META_DECL_HASH_RECORD_ID,
+
+    // Used decl records are applied to the last read dependency record.
+    META_USED_DECLS_DEPENDENCY_RECORD_ID,
+    META_USED_DECL_RECORD_ID,
+
+    // Record version and hash algorithm, absent for MD5.
+    META_HASH_KIND_RECORD_ID,
+
+    // Include hash record is applied to the last read include record.
+    META_INCLUDE_RECORD_ID,
+    META_INCLUDE_HASH_RECORD_ID,
+
+    // Fingerprint of compiler and flags, absent if unknown.
+    META_COMMAND_HASH_RECORD_ID,
+
+    // Present if unit definition emits no code.
+    META_CODELESS_RECORD_ID
   };
 
+  /// Layout version of META_HASH_KIND_RECORD_ID, bumped once
+  /// hash record is changed.
+  enum { META_HASH_KIND_VERSION = 1 };
+
   /// Describes the various kinds of blocks that occur within
   /// an Dependencies file.
   enum MetaBlockIDs {
     META_ARRAYS_BLOCK_ID = FIRST_VALID_BLOCK_ID,
-    META_SKIPPED_FRAGMENT_BLOCK_ID
+    META_SKIPPED_FRAGMENT_BLOCK_ID,
+    META_DECL_HASHES_BLOCK_ID,
+    META_USED_DECLS_BLOCK_ID,
+    META_INCLUDES_BLOCK_ID
+  };
+
+  enum BuildHistoryRecordTypes {
+    HISTORY_INVALID_RECORD_ID = 0,
+    HISTORY_STEP_RECORD_ID = 1,
+    HISTORY_PEAK_MEMORY_RECORD_ID = 2,
+    HISTORY_INTERFACE_CHANGES_RECORD_ID = 3
+  };
+
+  enum BuildHistoryBlockIDs {
+    HISTORY_MAIN_BLOCK_ID = FIRST_VALID_BLOCK_ID
+  };
+
+  enum BuildStateRecordTypes {
+    STATE_INVALID_RECORD_ID = 0,
+    STATE_PRODUCT_RECORD_ID = 1,
+
+    // Hash and include records are applied to the last read product record.
+    STATE_SOURCE_HASH_RECORD_ID,
+    STATE_PRODUCT_HASH_RECORD_ID,
+    STATE_INCLUDE_RECORD_ID,
+    STATE_COMMAND_HASH_RECORD_ID
+  };
+
+  enum BuildStateBlockIDs {
+    STATE_MAIN_BLOCK_ID = FIRST_VALID_BLOCK_ID
+  };
+
+  /// Top level block which carries declaration AST meta, once it is
+  /// appended to declaration AST itself, see writeEmbeddedMeta.
+  /// AST readers stop at AST block, so they never reach it.
+  enum EmbeddedMetaBlockIDs {
+    EMBEDDED_META_BLOCK_ID = llvm::bitc::FIRST_APPLICATION_BLOCKID + 64
+  };
+
+  enum EmbeddedMetaRecordTypes {
+    EMBEDDED_META_INVALID_RECORD_ID = 0,
+    EMBEDDED_META_RECORD_ID = 1
   };
 
   std::unique_ptr<DependenciesWriter> CreateBitstreamWriter(llvm::raw_ostream &OS);
@@ -184,6 +276,24 @@ namespace levitation {
   std::unique_ptr<DeclASTMetaWriter> CreateMetaBitstreamWriter(llvm::raw_ostream &OS);
   std::unique_ptr<DeclASTMetaReader> CreateMetaBitstreamReader(const llvm::MemoryBuffer &MemBuf);
 
+  std::unique_ptr<BuildHistoryWriter> CreateBuildHistoryBitstreamWriter(llvm::raw_ostream &OS);
+  std::unique_ptr<BuildHistoryReader> CreateBuildHistoryBitstreamReader(const llvm::MemoryBuffer &MemBuf);
+
+  std::unique_ptr<BuildStateWriter> CreateBuildStateBitstreamWriter(llvm::raw_ostream &OS);
+  std::unique_ptr<BuildStateReader> CreateBuildStateBitstreamReader(const llvm::MemoryBuffer &MemBuf);
+
+  /// Appends meta written by meta writer to word aligned bitstream
+  /// file, as single blob record of EMBEDDED_META_BLOCK_ID block.
+  /// Blob ends with meta size and magic number, and block ends
+  /// with single END_BLOCK word, so meta is found from the file end,
+  /// without walking through preceding blocks.
+  void writeEmbeddedMeta(llvm::raw_ostream &OS, llvm::StringRef MetaBytes);
+
+  /// Finds meta appended by writeEmbeddedMeta.
+  /// \return false if Buffer has no embedded meta, e.g.
+  ///   if it is stand-alone meta file.
+  bool findEmbeddedMeta(llvm::StringRef Buffer, llvm::StringRef &MetaBytes);
+
 }
 }
 
@@ -0,0 +1,281 @@
+//===--- C++ Levitation ConcurrencyController.h ---------------*- C++ -*-===//
+//
+// Part of the C++ Levitation Project,
+// under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file defines C++ Levitation ConcurrencyController class, which
+//  adjusts TasksManager jobs limit at runtime, see '-j auto'.
+//
+//  Controller periodically samples Linux pressure stall information
+//  (/proc/pressure/{cpu,memory,io}) and jobs throughput. Limit goes down
+//  as soon as memory or I/O stalls appear, before host starts swapping,
+//  and goes up one slot at a time while jobs are throttled and cores are
+//  idle. Increase which hasn't improved throughput is rolled back.
+//  Without PSI, only throughput is used.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_CLANG_LEVITATION_CONCURRENCYCONTROLLER_H
+#define LLVM_CLANG_LEVITATION_CONCURRENCYCONTROLLER_H
+
+#include "clang/Levitation/Common/SimpleLogger.h"
+#include "clang/Levitation/Common/Thread.h"
+#include "clang/Levitation/TasksManager/TasksManager.h"
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace clang { namespace levitation { namespace tasks {
+
+class ConcurrencyController {
+public:
+
+  /// Share of time, in percents, some or all tasks were stalled
+  /// on resource during last 10 seconds, i.e. 'avg10' values.
+  struct Pressure {
+    double Some = 0;
+    double Full = 0;
+  };
+
+  struct Sample {
+    bool HasPSI = false;
+    Pressure CPU;
+    Pressure Memory;
+    Pressure IO;
+
+    /// Jobs completed per second.
+    double Throughput = 0;
+
+    /// Whether some jobs were waiting for slot since last sample,
+    /// so that greater limit would be used.
+    bool Throttled = false;
+  };
+
+  struct State {
+    unsigned Limit = 1;
+    unsigned Min = 1;
+    unsigned Max = 1;
+
+    /// Throughput before last change of limit.
+    double LastThroughput = 0;
+
+    /// Whether last change was an increase, which is to be
+    /// checked against throughput.
+    bool Probing = false;
+
+    /// Samples to skip before next increase.
+    unsigned Cooldown = 0;
+  };
+
+  // Thresholds are avg10 percents. Memory stalls mean reclaim has
+  // started, so reaction is immediate and multiplicative.
+  static constexpr double MemorySomeHigh = 10.;
+  static constexpr double MemoryFullHigh = 1.;
+  static constexpr double IOFullHigh = 20.;
+  static constexpr double CPUSomeLow = 50.;
+
+  /// Samples to hold limit after it was lowered or rolled back.
+  static constexpr unsigned CooldownSamples = 5;
+
+private:
+
+  TasksManager &TM;
+  State St;
+  std::chrono::milliseconds Interval;
+
+  bool StopRequested = false;
+  std::mutex StopLocker;
+  std::condition_variable StopNotifier;
+  std::thread Thread;
+
+  log::Logger &Log;
+
+  static bool readPressure(llvm::StringRef Resource, Pressure &Res) {
+    auto Buffer = llvm::MemoryBuffer::getFileAsStream(
+        "/proc/pressure/" + Resource
+    );
+    return Buffer && parsePressure(Buffer.get()->getBuffer(), Res);
+  }
+
+  void run() {
+    uint64_t LastCompleted = TM.getNumCompletedJobs();
+    uint64_t LastThrottled = TM.getNumThrottledJobs();
+    auto LastTime = std::chrono::steady_clock::now();
+
+    while (true) {
+      {
+        auto locker = lock(StopLocker);
+        if (StopNotifier.wait_for(locker, Interval, [&] { return StopRequested; }))
+          return;
+      }
+
+      Sample S;
+      S.HasPSI =
+          readPressure("cpu", S.CPU) &&
+          readPressure("memory", S.Memory) &&
+          readPressure("io", S.IO);
+
+      auto Now = std::chrono::steady_clock::now();
+      double Seconds = std::chrono::duration<double>(Now - LastTime).count();
+      uint64_t Completed = TM.getNumCompletedJobs();
+      uint64_t Throttled = TM.getNumThrottledJobs();
+
+      S.Throughput = Seconds > 0 ? (Completed - LastCompleted) / Seconds : 0;
+      S.Throttled = Throttled != LastThrottled;
+
+      LastCompleted = Completed;
+      LastThrottled = Throttled;
+      LastTime = Now;
+
+      unsigned OldLimit = St.Limit;
+      unsigned NewLimit = adjust(St, S);
+      if (NewLimit == OldLimit)
+        continue;
+
+      Log.log_verbose(
+          "Jobs limit: ", OldLimit, " -> ", NewLimit,
+          " (throughput ", S.Throughput, " jobs/s, pressure cpu ", S.CPU.Some,
+          "%, memory ", S.Memory.Some, "/", S.Memory.Full,
+          "%, io ", S.IO.Some, "/", S.IO.Full, "%)."
+      );
+      TM.setJobsLimit(NewLimit);
+    }
+  }
+
+public:
+
+  /// Starts controller, which keeps limit of given tasks manager
+  /// in range [Min, Max].
+  ConcurrencyController(
+      TasksManager &tm,
+      unsigned Min,
+      unsigned Max,
+      unsigned Initial,
+      std::chrono::milliseconds interval = std::chrono::milliseconds(2000)
+  )
+  : TM(tm), Interval(interval), Log(log::Logger::get()) {
+    St.Min = std::max(Min, 1u);
+    St.Max = std::max(Max, St.Min);
+    St.Limit = std::min(std::max(Initial, St.Min), St.Max);
+    TM.setJobsLimit(St.Limit);
+    Thread = std::thread([this] { run(); });
+  }
+
+  ~ConcurrencyController() {
+    {
+      auto _ = lock(StopLocker);
+      StopRequested = true;
+    }
+    StopNotifier.notify_all();
+    Thread.join();
+  }
+
+  unsigned getLimit() const { return St.Limit; }
+
+  /// Parses PSI file contents, e.g.
+  /// "some avg10=1.50 avg60=0.90 avg300=0.20 total=12345".
+  /// Missing "full" line (older kernels' cpu file) means zero.
+  /// \return false if "some" line is missing or malformed.
+  static bool parsePressure(llvm::StringRef Content, Pressure &Res) {
+    Res = Pressure();
+    bool HasSome = false;
+
+    llvm::SmallVector<llvm::StringRef, 2> Lines;
+    Content.split(Lines, '\n', -1, /*KeepEmpty=*/false);
+
+    for (auto Line : Lines) {
+      llvm::StringRef Kind, Values;
+      std::tie(Kind, Values) = Line.trim().split(' ');
+
+      double *Dest = Kind == "some" ? &Res.Some :
+                     Kind == "full" ? &Res.Full : nullptr;
+      if (!Dest)
+        continue;
+
+      llvm::StringRef Avg10 = Values.trim().split(' ').first;
+      if (!Avg10.consume_front("avg10="))
+        return false;
+
+      // StringRef has no floating point parser which could report
+      // errors, so value is validated by strtod end pointer.
+      std::string Str = Avg10.str();
+      char *End;
+      *Dest = std::strtod(Str.c_str(), &End);
+      if (End != Str.c_str() + Str.size())
+        return false;
+
+      if (Dest == &Res.Some)
+        HasSome = true;
+    }
+
+    return HasSome;
+  }
+
+  /// Computes next limit for given sample.
+  /// \return new limit, also stored in S.
+  static unsigned adjust(State &S, const Sample &Smp) {
+    auto Lower = [&] (unsigned To) {
+      S.Limit = std::max(To, S.Min);
+      S.Probing = false;
+      S.Cooldown = CooldownSamples;
+    };
+
+    // Memory pressure is never waited out: next step is swapping,
+    // or OOM killer.
+    if (
+      Smp.HasPSI &&
+      (Smp.Memory.Some > MemorySomeHigh || Smp.Memory.Full > MemoryFullHigh)
+    ) {
+      Lower(std::min(S.Limit * 3 / 4, S.Limit - 1));
+      S.LastThroughput = Smp.Throughput;
+      return S.Limit;
+    }
+
+    if (Smp.HasPSI && Smp.IO.Full > IOFullHigh) {
+      Lower(S.Limit - 1);
+      S.LastThroughput = Smp.Throughput;
+      return S.Limit;
+    }
+
+    // Extra job was added, but jobs don't complete faster:
+    // host is saturated by something else, e.g. memory bandwidth.
+    if (S.Probing && Smp.Throughput < S.LastThroughput) {
+      Lower(S.Limit - 1);
+      S.LastThroughput = Smp.Throughput;
+      return S.Limit;
+    }
+
+    S.Probing = false;
+    S.LastThroughput = Smp.Throughput;
+
+    if (S.Cooldown) {
+      --S.Cooldown;
+      return S.Limit;
+    }
+
+    bool CPUIdle = !Smp.HasPSI || Smp.CPU.Some < CPUSomeLow;
+    if (Smp.Throttled && CPUIdle && S.Limit < S.Max) {
+      ++S.Limit;
+      S.Probing = true;
+    }
+
+    return S.Limit;
+  }
+};
+
+}}}
+
+#endif //LLVM_CLANG_LEVITATION_CONCURRENCYCONTROLLER_H
@@ -19,10 +19,16 @@
 #include "clang/Levitation/Common/SimpleLogger.h"
 #include "clang/Levitation/Common/Thread.h"
 #include "clang/Levitation/Common/WithOperator.h"
+#include "clang/Levitation/TasksManager/WorkerPlacement.h"
 
 #include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
 
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <deque>
 #include <memory>
@@ -32,6 +38,7 @@
 #include <unordered_map>
 #include <unordered_set>
 #include <utility>
+#include <vector>
 
 namespace clang { namespace levitation { namespace tasks {
 
@@ -47,6 +54,7 @@ public:
   };
 
   enum struct TaskStatus {
+    Waiting = -4,
     Unknown = -3,
     Registered = -2,
     Pending = -1,
@@ -58,6 +66,45 @@ public:
   using ActionFn = std::function<void(TaskContext&)>;
   using TasksSet = llvm::DenseSet<TaskID>;
 
+  /// Lightweight handle of registered task. Instead of blocking
+  /// until task is complete, caller may attach continuation to it.
+  /// Implicitly converts to TaskID, so it may be used wherever
+  /// task ID is expected.
+  class Future {
+    TasksManager *TM;
+    TaskID ID;
+
+  public:
+    Future(TasksManager *tm, TaskID id) : TM(tm), ID(id) {}
+
+    TaskID getID() const { return ID; }
+
+    operator TaskID() const { return ID; }
+
+    /// Registers task which is executed once this one is successfully
+    /// complete. If this task fails, continuation fails too,
+    /// without being executed.
+    Future then(ActionFn &&Fn) const {
+      return TM->whenAll({ID}, std::move(Fn));
+    }
+
+    /// Blocks until task is complete.
+    /// \return true if task was successful.
+    bool get() const {
+      return TM->waitForTasks({ID}) && TM->allSuccessfull({ID});
+    }
+  };
+
+  enum struct QueueKind {
+    /// Single pending tasks queue shared by all workers.
+    Shared,
+
+    /// Each worker owns its own queue. It pushes and pops tasks
+    /// from its back, and if it has nothing to do, it steals
+    /// tasks from the front of peer's queue.
+    WorkStealing
+  };
+
 private:
 
   enum struct RegisterAction {
@@ -66,28 +113,34 @@ private:
     PushIfHaveFreeWorker
   };
 
+  /// Task slot. Slots are owned by slab and reused by new tasks
+  /// as soon as their previous tasks are complete.
   struct Task {
-
-    Task(TaskID tid, ActionFn &&action)
-    : ID(tid), Action(std::move(action))
-    {}
-
-    TaskID ID;
+    TaskID ID = -1;
     ActionFn Action;
-    TaskStatus Status = TaskStatus::Unknown;
-
-    bool isComplete() {
-      return Status == TaskStatus::Failed ||
-             Status == TaskStatus::Successful;
-    }
+    std::atomic<TaskStatus> Status { TaskStatus::Unknown };
+
+    // Continuation part, protected by StatusLocker.
+    // Waiting task can't complete before its predecessors, so
+    // predecessors may keep pointers to its slot.
+    unsigned NumWaitedFor = 0;
+    bool PredecessorFailed = false;
+    llvm::SmallVector<Task*, 2> Continuations;
   };
 
   using TaskPtrTy = std::unique_ptr<Task>;
-  using TasksSetInternal = std::unordered_map<TaskID, TaskPtrTy>;
 
-  levitation::log::Logger &Log;
+  /// Not yet complete tasks, keyed by task ID.
+  using TasksSetInternal = llvm::DenseMap<TaskID, Task*>;
+
+  struct WorkerQueue {
+    std::mutex Locker;
+    std::deque<TaskID> Tasks;
+  };
 
   int WorkesNumber;
+  QueueKind Kind;
+  WorkerPlacement Placement;
 
   std::mutex WorkerIDsLocker;
   std::mutex StatusLocker;
@@ -98,27 +151,93 @@ private:
 
   int NextTaskID = 0;
 
+  // Slab of task slots and its free list, protected by TasksLocker.
+  // Number of slots is bounded by maximum number of incomplete tasks.
+  std::vector<TaskPtrTy> Slots;
+  std::vector<Task*> FreeSlots;
   TasksSetInternal Tasks;
+
+  // Complete tasks don't occupy slots, so we only remember which of them
+  // failed, everything else complete is successful.
+  // Protected by StatusLocker.
+  llvm::DenseSet<TaskID> FailedTasks;
+  std::atomic<unsigned> NumRegisteredTasks { 0 };
+  std::atomic<unsigned> NumCompleteTasks { 0 };
+
   std::deque<TaskID> PendingTasks;
 
-  bool TerminationRequested = false;
+  // Continuations which became ready while manager without workers
+  // executed a task. They are executed one by one by the outermost
+  // caller, since otherwise long chains would grow the stack.
+  std::deque<Task*> InlineTasks;
+  bool RunningInline = false;
+
+  // Work stealing queues, one per worker.
+  std::vector<std::unique_ptr<WorkerQueue>> WorkerQueues;
+  std::atomic<unsigned> NextWorkerQueue { 0 };
+  std::atomic<unsigned> NumPendingTasks { 0 };
+  std::atomic<unsigned> NumSleepingWorkers { 0 };
+  std::mutex SleepLocker;
+
+  std::atomic<bool> TerminationRequested { false };
+  std::atomic<bool> CancellationRequested { false };
   WorkerID NextWorkerId = 0;
-  unsigned NumFreeWorkers = 0;
+  std::atomic<unsigned> NumFreeWorkers { 0 };
+
+  // Time, in microseconds, callers spent blocked in waitForTasks,
+  // and workers spent waiting for tasks, see --stats.
+  std::atomic<uint64_t> WaitTime { 0 };
+  std::atomic<uint64_t> IdleTime { 0 };
   std::unordered_set<std::unique_ptr<std::thread>> Workers;
   std::unordered_map<std::thread::id, WorkerID> WorkerIDs;
 
+  // Memory budget, in bytes, 0 means unlimited.
+  uint64_t MemoryBudget = 0;
+  uint64_t MemoryInUse = 0;
+  unsigned NumMemoryHolders = 0;
+  std::mutex MemoryLocker;
+  std::condition_variable MemoryNotifier;
+
+  // Jobs slots, 0 means unlimited, see -j auto.
+  unsigned JobsLimit = 0;
+  unsigned JobsInUse = 0;
+  std::mutex JobsLocker;
+  std::condition_variable JobsNotifier;
+  std::atomic<uint64_t> NumCompletedJobs { 0 };
+  std::atomic<uint64_t> NumThrottledJobs { 0 };
+
+  // Jobs slots of named pools, see -pool.
+  struct Pool {
+    unsigned Limit = 0;
+    unsigned InUse = 0;
+  };
+  llvm::StringMap<Pool> Pools;
+
 public:
 
-  TasksManager(int jobsNumber)
-  : Log(log::Logger::get()),
-    WorkesNumber(jobsNumber)
+  /// \param placement how workers are split between NUMA nodes,
+  /// only used with work stealing queues.
+  TasksManager(
+      int jobsNumber,
+      QueueKind kind = QueueKind::Shared,
+      WorkerPlacement placement = WorkerPlacement()
+  )
+  : WorkesNumber(jobsNumber),
+    // Without workers there is nobody to steal from.
+    Kind(jobsNumber ? kind : QueueKind::Shared),
+    Placement(std::move(placement))
   {
+    if (Kind == QueueKind::WorkStealing)
+      for (int j = 0; j != WorkesNumber; ++j)
+        WorkerQueues.emplace_back(new WorkerQueue());
+
     runWorkers();
   }
 
   ~TasksManager() {
     {
       auto locker = lockTasks();
+      auto sleepLocker = lockSleep();
       TerminationRequested = true;
     }
     QueueNotifier.notify_all();
@@ -137,17 +256,18 @@ public:
    * workers queue and execution will be continued.
    * If this flag is false, then task will be registered
    * and executed immediately in same thread.
-   * @return task ID
+   * @return task future
    */
-  TaskID addTask(ActionFn &&Fn, bool SameThread = false) {
+  Future addTask(ActionFn &&Fn, bool SameThread = false) {
     auto RegAction = SameThread ?
         RegisterAction::RegisterOnly : RegisterAction::Push;
 
-    Task *Tsk = registerTask(std::move(Fn), RegAction);
-    if (SameThread) {
+    TaskID TID;
+    Task *Tsk = registerTask(std::move(Fn), RegAction, TID);
+    if (Tsk) {
       executeTask(*Tsk);
     }
-    return Tsk->ID;
+    return Future(this, TID);
   }
 
   /**
@@ -156,14 +276,91 @@ public:
    * queue and continue main thread execution.
    * Otherwise, it will execute task in current thread.
    * @param Fn action to be executed
-   * @return task ID
+   * @param Domain if valid, task is queued to worker of this domain,
+   * see getWorkerDomain. Idle workers of other domains may still
+   * steal it.
+   * @return task future
    */
-  TaskID runTask(ActionFn &&Fn) {
-    Task *Tsk = registerTask(std::move(Fn), RegisterAction::PushIfHaveFreeWorker);
-    if (Tsk->Status == TaskStatus::Registered) {
+  Future runTask(ActionFn &&Fn, int Domain = -1) {
+    TaskID TID;
+    Task *Tsk = registerTask(
+        std::move(Fn), RegisterAction::PushIfHaveFreeWorker, TID, Domain
+    );
+    if (Tsk) {
       executeTask(*Tsk);
     }
-    return Tsk->ID;
+    return Future(this, TID);
+  }
+
+  /**
+   * Registers task which is executed once all given tasks are
+   * successfully complete. Nobody is blocked while it waits, task is
+   * queued by the worker which completes its last predecessor.
+   * If any of predecessors fails, task fails without being executed.
+   * Unknown tasks are not waited for.
+   * @param Predecessors tasks to wait for
+   * @param Fn action to be executed, if empty, then task is just a barrier
+   * @return task future
+   */
+  Future whenAll(const TasksSet &Predecessors, ActionFn &&Fn = nullptr) {
+    Task *Tsk;
+    TaskID TID;
+    bool Ready;
+
+    with (auto statusLocker = lockStatus()) {
+      auto tasksLocker = lockTasks();
+
+      TID = NextTaskID++;
+
+      Tsk = allocateSlot();
+      Tsk->ID = TID;
+      Tsk->Action = std::move(Fn);
+      Tsk->Status = TaskStatus::Waiting;
+
+      auto Res = Tasks.insert({TID, Tsk});
+      if (!Res.second)
+        llvm_unreachable("Expected that task is not registered yet.");
+
+      ++NumRegisteredTasks;
+
+      for (auto PID : Predecessors) {
+        auto Found = Tasks.find(PID);
+        if (Found != Tasks.end()) {
+          Found->second->Continuations.push_back(Tsk);
+          ++Tsk->NumWaitedFor;
+        } else if (FailedTasks.count(PID)) {
+          Tsk->PredecessorFailed = true;
+        }
+      }
+
+      log("Registered task ", str(*Tsk), ", waits for ",
+          Tsk->NumWaitedFor, " tasks.");
+
+      Ready = !Tsk->NumWaitedFor;
+    }
+
+    // Otherwise task belongs to whoever completes its last predecessor.
+    if (Ready) {
+      if (Tsk->PredecessorFailed || !Tsk->Action) {
+        Tsk->Action = nullptr;
+        completeTask(*Tsk, !Tsk->PredecessorFailed);
+      } else {
+        scheduleTask(*Tsk);
+      }
+    }
+
+    return Future(this, TID);
+  }
+
+  Future whenAll(
+      const std::initializer_list<TaskID> &v,
+      ActionFn &&Fn = nullptr
+  ) {
+    TasksSet Tasks;
+    for (TaskID TID : v) {
+      Tasks.insert(TID);
+    }
+    return whenAll(Tasks, std::move(Fn));
   }
 
   WorkerID getWorkerID() {
@@ -179,6 +376,161 @@ public:
     return getInvalidWorkerID();
   }
 
+  /// \return number of worker threads, 0 if tasks are run
+  /// by threads which start them.
+  int getWorkersNumber() const {
+    return WorkesNumber;
+  }
+
+  /// \return number of domains workers are split between,
+  /// 1 if workers are not placed.
+  unsigned getNumDomains() const {
+    return Kind == QueueKind::WorkStealing ? Placement.getNumDomains() : 1;
+  }
+
+  /// \return domain (NUMA node) of given worker, or -1 for
+  /// invalid worker, e.g. for main thread.
+  int getWorkerDomain(WorkerID WID) const {
+    return isValid(WID) ? (int)Placement.getDomain(WID) : -1;
+  }
+
+  /// Requests cancellation of not yet started work. Pending tasks are
+  /// still executed, since their owners may wait for them, but they are
+  /// expected to check isCancelled() and finish as soon as possible.
+  void cancel() {
+    CancellationRequested = true;
+  }
+
+  bool isCancelled() const {
+    return CancellationRequested;
+  }
+
+  /// Clears cancellation request, e.g. before next watch mode build.
+  void resetCancellation() {
+    CancellationRequested = false;
+  }
+
+  /// Sets amount of memory jobs may use together.
+  /// \param Bytes budget in bytes, 0 means unlimited.
+  void setMemoryBudget(uint64_t Bytes) {
+    auto _ = lock(MemoryLocker);
+    MemoryBudget = Bytes;
+    MemoryNotifier.notify_all();
+  }
+
+  uint64_t getMemoryBudget() const {
+    return MemoryBudget;
+  }
+
+  /// Blocks until job with given expected memory usage fits into
+  /// memory budget. Job is always admitted if nobody else holds memory,
+  /// so jobs greater than budget still run, but only one at a time.
+  /// Every call should be paired with releaseMemory.
+  /// \param Bytes expected memory usage, 0 if unknown.
+  void acquireMemory(uint64_t Bytes) {
+    auto locker = lock(MemoryLocker);
+    MemoryNotifier.wait(locker, [&] {
+      return !MemoryBudget ||
+             !NumMemoryHolders ||
+             MemoryInUse + Bytes <= MemoryBudget;
+    });
+    MemoryInUse += Bytes;
+    ++NumMemoryHolders;
+  }
+
+  void releaseMemory(uint64_t Bytes) {
+    {
+      auto _ = lock(MemoryLocker);
+      MemoryInUse -= Bytes;
+      --NumMemoryHolders;
+    }
+    MemoryNotifier.notify_all();
+  }
+
+  /// Sets number of jobs which may run at once, may be changed
+  /// while jobs are running. Running jobs are never interrupted,
+  /// lower limit only holds back new ones.
+  /// \param Limit jobs number, 0 means unlimited.
+  void setJobsLimit(unsigned Limit) {
+    {
+      auto _ = lock(JobsLocker);
+      JobsLimit = Limit;
+    }
+    JobsNotifier.notify_all();
+  }
+
+  unsigned getJobsLimit() const {
+    return JobsLimit;
+  }
+
+  /// Sets number of jobs of given pool which may run at once,
+  /// in addition to jobs limit. Should be called before jobs
+  /// are run.
+  /// \param Limit jobs number, 0 means unlimited.
+  void setPoolLimit(llvm::StringRef Name, unsigned Limit) {
+    {
+      auto _ = lock(JobsLocker);
+      Pools[Name].Limit = Limit;
+    }
+    JobsNotifier.notify_all();
+  }
+
+  /// Blocks until job fits into jobs limit, and into limit of its pool.
+  /// Every call should be paired with releaseJob.
+  /// \param PoolName pool of job, pools without limit are unlimited.
+  void acquireJob(llvm::StringRef PoolName = llvm::StringRef()) {
+    auto locker = lock(JobsLocker);
+
+    auto PoolIt = Pools.find(PoolName);
+    Pool *P = PoolIt != Pools.end() ? &PoolIt->second : nullptr;
+
+    auto FitsLimit = [&] {
+      return !JobsLimit || JobsInUse < JobsLimit;
+    };
+    auto FitsPool = [&] {
+      return !P || !P->Limit || P->InUse < P->Limit;
+    };
+
+    // Only jobs limit tells whether more jobs would run at once,
+    // pool is limited on purpose.
+    if (!FitsLimit())
+      ++NumThrottledJobs;
+
+    JobsNotifier.wait(locker, [&] { return FitsLimit() && FitsPool(); });
+
+    ++JobsInUse;
+    if (P)
+      ++P->InUse;
+  }
+
+  void releaseJob(llvm::StringRef PoolName = llvm::StringRef()) {
+    {
+      auto _ = lock(JobsLocker);
+      --JobsInUse;
+      auto PoolIt = Pools.find(PoolName);
+      if (PoolIt != Pools.end())
+        --PoolIt->second.InUse;
+    }
+    ++NumCompletedJobs;
+
+    // Waiters of different pools wait for different slots.
+    JobsNotifier.notify_all();
+  }
+
+  /// \return number of jobs released since start.
+  uint64_t getNumCompletedJobs() const { return NumCompletedJobs; }
+
+  /// \return number of jobs which had to wait for jobs limit.
+  uint64_t getNumThrottledJobs() const { return NumThrottledJobs; }
+
+  /// \return total time, in microseconds, callers were blocked
+  /// in waitForTasks.
+  uint64_t getWaitTime() const { return WaitTime; }
+
+  /// \return total time, in microseconds, workers were waiting
+  /// for tasks.
+  uint64_t getIdleTime() const { return IdleTime; }
+
   static WorkerID getInvalidWorkerID() {
     return -1;
   }
@@ -190,13 +542,12 @@ public:
 
   TaskStatus getTaskStatus(TaskID TID) {
     auto _ = lockStatus();
-    auto __ = lockTasks();
 
-    auto Found = Tasks.find(TID);
-    if (Found == Tasks.end())
+    auto Status = getTaskStatusLocked(TID);
+    if (Status == TaskStatus::Unknown)
       llvm_unreachable("Expected to provide with valid TID");
 
-    return Tasks[TID]->Status;
+    return Status;
   }
 
   bool allSuccessfull(const std::initializer_list<TaskID> &v) {
@@ -208,12 +559,9 @@ public:
   }
 
   bool allSuccessfull(const TasksSet &tasksSet) {
+    auto _ = lockStatus();
     for (const auto &TID : tasksSet) {
-      auto Found = Tasks.find(TID);
-      if (Found == Tasks.end())
-        return false;
-
-      if (Found->second->Status != TaskStatus::Successful)
+      if (getTaskStatusLocked(TID) != TaskStatus::Successful)
         return false;
     }
     return true;
@@ -231,16 +579,19 @@ public:
 
     log("Waiting for some tasks to be completed.");
 
+    auto Start = ClockTy::now();
     auto locker = lockStatus();
     TaskFinishedNotifier.wait(locker, [&] {
+      // Unknown tasks are not waited for.
       for (auto TID : tasksSet) {
-        auto Found = Tasks.find(TID);
-        if (Found != Tasks.end() && !Found->second->isComplete())
+        auto Status = getTaskStatusLocked(TID);
+        if (Status != TaskStatus::Unknown && !isComplete(Status))
           return false;
       }
       return true;
     });
 
+    addElapsed(WaitTime, Start);
     return true;
   }
 
@@ -248,19 +599,16 @@ public:
 
     log("Waiting for all tasks to be completed.");
 
+    auto Start = ClockTy::now();
     auto locker = lockStatus();
     TaskFinishedNotifier.wait(locker, [&] {
-      log("Checking...");
-      for (auto &kv : Tasks) {
-        if (!kv.second->isComplete()) {
-          log("Task ", kv.first, " is in progress");
-          return false;
-        }
-      }
-      log("Checking: All tasks complete!");
-      return true;
+      unsigned NumComplete = NumCompleteTasks;
+      unsigned NumRegistered = NumRegisteredTasks;
+      log("Checking: ", NumComplete, " of ", NumRegistered, " complete.");
+      return NumComplete == NumRegistered;
     });
 
+    addElapsed(WaitTime, Start);
     log("Waiting task complete.");
 
     return true;
@@ -268,9 +616,23 @@ public:
 
 protected:
 
+  using ClockTy = std::chrono::steady_clock;
+
+  static void addElapsed(
+      std::atomic<uint64_t> &Counter,
+      ClockTy::time_point Start
+  ) {
+    Counter += std::chrono::duration_cast<std::chrono::microseconds>(
+        ClockTy::now() - Start
+    ).count();
+  }
+
   log::manipulator_t str(TasksManager::TaskStatus v) {
     return [=] (llvm::raw_ostream &out) {
       switch (v) {
+        case TaskStatus::Waiting:
+          out << "Waiting";
+          break;
         case TaskStatus::Pending:
           out << "Pending";
           break;
@@ -293,19 +655,60 @@ protected:
     };
   }
 
-  log::manipulator_t str(TasksManager::Task v) {
+  log::manipulator_t str(const TasksManager::Task &v) {
+    TaskID ID = v.ID;
+    TaskStatus Status = v.Status;
     return [=] (llvm::raw_ostream &out) {
       out
-      << "{ ID:" << v.ID << ", ";
-      str(v.Status)(out);
+      << "{ ID:" << ID << ", ";
+      str(Status)(out);
       out
       << "}";
     };
   }
 
+  static bool isComplete(TaskStatus Status) {
+    return Status == TaskStatus::Failed ||
+           Status == TaskStatus::Successful;
+  }
+
+  /// Returns status of task, StatusLocker should be locked.
+  /// Task which is neither registered nor complete has unknown status.
+  TaskStatus getTaskStatusLocked(TaskID TID) {
+    {
+      auto _ = lockTasks();
+      auto Found = Tasks.find(TID);
+      if (Found != Tasks.end())
+        return Found->second->Status;
+
+      if (TID < 0 || TID >= NextTaskID)
+        return TaskStatus::Unknown;
+    }
+
+    return FailedTasks.count(TID) ?
+        TaskStatus::Failed : TaskStatus::Successful;
+  }
+
+  /// Takes free slot or allocates new one, TasksLocker should be locked.
+  Task *allocateSlot() {
+    if (FreeSlots.size()) {
+      Task *Slot = FreeSlots.back();
+      FreeSlots.pop_back();
+      Slot->NumWaitedFor = 0;
+      Slot->PredecessorFailed = false;
+      return Slot;
+    }
+
+    Slots.emplace_back(new Task());
+    return Slots.back().get();
+  }
+
   template <typename ...ArgsT>
   void logWorker(int Id, ArgsT&&...args) {
 #ifdef LEVITATION_ENABLE_TASK_MANAGER_LOGS
+    // Logger may be recreated during manager lifetime (e.g. by tests),
+    // so it is not cached.
+    auto &Log = log::Logger::get();
     if (Id != getInvalidWorkerID())
       Log.log_verbose("Worker[", Id, "]: ", std::forward<ArgsT>(args)...);
     else
@@ -330,20 +733,35 @@ protected:
     return lock(WorkerIDsLocker);
   }
 
-  Task* registerTask(ActionFn &&action, RegisterAction RegAction) {
+  /// Registers new task.
+  /// \param TID set to ID of registered task.
+  /// \return task if it should be executed by caller, or nullptr if
+  /// it was pushed into queue. Once task is in queue, its slot may be
+  /// reused as soon as task is complete, so caller should not keep it.
+  Task* registerTask(
+      ActionFn &&action,
+      RegisterAction RegAction,
+      TaskID &TID,
+      int Domain = -1
+  ) {
     {
       Task* TaskPtr = nullptr;
+      bool Pending;
       {
         auto tasksLocker = lockTasks();
 
-        TaskID TID = NextTaskID++;
+        TID = NextTaskID++;
 
-        TaskPtr = new Task(TID, std::move(action));
+        TaskPtr = allocateSlot();
+        TaskPtr->ID = TID;
+        TaskPtr->Action = std::move(action);
 
-        auto Res = Tasks.emplace(TID, TaskPtr);
+        auto Res = Tasks.insert({TID, TaskPtr});
         if (!Res.second)
           llvm_unreachable("Expected that task is not registered yet.");
 
+        ++NumRegisteredTasks;
+
         if (
           RegAction == RegisterAction::Push ||
           (
@@ -351,29 +769,42 @@ protected:
             NumFreeWorkers
           )
         ) {
-          PendingTasks.push_front(TID);
+          if (Kind == QueueKind::Shared)
+            PendingTasks.push_front(TID);
           TaskPtr->Status = TaskStatus::Pending;
         } else {
           TaskPtr->Status = TaskStatus::Registered;
         }
+
+        Pending = TaskPtr->Status == TaskStatus::Pending;
+
+        log("Registered task ", str(*TaskPtr));
       }
 
-      log("Registered task ", str(*TaskPtr));
+      if (!Pending)
+        return TaskPtr;
 
-      if (TaskPtr->Status == TaskStatus::Pending)
+      if (Kind == QueueKind::WorkStealing)
+        pushToWorkerQueue(TID, Domain);
+      else
         QueueNotifier.notify_one();
 
-      return TaskPtr;
+      return nullptr;
     }
   }
 
-  Task *getNextTask(bool *Terminated) {
+  Task *getNextTask(WorkerID MyId, bool *Terminated) {
+    if (Kind == QueueKind::WorkStealing)
+      return getNextTaskWorkStealing(MyId, Terminated);
+
     auto tasksLocker = lockTasks();
 
     ++NumFreeWorkers;
+    auto Start = ClockTy::now();
     QueueNotifier.wait(tasksLocker, [&] {
       return TerminationRequested || (bool)PendingTasks.size();
     });
+    addElapsed(IdleTime, Start);
 
     if (TerminationRequested) {
       *Terminated = true;
@@ -384,7 +815,116 @@ protected:
     auto PendingTaskID = PendingTasks.back();
     PendingTasks.pop_back();
 
-    Task *ptr = Tasks[PendingTaskID].get();
+    Task *ptr = Tasks.lookup(PendingTaskID);
+    assert(ptr);
+
+    return ptr;
+  }
+
+  MutexLock lockSleep() {
+    return lock(SleepLocker);
+  }
+
+  void pushToWorkerQueue(TaskID TID, int Domain = -1) {
+
+    // If task is added from worker, then put it into its own queue,
+    // otherwise distribute tasks across workers in round robin manner.
+    // Task which prefers other domain goes to worker of that domain.
+    WorkerID WID = getWorkerID();
+    unsigned QueueIdx = isValid(WID) ?
+        (unsigned)WID :
+        NextWorkerQueue++ % WorkerQueues.size();
+
+    if (Domain >= 0 && Domain != getWorkerDomain(WID)) {
+      int Worker = Placement.getWorkerOfDomain(
+          Domain, NextWorkerQueue++, WorkerQueues.size()
+      );
+      if (Worker >= 0)
+        QueueIdx = Worker;
+    }
+
+    WorkerQueue &Queue = *WorkerQueues[QueueIdx];
+    with (auto _ = lock(Queue.Locker)) {
+      Queue.Tasks.push_back(TID);
+    }
+
+    ++NumPendingTasks;
+
+    // Wake up somebody only if there are sleeping workers.
+    // Sleeping worker increments NumSleepingWorkers before it checks
+    // NumPendingTasks, so at least one of us will see the other's update.
+    if (NumSleepingWorkers) {
+      { auto _ = lockSleep(); }
+      QueueNotifier.notify_one();
+    }
+  }
+
+  bool popFromWorkerQueue(unsigned QueueIdx, bool Steal, TaskID &TID) {
+    WorkerQueue &Queue = *WorkerQueues[QueueIdx];
+    auto _ = lock(Queue.Locker);
+
+    if (Queue.Tasks.empty())
+      return false;
+
+    if (Steal) {
+      TID = Queue.Tasks.front();
+      Queue.Tasks.pop_front();
+    } else {
+      TID = Queue.Tasks.back();
+      Queue.Tasks.pop_back();
+    }
+
+    --NumPendingTasks;
+    return true;
+  }
+
+  bool tryGetWorkStealingTask(WorkerID MyId, TaskID &TID) {
+    if (popFromWorkerQueue(MyId, /*Steal=*/false, TID))
+      return true;
+
+    // Peers of same domain are robbed first,
+    // their tasks likely use same memory.
+    unsigned MyDomain = Placement.getDomain(MyId);
+    for (bool SameDomain : { true, false })
+      for (unsigned i = 1, e = WorkerQueues.size(); i < e; ++i) {
+        unsigned PeerIdx = (MyId + i) % e;
+        if ((Placement.getDomain(PeerIdx) == MyDomain) != SameDomain)
+          continue;
+        if (popFromWorkerQueue(PeerIdx, /*Steal=*/true, TID)) {
+          logWorker(MyId, "Stole task ", TID, " from worker ", PeerIdx);
+          return true;
+        }
+      }
+
+    return false;
+  }
+
+  Task *getNextTaskWorkStealing(WorkerID MyId, bool *Terminated) {
+    TaskID TID;
+
+    ++NumFreeWorkers;
+
+    while (!tryGetWorkStealingTask(MyId, TID)) {
+      auto sleepLocker = lockSleep();
+
+      ++NumSleepingWorkers;
+      auto Start = ClockTy::now();
+      QueueNotifier.wait(sleepLocker, [&] {
+        return TerminationRequested || NumPendingTasks;
+      });
+      addElapsed(IdleTime, Start);
+      --NumSleepingWorkers;
+
+      if (TerminationRequested) {
+        *Terminated = true;
+        return nullptr;
+      }
+    }
+
+    --NumFreeWorkers;
+
+    auto tasksLocker = lockTasks();
+    Task *ptr = Tasks.lookup(TID);
     assert(ptr);
 
     return ptr;
@@ -402,15 +942,106 @@ protected:
 
     Tsk.Action(context);
 
-    {
-      auto locker = lockStatus();
-      Tsk.Status = context.Successful ?
-          TaskStatus::Successful : TaskStatus::Failed;
+    // Release everything action has captured before slot is reused.
+    Tsk.Action = nullptr;
 
-      log("Updated task status: ", str(Tsk));
+    completeTask(Tsk, context.Successful);
+  }
+
+  /// Sets final status of task and releases its slot, then
+  /// schedules continuations which have no more tasks to wait for.
+  void completeTask(Task &Tsk, bool Successful) {
+
+    // Failed continuations and barriers are complete right here,
+    // we use worklist, so that long chains don't grow the stack.
+    llvm::SmallVector<std::pair<Task*, bool>, 4> Complete;
+    llvm::SmallVector<Task*, 4> Ready;
+
+    Complete.push_back({&Tsk, Successful});
+
+    with (auto locker = lockStatus()) {
+      while (Complete.size()) {
+        Task &Cur = *Complete.back().first;
+        bool CurSuccessful = Complete.back().second;
+        Complete.pop_back();
+
+        Cur.Status = CurSuccessful ?
+            TaskStatus::Successful : TaskStatus::Failed;
+
+        log("Updated task status: ", str(Cur));
+
+        if (!CurSuccessful)
+          FailedTasks.insert(Cur.ID);
+
+        for (Task *C : Cur.Continuations) {
+          if (!CurSuccessful)
+            C->PredecessorFailed = true;
+
+          if (--C->NumWaitedFor)
+            continue;
+
+          if (C->PredecessorFailed || !C->Action) {
+            C->Action = nullptr;
+            Complete.push_back({C, !C->PredecessorFailed});
+          } else {
+            Ready.push_back(C);
+          }
+        }
+        Cur.Continuations.clear();
+
+        // Task is removed from table and counted as complete
+        // atomically for status readers.
+        {
+          auto tasksLocker = lockTasks();
+          Tasks.erase(Cur.ID);
+          FreeSlots.push_back(&Cur);
+        }
+
+        ++NumCompleteTasks;
+      }
     }
 
     TaskFinishedNotifier.notify_all();
+
+    for (Task *C : Ready)
+      scheduleTask(*C);
+  }
+
+  /// Pushes task which has no more tasks to wait for into queue.
+  /// If there are no workers, then executes it in current thread.
+  void scheduleTask(Task &Tsk) {
+    if (!WorkesNumber) {
+      runInline(Tsk);
+      return;
+    }
+
+    TaskID TID = Tsk.ID;
+
+    with (auto tasksLocker = lockTasks()) {
+      Tsk.Status = TaskStatus::Pending;
+      if (Kind == QueueKind::Shared)
+        PendingTasks.push_front(TID);
+    }
+
+    if (Kind == QueueKind::WorkStealing)
+      pushToWorkerQueue(TID);
+    else
+      QueueNotifier.notify_one();
+  }
+
+  void runInline(Task &Tsk) {
+    InlineTasks.push_back(&Tsk);
+
+    if (RunningInline)
+      return;
+
+    RunningInline = true;
+    while (InlineTasks.size()) {
+      Task *Next = InlineTasks.front();
+      InlineTasks.pop_front();
+      executeTask(*Next);
+    }
+    RunningInline = false;
   }
 
   void runWorkers() {
@@ -424,23 +1055,29 @@ protected:
         WorkerIDs.insert({std::this_thread::get_id(), MyId});
       }
 
+      unsigned MyDomain = Placement.getDomain(MyId);
+      if (Placement.Pin && !Placement.pinCurrentThread(MyDomain))
+        logWorker(MyId, "Failed to pin to domain ", MyDomain);
+
       logWorker(MyId, "Launched");
 
       while (true) {
         bool Terminated = false;
-        Task *TaskPtr = getNextTask(&Terminated);
+        Task *TaskPtr = getNextTask(MyId, &Terminated);
 
         if (Terminated) {
           break;
         }
 
         Task &Tsk = *TaskPtr;
+        TaskID TID = Tsk.ID;
 
         logWorker(MyId, "Got task ", str(Tsk));
 
+        // Slot may be reused once task is complete.
         executeTask(Tsk);
 
-        logWorker(MyId, "Finished task ", str(Tsk));
+        logWorker(MyId, "Finished task ", TID);
       }
 
       logWorker(MyId, "Stopped");
@@ -0,0 +1,167 @@
+//===--- C++ Levitation WorkerPlacement.h ---------------------*- C++ -*-===//
+//
+// Part of the C++ Levitation Project,
+// under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file defines C++ Levitation WorkerPlacement class, which splits
+//  TasksManager workers between NUMA nodes of host, and optionally pins
+//  them to CPUs of their nodes. Processes launched by pinned worker
+//  inherit its affinity, so jobs stay on same node too.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_CLANG_LEVITATION_WORKERPLACEMENT_H
+#define LLVM_CLANG_LEVITATION_WORKERPLACEMENT_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+namespace clang { namespace levitation { namespace tasks {
+
+struct WorkerPlacement {
+
+  /// CPUs of each domain (NUMA node), ordered by node number.
+  /// Empty if workers are not placed.
+  std::vector<std::vector<unsigned>> Domains;
+
+  /// Whether workers are pinned to CPUs of their domains.
+  bool Pin = false;
+
+  unsigned getNumDomains() const {
+    return std::max<size_t>(Domains.size(), 1);
+  }
+
+  /// Workers are split between domains round robin, so that each
+  /// domain gets same number of workers, whatever their number is.
+  unsigned getDomain(int WorkerID) const {
+    return (unsigned)WorkerID % getNumDomains();
+  }
+
+  /// \return worker of given domain, picked round robin by Seq,
+  /// or -1 if domain has no workers.
+  int getWorkerOfDomain(
+      unsigned Domain,
+      unsigned Seq,
+      unsigned NumWorkers
+  ) const {
+    unsigned N = getNumDomains();
+    if (Domain >= N || Domain >= NumWorkers)
+      return -1;
+    unsigned NumInDomain = (NumWorkers - Domain + N - 1) / N;
+    return (int)(Domain + N * (Seq % NumInDomain));
+  }
+
+  /// Pins calling thread to CPUs of given domain.
+  /// \return false if pinning is not supported or has failed.
+  bool pinCurrentThread(unsigned Domain) const {
+    if (Domain >= Domains.size() || Domains[Domain].empty())
+      return false;
+#ifdef __linux__
+    cpu_set_t Set;
+    CPU_ZERO(&Set);
+    for (unsigned CPU : Domains[Domain])
+      if (CPU < CPU_SETSIZE)
+        CPU_SET(CPU, &Set);
+    return sched_setaffinity(0, sizeof(Set), &Set) == 0;
+#else
+    return false;
+#endif
+  }
+
+  /// Parses CPU list in kernel format, e.g. "0-3,8,10-11".
+  /// \return false if list is malformed.
+  static bool parseCPUList(llvm::StringRef List, std::vector<unsigned> &CPUs) {
+    llvm::SmallVector<llvm::StringRef, 8> Ranges;
+    List.trim().split(Ranges, ',', -1, /*KeepEmpty=*/false);
+
+    for (auto Range : Ranges) {
+      auto Bounds = Range.trim().split('-');
+      unsigned First, Last;
+      if (Bounds.first.getAsInteger(10, First))
+        return false;
+      Last = First;
+      if (Bounds.second.size() && Bounds.second.getAsInteger(10, Last))
+        return false;
+      if (Last < First)
+        return false;
+      for (unsigned CPU = First; CPU <= Last; ++CPU)
+        CPUs.push_back(CPU);
+    }
+
+    return true;
+  }
+
+  /// Reads NUMA nodes of host from sysfs.
+  /// \return placement with no domains if host has single node,
+  /// or if topology is unknown.
+  static WorkerPlacement detect(bool Pin) {
+    WorkerPlacement Res;
+    Res.Pin = Pin;
+
+    const char *NodesDir = "/sys/devices/system/node";
+
+    std::vector<std::pair<unsigned, std::vector<unsigned>>> Nodes;
+    std::error_code EC;
+    for (
+      llvm::sys::fs::directory_iterator It(NodesDir, EC), End;
+      It != End && !EC;
+      It.increment(EC)
+    ) {
+      llvm::StringRef Name = llvm::sys::path::filename(It->path());
+      unsigned Number;
+      if (!Name.consume_front("node") || Name.getAsInteger(10, Number))
+        continue;
+
+      llvm::SmallString<64> CPUListFile(It->path());
+      llvm::sys::path::append(CPUListFile, "cpulist");
+
+      auto Buffer = llvm::MemoryBuffer::getFile(CPUListFile);
+      std::vector<unsigned> CPUs;
+      if (
+        !Buffer ||
+        !parseCPUList(Buffer.get()->getBuffer(), CPUs) ||
+        CPUs.empty()
+      )
+        continue;
+
+      Nodes.emplace_back(Number, std::move(CPUs));
+    }
+
+    // Single node has nothing to split, but its workers still
+    // may be pinned.
+    if (Nodes.size() < 2 && !Pin)
+      return Res;
+
+    std::sort(Nodes.begin(), Nodes.end(), [] (
+        const std::pair<unsigned, std::vector<unsigned>> &L,
+        const std::pair<unsigned, std::vector<unsigned>> &R
+    ) {
+      return L.first < R.first;
+    });
+
+    for (auto &N : Nodes)
+      Res.Domains.push_back(std::move(N.second));
+
+    return Res;
+  }
+};
+
+}}}
+
+#endif //LLVM_CLANG_LEVITATION_WORKERPLACEMENT_H
@@ -3387,6 +3387,11 @@ private:
   void LevitationOnParseStart();
   bool LevitationOnParseEnd();
 
+  /// Whether body of function definition D, we're about to parse,
+  /// should be kept in Declaration AST, see
+  /// Sema::levitationMayExportFunctionBody.
+  bool LevitationMayExportFunctionBody(Decl *D, SourceLocation Start);
+
 public:
 
   void LevitationInitializeExtensions();
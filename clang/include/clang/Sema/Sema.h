@@ -12519,6 +12519,61 @@ public:
 
   bool levitationUnitScopeNotEmpty() const;
 
+  /// Instantiates definitions of class template specializations
+  /// which declarations of current unit use by value, so that they
+  /// are stored in Declaration AST, and dependents don't need to
+  /// instantiate them again. Note, if such instantiation fails, error
+  /// is reported by unit itself, even though a regular build would
+  /// only report it in dependents which actually use declaration.
+  void levitationInstantiateInterfaceSpecializations();
+
+  /// Evaluates initializers of constexpr variables declared by
+  /// current unit, so that their values are stored in Declaration AST,
+  /// and dependents don't need to evaluate them again.
+  void levitationEvaluateInterfaceConstants();
+
+  /// Marks dynamic class of public unit with public LTO visibility,
+  /// so that dependents, which give classes of units hidden
+  /// LTO visibility, keep its hierarchy open,
+  /// see LangOptions::LevitationHiddenLTOVisibility.
+  void levitationSetLTOVisibility(CXXRecordDecl *Record);
+
+  // C++ Levitation Exported Bodies
+private:
+
+  /// Functions, whose bodies are kept in Declaration AST,
+  /// unless levitationCheckExportedBodies drops them.
+  SmallVector<FunctionDecl *, 16> LevitationExportedBodies;
+
+public:
+
+  /// Whether body of function definition D, which starts at Start,
+  /// may be kept in Declaration AST, so that dependents could inline it,
+  /// see LangOptions::LevitationExportBodies.
+  bool levitationMayExportFunctionBody(const Decl *D, SourceLocation Start);
+
+  /// Keeps body of function definition D in Declaration AST.
+  /// Same as for skipped body, generated header gets either ';'
+  /// instead of body, or nothing instead of whole definition.
+  /// \param RBraceLoc location of closing brace of body.
+  void levitationAddExportedFunctionBody(
+      Decl *D,
+      SourceLocation Start,
+      SourceLocation RBraceLoc,
+      bool ReplaceWithSemicolon
+  );
+
+  /// Drops exported bodies, which refer to something dependents can't
+  /// link against, or which must be unique, like static locals.
+  void levitationCheckExportedBodies();
+
+  // C++ Levitation Codeless Units
+
+  /// Whether translation unit has explicit instantiation definitions.
+  /// Those are emitted by unit object, though they are not a part
+  /// of any declaration context, see DeclASTMeta::isCodeless.
+  bool LevitationHasExplicitInstantiations = false;
+
   //
   // end of C++ Levitation Mode
   //===--------------------------------------------------------------------===//
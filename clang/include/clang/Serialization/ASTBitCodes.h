@@ -180,8 +180,6 @@ namespace serialization {
     /// An ID number that refers to a levitation module.
     using LevitationModuleID = uint32_t;
 
-    const unsigned int LEVITATION_NUM_RESERVED_NON_MODULES = 1;
-
     //
     // end of C++ Levitation Mode
     //===--------------------------------------------------------------------===//
@@ -702,6 +700,13 @@ namespace serialization {
 
       /// Record code for \#pragma float_control options.
       FLOAT_CONTROL_PRAGMA_OPTIONS = 65,
+
+      // C++ Levitation
+      /// Record code for names of macros written into C++ Levitation
+      /// Declaration AST, so that reader doesn't visit identifier tables
+      /// of dependencies which have no macros for looked up name.
+      LEVITATION_MACRO_NAMES = 66,
+      // end of C++ Levitation
     };
 
     /// Record types used within a source manager block.
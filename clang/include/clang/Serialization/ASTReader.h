@@ -911,6 +911,25 @@ private:
   /// Enables C++ Levitation mode
   bool LevitationMode = false;
 
+  /// Maps identifiers onto Levitation dependencies which have information
+  /// about them, so that identifier lookup doesn't probe every dependency.
+  std::unique_ptr<GlobalModuleIndex> LevitationNameIndex;
+
+  /// Maps macro names onto Levitation modules where macros with those
+  /// names are written. Identifier is only needed from Levitation
+  /// module for its macro (e.g. header guard), so other modules are
+  /// not visited during identifier lookup.
+  /// Built on first lookup, then updated with modules loaded since then.
+  llvm::StringMap<SmallVector<ModuleFile *, 1>> LevitationMacroModules;
+
+  /// Levitation modules without macro names record.
+  SmallVector<ModuleFile *, 4> LevitationModulesWithoutMacroNames;
+
+  /// Number of Levitation modules added to LevitationMacroModules.
+  unsigned NumLevitationModulesIndexed = 0;
+
+  void updateLevitationMacroModules();
+
   //
   // end of C++ Levitation Mode
   //===--------------------------------------------------------------------===//
@@ -15,6 +15,7 @@
 #ifndef LLVM_CLANG_SERIALIZATION_GLOBALMODULEINDEX_H
 #define LLVM_CLANG_SERIALIZATION_GLOBALMODULEINDEX_H
 
+#include "llvm/ADT/ArrayRef.h"
 #include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/SmallVector.h"
@@ -113,9 +114,19 @@ class GlobalModuleIndex {
   /// identifier.
   unsigned NumIdentifierLookupHits;
 
+  // C++ Levitation
+  /// Whether modules are identified by file names rather than by module
+  /// names. Levitation dependencies have no module names.
+  bool LevitationIndex;
+  // end of C++ Levitation
+
   /// Internal constructor. Use \c readIndex() to read an index.
   explicit GlobalModuleIndex(std::unique_ptr<llvm::MemoryBuffer> Buffer,
-                             llvm::BitstreamCursor Cursor);
+                             llvm::BitstreamCursor Cursor,
+                             bool LevitationIndex = false);
+
+  static std::pair<GlobalModuleIndex *, llvm::Error>
+  readIndexFile(llvm::StringRef IndexPath, bool LevitationIndex);
 
   GlobalModuleIndex(const GlobalModuleIndex &) = delete;
   GlobalModuleIndex &operator=(const GlobalModuleIndex &) = delete;
@@ -169,6 +180,14 @@ public:
   /// module file, and true otherwise.
   bool loadedModuleFile(ModuleFile *File);
 
+  // C++ Levitation
+  /// \returns true if given module file was resolved with index,
+  /// that is it is known to index and wasn't changed since index was built.
+  bool hasModuleFile(ModuleFile *File) const {
+    return ModulesByFile.count(File);
+  }
+  // end of C++ Levitation
+
   /// Print statistics to standard error.
   void printStats();
 
@@ -185,6 +204,31 @@ public:
   static llvm::Error writeIndex(FileManager &FileMgr,
                                 const PCHContainerReader &PCHContainerRdr,
                                 llvm::StringRef Path);
+
+  // C++ Levitation
+
+  /// Read C++ Levitation name index.
+  ///
+  /// \param IndexPath The path to index file itself.
+  static std::pair<GlobalModuleIndex *, llvm::Error>
+  readLevitationIndex(llvm::StringRef IndexPath);
+
+  /// Write C++ Levitation name index, it maps identifiers onto the
+  /// Declaration AST files which have information about them.
+  ///
+  /// Unlike regular global index, AST files are identified by their
+  /// paths, so ModuleFile::FileName at load time should be the same as
+  /// corresponding item of \p ASTFiles.
+  ///
+  /// \param ASTFiles Declaration AST files to be indexed.
+  /// \param IndexPath The path of index file to be written.
+  static llvm::Error
+  writeLevitationIndex(FileManager &FileMgr,
+                       const PCHContainerReader &PCHContainerRdr,
+                       llvm::ArrayRef<std::string> ASTFiles,
+                       llvm::StringRef IndexPath);
+
+  // end of C++ Levitation
 };
 }
 
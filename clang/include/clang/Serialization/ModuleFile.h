@@ -500,6 +500,14 @@ public:
 
   serialization::LevitationModuleID LevitationModuleID = 0;
 
+  /// Whether file has LEVITATION_MACRO_NAMES record. Files
+  /// without it are always visited during identifier lookup.
+  bool HasLevitationMacroNames = false;
+
+  /// Null separated names of macros defined or undefined in this file,
+  /// points into LEVITATION_MACRO_NAMES record blob.
+  StringRef LevitationMacroNames;
+
   bool isLevitationDependency() const {
     return Kind == MK_LevitationDependency;
   }
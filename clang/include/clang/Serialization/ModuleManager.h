@@ -208,11 +208,7 @@ public:
     Missing,
 
     /// The module file is out-of-date.
-    OutOfDate,
-
-    // C++ Levitation extension:
-    /// Can't load module, because we're out of IDs.
-    LevitationOutOfIDs
+    OutOfDate
   };
 
   using ASTFileSignatureReader = ASTFileSignature (*)(StringRef);
@@ -337,8 +333,6 @@ public:
   /// while dependent modules and their IDs are invalidated.
   SmallVector<ModuleFile*, 16> LevitationModules;
 
-  serialization::LevitationModuleID LevitationNumNonModules = 0;
-
   //
   // end of C++ Levitation Mode
   //===--------------------------------------------------------------------===//
@@ -40,6 +40,12 @@ enum class ScanningOutputFormat {
   /// This outputs the full module dependency graph suitable for use for
   /// explicitly building modules.
   Full,
+
+  // C++ Levitation
+  /// This outputs P1689 style dependencies of C++ Levitation units.
+  /// Units are scanned by clang-scan-deps itself, without workers.
+  P1689,
+  // end of C++ Levitation
 };
 
 /// The dependency scanning service contains the shared state that is used by
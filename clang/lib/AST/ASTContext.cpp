@@ -10269,6 +10269,16 @@ adjustGVALinkageForExternalDefinitionKind(const ASTContext &Ctx, const Decl *D,
   if (!Source)
     return L;
 
+  // C++ Levitation: current unit is home for its inline functions,
+  // provided it is compiled with -flevitation-modules-codegen.
+  if (Ctx.getLangOpts().isLevitationMode(LangOptions::LBSK_BuildObjectFile) &&
+      L == GVA_DiscardableODR) {
+    if (const auto *FD = dyn_cast<FunctionDecl>(D))
+      if (Ctx.isLevitationHomeDefinition(FD))
+        return GVA_StrongODR;
+  }
+  // end of C++ Levitation
+
   switch (Source->hasExternalDefinitions(D)) {
   case ExternalASTSource::EK_Never:
     // Other translation units rely on us to provide the definition.
@@ -10291,6 +10301,43 @@ GVALinkage ASTContext::GetGVALinkageForFunction(const FunctionDecl *FD) const {
              basicGVALinkageForFunction(*this, FD)));
 }
 
+// C++ Levitation
+bool ASTContext::isLevitationHomeDefinition(const FunctionDecl *FD) const {
+  if (!LangOpts.LevitationModulesCodegen ||
+      !LangOpts.isLevitationMode(LangOptions::LBSK_BuildDeclAST,
+                                 LangOptions::LBSK_BuildObjectFile))
+    return false;
+
+  // Same rules as for -fmodules-codegen, but limited to definitions
+  // located in current unit. Note, that object and decl-ast jobs parse
+  // same source, so both of them make same decision.
+  if (FD->isFromASTFile() || FD->isDependentContext() ||
+      !FD->doesThisDeclarationHaveABody() ||
+      FD->hasAttr<AlwaysInlineAttr>())
+    return false;
+
+  if (!SourceMgr.isInMainFile(FD->getLocation()))
+    return false;
+
+  return adjustGVALinkageForAttributes(*this, FD,
+           basicGVALinkageForFunction(*this, FD)) == GVA_DiscardableODR;
+}
+
+bool ASTContext::isLevitationHomeRecord(const CXXRecordDecl *RD) const {
+  if (!LangOpts.LevitationModulesDebugInfo ||
+      !LangOpts.isLevitationMode(LangOptions::LBSK_BuildDeclAST,
+                                 LangOptions::LBSK_BuildObjectFile))
+    return false;
+
+  if (RD->isFromASTFile() || RD->isDependentType() ||
+      !RD->isThisDeclarationADefinition() ||
+      RD->getParentFunctionOrMethod())
+    return false;
+
+  return SourceMgr.isInMainFile(RD->getLocation());
+}
+// end of C++ Levitation
+
 static GVALinkage basicGVALinkageForVariable(const ASTContext &Context,
                                              const VarDecl *VD) {
   if (!VD->isExternallyVisible())
@@ -24,6 +24,7 @@
 #include "llvm/Bitcode/BitcodeReader.h"
 #include "llvm/Bitcode/BitcodeWriter.h"
 #include "llvm/Bitcode/BitcodeWriterPass.h"
+#include "llvm/CodeGen/ParallelCG.h"
 #include "llvm/CodeGen/RegAllocRegistry.h"
 #include "llvm/CodeGen/SchedulerRegistry.h"
 #include "llvm/CodeGen/TargetSubtargetInfo.h"
@@ -42,9 +43,11 @@
 #include "llvm/Passes/StandardInstrumentations.h"
 #include "llvm/Support/BuryPointer.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/MD5.h"
 #include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/PrettyStackTrace.h"
 #include "llvm/Support/TargetRegistry.h"
+#include "llvm/Support/ThreadPool.h"
 #include "llvm/Support/TimeProfiler.h"
 #include "llvm/Support/Timer.h"
 #include "llvm/Support/ToolOutputFile.h"
@@ -76,11 +79,14 @@
 #include "llvm/Transforms/Scalar/GVN.h"
 #include "llvm/Transforms/Utils.h"
 #include "llvm/Transforms/Utils/CanonicalizeAliases.h"
+#include "llvm/Transforms/Utils/Cloning.h"
 #include "llvm/Transforms/Utils/EntryExitInstrumenter.h"
 #include "llvm/Transforms/Utils/NameAnonGlobals.h"
+#include "llvm/Transforms/Utils/SplitModule.h"
 #include "llvm/Transforms/Utils/SymbolRewriter.h"
 #include "llvm/Transforms/Utils/UniqueInternalLinkageNames.h"
 #include <memory>
+#include <mutex>
 using namespace clang;
 using namespace llvm;
 
@@ -130,6 +136,21 @@ class EmitAssemblyHelper {
   bool AddEmitPasses(legacy::PassManager &CodeGenPasses, BackendAction Action,
                      raw_pwrite_stream &OS, raw_pwrite_stream *DwoOS);
 
+  // C++ Levitation
+  /// Whether object is emitted as several partitions, see
+  /// -levitation-codegen-partition. Reports error if partitions
+  /// were requested for output they can't be emitted for.
+  bool useLevitationPartitions(BackendAction Action, bool &Failed);
+
+  /// Runs code generator for partitions of module on several threads.
+  /// First partition is written to OS, others to partition files.
+  void emitLevitationPartitions(raw_pwrite_stream &OS);
+
+  /// Same as emitLevitationPartitions, but code of partitions IR
+  /// didn't change for is taken from -levitation-codegen-cache.
+  void emitCachedLevitationPartitions(ArrayRef<raw_pwrite_stream *> OSs);
+  // end of C++ Levitation
+
   std::unique_ptr<llvm::ToolOutputFile> openOutputFile(StringRef Path) {
     std::error_code EC;
     auto F = std::make_unique<llvm::ToolOutputFile>(Path, EC,
@@ -848,6 +869,154 @@ bool EmitAssemblyHelper::AddEmitPasses(legacy::PassManager &CodeGenPasses,
   return true;
 }
 
+// C++ Levitation
+bool EmitAssemblyHelper::useLevitationPartitions(BackendAction Action,
+                                                 bool &Failed) {
+  Failed = false;
+  if (CodeGenOpts.LevitationCodeGenPartitions.empty())
+    return false;
+
+  // Each partition would need its own .dwo file.
+  if (Action != Backend_EmitObj || !CodeGenOpts.SplitDwarfOutput.empty()) {
+    Diags.Report(diag::err_fe_levitation_codegen_partitions_unsupported);
+    Failed = true;
+  }
+  return true;
+}
+
+void EmitAssemblyHelper::emitLevitationPartitions(raw_pwrite_stream &OS) {
+  SmallVector<std::unique_ptr<llvm::ToolOutputFile>, 8> Files;
+  SmallVector<raw_pwrite_stream *, 8> OSs;
+  OSs.push_back(&OS);
+  for (const auto &Path : CodeGenOpts.LevitationCodeGenPartitions) {
+    Files.push_back(openOutputFile(Path));
+    if (!Files.back())
+      return;
+    OSs.push_back(&Files.back()->os());
+  }
+
+  // Partitions are generated in their own contexts, so each thread
+  // needs its own target machine.
+  auto CreateTM = [&] {
+    return std::unique_ptr<TargetMachine>(TM->getTarget().createTargetMachine(
+        TM->getTargetTriple().str(), TM->getTargetCPU(),
+        TM->getTargetFeatureString(), TM->Options, TM->getRelocationModel(),
+        TM->getCodeModel(), TM->getOptLevel()));
+  };
+
+  PrettyStackTraceString CrashInfo("Code generation");
+  llvm::TimeTraceScope TimeScope("CodeGenPasses");
+
+  // Module splitting consumes module, while this one is still owned
+  // by consumer. Locals are preserved, that is kept in partition of
+  // their users, so that symbols of different units don't clash.
+  if (CodeGenOpts.LevitationCodeGenCache.empty())
+    splitCodeGen(CloneModule(*TheModule), OSs, {}, CreateTM, CGFT_ObjectFile,
+                 /*PreserveLocals=*/true);
+  else
+    emitCachedLevitationPartitions(OSs);
+
+  for (auto &F : Files)
+    F->keep();
+}
+
+void EmitAssemblyHelper::emitCachedLevitationPartitions(
+    ArrayRef<raw_pwrite_stream *> OSs) {
+  StringRef CacheDir = CodeGenOpts.LevitationCodeGenCache;
+  llvm::sys::fs::create_directories(CacheDir);
+
+  // Flags which don't go into IR are fingerprinted by cache directory,
+  // see driver, target is checked here as well.
+  std::string TargetKey = (Twine(TM->getTargetTriple().str()) + " " +
+                           TM->getTargetCPU() + " " +
+                           TM->getTargetFeatureString())
+                              .str();
+  const llvm::Target &T = TM->getTarget();
+  llvm::TargetOptions Options = TM->Options;
+  auto RM = TM->getRelocationModel();
+  auto CM = TM->getCodeModel();
+  auto OL = TM->getOptLevel();
+
+  std::mutex DiagsMutex;
+
+  // Partitions are code generated in their own contexts, so each
+  // partition is serialized to bitcode on main thread first. Same
+  // bitcode, and so same functions, gives same code.
+  {
+    ThreadPool Pool(hardware_concurrency(OSs.size()));
+    unsigned Idx = 0;
+
+    SplitModule(
+        CloneModule(*TheModule), OSs.size(),
+        [&](std::unique_ptr<llvm::Module> MPart) {
+          SmallString<0> BC;
+          raw_svector_ostream BCOS(BC);
+          WriteBitcodeToFile(*MPart, BCOS);
+
+          llvm::MD5 Hash;
+          Hash.update(TargetKey);
+          Hash.update(BC.str());
+          llvm::MD5::MD5Result Res;
+          Hash.final(Res);
+
+          SmallString<256> Cached = CacheDir;
+          llvm::sys::path::append(Cached, Twine(Res.digest()) + ".o");
+
+          raw_pwrite_stream *OS = OSs[Idx++];
+
+          if (auto Buffer = llvm::MemoryBuffer::getFile(Cached)) {
+            OS->write((*Buffer)->getBufferStart(), (*Buffer)->getBufferSize());
+            return;
+          }
+
+          Pool.async(
+              [&, OS, Cached](const SmallString<0> &BC) {
+                LLVMContext Ctx;
+                auto MOrErr = parseBitcodeFile(
+                    MemoryBufferRef(StringRef(BC.data(), BC.size()),
+                                    "<levitation-partition>"),
+                    Ctx);
+                if (!MOrErr)
+                  report_fatal_error("Failed to read bitcode");
+
+                std::unique_ptr<TargetMachine> PartTM(T.createTargetMachine(
+                    TM->getTargetTriple().str(), TM->getTargetCPU(),
+                    TM->getTargetFeatureString(), Options, RM, CM, OL));
+
+                SmallString<0> Code;
+                raw_svector_ostream CodeOS(Code);
+                legacy::PassManager CodeGenPasses;
+                if (PartTM->addPassesToEmitFile(CodeGenPasses, CodeOS, nullptr,
+                                                CGFT_ObjectFile)) {
+                  std::lock_guard<std::mutex> Lock(DiagsMutex);
+                  Diags.Report(diag::err_fe_unable_to_interface_with_target);
+                  return;
+                }
+                CodeGenPasses.run(**MOrErr);
+
+                OS->write(Code.data(), Code.size());
+
+                // Cache is shared by jobs, so entry is written
+                // through temporary, and failures are ignored.
+                int FD;
+                SmallString<256> Tmp;
+                if (llvm::sys::fs::createUniqueFile(
+                        Twine(Cached) + ".tmp-%%%%%%%%", FD, Tmp))
+                  return;
+                {
+                  raw_fd_ostream TmpOS(FD, /*shouldClose=*/true);
+                  TmpOS.write(Code.data(), Code.size());
+                }
+                if (llvm::sys::fs::rename(Tmp, Cached))
+                  llvm::sys::fs::remove(Tmp);
+              },
+              std::move(BC));
+        },
+        /*PreserveLocals=*/true);
+  }
+}
+// end of C++ Levitation
+
 void EmitAssemblyHelper::EmitAssembly(BackendAction Action,
                                       std::unique_ptr<raw_pwrite_stream> OS) {
   TimeRegion Region(FrontendTimesIsEnabled ? &CodeGenerationTime : nullptr);
@@ -880,6 +1049,10 @@ void EmitAssemblyHelper::EmitAssembly(BackendAction Action,
 
   std::unique_ptr<llvm::ToolOutputFile> ThinLinkOS, DwoOS;
 
+  // C++ Levitation
+  bool SplitCodeGen = false, PartitionsFailed;
+  // end of C++ Levitation
+
   switch (Action) {
   case Backend_EmitNothing:
     break;
@@ -921,6 +1094,16 @@ void EmitAssemblyHelper::EmitAssembly(BackendAction Action,
     break;
 
   default:
+    // C++ Levitation
+    // Object is emitted by emitLevitationPartitions then.
+    if (useLevitationPartitions(Action, PartitionsFailed)) {
+      if (PartitionsFailed)
+        return;
+      SplitCodeGen = true;
+      break;
+    }
+    // end of C++ Levitation
+
     if (!CodeGenOpts.SplitDwarfOutput.empty()) {
       DwoOS = openOutputFile(CodeGenOpts.SplitDwarfOutput);
       if (!DwoOS)
@@ -954,6 +1137,12 @@ void EmitAssemblyHelper::EmitAssembly(BackendAction Action,
     PerModulePasses.run(*TheModule);
   }
 
+  // C++ Levitation
+  // There are no emit passes then, so code generation passes are no-op.
+  if (SplitCodeGen)
+    emitLevitationPartitions(*OS);
+  // end of C++ Levitation
+
   {
     PrettyStackTraceString CrashInfo("Code generation");
     llvm::TimeTraceScope TimeScope("CodeGenPasses");
@@ -1386,6 +1575,10 @@ void EmitAssemblyHelper::EmitAssemblyWithNewPassManager(
   bool NeedCodeGen = false;
   std::unique_ptr<llvm::ToolOutputFile> ThinLinkOS, DwoOS;
 
+  // C++ Levitation
+  bool SplitCodeGen = false, PartitionsFailed;
+  // end of C++ Levitation
+
   // Append any output we need to the pass manager.
   switch (Action) {
   case Backend_EmitNothing:
@@ -1428,6 +1621,15 @@ void EmitAssemblyHelper::EmitAssemblyWithNewPassManager(
   case Backend_EmitAssembly:
   case Backend_EmitMCNull:
   case Backend_EmitObj:
+    // C++ Levitation
+    if (useLevitationPartitions(Action, PartitionsFailed)) {
+      if (PartitionsFailed)
+        return;
+      SplitCodeGen = true;
+      break;
+    }
+    // end of C++ Levitation
+
     NeedCodeGen = true;
     CodeGenPasses.add(
         createTargetTransformInfoWrapperPass(getTargetIRAnalysis()));
@@ -1452,6 +1654,11 @@ void EmitAssemblyHelper::EmitAssemblyWithNewPassManager(
     MPM.run(*TheModule, MAM);
   }
 
+  // C++ Levitation
+  if (SplitCodeGen)
+    emitLevitationPartitions(*OS);
+  // end of C++ Levitation
+
   // Now if needed, run the legacy PM for codegen.
   if (NeedCodeGen) {
     PrettyStackTraceString CrashInfo("Code generation");
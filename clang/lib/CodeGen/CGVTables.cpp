@@ -19,8 +19,10 @@
 #include "clang/Basic/CodeGenOptions.h"
 #include "clang/CodeGen/CGFunctionInfo.h"
 #include "clang/CodeGen/ConstantInitBuilder.h"
+#include "clang/Levitation/FileExtensions.h"
 #include "llvm/IR/IntrinsicInst.h"
 #include "llvm/Support/Format.h"
+#include "llvm/Support/Path.h"
 #include "llvm/Transforms/Utils/Cloning.h"
 #include <algorithm>
 #include <cstdio>
@@ -1041,6 +1043,23 @@ bool CodeGenModule::HasHiddenLTOVisibility(const CXXRecordDecl *RD) {
   if (RD->hasAttr<LTOVisibilityPublicAttr>() || RD->hasAttr<UuidAttr>())
     return false;
 
+  // C++ Levitation
+  // Hierarchies of units are closed, unless unit is public, then
+  // its classes have LTOVisibilityPublicAttr. Classes of included
+  // headers go on with regular rules.
+  if (getLangOpts().LevitationMode &&
+      getLangOpts().LevitationHiddenLTOVisibility) {
+    SourceLocation Loc = getContext().getSourceManager().getFileLoc(
+        RD->getLocation()
+    );
+    StringRef Ext = llvm::sys::path::extension(
+        getContext().getSourceManager().getFilename(Loc)
+    );
+    if (Ext.consume_front(".") && Ext == levitation::FileExtensions::SourceCode)
+      return true;
+  }
+  // end of C++ Levitation
+
   if (getTriple().isOSBinFormatCOFF()) {
     if (RD->hasAttr<DLLExportAttr>() || RD->hasAttr<DLLImportAttr>())
       return false;
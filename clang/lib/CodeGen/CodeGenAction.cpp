@@ -121,6 +121,16 @@ namespace clang {
     /// can happen when Clang plugins trigger additional AST deserialization.
     bool IRGenFinished = false;
 
+    // C++ Levitation
+    /// Set if backend is run by emitDeferredBackendOutput, after
+    /// AST is released, see -flevitation-release-ast.
+    bool DeferBackend = false;
+
+    /// Data layout of deferred backend, owned by TargetInfo,
+    /// which outlives AST context.
+    const llvm::DataLayout *DeferredDataLayout = nullptr;
+    // end of C++ Levitation
+
     std::unique_ptr<CodeGenerator> Gen;
 
     SmallVector<LinkModule, 4> LinkModules;
@@ -181,6 +191,23 @@ namespace clang {
 
     CodeGenerator *getCodeGenerator() { return Gen.get(); }
 
+    // C++ Levitation
+    void deferBackend() { DeferBackend = true; }
+
+    bool hasDeferredBackend() const { return DeferredDataLayout; }
+
+    /// Runs backend, once HandleTranslationUnit has generated IR.
+    /// AST context may be gone at this point, then diagnostics
+    /// are reported without declarations locations.
+    void emitDeferredBackendOutput() {
+      assert(hasDeferredBackend() && "Backend is not deferred");
+      const llvm::DataLayout &DL = *DeferredDataLayout;
+      DeferredDataLayout = nullptr;
+      Context = nullptr;
+      emitBackendOutput(DL);
+    }
+    // end of C++ Levitation
+
     void HandleCXXStaticMemberVarInstantiation(VarDecl *VD) override {
       Gen->HandleCXXStaticMemberVarInstantiation(VD);
     }
@@ -295,6 +322,17 @@ namespace clang {
       if (!getModule())
         return;
 
+      // C++ Levitation
+      if (DeferBackend) {
+        DeferredDataLayout = &C.getTargetInfo().getDataLayout();
+        return;
+      }
+      // end of C++ Levitation
+
+      emitBackendOutput(C.getTargetInfo().getDataLayout());
+    }
+
+    void emitBackendOutput(const llvm::DataLayout &DL) {
       // Install an inline asm handler so that diagnostics get printed through
       // our diagnostics hooks.
       LLVMContext &Ctx = getModule()->getContext();
@@ -333,8 +371,8 @@ namespace clang {
       EmbedBitcode(getModule(), CodeGenOpts, llvm::MemoryBufferRef());
 
       EmitBackendOutput(Diags, HeaderSearchOpts, CodeGenOpts, TargetOpts,
-                        LangOpts, C.getTargetInfo().getDataLayout(),
-                        getModule(), Action, std::move(AsmOutStream));
+                        LangOpts, DL, getModule(), Action,
+                        std::move(AsmOutStream));
 
       Ctx.setInlineAsmDiagnosticHandler(OldHandler, OldContext);
 
@@ -469,7 +507,7 @@ void BackendConsumer::InlineAsmDiagHandler2(const llvm::SMDiagnostic &D,
 
   // If the SMDiagnostic has an inline asm source location, translate it.
   FullSourceLoc Loc;
-  if (D.getLoc() != SMLoc())
+  if (D.getLoc() != SMLoc() && Context)
     Loc = ConvertBackendLocation(D, Context->getSourceManager());
 
   unsigned DiagID;
@@ -579,6 +617,10 @@ BackendConsumer::StackSizeDiagHandler(const llvm::DiagnosticInfoStackSize &D) {
     // We do not know how to format other severities.
     return false;
 
+  // Declarations are gone along with AST context.
+  if (!Context)
+    return false;
+
   if (const Decl *ND = Gen->GetDeclForMangledName(D.getFunction().getName())) {
     // FIXME: Shouldn't need to truncate to uint32_t
     Diags.Report(ND->getASTContext().getFullLoc(ND->getLocation()),
@@ -919,6 +961,20 @@ void CodeGenAction::EndSourceFileAction() {
   if (!getCompilerInstance().hasASTConsumer())
     return;
 
+  // C++ Levitation
+  // Backend only needs IR, so AST, Sema and declarations deserialized
+  // from dependencies are freed before optimization pipeline is run,
+  // even with -disable-free, so that they don't add to its peak memory.
+  // ASTReader is kept, since preprocessor still refers to it, while
+  // its files are mapped and don't hold much of anonymous memory.
+  if (BEConsumer->hasDeferredBackend()) {
+    CompilerInstance &CI = getCompilerInstance();
+    CI.setSema(nullptr);
+    CI.setASTContext(nullptr);
+    BEConsumer->emitDeferredBackendOutput();
+  }
+  // end of C++ Levitation
+
   // Steal the module from the consumer.
   TheModule = BEConsumer->takeModule();
 }
@@ -1003,6 +1059,11 @@ CodeGenAction::CreateASTConsumer(CompilerInstance &CI, StringRef InFile) {
       std::move(LinkModules), std::move(OS), *VMContext, CoverageInfo));
   BEConsumer = Result.get();
 
+  // C++ Levitation
+  if (CI.getFrontendOpts().LevitationReleaseAST)
+    BEConsumer->deferBackend();
+  // end of C++ Levitation
+
   // Enable generating macro debug info only when debug info is not disabled and
   // also macro debug info is enabled.
   if (CI.getCodeGenOpts().getDebugInfo() != codegenoptions::NoDebugInfo &&
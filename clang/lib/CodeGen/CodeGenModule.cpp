@@ -5375,6 +5375,14 @@ void CodeGenModule::EmitTopLevelDecl(Decl *D) {
       if (auto *ES = D->getASTContext().getExternalSource())
         if (ES->hasExternalDefinitions(D) == ExternalASTSource::EK_Never)
           DI->completeUnusedClass(cast<CXXRecordDecl>(*D));
+
+    // C++ Levitation: we're the only one who emits this class debug info,
+    // dependents only refer to it.
+    if (CGDebugInfo *DI = getModuleDebugInfo())
+      if (getContext().isLevitationHomeRecord(cast<CXXRecordDecl>(D)))
+        DI->completeUnusedClass(cast<CXXRecordDecl>(*D));
+    // end of C++ Levitation
+
     // Emit any static data members, they may be definitions.
     for (auto *I : cast<CXXRecordDecl>(D)->decls())
       if (isa<VarDecl>(I) || isa<CXXRecordDecl>(I))
@@ -3919,6 +3919,44 @@ void levitationParseIncludeDeps(
         Twine("-levitation-dependency=") + Dep)
     );
   }
+
+  if (Args.hasArg(options::OPT_cppl_trust_deps))
+    CmdArgs.push_back("-flevitation-trust-dependencies");
+
+  StringRef NameIndex = Args.getLastArgValue(options::OPT_cppl_name_index_EQ);
+  if (NameIndex.size()) {
+    CmdArgs.push_back(Args.MakeArgString(
+        Twine("-levitation-name-index=") + NameIndex)
+    );
+  }
+
+  // Dependencies written with sources root refer to sources
+  // relative to it, so they must be read with same root.
+  StringRef SrcRoot = Args.getLastArgValue(options::OPT_cppl_src_root_EQ);
+  if (SrcRoot.size()) {
+    CmdArgs.push_back(Args.MakeArgString(
+        Twine("-levitation-sources-root=") + SrcRoot)
+    );
+  }
+}
+
+void levitationParseModulesCodegen(
+    ArgStringList &CmdArgs, const ArgList &Args
+) {
+  if (Args.hasArg(options::OPT_cppl_modules_codegen))
+    CmdArgs.push_back("-flevitation-modules-codegen");
+  if (Args.hasArg(options::OPT_cppl_modules_debuginfo))
+    CmdArgs.push_back("-flevitation-modules-debuginfo");
+}
+
+void levitationParseLTOVisibility(
+    ArgStringList &CmdArgs, const ArgList &Args
+) {
+  if (!Args.hasArg(options::OPT_cppl_hidden_lto_visibility))
+    return;
+  CmdArgs.push_back("-flevitation-hidden-lto-visibility");
+  if (Args.hasArg(options::OPT_cppl_public_unit))
+    CmdArgs.push_back("-flevitation-public-unit");
 }
 
 void levitationSetMeta(
@@ -3934,6 +3972,43 @@ void levitationSetMeta(
   CmdArgs.push_back(Args.MakeArgString(
       Twine("-levitation-decl-ast-meta=") + DeclASTMeta
   ));
+
+  if (Args.hasArg(options::OPT_cppl_early_cutoff))
+    CmdArgs.push_back("-flevitation-early-cutoff");
+
+  if (Args.hasArg(options::OPT_cppl_keep_unchanged_outputs))
+    CmdArgs.push_back("-flevitation-keep-unchanged-outputs");
+
+  StringRef Hash = Args.getLastArgValue(options::OPT_cppl_hash_EQ);
+  if (Hash.size())
+    CmdArgs.push_back(Args.MakeArgString(Twine("-levitation-hash=") + Hash));
+
+  StringRef TimeTraceOut =
+      Args.getLastArgValue(options::OPT_cppl_time_trace_out_EQ);
+  if (TimeTraceOut.size())
+    CmdArgs.push_back(Args.MakeArgString(
+        Twine("-levitation-time-trace-out=") + TimeTraceOut
+    ));
+
+  StringRef SourceDigest =
+      Args.getLastArgValue(options::OPT_cppl_source_digest_EQ);
+  if (SourceDigest.size())
+    CmdArgs.push_back(Args.MakeArgString(
+        Twine("-levitation-source-digest=") + SourceDigest
+    ));
+
+  StringRef CommandHash =
+      Args.getLastArgValue(options::OPT_cppl_command_hash_EQ);
+  if (CommandHash.size())
+    CmdArgs.push_back(Args.MakeArgString(
+        Twine("-levitation-command-hash=") + CommandHash
+    ));
+
+  StringRef StatsOut = Args.getLastArgValue(options::OPT_cppl_stats_out_EQ);
+  if (StatsOut.size())
+    CmdArgs.push_back(Args.MakeArgString(
+        Twine("-levitation-stats=") + StatsOut
+    ));
 }
 
 void levitationSetUnitID(
@@ -3951,6 +4026,41 @@ void levitationSetUnitID(
   ));
 }
 
+void levitationSetGeneratedSources(
+    ArgStringList &CmdArgs, const ArgList &Args
+) {
+  StringRef HeaderOut = Args.getLastArgValue(options::OPT_cppl_header_out_EQ);
+  StringRef DeclOut = Args.getLastArgValue(options::OPT_cppl_decl_out_EQ);
+
+  if (HeaderOut.size()) {
+    CmdArgs.push_back(Args.MakeArgString(
+        Twine("-levitation-header-output=") + HeaderOut
+    ));
+    for (const auto &Inc : Args.getAllArgValues(options::OPT_cppl_header_include_EQ))
+      CmdArgs.push_back(Args.MakeArgString(
+          Twine("-levitation-header-include=") + Inc
+      ));
+  }
+
+  if (DeclOut.size()) {
+    CmdArgs.push_back(Args.MakeArgString(
+        Twine("-levitation-decl-output=") + DeclOut
+    ));
+    for (const auto &Imp : Args.getAllArgValues(options::OPT_cppl_decl_import_EQ))
+      CmdArgs.push_back(Args.MakeArgString(
+          Twine("-levitation-decl-import=") + Imp
+      ));
+  }
+
+  StringRef Preamble =
+      Args.getLastArgValue(options::OPT_cppl_header_preamble_EQ);
+
+  if (Preamble.size() && (HeaderOut.size() || DeclOut.size()))
+    CmdArgs.push_back(Args.MakeArgString(
+        Twine("-levitation-header-preamble=") + Preamble
+    ));
+}
+
 void Clang::ConstructJob(Compilation &C, const JobAction &JA,
                          const InputInfo &Output, const InputInfoList &Inputs,
                          const ArgList &Args, const char *LinkingOutput) const {
@@ -4173,8 +4283,13 @@ void Clang::ConstructJob(Compilation &C, const JobAction &JA,
 
       levitationParseIncludePreamble(CmdArgs, Args);
       levitationParseIncludeDeps(CmdArgs, Args);
+      levitationParseModulesCodegen(CmdArgs, Args);
+      levitationParseLTOVisibility(CmdArgs, Args);
       levitationSetMeta(D, CmdArgs, Args);
       levitationSetUnitID(D, CmdArgs, Args);
+
+      if (Args.hasArg(options::OPT_cppl_release_ast))
+        CmdArgs.push_back("-flevitation-release-ast");
     }
 
     // end of C++ Levitation
@@ -4280,8 +4395,40 @@ void Clang::ConstructJob(Compilation &C, const JobAction &JA,
 
       levitationParseIncludePreamble(CmdArgs, Args);
       levitationParseIncludeDeps(CmdArgs, Args);
+      levitationParseModulesCodegen(CmdArgs, Args);
+      levitationParseLTOVisibility(CmdArgs, Args);
       levitationSetMeta(D, CmdArgs, Args);
       levitationSetUnitID(D, CmdArgs, Args);
+      levitationSetGeneratedSources(CmdArgs, Args);
+
+      if (Args.hasArg(options::OPT_cppl_instantiate_interface))
+        CmdArgs.push_back("-flevitation-instantiate-interface");
+
+      if (Arg *A = Args.getLastArg(options::OPT_cppl_export_bodies_EQ))
+        CmdArgs.push_back(Args.MakeArgString(
+            Twine("-flevitation-export-bodies=") + A->getValue()));
+
+      if (Args.hasArg(options::OPT_cppl_compact_decl_ast))
+        CmdArgs.push_back("-flevitation-compact-decl-ast");
+
+      if (Args.hasArg(options::OPT_cppl_embed_meta))
+        CmdArgs.push_back("-flevitation-embed-meta");
+    } else if (Args.hasArg(options::OPT_cppl_obj)) {
+
+      // With -flto object is emitted as bitcode,
+      // so there is no assemble job.
+
+      CmdArgs.push_back("-flevitation-build-object");
+
+      levitationParseIncludePreamble(CmdArgs, Args);
+      levitationParseIncludeDeps(CmdArgs, Args);
+      levitationParseModulesCodegen(CmdArgs, Args);
+      levitationParseLTOVisibility(CmdArgs, Args);
+      levitationSetMeta(D, CmdArgs, Args);
+      levitationSetUnitID(D, CmdArgs, Args);
+
+      if (Args.hasArg(options::OPT_cppl_release_ast))
+        CmdArgs.push_back("-flevitation-release-ast");
     }
 
     // end of C++ Levitation
@@ -827,8 +827,10 @@ const char *tools::SplitDebugName(const ArgList &Args, const InputInfo &Input,
     if (StringRef(A->getValue()) == "single")
       return Args.MakeArgString(Output.getFilename());
 
+  // C++ Levitation: object build stops after assembling, same as -c.
   Arg *FinalOutput = Args.getLastArg(options::OPT_o);
-  if (FinalOutput && Args.hasArg(options::OPT_c)) {
+  if (FinalOutput && (Args.hasArg(options::OPT_c) ||
+                      Args.hasArg(options::OPT_cppl_obj))) {
     SmallString<128> T(FinalOutput->getValue());
     llvm::sys::path::replace_extension(T, "dwo");
     return Args.MakeArgString(T);
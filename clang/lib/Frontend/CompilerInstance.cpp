@@ -28,6 +28,8 @@
 #include "clang/Frontend/TextDiagnosticPrinter.h"
 #include "clang/Frontend/Utils.h"
 #include "clang/Frontend/VerifyDiagnosticConsumer.h"
+#include "clang/Levitation/Common/File.h"
+#include "clang/Levitation/Common/HashingStream.h"
 #include "clang/Lex/HeaderSearch.h"
 #include "clang/Lex/Preprocessor.h"
 #include "clang/Lex/PreprocessorOptions.h"
@@ -651,6 +653,18 @@ void CompilerInstance::clearOutputFiles(bool EraseFiles) {
         // If '-working-directory' was passed, the output filename should be
         // relative to that.
         FileMgr->FixupRelativePath(NewOutFile);
+
+        // C++ Levitation: keep existing output and its timestamp,
+        // if nothing was changed.
+        if (
+          hasInvocation() &&
+          getFrontendOpts().LevitationKeepUnchangedOutputs &&
+          levitation::File::isSameContents(OF.TempFilename, NewOutFile)
+        ) {
+          llvm::sys::fs::remove(OF.TempFilename);
+          continue;
+        }
+
         if (std::error_code ec =
                 llvm::sys::fs::rename(OF.TempFilename, NewOutFile)) {
           getDiagnostics().Report(diag::err_unable_to_rename_temp)
@@ -663,6 +677,8 @@ void CompilerInstance::clearOutputFiles(bool EraseFiles) {
       llvm::sys::fs::remove(OF.Filename);
   }
   OutputFiles.clear();
+  LevitationOutputHash.reset();
+  LevitationNumHashedOutputs = 0;
   if (DeleteBuiltModules) {
     for (auto &Module : BuiltModules)
       llvm::sys::fs::remove(Module.second);
@@ -671,6 +687,21 @@ void CompilerInstance::clearOutputFiles(bool EraseFiles) {
   NonSeekStream.reset();
 }
 
+bool CompilerInstance::getLevitationOutputHash(SmallVectorImpl<uint8_t> &Hash) {
+  // Several outputs were written, it is not clear
+  // which one is hashed.
+  if (!LevitationOutputHash || LevitationNumHashedOutputs != 1)
+    return false;
+
+  auto State = std::move(LevitationOutputHash);
+  if (!State->Valid)
+    return false;
+
+  auto Res = State->Hash.final();
+  Hash.assign(Res.begin(), Res.end());
+  return true;
+}
+
 StringRef CompilerInstance::getCurrentOutputFilePath() {
 
   if (OutputFiles.empty())
@@ -718,6 +749,23 @@ CompilerInstance::createOutputFile(StringRef OutputPath, bool Binary,
   addOutputFile(
       OutputFile((OutputPathName != "-") ? OutputPathName : "", TempPathName));
 
+  // C++ Levitation: output hash goes into meta, so output is hashed
+  // while written, rather than read back once it is done.
+  if (hasInvocation() && getLangOpts().LevitationMode &&
+      !getFrontendOpts().LevitationDeclASTMeta.empty()) {
+    levitation::HashKind Kind = levitation::HashKind::MD5;
+    levitation::parseHashKind(getFrontendOpts().LevitationHash, Kind);
+
+    LevitationOutputHash =
+        std::make_shared<levitation::HashingOStreamState>(Kind);
+    ++LevitationNumHashedOutputs;
+
+    OS = std::make_unique<levitation::HashingOStream>(
+        std::move(OS), LevitationOutputHash
+    );
+  }
+  // end of C++ Levitation
+
   return OS;
 }
 
@@ -38,6 +38,7 @@
 #include "clang/Frontend/MigratorOptions.h"
 #include "clang/Frontend/PreprocessorOutputOptions.h"
 #include "clang/Frontend/Utils.h"
+#include "clang/Levitation/Common/Utility.h"
 #include "clang/Lex/HeaderSearchOptions.h"
 #include "clang/Lex/PreprocessorOptions.h"
 #include "clang/Sema/CodeCompleteOptions.h"
@@ -761,6 +762,10 @@ static bool ParseCodeGenArgs(CodeGenOptions &Opts, ArgList &Args, InputKind IK,
   Opts.SplitDwarfFile = std::string(Args.getLastArgValue(OPT_split_dwarf_file));
   Opts.SplitDwarfOutput =
       std::string(Args.getLastArgValue(OPT_split_dwarf_output));
+  Opts.LevitationCodeGenPartitions =
+      Args.getAllArgValues(OPT_levitation_codegen_partition);
+  Opts.LevitationCodeGenCache =
+      std::string(Args.getLastArgValue(OPT_levitation_codegen_cache));
   Opts.SplitDwarfInlining = !Args.hasArg(OPT_fno_split_dwarf_inlining);
   Opts.DebugTypeExtRefs = Args.hasArg(OPT_dwarf_ext_refs);
   Opts.DebugExplicitImport = Args.hasArg(OPT_dwarf_explicit_import);
@@ -1923,15 +1928,61 @@ static InputKind ParseFrontendArgs(FrontendOptions &Opts, ArgList &Args,
           std::string(Args.getLastArgValue(OPT_levitation_preamble));
   Opts.LevitationDependencyDeclASTs =
           Args.getAllArgValues(OPT_levitation_dependency);
+  Opts.LevitationNameIndex =
+          std::string(Args.getLastArgValue(OPT_levitation_name_index));
+  Opts.LevitationSourcesRoot =
+          std::string(Args.getLastArgValue(OPT_levitation_sources_root));
+  Opts.LevitationTrustDependencies =
+          Args.hasArg(OPT_flevitation_trust_dependencies);
+  Opts.LevitationEarlyCutoff =
+          Args.hasArg(OPT_flevitation_early_cutoff);
+  Opts.LevitationCompactDeclAST =
+          Args.hasArg(OPT_flevitation_compact_decl_ast);
+  Opts.LevitationEmbedMeta =
+          Args.hasArg(OPT_flevitation_embed_meta);
+  Opts.LevitationKeepUnchangedOutputs =
+          Args.hasArg(OPT_flevitation_keep_unchanged_outputs);
+  Opts.LevitationReleaseAST =
+          Args.hasArg(OPT_flevitation_release_ast);
   Opts.LevitationDependenciesOutputFile = std::string(
           Args.getLastArgValue(OPT_levitation_dependencies_output_file)
   );
   Opts.LevitationDeclASTMeta =
           std::string(Args.getLastArgValue(OPT_levitation_decl_ast_meta));
+  Opts.LevitationDependenciesOutputFiles =
+          Args.getAllArgValues(OPT_levitation_dependencies_output_file);
+  Opts.LevitationDeclASTMetas =
+          Args.getAllArgValues(OPT_levitation_decl_ast_meta);
+  if (const Arg *A = Args.getLastArg(OPT_levitation_hash_EQ)) {
+    levitation::HashKind Kind;
+    if (levitation::parseHashKind(A->getValue(), Kind))
+      Opts.LevitationHash = A->getValue();
+    else
+      Diags.Report(diag::err_drv_invalid_value)
+          << A->getAsString(Args) << A->getValue();
+  }
+  Opts.LevitationSourceDigest =
+          std::string(Args.getLastArgValue(OPT_levitation_source_digest_EQ));
+  Opts.LevitationCommandHash =
+          std::string(Args.getLastArgValue(OPT_levitation_command_hash_EQ));
+  Opts.LevitationTimeTraceOutput =
+          std::string(Args.getLastArgValue(OPT_levitation_time_trace_out_EQ));
+  Opts.LevitationStatsOutput =
+          std::string(Args.getLastArgValue(OPT_levitation_stats_EQ));
   Opts.LevitationASTPrint =
           Args.hasArg(OPT_flevitation_ast_print);
   Opts.LevitationUnitID =
           std::string(Args.getLastArgValue(OPT_levitation_unit_id));
+  Opts.LevitationHeaderOutput =
+          std::string(Args.getLastArgValue(OPT_levitation_header_output));
+  Opts.LevitationDeclOutput =
+          std::string(Args.getLastArgValue(OPT_levitation_decl_output));
+  Opts.LevitationHeaderPreamble =
+          std::string(Args.getLastArgValue(OPT_levitation_header_preamble));
+  Opts.LevitationHeaderIncludes =
+          Args.getAllArgValues(OPT_levitation_header_include);
+  Opts.LevitationDeclImports =
+          Args.getAllArgValues(OPT_levitation_decl_import);
 
   if (const Arg *A = Args.getLastArg(OPT_arcmt_check,
                                      OPT_arcmt_modify,
@@ -2862,6 +2913,17 @@ static void ParseLangArgs(LangOptions &Opts, ArgList &Args, InputKind IK,
       Opts.CPlusPlusModules;
   Opts.ModulesCodegen = Args.hasArg(OPT_fmodules_codegen);
   Opts.ModulesDebugInfo = Args.hasArg(OPT_fmodules_debuginfo);
+  Opts.LevitationModulesCodegen =
+      Args.hasArg(OPT_flevitation_modules_codegen);
+  Opts.LevitationModulesDebugInfo =
+      Args.hasArg(OPT_flevitation_modules_debuginfo);
+  Opts.LevitationInstantiateInterface =
+      Args.hasArg(OPT_flevitation_instantiate_interface);
+  Opts.LevitationExportBodies =
+      getLastArgIntValue(Args, OPT_flevitation_export_bodies_EQ, 0, Diags);
+  Opts.LevitationHiddenLTOVisibility =
+      Args.hasArg(OPT_flevitation_hidden_lto_visibility);
+  Opts.LevitationPublicUnit = Args.hasArg(OPT_flevitation_public_unit);
   Opts.ModulesSearchAll = Opts.Modules &&
     !Args.hasArg(OPT_fno_modules_search_all) &&
     Args.hasArg(OPT_fmodules_search_all);
@@ -3653,6 +3715,18 @@ static void parseLevitationManualImportArgs(
     Diags.Report(diag::err_fe_levitation_wrong_option)
     << "-levitation-dependency" << Stage;
   }
+  if (!FrontendOpts.LevitationNameIndex.empty()) {
+    Diags.Report(diag::err_fe_levitation_wrong_option)
+    << "-levitation-name-index" << Stage;
+  }
+  if (FrontendOpts.LevitationTrustDependencies) {
+    Diags.Report(diag::err_fe_levitation_wrong_option)
+    << "-flevitation-trust-dependencies" << Stage;
+  }
+  if (FrontendOpts.LevitationEarlyCutoff) {
+    Diags.Report(diag::err_fe_levitation_wrong_option)
+    << "-flevitation-early-cutoff" << Stage;
+  }
 
   if (FrontendOpts.LevitationBuildObject) {
     Diags.Report(diag::err_fe_levitation_wrong_option)
@@ -3663,6 +3737,18 @@ static void parseLevitationManualImportArgs(
     << "-flevitation-build-decl" << Stage;
   }
 
+  // Batch mode, each input should get its own outputs.
+  size_t NumInputs = FrontendOpts.Inputs.size();
+  if (
+    NumInputs > 1 && (
+      FrontendOpts.LevitationDependenciesOutputFiles.size() != NumInputs ||
+      FrontendOpts.LevitationDeclASTMetas.size() != NumInputs
+    )
+  ) {
+    Diags.Report(diag::err_fe_levitation_batch_outputs_mismatch)
+    << (unsigned)NumInputs;
+  }
+
   LangOpts.LevitationMode = 1;
   LangOpts.setLevitationBuildStage(LangOptions::LBSK_ParseManualDeps);
 }
@@ -3683,6 +3769,18 @@ static void parseLevitationBuildPreambleArgs(
     Diags.Report(diag::err_fe_levitation_wrong_option)
     << "-levitation-dependency" << Stage;
   }
+  if (!FrontendOpts.LevitationNameIndex.empty()) {
+    Diags.Report(diag::err_fe_levitation_wrong_option)
+    << "-levitation-name-index" << Stage;
+  }
+  if (FrontendOpts.LevitationTrustDependencies) {
+    Diags.Report(diag::err_fe_levitation_wrong_option)
+    << "-flevitation-trust-dependencies" << Stage;
+  }
+  if (FrontendOpts.LevitationEarlyCutoff) {
+    Diags.Report(diag::err_fe_levitation_wrong_option)
+    << "-flevitation-early-cutoff" << Stage;
+  }
   if (FrontendOpts.LevitationBuildObject) {
     Diags.Report(diag::err_fe_levitation_wrong_option)
     << "-flevitation-build-object" << Stage;
@@ -3741,12 +3839,30 @@ static void parseLevitationBuildObjectArgs(
     Diags.Report(diag::err_fe_levitation_missed_option)
     << "-levitation-unit-id" << Stage;
   }
+  if (!FrontendOpts.LevitationBuildDeclaration) {
+    if (!FrontendOpts.LevitationHeaderOutput.empty()) {
+      Diags.Report(diag::err_fe_levitation_wrong_option)
+      << "-levitation-header-output" << Stage;
+    }
+    if (!FrontendOpts.LevitationDeclOutput.empty()) {
+      Diags.Report(diag::err_fe_levitation_wrong_option)
+      << "-levitation-decl-output" << Stage;
+    }
+  }
 
   LangOpts.LevitationMode = 1;
 
   PreprocessorOpts.LevitationUnitID.swap(FrontendOpts.LevitationUnitID);
 
   if (FrontendOpts.LevitationBuildDeclaration) {
+    // Dependents only need comments for documentation diagnostics
+    // and tooling, which benefit from -fparse-all-comments anyway.
+    if (
+      FrontendOpts.LevitationCompactDeclAST &&
+      !LangOpts.CommentOpts.ParseAllComments
+    )
+      PreprocessorOpts.WriteCommentListToPCH = false;
+
     LangOpts.setLevitationBuildStage(LangOptions::LBSK_BuildDeclAST);
   } else
     LangOpts.setLevitationBuildStage(LangOptions::LBSK_BuildObjectFile);
@@ -107,6 +107,13 @@ GeneratePCHAction::CreateASTConsumer(CompilerInstance &CI, StringRef InFile) {
   if (!CI.getFrontendOpts().RelocatablePCH)
     Sysroot.clear();
 
+  // C++ Levitation: paths within sources root are written relative
+  // to it, so that Declaration AST doesn't depend on sources location.
+  if (CI.getLangOpts().LevitationMode &&
+      !CI.getFrontendOpts().LevitationSourcesRoot.empty())
+    Sysroot = CI.getFrontendOpts().LevitationSourcesRoot;
+  // end of C++ Levitation
+
   const auto &FrontendOpts = CI.getFrontendOpts();
   auto Buffer = std::make_shared<PCHBuffer>();
   std::vector<std::unique_ptr<ASTConsumer>> Consumers;
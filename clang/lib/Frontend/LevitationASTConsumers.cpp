@@ -51,8 +51,14 @@ namespace levitation {
 
   class ASTDependenciesProcessor : public LevitationPreprocessorConsumer {
     const CompilerInstance &CI;
+    std::string DepsOutput;
+    std::string MetaOutput;
   public:
-    ASTDependenciesProcessor(const CompilerInstance &ci) : CI(ci) {}
+    ASTDependenciesProcessor(
+        const CompilerInstance &ci,
+        StringRef depsOutput,
+        StringRef metaOutput
+    ) : CI(ci), DepsOutput(depsOutput), MetaOutput(metaOutput) {}
 
     void HandlePreprocessor(Preprocessor &PP) override {
 
@@ -65,10 +71,7 @@ namespace levitation {
         auto Writer = CreateBitstreamWriter(buffer);
         Writer->writeAndFinalize(Dependencies);
 
-        writeMeta(
-            CI.getFrontendOpts().LevitationDeclASTMeta,
-            buffer.str()
-        );
+        writeMeta(MetaOutput, buffer.str());
       }
 
       if (F.hasErrors()) {
@@ -77,7 +80,7 @@ namespace levitation {
     }
   private:
     File createFile() {
-      return File(CI.getFrontendOpts().LevitationDependenciesOutputFile);
+      return File(DepsOutput);
     }
 
     void writeMeta(StringRef MetaOut, StringRef LDepsBuffer) {
@@ -87,16 +90,18 @@ namespace levitation {
       // Only SourceManager and FileManager remain.
 
       auto &SM = CI.getSourceManager();
-      auto SrcBuffer = SM.getBufferData(SM.getMainFileID());
 
-      auto SourceMD5 = levitation::calcMD5(SrcBuffer);
-      auto OutputMD5 = levitation::calcMD5(LDepsBuffer);
+      levitation::HashKind Hash = levitation::HashKind::MD5;
+      levitation::parseHashKind(CI.getFrontendOpts().LevitationHash, Hash);
 
       levitation::DeclASTMeta Meta(
-        SourceMD5.Bytes,
-        OutputMD5.Bytes,
+        levitation::calcMainFileHash(
+            SM, Hash, CI.getFrontendOpts().LevitationSourceDigest
+        ),
+        levitation::calcHash(Hash, LDepsBuffer),
         DeclASTMeta::FragmentsVectorTy()
       );
+      Meta.setHashKind(Hash);
 
       assert(MetaOut.size());
       levitation::File F(MetaOut);
@@ -173,12 +178,36 @@ namespace levitation {
   };
 
 std::unique_ptr<LevitationPreprocessorConsumer> CreateDependenciesASTProcessor(
-    CompilerInstance &CI
+    CompilerInstance &CI,
+    StringRef CurrentFile
 ) {
-  if (CI.getFrontendOpts().LevitationDependenciesOutputFile.empty())
+  const auto &Opts = CI.getFrontendOpts();
+
+  StringRef DepsOutput = Opts.LevitationDependenciesOutputFile;
+  StringRef MetaOutput = Opts.LevitationDeclASTMeta;
+
+  // Several inputs, pick outputs of current one.
+  if (Opts.Inputs.size() > 1) {
+    for (size_t i = 0, e = Opts.Inputs.size(); i != e; ++i) {
+      if (
+        Opts.Inputs[i].isFile() &&
+        Opts.Inputs[i].getFile() == CurrentFile &&
+        i < Opts.LevitationDependenciesOutputFiles.size() &&
+        i < Opts.LevitationDeclASTMetas.size()
+      ) {
+        DepsOutput = Opts.LevitationDependenciesOutputFiles[i];
+        MetaOutput = Opts.LevitationDeclASTMetas[i];
+        break;
+      }
+    }
+  }
+
+  if (DepsOutput.empty())
     return nullptr;
 
-  return std::make_unique<ASTDependenciesProcessor>(CI);
+  return std::make_unique<ASTDependenciesProcessor>(
+      CI, DepsOutput, MetaOutput
+  );
 }
 
 std::unique_ptr<ASTConsumer> CreateUnitNamespaceVerifier(
@@ -9,8 +9,10 @@
 #include "clang/Frontend/LevitationFrontendActions.h"
 #include "clang/AST/ASTConsumer.h"
 #include "clang/AST/ASTDiagnostic.h"
-#include "clang/AST/ASTImporter.h"
-#include "clang/AST/ASTImporterLookupTable.h"
+#include "clang/AST/DeclCXX.h"
+#include "clang/AST/DeclFriend.h"
+#include "clang/AST/DeclTemplate.h"
+#include "clang/AST/PrettyPrinter.h"
 #include "clang/Basic/FileManager.h"
 #include "clang/Frontend/ASTConsumers.h"
 #include "clang/Frontend/CompilerInstance.h"
@@ -21,7 +23,9 @@
 #include "clang/Levitation/FileExtensions.h"
 #include "clang/Levitation/DeserializationListeners.h"
 #include "clang/Levitation/Common/File.h"
+#include "clang/Levitation/Common/Path.h"
 #include "clang/Levitation/Common/WithOperator.h"
+#include "clang/Levitation/Driver/HeaderGenerator.h"
 #include "clang/Levitation/Serialization.h"
 #include "clang/Lex/HeaderSearch.h"
 #include "clang/Lex/Preprocessor.h"
@@ -31,13 +35,20 @@
 #include "clang/Serialization/ASTReader.h"
 #include "clang/Serialization/ASTWriter.h"
 #include "clang/Serialization/GlobalModuleIndex.h"
+#include "clang/Serialization/InMemoryModuleCache.h"
 #include "llvm/ADT/ScopeExit.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/StringMap.h"
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/Path.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/SaveAndRestore.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/TimeProfiler.h"
 #include "llvm/Support/YAMLTraits.h"
+#include <algorithm>
+#include <chrono>
 #include <memory>
 #include <system_error>
 #include <utility>
@@ -125,9 +136,326 @@ void diagMetaFileIOIssues(
   }
 }
 
+void addDeclHashes(
+    llvm::StringMap<uint64_t> &Hashes,
+    const DeclContext *DC,
+    const PrintingPolicy &Policy
+) {
+  for (const auto *D : DC->decls()) {
+    if (D->isFromASTFile() || D->isImplicit())
+      continue;
+
+    if (isa<NamespaceDecl>(D) || isa<LinkageSpecDecl>(D) || isa<ExportDecl>(D)) {
+      addDeclHashes(Hashes, cast<DeclContext>(D), Policy);
+      continue;
+    }
+
+    // Printed declaration doesn't depend on source locations,
+    // and it includes only those bodies which were not skipped.
+    std::string Text;
+    llvm::raw_string_ostream OS(Text);
+    D->print(OS, Policy);
+    OS.flush();
+
+    const Decl *Top = levitation::getNamespaceLevelDecl(D);
+    auto Key = Top ? levitation::getDeclHashKey(Top) : std::string();
+
+    // Order of redeclarations doesn't matter.
+    Hashes[Key] += levitation::calcMD5(Text).low();
+  }
+}
+
+/// Calculates hashes of declarations and macros, defined
+/// in current translation unit. Macros and declarations without name
+/// are all kept under empty name.
+levitation::DeclASTMeta::DeclHashesVectorTy calcDeclHashes(
+    CompilerInstance &CI
+) {
+  llvm::StringMap<uint64_t> Hashes;
+
+  PrintingPolicy Policy(CI.getLangOpts());
+  addDeclHashes(Hashes, CI.getASTContext().getTranslationUnitDecl(), Policy);
+
+  auto &PP = CI.getPreprocessor();
+  for (const auto &M : PP.macros(/*IncludeExternalMacros=*/false)) {
+    const auto *MD = M.second.getLatest();
+    if (!MD || MD->isFromPCH())
+      continue;
+
+    std::string Text = M.first->getName().str();
+    if (const auto *MI = MD->getMacroInfo()) {
+      if (MI->isBuiltinMacro())
+        continue;
+      for (const auto &Tok : MI->tokens())
+        Text += " " + PP.getSpelling(Tok);
+    } else
+      Text += " #undef";
+
+    Hashes[""] += levitation::calcMD5(Text).low();
+  }
+
+  levitation::DeclASTMeta::DeclHashesVectorTy Res;
+  for (const auto &H : Hashes)
+    Res.push_back({H.first().str(), H.second});
+
+  std::sort(Res.begin(), Res.end(), [] (
+      const levitation::DeclASTMeta::DeclHashTy &LHS,
+      const levitation::DeclASTMeta::DeclHashTy &RHS
+  ) {
+    return LHS.Name < RHS.Name;
+  });
+
+  return Res;
+}
+
+/// Whether declaration may emit code into unit object. Inline functions,
+/// templates and their implicit instantiations are emitted by users.
+/// Declarations of unknown kinds are supposed to emit code.
+bool mayEmitCode(const Decl *D) {
+  if (D->isFromASTFile() || D->isImplicit())
+    return false;
+
+  auto anyMayEmitCode = [] (const DeclContext *DC) {
+    for (const auto *Sub : DC->decls())
+      if (mayEmitCode(Sub))
+        return true;
+    return false;
+  };
+
+  if (
+    isa<TranslationUnitDecl>(D) ||
+    isa<NamespaceDecl>(D) ||
+    isa<LinkageSpecDecl>(D) ||
+    isa<ExportDecl>(D)
+  )
+    return anyMayEmitCode(cast<DeclContext>(D));
+
+  if (const auto *FD = dyn_cast<FunctionDecl>(D))
+    return
+        FD->isThisDeclarationADefinition() &&
+        !FD->isDeleted() &&
+        !FD->isInlined() &&
+        !FD->isTemplated();
+
+  if (const auto *VD = dyn_cast<VarDecl>(D)) {
+    if (
+      VD->isThisDeclarationADefinition() == VarDecl::DeclarationOnly ||
+      VD->isInline() ||
+      VD->isTemplated()
+    )
+      return false;
+
+    // Internal constants are only emitted where they are used.
+    const auto *Init = VD->getInit();
+    bool IsConstant =
+        VD->getType().isConstQualified() &&
+        !VD->isExternallyVisible() &&
+        !VD->getType().isDestructedType() &&
+        (!Init || Init->isConstantInitializer(VD->getASTContext(), false));
+    return !IsConstant;
+  }
+
+  if (const auto *Spec = dyn_cast<ClassTemplateSpecializationDecl>(D))
+    if (Spec->getSpecializationKind() == TSK_ExplicitInstantiationDefinition)
+      return true;
+
+  if (const auto *RD = dyn_cast<CXXRecordDecl>(D))
+    return !RD->isDependentContext() && anyMayEmitCode(RD);
+
+  if (const auto *Friend = dyn_cast<FriendDecl>(D))
+    return Friend->getFriendDecl() && mayEmitCode(Friend->getFriendDecl());
+
+  return !(
+      isa<TypeDecl>(D) ||
+      isa<TemplateDecl>(D) ||
+      isa<FieldDecl>(D) ||
+      isa<IndirectFieldDecl>(D) ||
+      isa<EnumConstantDecl>(D) ||
+      isa<AccessSpecDecl>(D) ||
+      isa<UsingDecl>(D) ||
+      isa<UsingShadowDecl>(D) ||
+      isa<UsingDirectiveDecl>(D) ||
+      isa<NamespaceAliasDecl>(D) ||
+      isa<StaticAssertDecl>(D) ||
+      isa<EmptyDecl>(D) ||
+      isa<ImportDecl>(D) ||
+      isa<ClassScopeFunctionSpecializationDecl>(D)
+  );
+}
+
+/// Whether unit being parsed into declaration AST emits no code.
+/// Non-inline function bodies and variable initializers are skipped
+/// at this stage, so they are found among skipped fragments.
+bool isCodelessUnit(
+    CompilerInstance &CI,
+    const levitation::DeclASTMeta::FragmentsVectorTy &Fragments
+) {
+  // Source below #body is only parsed by object job.
+  if (
+    CI.getSema().LevitationHasExplicitInstantiations ||
+    CI.getPreprocessor().getLevitationBodySize()
+  )
+    return false;
+
+  for (const auto &F : Fragments) {
+    switch (F.Action) {
+      case levitation::SourceFragmentAction::Skip:
+      case levitation::SourceFragmentAction::ReplaceWithSemicolon:
+      case levitation::SourceFragmentAction::PutExtern:
+      case levitation::SourceFragmentAction::ReplaceWithSemicolonInHeaderOnly:
+        return false;
+      default:
+        break;
+    }
+  }
+
+  return !mayEmitCode(CI.getASTContext().getTranslationUnitDecl());
+}
+
+/// Collects legacy headers parsed in current translation unit.
+/// Files of loaded ASTs (dependencies, preamble) are not local
+/// entries, so they are not collected, those are tracked by driver.
+levitation::DeclASTMeta::IncludesVectorTy collectIncludes(
+    SourceManager &SM,
+    levitation::HashKind Hash
+) {
+  levitation::DeclASTMeta::IncludesVectorTy Res;
+
+  const FileEntry *MainFile = SM.getFileEntryForID(SM.getMainFileID());
+  llvm::SmallPtrSet<const FileEntry*, 32> Visited;
+
+  for (unsigned i = 0, e = SM.local_sloc_entry_size(); i != e; ++i) {
+    const auto &Entry = SM.getLocalSLocEntry(i);
+    if (!Entry.isFile())
+      continue;
+
+    const auto *Content = Entry.getFile().getContentCache();
+    const FileEntry *FE = Content ? Content->OrigEntry : nullptr;
+
+    // Header included several times has entry per inclusion.
+    if (!FE || FE == MainFile || !Visited.insert(FE).second)
+      continue;
+
+    levitation::DeclASTMeta::IncludeTy Inc;
+    Inc.Path = FE->getName().str();
+    Inc.MTime = (uint64_t)FE->getModificationTime();
+    Inc.Size = (uint64_t)FE->getSize();
+
+    if (const auto *Buffer = Content->getRawBuffer())
+      Inc.Hash = levitation::calcHash(Hash, Buffer->getBuffer());
+    else if (auto Buffer = SM.getFileManager().getBufferForFile(FE))
+      Inc.Hash = levitation::calcHash(Hash, Buffer.get()->getBuffer());
+    else
+      continue;
+
+    Res.push_back(std::move(Inc));
+  }
+
+  std::sort(Res.begin(), Res.end(), [] (
+      const levitation::DeclASTMeta::IncludeTy &LHS,
+      const levitation::DeclASTMeta::IncludeTy &RHS
+  ) {
+    return LHS.Path < RHS.Path;
+  });
+
+  return Res;
+}
+
+/// Emits .h and .decl files of unit from fragments collected
+/// during parsing, outputs which are not requested are skipped.
+/// When both are requested, fragments are walked once.
+void emitGeneratedFiles(
+    DiagnosticsEngine &Diag,
+    StringRef HeaderOut,
+    StringRef DeclOut,
+    StringRef UnitID,
+    StringRef Source,
+    StringRef Preamble,
+    const std::vector<std::string> &Includes,
+    const std::vector<std::string> &Imports,
+    const levitation::DeclASTMeta::FragmentsVectorTy &Fragments
+) {
+  if (HeaderOut.empty() && DeclOut.empty())
+    return;
+
+  levitation::Paths IncludePaths, ImportPaths;
+  for (const auto &Inc : Includes)
+    IncludePaths.emplace_back(Inc);
+  for (const auto &Imp : Imports)
+    ImportPaths.emplace_back(Imp);
+
+  levitation::tools::HeaderGenerator Header(
+      UnitID, HeaderOut, /*SourceFile=*/"", Preamble, IncludePaths,
+      Fragments, /*Verbose=*/false, /*DryRun=*/false
+  );
+
+  levitation::tools::HeaderGenerator Decl(
+      UnitID, DeclOut, /*SourceFile=*/"", Preamble, ImportPaths,
+      Fragments, /*Verbose=*/false, /*DryRun=*/false, /*CreateDecl=*/true
+  );
+
+  levitation::File HeaderF(HeaderOut, /*KeepIfUnchanged=*/true);
+  levitation::File DeclF(DeclOut, /*KeepIfUnchanged=*/true);
+
+  if (HeaderOut.size() && DeclOut.size()) {
+    auto OpenedHeader = HeaderF.open();
+    auto OpenedDecl = DeclF.open();
+    if (OpenedHeader && OpenedDecl)
+      levitation::tools::HeaderGenerator::emit(
+          Header, OpenedHeader.getOutputStream(),
+          Decl, OpenedDecl.getOutputStream(),
+          Source
+      );
+  } else if (HeaderOut.size()) {
+    if (auto OpenedHeader = HeaderF.open())
+      Header.emit(OpenedHeader.getOutputStream(), Source);
+  } else {
+    if (auto OpenedDecl = DeclF.open())
+      Decl.emit(OpenedDecl.getOutputStream(), Source);
+  }
+
+  if (HeaderOut.size() && HeaderF.hasErrors())
+    Diag.Report(diag::err_fe_levitation_generated_file_failed_to_create)
+    << HeaderOut;
+
+  if (DeclOut.size() && DeclF.hasErrors())
+    Diag.Report(diag::err_fe_levitation_generated_file_failed_to_create)
+    << DeclOut;
+}
+
+/// Appends meta to output file, see levitation::writeEmbeddedMeta.
+bool embedMeta(
+    DiagnosticsEngine &Diag,
+    StringRef OutFile,
+    const levitation::DeclASTMeta &Meta
+) {
+  std::string MetaBytes;
+  llvm::raw_string_ostream MetaOS(MetaBytes);
+  levitation::CreateMetaBitstreamWriter(MetaOS)->writeAndFinalize(Meta);
+  MetaOS.flush();
+
+  std::error_code EC;
+  llvm::raw_fd_ostream OS(OutFile, EC, llvm::sys::fs::OF_Append);
+  if (!EC) {
+    levitation::writeEmbeddedMeta(OS, MetaBytes);
+    OS.close();
+  }
+
+  if (EC || OS.has_error()) {
+    OS.clear_error();
+    Diag.Report(diag::err_fe_levitation_decl_ast_meta_failed_to_create)
+    << OutFile;
+    return false;
+  }
+
+  return true;
+}
+
 template <typename EndSourceFileActionF>
 void CreateMetaWrapper(
-    FrontendAction &Action, EndSourceFileActionF &&EndSourceFileParentAction
+    FrontendAction &Action,
+    EndSourceFileActionF &&EndSourceFileParentAction,
+    const levitation::UsedDeclsCollector *UsedDeclsCollector = nullptr
 ) {
     // Remember everything we need for pos-processing.
   // After FrontendAction::EndSourceFile()
@@ -141,44 +469,144 @@ void CreateMetaWrapper(
   auto &Diag = CI.getDiagnostics();
   auto SkippedSrcFragments = CI.getSema().levitationGetSourceFragments();
 
+  bool EarlyCutoff = CI.getFrontendOpts().LevitationEarlyCutoff;
+  bool KeepUnchanged = CI.getFrontendOpts().LevitationKeepUnchangedOutputs;
+
+  bool IsDeclAST = CI.getLangOpts().isLevitationMode(
+      LangOptions::LBSK_BuildDeclAST
+  );
+
+  auto getUnitID = [&] { return CI.getPreprocessorOpts().LevitationUnitID; };
+
+  // Declarations are printed to be hashed, which costs about as much as
+  // AST serialization itself, so hashes are only computed for
+  // early cutoff, the only one who reads them during build.
+  bool WithDeclHashes = EarlyCutoff && IsDeclAST;
+
+  levitation::DeclASTMeta::DeclHashesVectorTy DeclHashes;
+  if (WithDeclHashes) {
+    llvm::TimeTraceScope TimeScope("LevitationDeclHashes", getUnitID);
+    DeclHashes = calcDeclHashes(CI);
+  }
+
+  bool Codeless = IsDeclAST && isCodelessUnit(CI, SkippedSrcFragments);
+
+  // Fragments are still in memory, so .h and .decl files are generated
+  // here rather than by driver, which would read source and meta again.
+  const auto &FrontendOpts = CI.getFrontendOpts();
+  std::string UnitID = CI.getPreprocessorOpts().LevitationUnitID;
+  std::string HeaderOut, DeclOut, HeaderPreamble;
+  std::vector<std::string> HeaderIncludes, DeclImports;
+  if (IsDeclAST) {
+    HeaderOut = FrontendOpts.LevitationHeaderOutput;
+    DeclOut = FrontendOpts.LevitationDeclOutput;
+    HeaderPreamble = FrontendOpts.LevitationHeaderPreamble;
+    HeaderIncludes = FrontendOpts.LevitationHeaderIncludes;
+    DeclImports = FrontendOpts.LevitationDeclImports;
+  }
+
+  levitation::DeclASTMeta::UsedDeclsVectorTy UsedDecls;
+  if (EarlyCutoff && UsedDeclsCollector) {
+    UsedDecls = UsedDeclsCollector->getUsedDecls();
+
+    StringRef SourcesRoot = CI.getFrontendOpts().LevitationSourcesRoot;
+    if (SourcesRoot.size()) {
+      for (auto &Used : UsedDecls)
+        Used.DeclAST = levitation::Path::makeRelative<levitation::SinglePath>(
+            Used.DeclAST, SourcesRoot
+        ).str().str();
+
+      std::sort(UsedDecls.begin(), UsedDecls.end(), [] (
+          const levitation::DeclASTMeta::UsedDeclsTy &LHS,
+          const levitation::DeclASTMeta::UsedDeclsTy &RHS
+      ) {
+        return LHS.DeclAST < RHS.DeclAST;
+      });
+    }
+  }
+
   EndSourceFileParentAction();
 
   auto SrcBuffer = SM.getBufferData(SM.getMainFileID());
-  std::unique_ptr<llvm::MemoryBuffer> OutBuffer;
 
-  StringRef OutFile = CI.getCurrentOutputFilePath();
+  levitation::HashKind Hash = levitation::HashKind::MD5;
+  levitation::parseHashKind(CI.getFrontendOpts().LevitationHash, Hash);
 
-  assert(OutFile.size());
+  // Output is usually hashed while it is written. Outputs patched
+  // after being written (e.g. object files) are read back instead.
+  levitation::HashVectorTy OutHash;
+  if (!CI.getLevitationOutputHash(OutHash)) {
+    llvm::TimeTraceScope TimeScope("LevitationOutputHash", getUnitID);
+    StringRef OutFile = CI.getCurrentOutputFilePath();
 
-  if (auto OutBufferRes = FM.getBufferForFile(OutFile)) {
-    OutBuffer = std::move(OutBufferRes.get());
-  } else {
-    Diag.Report(diag::err_fe_levitation_decl_ast_meta_failed_to_create)
-    << OutFile;
-    return;
+    assert(OutFile.size());
+
+    if (auto OutBufferRes = FM.getBufferForFile(OutFile)) {
+      OutHash = levitation::calcHash(Hash, OutBufferRes.get()->getBuffer());
+    } else {
+      Diag.Report(diag::err_fe_levitation_decl_ast_meta_failed_to_create)
+      << OutFile;
+      return;
+    }
   }
 
-  auto SourceMD5 = levitation::calcMD5(SrcBuffer);
-  auto OutputMD5 = levitation::calcMD5(OutBuffer->getBuffer());
+  levitation::HashVectorTy SourceHash;
+  {
+    llvm::TimeTraceScope TimeScope("LevitationSourceHash", getUnitID);
+    SourceHash = levitation::calcMainFileHash(
+        SM, Hash, CI.getFrontendOpts().LevitationSourceDigest
+    );
+  }
 
   levitation::DeclASTMeta Meta(
-    SourceMD5.Bytes,
-    OutputMD5.Bytes,
+    SourceHash,
+    OutHash,
     SkippedSrcFragments
   );
+  Meta.setHashKind(Hash);
 
-  assert(MetaOut.size());
-  levitation::File F(MetaOut);
+  Meta.setInterfaceHash(
+      levitation::DeclASTMeta::calcInterfaceHash(
+          SrcBuffer, SkippedSrcFragments
+      ).Bytes
+  );
 
-  if (auto OpenedFile = F.open()) {
-    auto Writer = levitation::CreateMetaBitstreamWriter(OpenedFile.getOutputStream());
-    Writer->writeAndFinalize(Meta);
-  }
+  if (WithDeclHashes)
+    Meta.setDeclHashes(std::move(DeclHashes));
 
-  if (F.hasErrors()) {
-    diagMetaFileIOIssues(Diag, F.getStatus());
-    return;
+  Meta.setCodeless(Codeless);
+
+  if (EarlyCutoff && UsedDeclsCollector)
+    Meta.setUsedDecls(std::move(UsedDecls));
+
+  Meta.setIncludes(collectIncludes(SM, Hash));
+
+  Meta.setCommandHash(StringRef(CI.getFrontendOpts().LevitationCommandHash));
+
+  // Output is not renamed yet, so if unchanged outputs are kept,
+  // embedded meta is compared along with it.
+  if (IsDeclAST && CI.getFrontendOpts().LevitationEmbedMeta) {
+    if (!embedMeta(Diag, CI.getCurrentOutputFilePath(), Meta))
+      return;
+  } else {
+    assert(MetaOut.size());
+    levitation::File F(MetaOut, KeepUnchanged);
+
+    if (auto OpenedFile = F.open()) {
+      auto Writer = levitation::CreateMetaBitstreamWriter(OpenedFile.getOutputStream());
+      Writer->writeAndFinalize(Meta);
+    }
+
+    if (F.hasErrors()) {
+      diagMetaFileIOIssues(Diag, F.getStatus());
+      return;
+    }
   }
+
+  emitGeneratedFiles(
+      Diag, HeaderOut, DeclOut, UnitID, SrcBuffer, HeaderPreamble,
+      HeaderIncludes, DeclImports, SkippedSrcFragments
+  );
 }
 
 } // end of anonymous namespace
@@ -224,7 +652,11 @@ public:
       CompilerInst.getModuleCache(),
       &CompilerInst.getASTContext(),
       CompilerInst.getPCHContainerReader(),
-      {}
+      {},
+      // Relative paths of Declaration ASTs are relative to sources root.
+      /*isysroot=*/CompilerInst.getFrontendOpts().LevitationSourcesRoot,
+      /*DisableValidation=*/
+      CompilerInst.getFrontendOpts().LevitationTrustDependencies
     ),
     MainFile(mainFile),
     Diags(CompilerInst.getDiagnostics()),
@@ -264,12 +696,63 @@ public:
     }
   }
 
+  /// Reads name index. Index is an optimization only, so if it
+  /// can't be read, all dependencies are visited during identifier lookup.
+  void readNameIndex(StringRef IndexPath) {
+    auto Result = GlobalModuleIndex::readLevitationIndex(IndexPath);
+    if (llvm::Error Err = std::move(Result.second)) {
+      consumeError(std::move(Err));
+      return;
+    }
+    LevitationNameIndex.reset(Result.first);
+  }
+
+  /// Opens and maps given AST files in parallel, and puts them into
+  /// module cache, so that reading them later only parses them.
+  /// Files which can't be mapped are left to read(), which reports errors.
+  void mapFiles(ArrayRef<StringRef> Files) {
+    if (Files.size() < 2)
+      return;
+
+    // Each job is one of many running in parallel already,
+    // so few threads are enough to hide open and mmap latency.
+    const unsigned MaxThreads = 4;
+
+    auto &FS = FileMgr.getVirtualFileSystem();
+    std::vector<std::unique_ptr<llvm::MemoryBuffer>> Buffers(Files.size());
+
+    {
+      llvm::ThreadPool Pool(llvm::hardware_concurrency(
+          std::min<unsigned>(Files.size(), MaxThreads)
+      ));
+
+      for (unsigned i = 0, e = Files.size(); i != e; ++i)
+        Pool.async([&, i] {
+          // Same as ModuleManager does, see addModule.
+          auto Buf = FS.getBufferForFile(
+              Files[i], /*FileSize=*/-1, /*RequiresNullTerminator=*/false
+          );
+          if (Buf)
+            Buffers[i] = std::move(*Buf);
+        });
+
+      Pool.wait();
+    }
+
+    auto &Cache = ModuleMgr.getModuleCache();
+    for (unsigned i = 0, e = Files.size(); i != e; ++i)
+      if (Buffers[i] && !Cache.lookupPCM(Files[i]))
+        Cache.addPCM(Files[i], std::move(Buffers[i]));
+  }
+
   void readDependency(StringRef Dependency) {
     if (hasErrors())
       return;
 
     serialization::ModuleKind Kind = serialization::MK_LevitationDependency;
 
+    llvm::TimeTraceScope TimeScope("LevitationReadDependency", Dependency);
+
     ReadResult = Dependency == MainFile ?
         readMainFile() :
         read(Dependency, Kind);
@@ -334,6 +817,10 @@ private:
       FileID MainFileID = ModuleMgr[MainFileChainIndex].OriginalSourceFileID;
       SourceMgr.setMainFileID(MainFileID);
     }
+
+    if (LevitationNameIndex)
+      for (auto F : ModuleMgr.LevitationModules)
+        LevitationNameIndex->loadedModuleFile(F);
   }
 
   ASTReadResult read(
@@ -375,7 +862,8 @@ std::unique_ptr<levitation::LevitationPreprocessorConsumer>
 LevitationParseImportAction::CreatePreprocessorConsumer() {
   return MultiplexPPConsumerBuilder()
     .addRequired(levitation::CreateDependenciesASTProcessor(
-         getCompilerInstance()
+         getCompilerInstance(),
+         getCurrentFile()
      ))
   .done();
 }
@@ -470,6 +958,9 @@ void LevitationBuildObjectAction::loadASTFiles() {
 
   CompilerInstance &CI = getCompilerInstance();
 
+  // Scope name is used by levitation driver time trace report.
+  llvm::TimeTraceScope TimeScope("LevitationLoadDependencies");
+
   CI.getDiagnostics().getClient()->BeginSourceFile(
       CI.getASTContext().getLangOpts()
   );
@@ -479,14 +970,6 @@ void LevitationBuildObjectAction::loadASTFiles() {
       &CI.getASTContext()
   );
 
-  IntrusiveRefCntPtr<DiagnosticIDs> DiagIDs(
-      CI.getDiagnostics().getDiagnosticIDs()
-  );
-
-  ASTImporterLookupTable LookupTable(
-      *CI.getASTContext().getTranslationUnitDecl()
-  );
-
   IntrusiveRefCntPtr<LevitationModulesReader>
       Reader(new LevitationModulesReader(
           CI, MainFile, /*On Fail do*/ diagFailedToRead
@@ -495,13 +978,43 @@ void LevitationBuildObjectAction::loadASTFiles() {
   CI.getASTContext().setExternalSource(Reader);
   setupDeserializationListener(*Reader);
 
+  StringRef NameIndex = CI.getFrontendOpts().LevitationNameIndex;
+  if (NameIndex.size())
+    Reader->readNameIndex(NameIndex);
+
+  // Reading file may load other ones as well (e.g. preamble),
+  // time is attributed to all files loaded.
+  auto measured = [&] (llvm::function_ref<void()> Read) {
+    if (!StatsCollector)
+      return Read();
+
+    auto &ModuleMgr = Reader->getModuleManager();
+    unsigned NumLoaded = ModuleMgr.size();
+    auto Start = std::chrono::steady_clock::now();
+
+    Read();
+
+    auto Time = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - Start
+    ).count();
+
+    for (unsigned i = NumLoaded, e = ModuleMgr.size(); i != e; ++i)
+      StatsCollector->addLoadTime(ModuleMgr[i], Time / (e - NumLoaded));
+  };
+
+  SmallVector<StringRef, 32> Files;
+  if (PreambleFileName.size())
+    Files.push_back(PreambleFileName);
+  Files.append(ASTFiles.begin(), ASTFiles.end());
+  Reader->mapFiles(Files);
+
   with(auto Opened = Reader->open()) {
 
     if (PreambleFileName.size())
-      Reader->readPreamble(PreambleFileName);
+      measured([&] { Reader->readPreamble(PreambleFileName); });
 
     for (const auto &Dep : ASTFiles) {
-      Reader->readDependency(Dep);
+      measured([&] { Reader->readDependency(Dep); });
     }
   }
 
@@ -547,6 +1060,28 @@ void LevitationBuildObjectAction::setupDeserializationListener(
     DeleteDeserialListener = true;
   }
 
+  if (CI.getFrontendOpts().LevitationEarlyCutoff) {
+    UsedDeclsCollector = new levitation::UsedDeclsCollector(
+        Reader,
+        DeserialListener,
+        DeleteDeserialListener
+    );
+
+    DeserialListener = UsedDeclsCollector;
+    DeleteDeserialListener = true;
+  }
+
+  if (CI.getFrontendOpts().LevitationStatsOutput.size()) {
+    StatsCollector = new levitation::DeserializationStatsCollector(
+        Reader,
+        DeserialListener,
+        DeleteDeserialListener
+    );
+
+    DeserialListener = StatsCollector;
+    DeleteDeserialListener = true;
+  }
+
   Reader.setDeserializationListener(
       DeserialListener,
       DeleteDeserialListener
@@ -586,6 +1121,48 @@ LevitationBuildObjectAction::createASTConsumerInternal(
   .done();
 }
 
+void LevitationBuildObjectAction::writeDependencyStats() {
+  if (!StatsCollector)
+    return;
+
+  CompilerInstance &CI = getCompilerInstance();
+  StringRef StatsOut = CI.getFrontendOpts().LevitationStatsOutput;
+  StringRef SourcesRoot = CI.getFrontendOpts().LevitationSourcesRoot;
+
+  auto Stats = StatsCollector->getStats();
+
+  // Same paths as in used declarations of meta file.
+  if (SourcesRoot.size())
+    for (auto &S : Stats)
+      S.File = levitation::Path::makeRelative<levitation::SinglePath>(
+          S.File, SourcesRoot
+      ).str().str();
+
+  levitation::File F(StatsOut);
+  if (auto OpenedFile = F.open())
+    levitation::DependencyStats::write(OpenedFile.getOutputStream(), Stats);
+
+  if (F.hasErrors())
+    CI.getDiagnostics().Report(
+        diag::err_fe_levitation_generated_file_failed_to_create
+    ) << StatsOut;
+}
+
 void LevitationBuildObjectAction::EndSourceFileAction() {
-  CreateMetaWrapper(*this, [&] { ASTMergeAction::EndSourceFileAction(); });
+  // Reader is still alive here, it is released with AST context.
+  writeDependencyStats();
+  StatsCollector = nullptr;
+
+  if (!WriteOutputs) {
+    ASTMergeAction::EndSourceFileAction();
+    UsedDeclsCollector = nullptr;
+    return;
+  }
+
+  CreateMetaWrapper(
+      *this,
+      [&] { ASTMergeAction::EndSourceFileAction(); },
+      UsedDeclsCollector
+  );
+  UsedDeclsCollector = nullptr;
 }
@@ -188,10 +188,13 @@ CreateFrontendAction(CompilerInstance &CI) {
         LangOptions::LBSK_BuildObjectFile,
         LangOptions::LBSK_BuildDeclAST
   )) {
+    // Syntax only object build checks unit against its dependencies,
+    // but neither object, nor meta is written, see --check.
     Act = std::make_unique<LevitationBuildObjectAction>(
         std::move(Act),
         FEOpts.LevitationPreambleFileName,
-        FEOpts.LevitationDependencyDeclASTs
+        FEOpts.LevitationDependencyDeclASTs,
+        /*WriteOutputs=*/FEOpts.ProgramAction != frontend::ParseSyntaxOnly
     );
   }
 
@@ -0,0 +1,387 @@
+//===--- C++ Levitation DependenciesIndex.cpp -------------------*- C++ -*-===//
+//
+// Part of the C++ Levitation Project,
+// under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file contains implementation of project-wide dependencies index.
+//
+//===----------------------------------------------------------------------===//
+
+#include "clang/Levitation/Common/File.h"
+#include "clang/Levitation/Common/WithOperator.h"
+#include "clang/Levitation/DependenciesSolver/DependenciesIndex.h"
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/EndianStream.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace clang { namespace levitation { namespace dependencies_solver {
+
+namespace {
+  const char INDEX_MAGIC[4] = { 'L', 'D', 'I', 'X' };
+  const uint32_t INDEX_VERSION = 1;
+
+  enum UnitFlags : uint32_t {
+    UNIT_PUBLIC = 1,
+    UNIT_BODY_ONLY = 2
+  };
+
+  size_t alignTo4(size_t Size) {
+    return (Size + 3) & ~size_t(3);
+  }
+
+  /// Reads index data, each method fails if data is truncated.
+  class IndexCursor {
+    const char *Cur;
+    const char *End;
+
+  public:
+    IndexCursor(llvm::StringRef Data)
+    : Cur(Data.begin()), End(Data.end()) {}
+
+    bool read(uint32_t &V) {
+      if (End - Cur < 4)
+        return false;
+      V = llvm::support::endian::read32le(Cur);
+      Cur += 4;
+      return true;
+    }
+
+    bool read(llvm::StringRef &Bytes, size_t Size) {
+      size_t Aligned = alignTo4(Size);
+      if ((size_t)(End - Cur) < Aligned)
+        return false;
+      Bytes = llvm::StringRef(Cur, Size);
+      Cur += Aligned;
+      return true;
+    }
+  };
+}
+
+void DependenciesIndex::addDependencies(
+    DependenciesStringsPool &DestStrings,
+    DependenciesData::DeclarationsBlock &Dest,
+    const DependenciesStringsPool &SrcStrings,
+    llvm::ArrayRef<StringID> Src
+) {
+  for (auto ID : Src)
+    Dest.insert(Declaration(DestStrings.addItem(*SrcStrings.getItem(ID))));
+}
+
+bool DependenciesIndex::getDependencies(
+    DependenciesData &Data,
+    llvm::StringRef UnitPath,
+    HashRef SourceHash
+) const {
+  if (SourceHash.empty())
+    return false;
+
+  auto Found = Units.find(UnitPath);
+  if (Found == Units.end())
+    return false;
+
+  const auto &Record = Found->second;
+  if (HashRef(Record.SourceHash) != SourceHash)
+    return false;
+
+  Data.IsPublic = Record.IsPublic;
+  Data.IsBodyOnly = Record.IsBodyOnly;
+
+  addDependencies(
+      *Data.Strings, Data.DeclarationDependencies,
+      Strings, Record.DeclarationDependencies
+  );
+  addDependencies(
+      *Data.Strings, Data.DefinitionDependencies,
+      Strings, Record.DefinitionDependencies
+  );
+
+  return true;
+}
+
+void DependenciesIndex::setDependencies(
+    llvm::StringRef UnitPath,
+    HashRef SourceHash,
+    const DependenciesData &Data
+) {
+  UnitRecord Record;
+  Record.SourceHash.assign(SourceHash.begin(), SourceHash.end());
+  Record.IsPublic = Data.IsPublic;
+  Record.IsBodyOnly = Data.IsBodyOnly;
+
+  auto addIDs = [&] (
+      llvm::SmallVectorImpl<StringID> &Dest,
+      const DependenciesData::DeclarationsBlock &Src
+  ) {
+    for (const auto &D : Src)
+      Dest.push_back(Strings.addItem(*Data.Strings->getItem(D.UnitIdentifier)));
+
+    // Same dependencies give same record, no matter
+    // in which order they were loaded.
+    std::sort(Dest.begin(), Dest.end());
+  };
+
+  addIDs(Record.DeclarationDependencies, Data.DeclarationDependencies);
+  addIDs(Record.DefinitionDependencies, Data.DefinitionDependencies);
+
+  auto &Existing = Units[UnitPath];
+  if (
+    Existing.SourceHash == Record.SourceHash &&
+    Existing.IsPublic == Record.IsPublic &&
+    Existing.IsBodyOnly == Record.IsBodyOnly &&
+    Existing.DeclarationDependencies == Record.DeclarationDependencies &&
+    Existing.DefinitionDependencies == Record.DefinitionDependencies
+  )
+    return;
+
+  Existing = std::move(Record);
+  Changed = true;
+}
+
+void DependenciesIndex::removeUnits(
+    std::function<bool(llvm::StringRef)> &&ShouldRemove
+) {
+  for (auto It = Units.begin(), e = Units.end(); It != e;) {
+    auto Cur = It++;
+    if (ShouldRemove(Cur->first())) {
+      Units.erase(Cur);
+      Changed = true;
+    }
+  }
+}
+
+Failable DependenciesIndex::load(llvm::StringRef IndexFile) {
+  // Large files are mapped rather than read.
+  auto Buffer = llvm::MemoryBuffer::getFile(
+      IndexFile, /*FileSize=*/-1, /*RequiresNullTerminator=*/false
+  );
+
+  if (!Buffer) {
+    Failable Status;
+    Status.setFailure()
+    << "Failed to open dependencies index '" << IndexFile << "'.";
+    return Status;
+  }
+
+  return read(*Buffer.get());
+}
+
+Failable DependenciesIndex::read(const llvm::MemoryBuffer &Buffer) {
+  Failable Status;
+
+  Units.clear();
+  Changed = false;
+
+  IndexCursor C(Buffer.getBuffer());
+
+  llvm::StringRef Magic;
+  uint32_t Version, NumStrings, NumUnits, BlobSize;
+
+  if (
+    !C.read(Magic, sizeof(INDEX_MAGIC)) ||
+    Magic != llvm::StringRef(INDEX_MAGIC, sizeof(INDEX_MAGIC))
+  ) {
+    Status.setFailure("Not a dependencies index.");
+    return Status;
+  }
+
+  if (!C.read(Version) || Version != INDEX_VERSION) {
+    Status.setFailure("Unsupported dependencies index version.");
+    return Status;
+  }
+
+  auto setTruncated = [&] {
+    Units.clear();
+    Status.setFailure("Dependencies index is truncated.");
+    return Status;
+  };
+
+  if (!C.read(NumStrings) || !C.read(NumUnits) || !C.read(BlobSize))
+    return setTruncated();
+
+  // Each string takes at least its offset.
+  if (NumStrings > Buffer.getBufferSize() / 4)
+    return setTruncated();
+
+  std::vector<uint32_t> Offsets(NumStrings + 1);
+  for (auto &Offset : Offsets)
+    if (!C.read(Offset))
+      return setTruncated();
+
+  llvm::StringRef Blob;
+  if (!C.read(Blob, BlobSize))
+    return setTruncated();
+
+  // File string indices to IDs in our pool.
+  std::vector<StringID> IDs;
+  IDs.reserve(NumStrings);
+  for (uint32_t i = 0; i != NumStrings; ++i) {
+    if (Offsets[i] > Offsets[i + 1] || Offsets[i + 1] > BlobSize) {
+      Units.clear();
+      Status.setFailure("Dependencies index strings table is broken.");
+      return Status;
+    }
+    IDs.push_back(
+        Strings.addItem(Blob.slice(Offsets[i], Offsets[i + 1]))
+    );
+  }
+
+  auto readIDs = [&] (
+      llvm::SmallVectorImpl<StringID> &Dest, uint32_t Num
+  ) {
+    for (uint32_t i = 0; i != Num; ++i) {
+      uint32_t FileID;
+      if (!C.read(FileID) || FileID >= NumStrings)
+        return false;
+      Dest.push_back(IDs[FileID]);
+    }
+    return true;
+  };
+
+  for (uint32_t i = 0; i != NumUnits; ++i) {
+    uint32_t PathID, Flags, HashSize, NumDecl, NumDef;
+    llvm::StringRef Hash;
+
+    if (
+      !C.read(PathID) || PathID >= NumStrings ||
+      !C.read(Flags) ||
+      !C.read(HashSize) ||
+      !C.read(NumDecl) ||
+      !C.read(NumDef) ||
+      !C.read(Hash, HashSize)
+    )
+      return setTruncated();
+
+    UnitRecord Record;
+    Record.SourceHash.assign(Hash.bytes_begin(), Hash.bytes_end());
+    Record.IsPublic = Flags & UNIT_PUBLIC;
+    Record.IsBodyOnly = Flags & UNIT_BODY_ONLY;
+
+    if (
+      !readIDs(Record.DeclarationDependencies, NumDecl) ||
+      !readIDs(Record.DefinitionDependencies, NumDef)
+    )
+      return setTruncated();
+
+    Units[*Strings.getItem(IDs[PathID])] = std::move(Record);
+  }
+
+  return Status;
+}
+
+Failable DependenciesIndex::save(llvm::StringRef IndexFile) {
+  Failable Status;
+
+  File F(IndexFile);
+  with (auto Scope = F.open()) {
+    write(Scope.getOutputStream());
+  }
+
+  if (F.hasErrors()) {
+    Status.setFailure()
+    << "Failed to write dependencies index '" << IndexFile << "'.";
+    return Status;
+  }
+
+  Changed = false;
+  return Status;
+}
+
+void DependenciesIndex::write(llvm::raw_ostream &OS) const {
+  llvm::support::endian::Writer W(OS, llvm::support::little);
+
+  auto pad = [&] (size_t Size) {
+    for (size_t i = Size, e = alignTo4(Size); i != e; ++i)
+      W.write<uint8_t>(0);
+  };
+
+  // Units are written in order of their paths, so that
+  // same index always gives same file.
+  std::vector<const llvm::StringMapEntry<UnitRecord>*> SortedUnits;
+  SortedUnits.reserve(Units.size());
+  for (const auto &U : Units)
+    SortedUnits.push_back(&U);
+
+  std::sort(SortedUnits.begin(), SortedUnits.end(), [] (
+      const llvm::StringMapEntry<UnitRecord> *L,
+      const llvm::StringMapEntry<UnitRecord> *R
+  ) {
+    return L->first() < R->first();
+  });
+
+  // Only strings used by records go into file, so removed
+  // units don't leave their strings behind.
+  llvm::DenseMap<llvm::StringRef, uint32_t> FileIDs;
+  std::vector<llvm::StringRef> FileStrings;
+
+  auto getFileID = [&] (llvm::StringRef S) {
+    auto Ins = FileIDs.insert({S, (uint32_t)FileStrings.size()});
+    if (Ins.second)
+      FileStrings.push_back(S);
+    return Ins.first->second;
+  };
+
+  for (const auto *U : SortedUnits) {
+    getFileID(U->first());
+    for (auto ID : U->second.DeclarationDependencies)
+      getFileID(*Strings.getItem(ID));
+    for (auto ID : U->second.DefinitionDependencies)
+      getFileID(*Strings.getItem(ID));
+  }
+
+  uint32_t BlobSize = 0;
+  for (auto S : FileStrings)
+    BlobSize += S.size();
+
+  OS.write(INDEX_MAGIC, sizeof(INDEX_MAGIC));
+  W.write<uint32_t>(INDEX_VERSION);
+  W.write<uint32_t>(FileStrings.size());
+  W.write<uint32_t>(SortedUnits.size());
+  W.write<uint32_t>(BlobSize);
+
+  uint32_t Offset = 0;
+  W.write<uint32_t>(Offset);
+  for (auto S : FileStrings) {
+    Offset += S.size();
+    W.write<uint32_t>(Offset);
+  }
+
+  for (auto S : FileStrings)
+    OS << S;
+  pad(BlobSize);
+
+  for (const auto *U : SortedUnits) {
+    const auto &Record = U->second;
+
+    uint32_t Flags = 0;
+    if (Record.IsPublic)
+      Flags |= UNIT_PUBLIC;
+    if (Record.IsBodyOnly)
+      Flags |= UNIT_BODY_ONLY;
+
+    W.write<uint32_t>(FileIDs.lookup(U->first()));
+    W.write<uint32_t>(Flags);
+    W.write<uint32_t>(Record.SourceHash.size());
+    W.write<uint32_t>(Record.DeclarationDependencies.size());
+    W.write<uint32_t>(Record.DefinitionDependencies.size());
+
+    OS.write((const char*)Record.SourceHash.data(), Record.SourceHash.size());
+    pad(Record.SourceHash.size());
+
+    for (auto ID : Record.DeclarationDependencies)
+      W.write<uint32_t>(FileIDs.lookup(*Strings.getItem(ID)));
+    for (auto ID : Record.DefinitionDependencies)
+      W.write<uint32_t>(FileIDs.lookup(*Strings.getItem(ID)));
+  }
+}
+
+}}} // end of clang::levitation::dependencies_solver namespace
@@ -20,23 +20,29 @@
 #include "clang/Levitation/Common/WithOperator.h"
 #include "clang/Levitation/Dependencies.h"
 #include "clang/Levitation/DependenciesSolver/DependenciesGraph.h"
+#include "clang/Levitation/DependenciesSolver/DependenciesIndex.h"
 #include "clang/Levitation/DependenciesSolver/SolvedDependenciesInfo.h"
 #include "clang/Levitation/DependenciesSolver/DependenciesSolver.h"
 #include "clang/Levitation/FileExtensions.h"
 #include "clang/Levitation/Serialization.h"
+#include "clang/Levitation/TasksManager/TasksManager.h"
 
 #include "clang/Basic/FileManager.h"
 
 #include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/DenseSet.h"
 #include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/StringSet.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/Path.h"
 #include "llvm/Support/raw_ostream.h"
 
 #include <algorithm>
 #include <assert.h>
+#include <memory>
+#include <vector>
 
 using namespace llvm;
 
@@ -66,6 +72,11 @@ class DependenciesSolverContext {
   std::shared_ptr<DependenciesGraph> DepsGraph;
   std::shared_ptr<SolvedDependenciesInfo> SolvedDepsInfo;
 
+  /// Whether dependencies graph should be built and solved again.
+  /// Cleared in incremental mode if no package has changed its
+  /// dependencies.
+  bool GraphChanged = true;
+
   friend class clang::levitation::dependencies_solver::DependenciesSolverImpl;
 
 public:
@@ -90,6 +101,11 @@ public:
     return *ParsedDeps;
   }
 
+  std::shared_ptr<ParsedDependencies> detachParsedDependencies() {
+    assert(ParsedDeps && "ParsedDependencies should be set");
+    return std::move(ParsedDeps);
+  }
+
   std::shared_ptr<DependenciesGraph> &&detachDependenciesGraph() {
     assert(DepsGraph && "DependenciesGraph should be set");
     return std::move(DepsGraph);
@@ -204,7 +220,10 @@ public:
   void collectParsedDependencies() {
     loadDependencies(Context.Files);
 
-    with (auto verb = Log.acquire(log::Level::Verbose)) {
+    if (Solver->Refine && Solver->isValid())
+      Solver->Refine(*Context.ParsedDeps);
+
+    with (auto verb = Log.acquireIfEnabled(log::Level::Verbose)) {
       auto &s = verb.s;
       s << "Loaded dependencies:\n";
       dump(s, Context.getParsedDependencies());
@@ -222,17 +241,16 @@ public:
     return llvm::sys::fs::exists(OriginalSourceFull);
   }
 
-  bool loadFromBuffer(
-      StringID PackageID,
-      ParsedDependencies &Dest,
+  /// Reads package dependencies into its own strings pool.
+  /// Doesn't touch solver state, so it may be called from worker threads.
+  static bool loadFromBuffer(
+      DependenciesData &PackageData,
       const llvm::MemoryBuffer &MemBuf
   ) {
     auto &Log = log::Logger::get();
 
     auto Reader = CreateBitstreamReader(MemBuf);
 
-    DependenciesData PackageData;
-
     if (!Reader->read(PackageData)) {
       Log.log_error(Reader->getStatus().getErrorMessage());
       return false;
@@ -242,39 +260,173 @@ public:
       Log.log_warning(Reader->getStatus().getWarningMessage());
     }
 
-    Dest.add(PackageID, PackageData);
+    return true;
+  }
+
+  static bool loadFromFile(
+      DependenciesData &PackageData,
+      StringRef LDepPath
+  ) {
+    auto &Log = log::Logger::get();
+
+    auto Buffer = llvm::MemoryBuffer::getFile(LDepPath);
+    if (!Buffer) {
+      Log.log_error("Failed to open file '", LDepPath, "'\n");
+      return false;
+    }
+
+    Log.log_trace("  Reading '", LDepPath, "'...");
+
+    if (!loadFromBuffer(PackageData, *Buffer.get())) {
+      Log.log_error("Failed to read dependencies for '", LDepPath, "'");
+      return false;
+    }
 
     return true;
   }
 
+  /// Removes packages which are not present in Files anymore.
+  /// \return true if some packages were removed.
+  bool removeAbsentPackages(const tools::FilesMapTy &Files) {
+    ParsedDependencies &Deps = *Context.ParsedDeps;
+
+    llvm::SmallVector<StringID, 16> Absent;
+    for (const auto &kv : Deps)
+      if (!Files.tryGet(kv.first))
+        Absent.push_back(kv.first);
+
+    for (auto PackageID : Absent)
+      Deps.remove(PackageID);
+
+    return !Absent.empty();
+  }
+
   void loadDependencies(const tools::FilesMapTy &ParsedDepFiles) {
-    Context.ParsedDeps = std::make_shared<ParsedDependencies>(
-        Context.getStringsPool()
-    );
+
+    // Refined dependencies of untouched packages may change as well.
+    bool Incremental =
+        Solver->PrevParsedDeps && Solver->PrevSolvedInfo && !Solver->Refine;
+
+    if (Incremental) {
+      Context.ParsedDeps = Solver->PrevParsedDeps;
+      Context.GraphChanged = removeAbsentPackages(ParsedDepFiles);
+    } else {
+      Context.ParsedDeps = std::make_shared<ParsedDependencies>(
+          Context.getStringsPool()
+      );
+    }
+
     ParsedDependencies &Dest = *Context.ParsedDeps;
 
     Log.log_verbose("Loading dependencies info...");
 
-    auto &FM = CreatableSingleton<FileManager>::get();
+    // Each package is read into its own strings pool, so that files
+    // are read and deserialized in parallel. Then packages are merged
+    // into common pool on this thread.
+
+    struct PendingPackage {
+      StringID PackageID;
+      StringRef LDepPath;
+      HashVectorTy SourceHash;
+      DependenciesData Data;
+      bool Loaded = false;
+
+      PendingPackage(StringID packageID, StringRef ldepPath)
+      : PackageID(packageID), LDepPath(ldepPath) {}
+    };
 
-    for (auto &kv : ParsedDepFiles.getUniquePtrMap()) {
+    std::vector<std::unique_ptr<PendingPackage>> Pending;
+
+    DependenciesIndex *Index = Solver->Index;
+    size_t NumIndexed = 0;
+
+    for (auto &kv : ParsedDepFiles.getMap()) {
       StringID PackageID = kv.first;
-      StringRef LDepPath = kv.second->LDeps;
 
-      if (auto Buffer = FM.getBufferForFile(LDepPath)) {
+      if (
+        Incremental &&
+        Dest.contains(PackageID) &&
+        !Solver->UpdatedPackages->count(PackageID)
+      )
+        continue;
+
+      auto P = std::make_unique<PendingPackage>(PackageID, kv.second->LDeps);
+
+      if (Index) {
+        P->SourceHash = Solver->GetSourceHash(PackageID);
+
+        // Sources were not changed since record was made,
+        // so .ldeps would give same dependencies.
+        P->Loaded = Index->getDependencies(
+            P->Data,
+            *Context.getStringsPool().getItem(PackageID),
+            P->SourceHash
+        );
+        NumIndexed += P->Loaded;
+      }
 
-        Log.log_trace("  Reading '", LDepPath, "'...");
+      Pending.emplace_back(std::move(P));
+    }
 
-        llvm::MemoryBuffer &MemBuf = *Buffer.get();
+    if (Index)
+      Log.log_verbose(
+          "Loaded ", NumIndexed, " of ", Pending.size(),
+          " packages from dependencies index."
+      );
 
-        if (!loadFromBuffer(PackageID, Dest, MemBuf)) {
-          Solver->setFailure("Failed to read dependencies");
-          Log.log_error("Failed to read dependencies for '", LDepPath, "'");
-        }
-      } else {
-       Solver->setFailure("Failed to open one of dependency files");
-       Log.log_error("Failed to open file '", LDepPath, "'\n");
+    auto &TM = tasks::TasksManager::get();
+
+    tasks::TasksManager::TasksSet LoadTasks;
+
+    for (auto &P : Pending) {
+      if (P->Loaded)
+        continue;
+
+      PendingPackage *Package = P.get();
+      LoadTasks.insert(TM.runTask([=] (tasks::TasksManager::TaskContext &TC) {
+        Package->Loaded = loadFromFile(Package->Data, Package->LDepPath);
+        TC.Successful = Package->Loaded;
+      }));
+    }
+
+    // Other driver tasks (e.g. preamble build) may be running
+    // at the same time, so only wait for our own tasks.
+    TM.waitForTasks(LoadTasks);
+
+    for (auto &P : Pending) {
+      if (!P->Loaded) {
+        Solver->setFailure("Failed to read dependencies");
+        continue;
       }
+
+      if (Index && !P->SourceHash.empty())
+        Index->setDependencies(
+            *Context.getStringsPool().getItem(P->PackageID),
+            P->SourceHash,
+            P->Data
+        );
+
+      if (Incremental)
+        Context.GraphChanged |= Dest.replace(P->PackageID, P->Data);
+      else
+        Dest.add(P->PackageID, P->Data);
+    }
+
+    if (Index) {
+      llvm::StringSet<> PackagePaths;
+      for (auto &kv : ParsedDepFiles.getMap())
+        PackagePaths.insert(*Context.getStringsPool().getItem(kv.first));
+
+      Index->removeUnits([&] (StringRef UnitPath) {
+        return !PackagePaths.count(UnitPath);
+      });
+    }
+
+    if (!Context.GraphChanged) {
+      Log.log_verbose(
+          "Dependencies were not changed, reusing previous solution."
+      );
+      return;
     }
 
     // Check missed dependencies
@@ -363,7 +515,7 @@ public:
   }
 
   void buildDependenciesGraph() {
-    if (!Solver->isValid())
+    if (!Solver->isValid() || !Context.GraphChanged)
       return;
 
     auto DGraph = DependenciesGraph::build(
@@ -376,7 +528,8 @@ public:
     if (DGraph->isInvalid()) {
       with(auto err = Log.acquire(log::Level::Error)) {
         auto &s = err.s;
-        s << "Failed to solve dependencies. Unable to find root nodes.\n";
+        s << "Failed to solve dependencies. Unable to find root nodes, "
+          << "or dependencies contain cycles.\n";
         if (!Solver->Verbose) {
           s << "Loaded dependencies:\n";
           dump(s, Context.getParsedDependencies());
@@ -385,7 +538,7 @@ public:
       }
     }
 
-    with (auto verb = Log.acquire(log::Level::Verbose)) {
+    with (auto verb = Log.acquireIfEnabled(log::Level::Verbose)) {
       auto &s = verb.s;
       s << "Dependencies graph:\n";
       DGraph->dump(s, Context.StringsPool);
@@ -396,6 +549,11 @@ public:
     if (!Solver->isValid())
       return;
 
+    if (!Context.GraphChanged) {
+      Context.SolvedDepsInfo = Solver->PrevSolvedInfo;
+      return;
+    }
+
     std::shared_ptr<DependenciesGraph> DGraphPtr =
         Context.detachDependenciesGraph();
 
@@ -420,7 +578,7 @@ public:
         return;
       }
 
-      with(auto verb = Log.acquire(log::Level::Verbose)) {
+      with(auto verb = Log.acquireIfEnabled(log::Level::Verbose)) {
         auto &s = verb.s;
         s << "Dependencies solved info:\n";
         SolvedInfo.dump(s, Strings);
@@ -584,9 +742,14 @@ DependenciesSolver::solve(
 
   Impl.solve();
 
+  PrevParsedDeps.reset();
+  PrevSolvedInfo.reset();
+  UpdatedPackages = nullptr;
+
   if (isValid()) {
     Log.log_verbose("\nComplete");
 
+    ParsedDeps = Context.detachParsedDependencies();
     return Context.detachSolvedDependenciesInfo();
   }
 
@@ -594,4 +757,11 @@ DependenciesSolver::solve(
   return nullptr;
 }
 
+bool DependenciesSolver::loadDependencies(
+    DependenciesData &Data,
+    StringRef LDepPath
+) {
+  return DependenciesSolverImpl::loadFromFile(Data, LDepPath);
+}
+
 }}}
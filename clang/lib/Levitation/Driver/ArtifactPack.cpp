@@ -0,0 +1,620 @@
+//===--- C++ Levitation ArtifactPack.cpp ------------------------*- C++ -*-===//
+//
+// Part of the C++ Levitation Project,
+// under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file contains implementation of packed artifacts store
+//  and its virtual file system.
+//
+//===----------------------------------------------------------------------===//
+
+#include "clang/Levitation/Common/File.h"
+#include "clang/Levitation/Common/SimpleLogger.h"
+#include "clang/Levitation/Common/Thread.h"
+#include "clang/Levitation/Driver/ArtifactPack.h"
+
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/EndianStream.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/VirtualFileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <chrono>
+#include <vector>
+
+namespace clang { namespace levitation { namespace tools {
+
+namespace {
+  const char PACK_FILE[] = "artifacts.pack";
+  const char INDEX_FILE[] = "artifacts.pack-index";
+
+  const char PACK_MAGIC[4] = { 'L', 'P', 'A', 'K' };
+  const char INDEX_MAGIC[4] = { 'L', 'P', 'I', 'X' };
+  const uint32_t PACK_VERSION = 1;
+
+  /// Magic, version and generation.
+  const uint64_t HEADER_SIZE = 16;
+
+  /// Path size, offset, size and modification time.
+  const uint64_t INDEX_RECORD_SIZE = 28;
+
+  const uint64_t REMOVED = ~uint64_t(0);
+
+  /// Pack is not compacted while it is that small.
+  const uint64_t MIN_COMPACTION_SIZE = 1 << 20;
+
+  uint64_t now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()
+    ).count();
+  }
+
+  /// Pack and its index are written at different moments, so both of
+  /// them keep generation of pack, and mismatched files are not used.
+  void writeHeader(llvm::raw_ostream &OS, const char *Magic, uint64_t Gen) {
+    llvm::support::endian::Writer W(OS, llvm::support::little);
+    OS.write(Magic, 4);
+    W.write<uint32_t>(PACK_VERSION);
+    W.write<uint64_t>(Gen);
+  }
+
+  bool readHeader(llvm::StringRef Data, const char *Magic, uint64_t &Gen) {
+    if (
+      Data.size() < HEADER_SIZE ||
+      Data.substr(0, 4) != llvm::StringRef(Magic, 4) ||
+      llvm::support::endian::read32le(Data.data() + 4) != PACK_VERSION
+    )
+      return false;
+
+    Gen = llvm::support::endian::read64le(Data.data() + 8);
+    return true;
+  }
+
+  /// Serves packed artifacts. Directories are not tracked,
+  /// so they are only visible through real file system.
+  class PackFileSystem : public llvm::vfs::FileSystem {
+    ArtifactPack &Pack;
+    std::string WorkingDir;
+
+    class PackedFile : public llvm::vfs::File {
+      llvm::vfs::Status S;
+      std::unique_ptr<llvm::MemoryBuffer> Buffer;
+
+    public:
+      PackedFile(llvm::vfs::Status S, std::unique_ptr<llvm::MemoryBuffer> B)
+      : S(std::move(S)), Buffer(std::move(B)) {}
+
+      llvm::ErrorOr<llvm::vfs::Status> status() override { return S; }
+
+      llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> getBuffer(
+          const llvm::Twine &Name,
+          int64_t FileSize,
+          bool RequiresNullTerminator,
+          bool IsVolatile
+      ) override {
+        // Slices of pack are not null terminated.
+        if (RequiresNullTerminator)
+          return llvm::MemoryBuffer::getMemBufferCopy(
+              Buffer->getBuffer(), Name
+          );
+        return std::move(Buffer);
+      }
+
+      std::error_code close() override { return std::error_code(); }
+    };
+
+    SinglePath resolve(const llvm::Twine &Path) const {
+      SinglePath Resolved;
+      Path.toVector(Resolved);
+      if (!llvm::sys::path::is_absolute(Resolved) && WorkingDir.size())
+        Resolved = Path::getPath<SinglePath>(WorkingDir, Resolved);
+      return Resolved;
+    }
+
+    llvm::vfs::Status makeStatus(
+        const llvm::Twine &Path,
+        const ArtifactPack::Entry &E
+    ) const {
+      // Offsets are unique within pack.
+      llvm::sys::fs::UniqueID ID(REMOVED, E.Offset);
+
+      return llvm::vfs::Status(
+          Path, ID,
+          llvm::sys::TimePoint<>(std::chrono::nanoseconds(E.MTime)),
+          0, 0, E.Size,
+          llvm::sys::fs::file_type::regular_file,
+          llvm::sys::fs::all_read
+      );
+    }
+
+  public:
+    PackFileSystem(ArtifactPack &Pack) : Pack(Pack) {
+      llvm::SmallString<256> CWD;
+      if (!llvm::sys::fs::current_path(CWD))
+        WorkingDir = CWD.str().str();
+    }
+
+    llvm::ErrorOr<llvm::vfs::Status> status(const llvm::Twine &Path) override {
+      auto E = Pack.getEntry(resolve(Path));
+      if (!E)
+        return std::make_error_code(std::errc::no_such_file_or_directory);
+      return makeStatus(Path, *E);
+    }
+
+    llvm::ErrorOr<std::unique_ptr<llvm::vfs::File>>
+    openFileForRead(const llvm::Twine &Path) override {
+      auto Resolved = resolve(Path);
+      auto E = Pack.getEntry(Resolved);
+      if (!E)
+        return std::make_error_code(std::errc::no_such_file_or_directory);
+
+      auto Buffer = Pack.getBuffer(Resolved);
+      if (!Buffer)
+        return std::make_error_code(std::errc::io_error);
+
+      return std::unique_ptr<llvm::vfs::File>(
+          new PackedFile(makeStatus(Path, *E), std::move(Buffer))
+      );
+    }
+
+    llvm::vfs::directory_iterator dir_begin(
+        const llvm::Twine &Dir, std::error_code &EC
+    ) override {
+      EC = std::make_error_code(std::errc::no_such_file_or_directory);
+      return llvm::vfs::directory_iterator();
+    }
+
+    std::error_code setCurrentWorkingDirectory(
+        const llvm::Twine &Path
+    ) override {
+      WorkingDir = resolve(Path).str().str();
+      return std::error_code();
+    }
+
+    llvm::ErrorOr<std::string> getCurrentWorkingDirectory() const override {
+      return WorkingDir;
+    }
+  };
+}
+
+ArtifactPack::~ArtifactPack() {
+  closeStreams();
+}
+
+SinglePath ArtifactPack::getKey(llvm::StringRef Path) {
+  SinglePath Key = Path;
+  llvm::sys::fs::make_absolute(Key);
+  llvm::sys::path::remove_dots(Key, /*remove_dot_dot=*/true);
+  return Key;
+}
+
+Failable ArtifactPack::open(llvm::StringRef Dir) {
+  auto _ = lock(Locker);
+
+  Failable Status;
+
+  PackFile = Path::getPath<SinglePath>(Dir, PACK_FILE);
+  IndexFile = Path::getPath<SinglePath>(Dir, INDEX_FILE);
+
+  if (llvm::sys::fs::create_directories(Dir)) {
+    Status.setFailure() << "Failed to create directory '" << Dir << "'.";
+    return Status;
+  }
+
+  Entries.clear();
+  PackSize = LiveSize = 0;
+
+  auto Res = readIndex();
+  if (!Res.isValid()) {
+    // Packed artifacts are lost, so they will be built again.
+    log::Logger::get().log_warning(
+        "Artifacts pack is dropped: ", Res.getErrorMessage()
+    );
+    Entries.clear();
+    PackSize = LiveSize = 0;
+    llvm::sys::fs::remove(PackFile);
+    llvm::sys::fs::remove(IndexFile);
+  }
+
+  return openStreams();
+}
+
+Failable ArtifactPack::readIndex() {
+  Failable Status;
+
+  if (!llvm::sys::fs::exists(PackFile) && !llvm::sys::fs::exists(IndexFile))
+    return Status;
+
+  auto PackHeader = llvm::MemoryBuffer::getFileSlice(
+      PackFile, HEADER_SIZE, 0
+  );
+  auto Index = llvm::MemoryBuffer::getFile(
+      IndexFile, /*FileSize=*/-1, /*RequiresNullTerminator=*/false
+  );
+
+  if (!PackHeader || !Index || llvm::sys::fs::file_size(PackFile, PackSize)) {
+    Status.setFailure("pack or its index is not accessible.");
+    return Status;
+  }
+
+  uint64_t PackGen, IndexGen;
+  llvm::StringRef Data = Index.get()->getBuffer();
+
+  if (
+    !readHeader(PackHeader.get()->getBuffer(), PACK_MAGIC, PackGen) ||
+    !readHeader(Data, INDEX_MAGIC, IndexGen) ||
+    PackGen != IndexGen
+  ) {
+    Status.setFailure("pack and its index don't match.");
+    return Status;
+  }
+
+  // Trailing record may be incomplete, if previous build
+  // was interrupted. Such record, as well as records which refer
+  // to contents not flushed to pack, is dropped, and index is
+  // rewritten before anything is appended to it.
+  uint64_t Pos = HEADER_SIZE;
+  bool NeedsRepair = false;
+
+  while (Pos != Data.size()) {
+    const char *Rec = Data.data() + Pos;
+    uint32_t PathSize = Data.size() - Pos >= INDEX_RECORD_SIZE ?
+        llvm::support::endian::read32le(Rec) : 0;
+
+    if (
+      Data.size() - Pos < INDEX_RECORD_SIZE ||
+      Data.size() - Pos - INDEX_RECORD_SIZE < PathSize
+    ) {
+      NeedsRepair = true;
+      break;
+    }
+
+    Entry E;
+    E.Offset = llvm::support::endian::read64le(Rec + 4);
+    E.Size = llvm::support::endian::read64le(Rec + 12);
+    E.MTime = llvm::support::endian::read64le(Rec + 20);
+
+    llvm::StringRef Path(Rec + INDEX_RECORD_SIZE, PathSize);
+
+    Pos += INDEX_RECORD_SIZE + PathSize;
+
+    auto Found = Entries.find(Path);
+    if (Found != Entries.end()) {
+      LiveSize -= Found->second.Size;
+      Entries.erase(Found);
+    }
+
+    if (E.Size == REMOVED)
+      continue;
+
+    if (E.Offset < HEADER_SIZE || E.Offset + E.Size > PackSize) {
+      NeedsRepair = true;
+      continue;
+    }
+
+    Entries[Path] = E;
+    LiveSize += E.Size;
+  }
+
+  if (!NeedsRepair)
+    return Status;
+
+  Index.get().reset();
+
+  std::error_code EC;
+  llvm::raw_fd_ostream OS(IndexFile, EC, llvm::sys::fs::OF_None);
+  if (EC) {
+    Status.setFailure("failed to repair pack index.");
+    return Status;
+  }
+
+  writeHeader(OS, INDEX_MAGIC, IndexGen);
+
+  llvm::support::endian::Writer W(OS, llvm::support::little);
+  for (const auto &E : Entries) {
+    W.write<uint32_t>(E.first().size());
+    W.write<uint64_t>(E.second.Offset);
+    W.write<uint64_t>(E.second.Size);
+    W.write<uint64_t>(E.second.MTime);
+    OS << E.first();
+  }
+
+  return Status;
+}
+
+Failable ArtifactPack::openStreams() {
+  Failable Status;
+
+  bool IsNew = !llvm::sys::fs::exists(PackFile);
+  uint64_t Gen = now();
+
+  std::error_code EC;
+  PackOS.reset(new llvm::raw_fd_ostream(
+      PackFile, EC, llvm::sys::fs::OF_Append
+  ));
+
+  if (!EC)
+    IndexOS.reset(new llvm::raw_fd_ostream(
+        IndexFile, EC, llvm::sys::fs::OF_Append
+    ));
+
+  if (EC) {
+    closeStreams();
+    Status.setFailure() << "Failed to open artifacts pack '" << PackFile << "'.";
+    return Status;
+  }
+
+  if (IsNew) {
+    writeHeader(*PackOS, PACK_MAGIC, Gen);
+    writeHeader(*IndexOS, INDEX_MAGIC, Gen);
+    PackOS->flush();
+    IndexOS->flush();
+    PackSize = HEADER_SIZE;
+  }
+
+  auto FD = llvm::sys::fs::openNativeFileForRead(PackFile);
+  if (!FD) {
+    llvm::consumeError(FD.takeError());
+    closeStreams();
+    Status.setFailure() << "Failed to open artifacts pack '" << PackFile << "'.";
+    return Status;
+  }
+
+  ReadFD = *FD;
+  return Status;
+}
+
+void ArtifactPack::closeStreams() {
+  PackOS.reset();
+  IndexOS.reset();
+  if (ReadFD != llvm::sys::fs::kInvalidFile)
+    llvm::sys::fs::closeFile(ReadFD);
+}
+
+void ArtifactPack::writeIndexRecord(llvm::StringRef Path, const Entry &E) {
+  llvm::support::endian::Writer W(*IndexOS, llvm::support::little);
+  W.write<uint32_t>(Path.size());
+  W.write<uint64_t>(E.Offset);
+  W.write<uint64_t>(E.Size);
+  W.write<uint64_t>(E.MTime);
+  *IndexOS << Path;
+  IndexOS->flush();
+}
+
+bool ArtifactPack::add(
+    llvm::StringRef Path,
+    llvm::StringRef Contents,
+    uint64_t MTime
+) {
+  auto Key = getKey(Path);
+
+  auto _ = lock(Locker);
+
+  if (!isEnabled())
+    return false;
+
+  Entry E;
+  E.Offset = PackSize;
+  E.Size = Contents.size();
+  E.MTime = MTime;
+
+  // Contents should be on disk before index refers to them.
+  *PackOS << Contents;
+  PackOS->flush();
+
+  if (PackOS->has_error()) {
+    PackOS->clear_error();
+    return false;
+  }
+
+  PackSize += E.Size;
+
+  writeIndexRecord(Key, E);
+
+  auto &Existing = Entries[Key];
+  LiveSize -= Existing.Size;
+  LiveSize += E.Size;
+  Existing = E;
+
+  return true;
+}
+
+bool ArtifactPack::addFile(llvm::StringRef Path) {
+  llvm::sys::fs::file_status FileStatus;
+  if (llvm::sys::fs::status(Path, FileStatus))
+    return false;
+
+  auto Buffer = llvm::MemoryBuffer::getFile(
+      Path, /*FileSize=*/-1, /*RequiresNullTerminator=*/false
+  );
+  if (!Buffer)
+    return false;
+
+  uint64_t MTime = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      FileStatus.getLastModificationTime().time_since_epoch()
+  ).count();
+
+  if (!add(Path, Buffer.get()->getBuffer(), MTime))
+    return false;
+
+  llvm::sys::fs::remove(Path);
+  File::notifyChanged(Path);
+  return true;
+}
+
+void ArtifactPack::remove(llvm::StringRef Path) {
+  auto Key = getKey(Path);
+
+  auto _ = lock(Locker);
+
+  auto Found = Entries.find(Key);
+  if (Found == Entries.end())
+    return;
+
+  LiveSize -= Found->second.Size;
+  Entries.erase(Found);
+
+  Entry E;
+  E.Size = REMOVED;
+  writeIndexRecord(Key, E);
+}
+
+llvm::Optional<ArtifactPack::Entry> ArtifactPack::getEntry(
+    llvm::StringRef Path
+) const {
+  auto Key = getKey(Path);
+
+  auto _ = lock(Locker);
+
+  auto Found = Entries.find(Key);
+  if (Found == Entries.end())
+    return llvm::None;
+
+  return Found->second;
+}
+
+std::unique_ptr<llvm::MemoryBuffer> ArtifactPack::getBuffer(
+    llvm::StringRef Path
+) const {
+  auto E = getEntry(Path);
+  if (!E)
+    return nullptr;
+
+  // Packed contents are never overwritten, so they
+  // may be read without lock.
+  auto Buffer = llvm::MemoryBuffer::getOpenFileSlice(
+      ReadFD, Path, E->Size, E->Offset
+  );
+
+  if (!Buffer)
+    return nullptr;
+
+  return std::move(Buffer.get());
+}
+
+size_t ArtifactPack::size() const {
+  auto _ = lock(Locker);
+  return Entries.size();
+}
+
+bool ArtifactPack::needsCompaction() const {
+  auto _ = lock(Locker);
+  return PackSize > MIN_COMPACTION_SIZE && LiveSize < PackSize / 2;
+}
+
+Failable ArtifactPack::compact() {
+  auto _ = lock(Locker);
+
+  Failable Status;
+
+  if (!isEnabled()) {
+    Status.setFailure("Artifacts pack is not opened.");
+    return Status;
+  }
+
+  SinglePath NewPackFile = PackFile;
+  NewPackFile += ".tmp";
+  SinglePath NewIndexFile = IndexFile;
+  NewIndexFile += ".tmp";
+
+  uint64_t Gen = now();
+  llvm::StringMap<Entry> NewEntries;
+  uint64_t NewSize = HEADER_SIZE;
+
+  {
+    std::error_code PackEC, IndexEC;
+    llvm::raw_fd_ostream NewPack(NewPackFile, PackEC, llvm::sys::fs::OF_None);
+    llvm::raw_fd_ostream NewIndex(NewIndexFile, IndexEC, llvm::sys::fs::OF_None);
+
+    if (PackEC || IndexEC) {
+      Status.setFailure("Failed to create compacted artifacts pack.");
+      return Status;
+    }
+
+    writeHeader(NewPack, PACK_MAGIC, Gen);
+    writeHeader(NewIndex, INDEX_MAGIC, Gen);
+
+    llvm::support::endian::Writer W(NewIndex, llvm::support::little);
+
+    for (const auto &E : Entries) {
+      auto Buffer = llvm::MemoryBuffer::getOpenFileSlice(
+          ReadFD, PackFile, E.second.Size, E.second.Offset
+      );
+      if (!Buffer) {
+        Status.setFailure() << "Failed to read packed '" << E.first() << "'.";
+        break;
+      }
+
+      Entry NewE = E.second;
+      NewE.Offset = NewSize;
+      NewPack << Buffer.get()->getBuffer();
+      NewSize += NewE.Size;
+
+      W.write<uint32_t>(E.first().size());
+      W.write<uint64_t>(NewE.Offset);
+      W.write<uint64_t>(NewE.Size);
+      W.write<uint64_t>(NewE.MTime);
+      NewIndex << E.first();
+
+      NewEntries[E.first()] = NewE;
+    }
+
+    NewPack.close();
+    NewIndex.close();
+
+    if (Status.isValid() && (NewPack.has_error() || NewIndex.has_error()))
+      Status.setFailure("Failed to write compacted artifacts pack.");
+
+    NewPack.clear_error();
+    NewIndex.clear_error();
+  }
+
+  if (!Status.isValid()) {
+    llvm::sys::fs::remove(NewPackFile);
+    llvm::sys::fs::remove(NewIndexFile);
+    return Status;
+  }
+
+  // If we are interrupted between renames, generations
+  // don't match and pack is dropped on next open.
+  closeStreams();
+
+  if (
+    llvm::sys::fs::rename(NewPackFile, PackFile) ||
+    llvm::sys::fs::rename(NewIndexFile, IndexFile)
+  ) {
+    Entries.clear();
+    PackSize = LiveSize = 0;
+    llvm::sys::fs::remove(PackFile);
+    llvm::sys::fs::remove(IndexFile);
+    openStreams();
+    Status.setFailure("Failed to replace artifacts pack.");
+    return Status;
+  }
+
+  Entries = std::move(NewEntries);
+  PackSize = NewSize;
+  LiveSize = NewSize - HEADER_SIZE;
+
+  return openStreams();
+}
+
+llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem>
+ArtifactPack::createFileSystem(
+    llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> DiskFS
+) {
+  llvm::IntrusiveRefCntPtr<llvm::vfs::OverlayFileSystem> FS(
+      new llvm::vfs::OverlayFileSystem(new PackFileSystem(*this))
+  );
+
+  // Files written after they were packed are newer than packed ones.
+  FS->pushOverlay(std::move(DiskFS));
+  return FS;
+}
+
+}}}
@@ -0,0 +1,470 @@
+//===--- C++ Levitation BuildCache.cpp --------------------------*- C++ -*-===//
+//
+// Part of the C++ Levitation Project,
+// under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file contains implementation of build cache and its backends.
+//
+//===----------------------------------------------------------------------===//
+
+#include "clang/Levitation/Common/File.h"
+#include "clang/Levitation/Common/Path.h"
+#include "clang/Levitation/Common/SimpleLogger.h"
+#include "clang/Levitation/Common/Thread.h"
+#include "clang/Levitation/Driver/BuildCache.h"
+#include "clang/Levitation/Driver/FileClone.h"
+
+#include "llvm/ADT/ScopeExit.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/Support/Compression.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/EndianStream.h"
+#include "llvm/Support/FileOutputBuffer.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+namespace clang { namespace levitation { namespace tools {
+
+namespace {
+
+  const char COMPRESSED_MAGIC[4] = { 'L', 'V', 'Z', 'C' };
+
+  /// Magic and uncompressed size.
+  const size_t COMPRESSED_HEADER_SIZE = 12;
+
+  /// Writes compressed container of SrcFile into temporary file.
+  /// \return false if file can't be read, or compression doesn't
+  ///         make it smaller, in which case plain file should be stored.
+  bool compressFile(llvm::StringRef SrcFile, int Level, SinglePath &Tmp) {
+    auto Buffer = llvm::MemoryBuffer::getFile(
+        SrcFile, /*FileSize=*/-1, /*RequiresNullTerminator=*/false
+    );
+    if (!Buffer)
+      return false;
+
+    llvm::StringRef Contents = Buffer.get()->getBuffer();
+
+    llvm::SmallVector<char, 0> Compressed;
+    if (auto Err = llvm::zlib::compress(Contents, Compressed, Level)) {
+      llvm::consumeError(std::move(Err));
+      return false;
+    }
+
+    if (Compressed.size() + COMPRESSED_HEADER_SIZE >= Contents.size())
+      return false;
+
+    int FD;
+    if (llvm::sys::fs::createUniqueFile(SrcFile + ".lvzc-%%%%%%%%", FD, Tmp)) {
+      Tmp.clear();
+      return false;
+    }
+
+    llvm::raw_fd_ostream OS(FD, /*shouldClose=*/true);
+    llvm::support::endian::Writer W(OS, llvm::support::little);
+    OS.write(COMPRESSED_MAGIC, sizeof(COMPRESSED_MAGIC));
+    W.write<uint64_t>(Contents.size());
+    OS.write(Compressed.data(), Compressed.size());
+    OS.close();
+
+    if (OS.has_error()) {
+      OS.clear_error();
+      llvm::sys::fs::remove(Tmp);
+      Tmp.clear();
+      return false;
+    }
+
+    return true;
+  }
+
+  /// If File is compressed container, replaces it with its contents.
+  /// Contents are decompressed right into mapped output file.
+  /// \return false if container is corrupted.
+  bool decompressFile(llvm::StringRef File) {
+    auto Buffer = llvm::MemoryBuffer::getFile(
+        File, /*FileSize=*/-1, /*RequiresNullTerminator=*/false
+    );
+    if (!Buffer)
+      return false;
+
+    llvm::StringRef Contents = Buffer.get()->getBuffer();
+
+    if (
+      Contents.size() < COMPRESSED_HEADER_SIZE ||
+      !Contents.startswith(
+          llvm::StringRef(COMPRESSED_MAGIC, sizeof(COMPRESSED_MAGIC))
+      )
+    )
+      return true;
+
+    size_t Size = llvm::support::endian::read64le(
+        Contents.data() + sizeof(COMPRESSED_MAGIC)
+    );
+
+    auto Out = llvm::FileOutputBuffer::create(File, Size);
+    if (!Out) {
+      llvm::consumeError(Out.takeError());
+      llvm::sys::fs::remove(File);
+      return false;
+    }
+
+    size_t UncompressedSize = Size;
+    auto Err = llvm::zlib::uncompress(
+        Contents.drop_front(COMPRESSED_HEADER_SIZE),
+        (char*)(*Out)->getBufferStart(),
+        UncompressedSize
+    );
+
+    if (Err || UncompressedSize != Size) {
+      llvm::consumeError(std::move(Err));
+      (*Out)->discard();
+      llvm::sys::fs::remove(File);
+      return false;
+    }
+
+    if (auto Err = (*Out)->commit()) {
+      llvm::consumeError(std::move(Err));
+      llvm::sys::fs::remove(File);
+      return false;
+    }
+
+    return true;
+  }
+}
+
+//-----------------------------------------------------------------------------
+// LocalDirectoryCacheBackend
+
+SinglePath LocalDirectoryCacheBackend::getEntryPath(llvm::StringRef Key) const {
+  SinglePath P = Directory;
+  llvm::sys::path::append(P, Key.take_front(2), Key);
+  return P;
+}
+
+bool LocalDirectoryCacheBackend::fetch(
+    llvm::StringRef Key,
+    llvm::StringRef DestFile
+) {
+  auto EntryPath = getEntryPath(Key);
+
+  if (!llvm::sys::fs::exists(EntryPath))
+    return false;
+
+  if (!FileClone::materialize(EntryPath, DestFile, Hardlinks))
+    return false;
+
+  // Access time is not reliable (e.g. noatime mounts),
+  // so last use is kept as modification time.
+  int FD;
+  if (!llvm::sys::fs::openFileForRead(EntryPath, FD)) {
+    llvm::sys::fs::setLastAccessAndModificationTime(
+        FD, std::chrono::system_clock::now()
+    );
+    llvm::sys::Process::SafelyCloseFileDescriptor(FD);
+  }
+
+  return true;
+}
+
+bool LocalDirectoryCacheBackend::store(
+    llvm::StringRef Key,
+    llvm::StringRef SrcFile
+) {
+  return FileClone::materialize(SrcFile, getEntryPath(Key), Hardlinks);
+}
+
+unsigned LocalDirectoryCacheBackend::trim(uint64_t MaxSize, uint64_t MaxAge) {
+  using namespace llvm::sys;
+
+  if (!MaxSize && !MaxAge)
+    return 0;
+
+  struct Step {
+    std::vector<std::string> Files;
+    uint64_t Size = 0;
+    TimePoint<> LastUse;
+  };
+
+  // Entries are named <step key>.<artifact name>.
+  llvm::StringMap<Step> Steps;
+
+  std::error_code EC;
+  for (
+    fs::recursive_directory_iterator I(Directory, EC), E;
+    I != E && !EC;
+    I.increment(EC)
+  ) {
+    auto Status = I->status();
+    if (!Status || Status->type() != fs::file_type::regular_file)
+      continue;
+
+    auto Name = path::filename(I->path());
+    auto &S = Steps[Name.split('.').first];
+    S.Files.push_back(I->path());
+    S.Size += Status->getSize();
+    S.LastUse = std::max(S.LastUse, Status->getLastModificationTime());
+  }
+
+  std::vector<Step*> Sorted;
+  uint64_t TotalSize = 0;
+  for (auto &S : Steps) {
+    Sorted.push_back(&S.second);
+    TotalSize += S.second.Size;
+  }
+
+  std::sort(Sorted.begin(), Sorted.end(), [] (const Step *L, const Step *R) {
+    return L->LastUse < R->LastUse;
+  });
+
+  auto Now = std::chrono::system_clock::now();
+  unsigned Removed = 0;
+
+  for (auto *S : Sorted) {
+    bool Expired =
+        MaxAge && Now - S->LastUse > std::chrono::seconds(MaxAge);
+
+    if (!Expired && (!MaxSize || TotalSize <= MaxSize))
+      break;
+
+    for (const auto &F : S->Files)
+      if (!fs::remove(F))
+        ++Removed;
+
+    TotalSize -= S->Size;
+  }
+
+  return Removed;
+}
+
+//-----------------------------------------------------------------------------
+// CommandCacheBackend
+
+bool CommandCacheBackend::run(
+    llvm::StringRef Action,
+    llvm::StringRef Key,
+    llvm::StringRef File
+) {
+  llvm::StringRef Args[] = { Program, Action, Key, File };
+
+  std::string ErrorMessage;
+  int Res = llvm::sys::ExecuteAndWait(
+      Program, Args, /*Env*/llvm::None, /*Redirects*/{},
+      /*secondsToWait*/0, /*memoryLimit*/0, &ErrorMessage
+  );
+
+  if (Res < 0)
+    log::Logger::get().log_warning(
+        "Remote cache program '", Program, "' failed: ", ErrorMessage
+    );
+
+  return Res == 0;
+}
+
+bool CommandCacheBackend::fetch(llvm::StringRef Key, llvm::StringRef DestFile) {
+  Path::createDirsForFile(DestFile);
+  return run("get", Key, DestFile);
+}
+
+bool CommandCacheBackend::store(llvm::StringRef Key, llvm::StringRef SrcFile) {
+  return run("put", Key, SrcFile);
+}
+
+//-----------------------------------------------------------------------------
+// BuildCache
+
+bool BuildCache::fetch(
+    BuildCacheBackend &Backend,
+    llvm::StringRef Key,
+    llvm::ArrayRef<Artifact> Artifacts
+) {
+  // Entry may be compressed by other build, which had compression
+  // enabled, so containers are unpacked regardless of own settings.
+  for (const auto &A : Artifacts) {
+    if (A.Deferred)
+      continue;
+    if (!Backend.fetch(getEntryKey(Key, A), A.Path) || !decompressFile(A.Path))
+      return false;
+  }
+  return true;
+}
+
+bool BuildCache::fetch(llvm::StringRef Key, llvm::ArrayRef<Artifact> Artifacts) {
+
+  // Artifacts are either fetched or rebuilt now,
+  // so older records are stale.
+  with (auto _ = lock(DeferredLocker)) {
+    if (Deferred.size())
+      for (const auto &A : Artifacts)
+        Deferred.erase(A.Path);
+  }
+
+  // Artifacts may be partially fetched, even if fetch has failed.
+  auto NotifyScope = llvm::make_scope_exit([&] {
+    for (const auto &A : Artifacts)
+      File::notifyChanged(A.Path);
+  });
+
+  for (size_t i = 0, e = Backends.size(); i != e; ++i) {
+    if (!fetch(*Backends[i], Key, Artifacts))
+      continue;
+
+    log::Logger::get().log_verbose(
+        "Build cache: ", Backends[i]->getName(), " hit for ", Key
+    );
+
+    // Warm up faster backends.
+    store(i, Key, Artifacts);
+
+    with (auto _ = lock(DeferredLocker)) {
+      for (const auto &A : Artifacts) {
+        if (!A.Deferred)
+          continue;
+        auto &D = Deferred[A.Path];
+        D.EntryKey = getEntryKey(Key, A);
+        D.Backend = i;
+        ++NumDeferred;
+      }
+    }
+
+    ++Hits;
+    return true;
+  }
+
+  ++Misses;
+  return false;
+}
+
+bool BuildCache::materialize(llvm::ArrayRef<llvm::StringRef> Files) {
+  if (!NumDeferred)
+    return true;
+
+  for (auto F : Files) {
+    DeferredArtifact D;
+
+    with (auto Lock = lock(DeferredLocker)) {
+      auto Found = Deferred.find(F);
+
+      // Other job may be fetching it, then it is either fetched
+      // or has failed, and is recorded again, once job is done.
+      while (Found != Deferred.end() && Found->second.Fetching) {
+        DeferredFetched.wait(Lock);
+        Found = Deferred.find(F);
+      }
+
+      if (Found == Deferred.end())
+        continue;
+
+      Found->second.Fetching = true;
+      D = Found->second;
+    }
+
+    bool Fetched = false;
+    std::vector<size_t> Order { D.Backend };
+    for (size_t i = 0, e = Backends.size(); i != e; ++i)
+      if (i != D.Backend)
+        Order.push_back(i);
+
+    for (auto i : Order)
+      if (
+        i < Backends.size() &&
+        Backends[i]->fetch(D.EntryKey, F) && decompressFile(F)
+      ) {
+        Fetched = true;
+        break;
+      }
+
+    File::notifyChanged(F);
+
+    with (auto _ = lock(DeferredLocker)) {
+      if (Fetched) {
+        Deferred.erase(F);
+        ++NumMaterialized;
+      } else
+        Deferred[F].Fetching = false;
+    }
+    DeferredFetched.notify_all();
+
+    if (!Fetched) {
+      log::Logger::get().log_error(
+          "Build cache: deferred '", F, "' is not in cache anymore."
+      );
+      return false;
+    }
+
+    log::Logger::get().log_verbose("Build cache: fetched deferred '", F, "'.");
+  }
+
+  return true;
+}
+
+bool BuildCache::isCompressible(const Artifact &A) {
+  return llvm::StringSwitch<bool>(A.Name)
+      .Cases("decl-ast", "object", "ir", true)
+      .Default(false);
+}
+
+bool BuildCache::setCompressionLevel(int Level) {
+  if (Level && !llvm::zlib::isAvailable())
+    return false;
+
+  CompressionLevel = Level;
+  return true;
+}
+
+void BuildCache::store(
+    size_t NumBackends,
+    llvm::StringRef Key,
+    llvm::ArrayRef<Artifact> Artifacts
+) {
+  if (!NumBackends)
+    return;
+
+  // Artifacts are compressed once, and then put into all backends.
+  llvm::SmallVector<SinglePath, 4> Compressed(Artifacts.size());
+  for (size_t i = 0, e = Artifacts.size(); i != e; ++i)
+    if (
+      CompressionLevel && !Artifacts[i].Deferred &&
+      isCompressible(Artifacts[i])
+    )
+      compressFile(Artifacts[i].Path, CompressionLevel, Compressed[i]);
+
+  for (size_t b = 0; b != NumBackends; ++b) {
+    auto &Backend = *Backends[b];
+    for (size_t i = 0, e = Artifacts.size(); i != e; ++i) {
+      const auto &A = Artifacts[i];
+
+      // Backend has entry already, if it was found in it.
+      if (A.Deferred)
+        continue;
+
+      llvm::StringRef Src =
+          Compressed[i].size() ? llvm::StringRef(Compressed[i]) : A.Path;
+
+      if (!Backend.store(getEntryKey(Key, A), Src)) {
+        log::Logger::get().log_verbose(
+            "Build cache: failed to store '", A.Path, "' in ",
+            Backend.getName(), " cache."
+        );
+        break;
+      }
+    }
+  }
+
+  for (const auto &Tmp : Compressed)
+    if (Tmp.size())
+      llvm::sys::fs::remove(Tmp);
+}
+
+}}}
@@ -0,0 +1,515 @@
+//===--- C++ Levitation CompileServer.cpp -----------------------*- C++ -*-===//
+//
+// Part of the C++ Levitation Project,
+// under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file contains implementation of compile server and
+//  compile servers pool.
+//
+//===----------------------------------------------------------------------===//
+
+#include "clang/Levitation/Common/SimpleLogger.h"
+#include "clang/Levitation/Common/Thread.h"
+#include "clang/Levitation/Driver/CompileServer.h"
+#include "clang/Levitation/Driver/InProcessCompiler.h"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Program.h"
+
+#include <cerrno>
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <thread>
+
+#ifdef LLVM_ON_UNIX
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+namespace clang { namespace levitation { namespace tools {
+
+//-----------------------------------------------------------------------------
+// Protocol helpers
+
+namespace {
+
+  /// How long driver waits for started server to open its pipes.
+  constexpr auto ConnectTimeout = std::chrono::seconds(30);
+
+  /// How often driver checks whether server is still alive, while
+  /// it waits for it to connect.
+  constexpr int ConnectPollMs = 50;
+
+  bool readJob(std::istream &In, std::vector<std::string> &Args) {
+    std::string Header;
+    if (!std::getline(In, Header))
+      return false;
+
+    llvm::StringRef HeaderRef(Header);
+    unsigned NumArgs;
+    if (!HeaderRef.consume_front("JOB ") || HeaderRef.getAsInteger(10, NumArgs))
+      return false;
+
+    Args.resize(NumArgs);
+    for (auto &Arg : Args) {
+      std::string LengthStr;
+      unsigned Length;
+      if (
+        !std::getline(In, LengthStr) ||
+        llvm::StringRef(LengthStr).getAsInteger(10, Length)
+      )
+        return false;
+
+      Arg.assign(Length, '\0');
+      if (Length && !In.read(&Arg[0], Length))
+        return false;
+    }
+
+    return true;
+  }
+
+  void writeResponse(std::ostream &Out, const Failable &Status) {
+    llvm::StringRef Message = Status.isValid() ?
+        Status.getWarningMessage() : Status.getErrorMessage();
+
+    Out << "DONE " << (Status.isValid() ? 0 : 1) << " "
+        << Message.size() << "\n"
+        << Message.str();
+    Out.flush();
+  }
+
+#ifdef LLVM_ON_UNIX
+  /// \return false if server has closed its end.
+  bool writeAll(int FD, llvm::StringRef Data) {
+    while (!Data.empty()) {
+      ssize_t Written = ::write(FD, Data.data(), Data.size());
+      if (Written < 0 && errno == EINTR)
+        continue;
+      if (Written <= 0)
+        return false;
+      Data = Data.drop_front(Written);
+    }
+    return true;
+  }
+
+  bool writeJob(int FD, llvm::ArrayRef<llvm::StringRef> Args) {
+    // Arguments may contain anything, new lines as well,
+    // so each one goes with its length.
+    std::string Job = "JOB " + std::to_string(Args.size()) + "\n";
+    for (auto Arg : Args)
+      Job += std::to_string(Arg.size()) + "\n" + Arg.str();
+    return writeAll(FD, Job);
+  }
+
+  /// Reads from pipe through buffer, which keeps bytes
+  /// read beyond requested ones.
+  class PipeReader {
+    int FD;
+    std::string &Buffer;
+
+    bool fill() {
+      char Chunk[4096];
+      while (true) {
+        ssize_t Read = ::read(FD, Chunk, sizeof(Chunk));
+        if (Read < 0 && errno == EINTR)
+          continue;
+        if (Read <= 0)
+          return false;
+        Buffer.append(Chunk, Read);
+        return true;
+      }
+    }
+
+  public:
+    PipeReader(int FD, std::string &Buffer) : FD(FD), Buffer(Buffer) {}
+
+    bool readLine(std::string &Line) {
+      size_t End;
+      while ((End = Buffer.find('\n')) == std::string::npos)
+        if (!fill())
+          return false;
+      Line = Buffer.substr(0, End);
+      Buffer.erase(0, End + 1);
+      return true;
+    }
+
+    bool read(size_t Length, std::string &Data) {
+      while (Buffer.size() < Length)
+        if (!fill())
+          return false;
+      Data = Buffer.substr(0, Length);
+      Buffer.erase(0, Length);
+      return true;
+    }
+  };
+
+  /// Reads response.
+  /// \return true if response was read, false if server is dead.
+  bool readResponse(PipeReader &In, Failable &Status) {
+    std::string Header;
+    if (!In.readLine(Header))
+      return false;
+
+    llvm::StringRef HeaderRef(Header);
+    llvm::StringRef ResultStr, LengthStr;
+    if (!HeaderRef.consume_front("DONE "))
+      return false;
+
+    std::tie(ResultStr, LengthStr) = HeaderRef.split(' ');
+
+    unsigned Result, Length;
+    if (ResultStr.getAsInteger(10, Result) || LengthStr.getAsInteger(10, Length))
+      return false;
+
+    std::string Message;
+    if (!In.read(Length, Message))
+      return false;
+
+    if (Result != 0)
+      Status.setFailure(Message);
+    else if (Message.size())
+      Status.setWarning(Message);
+
+    return true;
+  }
+
+  void setBlocking(int FD) {
+    int Flags = ::fcntl(FD, F_GETFL);
+    if (Flags != -1)
+      ::fcntl(FD, F_SETFL, Flags & ~O_NONBLOCK);
+  }
+
+  bool isAlive(llvm::sys::ProcessInfo &Process) {
+    if (Process.Pid == llvm::sys::ProcessInfo::InvalidPid)
+      return false;
+
+    // Non-zero pid means process has changed its state, and is reaped.
+    if (llvm::sys::Wait(Process, 0, /*WaitUntilTerminates=*/false).Pid == 0)
+      return true;
+
+    Process = llvm::sys::ProcessInfo();
+    return false;
+  }
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// CompileServer
+
+int CompileServer::serve(
+    llvm::StringRef RequestsPipe,
+    llvm::StringRef ResponsesPipe,
+    bool WarmPreamble
+) {
+  InProcessCompiler::setWarmPreamble(WarmPreamble);
+
+  // Note: open order should match one in CompileServersPool::startServer,
+  // otherwise both sides will block forever.
+  std::ifstream In(RequestsPipe.str());
+  std::ofstream Out(ResponsesPipe.str());
+
+  if (!In || !Out)
+    return 1;
+
+  // Driver doesn't block while it waits for server to start,
+  // so it needs to know once both pipes are open.
+  Out << "READY\n";
+  Out.flush();
+
+  std::vector<std::string> Args;
+  while (readJob(In, Args)) {
+    llvm::SmallVector<llvm::StringRef, 64> ArgsRefs(Args.begin(), Args.end());
+    writeResponse(Out, InProcessCompiler::run(ArgsRefs));
+  }
+
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+// CompileServersPool
+
+struct CompileServersPool::Server {
+  unsigned ID;
+  SinglePath RequestsPipe;
+  SinglePath ResponsesPipe;
+
+  llvm::sys::ProcessInfo Process;
+  int RequestsFD = -1;
+  int ResponsesFD = -1;
+
+  /// Responses bytes read ahead, see PipeReader.
+  std::string ResponsesBuffer;
+
+  bool Running = false;
+};
+
+CompileServersPool::CompileServersPool(
+    llvm::StringRef serverExecutable,
+    unsigned ServersNumber,
+    bool warmPreamble
+) : ServerExecutable(serverExecutable), WarmPreamble(warmPreamble) {
+
+  auto &Log = log::Logger::get();
+
+#ifdef LLVM_ON_UNIX
+  // We don't want to die if server crashes while we're writing request.
+  // Failed write is handled as dead server.
+  signal(SIGPIPE, SIG_IGN);
+#endif
+
+  SinglePath Prefix;
+  llvm::sys::path::system_temp_directory(/*ErasedOnReboot=*/true, Prefix);
+  llvm::sys::path::append(Prefix, "cppl-compile-servers");
+
+  if (auto EC = llvm::sys::fs::createUniqueDirectory(Prefix, PipesDir)) {
+    Log.log_error(
+        "Failed to create compile servers directory: ", EC.message()
+    );
+    return;
+  }
+
+  for (unsigned i = 0; i != ServersNumber; ++i) {
+    auto S = std::make_unique<Server>();
+    S->ID = i;
+
+    SinglePath Base = PipesDir;
+    llvm::sys::path::append(Base, std::to_string(i));
+    S->RequestsPipe = (Base + ".req").str();
+    S->ResponsesPipe = (Base + ".resp").str();
+
+    FreeServers.push_back(S.get());
+    Servers.emplace_back(std::move(S));
+  }
+}
+
+CompileServersPool::~CompileServersPool() {
+  for (auto &S : Servers) {
+    stopServer(*S);
+#ifdef LLVM_ON_UNIX
+    ::unlink(S->RequestsPipe.c_str());
+    ::unlink(S->ResponsesPipe.c_str());
+#endif
+  }
+
+  llvm::sys::fs::remove_directories(PipesDir, /*IgnoreErrors=*/true);
+}
+
+bool CompileServersPool::isSupported() {
+#ifdef LLVM_ON_UNIX
+  return true;
+#else
+  return false;
+#endif
+}
+
+Failable CompileServersPool::startServer(Server &S) {
+  Failable Status;
+
+#ifdef LLVM_ON_UNIX
+  for (auto *P : { &S.RequestsPipe, &S.ResponsesPipe }) {
+    ::unlink(P->c_str());
+    if (mkfifo(P->c_str(), 0600) != 0) {
+      Status.setFailure()
+      << "Failed to create pipe '" << *P << "'.";
+      return Status;
+    }
+  }
+
+  llvm::SmallVector<llvm::StringRef, 5> Args = {
+      ServerExecutable,
+      CompileServer::getServerOption(),
+      S.RequestsPipe,
+      S.ResponsesPipe
+  };
+
+  if (WarmPreamble)
+    Args.push_back(CompileServer::getWarmPreambleOption());
+
+  std::string ErrorMessage;
+  bool ExecutionFailed = false;
+
+  S.Process = llvm::sys::ExecuteNoWait(
+      ServerExecutable, Args, /*Env*/llvm::None, /*Redirects*/{},
+      /*MemoryLimit*/0, &ErrorMessage, &ExecutionFailed
+  );
+
+  if (ExecutionFailed) {
+    Status.setFailure()
+    << "Failed to start compile server: " << ErrorMessage;
+    return Status;
+  }
+
+  // Blocking open of FIFO waits for other side, which never comes if
+  // server has died before it opened its ends, e.g. failed exec or
+  // rejected option. So pipes are opened in non-blocking mode, and
+  // server is checked to be alive until it connects.
+  //
+  // Note: open order should match one in CompileServer::serve.
+
+  auto Deadline = std::chrono::steady_clock::now() + ConnectTimeout;
+
+  auto connectFailure = [&] (llvm::StringRef Reason) {
+    stopServer(S);
+    Status.setFailure()
+    << "Failed to connect to compile server #" << S.ID << ": " << Reason;
+    return Status;
+  };
+
+  // Read end opens at once, and lets server's open of write end succeed.
+  S.ResponsesFD = ::open(S.ResponsesPipe.c_str(), O_RDONLY | O_NONBLOCK);
+  if (S.ResponsesFD == -1)
+    return connectFailure("can't open responses pipe.");
+
+  // Write end fails with ENXIO until server opens read end.
+  while (true) {
+    S.RequestsFD = ::open(S.RequestsPipe.c_str(), O_WRONLY | O_NONBLOCK);
+    if (S.RequestsFD != -1)
+      break;
+
+    if (errno != ENXIO && errno != EINTR)
+      return connectFailure("can't open requests pipe.");
+
+    if (!isAlive(S.Process))
+      return connectFailure("server has exited.");
+
+    if (std::chrono::steady_clock::now() > Deadline)
+      return connectFailure("timed out.");
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(ConnectPollMs));
+  }
+
+  // Until server opens write end, reads would return EOF,
+  // so wait for its READY line.
+  while (S.ResponsesBuffer.find('\n') == std::string::npos) {
+    pollfd P = { S.ResponsesFD, POLLIN, 0 };
+    int Ready = ::poll(&P, 1, ConnectPollMs);
+
+    if (Ready > 0 && (P.revents & POLLIN)) {
+      char Chunk[64];
+      ssize_t Read = ::read(S.ResponsesFD, Chunk, sizeof(Chunk));
+      if (Read > 0)
+        S.ResponsesBuffer.append(Chunk, Read);
+      else if (Read == 0 || (errno != EAGAIN && errno != EINTR))
+        return connectFailure("server has closed responses pipe.");
+      continue;
+    }
+
+    if (!isAlive(S.Process))
+      return connectFailure("server has exited.");
+
+    if (std::chrono::steady_clock::now() > Deadline)
+      return connectFailure("timed out.");
+  }
+
+  std::string Ready;
+  PipeReader(S.ResponsesFD, S.ResponsesBuffer).readLine(Ready);
+  if (Ready != "READY")
+    return connectFailure("unexpected handshake.");
+
+  setBlocking(S.RequestsFD);
+  setBlocking(S.ResponsesFD);
+
+  S.Running = true;
+
+  log::Logger::get().log_verbose(
+      "Started compile server #", S.ID, ", pid ", S.Process.Pid
+  );
+#else
+  Status.setFailure() << "Compile servers are not supported on this host.";
+#endif
+
+  return Status;
+}
+
+void CompileServersPool::stopServer(Server &S) {
+#ifdef LLVM_ON_UNIX
+  if (S.RequestsFD != -1) {
+    writeAll(S.RequestsFD, "EXIT\n");
+    ::close(S.RequestsFD);
+    S.RequestsFD = -1;
+  }
+
+  if (S.ResponsesFD != -1) {
+    ::close(S.ResponsesFD);
+    S.ResponsesFD = -1;
+  }
+  S.ResponsesBuffer.clear();
+#endif
+
+  if (S.Process.Pid != llvm::sys::ProcessInfo::InvalidPid)
+    llvm::sys::Wait(S.Process, 0, /*WaitUntilTerminates=*/true);
+
+  S.Process = llvm::sys::ProcessInfo();
+  S.Running = false;
+}
+
+CompileServersPool::Server *CompileServersPool::acquireServer() {
+  auto _ = lock(Locker);
+  FreeServerNotifier.wait(_, [&] { return !FreeServers.empty(); });
+
+  auto *S = FreeServers.back();
+  FreeServers.pop_back();
+  return S;
+}
+
+void CompileServersPool::releaseServer(Server *S) {
+  {
+    auto _ = lock(Locker);
+    FreeServers.push_back(S);
+  }
+  FreeServerNotifier.notify_one();
+}
+
+Failable CompileServersPool::run(llvm::ArrayRef<llvm::StringRef> Args) {
+  Failable Status;
+
+  auto *S = acquireServer();
+
+  if (!S->Running) {
+    Status = startServer(*S);
+    if (!Status.isValid()) {
+      releaseServer(S);
+      return Status;
+    }
+  }
+
+#ifdef LLVM_ON_UNIX
+  PipeReader Responses(S->ResponsesFD, S->ResponsesBuffer);
+  bool Delivered =
+      writeJob(S->RequestsFD, Args) && readResponse(Responses, Status);
+#else
+  bool Delivered = false;
+#endif
+
+  if (!Delivered) {
+    log::Logger::get().log_warning(
+        "Compile server #", S->ID, " has crashed, it will be restarted."
+    );
+
+    stopServer(*S);
+
+    Status = Failable();
+    Status.setFailure()
+    << "Compile server crashed while running '"
+    << (Args.size() > 1 ? Args.back() : llvm::StringRef()) << "'.";
+  }
+
+  releaseServer(S);
+
+  return Status;
+}
+
+}}}
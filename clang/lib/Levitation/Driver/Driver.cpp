@@ -12,34 +12,102 @@
 //===----------------------------------------------------------------------===//
 
 #include "clang/Basic/FileManager.h"
+#include "clang/Basic/Version.h"
 #include "clang/Config/config.h"
+#include "clang/Levitation/BuildHistory/BuildHistory.h"
+#include "clang/Levitation/BuildState/BuildState.h"
 
 #include "clang/Levitation/Common/Failable.h"
 #include "clang/Levitation/Common/File.h"
 #include "clang/Levitation/Common/FileSystem.h"
 #include "clang/Levitation/Common/SimpleLogger.h"
 #include "clang/Levitation/Common/StringBuilder.h"
+#include "clang/Levitation/Common/Utility.h"
 #include "clang/Levitation/DeclASTMeta/DeclASTMeta.h"
 #include "clang/Levitation/DeclASTMeta/DeclASTMetaLoader.h"
 #include "clang/Levitation/DependenciesSolver/DependenciesGraph.h"
+#include "clang/Levitation/DependenciesSolver/DependenciesGraphExport.h"
+#include "clang/Levitation/DependenciesSolver/DependenciesIndex.h"
 #include "clang/Levitation/DependenciesSolver/DependenciesSolver.h"
 #include "clang/Levitation/DependenciesSolver/SolvedDependenciesInfo.h"
+#include "clang/Levitation/Driver/ArtifactLock.h"
+#include "clang/Levitation/Driver/ArtifactPack.h"
+#include "clang/Levitation/Driver/ArtifactPublisher.h"
+#include "clang/Levitation/Driver/BuildCache.h"
+#include "clang/Levitation/Driver/BuildJournal.h"
+#include "clang/Levitation/Driver/BuildMetrics.h"
+#include "clang/Levitation/Driver/BuildProgress.h"
+#include "clang/Levitation/Driver/BuildTrace.h"
+#include "clang/Levitation/Driver/CompileServer.h"
+#include "clang/Levitation/Driver/CompileCommands.h"
+#include "clang/Levitation/Driver/DiagnosticsReplay.h"
 #include "clang/Levitation/Driver/Driver.h"
+#include "clang/Levitation/Driver/DriverSession.h"
+#include "clang/Levitation/Driver/FileClone.h"
+#include "clang/Levitation/Driver/FilesCache.h"
+#include "clang/Levitation/Driver/GraphAdvisor.h"
+#include "clang/Levitation/Driver/HotUnits.h"
+#include "clang/Levitation/Driver/JUnitReport.h"
+#include "clang/Levitation/Driver/ModuleMap.h"
+#include "clang/Levitation/Driver/PerformanceBudgets.h"
 #include "clang/Levitation/Driver/PackageFiles.h"
+#include "clang/Levitation/Driver/ProcessReaper.h"
+#include "clang/Levitation/Driver/SourcesWatcher.h"
+#include "clang/Levitation/Driver/TimeTraceReport.h"
+#include "clang/Levitation/Driver/UnsavedFiles.h"
+#include "clang/Levitation/Driver/PrivateImports.h"
+#include "clang/Levitation/Driver/UnusedImports.h"
 #include "clang/Levitation/Driver/HeaderGenerator.h"
+#include "clang/Levitation/Driver/InProcessCompiler.h"
+#include "clang/Levitation/Driver/Jobserver.h"
+#include "clang/Levitation/Driver/LibraryBundle.h"
+#include "clang/Levitation/Driver/LibraryCache.h"
+#include "clang/Levitation/Driver/NinjaPlan.h"
 #include "clang/Levitation/FileExtensions.h"
+#include "clang/Levitation/ImportScanner.h"
+#include "clang/Levitation/Serialization.h"
+#include "clang/Levitation/TasksManager/ConcurrencyController.h"
 #include "clang/Levitation/TasksManager/TasksManager.h"
+#include "clang/Levitation/TasksManager/WorkerPlacement.h"
 #include "clang/Levitation/UnitID.h"
-
+#include "clang/Serialization/GlobalModuleIndex.h"
+#include "clang/Serialization/PCHContainerOperations.h"
+
+#include "llvm/Config/llvm-config.h"
+#include "llvm/Object/Archive.h"
+#include "llvm/Object/ArchiveWriter.h"
+#include "llvm/Object/Binary.h"
+#include "llvm/Object/SymbolicFile.h"
+#include "llvm/ProfileData/InstrProfReader.h"
 #include "llvm/Support/FileSystem.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/Program.h"
+#include "llvm/ADT/DenseSet.h"
 #include "llvm/ADT/None.h"
+#include "llvm/ADT/ScopeExit.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/ADT/StringSwitch.h"
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <system_error>
+#include <thread>
 #include <utility>
 
+#ifdef LLVM_ON_UNIX
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
 namespace clang { namespace levitation { namespace tools {
 
 using namespace clang::levitation::dependencies_solver;
@@ -51,6 +119,310 @@ using namespace clang::levitation::tasks;
 
 namespace {
 
+  /// Stamps are taken through files cache, so that each file
+  /// is stat'ed once per build.
+  llvm::Optional<BuildState::FileStamp> getFileStamp(StringRef Path) {
+    return BuildState::getStamp(*FilesCache::get().getFileSystem(), Path);
+  }
+
+  bool fileExists(StringRef Path) {
+    return FilesCache::get().exists(Path);
+  }
+
+  /// Whether header has same stamp it had when compiler read it.
+  /// Compiler records modification time in seconds.
+  bool isIncludeUntouched(
+      const DeclASTMeta::IncludeTy &Inc,
+      const BuildState::FileStamp &Stamp
+  ) {
+    return Stamp.Size == Inc.Size && Stamp.MTime / 1000000000 == Inc.MTime;
+  }
+
+  /// Stamps of headers product was built from, for build state.
+  std::vector<BuildState::IncludeState> getIncludeStates(
+      const DeclASTMeta &Meta
+  ) {
+    std::vector<BuildState::IncludeState> Res;
+    for (const auto &Inc : Meta.getIncludes()) {
+      auto Stamp = getFileStamp(Inc.Path);
+
+      // Header was changed while product was built, so its
+      // contents are not known, it is rehashed next time.
+      if (!Stamp || !isIncludeUntouched(Inc, *Stamp))
+        Res.push_back({Inc.Path, BuildState::FileStamp()});
+      else
+        Res.push_back({Inc.Path, *Stamp});
+    }
+    return Res;
+  }
+
+  /// Whether headers recorded in build state were not
+  /// touched since then.
+  bool areIncludesUntouched(const BuildState::ProductState &S) {
+    for (const auto &Inc : S.Includes) {
+      auto Stamp = getFileStamp(Inc.Path);
+      if (!Stamp || *Stamp != Inc.Stamp)
+        return false;
+    }
+    return true;
+  }
+
+  /// Hash algorithm new metas and cache keys use, see --hash.
+  /// Existing metas are checked with algorithm they were written with.
+  HashKind &metaHash() {
+    static HashKind Kind = HashKind::MD5;
+    return Kind;
+  }
+
+  /// Whether decl-ast and object jobs write dependencies
+  /// deserialization stats, see --dependency-stats.
+  bool &dependencyStatsEnabled() {
+    static bool Enabled = false;
+    return Enabled;
+  }
+
+  /// Whether decl-ast and object jobs serialize diagnostics,
+  /// see --replay-diagnostics.
+  bool &diagnosticsReplayEnabled() {
+    static bool Enabled = false;
+    return Enabled;
+  }
+
+  /// Returns serialized diagnostics file of job
+  /// which produces given output.
+  SinglePath getDiagnosticsFile(StringRef OutputFile) {
+    SinglePath Res = OutputFile;
+    Res += ".";
+    Res += FileExtensions::SerializedDiagnostics;
+    return Res;
+  }
+
+  /// Returns path of unit artifact without artifact extension,
+  /// or empty string if file is not unit artifact.
+  std::string getArtifactStem(StringRef File) {
+    SinglePath P = File;
+    llvm::sys::fs::make_absolute(P);
+    llvm::sys::path::remove_dots(P, /*remove_dot_dot=*/true);
+
+    StringRef Stem = P;
+
+    // Response files and time traces are named after outputs of commands.
+    Stem.consume_back(
+        (Twine(".") + FileExtensions::ResponseFile).str()
+    );
+    Stem.consume_back(
+        (Twine(".") + FileExtensions::TimeTrace).str()
+    );
+    Stem.consume_back(
+        (Twine(".") + FileExtensions::DependencyStats).str()
+    );
+    Stem.consume_back(
+        (Twine(".") + FileExtensions::SerializedDiagnostics).str()
+    );
+
+    // Compound extensions go first.
+    static const char *Extensions[] = {
+      FileExtensions::DeclASTMeta,
+      FileExtensions::ParsedDependenciesMeta,
+      FileExtensions::ObjMeta,
+      FileExtensions::IR,
+      FileExtensions::DeclarationAST,
+      FileExtensions::ParsedDependencies,
+      FileExtensions::Object,
+      FileExtensions::DirectDependencies,
+      FileExtensions::FullDependencies
+    };
+
+    for (StringRef Ext : Extensions) {
+      if (
+        Stem.size() > Ext.size() + 1 &&
+        Stem.endswith(Ext) &&
+        Stem[Stem.size() - Ext.size() - 1] == '.'
+      )
+        return Stem.drop_back(Ext.size() + 1).str();
+    }
+
+    return "";
+  }
+
+  /// Asks OS to read file into page cache in background.
+  /// Does nothing if it is not supported.
+  void prefetchFile(StringRef Path) {
+#if defined(LLVM_ON_UNIX) && defined(POSIX_FADV_WILLNEED)
+    int FD;
+    if (llvm::sys::fs::openFileForRead(Path, FD))
+      return;
+    posix_fadvise(FD, 0, 0, POSIX_FADV_WILLNEED);
+    ::close(FD);
+#endif
+  }
+
+  /// Driver counters, dumped with --stats. Counters are always
+  /// updated, they are cheap compared to things they count.
+  struct DriverStats {
+    std::atomic<uint64_t> NodesChecked { 0 };
+    std::atomic<uint64_t> NodesRebuilt { 0 };
+    std::atomic<uint64_t> BytesHashed { 0 };
+    std::atomic<uint64_t> MetasLoaded { 0 };
+    std::atomic<uint64_t> ProcessesSpawned { 0 };
+    std::atomic<uint64_t> DiagnosticsReplayed { 0 };
+
+    static DriverStats &get() {
+      static DriverStats Instance;
+      return Instance;
+    }
+  };
+
+  /// Same as DeclASTMetaLoader::fromFile, but also counts loaded metas.
+  bool loadMeta(DeclASTMeta &Meta, StringRef BuildRoot, StringRef MetaFile) {
+    ++DriverStats::get().MetasLoaded;
+    return DeclASTMetaLoader::fromFile(Meta, BuildRoot, MetaFile);
+  }
+
+  /// Source hashes known to this build. Each source is hashed once,
+  /// then the hash is used by up-to-date checks and cache keys of all
+  /// its steps, and is passed to frontend jobs, see
+  /// levitation::parseSourceDigest. Hashes are only valid while
+  /// sources keep stamps they had when were hashed.
+  class SourceDigests {
+    struct Digest {
+      BuildState::FileStamp Stamp;
+      HashKind Kind;
+      HashVectorTy Hash;
+    };
+
+    std::mutex Locker;
+    llvm::StringMap<Digest> Digests;
+
+  public:
+
+    static SourceDigests &get() {
+      static SourceDigests Instance;
+      return Instance;
+    }
+
+    /// Remembers hash calculated elsewhere, e.g. recorded
+    /// in build state of previous build.
+    void remember(
+        StringRef Source,
+        BuildState::FileStamp Stamp,
+        HashKind Kind,
+        HashRef Hash
+    ) {
+      auto _ = lock(Locker);
+      Digests[Source] = { Stamp, Kind, HashVectorTy(Hash.begin(), Hash.end()) };
+    }
+
+    /// \return false if source can't be read.
+    bool getHash(StringRef Source, HashKind Kind, HashVectorTy &Res) {
+      auto Stamp = getFileStamp(Source);
+
+      if (Stamp) {
+        auto _ = lock(Locker);
+        auto Found = Digests.find(Source);
+        if (
+          Found != Digests.end() &&
+          Found->second.Stamp == *Stamp &&
+          Found->second.Kind == Kind
+        ) {
+          Res = Found->second.Hash;
+          return true;
+        }
+      }
+
+      // Source is hashed without lock, so that other
+      // sources are not blocked.
+      auto &FM = CreatableSingleton<FileManager>::get();
+      if (!calcHashFromFile(FM, Kind, Res, Source))
+        return false;
+
+      if (Stamp)
+        DriverStats::get().BytesHashed += Stamp->Size;
+
+      if (Stamp)
+        remember(Source, *Stamp, Kind, Res);
+
+      return true;
+    }
+
+    /// \return digest of source for frontend jobs,
+    /// or empty string if source can't be hashed.
+    std::string getDigestArg(StringRef Source) {
+      // Plan is run later, when sources may be different.
+      if (NinjaPlan::get().isRecording())
+        return "";
+
+      auto Stamp = getFileStamp(Source);
+      HashVectorTy Hash;
+      if (!Stamp || !getHash(Source, metaHash(), Hash))
+        return "";
+
+      return formatSourceDigest(Hash, Stamp->Size, Stamp->MTime);
+    }
+  };
+
+  /// Why node is rebuilt, see --explain.
+  struct RebuildReason {
+    enum class Kind {
+      PreambleUpdated,
+      HeaderUnitUpdated,
+      DependencyUpdated,
+      ProfileUpdated,
+      NoProduct,
+      ProductMissing,
+      MetaMissing,
+      MetaUnreadable,
+      SourceUnreadable,
+      SourceChanged,
+      IncludeChanged,
+      CommandChanged
+    };
+
+    Kind K = Kind::SourceChanged;
+
+    /// Updated dependency, for DependencyUpdated only.
+    DependenciesGraph::NodeID::Type Dependency = 0;
+
+    /// Updated header unit, for HeaderUnitUpdated only.
+    std::string HeaderUnit;
+
+    static llvm::StringRef getKindName(Kind K) {
+      switch (K) {
+        case Kind::PreambleUpdated: return "preamble-updated";
+        case Kind::HeaderUnitUpdated: return "header-unit-updated";
+        case Kind::DependencyUpdated: return "dependency-updated";
+        case Kind::ProfileUpdated: return "profile-updated";
+        case Kind::NoProduct: return "no-product";
+        case Kind::ProductMissing: return "product-missing";
+        case Kind::MetaMissing: return "meta-missing";
+        case Kind::MetaUnreadable: return "meta-unreadable";
+        case Kind::SourceUnreadable: return "source-unreadable";
+        case Kind::SourceChanged: return "source-changed";
+        case Kind::IncludeChanged: return "include-changed";
+        case Kind::CommandChanged: return "command-changed";
+      }
+      llvm_unreachable("Unknown rebuild reason");
+    }
+
+    static llvm::StringRef getKindDescr(Kind K) {
+      switch (K) {
+        case Kind::PreambleUpdated: return "preamble updated";
+        case Kind::HeaderUnitUpdated: return "header unit updated";
+        case Kind::DependencyUpdated: return "dependency updated";
+        case Kind::ProfileUpdated: return "profile updated";
+        case Kind::NoProduct: return "no product";
+        case Kind::ProductMissing: return "product missing";
+        case Kind::MetaMissing: return "meta missing";
+        case Kind::MetaUnreadable: return "meta unreadable";
+        case Kind::SourceUnreadable: return "source unreadable";
+        case Kind::SourceChanged: return "source hash changed";
+        case Kind::IncludeChanged: return "included header changed";
+        case Kind::CommandChanged: return "compiler or flags changed";
+      }
+      llvm_unreachable("Unknown rebuild reason");
+    }
+  };
+
   // TODO Levitation: Whole Context approach is malformed.
   // Context should keep shared data for all sequence steps.
   // If something is required for particular step only it should
@@ -69,18 +441,405 @@ namespace {
 
     FilesMapTy Files;
 
+    /// Library units project doesn't import, neither directly, nor
+    /// through other library units. They are kept out of Files,
+    /// so that nothing is built for them, see runParseImport.
+    FilesMapTy UnreachedLibraries;
+
+    /// Contents hashes of libraries units belong to, by unit ID.
+    /// Only collected if library cache is enabled.
+    llvm::StringMap<std::string> LibraryHashes;
+
+    /// Declaration AST metas of library and bundle units. Dependents
+    /// are keyed by interface hashes of these, see
+    /// getDependencyFingerprint.
+    llvm::StringSet<> LibraryMetaFiles;
+
+    /// Units of each library, by library output directory,
+    /// see writeLibraryFingerprints.
+    std::map<std::string, std::vector<StringID>> LibraryUnits;
+
+    std::string CompilerFingerprint;
+
+    /// Prebuilt library bundles, see +B.
+    struct BundleInfo {
+      SinglePath Path;
+      std::shared_ptr<LibraryBundle> Bundle;
+
+      /// Packages of bundle units, in order of bundle units.
+      std::vector<StringID> Packages;
+    };
+    std::vector<BundleInfo> Bundles;
+
     std::shared_ptr<SolvedDependenciesInfo> DependenciesInfo;
 
+    /// Dependencies loaded by solver, kept so that next watch mode
+    /// build may reload only updated .ldeps.
+    std::shared_ptr<ParsedDependencies> ParsedDeps;
+
+    /// Packages whose .ldeps were rebuilt since they were loaded
+    /// by solver last time.
+    PathIDsSet UpdatedLDeps;
+
+    /// Dependencies of all packages, kept in single file,
+    /// so that solver doesn't open .ldeps of unchanged packages.
+    std::shared_ptr<DependenciesIndex> DepsIndex;
+
     bool PreambleUpdated = false;
+
+    /// Whether subtree preambles were updated, in order
+    /// of LevitationDriver::SubtreePreambles.
+    llvm::SmallVector<bool, 4> SubtreePreamblesUpdated;
+
+    /// Header units, in order of LevitationDriver::HeaderUnits.
+    struct HeaderUnitInfo {
+      SinglePath Source;
+      SinglePath DeclAST;
+      SinglePath DeclASTMetaFile;
+      bool Updated = false;
+    };
+    std::vector<HeaderUnitInfo> HeaderUnits;
+
+    /// Header units packages include directly.
+    llvm::DenseMap<StringID, llvm::SmallVector<unsigned, 2>> HeaderUnitsUsed;
     bool ObjectsUpdated = false;
     DependenciesGraph::NodesSet UpdatedNodes;
 
+    /// Names of declarations changed by updated declaration nodes,
+    /// see DeclASTMeta::DeclHashTy. Updated nodes without entry
+    /// may have changed anything.
+    llvm::DenseMap<
+        DependenciesGraph::NodeID::Type, llvm::StringSet<>
+    > ChangedDecls;
+    std::mutex ChangedDeclsMutex;
+
+    /// Reasons of nodes rebuilt during current build, in order
+    /// nodes were checked, see --explain.
+    std::vector<
+        std::pair<DependenciesGraph::NodeID::Type, RebuildReason>
+    > RebuildReasons;
+    std::mutex RebuildReasonsMutex;
+
+    /// Hash of profile used by objects, if any.
+    std::string ProfileUseHash;
+
+    /// Symbol ordering file passed to linker, if any,
+    /// see --symbol-ordering.
+    std::string SymbolOrderingFile;
+
+    /// Classes of units listed by --hot-units, and class
+    /// of unlisted ones.
+    llvm::StringMap<HotUnits::Temperature> UnitTemperatures;
+    HotUnits::Temperature DefaultTemperature = HotUnits::Temperature::Warm;
+
+    /// Results of tests which were run, see --test.
+    std::vector<JUnitReport::TestCase> TestResults;
+
+    /// Workers of nodes, see --remote-workers.
+    SolvedDependenciesInfo::WorkersMap Workers;
+
+    /// Nodes whose jobs may be duplicated, see --speculate-after.
+    DependenciesGraph::NodesSet CriticalNodes;
+
+    /// Domains (NUMA nodes) where node products were written,
+    /// see --numa.
+    llvm::DenseMap<DependenciesGraph::NodeID::Type, int> NodeDomains;
+    std::mutex NodeDomainsMutex;
+
+    /// Nodes build is restricted to, see -target and --shard.
+    /// Only actual if there are targets or shards.
+    DependenciesGraph::NodesSet SelectedNodes;
+
+    /// Nodes current codegen phase may rebuild, that is nodes whose own
+    /// inputs were changed and their dependents, see precheckNodes.
+    /// Only actual if NodesPrechecked is set.
+    DependenciesGraph::NodesSet DirtyNodes;
+    bool NodesPrechecked = false;
+
+    /// Build configuration objects are currently built for,
+    /// null if configurations are not used.
+    const LevitationDriver::BuildConfig *Config = nullptr;
+
+    /// Codegen arguments for current configuration.
+    LevitationDriver::Args CodeGenArgs;
+
+    /// Whether declaration nodes were processed by
+    /// previous configuration pass.
+    bool DeclarationsProcessed = false;
+
+    /// Steps durations collected during previous builds.
+    BuildHistory History;
+
+    /// Steps durations collected during current build.
+    BuildHistory Timings;
+    std::mutex TimingsMutex;
+
+    /// Build start time and driver counters by then, counters are
+    /// accumulated since driver start, while metrics only cover
+    /// current build, see --metrics.
+    std::chrono::steady_clock::time_point BuildStart;
+    uint64_t BaseNodesChecked = 0;
+    uint64_t BaseNodesRebuilt = 0;
+    uint64_t BaseProcessesSpawned = 0;
+    unsigned BaseCacheHits = 0;
+    unsigned BaseCacheMisses = 0;
+
+    /// Products states recorded during previous build.
+    BuildState PrevState;
+
+    /// Products states checked or built during current build.
+    BuildState State;
+    std::mutex StateMutex;
+
+    /// Nodes completed during current build, and during builds
+    /// interrupted before, see BuildJournal.
+    BuildJournal Journal;
+
+    /// Units whose declarations were updated by interrupted builds,
+    /// dependents of them might not be rebuilt yet.
+    llvm::DenseSet<StringID> JournalUpdatedUnits;
+
+    /// Whether sources were collected by previous watch mode build.
+    bool SourcesCollected = false;
+
+    /// Whether history and state were inherited from previous
+    /// watch mode build.
+    bool Inherited = false;
+
+    /// Absolute paths of sources reported as changed in watch mode.
+    /// Stamps of these sources are not trusted, since they may have
+    /// been changed within same mtime tick.
+    llvm::StringSet<> ChangedSources;
+
+    /// Number of steps failed during current build.
+    std::atomic<unsigned> NumFailedSteps { 0 };
+
+    /// Units whose declaration AST metas, checked or built during
+    /// current build, tell they emit no code, see --skip-empty-objects.
+    llvm::DenseSet<StringID> CodelessUnits;
+    std::mutex CodelessUnitsMutex;
+
+    /// Whether sources were changed again while watch mode build was
+    /// running, so that build is cancelled.
+    std::atomic<bool> Superseded { false };
+
+    /// Callbacks of session build was run by, if any.
+    const LevitationDriverSession::Callbacks *Callbacks = nullptr;
+
     RunContext(LevitationDriver &driver)
     : Driver(driver)
     {}
+
+    /// Takes everything what survives between watch mode builds.
+    /// \param Prev context of previous build
+    /// \param KeepSources whether collected sources may be reused.
+    void inherit(RunContext &Prev, bool KeepSources) {
+      History = std::move(Prev.History);
+      History.merge(Prev.Timings);
+
+      if (!Prev.Status.isValid()) {
+        PrevState = std::move(Prev.PrevState);
+        PrevState.merge(Prev.State);
+      } else
+        PrevState = std::move(Prev.State);
+
+      if (KeepSources && Prev.Status.isValid()) {
+        AllPackages = std::move(Prev.AllPackages);
+        ProjectPackages = std::move(Prev.ProjectPackages);
+        ExternalPackages = std::move(Prev.ExternalPackages);
+        Files = std::move(Prev.Files);
+        Bundles = std::move(Prev.Bundles);
+        LibraryHashes = std::move(Prev.LibraryHashes);
+        LibraryMetaFiles = std::move(Prev.LibraryMetaFiles);
+        LibraryUnits = std::move(Prev.LibraryUnits);
+        CompilerFingerprint = std::move(Prev.CompilerFingerprint);
+        SourcesCollected = true;
+
+        // Project may start to import them since previous build.
+        for (auto &kv : Prev.UnreachedLibraries.getMap()) {
+          AllPackages.insert(kv.first);
+          ExternalPackages.insert(kv.first);
+        }
+        std::vector<StringID> Unreached;
+        for (auto &kv : Prev.UnreachedLibraries.getMap())
+          Unreached.push_back(kv.first);
+        for (auto PackageID : Unreached)
+          Files.insert(PackageID, Prev.UnreachedLibraries.take(PackageID));
+      }
+
+      // Solved dependencies are reused even if sources were
+      // collected again, solver drops packages which have gone.
+      ParsedDeps = std::move(Prev.ParsedDeps);
+      DependenciesInfo = std::move(Prev.DependenciesInfo);
+      UpdatedLDeps = std::move(Prev.UpdatedLDeps);
+      DepsIndex = std::move(Prev.DepsIndex);
+
+      Inherited = true;
+    }
+  };
+}
+
+namespace {
+
+  /// State of streaming declarations pipeline (see --streaming).
+  /// Declaration AST of a unit is built as soon as its .ldeps and
+  /// declaration ASTs of its dependencies are ready, while other units
+  /// are still being parsed. Streaming is an accelerator only: regular
+  /// solve and code generation follow it, and only pick up results of
+  /// streamed units, so anything streaming leaves aside (cycles, body-only
+  /// and external dependencies, failures) is handled by regular phases.
+  struct StreamingState {
+
+    enum class UnitStatus {
+      Waiting,
+      Held,
+      Scheduled,
+      Done,
+      Failed
+    };
+
+    struct Unit {
+      std::string UnitID;
+      const FilesInfo *Files = nullptr;
+
+      bool Loaded = false;
+      bool IsPublic = false;
+      bool IsBodyOnly = false;
+
+      /// If set, unit has dependencies streaming can't satisfy.
+      bool NotStreamable = false;
+
+      UnitStatus Status = UnitStatus::Waiting;
+      bool InterfaceUpdated = false;
+
+      llvm::SmallVector<StringID, 8> Dependencies;
+      llvm::SmallVector<StringID, 8> Dependents;
+    };
+
+    std::mutex Mutex;
+
+    /// All project units, created before streaming is started,
+    /// so that map itself is never modified by jobs.
+    llvm::DenseMap<StringID, std::unique_ptr<Unit>> Units;
+    llvm::StringMap<StringID> UnitIDs;
+
+    /// Units which are ready, but wait for preamble.
+    llvm::SmallVector<StringID, 16> Held;
+    bool PreambleReady = false;
+
+    /// Set when cycle is found or some job failed,
+    /// no more jobs are scheduled after that.
+    bool Stopped = false;
+
+    tasks::TasksManager::TasksSet Tasks;
+    Failable Status;
+
+    /// Metas of declaration ASTs as they were before streamed rebuild.
+    llvm::DenseMap<StringID, DeclASTMeta> StreamedOldMetas;
+
+    MutexLock lock() {
+      return levitation::lock(Mutex);
+    }
+
+    Unit *get(StringID ID) {
+      auto Found = Units.find(ID);
+      return Found != Units.end() ? Found->second.get() : nullptr;
+    }
+  };
+}
+
+namespace {
+
+  /// Memory accounting of build step being run by current thread,
+  /// see LevitationDriverImpl::runTimed.
+  struct StepMemory {
+    /// Expected peak memory of step jobs, 0 if unknown.
+    BuildHistory::MemoryTy Expected = 0;
+
+    /// Peak memory of step jobs run in subprocesses, 0 if unknown.
+    BuildHistory::MemoryTy Peak = 0;
+  };
+
+  thread_local StepMemory CurrentStepMemory;
+
+  /// Straggler policy of build step being run by current thread,
+  /// see LevitationDriverImpl::getSpeculation.
+  struct StepSpeculation {
+    /// Duration in microseconds, after which delegated job is
+    /// duplicated, 0 if job is never duplicated.
+    BuildHistory::DurationTy After = 0;
+
+    /// Worker duplicate is sent to, negative if jobs
+    /// are not assigned to workers.
+    int Worker = -1;
+  };
+
+  thread_local StepSpeculation CurrentStepSpeculation;
+
+  /// Whether jobs of build step being run by current thread are
+  /// off critical path, and their subprocesses run with lower CPU
+  /// and I/O priority, see --job-priorities.
+  thread_local bool CurrentStepLowPriority = false;
+
+  /// Subprocesses launched by driver jobs which are still running,
+  /// so that they may be killed in -fail-fast mode.
+  class RunningSubprocesses {
+    std::mutex Locker;
+    llvm::DenseSet<int> PIDs;
+    bool Killed = false;
+
+  public:
+
+    static RunningSubprocesses &get() {
+      static RunningSubprocesses Instance;
+      return Instance;
+    }
+
+    void add(int PID) {
+      auto _ = lock(Locker);
+      PIDs.insert(PID);
+#ifdef LLVM_ON_UNIX
+      // Process was launched after everything else was killed.
+      if (Killed)
+        kill(PID, SIGTERM);
+#endif
+    }
+
+    /// Should be called before process is reaped, otherwise
+    /// its PID may be reused by unrelated process.
+    void remove(int PID) {
+      auto _ = lock(Locker);
+      PIDs.erase(PID);
+    }
+
+    void killAll() {
+      auto _ = lock(Locker);
+      Killed = true;
+#ifdef LLVM_ON_UNIX
+      for (int PID : PIDs)
+        kill(PID, SIGTERM);
+#endif
+    }
+
+    void reset() {
+      auto _ = lock(Locker);
+      Killed = false;
+    }
   };
 }
 
+/// Files decl-ast job generates along with declaration AST, see
+/// -cppl-header-out and -cppl-decl-out.
+struct GeneratedSources {
+  StringRef Header;
+  StringRef Decl;
+  StringRef Preamble;
+  Paths Includes;
+  Paths Imports;
+
+  bool empty() const { return Header.empty() && Decl.empty(); }
+};
+
 class LevitationDriverImpl {
   RunContext &Context;
   DependenciesStringsPool &Strings;
@@ -89,6 +848,29 @@ class LevitationDriverImpl {
   log::Logger &Log;
   TasksManager &TM;
 
+  /// Preamble is built concurrently with parse-import and
+  /// dependencies solving, so it reports into separate status,
+  /// which is merged into main one before code generation.
+  Failable PreambleStatus;
+
+  std::unique_ptr<StreamingState> Streaming;
+
+  /// Name index built by previous build, empty if there is no one.
+  /// Index is only valid for Declaration ASTs which were not changed
+  /// since then, and compiler checks it by itself.
+  SinglePath NameIndex;
+
+  /// Nodes and files which were prefetched, see --prefetch.
+  std::mutex PrefetchLocker;
+  llvm::DenseSet<DependenciesGraph::NodeID::Type> PrefetchedNodes;
+  llvm::StringSet<> PrefetchedFiles;
+
+  /// Progress of declaration and object jobs, see --status-fd.
+  BuildProgress Progress;
+  bool ShowProgress = false;
+  std::mutex StatusLocker;
+  std::unique_ptr<llvm::raw_fd_ostream> StatusOut;
+
 public:
 
   explicit LevitationDriverImpl(RunContext &context)
@@ -99,11 +881,126 @@ public:
     TM(TasksManager::get())
   {}
 
+  /// Runs all build phases.
+  /// \return true if build was successful.
+  bool build();
+
+  /// Prints definitions, or targets, affected by changed files,
+  /// see --affected. Graph is solved for dependencies found by
+  /// previous build, nothing is compiled.
+  /// \return false if dependencies can't be solved.
+  bool queryAffected();
+
+  /// Writes preamble suggested by include directives of units,
+  /// see --suggest-preamble.
+  /// \return false if dependencies can't be solved, or preamble
+  /// can't be written.
+  bool suggestPreamble();
+
+  /// Prints units ranked by rebuild impact and load cost, with
+  /// suggestions how to split them, see --advise. Graph is solved
+  /// for dependencies found by previous build, nothing is compiled.
+  /// \return false if dependencies can't be solved.
+  bool advise();
+
+  /// Fetches declaration ASTs and objects of dirty nodes from build
+  /// cache, see --prewarm-cache. Node is fetched once all its
+  /// dependencies are up-to-date or fetched, since their metas
+  /// are part of its cache key. Nothing is compiled, besides
+  /// preamble, if it is out of date and not in cache.
+  /// \return false if dependencies can't be solved.
+  bool prewarmCache();
+
+  /// Parses imports and solves dependencies, then records commands
+  /// of all other phases and writes them as ninja build file,
+  /// see --emit-ninja.
+  /// \return false if dependencies can't be solved, any of phases
+  /// has failed, or build file can't be written.
+  bool emitNinja();
+
+  /// Collects sources and removes garbage, see --gc.
+  /// \return false if sources can't be collected.
+  bool collectGarbage();
+
+  /// Removes declaration ASTs, objects and their metas of units
+  /// which are not in Context.Files anymore.
+  void removeOrphanArtifacts();
+
+  /// Applies --cache-max-size and --cache-max-age to build cache.
+  void trimBuildCache();
+
   void buildPreamble();
 
+  /// Builds single preamble of preambles chain, unless it is up to date.
+  /// \param ChainedOn preamble this one is built on top of, if any.
+  /// \param ChainUpdated whether some of previous links were rebuilt,
+  /// set to true if this one is rebuilt.
+  /// \return false if build failed.
+  bool buildPreambleLink(
+      StringRef Source,
+      StringRef Output,
+      StringRef OutputMeta,
+      StringRef ChainedOn,
+      bool &ChainUpdated
+  );
+
+  /// Builds subtree preambles on top of main preamble.
+  /// \param MainUpdated whether main preamble was updated.
+  void buildSubtreePreambles(bool MainUpdated);
+
+  /// \return index of subtree preamble unit with given source uses,
+  /// or -1 if it uses main preamble.
+  int getSubtreePreamble(StringRef Source) const;
+
+  /// \return preamble source, to be included into unit
+  /// with given source, empty if there is no preamble.
+  StringRef getPreambleSource(StringRef Source) const;
+
+  /// \return precompiled preamble and its meta for unit
+  /// with given source, empty if there is no preamble.
+  StringRef getPreambleOutput(StringRef Source) const;
+  StringRef getPreambleOutputMeta(StringRef Source) const;
+
+  /// \return whether preamble of unit with given source was updated.
+  bool isPreambleUpdated(StringRef Source) const;
+
+  /// Checks that units only depend on units built with
+  /// same preamble or with main preamble.
+  void checkSubtreePreambles();
+
+  /// Builds header units on top of main preamble, see --header-unit,
+  /// and finds out which packages include them.
+  void buildHeaderUnits();
+  bool buildHeaderUnit(
+      StringRef Header,
+      RunContext::HeaderUnitInfo &HU
+  );
+
+  /// \return header units used by node, either directly
+  /// or through its dependencies, in order of their declaration.
+  llvm::SmallVector<unsigned, 4> getHeaderUnits(
+      const DependenciesGraph::Node &N
+  ) const;
+
   // TODO Levitation: Deprecated
   void runParse();
   void runParseImport();
+
+  /// Runs parse-import for given packages.
+  /// \return true if successful.
+  bool parseImports(const PathIDsSet &Packages);
+
+  /// Collects library packages imported by given packages,
+  /// which are not in Reached yet, and adds them to Reached.
+  void collectImportedLibraries(
+      const PathIDsSet &Packages,
+      PathIDsSet &Reached,
+      PathIDsSet &Imported
+  );
+
+  /// Moves library packages out of Reached into UnreachedLibraries.
+  void removeUnreachedLibraries(const PathIDsSet &Reached);
+
   void solveDependencies();
 
   // TODO Levitation: Deprecated
@@ -112,19 +1009,224 @@ public:
   void codeGen();
   void runLinker();
 
+  /// Puts project objects into static archive, see --archive.
+  void writeArchive();
+
+  /// Puts project units artifacts into library bundle, see --make-bundle.
+  void writeBundle();
+
+  /// Puts headers of public project units into single header,
+  /// see --amalgamated-header.
+  void writeAmalgamatedHeader();
+
+  /// Collects headers of public project units, in order of their
+  /// dependencies, along with unit IDs.
+  void collectPublicHeaders(
+      std::vector<std::pair<StringRef, const FilesInfo*>> &Headers
+  );
+
+  /// Writes clang module map of public headers, see --module-map.
+  void writeModuleMap();
+
+  /// Precompiles public headers into single PCH, see --headers-pch.
+  void buildHeadersPCH();
+
+  /// Writes contents of library bundles into build root,
+  /// unless they were written by previous build.
+  void extractBundles();
+
+  /// Links each of targets into its own executable, in parallel,
+  /// see -target. Executable is only relinked if set of its objects,
+  /// or some of objects, has changed.
+  void runTargetsLinker();
+
+  /// Runs linked executable as test, see --test.
+  void runTest(StringRef Executable, JUnitReport::TestCase &R);
+
+  /// Runs output executable as test, unless targets were tested
+  /// already while they were linked, and reports test results.
+  void runTests();
+
+  /// Packages split DWARF of linked executables, unless their
+  /// packages are up-to-date, see --dwp. Each package is made
+  /// in its own task.
+  bool packageDwarf(ArrayRef<SinglePath> Executables);
+
+  /// Runs ThinLTO thin-link step and backends for all bitcode objects.
+  /// \param NativeFiles native objects to be linked instead of bitcode.
+  /// \return false if some of steps failed.
+  bool runThinLTO(const Paths &BitcodeFiles, Paths &NativeFiles);
+
+  /// Links objects of each top-level package directory into
+  /// relocatable object, or into shared library. Package product is
+  /// only relinked if some of its objects were changed.
+  /// \param ObjectFiles in: objects of project packages, out: package
+  /// products and objects of packages located in sources root.
+  /// \param Shared whether packages should be linked as shared libraries.
+  /// \return false if some of package links failed.
+  bool runPackageLinks(Paths &ObjectFiles, bool Shared);
+
+  void startStreaming();
+
+  /// Adds unit to streaming pipeline, once its .ldeps are ready.
+  void streamLDeps(StringID UnitID);
+
+  void streamPreambleReady(bool Successful);
+
+  /// Waits for all streamed jobs.
+  void finishStreaming();
+
   void collectSources();
 
+  void loadBuildHistory();
+  void saveBuildHistory();
+  void loadBuildState();
+  void saveBuildState();
+
+  /// Picks up nodes completed by interrupted build, and starts
+  /// journal of current build.
+  void loadBuildJournal();
+
+  /// Marks declarations updated by interrupted build as updated,
+  /// once graph is solved.
+  void restoreJournalNodes();
+
+  void journalProduct(
+      StringRef ProductFile,
+      bool Declaration,
+      bool Updated,
+      llvm::Optional<BuildState::FileStamp> SourceStamp
+  );
+
+  void loadDependenciesIndex();
+  void saveDependenciesIndex();
+  void findNameIndex();
+  void buildNameIndex();
+
+  /// Writes interface fingerprint of each library into its output
+  /// directory, so that library bumps which only touch bodies can
+  /// be told from ones consumers have to be rebuilt for.
+  void writeLibraryFingerprints();
+
+  void dumpTimeReport();
+  void dumpUnitTimeTraceReport();
+  void dumpUnusedImportsReport();
+
 private:
 
+  /// Demotes imports which are inferred private, see --private-imports.
+  void inferPrivateImports(ParsedDependencies &Deps);
+
+  /// Reads stats written next to given job output.
+  /// Stats paths are made absolute, so they match driver ones.
+  /// \return false if there are no stats.
+  bool loadDependencyStats(
+      StringRef Output,
+      std::vector<DependencyStats> &Stats
+  );
+
   void collectProjectSources();
+
+  /// Reads list of project sources, one path per line.
+  /// Paths are relative to sources root unless absolute.
+  /// Empty lines and lines starting with '#' are ignored.
+  bool readSourcesManifest(Paths &Dest);
   void collectLibrariesSources();
 
+  /// Fingerprints compiler binary, so that its updates
+  /// invalidate products built by it.
+  void initCompilerFingerprint();
+  void collectBundlesSources();
+
   void setOutputFilesInfo(
       FilesInfo& Info,
       StringRef OutputPathWithoutExt,
       bool SetObjectRelatedInfo
   );
 
+  void setObjectFilesInfo(FilesInfo& Info, StringRef OutputPathWithoutExt);
+
+  /// Whether object of unit is compiled as several partitions,
+  /// code generated in parallel, see --split-codegen. Unit stays
+  /// split once it was, otherwise its faster object job would
+  /// toggle it every other build.
+  bool isSplitCodeGen(StringID UnitPath) const;
+
+  /// Returns object partitions past the first one, which goes
+  /// to object itself.
+  Paths getCodeGenPartitions(const FilesInfo &Files) const;
+
+  /// Adds object of unit to linker inputs, along with its
+  /// partitions if unit is split.
+  void appendLinkObjects(StringID UnitPath, Paths &Objects) const;
+
+  /// Returns project units in order their objects are linked in.
+  /// It is topological order of dependencies graph, where units which
+  /// may go in any order are sorted by path, so that layout of linked
+  /// code is stable and units calling each other are kept close.
+  std::vector<StringID> getLinkOrder();
+
+  /// Finds symbol ordering file, or generates it of profile, unless
+  /// it is up-to-date, see --symbol-ordering.
+  /// \return false if ordering file couldn't be generated.
+  bool prepareSymbolOrdering();
+
+  /// Adds symbol ordering file to final link arguments, if any.
+  void addSymbolOrderingArgs(LevitationDriver::Args &LinkerArgs) const;
+
+  /// Classifies units by --hot-units, profile is turned into units
+  /// list in build root once, and then once it is updated.
+  /// \return false if file can't be read.
+  bool prepareHotUnits();
+
+  /// Writes units list made of profile, functions are matched
+  /// to units by objects of previous build.
+  bool writeHotUnits(StringRef ProfileFile, StringRef Output);
+
+  /// \return optimization level of definition object, see --hot-units,
+  /// or empty string, if level of extra codegen args is kept.
+  std::string getOptLevel(const DependenciesGraph::Node &N);
+
+  /// Whether class hierarchies of unit may be extended out of
+  /// linked program, that is, whether unit is part of public
+  /// interface, see --whole-program-vtables.
+  bool isLTOPublicUnit(const DependenciesGraph::Node &N) const;
+
+  /// Adds LTO visibility args of unit to declaration AST or
+  /// object job args, see --whole-program-vtables.
+  void addLTOVisibilityArgs(
+      LevitationDriver::Args &Args, bool LTOPublic
+  ) const;
+
+  /// Collects arguments for definition node.
+  /// \param FrontendArgs args for object build, or for IR build
+  /// in keep IR mode.
+  /// \param BackendArgs args for compiling IR into object,
+  /// only filled in keep IR mode.
+  void getDefinitionArgs(
+      const DependenciesGraph::Node &N,
+      LevitationDriver::Args &FrontendArgs,
+      LevitationDriver::Args &BackendArgs
+  );
+
+  /// In keep IR mode compiles definition IR into object,
+  /// unless object is up-to-date.
+  bool processIR(const DependenciesGraph::Node &N);
+
+  /// Switches objects phase to given configuration,
+  /// null means no configurations are used.
+  void selectConfig(const LevitationDriver::BuildConfig *Config);
+
+  /// \return objects extension prefix for current configuration
+  /// and profile mode, or empty string if neither is used.
+  std::string getObjectsVariant() const;
+
+  /// \return linker output for current configuration.
+  SinglePath getOutput() const;
+
+  /// \return given output path for current configuration.
+  SinglePath getConfigOutput(StringRef Output) const;
+
   // TODO Levitation: deprecated
   void addMainFileInfo();
 
@@ -136,31 +1238,441 @@ private:
   /// Dependency node processing
   /// \param N node to be processed
   /// \return true is successful
+  /// Prefetches files dependents of node need, since they
+  /// are likely to be run once node is done.
+  void prefetchDependents(const DependenciesGraph::Node &N);
+
   bool processDependencyNode(
       const DependenciesGraph::Node &N
   );
 
   bool processDefinition(const DependenciesGraph::Node &N);
 
+  typedef std::vector<const DependenciesGraph::Node*> NodesVectorTy;
+
+  /// Splits definitions into unity batches. Batch consists of
+  /// definitions of sibling units (units of same package directory)
+  /// with overlapping dependencies.
+  void getUnityBatches(
+      const NodesVectorTy &Definitions,
+      std::vector<NodesVectorTy> &Batches
+  );
+
+  /// Runs unity batches in parallel, definitions of each batch are
+  /// processed one by one within single in-process compiler batch, so that
+  /// common dependencies are loaded once.
+  /// \return true if successful.
+  bool runUnityBatches(const NodesVectorTy &Definitions);
+
+  /// \param AlreadyBuilt if true, declaration AST was built
+  /// by streaming pipeline, only post-processing is required.
   bool processDeclaration(
-      HashRef ExistingMeta,
+      const DeclASTMeta &OldMeta,
+      const DependenciesGraph::Node &N,
+      bool AlreadyBuilt = false
+  );
+
+  /// Runs decl-ast step for given unit.
+  /// \param FullDeps declaration ASTs of all direct and indirect
+  /// dependencies, topologically ordered.
+  /// \param Generated files decl-ast job should also generate.
+  /// \param GeneratedEmitted set if job was actually run and
+  /// generated them, that is, if step wasn't taken from cache.
+  /// \return extra args of decl-ast step.
+  /// \param HasDefinition whether unit also has definition, which
+  /// is diagnosed by object step, and is home of unit's inline code.
+  /// \param LTOPublic whether classes of unit keep public LTO
+  /// visibility, see isLTOPublicUnit.
+  LevitationDriver::Args getDeclASTArgs(bool HasDefinition, bool LTOPublic);
+
+  bool buildDeclAST(
+      StringRef UnitID,
+      const FilesInfo &Files,
+      const Paths &FullDeps,
+      const Paths &FullDepsMetas,
+      bool HasDefinition,
+      bool LTOPublic,
+      int Worker,
+      const GeneratedSources &Generated = GeneratedSources(),
+      bool *GeneratedEmitted = nullptr
+  );
+
+  bool isInterfaceUpdated(
+      const DeclASTMeta &OldMeta,
+      const DeclASTMeta &NewMeta,
       const DependenciesGraph::Node &N
   );
 
+  /// \param DepsUpdated whether preamble or some of dependencies
+  /// interfaces were updated.
+  bool isInterfaceUpdated(
+      const DeclASTMeta &OldMeta,
+      const DeclASTMeta &NewMeta,
+      bool DepsUpdated,
+      StringRef ItemDescr
+  );
+
+  // Streaming pipeline helpers, all "Locked" methods
+  // expect streaming state to be locked.
+
+  /// Checks whether unit may be built, and if so, adds it to ToRun.
+  void streamTryScheduleLocked(
+      StringID UnitID,
+      llvm::SmallVectorImpl<StringID> &ToRun
+  );
+
+  /// \return true if To is reachable from From by dependencies.
+  bool streamHasPathLocked(StringID From, StringID To);
+
+  void streamRun(llvm::ArrayRef<StringID> ToRun);
+
+  /// Streamed decl-ast job.
+  bool streamDeclaration(StringID UnitID);
+
   bool isUpToDate(DeclASTMeta &Meta, const DependenciesGraph::Node &N);
 
+  void recordChangedDecls(
+      DependenciesGraph::NodeID::Type NID,
+      const DeclASTMeta &OldMeta,
+      const DeclASTMeta &NewMeta
+  );
+
+  bool areUsedDeclsUnchanged(const DependenciesGraph::Node &N);
+
+  /// Checks legacy headers recorded in meta. Headers which have
+  /// same stamps compiler has seen are not read, others are rehashed,
+  /// so that touched, but not changed headers don't cause rebuild.
+  /// \param States set to stamps of checked headers.
+  /// \return false if some header was changed or removed.
+  bool areIncludesUnchanged(
+      const DeclASTMeta &Meta,
+      StringRef ItemDescr,
+      std::vector<BuildState::IncludeState> &States
+  );
+
+  /// Calculates fingerprint of compiler and flags of build step.
+  /// It is passed to compiler, which keeps it in product meta.
+  /// \param StepName step name, e.g. "decl-ast"
+  /// \param ExtraArgs extra arguments passed to compiler.
+  /// \param FullDeps dependencies of decl-ast step, with
+  ///   --private-imports they may change without any source change.
+  /// \return fingerprint, or empty string in dry run mode.
+  std::string getCommandHash(
+      StringRef StepName,
+      const LevitationDriver::Args &ExtraArgs,
+      const Paths &FullDeps = Paths()
+  );
+
+  /// \return command fingerprint of node's product, empty
+  /// for nodes without products.
+  std::string getCommandHash(const DependenciesGraph::Node &N);
+
+  /// \param Reason set to rebuild reason if item is not up-to-date,
+  ///   unless it is out of date just because build plan is recorded.
+  /// \param CommandHash expected command fingerprint of product,
+  ///   it is not checked if empty.
   bool isUpToDate(
     DeclASTMeta &Meta,
     StringRef ProductFile,
     StringRef MetaFile,
     StringRef SourceFile,
-    StringRef ItemDescr
+    StringRef ItemDescr,
+    RebuildReason::Kind *Reason = nullptr,
+    StringRef CommandHash = ""
+  );
+
+  /// Records why node is rebuilt, if --explain is set.
+  void explainRebuild(const DependenciesGraph::Node &N, RebuildReason &&R);
+
+  void dumpRebuildReasons();
+
+  /// Dumps driver counters, see --stats.
+  void dumpStats();
+
+  /// Writes graph with nodes costs, see --export-graph.
+  void exportGraph();
+
+  /// Writes metrics of current build and pushes them, see --metrics.
+  void writeMetrics();
+
+  /// Checks units against performance budgets, see --budgets.
+  void checkBudgets();
+
+  /// Writes object commands of project units, see --compile-commands.
+  void writeCompileCommands();
+
+  /// Runs clang-tidy over each project definition, see --tidy.
+  void runTidy();
+
+  /// Runs clang-tidy over definition unless its fixes are up-to-date.
+  bool processTidy(const DependenciesGraph::Node &N);
+  bool processCheck(const DependenciesGraph::Node &N);
+
+  /// Finds product and meta files for given node.
+  /// \return false if node has no product.
+  bool getProductFiles(
+      const DependenciesGraph::Node &N,
+      StringRef &ProductFile,
+      StringRef &MetaFile
+  ) const;
+
+  void setProductState(StringRef ProductFile, BuildState::ProductState S);
+
+  /// Takes lock of product and meta files, see --shared-build-root.
+  /// If other invocation was building them, they are re-read from disk.
+  /// \return true if other invocation was waited for.
+  bool lockProduct(
+      ArtifactLock &Lock,
+      StringRef ProductFile,
+      StringRef MetaFile
+  );
+
+  bool isChangedSource(StringRef SourceFile) const {
+    return Context.ChangedSources.size() &&
+           Context.ChangedSources.count(
+               Path::makeAbsolute<SinglePath>(SourceFile)
+           );
+  }
+
+  /// Records state of product which was just built.
+  /// \param SourceStamp source stamp taken before build was started,
+  /// so that source changes made during build are not missed.
+  void updateProductState(
+      StringRef ProductFile,
+      StringRef MetaFile,
+      llvm::Optional<BuildState::FileStamp> SourceStamp
   );
 
   void setPreambleUpdated();
   void setNodeUpdated(DependenciesGraph::NodeID::Type NID);
+
+  /// Records in build history that unit interface has changed.
+  void recordInterfaceChange(StringRef UnitPath);
   void setObjectsUpdated();
 
+  /// Runs build step and records its duration and peak memory
+  /// if it was successful. Jobs launched by step are admitted against
+  /// memory budget with peak memory recorded during previous builds.
+  /// \param Kind kind of build step
+  /// \param UnitPath path of unit the step is performed for
+  /// \param Fn step action, should return true if successful.
+  /// \return result of Fn.
+  template <typename FnTy>
+  bool runTimed(
+      BuildHistory::StepKind Kind,
+      StringRef UnitPath,
+      FnTy &&Fn
+  );
+
+  /// Counts failed step, and cancels the build once number
+  /// of failures reaches limit (see -k and -fail-fast).
+  void onStepFailed();
+
+  /// Runs build step through build cache. If all step artifacts
+  /// are found in cache, then step is skipped, otherwise
+  /// artifacts are put into cache after successful build.
+  /// \param Key cache key, if empty, cache is not used.
+  /// \param Artifacts files produced by step.
+  /// \param Fn step action, should return true if successful.
+  /// \return true if artifacts were fetched or Fn was successful.
+  template <typename FnTy>
+  bool runCached(
+      StringRef Key,
+      ArrayRef<BuildCache::Artifact> Artifacts,
+      FnTy &&Fn
+  );
+
+  /// Prints diagnostics job has serialized once it produced
+  /// given product, see --replay-diagnostics.
+  void replayDiagnostics(StringRef DiagnosticsFile);
+  void replayDiagnostics(const DependenciesGraph::Node &N);
+
+  /// Puts artifacts into build cache in background, see
+  /// ArtifactPublisher. Artifacts are copied, so caller
+  /// may release them right away.
+  void storeInCache(StringRef Key, ArrayRef<BuildCache::Artifact> Artifacts);
+
+  /// Waits until all artifacts are published, and fails
+  /// the build if some of them were not.
+  void waitForPublication();
+
+  /// Calculates cache key for build step.
+  /// \param StepName step name, e.g. "decl-ast"
+  /// \param SourceFile unit source file
+  /// \param DepsMetaFiles meta files of declaration ASTs step depends on.
+  /// \param ExtraArgs extra arguments passed to compiler.
+  /// \param UsesPreamble whether step output depends on preamble.
+  /// \return cache key, or empty string if cache should not be used.
+  std::string getCacheKey(
+      StringRef StepName,
+      StringRef SourceFile,
+      const Paths &DepsMetaFiles,
+      const LevitationDriver::Args &ExtraArgs,
+      bool UsesPreamble = true
+  );
+
+  /// Same as getCacheKey, but key is calculated even if cache
+  /// is disabled, so it may be recorded by build state.
+  /// \return step key, or empty string if some of inputs can't be hashed.
+  std::string getStepKey(
+      StringRef StepName,
+      StringRef SourceFile,
+      const Paths &DepsMetaFiles,
+      const LevitationDriver::Args &ExtraArgs,
+      bool UsesPreamble = true
+  );
+
+  /// Calculates library cache key for build step of library unit.
+  /// Unlike step key it doesn't depend on project roots, so that
+  /// projects which use same library share its artifacts.
+  /// \return cache key, or empty string if library cache should
+  /// not be used.
+  std::string getLibraryCacheKey(
+      StringRef StepName,
+      StringRef UnitID,
+      StringRef SourceFile,
+      const Paths &DepsMetaFiles,
+      const LevitationDriver::Args &ExtraArgs,
+      bool UsesPreamble = true
+  );
+
+  /// Returns part of dependency meta which goes into keys of
+  /// dependents. Library units are only rebuilt by declaration parser
+  /// once library is bumped, and their declaration ASTs change even
+  /// if only bodies did, so for them interface hash is used.
+  ArrayRef<uint8_t> getDependencyFingerprint(
+      const DeclASTMeta &DepMeta, StringRef MetaFile
+  ) const;
+
+  /// In reproducible mode returns path relative to sources root,
+  /// if it is within sources root. Otherwise returns path as is.
+  SinglePath getPortablePath(StringRef Path) const;
+
+  static BuildHistory::StepKind getStepKind(const DependenciesGraph::Node &N);
+
+  /// Collects definitions of targets, definitions of units targets
+  /// use, and their full dependencies, see -target.
+  /// \return false if some of targets is not found.
+  bool selectTargetNodes();
+
+  /// Finds definition nodes of targets.
+  /// \return false if some of targets is not found.
+  bool findTargets(SmallVectorImpl<DependenciesGraph::NodeID::Type> &Defs);
+
+  /// Collects nodes of focused units and their full dependencies,
+  /// see --focus.
+  void collectFocusedNodes(DependenciesGraph::NodesSet &Focused);
+
+  /// Adds definition, definitions of units it uses,
+  /// and their full dependencies into Closure.
+  void collectLinkClosure(
+      DependenciesGraph::NodeID::Type DefID,
+      DependenciesGraph::NodesSet &Closure
+  ) const;
+
+  /// Splits selected definitions between shards, and collects nodes
+  /// current shard has to process, see --shard.
+  void selectShardNodes();
+
+  /// Checks own inputs of all selected nodes in parallel, before
+  /// anything is scheduled, and collects dirty nodes, so that
+  /// scheduler only weighs nodes which may be rebuilt, and nodes
+  /// outside of dirty closure are not checked once again.
+  /// Dependencies are not taken into account by checks, thus
+  /// dirty set is conservative, early cutoff may still skip
+  /// some of its nodes.
+  void precheckNodes();
+
+  /// Whether node's own inputs are unchanged, that is same part of
+  /// isUpToDate which doesn't depend on other nodes.
+  /// \param LoadedMeta if provided, gets product meta,
+  ///        once product is found up-to-date.
+  bool areOwnInputsUpToDate(
+      const DependenciesGraph::Node &N,
+      DeclASTMeta *LoadedMeta = nullptr
+  );
+
+  /// Remembers unit as codeless, if its declaration meta tells so,
+  /// see --skip-empty-objects.
+  void noteCodeless(const DependenciesGraph::Node &N, const DeclASTMeta &Meta);
+
+  /// Whether definition emits no code, according to declaration
+  /// meta of its unit. Unit whose declaration is not checked yet
+  /// is supposed to emit code.
+  bool isCodelessDefinition(const DependenciesGraph::Node &N) const;
+
+  /// Removes objects codeless definition might have from previous builds.
+  bool skipCodelessDefinition(const DependenciesGraph::Node &N);
+
+  /// Whether node is known to be up-to-date before it is scheduled.
+  bool isPrecheckedClean(DependenciesGraph::NodeID::Type NID) const {
+    return Context.NodesPrechecked && !Context.DirtyNodes.count(NID);
+  }
+
+  /// Whether profile object is built with was updated after object.
+  bool isProfileUpdated(const DependenciesGraph::Node &N);
+
+  bool isSelected(DependenciesGraph::NodeID::Type NID) const {
+    return
+        (Context.Driver.Targets.empty() && !Context.Driver.NumShards) ||
+        Context.SelectedNodes.count(NID);
+  }
+
+  /// Returns straggler policy for node jobs. Jobs of critical nodes
+  /// are duplicated once they run longer than --speculate-after percent
+  /// of duration recorded in previous build, or, for new units,
+  /// of 95th percentile of same steps.
+  StepSpeculation getSpeculation(const DependenciesGraph::Node &N) const;
+
+  /// Returns whether node jobs run with lower priority. Objects
+  /// nothing critical waits for are built in background, so that
+  /// host stays responsive, see --job-priorities.
+  bool isLowPriority(const DependenciesGraph::Node &N) const {
+    return
+        Context.Driver.JobPriorities &&
+        N.Kind == DependenciesGraph::NodeKind::Definition &&
+        !Context.CriticalNodes.count(N.ID);
+  }
+
+  /// Returns worker node is assigned to, or -1 if nodes
+  /// are not split between workers.
+  int getWorker(DependenciesGraph::NodeID::Type NID) const {
+    auto Found = Context.Workers.find(NID);
+    return Found != Context.Workers.end() ? (int)Found->second : -1;
+  }
+
+  /// Remembers domain of current worker as domain of node products.
+  void recordNodeDomain(const DependenciesGraph::Node &N);
+
+  /// Returns domain most of node full dependencies were produced
+  /// on, or -1 if they were not produced by this build.
+  int getPreferredDomain(const DependenciesGraph::Node &N);
+
+  /// Returns node processing duration as it was recorded during
+  /// previous builds, or average duration of same steps if node is new.
+  BuildHistory::DurationTy getExpectedDuration(
+      const DependenciesGraph::Node &N
+  ) const;
+
+  /// Starts progress of selected dirty nodes, see BuildProgress.
+  /// \return true if progress is shown or written anywhere.
+  bool startProgress();
+
+  /// Reports node job start or finish, prechecked clean
+  /// nodes are not reported.
+  void reportProgress(
+      const DependenciesGraph::Node &N,
+      BuildProgress::EventKind Kind
+  );
+
+  /// Returns step peak memory as it was recorded during previous builds,
+  /// or average peak memory of same steps if unit is new.
+  /// \return expected peak memory in bytes, or 0 if nothing is known.
+  BuildHistory::MemoryTy getExpectedMemory(
+      BuildHistory::StepKind Kind,
+      StringRef UnitPath
+  ) const;
+
   const FilesInfo& getFilesInfoFor(
       const DependenciesGraph::Node &N
   ) const;
@@ -170,6 +1682,11 @@ private:
       const DependenciesGraph &Graph
   ) const;
 
+  Paths getFullDependenciesMetas(
+      const DependenciesGraph::Node &N,
+      const DependenciesGraph &Graph
+  ) const;
+
   Paths getIncludeSources(
       const DependenciesGraph::Node &N,
       const DependenciesGraph &Graph
@@ -369,6 +1886,21 @@ public:
     return Args;
   }
 
+  /// Writes arguments into response file, each argument is quoted,
+  /// the same way clang driver writes its response files.
+  template <typename ValuesT>
+  static void writeResponseFile(llvm::raw_ostream &Out, const ValuesT &Args) {
+    for (const auto &A : Args) {
+      Out << '"';
+      for (char C : A) {
+        if (C == '"' || C == '\\')
+          Out << '\\';
+        Out << C;
+      }
+      Out << "\"\n";
+    }
+  }
+
   static void dump(
       llvm::raw_ostream& Out,
       const LevitationDriver::Args &Args
@@ -384,6 +1916,23 @@ public:
   }
 };
 
+/// \return pool jobs of given trace category are limited by, see -pool.
+static StringRef getPoolOf(StringRef Category) {
+  return llvm::StringSwitch<StringRef>(Category)
+      .Cases("parse-import", "parse-header", "parse")
+      .Case("decl-ast", "decl")
+      .Cases("object", "backend", "thinlto-backend", "obj")
+      .Cases("link", "link-shared", "partial-link", "thin-link", "link")
+      .Default(Category);
+}
+
+static bool isKnownPool(StringRef Name) {
+  return llvm::StringSwitch<bool>(Name)
+      .Cases("parse", "decl", "preamble", "obj", "link", true)
+      .Cases("check", "tidy", "test", true)
+      .Default(false);
+}
+
 /*static*/
 class Commands {
 public:
@@ -397,6 +1946,37 @@ public:
     bool Condition = true;
     bool Verbose;
     bool DryRun;
+    LevitationDriver::ExecutionMode Execution =
+        LevitationDriver::ExecutionMode::Subprocess;
+
+    // Phase and unit, reported to build trace.
+    StringRef TraceCategory = "command";
+    StringRef TraceUnit;
+
+    // External program job is delegated to, if any.
+    StringRef Executor;
+
+    // Worker hint for executor, negative if job is not assigned.
+    int Worker = -1;
+
+    // Files job reads and writes, listed for executor.
+    SmallVector<StringRef, 16> Inputs;
+    SmallVector<StringRef, 2> Outputs;
+
+    // Response file arguments are passed through when command line
+    // is long, only used for subprocesses.
+    SinglePath ResponseFile;
+
+    // Frontend time trace output, empty if job is not traced.
+    SinglePath TimeTraceFile;
+
+    // Serialized diagnostics output, see --replay-diagnostics.
+    SinglePath DiagnosticsFile;
+
+    /// Length of arguments starting from which response file is used.
+    /// Long command lines slow down process spawn even if they
+    /// fit system limits.
+    static const size_t RESPONSE_FILE_MIN_LENGTH = 16 * 1024;
 
     CommandInfo(
         SinglePath &&executablePath,
@@ -432,14 +2012,44 @@ public:
       auto Cmd = getClangXXCommand(BinDir, Includes, StdLib, verbose, dryRun);
 
       Cmd
-      .addArg("-cppl-preamble");
+      .addArg("-cppl-preamble")
+      .addHashArg("-cppl-hash");
+
+      return Cmd;
+    }
+
+    static CommandInfo getBuildHeadersPCH(
+        StringRef BinDir,
+        const SmallVectorImpl<SinglePath> &Includes,
+        StringRef StdLib,
+        bool verbose,
+        bool dryRun
+    ) {
+      auto Cmd = getClangXXCommand(BinDir, Includes, StdLib, verbose, dryRun);
+      Cmd.addArg("-xc++-header");
+      return Cmd;
+    }
+
+    static CommandInfo getParseOnly(
+        StringRef BinDir,
+        const SmallVectorImpl<SinglePath> &Includes,
+        StringRef StdLib,
+        bool verbose,
+        bool dryRun
+    ) {
+      auto Cmd = getClangXXCommand(BinDir, Includes, StdLib, verbose, dryRun);
+
+      Cmd
+      .addArg("-fsyntax-only")
+      .addArg("-xc++");
 
       return Cmd;
     }
 
+    /// Parse-import doesn't include preamble, it only collects
+    /// directives, so it may run before preamble is built.
     static CommandInfo getParseImport(
         StringRef BinDir,
-        StringRef PrecompiledPreamble,
         bool verbose,
         bool dryRun
     ) {
@@ -448,11 +2058,28 @@ public:
           BinDir, "", verbose, dryRun
       );
 
-      Cmd.addArg("-cppl-import");
+      Cmd
+      .addArg("-cppl-import")
+      .addHashArg("-cppl-hash");
 
-      if (PrecompiledPreamble.size())
-        Cmd.addKVArgEq("-cppl-include-preamble", PrecompiledPreamble);
+      return Cmd;
+    }
 
+    /// Parse import of several sources by one frontend invocation.
+    /// Clang driver creates job for each input, so it is bypassed.
+    static CommandInfo getParseImportBatch(
+        StringRef BinDir,
+        bool verbose,
+        bool dryRun
+    ) {
+      CommandInfo Cmd(getClangPath(BinDir), verbose, dryRun);
+      Cmd
+      .addArg("-cc1")
+      .addArg("-levitation-parse-import")
+      .addArg("-std=c++17")
+      .addKVArgSpace("-x", "c++")
+      .addHashArg("-levitation-hash")
+      .addVFSOverlayArg();
       return Cmd;
     }
 
@@ -466,9 +2093,13 @@ public:
     ) {
       auto Cmd = getClangXXCommand(BinDir, Includes, StdLib, verbose, dryRun);
 
+      // Preamble and dependencies are checked by driver's
+      // up-to-date checks, no need to do it in every job.
       Cmd
       .addArg("-xc++")
-      .addArg("-cppl-decl");
+      .addArg("-cppl-decl")
+      .addArg("-cppl-trust-deps")
+      .addHashArg("-cppl-hash");
       return Cmd;
     }
 
@@ -482,13 +2113,71 @@ public:
     ) {
       auto Cmd = getClangXXCommand(BinDir, Includes, StdLib, verbose, dryRun);
       Cmd
-      .addArg("-cppl-obj");
+      .addArg("-cppl-obj")
+      .addArg("-cppl-trust-deps")
+      .addHashArg("-cppl-hash");
+      return Cmd;
+    }
+
+    /// Everything after "--" goes to clang driver, as for object build.
+    static CommandInfo getTidy(
+        StringRef BinDir,
+        StringRef Checks,
+        StringRef OutFixesFile,
+        StringRef Source,
+        bool verbose,
+        bool dryRun
+    ) {
+      CommandInfo Cmd(getClangTidyPath(BinDir), verbose, dryRun);
+      Cmd
+      .addArg("-quiet")
+      .addKVArgEqIfNotEmpty("-checks", Checks)
+      .addKVArgEq("-export-fixes", OutFixesFile)
+      .addArg(Source)
+      .addArg("--")
+      .addArg("-std=c++17")
+      .addArg("-cppl-obj")
+      .addArg("-cppl-trust-deps");
+      return Cmd;
+    }
+
+    static CommandInfo getCompileIR(
+        StringRef BinDir,
+        bool verbose,
+        bool dryRun
+    ) {
+      CommandInfo Cmd(getClangXXPath(BinDir), verbose, dryRun);
+      Cmd
+      .addArg("-c")
+      .addArg("-xir");
       return Cmd;
     }
 
+    static CommandInfo getDwp(
+        StringRef BinDir,
+        bool verbose,
+        bool dryRun
+    ) {
+      return CommandInfo(getDwpPath(BinDir), verbose, dryRun);
+    }
+
+    static CommandInfo getMetricsPush(
+        StringRef Program,
+        bool verbose,
+        bool dryRun
+    ) {
+      return CommandInfo(SinglePath(Program), verbose, dryRun);
+    }
+
+    /// \param Linker linker name for -fuse-ld, if empty, default
+    /// linker of clang driver is used.
+    /// \param LinkerThreads number of lld threads, 0 means
+    /// all hardware threads.
     static CommandInfo getLink(
         StringRef BinDir,
         StringRef StdLib,
+        StringRef Linker,
+        int LinkerThreads,
         bool verbose,
         bool dryRun,
         bool CanUseLibStdCpp
@@ -498,6 +2187,12 @@ public:
       if (CanUseLibStdCpp)
         Cmd.addKVArgEqIfNotEmpty("-stdlib", StdLib);
 
+      Cmd
+      .addKVArgEqIfNotEmpty("-fuse-ld", Linker)
+      .condition(Linker == "lld" && LinkerThreads > 0)
+          .addKVArgEq("-Wl,--threads", std::to_string(LinkerThreads))
+      .conditionEnd();
+
 #ifdef LEVITATION_DEFAULT_LINKER_VERSION
       Cmd.addKVArgEqIfNotEmpty("-mlinker-version", LEVITATION_DEFAULT_LINKER_VERSION);
 #endif
@@ -525,6 +2220,36 @@ public:
       return *this;
     }
 
+    /// Passes meta hash algorithm, unless it is default one,
+    /// so that commands are same as before for MD5 builds.
+    CommandInfo& addHashArg(StringRef Arg) {
+      if (metaHash() != HashKind::MD5)
+        addKVArgEq(Arg, getHashKindName(metaHash()));
+      return *this;
+    }
+
+    /// Passes source hash, so that frontend doesn't hash source again.
+    CommandInfo& addSourceDigestArg(StringRef Arg, StringRef Source) {
+      if (!Condition || DryRun) return *this;
+      return addKVArgEqIfNotEmpty(
+          Arg, SourceDigests::get().getDigestArg(Source)
+      );
+    }
+
+    /// Overlay of unsaved files for compiler jobs, empty if there
+    /// are no unsaved files, see LevitationDriverSession.
+    static SinglePath &vfsOverlay() {
+      static SinglePath Overlay;
+      return Overlay;
+    }
+
+    /// Passes overlay of unsaved files, if any, so that jobs
+    /// see same sources driver does.
+    CommandInfo& addVFSOverlayArg() {
+      if (!Condition || vfsOverlay().empty()) return *this;
+      return addKVArgSpace("-ivfsoverlay", vfsOverlay());
+    }
+
     CommandInfo& addKVArgEqIfNotEmpty(StringRef Arg, StringRef Value) {
       if (!Condition) return *this;
       if (Value.size())
@@ -596,29 +2321,294 @@ public:
       return *this;
     }
 
+    /// Sets the way command should be executed.
+    /// Modes other than Subprocess are only applicable for clang++ commands.
+    CommandInfo& executionMode(LevitationDriver::ExecutionMode Mode) {
+      Execution = Mode;
+      return *this;
+    }
+
+    /// Delegates command to external program, which is called as
+    /// '<program> <trace category> <command...>', so that job may be
+    /// run on remote worker. Takes precedence over execution mode.
+    CommandInfo& executor(StringRef Program) {
+      Executor = Program;
+      return *this;
+    }
+
+    /// Sets worker executor should run job on, see
+    /// writeExecutorManifests.
+    CommandInfo& worker(int W) {
+      Worker = W;
+      return *this;
+    }
+
+    /// Adds file job reads. Inputs and outputs are only reported to
+    /// executor, see writeExecutorManifests.
+    CommandInfo& addInput(StringRef File) {
+      if (!Condition) return *this;
+      if (File.size())
+        Inputs.push_back(File);
+      return *this;
+    }
+
+    template <typename ValuesT>
+    CommandInfo& addInputs(const ValuesT& Files) {
+      for (const auto &File : Files)
+        addInput(File);
+      return *this;
+    }
+
+    CommandInfo& addOutput(StringRef File) {
+      if (!Condition) return *this;
+      if (File.size())
+        Outputs.push_back(File);
+      return *this;
+    }
+
+    template <typename ValuesT>
+    CommandInfo& addOutputs(const ValuesT& Files) {
+      for (const auto &File : Files)
+        addOutput(File);
+      return *this;
+    }
+
+    /// Sets file long arguments list should be passed through.
+    /// File is only rewritten if arguments were changed, so
+    /// same set of dependencies keeps same file.
+    CommandInfo& responseFile(StringRef File) {
+      ResponseFile = File;
+      return *this;
+    }
+
+    CommandInfo& traceAs(StringRef Category, StringRef Unit) {
+      TraceCategory = Category;
+      TraceUnit = Unit;
+      return *this;
+    }
+
+    /// Runs frontend with -ftime-trace, if --unit-time-trace
+    /// is set, trace is named after given output file.
+    CommandInfo& timeTrace(StringRef OutputFile) {
+      if (
+        !Condition || DryRun ||
+        !TimeTraceReport::get().isEnabled() ||
+        NinjaPlan::get().isRecording()
+      )
+        return *this;
+
+      TimeTraceFile = OutputFile;
+      TimeTraceFile += ".";
+      TimeTraceFile += FileExtensions::TimeTrace;
+
+      addArg("-ftime-trace");
+      addKVArgEq("-cppl-time-trace-out", TimeTraceFile);
+      addOutput(TimeTraceFile);
+      return *this;
+    }
+
+    /// Makes frontend write dependencies deserialization stats
+    /// next to given output file, if --dependency-stats is set.
+    CommandInfo& dependencyStats(StringRef OutputFile) {
+      if (!Condition || DryRun || !dependencyStatsEnabled())
+        return *this;
+
+      auto StatsFile = (
+          OutputFile + "." + FileExtensions::DependencyStats
+      ).str();
+
+      addKVArgEq("-cppl-stats-out", StatsFile);
+      addOutput(StatsFile);
+      return *this;
+    }
+
+    /// Makes frontend serialize diagnostics next to given output file,
+    /// if --replay-diagnostics is set.
+    CommandInfo& serializeDiagnostics(StringRef OutputFile) {
+      if (
+        !Condition || DryRun ||
+        !diagnosticsReplayEnabled() ||
+        NinjaPlan::get().isRecording()
+      )
+        return *this;
+
+      DiagnosticsFile = getDiagnosticsFile(OutputFile);
+      addKVArgSpace("--serialize-diagnostics", DiagnosticsFile);
+      addOutput(DiagnosticsFile);
+      return *this;
+    }
+
     Failable execute() {
+      auto &Plan = NinjaPlan::get();
+      if (Plan.isRecording()) {
+        if (Verbose)
+          dumpCommand();
+
+        auto Args = ArgsUtils::toStringRefArgs(CommandArgs);
+        Plan.add(
+            TraceCategory, Args, Inputs, Outputs,
+            useResponseFile(Args) ? StringRef(ResponseFile) : StringRef()
+        );
+        return Failable();
+      }
+
+      auto &Database = CompileCommands::get();
+      if (Database.isRecording()) {
+        Database.add(
+            ArgsUtils::toStringRefArgs(CommandArgs),
+            Inputs.size() ? StringRef(Inputs.front()) : StringRef(),
+            Outputs.size() ? StringRef(Outputs.front()) : StringRef()
+        );
+        return Failable();
+      }
+
       if (DryRun || Verbose) {
         dumpCommand();
       }
 
       if (!DryRun) {
-        std::string ErrorMessage;
+        // Inputs taken from build cache by key only are fetched once
+        // job actually reads them, see --lazy-cache-fetch. It is done
+        // before resources are acquired, so it doesn't hold a job slot.
+        if (!BuildCache::get().materialize(Inputs)) {
+          Failable Status;
+          Status.setFailure()
+          << "Failed to fetch inputs of job from build cache.";
+          return Status;
+        }
+
+        // Outputs may be changed even if command has failed.
+        auto OutputsScope = llvm::make_scope_exit([&] {
+          for (auto O : Outputs)
+            File::notifyChanged(O);
+        });
+
+        auto &TM = TasksManager::get();
+        auto ExpectedMemory = CurrentStepMemory.Expected;
+        TM.acquireMemory(ExpectedMemory);
+        auto MemoryScope = llvm::make_scope_exit([&] {
+          TM.releaseMemory(ExpectedMemory);
+        });
+
+        StringRef Pool = getPoolOf(TraceCategory);
+        TM.acquireJob(Pool);
+        auto JobScope = llvm::make_scope_exit([&] {
+          TM.releaseJob(Pool);
+        });
+
+        // Slot is acquired after memory, so that we don't keep
+        // slots other make jobs could use while waiting for memory.
+        auto JobSlot = Jobserver::get().acquire();
+
+        // Build was cancelled while we were waiting for resources.
+        if (TM.isCancelled()) {
+          Failable Status;
+          Status.setFailure() << "Cancelled.";
+          return Status;
+        }
+
+        auto Span = BuildTrace::get().span(
+            TraceUnit.size() ? TraceUnit : llvm::sys::path::filename(ExecutablePath),
+            TraceCategory,
+            TraceUnit
+        );
+
+        // Trace is read once build is done, whatever job result is.
+        if (TimeTraceFile.size())
+          TimeTraceReport::get().addJob({
+              TraceUnit.str(), TraceCategory.str(), TimeTraceFile.str().str(),
+              BuildTrace::get().elapsed(), BuildTrace::getCurrentThreadID()
+          });
 
         auto Args = ArgsUtils::toStringRefArgs(CommandArgs);
 
         unsigned ExecJobID = getExecID();
+
+        if (Executor.size()) {
+          Log.log_trace("Trying to execute delegated job ID=", ExecJobID);
+
+          if (!writeExecutorManifests()) {
+            Failable Status;
+            Status.setFailure()
+            << "Failed to write inputs of job for executor '" << Executor << "'.";
+            return Status;
+          }
+
+          SmallVector<StringRef, 32> ExecutorArgs = { Executor, TraceCategory };
+          ExecutorArgs.append(Args.begin(), Args.end());
+
+          // Executor memory is not the job memory, so peak is ignored.
+          std::string ErrorMessage;
+          BuildHistory::MemoryTy ExecutorMemory;
+          int Res;
+
+          auto Speculation = CurrentStepSpeculation;
+          if (Speculation.After)
+            Res = executeSpeculatively(
+                Executor, ExecutorArgs, Speculation.After,
+                [&] {
+                  Log.log_verbose(
+                      "Job ID=", ExecJobID, " is running too long, ",
+                      "launching its duplicate."
+                  );
+                  // Worker manifest is rewritten for duplicate only,
+                  // original executor has read it already.
+                  if (Worker >= 0 && Speculation.Worker >= 0)
+                    writeWorkerManifest(Speculation.Worker);
+                },
+                ErrorMessage
+            );
+          else
+            Res = executeAndWait(
+                Executor, ExecutorArgs, ErrorMessage, ExecutorMemory
+            );
+
+          Failable Status;
+          if (Res != 0)
+            Status.setFailure()
+            << "Executor '" << Executor << "' failed. " << ErrorMessage;
+
+          Log.log_trace("Result for delegated job ID=", ExecJobID, " is ", Res);
+          return Status;
+        }
+
+        if (Execution != LevitationDriver::ExecutionMode::Subprocess) {
+          Log.log_trace("Trying to execute in-process job ID=", ExecJobID);
+
+          Failable Status =
+              Execution == LevitationDriver::ExecutionMode::CompileServer ?
+              CompileServersPool::get().run(Args) :
+              InProcessCompiler::run(Args);
+
+          Log.log_trace(
+              "Result for in-process job ID=", ExecJobID,
+              " is ", (Status.isValid() ? "success" : "failure")
+          );
+          return Status;
+        }
+
+        std::string ErrorMessage;
+
         Log.log_trace("Trying to execute exec job ID=", ExecJobID);
 
-        int Res = llvm::sys::ExecuteAndWait(
-            ExecutablePath,
-            Args,
-            /*Env*/llvm::None,
-            /*Redirects*/{},
-            /*secondsToWait*/ 0,
-            /*memoryLimit*/ 0,
-            &ErrorMessage,
-            /*ExectutionFailed*/nullptr
-        );
+        std::string ResponseFileArg;
+        if (useResponseFile(Args)) {
+          if (!writeResponseFile(Args)) {
+            Failable Status;
+            Status.setFailure()
+            << "Failed to write response file '" << ResponseFile << "'.";
+            return Status;
+          }
+
+          ResponseFileArg = ("@" + ResponseFile).str();
+          Args.resize(1);
+          Args.push_back(ResponseFileArg);
+        }
+
+        BuildHistory::MemoryTy PeakMemory;
+        int Res = executeAndWait(ExecutablePath, Args, ErrorMessage, PeakMemory);
+
+        CurrentStepMemory.Peak = std::max(CurrentStepMemory.Peak, PeakMemory);
 
         Failable Status;
 
@@ -637,30 +2627,364 @@ public:
     }
   protected:
 
-    static SinglePath getClangPath(llvm::StringRef BinDir) {
-
-      const char *ClangBin = "clang";
+    /// Lists job inputs and outputs, one path per line, in
+    /// <first output>.inputs and <first output>.outputs, so that
+    /// executor knows what to upload and what to fetch back without
+    /// parsing command. Assigned worker, if any, is written
+    /// into <first output>.worker.
+    bool writeExecutorManifests() const {
+      if (Outputs.empty())
+        return true;
+
+      std::pair<StringRef, ArrayRef<StringRef>> Manifests[] = {
+          { "inputs", Inputs },
+          { "outputs", Outputs }
+      };
+
+      for (const auto &M : Manifests) {
+        SinglePath ManifestFile = Outputs.front();
+        ManifestFile += ".";
+        ManifestFile += M.first;
+
+        levitation::Path::createDirsForFile(ManifestFile);
+
+        levitation::File F(ManifestFile);
+        if (auto OpenedFile = F.open()) {
+          auto &Out = OpenedFile.getOutputStream();
+          for (auto File : M.second)
+            Out << File << "\n";
+        }
 
-      if (BinDir.size()) {
-        SinglePath P = BinDir;
-        llvm::sys::path::append(P, ClangBin);
-        return P;
+        if (F.hasErrors())
+          return false;
       }
 
-      return SinglePath(ClangBin);
+      return Worker < 0 || writeWorkerManifest(Worker);
     }
 
-    static SinglePath getClangXXPath(llvm::StringRef BinDir) {
+    bool writeWorkerManifest(int W) const {
+      SinglePath WorkerFile = Outputs.front();
+      WorkerFile += ".worker";
 
-      const char *ClangBin = "clang++";
+      levitation::File F(WorkerFile);
+      if (auto OpenedFile = F.open())
+        OpenedFile.getOutputStream() << W << "\n";
 
-      if (BinDir.size()) {
-        SinglePath P = BinDir;
-        llvm::sys::path::append(P, ClangBin);
-        return P;
-      }
+      return !F.hasErrors();
+    }
 
-      return SinglePath(ClangBin);
+    /// Same as llvm::sys::ExecuteAndWait, but also obtains peak
+    /// resident set size of child process, where host supports it.
+    /// Process is registered in RunningSubprocesses while it runs.
+    /// \param PeakMemory set to peak RSS in bytes, or to 0 if unknown.
+    /// \return same value ExecuteAndWait would return.
+    bool useResponseFile(ArrayRef<StringRef> Args) const {
+      if (ResponseFile.empty())
+        return false;
+
+      size_t Length = 0;
+      for (auto A : Args)
+        Length += A.size() + 1;
+
+      return
+          Length >= RESPONSE_FILE_MIN_LENGTH ||
+          !llvm::sys::commandLineFitsWithinSystemLimits(ExecutablePath, Args);
+    }
+
+    /// Writes arguments except program itself.
+    bool writeResponseFile(ArrayRef<StringRef> Args) const {
+      File F(ResponseFile, /*KeepIfUnchanged=*/true);
+      with (auto Scope = F.open())
+        ArgsUtils::writeResponseFile(Scope.getOutputStream(), Args.drop_front());
+      return !F.hasErrors();
+    }
+
+    static int executeAndWait(
+        StringRef Program,
+        ArrayRef<StringRef> Args,
+        std::string &ErrorMessage,
+        BuildHistory::MemoryTy &PeakMemory
+    ) {
+      PeakMemory = 0;
+      ++DriverStats::get().ProcessesSpawned;
+
+      // Reaper waits for all children at once, so waiting job
+      // only blocks on its completion.
+      auto &Reaper = ProcessReaper::get();
+      if (Reaper.isEnabled()) {
+        auto &Running = RunningSubprocesses::get();
+        uint64_t Peak;
+        int Res = Reaper.execute(
+            Program, Args, ErrorMessage, Peak,
+            [&] (int Pid) {
+              Running.add(Pid);
+              if (CurrentStepLowPriority)
+                lowerPriority(Pid);
+            },
+            [&] (int Pid) { Running.remove(Pid); }
+        );
+        PeakMemory = (BuildHistory::MemoryTy)Peak;
+        return Res;
+      }
+
+#ifdef LLVM_ON_UNIX
+      bool ExecutionFailed = false;
+      auto PI = llvm::sys::ExecuteNoWait(
+          Program, Args, /*Env*/llvm::None, /*Redirects*/{},
+          /*memoryLimit*/0, &ErrorMessage, &ExecutionFailed
+      );
+      if (ExecutionFailed)
+        return -1;
+
+      auto &Running = RunningSubprocesses::get();
+      Running.add(PI.Pid);
+
+      // Child has started with our priority, so it runs a bit
+      // at normal priority, which is fine.
+      if (CurrentStepLowPriority)
+        lowerPriority(PI.Pid);
+
+      // Wait for exit without reaping, so that process is unregistered
+      // while its PID is still reserved.
+      siginfo_t Info;
+      while (waitid(P_PID, PI.Pid, &Info, WEXITED | WNOWAIT) < 0 &&
+             errno == EINTR);
+
+      Running.remove(PI.Pid);
+
+      // Unlike getrusage(RUSAGE_CHILDREN), which reports maximum
+      // over all children, wait4 reports usage of particular child.
+      int WaitStatus;
+      struct rusage Usage;
+      pid_t Res;
+      do {
+        Res = wait4(PI.Pid, &WaitStatus, 0, &Usage);
+      } while (Res < 0 && errno == EINTR);
+
+      if (Res < 0) {
+        ErrorMessage = "Error waiting for child process";
+        return -1;
+      }
+
+      // Linux reports ru_maxrss in kilobytes, and Darwin in bytes.
+#ifdef __APPLE__
+      PeakMemory = (BuildHistory::MemoryTy)Usage.ru_maxrss;
+#else
+      PeakMemory = (BuildHistory::MemoryTy)Usage.ru_maxrss * 1024;
+#endif
+
+      if (WIFEXITED(WaitStatus)) {
+        int Code = WEXITSTATUS(WaitStatus);
+        if (Code == 127)
+          ErrorMessage = "Program could not be executed";
+        return Code;
+      }
+
+      ErrorMessage = "Program crashed";
+      return -2;
+#else
+      return llvm::sys::ExecuteAndWait(
+          Program,
+          Args,
+          /*Env*/llvm::None,
+          /*Redirects*/{},
+          /*secondsToWait*/ 0,
+          /*memoryLimit*/ 0,
+          &ErrorMessage,
+          /*ExectutionFailed*/nullptr
+      );
+#endif
+    }
+
+    /// Same as executeAndWait, but once program runs longer than
+    /// SpeculateAfter microseconds, launches its duplicate and takes
+    /// result of whichever copy succeeds first, other copy is killed.
+    /// Failed copy doesn't stop the one which is still running, since
+    /// its failure may be caused by its host.
+    /// \param OnDuplicate called before duplicate is launched.
+    /// \return exit code of successful copy, or of first copy
+    ///         if both have failed.
+    static int executeSpeculatively(
+        StringRef Program,
+        ArrayRef<StringRef> Args,
+        BuildHistory::DurationTy SpeculateAfter,
+        llvm::function_ref<void()> OnDuplicate,
+        std::string &ErrorMessage
+    ) {
+#ifdef LLVM_ON_UNIX
+      struct Copy {
+        pid_t Pid = 0;
+        bool Done = false;
+        int Code = -1;
+        std::string ErrorMessage;
+      };
+
+      auto &Running = RunningSubprocesses::get();
+      SmallVector<Copy, 2> Copies;
+
+      auto launch = [&] {
+        ++DriverStats::get().ProcessesSpawned;
+        Copies.emplace_back();
+        auto &C = Copies.back();
+
+        bool ExecutionFailed = false;
+        auto PI = llvm::sys::ExecuteNoWait(
+            Program, Args, /*Env*/llvm::None, /*Redirects*/{},
+            /*memoryLimit*/0, &C.ErrorMessage, &ExecutionFailed
+        );
+
+        if (ExecutionFailed) {
+          C.Done = true;
+          return;
+        }
+
+        C.Pid = PI.Pid;
+        Running.add(C.Pid);
+
+        if (CurrentStepLowPriority)
+          lowerPriority(C.Pid);
+      };
+
+      // Same as in executeAndWait, process is unregistered
+      // before it is reaped.
+      auto reap = [&] (Copy &C, bool Block) {
+        siginfo_t Info;
+        Info.si_pid = 0;
+        int Options = WEXITED | WNOWAIT | (Block ? 0 : WNOHANG);
+
+        int Res;
+        do {
+          Res = waitid(P_PID, C.Pid, &Info, Options);
+        } while (Res < 0 && errno == EINTR);
+
+        if (Res == 0 && Info.si_pid == 0)
+          return;
+
+        Running.remove(C.Pid);
+        C.Done = true;
+
+        int WaitStatus;
+        pid_t Waited;
+        do {
+          Waited = waitpid(C.Pid, &WaitStatus, 0);
+        } while (Waited < 0 && errno == EINTR);
+
+        if (Res < 0 || Waited < 0) {
+          C.ErrorMessage = "Error waiting for child process";
+          return;
+        }
+
+        if (WIFEXITED(WaitStatus)) {
+          C.Code = WEXITSTATUS(WaitStatus);
+          if (C.Code == 127)
+            C.ErrorMessage = "Program could not be executed";
+          return;
+        }
+
+        C.Code = -2;
+        C.ErrorMessage = "Program crashed";
+      };
+
+      auto finish = [&] (Copy &Result) {
+        for (auto &C : Copies)
+          if (!C.Done) {
+            kill(C.Pid, SIGTERM);
+            reap(C, /*Block=*/true);
+          }
+        ErrorMessage = Result.ErrorMessage;
+        return Result.Code;
+      };
+
+      static const std::chrono::milliseconds PollInterval(20);
+
+      auto Start = std::chrono::steady_clock::now();
+      launch();
+
+      while (true) {
+        for (auto &C : Copies)
+          if (!C.Done)
+            reap(C, /*Block=*/false);
+
+        for (auto &C : Copies)
+          if (C.Done && C.Code == 0)
+            return finish(C);
+
+        bool AllDone = llvm::all_of(Copies, [] (const Copy &C) {
+          return C.Done;
+        });
+
+        // Original has failed, or both copies have failed.
+        if (AllDone)
+          return finish(Copies.front());
+
+        auto Elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - Start
+        ).count();
+
+        if (Copies.size() == 1 && (uint64_t)Elapsed >= SpeculateAfter) {
+          OnDuplicate();
+          launch();
+          continue;
+        }
+
+        std::this_thread::sleep_for(PollInterval);
+      }
+#else
+      BuildHistory::MemoryTy PeakMemory;
+      return executeAndWait(Program, Args, ErrorMessage, PeakMemory);
+#endif
+    }
+
+    static SinglePath getClangPath(llvm::StringRef BinDir) {
+
+      const char *ClangBin = "clang";
+
+      if (BinDir.size()) {
+        SinglePath P = BinDir;
+        llvm::sys::path::append(P, ClangBin);
+        return P;
+      }
+
+      return SinglePath(ClangBin);
+    }
+
+    static SinglePath getClangTidyPath(llvm::StringRef BinDir) {
+
+      const char *ClangTidyBin = "clang-tidy";
+
+      if (BinDir.size()) {
+        SinglePath P = BinDir;
+        llvm::sys::path::append(P, ClangTidyBin);
+        return P;
+      }
+
+      return SinglePath(ClangTidyBin);
+    }
+
+    static SinglePath getDwpPath(llvm::StringRef BinDir) {
+
+      const char *DwpBin = "llvm-dwp";
+
+      if (BinDir.size()) {
+        SinglePath P = BinDir;
+        llvm::sys::path::append(P, DwpBin);
+        return P;
+      }
+
+      return SinglePath(DwpBin);
+    }
+
+    static SinglePath getClangXXPath(llvm::StringRef BinDir) {
+
+      const char *ClangBin = "clang++";
+
+      if (BinDir.size()) {
+        SinglePath P = BinDir;
+        llvm::sys::path::append(P, ClangBin);
+        return P;
+      }
+
+      return SinglePath(ClangBin);
     }
 
     static CommandInfo getClangXXCommand(
@@ -684,7 +3008,8 @@ public:
       CommandInfo Cmd(getClangXXPath(BinDir), verbose, dryRun);
       Cmd
       .addArg("-std=c++17")
-      .addKVArgEqIfNotEmpty("-stdlib", StdLib);
+      .addKVArgEqIfNotEmpty("-stdlib", StdLib)
+      .addVFSOverlayArg();
 
       return Cmd;
     }
@@ -735,16 +3060,55 @@ public:
     }
   };
 
+  static bool parseImportBatch(
+      StringRef BinDir,
+      const Paths &OutLDepsFiles,
+      const Paths &OutLDepsMetaFiles,
+      const Paths &SourceFiles,
+      const LevitationDriver::Args &ExtraArgs,
+      bool Verbose,
+      bool DryRun,
+      LevitationDriver::ExecutionMode Execution
+  ) {
+    assert(
+        SourceFiles.size() &&
+        OutLDepsFiles.size() == SourceFiles.size() &&
+        OutLDepsMetaFiles.size() == SourceFiles.size()
+    );
+
+    if (!DryRun || Verbose)
+      log_info("PARSE IMPORT BATCH ", dumpPathsArray(SourceFiles, "sources"));
+
+    for (const auto &LDeps : OutLDepsFiles)
+      levitation::Path::createDirsForFile(LDeps);
+
+    auto ExecutionStatus = CommandInfo::getParseImportBatch(
+        BinDir, Verbose, DryRun
+    )
+    .addKVArgsEq("-levitation-deps-output-file", OutLDepsFiles)
+    .addKVArgsEq("-levitation-decl-ast-meta", OutLDepsMetaFiles)
+    .addArgs(ExtraArgs)
+    .addArgs(SourceFiles)
+    .addInputs(SourceFiles)
+    .addOutputs(OutLDepsFiles)
+    .addOutputs(OutLDepsMetaFiles)
+    .executionMode(Execution)
+    .traceAs("parse-import", SourceFiles.front())
+    .execute();
+
+    return processStatus(ExecutionStatus);
+  }
+
   static bool parseImport(
       StringRef BinDir,
-      StringRef PrecompiledPreamble,
       StringRef OutLDepsFile,
       StringRef OutLDepsMetaFile,
       StringRef SourceFile,
       StringRef SourcesRoot,
       const LevitationDriver::Args &ExtraArgs,
       bool Verbose,
-      bool DryRun
+      bool DryRun,
+      LevitationDriver::ExecutionMode Execution
   ) {
     if (!DryRun || Verbose)
       dumpParseImport(OutLDepsFile, SourceFile);
@@ -752,18 +3116,92 @@ public:
     levitation::Path::createDirsForFile(OutLDepsFile);
 
     auto ExecutionStatus = CommandInfo::getParseImport(
-        BinDir, PrecompiledPreamble, Verbose, DryRun
+        BinDir, Verbose, DryRun
     )
     .addKVArgEq("-cppl-src-root", SourcesRoot)
     .addKVArgEq("-cppl-deps-out", OutLDepsFile)
     .addKVArgEq("-cppl-meta", OutLDepsMetaFile)
+    .addSourceDigestArg("-cppl-source-digest", SourceFile)
     .addArgs(ExtraArgs)
     .addArg(SourceFile)
+    .addInput(SourceFile)
+    .addOutput(OutLDepsFile)
+    .addOutput(OutLDepsMetaFile)
+    .executionMode(Execution)
+    .traceAs("parse-import", SourceFile)
     .execute();
 
     return processStatus(ExecutionStatus);
   }
 
+  /// Collects dependencies with in-driver import scanner and writes
+  /// .ldeps and .ldeps-meta files, same as clang would do.
+  /// \return false if source can't be handled by import scanner,
+  /// or if files were not written. In this case
+  /// parse-import should be done by clang.
+  static bool scanImport(
+      StringRef OutLDepsFile,
+      StringRef OutLDepsMetaFile,
+      StringRef SourceFile
+  ) {
+    // Source is read through file manager, so that it is
+    // read once, for later steps as well.
+    auto &FM = CreatableSingleton<FileManager>::get();
+    auto Buffer = FM.getBufferForFile(SourceFile);
+    if (!Buffer)
+      return false;
+
+    auto SrcBuffer = Buffer.get()->getBuffer();
+
+    PackageDependencies Dependencies;
+    ImportScanner Scanner(SrcBuffer);
+
+    auto Span = BuildTrace::get().span(SourceFile, "scan-import", SourceFile);
+
+    if (!Scanner.scan(Dependencies)) {
+      log_verbose(
+          "Import scanner can't handle '", SourceFile, "', ",
+          Scanner.getErrorMessage(), " Falling back to clang."
+      );
+      return false;
+    }
+
+    dumpParseImport(OutLDepsFile, SourceFile);
+
+    levitation::Path::createDirsForFile(OutLDepsFile);
+
+    SmallString<256> LDepsBuffer;
+    {
+      llvm::raw_svector_ostream Out(LDepsBuffer);
+      CreateBitstreamWriter(Out)->writeAndFinalize(Dependencies);
+    }
+
+    levitation::File F(OutLDepsFile);
+    if (auto OpenedFile = F.open())
+      OpenedFile.getOutputStream() << LDepsBuffer;
+
+    if (F.hasErrors())
+      return false;
+
+    HashVectorTy SrcHash;
+    if (!SourceDigests::get().getHash(SourceFile, metaHash(), SrcHash))
+      return false;
+
+    DeclASTMeta Meta(
+        SrcHash,
+        calcHash(metaHash(), LDepsBuffer.str()),
+        DeclASTMeta::FragmentsVectorTy()
+    );
+    Meta.setHashKind(metaHash());
+
+    levitation::File MetaF(OutLDepsMetaFile);
+    if (auto OpenedFile = MetaF.open())
+      CreateMetaBitstreamWriter(OpenedFile.getOutputStream())
+          ->writeAndFinalize(Meta);
+
+    return !MetaF.hasErrors();
+  }
+
   static bool buildDecl(
       StringRef BinDir,
       const SmallVectorImpl<SinglePath> &Includes,
@@ -773,10 +3211,16 @@ public:
       StringRef InputFile,
       StringRef UnitID,
       const Paths &Deps,
+      StringRef NameIndex,
+      StringRef PortableSourcesRoot,
       StringRef StdLib,
       const LevitationDriver::Args &ExtraParserArgs,
+      const GeneratedSources &Generated,
+      StringRef Executor,
+      int Worker,
       bool Verbose,
-      bool DryRun
+      bool DryRun,
+      LevitationDriver::ExecutionMode Execution
   ) {
     assert(OutDeclASTFile.size() && InputFile.size());
 
@@ -790,37 +3234,73 @@ public:
     )
     .addKVArgEqIfNotEmpty("-cppl-include-preamble", PrecompiledPreamble)
     .addKVArgsEq("-cppl-include-dependency", Deps)
+    .addKVArgEqIfNotEmpty("-cppl-name-index", NameIndex)
+    .condition(PortableSourcesRoot.size())
+        .addKVArgEq("-cppl-src-root", PortableSourcesRoot)
+        .addKVArgEq("-ffile-prefix-map", (PortableSourcesRoot + "=.").str())
+    .conditionEnd()
     .addArgs(ExtraParserArgs)
     .addArg(InputFile)
     .addKVArgEq("-cppl-unit-id", UnitID)
-    // TODO Levitation: don't emit .decl-ast files
-    //  in some cases. See task #48
-    //    .condition(OutDeclASTFile.size())
-    //        .addKVArgSpace("-o", OutDeclASTFile)
-    //    .conditionElse()
-    //        .addArg("-cppl-no-out")
-    //    .conditionEnd()
     .addKVArgSpace("-o", OutDeclASTFile)
     .addKVArgEq("-cppl-meta", OutDeflASTMetaFile)
+    .addSourceDigestArg("-cppl-source-digest", InputFile)
+    .addKVArgEqIfNotEmpty("-cppl-header-out", Generated.Header)
+    .condition(Generated.Header.size())
+        .addKVArgsEq("-cppl-header-include", Generated.Includes)
+    .conditionEnd()
+    .addKVArgEqIfNotEmpty("-cppl-decl-out", Generated.Decl)
+    .condition(Generated.Decl.size())
+        .addKVArgsEq("-cppl-decl-import", Generated.Imports)
+    .conditionEnd()
+    .condition(!Generated.empty())
+        .addKVArgEqIfNotEmpty("-cppl-header-preamble", Generated.Preamble)
+    .conditionEnd()
+    .addInput(InputFile)
+    .addInput(PrecompiledPreamble)
+    .addInputs(Deps)
+    .addInput(NameIndex)
+    .addOutput(OutDeclASTFile)
+    .condition(OutDeflASTMetaFile != OutDeclASTFile)
+        .addOutput(OutDeflASTMetaFile)
+    .conditionEnd()
+    .addOutput(Generated.Header)
+    .addOutput(Generated.Decl)
+    .responseFile(getResponseFile(OutDeclASTFile))
+    .timeTrace(OutDeclASTFile)
+    .dependencyStats(OutDeclASTFile)
+    .serializeDiagnostics(OutDeclASTFile)
+    .executionMode(Execution)
+    .executor(Executor)
+    .worker(Worker)
+    .traceAs("decl-ast", UnitID)
     .execute();
 
     return processStatus(ExecutionStatus);
   }
 
+  /// \param OutDwoFile split DWARF file, which object build also
+  /// produces, empty if debug info is not split.
   static bool buildObject(
       StringRef BinDir,
       const SmallVectorImpl<SinglePath>& Includes,
       StringRef PrecompiledPreamble,
       StringRef OutObjFile,
       StringRef OutMetaFile,
+      StringRef OutDwoFile,
       StringRef InputObject,
       StringRef UnitID,
       const Paths &Deps,
+      StringRef NameIndex,
+      StringRef PortableSourcesRoot,
       StringRef StdLib,
       const LevitationDriver::Args &ExtraParserArgs,
       const LevitationDriver::Args &ExtraCodeGenArgs,
+      StringRef Executor,
+      int Worker,
       bool Verbose,
-      bool DryRun
+      bool DryRun,
+      LevitationDriver::ExecutionMode Execution
   ) {
     assert(OutObjFile.size() && InputObject.size());
 
@@ -834,12 +3314,106 @@ public:
     )
     .addKVArgEqIfNotEmpty("-cppl-include-preamble", PrecompiledPreamble)
     .addKVArgsEq("-cppl-include-dependency", Deps)
+    .addKVArgEqIfNotEmpty("-cppl-name-index", NameIndex)
+    .condition(PortableSourcesRoot.size())
+        .addKVArgEq("-cppl-src-root", PortableSourcesRoot)
+        .addKVArgEq("-ffile-prefix-map", (PortableSourcesRoot + "=.").str())
+    .conditionEnd()
     .addArgs(ExtraParserArgs)
     .addArgs(ExtraCodeGenArgs)
     .addArg(InputObject)
     .addKVArgEq("-cppl-unit-id", UnitID)
     .addKVArgSpace("-o", OutObjFile)
     .addKVArgEq("-cppl-meta", OutMetaFile)
+    .addSourceDigestArg("-cppl-source-digest", InputObject)
+    .addInput(InputObject)
+    .addInput(PrecompiledPreamble)
+    .addInputs(Deps)
+    .addInput(NameIndex)
+    .addOutput(OutObjFile)
+    .addOutput(OutMetaFile)
+    .addOutput(OutDwoFile)
+    .responseFile(getResponseFile(OutObjFile))
+    .timeTrace(OutObjFile)
+    .dependencyStats(OutObjFile)
+    .serializeDiagnostics(OutObjFile)
+    .executionMode(Execution)
+    .executor(Executor)
+    .worker(Worker)
+    .traceAs("object", UnitID)
+    .execute();
+
+    return processStatus(ExecutionStatus);
+  }
+
+  /// Parses definition with dependencies loaded, as object build does,
+  /// but stops after semantic analysis, so that neither object,
+  /// nor meta is produced.
+  static bool checkDefinition(
+      StringRef BinDir,
+      const SmallVectorImpl<SinglePath>& Includes,
+      StringRef PrecompiledPreamble,
+      StringRef Source,
+      StringRef UnitID,
+      const Paths &Deps,
+      StringRef NameIndex,
+      StringRef StdLib,
+      const LevitationDriver::Args &ExtraParserArgs,
+      StringRef Executor,
+      int Worker,
+      bool Verbose,
+      bool DryRun,
+      LevitationDriver::ExecutionMode Execution
+  ) {
+    if (!DryRun || Verbose)
+      log_info("CHECK ", Source);
+
+    // Meta option is mandatory for object builds, though
+    // syntax only frontend never writes it.
+    auto UnusedMeta = Path::replaceExtension<SinglePath>(
+        Source, FileExtensions::DeclASTMeta
+    );
+
+    auto ExecutionStatus = CommandInfo::getBuildObj(
+        BinDir, Includes, PrecompiledPreamble, StdLib, Verbose, DryRun
+    )
+    .addArg("-fsyntax-only")
+    .addKVArgEqIfNotEmpty("-cppl-include-preamble", PrecompiledPreamble)
+    .addKVArgsEq("-cppl-include-dependency", Deps)
+    .addKVArgEqIfNotEmpty("-cppl-name-index", NameIndex)
+    .addArgs(ExtraParserArgs)
+    .addArg(Source)
+    .addKVArgEq("-cppl-unit-id", UnitID)
+    .addKVArgEq("-cppl-meta", UnusedMeta)
+    .addInput(Source)
+    .addInput(PrecompiledPreamble)
+    .addInputs(Deps)
+    .addInput(NameIndex)
+    .executionMode(Execution)
+    .executor(Executor)
+    .worker(Worker)
+    .traceAs("check", UnitID)
+    .execute();
+
+    return processStatus(ExecutionStatus);
+  }
+
+  /// Parses source without producing anything, used to
+  /// measure parse time of headers.
+  static bool parseOnly(
+      StringRef BinDir,
+      const SmallVectorImpl<SinglePath>& Includes,
+      StringRef Source,
+      StringRef StdLib,
+      bool Verbose,
+      LevitationDriver::ExecutionMode Execution
+  ) {
+    auto ExecutionStatus = CommandInfo::getParseOnly(
+        BinDir, Includes, StdLib, Verbose, false
+    )
+    .addArg(Source)
+    .executionMode(Execution)
+    .traceAs("parse-header", Source)
     .execute();
 
     return processStatus(ExecutionStatus);
@@ -851,10 +3425,12 @@ public:
       StringRef PreambleSource,
       StringRef PCHOutput,
       StringRef PCHOutputMeta,
+      StringRef ChainedOnPCH,
       StringRef StdLib,
       const LevitationDriver::Args &ExtraPreambleArgs,
       bool Verbose,
-      bool DryRun
+      bool DryRun,
+      LevitationDriver::ExecutionMode Execution
   ) {
     assert(PreambleSource.size() && PCHOutput.size());
 
@@ -863,23 +3439,100 @@ public:
 
     levitation::Path::createDirsForFile(PCHOutput);
 
-    auto ExecutionStatus = CommandInfo::getBuildPreamble(
+    auto Cmd = CommandInfo::getBuildPreamble(
         BinDir, Includes, StdLib, Verbose, DryRun
-    )
+    );
+
+    if (ChainedOnPCH.size())
+      Cmd.addKVArgSpace("-include-pch", ChainedOnPCH);
+
+    auto ExecutionStatus = Cmd
     .addArg(PreambleSource)
     .addKVArgSpace("-o", PCHOutput)
     .addKVArgEq("-cppl-meta", PCHOutputMeta)
+    .addSourceDigestArg("-cppl-source-digest", PreambleSource)
+    .addArgs(ExtraPreambleArgs)
+    .addInput(PreambleSource)
+    .addInput(ChainedOnPCH)
+    .addOutput(PCHOutput)
+    .addOutput(PCHOutputMeta)
+    .executionMode(Execution)
+    .traceAs("preamble", PreambleSource)
+    .execute();
+
+    return processStatus(ExecutionStatus);
+  }
+
+  /// Precompiles umbrella header of public headers into plain PCH,
+  /// for consumers which are not C++ Levitation units.
+  static bool buildHeadersPCH(
+      StringRef BinDir,
+      const SmallVectorImpl<SinglePath>& Includes,
+      StringRef Umbrella,
+      StringRef PCHOutput,
+      StringRef StdLib,
+      const LevitationDriver::Args &ExtraPreambleArgs,
+      bool Verbose,
+      bool DryRun
+  ) {
+    assert(Umbrella.size() && PCHOutput.size());
+
+    if (!DryRun || Verbose)
+      log_info("HEADERS-PCH ", Umbrella, " -> ", PCHOutput);
+
+    levitation::Path::createDirsForFile(PCHOutput);
+
+    auto ExecutionStatus = CommandInfo::getBuildHeadersPCH(
+        BinDir, Includes, StdLib, Verbose, DryRun
+    )
+    .addArg(Umbrella)
+    .addKVArgSpace("-o", PCHOutput)
     .addArgs(ExtraPreambleArgs)
+    .addInput(Umbrella)
+    .addOutput(PCHOutput)
+    .traceAs("preamble", Umbrella)
     .execute();
 
     return processStatus(ExecutionStatus);
   }
 
+  static SinglePath getResponseFile(StringRef OutputFile) {
+    SinglePath RspFile = OutputFile;
+    RspFile += ".";
+    RspFile += FileExtensions::ResponseFile;
+    return RspFile;
+  }
+
+  /// Writes object files list into response file, so that
+  /// command line length doesn't depend on number of objects.
+  /// \return response file argument, or empty string in case of failure.
+  static std::string writeResponseFile(
+      StringRef OutputFile,
+      const Paths &ObjectFiles
+  ) {
+    SinglePath RspFile = getResponseFile(OutputFile);
+
+    levitation::File F(RspFile);
+    if (auto OpenedFile = F.open())
+      ArgsUtils::writeResponseFile(OpenedFile.getOutputStream(), ObjectFiles);
+
+    if (F.hasErrors()) {
+      log::Logger::get().log_error(
+          "Failed to write response file '", RspFile, "'"
+      );
+      return "";
+    }
+
+    return ("@" + RspFile).str();
+  }
+
   static bool link(
       StringRef BinDir,
       StringRef OutputFile,
       const Paths &ObjectFiles,
       StringRef StdLib,
+      StringRef Linker,
+      int LinkerThreads,
       const LevitationDriver::Args &ExtraArgs,
       bool Verbose,
       bool DryRun,
@@ -892,45 +3545,434 @@ public:
 
     levitation::Path::createDirsForFile(OutputFile);
 
+    std::string RspArg;
+    if (!DryRun) {
+      RspArg = writeResponseFile(OutputFile, ObjectFiles);
+      if (RspArg.empty())
+        return false;
+    }
+
     auto ExecutionStatus = CommandInfo::getLink(
-        BinDir, StdLib, Verbose, DryRun, CanUseLibStdCpp
+        BinDir, StdLib, Linker, LinkerThreads, Verbose, DryRun, CanUseLibStdCpp
     )
     .addArgs(ExtraArgs)
-    .addArgs(ObjectFiles)
+    .condition(DryRun)
+        .addArgs(ObjectFiles)
+    .conditionElse()
+        .addArg(RspArg)
+    .conditionEnd()
     .addKVArgSpace("-o", OutputFile)
+    .addInputs(ObjectFiles)
+    .addOutput(OutputFile)
+    .responseFile(getResponseFile(OutputFile))
+    .traceAs("link", OutputFile)
     .execute();
 
-    return true;
+    return processStatus(ExecutionStatus);
   }
 
-protected:
+  /// Links objects into single relocatable object.
+  /// Standard libraries and start files are left to final link.
+  static bool partialLink(
+      StringRef BinDir,
+      StringRef OutputFile,
+      const Paths &ObjectFiles,
+      StringRef Linker,
+      int LinkerThreads,
+      bool Verbose,
+      bool DryRun
+  ) {
+    assert(OutputFile.size() && ObjectFiles.size());
 
-  static log::manipulator_t workerId() {
-    auto &TM = TasksManager::get();
-    auto WID = TM.getWorkerID();
-      if (TasksManager::isValid(WID))
-        return [=] (llvm::raw_ostream &out) {
-          out << WID;
-        };
-      else
-        return [=] (llvm::raw_ostream &out) {
-          out << "Main";
-        };
-  }
+    if (!DryRun || Verbose)
+      log_info(
+          "PARTIAL-LINK ", dumpObjectFiles(ObjectFiles), " -> ", OutputFile
+      );
 
-  template <typename ...ArgsT>
-  static void log_info(ArgsT&&...args) {
-    log::Logger::get().log_info(
-        "[", workerId(), "] ",
-        std::forward<ArgsT>(args)...
-    );
-  }
+    levitation::Path::createDirsForFile(OutputFile);
 
-  template <typename ...ArgsT>
-  static void log_verbose(ArgsT&&...args) {
-    log::Logger::get().log_verbose(
-        "[", workerId(), "] ",
-        std::forward<ArgsT>(args)...
+    std::string RspArg;
+    if (!DryRun) {
+      RspArg = writeResponseFile(OutputFile, ObjectFiles);
+      if (RspArg.empty())
+        return false;
+    }
+
+    auto ExecutionStatus = CommandInfo::getLink(
+        BinDir, "", Linker, LinkerThreads, Verbose, DryRun, false
+    )
+    .addArg("-r")
+    .addArg("-nostdlib")
+    .condition(DryRun)
+        .addArgs(ObjectFiles)
+    .conditionElse()
+        .addArg(RspArg)
+    .conditionEnd()
+    .addKVArgSpace("-o", OutputFile)
+    .addInputs(ObjectFiles)
+    .addOutput(OutputFile)
+    .responseFile(getResponseFile(OutputFile))
+    .traceAs("partial-link", OutputFile)
+    .execute();
+
+    return processStatus(ExecutionStatus);
+  }
+
+  /// Links objects into shared library. Undefined symbols are allowed,
+  /// they are resolved against other libraries when executable is linked.
+  static bool linkShared(
+      StringRef BinDir,
+      StringRef OutputFile,
+      const Paths &ObjectFiles,
+      StringRef StdLib,
+      StringRef Linker,
+      int LinkerThreads,
+      const LevitationDriver::Args &ExtraArgs,
+      bool Verbose,
+      bool DryRun,
+      bool CanUseLibStdCpp
+  ) {
+    assert(OutputFile.size() && ObjectFiles.size());
+
+    if (!DryRun || Verbose)
+      log_info(
+          "LINK-SHARED ", dumpObjectFiles(ObjectFiles), " -> ", OutputFile
+      );
+
+    levitation::Path::createDirsForFile(OutputFile);
+
+    std::string RspArg;
+    if (!DryRun) {
+      RspArg = writeResponseFile(OutputFile, ObjectFiles);
+      if (RspArg.empty())
+        return false;
+    }
+
+    auto ExecutionStatus = CommandInfo::getLink(
+        BinDir, StdLib, Linker, LinkerThreads, Verbose, DryRun, CanUseLibStdCpp
+    )
+    .addArg("-shared")
+    .addArgs(ExtraArgs)
+    .condition(DryRun)
+        .addArgs(ObjectFiles)
+    .conditionElse()
+        .addArg(RspArg)
+    .conditionEnd()
+    .addKVArgSpace("-o", OutputFile)
+    .addInputs(ObjectFiles)
+    .addOutput(OutputFile)
+    .responseFile(getResponseFile(OutputFile))
+    .traceAs("link-shared", OutputFile)
+    .execute();
+
+    return processStatus(ExecutionStatus);
+  }
+
+  /// Runs ThinLTO thin-link step only. For each bitcode object linker
+  /// writes <object>.thinlto.bc index file, which is then used
+  /// by backend of that object.
+  /// Linker also writes <object>.imports file, with list of bitcode
+  /// objects backend imports from, which are to be shipped to remote
+  /// worker along with object and its index.
+  /// Distributed ThinLTO is only supported by lld,
+  /// so it is always used for this step.
+  static bool thinLink(
+      StringRef BinDir,
+      StringRef OutputFile,
+      const Paths &ObjectFiles,
+      StringRef StdLib,
+      int LinkerThreads,
+      const LevitationDriver::Args &ExtraArgs,
+      bool Verbose,
+      bool DryRun,
+      bool CanUseLibStdCpp
+  ) {
+    assert(OutputFile.size() && ObjectFiles.size());
+
+    if (!DryRun || Verbose)
+      log_info("THIN-LINK ", dumpObjectFiles(ObjectFiles));
+
+    levitation::Path::createDirsForFile(OutputFile);
+
+    Paths IndexFiles;
+    for (const auto &Obj : ObjectFiles) {
+      IndexFiles.emplace_back(Obj);
+      IndexFiles.back() += ".thinlto.bc";
+      IndexFiles.emplace_back(Obj);
+      IndexFiles.back() += ".imports";
+    }
+
+    std::string RspArg;
+    if (!DryRun) {
+      RspArg = writeResponseFile(OutputFile, ObjectFiles);
+      if (RspArg.empty())
+        return false;
+    }
+
+    auto ExecutionStatus = CommandInfo::getLink(
+        BinDir, StdLib, "lld", LinkerThreads, Verbose, DryRun, CanUseLibStdCpp
+    )
+    .addArg("-flto=thin")
+    .addArg("-Wl,--thinlto-index-only")
+    .addArg("-Wl,--thinlto-emit-imports-files")
+    .addArgs(ExtraArgs)
+    .condition(DryRun)
+        .addArgs(ObjectFiles)
+    .conditionElse()
+        .addArg(RspArg)
+    .conditionEnd()
+    .addKVArgSpace("-o", OutputFile)
+    .addInputs(ObjectFiles)
+    .addOutputs(IndexFiles)
+    .responseFile(getResponseFile(OutputFile))
+    .traceAs("thin-link", OutputFile)
+    .execute();
+
+    return processStatus(ExecutionStatus);
+  }
+
+  static bool thinBackend(
+      StringRef BinDir,
+      StringRef OutObjFile,
+      StringRef BitcodeFile,
+      StringRef IndexFile,
+      const LevitationDriver::Args &ExtraCodeGenArgs,
+      StringRef Executor,
+      bool Verbose,
+      bool DryRun,
+      LevitationDriver::ExecutionMode Execution
+  ) {
+    assert(OutObjFile.size() && BitcodeFile.size() && IndexFile.size());
+
+    if (!DryRun || Verbose)
+      log_info("THINLTO ", BitcodeFile, " -> ", OutObjFile);
+
+    auto ExecutionStatus = CommandInfo::getCompileIR(
+        BinDir, Verbose, DryRun
+    )
+    .addArg(BitcodeFile)
+    .addKVArgEq("-fthinlto-index", IndexFile)
+    .addArgs(ExtraCodeGenArgs)
+    .addKVArgSpace("-o", OutObjFile)
+    .addInput(BitcodeFile)
+    .addInput(IndexFile)
+    .addOutput(OutObjFile)
+    .executionMode(Execution)
+    .executor(Executor)
+    .traceAs("thinlto-backend", BitcodeFile)
+    .execute();
+
+    return processStatus(ExecutionStatus);
+  }
+
+  /// Compiles unoptimized bitcode, kept in keep IR mode, into object.
+  static bool compileIR(
+      StringRef BinDir,
+      StringRef OutObjFile,
+      StringRef IRFile,
+      StringRef UnitID,
+      const LevitationDriver::Args &BackendArgs,
+      bool Verbose,
+      bool DryRun,
+      LevitationDriver::ExecutionMode Execution
+  ) {
+    assert(OutObjFile.size() && IRFile.size());
+
+    if (!DryRun || Verbose)
+      log_info("BACKEND ", IRFile, " -> ", OutObjFile);
+
+    auto ExecutionStatus = CommandInfo::getCompileIR(
+        BinDir, Verbose, DryRun
+    )
+    .addArg(IRFile)
+    .addArgs(BackendArgs)
+    .addKVArgSpace("-o", OutObjFile)
+    .addInput(IRFile)
+    .addOutput(OutObjFile)
+    .executionMode(Execution)
+    .traceAs("backend", UnitID)
+    .execute();
+
+    return processStatus(ExecutionStatus);
+  }
+
+  /// Packages split DWARF files executable refers to into
+  /// single .dwp file.
+  static bool packageDwarf(
+      StringRef BinDir,
+      StringRef OutDwpFile,
+      StringRef Executable,
+      bool Verbose,
+      bool DryRun
+  ) {
+    assert(OutDwpFile.size() && Executable.size());
+
+    if (!DryRun || Verbose)
+      log_info("DWP ", Executable, " -> ", OutDwpFile);
+
+    auto ExecutionStatus = CommandInfo::getDwp(BinDir, Verbose, DryRun)
+    .addKVArgSpace("-e", Executable)
+    .addKVArgSpace("-o", OutDwpFile)
+    .addInput(Executable)
+    .addOutput(OutDwpFile)
+    .traceAs("dwp", Executable)
+    .execute();
+
+    return processStatus(ExecutionStatus);
+  }
+
+  /// Runs test executable without arguments, its stdout and stderr
+  /// go to LogFile.
+  /// \return exit code, same as llvm::sys::ExecuteAndWait returns.
+  static int runTest(
+      StringRef Executable,
+      StringRef LogFile,
+      bool Verbose,
+      bool DryRun,
+      std::string &ErrorMessage
+  ) {
+    if (DryRun || Verbose)
+      log_info("TEST ", Executable);
+
+    if (DryRun)
+      return 0;
+
+    auto &TM = TasksManager::get();
+    TM.acquireJob("test");
+    auto JobScope = llvm::make_scope_exit([&] {
+      TM.releaseJob("test");
+    });
+
+    auto JobSlot = Jobserver::get().acquire();
+
+    if (TM.isCancelled()) {
+      ErrorMessage = "Cancelled";
+      return -1;
+    }
+
+    auto Span = BuildTrace::get().span(Executable, "test", Executable);
+
+    ++DriverStats::get().ProcessesSpawned;
+
+    StringRef Args[] = { Executable };
+    Optional<StringRef> Redirects[] = { llvm::None, LogFile, LogFile };
+
+#ifdef LLVM_ON_UNIX
+    bool ExecutionFailed = false;
+    auto PI = llvm::sys::ExecuteNoWait(
+        Executable, Args, /*Env*/llvm::None, Redirects,
+        /*memoryLimit*/0, &ErrorMessage, &ExecutionFailed
+    );
+    if (ExecutionFailed)
+      return -1;
+
+    auto &Running = RunningSubprocesses::get();
+    Running.add(PI.Pid);
+
+    // Same as for jobs, test is unregistered while its PID
+    // is still reserved.
+    siginfo_t Info;
+    while (waitid(P_PID, PI.Pid, &Info, WEXITED | WNOWAIT) < 0 &&
+           errno == EINTR);
+
+    Running.remove(PI.Pid);
+
+    return llvm::sys::Wait(
+        PI, /*SecondsToWait*/0, /*WaitUntilTerminates*/true, &ErrorMessage
+    ).ReturnCode;
+#else
+    return llvm::sys::ExecuteAndWait(
+        Executable, Args, /*Env*/llvm::None, Redirects,
+        /*secondsToWait*/0, /*memoryLimit*/0, &ErrorMessage
+    );
+#endif
+  }
+
+  static bool pushMetrics(
+      StringRef Program,
+      StringRef MetricsFile,
+      bool Verbose,
+      bool DryRun
+  ) {
+    auto ExecutionStatus = CommandInfo::getMetricsPush(Program, Verbose, DryRun)
+    .addArg(MetricsFile)
+    .addInput(MetricsFile)
+    .traceAs("pushMetrics", MetricsFile)
+    .execute();
+
+    return processStatus(ExecutionStatus);
+  }
+
+  static bool runTidy(
+      StringRef BinDir,
+      const SmallVectorImpl<SinglePath>& Includes,
+      StringRef PrecompiledPreamble,
+      StringRef OutFixesFile,
+      StringRef Source,
+      StringRef UnitID,
+      const Paths &Deps,
+      StringRef NameIndex,
+      StringRef StdLib,
+      StringRef Checks,
+      const LevitationDriver::Args &ExtraParserArgs,
+      bool Verbose,
+      bool DryRun
+  ) {
+    if (!DryRun || Verbose)
+      log_info("TIDY ", Source);
+
+    levitation::Path::createDirsForFile(OutFixesFile);
+
+    // clang-tidy is not a part of compile server or in-process
+    // compiler, so it is always run as subprocess.
+    auto ExecutionStatus = CommandInfo::getTidy(
+        BinDir, Checks, OutFixesFile, Source, Verbose, DryRun
+    )
+    .addKVArgEqIfNotEmpty("-stdlib", StdLib)
+    .addKVArgsSpace("-I", Includes, /*quotes=*/true)
+    .addKVArgEqIfNotEmpty("-cppl-include-preamble", PrecompiledPreamble)
+    .addKVArgsEq("-cppl-include-dependency", Deps)
+    .addKVArgEqIfNotEmpty("-cppl-name-index", NameIndex)
+    .addArgs(ExtraParserArgs)
+    .addKVArgEq("-cppl-unit-id", UnitID)
+    .addInput(Source)
+    .addInput(PrecompiledPreamble)
+    .addInputs(Deps)
+    .addOutput(OutFixesFile)
+    .traceAs("tidy", UnitID)
+    .execute();
+
+    return processStatus(ExecutionStatus);
+  }
+
+protected:
+
+  static log::manipulator_t workerId() {
+    auto &TM = TasksManager::get();
+    auto WID = TM.getWorkerID();
+      if (TasksManager::isValid(WID))
+        return [=] (llvm::raw_ostream &out) {
+          out << WID;
+        };
+      else
+        return [=] (llvm::raw_ostream &out) {
+          out << "Main";
+        };
+  }
+
+  template <typename ...ArgsT>
+  static void log_info(ArgsT&&...args) {
+    log::Logger::get().log_info(
+        "[", workerId(), "] ",
+        std::forward<ArgsT>(args)...
+    );
+  }
+
+  template <typename ...ArgsT>
+  static void log_verbose(ArgsT&&...args) {
+    log::Logger::get().log_verbose(
+        "[", workerId(), "] ",
+        std::forward<ArgsT>(args)...
     );
   }
 
@@ -1096,832 +4138,9641 @@ protected:
   }
 };
 
-void LevitationDriverImpl::buildPreamble() {
-  if (!Status.isValid())
-    return;
+bool LevitationDriverImpl::build() {
+  auto &Trace = BuildTrace::get();
+  auto &Cache = BuildCache::get();
 
-  if (!Context.Driver.isPreambleCompilationRequested())
-    return;
+  // Previous watch mode build might be cancelled.
+  TM.resetCancellation();
+  RunningSubprocesses::get().reset();
 
-  if (Context.Driver.PreambleOutput.empty()) {
-    Context.Driver.PreambleOutput = levitation::Path::getPath<SinglePath>(
-      Context.Driver.BuildRoot,
-      DriverDefaults::PREAMBLE_OUT
-    );
-    Context.Driver.PreambleOutputMeta = levitation::Path::getPath<SinglePath>(
-      Context.Driver.BuildRoot,
-      DriverDefaults::PREAMBLE_OUT_META
-    );
+  // This build might be superseded before it has started.
+  if (Context.Superseded) {
+    TM.cancel();
+    RunningSubprocesses::get().killAll();
   }
 
-  DeclASTMeta Meta;
-  if (isUpToDate(
-      Meta,
-      Context.Driver.PreambleOutput,
-      Context.Driver.PreambleOutputMeta,
-      Context.Driver.PreambleSource,
-      Context.Driver.PreambleSource
-  ))
-    return;
+  if (Context.Driver.MetricsOutput.size()) {
+    const auto &Stats = DriverStats::get();
+    Context.BuildStart = std::chrono::steady_clock::now();
+    Context.BaseNodesChecked = Stats.NodesChecked;
+    Context.BaseNodesRebuilt = Stats.NodesRebuilt;
+    Context.BaseProcessesSpawned = Stats.ProcessesSpawned;
+    Context.BaseCacheHits = Cache.getHits();
+    Context.BaseCacheMisses = Cache.getMisses();
+  }
 
-  auto Res = Commands::buildPreamble(
-    Context.Driver.BinDir,
-    Context.Driver.Includes,
-    Context.Driver.PreambleSource,
-    Context.Driver.PreambleOutput,
-    Context.Driver.PreambleOutputMeta,
-    Context.Driver.StdLib,
-    Context.Driver.ExtraPreambleArgs,
-    Context.Driver.isVerbose(),
-    Context.Driver.DryRun
-  );
+  // Sources might be changed since previous watch mode build.
+  auto &Files = FilesCache::get();
+  Files.clear();
 
-  if (!Res)
-    Status.setFailure()
-    << "Preamble: phase failed";
+  with (auto _ = Trace.span("build", "driver")) {
 
-  setPreambleUpdated();
-}
+    if (!Context.SourcesCollected)
+      with (auto _ = Trace.span("collectSources", "driver"))
+        collectSources();
 
-void LevitationDriverImpl::runParseImport() {
-  auto &TM = TasksManager::get();
+    if (!Context.Inherited) {
+      loadBuildHistory();
+      loadBuildState();
+    }
 
-  for (auto PackagePath : Context.AllPackages) {
+    // Previous watch mode build may be cancelled as well.
+    loadBuildJournal();
 
-    auto &Files = Context.Files[PackagePath];
+    with (auto _ = Trace.span("extractBundles", "driver"))
+      extractBundles();
 
-    DeclASTMeta ldepsMeta;
+    findNameIndex();
 
-    if (isUpToDate(
-        ldepsMeta,
-        Files.LDeps,
-        Files.LDepsMeta,
-        Files.Source,
-        Files.LDeps /* item description */
-    ))
-      continue;
+    if (Context.Driver.Streaming && !Context.Driver.DryRun)
+      startStreaming();
 
-    TM.runTask([=] (TasksManager::TaskContext &TC) {
-      TC.Successful = Commands::parseImport(
-          Context.Driver.BinDir,
-          Context.Driver.PreambleOutput,
-          Files.LDeps,
-          Files.LDepsMeta,
-          Files.Source,
-          Context.Driver.SourcesRoot,
-          Context.Driver.ExtraParseImportArgs,
-          Context.Driver.isVerbose(),
-          Context.Driver.DryRun
-      );
+    // Import discovery doesn't need preamble, so preamble is built
+    // in background, while dependencies are parsed and solved.
+    // If there are no free workers, it is built right here.
+    auto PreambleTask = TM.runTask([&] (TasksManager::TaskContext &TC) {
+      with (auto _ = Trace.span("buildPreamble", "driver"))
+        buildPreamble();
+
+      if (PreambleStatus.isValid())
+        with (auto _ = Trace.span("buildHeaderUnits", "driver"))
+          buildHeaderUnits();
+
+      TC.Successful = PreambleStatus.isValid();
+
+      if (Streaming)
+        streamPreambleReady(TC.Successful);
     });
-  }
 
-  auto Res = TM.waitForTasks();
+    with (auto _ = Trace.span("runParseImport", "driver"))
+      runParseImport();
 
-  if (!Res)
-    Status.setFailure()
-    << "Parse: phase failed.";
-}
+    // Streamed jobs don't touch solver inputs, but they use
+    // strings pool, which is not thread-safe. So let them finish first.
+    if (Streaming) {
+      with (auto _ = Trace.span("finishStreaming", "driver")) {
+        TM.waitForTasks({PreambleTask});
+        finishStreaming();
+      }
+    }
 
-void LevitationDriverImpl::solveDependencies() {
-  if (!Status.isValid())
-    return;
+    with (auto _ = Trace.span("solveDependencies", "driver"))
+      solveDependencies();
 
-  DependenciesSolver Solver;
-  Solver.setSourcesRoot(Context.Driver.SourcesRoot);
-  Solver.setBuildRoot(Context.Driver.BuildRoot);
-  Solver.setVerbose(Context.Driver.isVerbose());
+    checkSubtreePreambles();
 
-  Context.DependenciesInfo = Solver.solve(
-      Context.ExternalPackages,
-      Context.Files
-  );
+    TM.waitForTasks({PreambleTask});
+    Status.inheritResult(PreambleStatus, "");
 
-  Status.inheritResult(Solver, "Dependencies solver: ");
-}
-
-void LevitationDriverImpl::codeGen() {
-  if (!Status.isValid())
-    return;
+    // Nothing adds strings until next build, while node jobs
+    // look them up from all workers.
+    Strings.freeze();
 
-  bool Res =
-    Context.DependenciesInfo->getDependenciesGraph().dsfJobs(
-        [&] (const DependenciesGraph::Node &N) {
-          return processDependencyNode(N);
-        }
-    );
+    // Declaration ASTs don't depend on configuration, so they are
+    // only built by first configuration pass, and other passes
+    // only build objects.
+    auto &Configs = Context.Driver.Configs;
+    size_t NumPasses = std::max<size_t>(Configs.size(), 1);
+    Context.DeclarationsProcessed = false;
 
-  if (!Res)
-    Status.setFailure()
-    << "Instantiate and codegen: phase failed.";
-}
+    for (size_t Pass = 0; Pass != NumPasses; ++Pass) {
+      selectConfig(Configs.empty() ? nullptr : &Configs[Pass]);
 
-void LevitationDriverImpl::runLinker() {
-  if (!Status.isValid())
-    return;
+      if (Context.Config)
+        Log.log_verbose("Building configuration '", Context.Config->Name, "'...");
 
-  if (llvm::sys::fs::exists(Context.Driver.Output) && !Context.ObjectsUpdated) {
-    Status.setWarning("Nothing to build.\n");
-    return;
-  }
+      with (auto _ = Trace.span("codeGen", "driver"))
+        codeGen();
 
-  assert(Context.Driver.isLinkPhaseEnabled() && "Link phase must be enabled.");
+      if (Pass == 0) {
+        with (auto _ = Trace.span("buildNameIndex", "driver"))
+          buildNameIndex();
+        Context.DeclarationsProcessed = true;
 
-  Paths ObjectFiles;
-  for (auto &PackagePath : Context.ProjectPackages) {
-    assert(Context.Files.count(PackagePath));
-    ObjectFiles.push_back(Context.Files[PackagePath].Object);
-  }
+        if (Context.LibraryUnits.size())
+          with (auto _ = Trace.span("writeLibraryFingerprints", "driver"))
+            writeLibraryFingerprints();
 
-  auto Res = Commands::link(
-      Context.Driver.BinDir,
-      Context.Driver.Output,
-      ObjectFiles,
-      Context.Driver.StdLib,
-      Context.Driver.ExtraLinkerArgs,
-      Context.Driver.isVerbose(),
-      Context.Driver.DryRun,
-      Context.Driver.CanUseLibStdCppForLinker
-  );
+        if (Context.Driver.Tidy)
+          with (auto _ = Trace.span("runTidy", "driver"))
+            runTidy();
+      }
 
-  if (!Res)
-    Status.setFailure()
-    << "Link: phase failed";
-}
+      // Sharded build only compiles part of objects, they are
+      // linked by final build.
+      if (
+        Context.Driver.LinkPhaseEnabled &&
+        !Context.Driver.NumShards &&
+        !Context.Driver.Check
+      )
+      {
+        with (auto _ = Trace.span("runLinker", "driver"))
+          runLinker();
 
-void LevitationDriverImpl::collectSources() {
-  collectProjectSources();
-  collectLibrariesSources();
-}
+        if (Context.Driver.RunTests)
+          with (auto _ = Trace.span("runTests", "driver"))
+            runTests();
+      }
 
-void LevitationDriverImpl::collectProjectSources() {
+      // Library outputs are made of generated headers.
+      if (!Context.Driver.LinkPhaseEnabled)
+        with (auto _ = Trace.span("waitForPublication", "driver"))
+          waitForPublication();
+
+      if (!Context.Driver.LinkPhaseEnabled && Context.Driver.Archive.size())
+        with (auto _ = Trace.span("writeArchive", "driver"))
+          writeArchive();
+
+      if (!Context.Driver.LinkPhaseEnabled && Context.Driver.MakeBundle.size())
+        with (auto _ = Trace.span("writeBundle", "driver"))
+          writeBundle();
+
+      if (
+        !Context.Driver.LinkPhaseEnabled &&
+        Context.Driver.AmalgamatedHeader.size()
+      )
+        with (auto _ = Trace.span("writeAmalgamatedHeader", "driver"))
+          writeAmalgamatedHeader();
+
+      if (!Context.Driver.LinkPhaseEnabled && Context.Driver.EmitModuleMap)
+        with (auto _ = Trace.span("writeModuleMap", "driver"))
+          writeModuleMap();
+
+      if (!Context.Driver.LinkPhaseEnabled && Context.Driver.HeadersPCH.size())
+        with (auto _ = Trace.span("buildHeadersPCH", "driver"))
+          buildHeadersPCH();
+    }
+  }
 
-  Log.log_verbose("Collecting project sources...");
+  with (auto _ = Trace.span("waitForPublication", "driver"))
+    waitForPublication();
 
-  // Gather all .cppl files
-  Paths ProjectPackages;
+  saveBuildHistory();
+  saveBuildState();
 
-  FileSystem::collectFiles(
-      ProjectPackages,
-      Context.Driver.SourcesRoot,
-      FileExtensions::SourceCode,
-      /*ignore dirs*/ { Context.Driver.getBuildRoot() }
+  // Journal is kept after failures, since dependents of updated
+  // declarations might be left unbuilt.
+  Context.Journal.close(
+      /*Remove=*/Status.isValid() && !Context.Superseded
   );
 
-  DenseMap<StringID, SinglePath> RelPaths;
+  if (Context.Driver.ExportGraph.size() && Context.DependenciesInfo)
+    with (auto _ = Trace.span("exportGraph", "driver"))
+      exportGraph();
 
-  // Normalize all paths to project .cppl files and register them.
-  for (const auto &Src : ProjectPackages) {
-    auto Rel = levitation::Path::makeRelative<SinglePath>(
-        Src, Context.Driver.SourcesRoot
-    );
+  if (Context.Driver.CompileCommands.size() && Context.DependenciesInfo)
+    with (auto _ = Trace.span("writeCompileCommands", "driver"))
+      writeCompileCommands();
 
-    auto UnitIdentifier = UnitIDUtils::fromRelPath(Rel);
-    auto UnitID = Strings.addItem(StringRef(UnitIdentifier));
-    RelPaths.try_emplace(UnitID, Rel);
+  // Failed build may leave sources set incomplete.
+  if (Context.Driver.AutoGC && Status.isValid())
+    with (auto _ = Trace.span("collectGarbage", "driver")) {
+      removeOrphanArtifacts();
+      trimBuildCache();
+    }
 
-    Context.ProjectPackages.insert(UnitID);
-    Context.AllPackages.insert(UnitID);
+  auto &Pack = ArtifactPack::get();
+  if (Pack.needsCompaction()) {
+    with (auto _ = Trace.span("compactArtifactPack", "driver")) {
+      Failable Compacted = Pack.compact();
+      if (!Compacted.isValid())
+        Log.log_warning(Compacted.getErrorMessage());
+    }
   }
 
-  for (auto UnitID : Context.ProjectPackages) {
+  if (Cache.isEnabled())
+    Log.log_verbose(
+        "Build cache: ", Cache.getHits(), " hits, ",
+        Cache.getMisses(), " misses."
+    );
 
-    //const auto& UnitPath = *Strings.getItem(UnitID);
-    const auto& PackagePath = RelPaths[UnitID];
+  auto &Libraries = LibraryCache::get();
+  if (Libraries.isEnabled())
+    Log.log_verbose(
+        "Library cache: ", Libraries.getHits(), " hits, ",
+        Libraries.getMisses(), " misses."
+    );
 
-    Log.log_trace("  Generating paths for '", PackagePath, "'...");
+  Log.log_verbose(
+      "Files cache: ", Files.getNumHits(), " hits, ",
+      Files.getNumMisses(), " misses."
+  );
 
+  if (Context.Driver.TimeReport)
+    dumpTimeReport();
 
-    auto &Files = Context.Files.create(UnitID);
+  if (Context.Driver.UnitTimeTrace)
+    dumpUnitTimeTraceReport();
 
-    // In current implementation package path is equal to relative source path.
+  if (Context.Driver.DependencyStats && !Context.Driver.DryRun)
+    dumpUnusedImportsReport();
 
-    Files.Source = Path::getPath<SinglePath>(
-        Context.Driver.SourcesRoot,
-        PackagePath,
-        FileExtensions::SourceCode
-    );
+  if (Context.Driver.Explain)
+    dumpRebuildReasons();
 
-    Files.Header = Path::getPath<SinglePath>(
-        Context.Driver.getOutputHeadersDir(),
-        PackagePath,
-        FileExtensions::Header
-    );
+  if (Context.Driver.Stats)
+    dumpStats();
 
-    Files.Decl = Path::getPath<SinglePath>(
-        Context.Driver.getOutputDeclsDir(),
-        PackagePath,
-        FileExtensions::SourceCode
-    );
+  if (Context.Driver.BudgetsFile.size() && Status.isValid())
+    checkBudgets();
 
-    SinglePath OutputTemplate = Path::getPath<SinglePath>(
-        Context.Driver.BuildRoot,
-        PackagePath
+  if (Context.Driver.MetricsOutput.size())
+    writeMetrics();
+
+  if (!Trace.write())
+    Log.log_warning(
+        "Failed to write build trace '", Context.Driver.TraceOutput, "'."
     );
 
-    setOutputFilesInfo(Files, OutputTemplate, true);
+  // Failures of cancelled jobs are not worth reporting.
+  if (Context.Superseded) {
+    Log.log_info("Build is cancelled, since sources were changed again.");
+    return false;
+  }
 
-    Files.dump(Log, log::Level::Trace, 4);
+  if (Status.hasWarnings()) {
+    Log.log_warning(Status.getWarningMessage());
   }
 
-  Log.log_verbose(
-    "Found ", Context.ProjectPackages.size(),
-    " '.", FileExtensions::SourceCode,
-    "' project files.\n" // it was meant to put extra new line here
-  );
-}
+  if (!Status.isValid()) {
+    Log.log_error(Status.getErrorMessage());
+    return false;
+  }
 
-void LevitationDriverImpl::collectLibrariesSources() {
+  return true;
+}
 
-  if (Context.Driver.LevitationLibs.empty())
+void LevitationDriverImpl::buildPreamble() {
+  if (!Context.Driver.isPreambleCompilationRequested()) {
+    buildSubtreePreambles(false);
     return;
+  }
 
-  Log.log_verbose("Collecting libraries (presumable declaration) sources...");
+  if (Context.Driver.PreambleOutput.empty()) {
+    Context.Driver.PreambleOutput = levitation::Path::getPath<SinglePath>(
+      Context.Driver.BuildRoot,
+      DriverDefaults::PREAMBLE_OUT
+    );
+    Context.Driver.PreambleOutputMeta = levitation::Path::getPath<SinglePath>(
+      Context.Driver.BuildRoot,
+      DriverDefaults::PREAMBLE_OUT_META
+    );
+  }
 
-  // Register all external packages.
+  // Chained preambles go first, each one is built on top of previous.
+  // Once some link is rebuilt, all subsequent links are rebuilt as well.
 
-  for (auto &CollectedExtLib : Context.Driver.LevitationLibs) {
+  SinglePath ChainedOn;
+  bool ChainUpdated = false;
 
-    Path::Builder ExtLibPath;
-    ExtLibPath
-      .addComponent(Context.Driver.SourcesRoot)
-      .addComponent(CollectedExtLib)
-      .done();
+  // Prebuilt standard library preamble is only replaced along with
+  // toolchain, then the whole chain is rebuilt.
+  StringRef StdLibPreamble = Context.Driver.StdLibPreambleFile;
+  if (StdLibPreamble.size()) {
+    auto Stamp = getFileStamp(StdLibPreamble);
+    if (!Stamp) {
+      PreambleStatus.setFailure()
+      << "Standard library preamble '" << StdLibPreamble << "' has gone.";
+      return;
+    }
 
-    auto ExtLibAbsPath = Path::makeAbsolute<SinglePath>(ExtLibPath.str());
+    const auto *Recorded = Context.PrevState.get(StdLibPreamble);
+    if (!Recorded || !(Recorded->Product == *Stamp))
+      ChainUpdated = true;
 
-    Log.log_verbose("  Checking dir '", CollectedExtLib, "'...");
-    Paths ExternalPackages;
-    FileSystem::collectFiles(
-        ExternalPackages,
-        ExtLibAbsPath,
-        FileExtensions::SourceCode,
-        /*ignore dirs*/ { Context.Driver.getBuildRoot() }
-    );
+    if (!Context.Driver.DryRun)
+      setProductState(StdLibPreamble, {
+          BuildState::FileStamp(), HashVectorTy(), *Stamp, HashVectorTy()
+      });
 
-    for (const auto &CollectedPath : ExternalPackages) {
-      auto PackagePath = Path::makeAbsolute<SinglePath>(CollectedPath);
-      auto Package = Path::makeRelative<SinglePath>(PackagePath, ExtLibAbsPath);
-      auto UnitIdentifier = UnitIDUtils::fromRelPath(Package);
+    ChainedOn = StdLibPreamble;
+  }
 
-      auto UnitID = Strings.addItem(StringRef(UnitIdentifier));
+  // preamble.pch -> preamble.<i>.pch
+  auto getLinkPath = [&] (StringRef Name, size_t i) {
+    auto P = Path::getPath<SinglePath>(Context.Driver.BuildRoot, Name);
+    llvm::sys::path::replace_extension(
+        P, Twine(i) + llvm::sys::path::extension(Name)
+    );
+    return P;
+  };
 
-      Context.ExternalPackages.insert(UnitID);
-      Context.AllPackages.insert(UnitID);
+  auto &ChainSources = Context.Driver.PreambleChainSources;
+  for (size_t i = 0, e = ChainSources.size(); i != e; ++i) {
+    auto Out = getLinkPath(DriverDefaults::PREAMBLE_OUT, i);
+    auto OutMeta = getLinkPath(DriverDefaults::PREAMBLE_OUT_META, i);
 
-      Log.log_trace(
-          "Checking lib package '", UnitIdentifier, "' -> '", PackagePath, "'..."
-      );
+    if (!buildPreambleLink(
+        ChainSources[i], Out, OutMeta, ChainedOn, ChainUpdated
+    ))
+      return;
 
-      auto &Files = Context.Files.create(UnitID);
+    ChainedOn = Out;
+  }
 
-      // For libraries sources keep absolute source paths
+  buildPreambleLink(
+      Context.Driver.PreambleSource,
+      Context.Driver.PreambleOutput,
+      Context.Driver.PreambleOutputMeta,
+      ChainedOn,
+      ChainUpdated
+  );
 
-      Files.Source = Path::replaceExtension<SinglePath>(
-          PackagePath,
-          FileExtensions::SourceCode
-      );
+  if (!PreambleStatus.isValid())
+    return;
 
-      Path::Builder PBHeader;
-      PBHeader
-        .addComponent(Context.Driver.getOutputHeadersDir())
-        .addComponent(Context.Driver.LibsOutSubDir)
-        .addComponent(PackagePath)
-        .replaceExtension(FileExtensions::Header)
-        .done(Files.Header);
+  if (ChainUpdated)
+    setPreambleUpdated();
 
-      // Note, we don't generate decl .cpp files for levitation libraries.
-      // Source file itself is a decl file.
+  buildSubtreePreambles(ChainUpdated);
+}
 
-      SinglePath OutputTemplate;
+void LevitationDriverImpl::buildSubtreePreambles(bool MainUpdated) {
+  auto &Subtrees = Context.Driver.SubtreePreambles;
+  Context.SubtreePreamblesUpdated.assign(Subtrees.size(), false);
 
-      Path::Builder PBOutputTemplate;
-      PBOutputTemplate
-        .addComponent(Context.Driver.BuildRoot)
-        .addComponent(Context.Driver.LibsOutSubDir)
-        .addComponent(PackagePath)
-        .done(OutputTemplate);
+  StringRef ChainedOn;
+  if (Context.Driver.isPreambleCompilationRequested())
+    ChainedOn = Context.Driver.PreambleOutput;
 
-      setOutputFilesInfo(Files, OutputTemplate, false);
+  // preamble.pch -> preamble.subtree-<i>.pch
+  auto getSubtreePath = [&] (StringRef Name, size_t i) {
+    auto P = Path::getPath<SinglePath>(Context.Driver.BuildRoot, Name);
+    llvm::sys::path::replace_extension(
+        P, "subtree-" + Twine(i) + llvm::sys::path::extension(Name)
+    );
+    return P;
+  };
 
-      Files.dump(Log, log::Level::Trace, 4);
+  for (size_t i = 0, e = Subtrees.size(); i != e; ++i) {
+    auto &P = Subtrees[i];
+
+    if (P.Output.empty()) {
+      P.Output = getSubtreePath(DriverDefaults::PREAMBLE_OUT, i);
+      P.OutputMeta = getSubtreePath(DriverDefaults::PREAMBLE_OUT_META, i);
     }
-  }
 
-  Log.log_verbose(
-    "Found ", Context.ExternalPackages.size(),
-    " '.", FileExtensions::SourceCode,
-    "' files.\n" // it was meant to put extra new line here.
-  );
+    // Each subtree preamble is only rebuilt along with main one
+    // or its own source.
+    bool Updated = MainUpdated;
+    if (!buildPreambleLink(P.Source, P.Output, P.OutputMeta, ChainedOn, Updated))
+      return;
+
+    Context.SubtreePreamblesUpdated[i] = Updated;
+  }
 }
 
-void LevitationDriverImpl::setOutputFilesInfo(
-    FilesInfo &Files,
-    StringRef OutputPathWithoutExt,
-    bool SetObjectRelatedInfo
+/// Collects headers of #include directives, directives are
+/// expected to be on their own lines.
+/// \param AngledOnly whether only <...> headers should be collected.
+static void scanIncludes(
+    StringRef Source,
+    SmallVectorImpl<StringRef> &Headers,
+    bool AngledOnly = false
 ) {
-    // In current implementation package path is equal to relative source path.
-
-    Files.DeclASTMetaFile = Path::replaceExtension<SinglePath>(
-        OutputPathWithoutExt, FileExtensions::DeclASTMeta
-    );
+  while (!Source.empty()) {
+    StringRef Line;
+    std::tie(Line, Source) = Source.split('\n');
 
-    Files.LDeps = Path::replaceExtension<SinglePath>(
-        OutputPathWithoutExt, FileExtensions::ParsedDependencies
-    );
+    Line = Line.ltrim();
+    if (!Line.consume_front("#"))
+      continue;
 
-    Files.LDepsMeta = Path::replaceExtension<SinglePath>(
-        OutputPathWithoutExt, FileExtensions::ParsedDependenciesMeta
-    );
+    Line = Line.ltrim();
+    if (!Line.consume_front("include"))
+      continue;
 
-    Files.DeclAST = Path::replaceExtension<SinglePath>(
-        OutputPathWithoutExt, FileExtensions::DeclarationAST
-    );
+    Line = Line.ltrim();
+    char Close = Line.startswith("<") ? '>' : Line.startswith("\"") ? '"' : 0;
+    if (!Close || (AngledOnly && Close != '>'))
+      continue;
 
-    if (SetObjectRelatedInfo) {
-      Files.ObjMetaFile = Path::replaceExtension<SinglePath>(
-          OutputPathWithoutExt, FileExtensions::ObjMeta
-      );
-      Files.Object = Path::replaceExtension<SinglePath>(
-          OutputPathWithoutExt, FileExtensions::Object
-      );
-    }
+    auto End = Line.find(Close, 1);
+    if (End != StringRef::npos)
+      Headers.push_back(Line.slice(1, End));
+  }
 }
 
-// TODO Levitation: try to make this method const.
-bool LevitationDriverImpl::processDependencyNode(
-    const DependenciesGraph::Node &N
-) {
-  DeclASTMeta ExistingMeta;
-  if (isUpToDate(ExistingMeta, N))
-    return true;
+void LevitationDriverImpl::buildHeaderUnits() {
+  const auto &Headers = Context.Driver.HeaderUnits;
+  if (Headers.empty())
+    return;
 
-  switch (N.Kind) {
-    case DependenciesGraph::NodeKind::Declaration:
-      return processDeclaration(ExistingMeta.getDeclASTHash(), N);
-    case DependenciesGraph::NodeKind::Definition: {
-      return processDefinition(N);
-    }
-    default:
-      llvm_unreachable("Unknown dependency kind");
+  Context.HeaderUnits.assign(Headers.size(), RunContext::HeaderUnitInfo());
+  Context.HeaderUnitsUsed.clear();
+
+  TasksManager::TasksSet Tasks;
+  for (size_t i = 0, e = Headers.size(); i != e; ++i) {
+    auto TID = TM.runTask([&, i] (TasksManager::TaskContext &TC) {
+      TC.Successful = buildHeaderUnit(Headers[i], Context.HeaderUnits[i]);
+    });
+    Tasks.insert(TID);
   }
-}
 
-const FilesInfo& LevitationDriverImpl::getFilesInfoFor(
-    const DependenciesGraph::Node &N
-) const {
-  auto *FoundFiles = Context.Files.tryGet(N.LevitationUnit->UnitPath);
-  if(!FoundFiles) {
-    const auto &SrcRel = *Strings.getItem(N.LevitationUnit->UnitPath);
-    Log.log_error(
-        "Package '",
-        SrcRel,
-        "' is present in dependencies, but not found."
-    );
-    llvm_unreachable("Package not found");
+  if (!TM.waitForTasks(Tasks) || !TM.allSuccessfull(Tasks)) {
+    PreambleStatus.setFailure()
+    << "Header units: phase failed";
+    return;
   }
-  return *FoundFiles;
-}
 
-Paths LevitationDriverImpl::getFullDependencies(
-    const DependenciesGraph::Node &N,
-    const DependenciesGraph &Graph
-) const {
-  auto &FullDepsRanged = Context.DependenciesInfo->getRangedDependencies(N.ID);
+  // Only direct includes are scanned, units get header units
+  // included by their dependencies through getHeaderUnits.
+  llvm::StringMap<unsigned> HeaderIndices;
+  for (size_t i = 0, e = Headers.size(); i != e; ++i)
+    HeaderIndices.try_emplace(Headers[i], i);
 
-  Paths FullDeps;
-  for (auto RangeNID : FullDepsRanged) {
-    auto &DNode = Graph.getNode(RangeNID.second);
-    auto DepPath = *Strings.getItem(DNode.LevitationUnit->UnitPath);
+  auto &FM = CreatableSingleton<FileManager>::get();
 
-    auto &Files = Context.Files[DNode.LevitationUnit->UnitPath];
+  for (auto PackageID : Context.AllPackages) {
+    auto Buffer = FM.getBufferForFile(Context.Files[PackageID].Source);
+    if (!Buffer)
+      continue;
 
-    FullDeps.push_back(Files.DeclAST);
+    SmallVector<StringRef, 8> Included;
+    scanIncludes(Buffer.get()->getBuffer(), Included);
+
+    for (auto Header : Included) {
+      auto Found = HeaderIndices.find(Header);
+      if (Found != HeaderIndices.end())
+        Context.HeaderUnitsUsed[PackageID].push_back(Found->second);
+    }
   }
-  return FullDeps;
 }
 
-Paths LevitationDriverImpl::getIncludeSources(
-    const DependenciesGraph::Node &N,
-    const DependenciesGraph &Graph
-) const {
-  Paths Includes;
-  for (auto DepNID : N.Dependencies) {
-    auto &DNode = Graph.getNode(DepNID);
-    auto DepPath = Context.Files[DNode.LevitationUnit->UnitPath].Header;
+bool LevitationDriverImpl::buildHeaderUnit(
+    StringRef Header,
+    RunContext::HeaderUnitInfo &HU
+) {
+  // <build root>/header-units/QtCore_QString.cppl
+  std::string Name;
+  for (char C : Header)
+    Name += llvm::isAlnum(C) ? C : '_';
 
-    auto Header = Path::makeRelative<SinglePath>(
-        DepPath,
-        Context.Driver.getOutputHeadersDir()
-    );
+  HU.Source = Path::getPath<SinglePath>(
+      Context.Driver.BuildRoot, DriverDefaults::HEADER_UNITS_SUBDIR
+  );
+  llvm::sys::path::append(HU.Source, Name);
+  HU.DeclAST = Path::replaceExtension<SinglePath>(
+      HU.Source, FileExtensions::DeclarationAST
+  );
+  HU.DeclASTMetaFile = Path::replaceExtension<SinglePath>(
+      HU.Source, FileExtensions::DeclASTMeta
+  );
+  llvm::sys::path::replace_extension(HU.Source, FileExtensions::SourceCode);
 
-    Includes.emplace_back(std::move(Header));
+  // Header is not a build input of its own, so its hash goes into
+  // generated source, and source changes whenever header does.
+  // Headers which are not found in include directories (e.g. system ones)
+  // are only rebuilt along with preamble.
+  std::string HeaderHash = "<not found>";
+  auto &FM = CreatableSingleton<FileManager>::get();
+  for (const auto &Dir : Context.Driver.Includes) {
+    auto HeaderPath = Path::getPath<SinglePath>(Dir, Header);
+    llvm::MD5::MD5Result HeaderMD5;
+    if (fileExists(HeaderPath) &&
+        calcMD5FromFile(FM, HeaderMD5, HeaderPath)) {
+      HeaderHash = HeaderMD5.digest().str().str();
+      break;
+    }
   }
-  return Includes;
+
+  std::string Contents;
+  llvm::raw_string_ostream ContentsOS(Contents);
+  ContentsOS
+  << "// Header unit generated by levitation-cppl.\n"
+  << "// Header hash: " << HeaderHash << "\n"
+  << "#include <" << Header << ">\n";
+  ContentsOS.flush();
+
+  auto Existing = llvm::MemoryBuffer::getFile(HU.Source);
+  if (!Existing || Existing.get()->getBuffer() != Contents) {
+    if (Context.Driver.DryRun)
+      return true;
+
+    File F(HU.Source);
+    with (auto Scope = F.open()) {
+      Scope.getOutputStream() << Contents;
+    }
+
+    if (F.hasErrors()) {
+      Log.log_error("Failed to write header unit source '", HU.Source, "'.");
+      return false;
+    }
+  }
+
+  DeclASTMeta Meta;
+  if (
+    !Context.PreambleUpdated &&
+    isUpToDate(Meta, HU.DeclAST, HU.DeclASTMetaFile, HU.Source, Header)
+  )
+    return true;
+
+  HU.Updated = true;
+
+  auto SourceStamp = getFileStamp(HU.Source);
+
+  auto Res = Commands::buildDecl(
+      Context.Driver.BinDir,
+      Context.Driver.Includes,
+      Context.Driver.isPreambleCompilationRequested() ?
+          StringRef(Context.Driver.PreambleOutput) : StringRef(),
+      HU.DeclAST,
+      HU.DeclASTMetaFile,
+      HU.Source,
+      (Twine("header_units") + UnitIDUtils::getComponentSeparator() + Name)
+          .str(),
+      Paths(),
+      /*NameIndex=*/"",
+      Context.Driver.PortableSourcesRoot,
+      Context.Driver.StdLib,
+      Context.Driver.ExtraParseArgs,
+      GeneratedSources(),
+      Context.Driver.RemoteExecutor,
+      /*Worker=*/-1,
+      Context.Driver.isVerbose(),
+      Context.Driver.DryRun,
+      Context.Driver.Execution
+  );
+
+  if (!Res)
+    return false;
+
+  updateProductState(HU.DeclAST, HU.DeclASTMetaFile, SourceStamp);
+  return true;
 }
 
-Paths LevitationDriverImpl::getImportSources(
-    const DependenciesGraph::Node &N,
-    const DependenciesGraph &Graph
+llvm::SmallVector<unsigned, 4> LevitationDriverImpl::getHeaderUnits(
+    const DependenciesGraph::Node &N
 ) const {
-  Paths Imports;
-  for (auto DepNID : N.Dependencies) {
-    auto &DNode = Graph.getNode(DepNID);
-    auto DepPackage = *Strings.getItem(DNode.LevitationUnit->UnitPath);
+  llvm::SmallVector<unsigned, 4> Res;
+  if (Context.HeaderUnitsUsed.empty())
+    return Res;
 
-    // Remove extension, A/B/C.cppl -> A/B/C
-    DepPackage = Path::replaceExtension<SinglePath>(DepPackage, "");
+  // Dependents include whatever their dependencies include.
+  auto addUsed = [&] (StringID PackageID) {
+    auto Found = Context.HeaderUnitsUsed.find(PackageID);
+    if (Found != Context.HeaderUnitsUsed.end())
+      Res.append(Found->second.begin(), Found->second.end());
+  };
 
-    Imports.push_back(DepPackage);
+  const auto &Graph = Context.DependenciesInfo->getDependenciesGraph();
+
+  addUsed(N.LevitationUnit->UnitPath);
+  for (auto DepNID : Context.DependenciesInfo->getFullDependencies(N.ID))
+    addUsed(Graph.getNode(DepNID).LevitationUnit->UnitPath);
+
+  std::sort(Res.begin(), Res.end());
+  Res.erase(std::unique(Res.begin(), Res.end()), Res.end());
+  return Res;
+}
+
+int LevitationDriverImpl::getSubtreePreamble(StringRef Source) const {
+  const auto &Subtrees = Context.Driver.SubtreePreambles;
+  if (Subtrees.empty())
+    return -1;
+
+  auto Abs = Path::makeAbsolute<SinglePath>(Source);
+  llvm::sys::path::remove_dots(Abs, /*remove_dot_dot=*/true);
+  StringRef AbsRef = Abs;
+
+  int Found = -1;
+  size_t FoundLength = 0;
+
+  for (size_t i = 0, e = Subtrees.size(); i != e; ++i) {
+    StringRef Dir = Subtrees[i].AbsDir;
+
+    // Note, "ui" is not a parent of "uix/a.cppl".
+    if (
+      !AbsRef.startswith(Dir) ||
+      AbsRef.size() == Dir.size() ||
+      !llvm::sys::path::is_separator(AbsRef[Dir.size()])
+    )
+      continue;
+
+    if (Found == -1 || Dir.size() > FoundLength) {
+      Found = (int)i;
+      FoundLength = Dir.size();
+    }
   }
-  return Imports;
+
+  return Found;
 }
 
-bool LevitationDriverImpl::processDefinition(
-    const DependenciesGraph::Node &N
-) {
-  assert(
-      N.Kind == DependenciesGraph::NodeKind::Definition &&
-      "Only definition nodes expected here"
-  );
+StringRef LevitationDriverImpl::getPreambleSource(StringRef Source) const {
+  int Subtree = getSubtreePreamble(Source);
+  if (Subtree != -1)
+    return Context.Driver.SubtreePreambles[Subtree].Source;
+  return Context.Driver.PreambleSource;
+}
+
+StringRef LevitationDriverImpl::getPreambleOutput(StringRef Source) const {
+  int Subtree = getSubtreePreamble(Source);
+  if (Subtree != -1)
+    return Context.Driver.SubtreePreambles[Subtree].Output;
+  return Context.Driver.PreambleOutput;
+}
+
+StringRef LevitationDriverImpl::getPreambleOutputMeta(StringRef Source) const {
+  int Subtree = getSubtreePreamble(Source);
+  if (Subtree != -1)
+    return Context.Driver.SubtreePreambles[Subtree].OutputMeta;
+  return Context.Driver.isPreambleCompilationRequested() ?
+      StringRef(Context.Driver.PreambleOutputMeta) : StringRef();
+}
+
+bool LevitationDriverImpl::isPreambleUpdated(StringRef Source) const {
+  if (Context.PreambleUpdated)
+    return true;
+
+  int Subtree = getSubtreePreamble(Source);
+  return Subtree != -1 && Context.SubtreePreamblesUpdated[Subtree];
+}
+
+void LevitationDriverImpl::checkSubtreePreambles() {
+  const auto &Subtrees = Context.Driver.SubtreePreambles;
+  if (Subtrees.empty() || !Status.isValid())
+    return;
 
   const auto &Graph = Context.DependenciesInfo->getDependenciesGraph();
-  const auto &Files = getFilesInfoFor(N);
 
-  Paths fullDependencies = getFullDependencies(N, Graph);
+  for (const auto &NodeIt : Graph.allNodes()) {
+    const auto &N = *NodeIt.second;
+    int Preamble = getSubtreePreamble(getFilesInfoFor(N).Source);
 
-  setObjectsUpdated();
+    for (auto DepID : N.Dependencies) {
+      int DepPreamble = getSubtreePreamble(
+          getFilesInfoFor(Graph.getNode(DepID)).Source
+      );
 
-  StringRef UnitID = *Strings.getItem(N.LevitationUnit->UnitPath);
+      // Declarations of dependency refer to its preamble,
+      // so it must be loaded by dependent as well.
+      if (DepPreamble != -1 && DepPreamble != Preamble) {
+        Status.setFailure()
+        << Graph.nodeDescrShort(N.ID, Strings) << " depends on "
+        << Graph.nodeDescrShort(DepID, Strings) << ", which uses preamble '"
+        << Subtrees[DepPreamble].Source << "' of '"
+        << Subtrees[DepPreamble].Dir << "'.";
+        return;
+      }
+    }
+  }
+}
+
+bool LevitationDriverImpl::buildPreambleLink(
+    StringRef Source,
+    StringRef Output,
+    StringRef OutputMeta,
+    StringRef ChainedOn,
+    bool &ChainUpdated
+) {
+  DeclASTMeta Meta;
+  if (!ChainUpdated && isUpToDate(Meta, Output, OutputMeta, Source, Source))
+    return true;
 
-  return Commands::buildObject(
+  ChainUpdated = true;
+
+  auto SourceStamp = getFileStamp(Source);
+
+  auto Res = Commands::buildPreamble(
     Context.Driver.BinDir,
     Context.Driver.Includes,
-    Context.Driver.PreambleOutput,
-    Files.Object,
-    Files.ObjMetaFile,
-    Files.Source,
-    UnitID,
-    fullDependencies,
+    Source,
+    Output,
+    OutputMeta,
+    ChainedOn,
     Context.Driver.StdLib,
-    Context.Driver.ExtraParseArgs,
-    Context.Driver.ExtraCodeGenArgs,
+    Context.Driver.ExtraPreambleArgs,
     Context.Driver.isVerbose(),
-    Context.Driver.DryRun
+    Context.Driver.DryRun,
+    Context.Driver.Execution
   );
+
+  if (!Res) {
+    PreambleStatus.setFailure()
+    << "Preamble: phase failed";
+    return false;
+  }
+
+  updateProductState(Output, OutputMeta, SourceStamp);
+  return true;
 }
 
-bool LevitationDriverImpl::processDeclaration(
-    HashRef OldDeclASTHash,
-    const DependenciesGraph::Node &N
-) {
-  const auto &Graph = Context.DependenciesInfo->getDependenciesGraph();
-  const auto &Files = getFilesInfoFor(N);
-  Paths fullDependencies = getFullDependencies(N, Graph);
+void LevitationDriverImpl::runParseImport() {
 
-  bool NeedDeclAST = true;
+  // Dry run produces no .ldeps to follow, and without libraries
+  // there is nothing to skip.
+  if (Context.Driver.DryRun || Context.ExternalPackages.empty()) {
+    if (!parseImports(Context.AllPackages))
+      Status.setFailure()
+      << "Parse: phase failed.";
+    return;
+  }
 
-  if (N.DependentNodes.empty() && !Graph.isPublic(N.ID)) {
-    with (auto verb = Log.acquire(log::Level::Verbose)) {
-      auto &Verbose = verb.s;
-      Verbose << "TODO: Skip building unused declaration for ";
-      Graph.dumpNodeShort(Verbose, N.ID, Strings);
-      Verbose << "\n";
+  // Project units are parsed first, then library units they import,
+  // and so on, until there is nothing new. Libraries may be much larger
+  // than part of them project uses, the rest is never parsed.
+  PathIDsSet Wave, Reached;
+  for (auto PackageID : Context.AllPackages)
+    if (!Context.ExternalPackages.count(PackageID))
+      Wave.insert(PackageID);
+
+  while (!Wave.empty()) {
+    if (!parseImports(Wave)) {
+      Status.setFailure()
+      << "Parse: phase failed.";
+      return;
     }
 
-    // TODO Levitation: see #48
-    // NeedDeclAST = false;
+    PathIDsSet Imported;
+    collectImportedLibraries(Wave, Reached, Imported);
+    Wave = std::move(Imported);
   }
 
-  StringRef UnitID = *Strings.getItem(N.LevitationUnit->UnitPath);
+  removeUnreachedLibraries(Reached);
+}
 
-  // Check whether we also will compile a definition,
-  // in this case both phases may produce same warnings,
-  // so suppress warnings for declaration.
-  //
-  // NOTE: this is only actual unless we change parsing workflow.
-  // In future I hope to parse definition with preincluded
-  // parsed declaratino AST, in this case we should change this behaviour.
-  bool SuppressLevitationWarnings = N.LevitationUnit->Definition != nullptr;
-  auto ExtraArgs = Context.Driver.ExtraParseArgs;
-  if (SuppressLevitationWarnings)
-    ExtraArgs.emplace_back("-Wno-everything");
+void LevitationDriverImpl::collectImportedLibraries(
+    const PathIDsSet &Packages,
+    PathIDsSet &Reached,
+    PathIDsSet &Imported
+) {
+  for (auto PackageID : Packages) {
+    DependenciesData Data;
 
-  bool buildDeclSuccessfull = Commands::buildDecl(
-      Context.Driver.BinDir,
-      Context.Driver.Includes,
-      Context.Driver.PreambleOutput,
-      (NeedDeclAST ? Files.DeclAST.str() : StringRef()),
-      (NeedDeclAST ? Files.DeclASTMetaFile.str() : StringRef()),
-      Files.Source,
-      UnitID,
-      fullDependencies,
-      Context.Driver.StdLib,
-      ExtraArgs,
-      Context.Driver.isVerbose(),
-      Context.Driver.DryRun
+    // Solver reports broken .ldeps later.
+    if (!DependenciesSolver::loadDependencies(
+        Data, Context.Files[PackageID].LDeps
+    ))
+      continue;
+
+    for (const auto *Deps : {
+      &Data.DeclarationDependencies, &Data.DefinitionDependencies
+    }) {
+      for (const auto &Dep : *Deps) {
+        auto DepID = Strings.addItem(*Data.Strings->getItem(Dep.UnitIdentifier));
+        if (Context.ExternalPackages.count(DepID) && Reached.insert(DepID).second)
+          Imported.insert(DepID);
+      }
+    }
+  }
+}
+
+void LevitationDriverImpl::removeUnreachedLibraries(const PathIDsSet &Reached) {
+  std::vector<StringID> Unreached;
+  for (auto PackageID : Context.ExternalPackages)
+    if (!Reached.count(PackageID))
+      Unreached.push_back(PackageID);
+
+  if (Unreached.empty())
+    return;
+
+  for (auto PackageID : Unreached) {
+    Context.ExternalPackages.erase(PackageID);
+    Context.AllPackages.erase(PackageID);
+    Context.UnreachedLibraries.insert(
+        PackageID, Context.Files.take(PackageID)
+    );
+  }
+
+  Log.log_verbose(
+      "Skipped ", Unreached.size(), " library unit(s) project doesn't import."
   );
+}
 
-  if (!buildDeclSuccessfull)
-    return false;
+bool LevitationDriverImpl::parseImports(const PathIDsSet &Packages) {
+  auto &TM = TasksManager::get();
 
-  bool MustGenerateHeaders =
-      Context.Driver.shouldCreateHeaders() &&
-      Graph.isPublic(N.ID);
+  TasksManager::TasksSet ParseTasks;
 
-  bool MustGenerateDecl =
-      Context.Driver.shouldCreateDecls() &&
-      Graph.isPublic(N.ID) &&
-      !Graph.isExternal(N.ID);
+  // Sources import scanner can't handle, in batch mode.
+  struct PendingParse {
+    StringID PackagePath;
+    std::string Key;
+    llvm::Optional<BuildState::FileStamp> SourceStamp;
+  };
+  std::vector<PendingParse> Pending;
+  std::mutex PendingMutex;
 
-  DeclASTMeta Meta;
-  if (!DeclASTMetaLoader::fromFile(
-      Meta, Context.Driver.BuildRoot, Files.DeclASTMetaFile
-  ))
-    return false;
+  bool BatchMode = Context.Driver.ParseImportBatchSize > 1;
 
-  bool Success = true;
+  for (auto PackagePath : Packages) {
 
-  if (MustGenerateHeaders) {
+    auto &Files = Context.Files[PackagePath];
 
-    assert(!Files.Header.empty());
+    DeclASTMeta ldepsMeta;
 
-    auto IncludeSources = getIncludeSources(N, Graph);
-    Success = HeaderGenerator(
-        *Strings.getItem(N.LevitationUnit->UnitPath),
-        Files.Header,
+    if (isUpToDate(
+        ldepsMeta,
+        Files.LDeps,
+        Files.LDepsMeta,
         Files.Source,
-        N.Dependencies.empty() ? Context.Driver.PreambleSource : "",
-        IncludeSources,
-        Meta.getFragmentsToSkip(),
-        Context.Driver.isVerbose(),
-        Context.Driver.DryRun
-    )
-    .execute();
-  }
+        Files.LDeps /* item description */
+    )) {
+      if (Streaming)
+        streamLDeps(PackagePath);
+      continue;
+    }
 
-  if (MustGenerateDecl) {
+    Context.UpdatedLDeps.insert(PackagePath);
 
-    assert(!Files.Decl.empty());
+    auto TID = TM.runTask([=, &Pending, &PendingMutex] (
+        TasksManager::TaskContext &TC
+    ) {
+      // Other invocation on same build root may be parsing same source.
+      ArtifactLock Lock;
+      if (
+        Context.Driver.SharedBuildRoot &&
+        !Context.Driver.DryRun &&
+        lockProduct(Lock, Files.LDeps, Files.LDepsMeta)
+      ) {
+        DeclASTMeta LockedMeta;
+        if (isUpToDate(
+            LockedMeta, Files.LDeps, Files.LDepsMeta, Files.Source, Files.LDeps
+        )) {
+          TC.Successful = true;
+          if (Streaming)
+            streamLDeps(PackagePath);
+          return;
+        }
+      }
 
-    auto DeclSources = getImportSources(N, Graph);
+      auto SourceStamp = getFileStamp(Files.Source);
+
+      std::string Key;
+      bool Postponed = false;
+
+      TC.Successful = runTimed(
+          BuildHistory::StepKind::ParseImport,
+          *Strings.getItem(PackagePath),
+          [&] {
+            Key = getCacheKey(
+                "ldeps", Files.Source, {}, Context.Driver.ExtraParseImportArgs,
+                /*UsesPreamble=*/false
+            );
+            auto LibraryKey = getLibraryCacheKey(
+                "ldeps", *Strings.getItem(PackagePath), Files.Source, {},
+                Context.Driver.ExtraParseImportArgs, /*UsesPreamble=*/false
+            );
+            BuildCache::Artifact Artifacts[] = {
+                {"ldeps", Files.LDeps}, {"meta", Files.LDepsMeta}
+            };
+            return LibraryCache::get().fetchOrFill(LibraryKey, Artifacts, [&] {
+              return runCached(Key, Artifacts, [&] {
+                if (
+                  Context.Driver.ImportScannerEnabled &&
+                  !Context.Driver.DryRun &&
+                  Commands::scanImport(
+                      Files.LDeps,
+                      Files.LDepsMeta,
+                      Files.Source
+                  )
+                )
+                  return true;
+
+                // Library cache entry is filled right away,
+                // so library units are not batched.
+                if (BatchMode && LibraryKey.empty()) {
+                  Postponed = true;
+                  return false;
+                }
+
+                return Commands::parseImport(
+                    Context.Driver.BinDir,
+                    Files.LDeps,
+                    Files.LDepsMeta,
+                    Files.Source,
+                    Context.Driver.SourcesRoot,
+                    Context.Driver.ExtraParseImportArgs,
+                    Context.Driver.isVerbose(),
+                    Context.Driver.DryRun,
+                    Context.Driver.Execution
+                );
+              });
+            });
+          }
+      );
 
-    Success = HeaderGenerator(
-        *Strings.getItem(N.LevitationUnit->UnitPath),
-        Files.Decl,
-        Files.Source,
-        N.Dependencies.empty() ? Context.Driver.PreambleSource : "",
-        DeclSources,
-        Meta.getFragmentsToSkip(),
-        Context.Driver.isVerbose(),
-        Context.Driver.DryRun,
-        /*import*/true
-    )
-    .execute();
-  }
+      if (Postponed) {
+        with (auto _ = lock(PendingMutex)) {
+          Pending.push_back({PackagePath, Key, SourceStamp});
+        }
+        TC.Successful = true;
+        return;
+      }
 
-  // Mark that node was updated, if it was updated
+      if (TC.Successful) {
+        updateProductState(Files.LDeps, Files.LDepsMeta, SourceStamp);
+        if (Streaming)
+          streamLDeps(PackagePath);
+      }
+    });
 
-  if (!equal(OldDeclASTHash, Meta.getDeclASTHash()))
-    setNodeUpdated(N.ID);
-  else {
-    with (auto verb = Log.acquire(log::Level::Verbose)) {
-      auto &Verbose = verb.s;
-      Verbose << "Node ";
-      Graph.dumpNodeShort(Verbose, N.ID, Strings);
-      Verbose << " is up-to-date.\n";
-    }
+    ParseTasks.insert(TID);
   }
 
-  return Success;
-}
+  // Preamble may still be in progress, so only wait for our own tasks.
+  auto Res = TM.waitForTasks(ParseTasks) && TM.allSuccessfull(ParseTasks);
 
-bool LevitationDriverImpl::isUpToDate(
-    DeclASTMeta &Meta,
-    const DependenciesGraph::Node &N
-) {
-  if (Context.PreambleUpdated)
-    return false;
+  if (Res && Pending.size()) {
+    std::sort(Pending.begin(), Pending.end(), [&] (
+        const PendingParse &L, const PendingParse &R
+    ) {
+      return *Strings.getItem(L.PackagePath) < *Strings.getItem(R.PackagePath);
+    });
 
-  for (auto D : N.Dependencies)
-    if (Context.UpdatedNodes.count(D))
-      return false;
+    Log.log_verbose("Parse import: ", Pending.size(), " sources in batches.");
 
-  const auto &Files = getFilesInfoFor(N);
+    TasksManager::TasksSet BatchTasks;
+    size_t BatchSize = (size_t)Context.Driver.ParseImportBatchSize;
 
-  StringRef MetaFile;
-  StringRef ProductFile;
+    for (size_t Start = 0; Start < Pending.size(); Start += BatchSize) {
+      auto Batch = llvm::makeArrayRef(Pending).slice(
+          Start, std::min(BatchSize, Pending.size() - Start)
+      );
 
-  switch (N.Kind) {
-    case DependenciesGraph::NodeKind::Declaration:
-      MetaFile = Files.DeclASTMetaFile;
-      ProductFile = Files.DeclAST;
-      break;
-    case DependenciesGraph::NodeKind::Definition:
-      MetaFile = Files.ObjMetaFile;
-      ProductFile = Files.Object;
-      break;
-    default:
-      return false;
-  }
+      auto TID = TM.runTask([=] (TasksManager::TaskContext &TC) {
+        Paths Sources, LDeps, Metas;
+        for (const auto &P : Batch) {
+          const auto &Files = Context.Files[P.PackagePath];
+          Sources.push_back(Files.Source);
+          LDeps.push_back(Files.LDeps);
+          Metas.push_back(Files.LDepsMeta);
+        }
 
-  auto NodeDescr = Context.DependenciesInfo->getDependenciesGraph()
-      .nodeDescrShort(N.ID, Strings);
+        TC.Successful = Commands::parseImportBatch(
+            Context.Driver.BinDir,
+            LDeps,
+            Metas,
+            Sources,
+            Context.Driver.ExtraParseImportArgs,
+            Context.Driver.isVerbose(),
+            Context.Driver.DryRun,
+            Context.Driver.Execution
+        );
+
+        if (!TC.Successful)
+          return;
+
+        for (const auto &P : Batch) {
+          const auto &Files = Context.Files[P.PackagePath];
+
+          if (P.Key.size())
+            storeInCache(
+                P.Key, {{"ldeps", Files.LDeps}, {"meta", Files.LDepsMeta}}
+            );
 
-  return isUpToDate(Meta, ProductFile, MetaFile, Files.Source, NodeDescr);
+          updateProductState(Files.LDeps, Files.LDepsMeta, P.SourceStamp);
+          if (Streaming)
+            streamLDeps(P.PackagePath);
+        }
+      });
+
+      BatchTasks.insert(TID);
+    }
+
+    Res = TM.waitForTasks(BatchTasks) && TM.allSuccessfull(BatchTasks);
+  }
+
+  return Res;
 }
 
-bool LevitationDriverImpl::isUpToDate(
-    DeclASTMeta &Meta,
-    llvm::StringRef ProductFile,
-    llvm::StringRef MetaFile,
-    llvm::StringRef SourceFile,
-    llvm::StringRef ItemDescr
+void LevitationDriverImpl::solveDependencies() {
+  if (!Status.isValid())
+    return;
+
+  DependenciesSolver Solver;
+  Solver.setSourcesRoot(Context.Driver.SourcesRoot);
+  Solver.setBuildRoot(Context.Driver.BuildRoot);
+  Solver.setVerbose(Context.Driver.isVerbose());
+
+  if (Context.ParsedDeps && Context.DependenciesInfo)
+    Solver.setPreviousResult(
+        std::move(Context.ParsedDeps),
+        std::move(Context.DependenciesInfo),
+        Context.UpdatedLDeps
+    );
+
+  loadDependenciesIndex();
+
+  Solver.setIndex(*Context.DepsIndex, [&] (StringID PackageID) {
+    HashVectorTy Hash;
+    const auto *Files = Context.Files.tryGet(PackageID);
+    if (!Files)
+      return Hash;
+
+    with (auto _ = lock(Context.StateMutex)) {
+      if (const auto *S = Context.State.get(Files->LDeps))
+        Hash = S->SourceHash;
+    }
+    return Hash;
+  });
+
+  if (Context.Driver.PrivateImports)
+    Solver.setRefine([&] (ParsedDependencies &Deps) {
+      inferPrivateImports(Deps);
+    });
+
+  Context.DependenciesInfo = Solver.solve(
+      Context.ExternalPackages,
+      Context.Files
+  );
+
+  Context.ParsedDeps = Solver.getParsedDependencies();
+  Context.UpdatedLDeps.clear();
+
+  Status.inheritResult(Solver, "Dependencies solver: ");
+
+  saveDependenciesIndex();
+}
+
+void LevitationDriverImpl::loadDependenciesIndex() {
+  // Watch mode keeps index between builds.
+  if (Context.DepsIndex)
+    return;
+
+  Context.DepsIndex = std::make_shared<DependenciesIndex>();
+
+  auto IndexFile = levitation::Path::getPath<SinglePath>(
+      Context.Driver.BuildRoot,
+      DriverDefaults::DEPENDENCIES_INDEX
+  );
+
+  if (!fileExists(IndexFile))
+    return;
+
+  // Broken index only means that .ldeps will be loaded instead.
+  auto Res = Context.DepsIndex->load(IndexFile);
+  if (!Res.isValid())
+    Log.log_warning(
+        "Failed to read dependencies index '", IndexFile, "': ",
+        Res.getErrorMessage()
+    );
+}
+
+void LevitationDriverImpl::saveDependenciesIndex() {
+  if (
+    Context.Driver.DryRun ||
+    !Context.DepsIndex ||
+    !Context.DepsIndex->isChanged()
+  )
+    return;
+
+  auto IndexFile = levitation::Path::getPath<SinglePath>(
+      Context.Driver.BuildRoot,
+      DriverDefaults::DEPENDENCIES_INDEX
+  );
+
+  auto Res = Context.DepsIndex->save(IndexFile);
+  if (!Res.isValid())
+    Log.log_warning(Res.getErrorMessage());
+}
+
+void LevitationDriverImpl::codeGen() {
+  if (!Status.isValid())
+    return;
+
+  if (Context.Driver.ProfileUse.size() && !Context.Driver.DryRun) {
+    llvm::MD5::MD5Result ProfileMD5;
+    auto &FM = CreatableSingleton<FileManager>::get();
+    if (!calcMD5FromFile(FM, ProfileMD5, Context.Driver.ProfileUse)) {
+      Status.setFailure()
+      << "Failed to read profile '" << Context.Driver.ProfileUse << "'";
+      return;
+    }
+    Context.ProfileUseHash = ("profile-md5=" + ProfileMD5.digest()).str();
+  }
+
+  if (!prepareHotUnits()) {
+    Status.setFailure()
+    << "Failed to classify units by '" << Context.Driver.HotUnitsFile << "'";
+    return;
+  }
+
+  auto &Graph = Context.DependenciesInfo->getDependenciesGraph();
+
+  if (Context.Driver.RemoteExecutor.size() && Context.Driver.RemoteWorkers > 1)
+    Context.Workers = Context.DependenciesInfo->partitionWorkers(
+        Context.Driver.RemoteWorkers,
+        [&] (const DependenciesGraph::Node &N) {
+          // Zero weight nodes are not placed.
+          return std::max<BuildHistory::DurationTy>(getExpectedDuration(N), 1);
+        }
+    );
+
+  // In unity mode definitions are postponed until all declarations
+  // are built, nothing depends on them anyway.
+  NodesVectorTy UnityDefinitions;
+  std::mutex UnityMutex;
+
+  if (Context.Driver.Targets.size() && !selectTargetNodes())
+    return;
+
+  if (Context.Driver.NumShards)
+    selectShardNodes();
+
+  restoreJournalNodes();
+
+  precheckNodes();
+
+  // Nothing may be rebuilt, so there is nothing to schedule.
+  if (
+    Context.NodesPrechecked &&
+    Context.DirtyNodes.empty() &&
+    !Context.Driver.KeepIR
+  ) {
+    Log.log_verbose("All nodes are up-to-date.");
+    return;
+  }
+
+  bool HasProgress = startProgress();
+  auto ClearStatus = llvm::make_scope_exit([&] {
+    if (ShowProgress)
+      Log.clearStatus();
+  });
+
+  auto OnNode = [&] (const DependenciesGraph::Node &N) {
+    if (!isSelected(N.ID))
+      return true;
+
+    if (
+      Context.Driver.Unity &&
+      N.Kind == DependenciesGraph::NodeKind::Definition
+    ) {
+      with (auto _ = lock(UnityMutex)) {
+        UnityDefinitions.push_back(&N);
+      }
+      return true;
+    }
+
+    if (HasProgress)
+      reportProgress(N, BuildProgress::EventKind::Started);
+
+    bool Res = processDependencyNode(N);
+
+    if (HasProgress)
+      reportProgress(N, BuildProgress::EventKind::Finished);
+
+    if (Context.Driver.Numa)
+      recordNodeDomain(N);
+    return Res;
+  };
+
+  std::function<int(const DependenciesGraph::Node&)> Domain;
+  if (Context.Driver.Numa && TasksManager::get().getNumDomains() > 1)
+    Domain = [&] (const DependenciesGraph::Node &N) {
+      return getPreferredDomain(N);
+    };
+
+  bool Speculate =
+      Context.Driver.RemoteExecutor.size() && Context.Driver.SpeculateAfter;
+
+  DependenciesGraph::NodesWeights Priorities;
+  if (
+    Speculate ||
+    Context.Driver.JobPriorities ||
+    Context.Driver.getSchedule() == LevitationDriver::SchedulingMode::CriticalPath
+  )
+    Priorities = Graph.calcCriticalPaths(
+        [&] (const DependenciesGraph::Node &N) {
+          // Up-to-date nodes cost nothing, critical path
+          // only goes through nodes which are to be rebuilt.
+          if (isPrecheckedClean(N.ID))
+            return (BuildHistory::DurationTy)0;
+          return getExpectedDuration(N);
+        }
+    );
+
+  Context.CriticalNodes.clear();
+  if (Speculate || Context.Driver.JobPriorities) {
+    uint64_t Longest = 0;
+    for (const auto &NP : Priorities)
+      Longest = std::max(Longest, NP.second);
+
+    // Nodes on paths at least half as long as longest one.
+    for (const auto &NP : Priorities)
+      if (NP.second * 2 >= Longest)
+        Context.CriticalNodes.insert(NP.first);
+  }
+
+  // Focused nodes outrank any critical path, and keep
+  // critical path order among themselves.
+  DependenciesGraph::NodesSet Focused;
+  if (Context.Driver.getSchedule() != LevitationDriver::SchedulingMode::DepthFirst)
+    collectFocusedNodes(Focused);
+
+  const uint64_t FocusBoost = 1ULL << 62;
+  for (auto NID : Focused)
+    Priorities[NID] += FocusBoost;
+
+  bool Res;
+
+  switch (Context.Driver.getSchedule()) {
+    case LevitationDriver::SchedulingMode::DepthFirst:
+      Res = Graph.dsfJobs(OnNode);
+      break;
+    case LevitationDriver::SchedulingMode::ReadyQueue:
+      Res = Graph.readyQueueJobs(
+          OnNode, Focused.size() ? &Priorities : nullptr, std::move(Domain)
+      );
+      break;
+    case LevitationDriver::SchedulingMode::CriticalPath:
+      Res = Graph.readyQueueJobs(OnNode, &Priorities, std::move(Domain));
+      break;
+    default:
+      llvm_unreachable("Unknown scheduling mode.");
+  }
+
+  if (Res && UnityDefinitions.size())
+    Res = runUnityBatches(UnityDefinitions);
+
+  if (!Res)
+    Status.setFailure()
+    << "Instantiate and codegen: phase failed.";
+}
+
+bool LevitationDriverImpl::findTargets(
+    SmallVectorImpl<DependenciesGraph::NodeID::Type> &Defs
+) {
+  const auto &Graph = Context.DependenciesInfo->getDependenciesGraph();
+
+  llvm::StringMap<DependenciesGraph::NodeID::Type> Found;
+  for (const auto &NodeIt : Graph.allNodes()) {
+    const auto &N = *NodeIt.second;
+    if (N.Kind == DependenciesGraph::NodeKind::Definition)
+      Found[*Strings.getItem(N.LevitationUnit->UnitPath)] = N.ID;
+  }
+
+  SmallVector<StringRef, 4> Missing;
+  for (auto Target : Context.Driver.Targets) {
+    auto It = Found.find(Target);
+    if (It != Found.end())
+      Defs.push_back(It->second);
+    else
+      Missing.push_back(Target);
+  }
+
+  if (Missing.empty())
+    return true;
+
+  auto Err = Status.setFailure();
+  Err << "Targets not found:";
+  for (auto T : Missing)
+    Err << " '" << T << "'";
+  Err << ". Target should be ID of unit with definition.";
+  return false;
+}
+
+void LevitationDriverImpl::collectLinkClosure(
+    DependenciesGraph::NodeID::Type DefID,
+    DependenciesGraph::NodesSet &Closure
+) const {
+  using NodeKind = DependenciesGraph::NodeKind;
+  using NodeID = DependenciesGraph::NodeID;
+
+  const auto &Info = *Context.DependenciesInfo;
+  const auto &Graph = Info.getDependenciesGraph();
+
+  // Objects of every unit whose declaration is used
+  // are needed to link target.
+  SmallVector<NodeID::Type, 16> Worklist = { DefID };
+  while (!Worklist.empty()) {
+    auto NID = Worklist.pop_back_val();
+    if (!Closure.insert(NID).second)
+      continue;
+
+    for (auto DepID : Info.getFullDependencies(NID)) {
+      Closure.insert(DepID);
+
+      auto DepDefID = NodeID::get(
+          NodeKind::Definition, NodeID::getKindAndPathID(DepID).second
+      );
+      if (Graph.allNodes().count(DepDefID) && !Closure.count(DepDefID))
+        Worklist.push_back(DepDefID);
+    }
+  }
+}
+
+bool LevitationDriverImpl::selectTargetNodes() {
+  SmallVector<DependenciesGraph::NodeID::Type, 4> TargetDefs;
+  if (!findTargets(TargetDefs))
+    return false;
+
+  Context.SelectedNodes.clear();
+  for (auto DefID : TargetDefs)
+    collectLinkClosure(DefID, Context.SelectedNodes);
+
+  Log.log_verbose(
+      "Targets: ", Context.SelectedNodes.size(), " of ",
+      Context.DependenciesInfo->getDependenciesGraph().getNumNodes(),
+      " node(s) selected."
+  );
+
+  return true;
+}
+
+void LevitationDriverImpl::collectFocusedNodes(
+    DependenciesGraph::NodesSet &Focused
 ) {
-  if (!llvm::sys::fs::exists(MetaFile))
+  const auto &Driver = Context.Driver;
+  const auto &Info = *Context.DependenciesInfo;
+  const auto &Graph = Info.getDependenciesGraph();
+
+  llvm::StringSet<> Units;
+  for (auto UnitID : Driver.FocusUnits)
+    Units.insert(UnitID);
+
+  if (Driver.FocusFile.size()) {
+    if (auto Buf = llvm::MemoryBuffer::getFile(Driver.FocusFile)) {
+      SmallVector<StringRef, 8> Lines;
+      (*Buf)->getBuffer().split(Lines, '\n', -1, /*KeepEmpty=*/false);
+      for (auto L : Lines) {
+        L = L.trim();
+        if (L.size() && !L.startswith("#"))
+          Units.insert(L);
+      }
+    } else
+      Log.log_verbose("Focus file '", Driver.FocusFile, "' is not found.");
+  }
+
+  for (const auto &NodeIt : Graph.allNodes()) {
+    const auto &N = *NodeIt.second;
+    if (!N.LevitationUnit)
+      continue;
+
+    bool IsFocused = Units.count(*Strings.getItem(N.LevitationUnit->UnitPath));
+
+    // In watch mode units which were just saved are likely
+    // the ones being edited.
+    if (!IsFocused && Context.ChangedSources.size()) {
+      if (auto *Files = Context.Files.tryGet(N.LevitationUnit->UnitPath))
+        IsFocused = isChangedSource(Files->Source);
+    }
+
+    if (!IsFocused)
+      continue;
+
+    Focused.insert(N.ID);
+    for (auto DepID : Info.getFullDependencies(N.ID))
+      Focused.insert(DepID);
+  }
+
+  if (Focused.size())
+    Log.log_verbose("Focused: ", Focused.size(), " node(s).");
+}
+
+bool LevitationDriverImpl::suggestPreamble() {
+  using NodeKind = DependenciesGraph::NodeKind;
+
+  const auto &Driver = Context.Driver;
+
+  collectSources();
+  loadBuildState();
+  extractBundles();
+
+  // Parse-import is not run, so graph is made of .ldeps
+  // of previous build.
+  solveDependencies();
+
+  if (!Status.isValid()) {
+    Log.log_error(Status.getErrorMessage());
+    return false;
+  }
+
+  auto &FM = CreatableSingleton<FileManager>::get();
+
+  // Headers each package includes directly.
+  llvm::DenseMap<StringID, SmallVector<std::string, 8>> PackageHeaders;
+  for (auto PackageID : Context.AllPackages) {
+    auto Buffer = FM.getBufferForFile(Context.Files[PackageID].Source);
+    if (!Buffer)
+      continue;
+
+    SmallVector<StringRef, 8> Headers;
+    scanIncludes(Buffer.get()->getBuffer(), Headers, /*AngledOnly=*/true);
+
+    auto &Dest = PackageHeaders[PackageID];
+    for (auto H : Headers)
+      Dest.push_back(H.str());
+  }
+
+  // Includes of unit are parsed by each job of unit and its
+  // dependents, so header is counted once per job which parses it.
+  const auto &Graph = Context.DependenciesInfo->getDependenciesGraph();
+  llvm::StringMap<unsigned> Uses;
+  unsigned NumJobs = 0;
+
+  for (const auto &NodeIt : Graph.allNodes()) {
+    const auto &N = *NodeIt.second;
+    if (Graph.isExternal(N.ID) && N.Kind == NodeKind::Definition)
+      continue;
+
+    ++NumJobs;
+
+    llvm::StringSet<> Parsed;
+    auto addHeaders = [&] (StringID PackageID) {
+      auto Found = PackageHeaders.find(PackageID);
+      if (Found != PackageHeaders.end())
+        for (const auto &H : Found->second)
+          Parsed.insert(H);
+    };
+
+    addHeaders(N.LevitationUnit->UnitPath);
+    for (auto DepID : Context.DependenciesInfo->getFullDependencies(N.ID))
+      addHeaders(Graph.getNode(DepID).LevitationUnit->UnitPath);
+
+    for (const auto &H : Parsed)
+      ++Uses[H.first()];
+  }
+
+  // Includes of current preamble are kept as is, since
+  // there is no way to tell whether units rely on them.
+  SmallVector<std::string, 16> Kept;
+  llvm::StringSet<> KeptSet;
+  if (Driver.isPreambleCompilationRequested()) {
+    if (auto Buffer = FM.getBufferForFile(Driver.PreambleSource)) {
+      SmallVector<StringRef, 16> Headers;
+      scanIncludes(Buffer.get()->getBuffer(), Headers, /*AngledOnly=*/true);
+      for (auto H : Headers)
+        if (KeptSet.insert(H).second)
+          Kept.push_back(H.str());
+    }
+  }
+
+  struct Candidate {
+    std::string Header;
+    unsigned Uses;
+    double ParseTime = 0.;
+    bool Parsed = false;
+  };
+
+  std::vector<Candidate> Candidates;
+  for (const auto &U : Uses)
+    if (!KeptSet.count(U.first()))
+      Candidates.push_back({U.first().str(), U.second});
+
+  std::sort(Candidates.begin(), Candidates.end(), [] (
+      const Candidate &L, const Candidate &R
+  ) {
+    return L.Header < R.Header;
+  });
+
+  Log.log_verbose(
+      "Measuring parse time of ", Candidates.size(), " header(s)..."
+  );
+
+  auto ProbesDir = Path::getPath<SinglePath>(
+      Driver.BuildRoot, DriverDefaults::HEADER_UNITS_SUBDIR
+  );
+  llvm::sys::path::append(ProbesDir, "suggest-preamble");
+
+  TasksManager::TasksSet Tasks;
+  for (size_t i = 0, e = Candidates.size(); i != e; ++i) {
+    auto TID = TM.runTask([&, i] (TasksManager::TaskContext &TC) {
+      auto &C = Candidates[i];
+
+      SinglePath Probe = ProbesDir;
+      llvm::sys::path::append(Probe, std::to_string(i));
+      llvm::sys::path::replace_extension(Probe, "cpp");
+
+      File F(Probe);
+      with (auto Scope = F.open()) {
+        Scope.getOutputStream() << "#include <" << C.Header << ">\n";
+      }
+
+      TC.Successful = true;
+      if (F.hasErrors())
+        return;
+
+      auto Start = std::chrono::steady_clock::now();
+      C.Parsed = Commands::parseOnly(
+          Driver.BinDir, Driver.Includes, Probe, Driver.StdLib,
+          Driver.isVerbose(), Driver.Execution
+      );
+      C.ParseTime = std::chrono::duration<double>(
+          std::chrono::steady_clock::now() - Start
+      ).count();
+
+      llvm::sys::fs::remove(Probe);
+    });
+    Tasks.insert(TID);
+  }
+  TM.waitForTasks(Tasks);
+
+  // Precompiled declarations are loaded lazily, so preamble costs
+  // each job a fraction of header's parse time, rather than
+  // nothing. Header is worth it if it saves more than it costs.
+  const double LoadCostRatio = 0.05;
+
+  std::vector<const Candidate*> Suggested;
+  for (const auto &C : Candidates) {
+    if (!C.Parsed) {
+      Log.log_verbose("  <", C.Header, ">: can't be parsed alone, skipped.");
+      continue;
+    }
+
+    double Benefit = C.Uses * C.ParseTime;
+    double Cost = NumJobs * C.ParseTime * LoadCostRatio;
+
+    Log.log_verbose(
+        "  <", C.Header, ">: parsed by ", C.Uses, " of ", NumJobs,
+        " job(s), ", (unsigned)(C.ParseTime * 1000), " ms each."
+    );
+
+    if (Benefit > Cost)
+      Suggested.push_back(&C);
+  }
+
+  // Most expensive headers go first.
+  std::stable_sort(Suggested.begin(), Suggested.end(), [] (
+      const Candidate *L, const Candidate *R
+  ) {
+    return L->Uses * L->ParseTime > R->Uses * R->ParseTime;
+  });
+
+  File Out(Driver.SuggestPreamble);
+  with (auto Scope = Out.open()) {
+    auto &OS = Scope.getOutputStream();
+    OS << "// Preamble suggested by levitation-cppl --suggest-preamble.\n";
+
+    if (Kept.size()) {
+      OS << "\n// Kept from '" << Driver.PreambleSource << "'.\n";
+      for (const auto &H : Kept)
+        OS << "#include <" << H << ">\n";
+    }
+
+    if (Suggested.size()) {
+      OS << "\n";
+      for (const auto *C : Suggested)
+        OS
+        << "#include <" << C->Header << "> // "
+        << C->Uses << "/" << NumJobs << " jobs, "
+        << (unsigned)(C->ParseTime * 1000) << " ms\n";
+    }
+  }
+
+  if (Out.hasErrors()) {
+    Log.log_error(
+        "Failed to write suggested preamble '", Driver.SuggestPreamble, "'."
+    );
+    return false;
+  }
+
+  Log.log_info(
+      "Suggested preamble '", Driver.SuggestPreamble, "': ",
+      Kept.size() + Suggested.size(), " header(s), ",
+      Suggested.size(), " of them are new."
+  );
+
+  return true;
+}
+
+bool LevitationDriverImpl::advise() {
+  using NodeKind = DependenciesGraph::NodeKind;
+  using StepKind = BuildHistory::StepKind;
+
+  collectSources();
+  loadBuildHistory();
+  loadBuildState();
+  extractBundles();
+
+  // Parse-import is not run, so graph is made of .ldeps
+  // of previous build.
+  solveDependencies();
+
+  if (!Status.isValid()) {
+    Log.log_error(Status.getErrorMessage());
     return false;
+  }
+
+  if (Context.History.empty())
+    Log.log_warning(
+        "Build history is empty, rebuild impact can't be estimated."
+    );
+
+  const auto &Graph = Context.DependenciesInfo->getDependenciesGraph();
+  size_t NumNodes = Graph.getNumNodes();
+
+  std::vector<GraphAdvisor::Node> Nodes(NumNodes);
+  std::vector<GraphAdvisor::Unit> Units;
+  std::vector<StringID> UnitPaths;
+  llvm::DenseMap<DependenciesGraph::NodeIndex, unsigned> DeclUnits;
+  llvm::StringMap<unsigned> DeclASTUnits;
+
+  for (DependenciesGraph::NodeIndex Idx = 0; Idx != NumNodes; ++Idx) {
+    const auto &N = Graph.getNodeByIndex(Idx);
+    if (!N.LevitationUnit)
+      continue;
+
+    const auto &UnitPath = *Strings.getItem(N.LevitationUnit->UnitPath);
+
+    auto &AN = Nodes[Idx];
+    for (auto DependentIdx : Graph.getDependentNodes(Idx))
+      AN.Dependents.push_back(DependentIdx);
+
+    auto Duration = Context.History.getDuration(
+        N.Kind == NodeKind::Declaration ?
+            StepKind::BuildDecl : StepKind::BuildObject,
+        UnitPath
+    );
+    AN.Duration = Duration ? *Duration : 0;
+
+    if (N.Kind != NodeKind::Declaration)
+      continue;
+
+    // External packages have no stats.
+    const auto *Files = Context.Files.tryGet(N.LevitationUnit->UnitPath);
+    if (!Files)
+      continue;
+
+    GraphAdvisor::Unit U;
+    U.Decl = Idx;
+    U.InterfaceChanges = Context.History.getInterfaceChanges(UnitPath);
+    llvm::sys::fs::file_size(Files->DeclAST, U.DeclASTSize);
+
+    SinglePath DeclAST = Files->DeclAST;
+    llvm::sys::fs::make_absolute(DeclAST);
+    llvm::sys::path::remove_dots(DeclAST, /*remove_dot_dot=*/true);
+
+    DeclUnits[Idx] = Units.size();
+    DeclASTUnits[DeclAST] = Units.size();
+    Units.push_back(std::move(U));
+    UnitPaths.push_back(N.LevitationUnit->UnitPath);
+  }
+
+  // Stats of each job tell what it has read from declarations it loaded.
+  bool HasStats = false;
+  for (DependenciesGraph::NodeIndex Idx = 0; Idx != NumNodes; ++Idx) {
+    const auto &N = Graph.getNodeByIndex(Idx);
+    if (!N.LevitationUnit)
+      continue;
+
+    const auto *Files = Context.Files.tryGet(N.LevitationUnit->UnitPath);
+    if (!Files)
+      continue;
+
+    bool Declaration = N.Kind == NodeKind::Declaration;
+
+    std::vector<DependencyStats> Stats;
+    if (!loadDependencyStats(
+        Declaration ? Files->DeclAST :
+            (Context.Driver.KeepIR ? Files->IR : Files->Object),
+        Stats
+    ))
+      continue;
+
+    HasStats = true;
+
+    llvm::DenseSet<unsigned> UsedByDecl;
+    for (const auto &S : Stats) {
+      auto Found = DeclASTUnits.find(S.File);
+      if (Found == DeclASTUnits.end())
+        continue;
+
+      auto &U = Units[Found->second];
+      U.LoadedBytes += S.Bytes;
+      ++U.NumLoads;
+
+      if (Declaration && !S.isUnused())
+        UsedByDecl.insert(Found->second);
+    }
+
+    if (!Declaration)
+      continue;
+
+    for (auto DepIdx : Graph.getDependencies(Idx)) {
+      auto Found = DeclUnits.find(DepIdx);
+      if (Found != DeclUnits.end() && !UsedByDecl.count(Found->second))
+        Units[Found->second].BodyOnlyDependents.push_back(Idx);
+    }
+  }
+
+  if (!HasStats)
+    Log.log_warning(
+        "No dependency stats found, load cost can't be estimated. "
+        "Build project with --dependency-stats first."
+    );
+
+  auto Advices = GraphAdvisor::advise(Nodes, Units);
+
+  auto getUnitID = [&] (DependenciesGraph::NodeIndex Idx) {
+    return *Strings.getItem(Graph.getNodeByIndex(Idx).LevitationUnit->UnitPath);
+  };
+
+  size_t NumShown = Context.Driver.isVerbose() ?
+      Advices.size() :
+      std::min<size_t>(Advices.size(), DriverDefaults::ADVISED_UNITS);
+
+  with (auto info = Log.acquire(log::Level::Info)) {
+    auto &Out = info.s;
+
+    Out << "\nGraph advice:\n";
+
+    if (Advices.empty()) {
+      Out << "  Nothing to advise.\n\n";
+      return true;
+    }
+
+    for (size_t i = 0; i != NumShown; ++i) {
+      const auto &A = Advices[i];
+      const auto &U = Units[A.U];
+
+      Out.indent(2)
+      << i + 1 << ". " << *Strings.getItem(UnitPaths[A.U]) << ": "
+      << U.InterfaceChanges << " interface change(s) x "
+      << A.NumAffected << " dependent job(s), "
+      << A.AffectedTime / 1000 << " ms per change, impact "
+      << A.Impact / 1000 << " ms\n";
+
+      if (U.NumLoads)
+        Out.indent(5)
+        << "loaded by " << U.NumLoads << " job(s), "
+        << U.LoadedBytes / 1024 << " KiB read, "
+        << A.LoadedPercent << "% of declaration AST per job\n";
+
+      if (A.BodyDepSavedTime) {
+        Out.indent(5)
+        << "- " << U.BodyOnlyDependents.size()
+        << " importer(s) use nothing from it in declaration, as [bodydep] "
+        << "imports would save " << A.BodyDepSavedTime / 1000
+        << " ms per change:";
+        for (auto D : U.BodyOnlyDependents)
+          Out << " " << getUnitID(D);
+        Out << "\n";
+      }
+
+      if (A.SuggestSplit)
+        Out.indent(5)
+        << "- dependents read " << A.LoadedPercent
+        << "% of its declaration on average, consider moving rarely "
+        << "used declarations into separate unit\n";
+    }
+
+    if (NumShown != Advices.size())
+      Out.indent(2)
+      << "... " << Advices.size() - NumShown
+      << " more unit(s), use -v to see all of them.\n";
+
+    Out << "\n";
+  }
+
+  return true;
+}
+
+bool LevitationDriverImpl::prewarmCache() {
+  using NodeKind = DependenciesGraph::NodeKind;
+
+  collectSources();
+  loadBuildHistory();
+  loadBuildState();
+  extractBundles();
+
+  // Unlike advise, graph is solved for current sources, since
+  // they're likely changed by checkout.
+  runParseImport();
+  solveDependencies();
+  checkSubtreePreambles();
+
+  // Keys of steps which use preamble include its meta.
+  if (Status.isValid()) {
+    buildPreamble();
+    Status.inheritResult(PreambleStatus, "");
+  }
+
+  if (Status.isValid()) {
+    Strings.freeze();
+
+    if (Context.Driver.Targets.size())
+      selectTargetNodes();
+
+    if (Context.Driver.NumShards)
+      selectShardNodes();
+  }
+
+  if (!Status.isValid()) {
+    Log.log_error(Status.getErrorMessage());
+    return false;
+  }
+
+  precheckNodes();
+
+  auto &Cache = BuildCache::get();
+  const auto &Graph = Context.DependenciesInfo->getDependenciesGraph();
+
+  std::atomic<unsigned> NumFetched { 0 };
+  std::atomic<unsigned> NumMissed { 0 };
+
+  // Missed node fails, so that its dependents are not visited,
+  // their keys can't be known until it is built.
+  auto OnNode = [&] (const DependenciesGraph::Node &N) {
+    if (
+      !N.LevitationUnit ||
+      !isSelected(N.ID) ||
+      isPrecheckedClean(N.ID) ||
+      isCodelessDefinition(N)
+    )
+      return true;
+
+    const auto &Files = getFilesInfoFor(N);
+
+    std::string Key;
+    std::vector<BuildCache::Artifact> Artifacts;
+    SinglePath DiagnosticsFile;
+    Paths Partitions;
+    std::vector<std::string> PartitionNames;
+
+    // Same keys and artifacts as build uses,
+    // see buildDeclAST and processDefinition.
+    if (N.Kind == NodeKind::Declaration) {
+      bool HasDefinition = N.LevitationUnit->Definition != nullptr;
+
+      // Unused declaration is not built, see processDeclaration.
+      if (N.DependentNodes.empty() && !Graph.isPublic(N.ID) && HasDefinition)
+        return true;
+
+      Key = getCacheKey(
+          "decl-ast",
+          Files.Source,
+          getFullDependenciesMetas(N, Graph),
+          getDeclASTArgs(HasDefinition, isLTOPublicUnit(N))
+      );
+
+      Artifacts.push_back({"decl-ast", Files.DeclAST});
+      if (!Context.Driver.EmbedMeta)
+        Artifacts.push_back({"meta", Files.DeclASTMetaFile});
+
+      DiagnosticsFile = getDiagnosticsFile(Files.DeclAST);
+    } else {
+      LevitationDriver::Args CodeGenArgs, BackendArgs;
+      getDefinitionArgs(N, CodeGenArgs, BackendArgs);
+
+      auto ExtraArgs = Context.Driver.ExtraParseArgs;
+      ExtraArgs.append(CodeGenArgs.begin(), CodeGenArgs.end());
+      if (Context.ProfileUseHash.size() && !Context.Driver.KeepIR)
+        ExtraArgs.emplace_back(Context.ProfileUseHash);
+
+      bool KeepIR = Context.Driver.KeepIR;
+      StringRef Output = KeepIR ? Files.IR : Files.Object;
+
+      Key = getCacheKey(
+          KeepIR ? "ir" : "object",
+          Files.Source,
+          getFullDependenciesMetas(N, Graph),
+          ExtraArgs
+      );
+
+      Artifacts.push_back({KeepIR ? "ir" : "object", Output});
+      Artifacts.push_back({"meta", Files.ObjMetaFile});
+
+      if (!KeepIR && Files.SplitDwarf.size())
+        Artifacts.push_back({"dwo", Files.SplitDwarf});
+
+      if (!KeepIR && isSplitCodeGen(N.LevitationUnit->UnitPath)) {
+        Partitions = getCodeGenPartitions(Files);
+        for (unsigned i = 0, e = Partitions.size(); i != e; ++i)
+          PartitionNames.push_back(("part" + Twine(i + 1)).str());
+      }
+
+      DiagnosticsFile = getDiagnosticsFile(Output);
+    }
+
+    if (diagnosticsReplayEnabled())
+      Artifacts.push_back({"diagnostics", DiagnosticsFile});
+
+    for (unsigned i = 0, e = Partitions.size(); i != e; ++i)
+      Artifacts.push_back({PartitionNames[i], Partitions[i]});
+
+    // Some of dependencies metas is missing.
+    if (Key.empty()) {
+      ++NumMissed;
+      return false;
+    }
+
+    ArtifactLock Lock;
+    StringRef ProductFile, MetaFile;
+    if (
+      Context.Driver.SharedBuildRoot &&
+      getProductFiles(N, ProductFile, MetaFile)
+    )
+      lockProduct(Lock, ProductFile, MetaFile);
+
+    if (!Cache.fetch(Key, Artifacts)) {
+      ++NumMissed;
+      return false;
+    }
+
+    ++NumFetched;
+    return true;
+  };
+
+  Graph.readyQueueJobs(OnNode);
+
+  Log.log_info(
+      "Build cache prewarmed: ", NumFetched.load(), " node(s) fetched, ",
+      NumMissed.load(), " missed."
+  );
+
+  return true;
+}
+
+bool LevitationDriverImpl::emitNinja() {
+  auto &Plan = NinjaPlan::get();
+
+  collectSources();
+  loadBuildHistory();
+  loadBuildState();
+  extractBundles();
+  findNameIndex();
+
+  // Dependencies are the plan's input, so they are actually found
+  // and solved, rest phases are only recorded.
+  runParseImport();
+  solveDependencies();
+  checkSubtreePreambles();
+
+  if (Status.isValid()) {
+    Strings.freeze();
+
+    // Nothing is built, so neither build state nor any of artifacts
+    // should be touched.
+    Context.Driver.DryRun = true;
+    Plan.startRecording();
+
+    buildPreamble();
+    if (PreambleStatus.isValid())
+      buildHeaderUnits();
+    Status.inheritResult(PreambleStatus, "");
+
+    auto &Configs = Context.Driver.Configs;
+    size_t NumPasses = std::max<size_t>(Configs.size(), 1);
+    Context.DeclarationsProcessed = false;
+
+    for (size_t Pass = 0; Pass != NumPasses; ++Pass) {
+      selectConfig(Configs.empty() ? nullptr : &Configs[Pass]);
+
+      codeGen();
+      Context.DeclarationsProcessed = true;
+
+      if (Context.Driver.LinkPhaseEnabled && !Context.Driver.NumShards)
+        runLinker();
+    }
+  }
+
+  if (!Status.isValid()) {
+    Log.log_error(Status.getErrorMessage());
+    return false;
+  }
+
+  if (!Plan.write()) {
+    Log.log_error(
+        "Failed to write ninja file '", Context.Driver.EmitNinja, "'."
+    );
+    return false;
+  }
+
+  Log.log_info("Build plan is written into '", Context.Driver.EmitNinja, "'.");
+  return true;
+}
+
+bool LevitationDriverImpl::collectGarbage() {
+  collectSources();
+
+  if (!Status.isValid()) {
+    Log.log_error(Status.getErrorMessage());
+    return false;
+  }
+
+  removeOrphanArtifacts();
+  trimBuildCache();
+  return true;
+}
+
+void LevitationDriverImpl::removeOrphanArtifacts() {
+  const auto &Driver = Context.Driver;
+
+  llvm::StringSet<> Stems;
+  for (const auto &F : Context.Files.getMap())
+    Stems.insert(getArtifactStem(F.second->DeclAST));
+
+  // Artifacts of units are kept under paths of unit sources,
+  // while these directories belong to other phases.
+  llvm::StringSet<> SkippedDirs;
+  for (StringRef Dir : {
+    DriverDefaults::HEADER_UNITS_SUBDIR,
+    DriverDefaults::THINLTO_CACHE_DIR,
+    DriverDefaults::PARTIAL_LINKS_DIR,
+    DriverDefaults::SHARED_PACKAGES_DIR
+  })
+    SkippedDirs.insert(
+        Path::makeAbsolute<SinglePath>(
+            levitation::Path::getPath<SinglePath>(Driver.BuildRoot, Dir)
+        )
+    );
+  if (Driver.CacheDir.size())
+    SkippedDirs.insert(Path::makeAbsolute<SinglePath>(Driver.CacheDir));
+
+  unsigned Removed = 0;
+  uint64_t RemovedSize = 0;
+
+  std::error_code EC;
+  for (
+    llvm::sys::fs::recursive_directory_iterator I(Driver.BuildRoot, EC), E;
+    I != E && !EC;
+    I.increment(EC)
+  ) {
+    auto St = I->status();
+    if (!St)
+      continue;
+
+    if (St->type() == llvm::sys::fs::file_type::directory_file) {
+      if (SkippedDirs.count(Path::makeAbsolute<SinglePath>(I->path())))
+        I.no_push();
+      continue;
+    }
+
+    auto Stem = getArtifactStem(I->path());
+    if (Stem.empty() || Stems.count(Stem))
+      continue;
+
+    // Objects of configurations are named <unit>.<variant>.o
+    StringRef Variant = llvm::sys::path::extension(Stem);
+    if (Variant.size() && Stems.count(StringRef(Stem).drop_back(Variant.size())))
+      continue;
+
+    Log.log_verbose("Removing orphan artifact '", I->path(), "'...");
+
+    if (Driver.DryRun || !llvm::sys::fs::remove(I->path())) {
+      File::notifyChanged(I->path());
+      ++Removed;
+      RemovedSize += St->getSize();
+    }
+  }
+
+  if (Removed)
+    Log.log_info(
+        "Garbage collection: removed ", Removed, " orphan artifact(s), ",
+        RemovedSize >> 20, " MB."
+    );
+}
+
+void LevitationDriverImpl::trimBuildCache() {
+  const auto &Driver = Context.Driver;
+
+  if (Driver.DryRun || (!Driver.CacheMaxSize && !Driver.CacheMaxAge))
+    return;
+
+  unsigned Removed = BuildCache::get().trim(
+      uint64_t(Driver.CacheMaxSize) << 20,
+      uint64_t(Driver.CacheMaxAge) * 24 * 60 * 60
+  );
+
+  if (Removed)
+    Log.log_info(
+        "Garbage collection: removed ", Removed, " build cache entries."
+    );
+}
+
+bool LevitationDriverImpl::queryAffected() {
+  using NodeKind = DependenciesGraph::NodeKind;
+  using NodeID = DependenciesGraph::NodeID;
+
+  collectSources();
+  loadBuildState();
+  extractBundles();
+
+  // Parse-import is not run, so graph is made of .ldeps
+  // of previous build.
+  solveDependencies();
+
+  if (!Status.isValid()) {
+    Log.log_error(
+        Status.getErrorMessage(),
+        " Dependencies of previous build are required."
+    );
+    return false;
+  }
+
+  const auto &Graph = Context.DependenciesInfo->getDependenciesGraph();
+  const auto &Driver = Context.Driver;
+
+  bool AffectsAll = false;
+
+  // Unit changes affect both its declaration and definition, but
+  // definition dependencies are only added to dependent definitions,
+  // so [bodydep] users are affected without their dependents.
+  SmallVector<NodeID::Type, 16> Worklist;
+
+  // New units are not in graph yet, but they must be built too.
+  llvm::StringSet<> NewUnits;
+
+  for (auto File : Driver.ChangedFiles) {
+    auto Abs = levitation::Path::makeAbsolute<SinglePath>(File);
+
+    bool IsPreamble = Driver.PreambleSource.size() &&
+        Abs == levitation::Path::makeAbsolute<SinglePath>(Driver.PreambleSource);
+    for (auto ChainSource : Driver.PreambleChainSources)
+      IsPreamble |=
+          Abs == levitation::Path::makeAbsolute<SinglePath>(ChainSource);
+
+    bool IsInclude = llvm::any_of(Driver.Includes, [&] (StringRef Dir) {
+      return levitation::Path::hasParent(Abs, Dir);
+    });
+
+    if (IsPreamble || IsInclude) {
+      Log.log_verbose("'", File, "' affects all units.");
+      AffectsAll = true;
+      break;
+    }
+
+    // Subtree preamble affects units which use it.
+    bool IsSubtreePreamble = false;
+    for (size_t i = 0, e = Driver.SubtreePreambles.size(); i != e; ++i) {
+      if (Abs != levitation::Path::makeAbsolute<SinglePath>(
+          Driver.SubtreePreambles[i].Source
+      ))
+        continue;
+
+      IsSubtreePreamble = true;
+      for (const auto &NodeIt : Graph.allNodes())
+        if (getSubtreePreamble(getFilesInfoFor(*NodeIt.second).Source) == (int)i)
+          Worklist.push_back(NodeIt.first);
+    }
+
+    if (IsSubtreePreamble) {
+      Log.log_verbose("'", File, "' affects units of its subtree.");
+      continue;
+    }
+
+    if (
+      llvm::sys::path::extension(Abs).drop_front() !=
+          FileExtensions::SourceCode ||
+      !levitation::Path::hasParent(Abs, Driver.SourcesRoot)
+    ) {
+      Log.log_verbose("'", File, "' is not a build input, skipped.");
+      continue;
+    }
+
+    auto Rel = levitation::Path::makeRelative<SinglePath>(
+        Abs, Driver.SourcesRoot
+    );
+    auto UnitID = UnitIDUtils::fromRelPath(Rel);
+    auto PathID = Strings.addItem(StringRef(UnitID));
+
+    bool Known = false;
+    for (auto Kind : { NodeKind::Declaration, NodeKind::Definition }) {
+      auto NID = NodeID::get(Kind, PathID);
+      if (Graph.allNodes().count(NID)) {
+        Worklist.push_back(NID);
+        Known = true;
+      }
+    }
+
+    if (!Known)
+      NewUnits.insert(UnitID);
+  }
+
+  DependenciesGraph::NodesSet Affected;
+  if (AffectsAll) {
+    for (const auto &NodeIt : Graph.allNodes())
+      Affected.insert(NodeIt.first);
+  }
+
+  while (!Worklist.empty()) {
+    auto NID = Worklist.pop_back_val();
+    if (!Affected.insert(NID).second)
+      continue;
+
+    for (auto DependentID : Graph.getNode(NID).DependentNodes)
+      if (!Affected.count(DependentID))
+        Worklist.push_back(DependentID);
+  }
+
+  std::vector<std::string> Units;
+
+  if (Driver.Targets.size()) {
+    SmallVector<NodeID::Type, 4> TargetDefs;
+    if (!findTargets(TargetDefs)) {
+      Log.log_error(Status.getErrorMessage());
+      return false;
+    }
+
+    for (auto DefID : TargetDefs) {
+      DependenciesGraph::NodesSet Closure;
+      collectLinkClosure(DefID, Closure);
+
+      bool IsAffected = llvm::any_of(Closure, [&] (NodeID::Type NID) {
+        return Affected.count(NID);
+      });
+
+      if (IsAffected)
+        Units.push_back(
+            Strings.getItem(Graph.getNode(DefID).LevitationUnit->UnitPath)->str()
+        );
+    }
+
+    // New unit can't be used by targets, unless they were
+    // changed as well.
+  } else {
+    for (auto NID : Affected) {
+      const auto &N = Graph.getNode(NID);
+      if (N.Kind == NodeKind::Definition)
+        Units.push_back(Strings.getItem(N.LevitationUnit->UnitPath)->str());
+    }
+
+    for (const auto &U : NewUnits)
+      Units.push_back(U.first().str());
+  }
+
+  std::sort(Units.begin(), Units.end());
+
+  for (const auto &U : Units)
+    llvm::outs() << U << "\n";
+
+  return true;
+}
+
+void LevitationDriverImpl::selectShardNodes() {
+  using Node = DependenciesGraph::Node;
+
+  const auto &Info = *Context.DependenciesInfo;
+  const auto &Graph = Info.getDependenciesGraph();
+
+  // Shards are computed independently on different hosts, so
+  // only things which are same for all of them are taken into
+  // account: nodes are weighted equally, and nodes which can go
+  // in any order are ordered by unit path.
+  // Selected nodes are replaced by shard nodes, so only
+  // targets selection is taken into account.
+  bool HasTargets = Context.Driver.Targets.size();
+  auto Shards = Info.partitionWorkers(
+      Context.Driver.NumShards,
+      [&] (const Node &N) {
+        return
+            N.Kind == DependenciesGraph::NodeKind::Definition &&
+            (!HasTargets || Context.SelectedNodes.count(N.ID)) ? 1 : 0;
+      },
+      /*MaxImbalance=*/0.1,
+      [&] (const Node &L, const Node &R) {
+        auto LPath = *Strings.getItem(L.LevitationUnit->UnitPath);
+        auto RPath = *Strings.getItem(R.LevitationUnit->UnitPath);
+        if (LPath != RPath)
+          return LPath < RPath;
+        return L.Kind < R.Kind;
+      }
+  );
+
+  unsigned Shard = Context.Driver.ShardIndex - 1;
+
+  Context.SelectedNodes.clear();
+  for (const auto &NS : Shards) {
+    if (NS.second != Shard)
+      continue;
+
+    Context.SelectedNodes.insert(NS.first);
+    for (auto DepID : Info.getFullDependencies(NS.first))
+      Context.SelectedNodes.insert(DepID);
+  }
+
+  size_t NumDefinitions = 0;
+  for (auto NID : Context.SelectedNodes)
+    if (Graph.getNode(NID).Kind == DependenciesGraph::NodeKind::Definition)
+      ++NumDefinitions;
+
+  Log.log_info(
+      "Shard ", Context.Driver.Shard, ": ", NumDefinitions,
+      " of ", Shards.size(), " object(s), ",
+      Context.SelectedNodes.size() - NumDefinitions, " declaration(s)."
+  );
+}
+
+void LevitationDriverImpl::getUnityBatches(
+    const NodesVectorTy &Definitions,
+    std::vector<NodesVectorTy> &Batches
+) {
+  const auto &Graph = Context.DependenciesInfo->getDependenciesGraph();
+
+  // Sort siblings by unit ID, so that batches are same from run to run.
+  std::map<std::string, NodesVectorTy> Siblings;
+  for (const auto *N : Definitions) {
+    StringRef UnitID = *Strings.getItem(N->LevitationUnit->UnitPath);
+    auto Dir = UnitID.rsplit(UnitIDUtils::getComponentSeparator());
+    StringRef DirID = Dir.second.empty() ? StringRef() : Dir.first;
+    Siblings[DirID.str()].push_back(N);
+  }
+
+  size_t MaxSize = (size_t)Context.Driver.UnitySize;
+
+  for (auto &Dir : Siblings) {
+    auto &Nodes = Dir.second;
+
+    std::sort(Nodes.begin(), Nodes.end(), [&] (
+        const DependenciesGraph::Node *L, const DependenciesGraph::Node *R
+    ) {
+      return *Strings.getItem(L->LevitationUnit->UnitPath) <
+             *Strings.getItem(R->LevitationUnit->UnitPath);
+    });
+
+    // Own declaration is always a dependency, but it is never shared.
+    std::vector<llvm::StringSet<>> Deps(Nodes.size());
+    for (size_t i = 0, e = Nodes.size(); i != e; ++i) {
+      const auto &OwnDeclAST = getFilesInfoFor(*Nodes[i]).DeclAST;
+      for (const auto &D : getFullDependencies(*Nodes[i], Graph))
+        if (D != OwnDeclAST)
+          Deps[i].insert(D);
+    }
+
+    std::vector<bool> Taken(Nodes.size(), false);
+
+    // Greedy: start batch with first free node, and add free nodes
+    // which share something with batch.
+    for (size_t i = 0, e = Nodes.size(); i != e; ++i) {
+      if (Taken[i])
+        continue;
+
+      NodesVectorTy Batch = { Nodes[i] };
+      Taken[i] = true;
+      llvm::StringSet<> BatchDeps = Deps[i];
+
+      for (size_t j = i + 1; j != e && Batch.size() < MaxSize; ++j) {
+        if (Taken[j])
+          continue;
+
+        bool Overlaps = BatchDeps.empty() && Deps[j].empty();
+        for (const auto &D : Deps[j])
+          if (BatchDeps.count(D.first())) {
+            Overlaps = true;
+            break;
+          }
+
+        if (!Overlaps)
+          continue;
+
+        Batch.push_back(Nodes[j]);
+        Taken[j] = true;
+        for (const auto &D : Deps[j])
+          BatchDeps.insert(D.first());
+      }
+
+      Batches.emplace_back(std::move(Batch));
+    }
+  }
+}
+
+bool LevitationDriverImpl::runUnityBatches(const NodesVectorTy &Definitions) {
+  std::vector<NodesVectorTy> Batches;
+  getUnityBatches(Definitions, Batches);
+
+  Log.log_verbose(
+      "Unity: ", Definitions.size(), " definitions in ",
+      Batches.size(), " batches."
+  );
+
+  auto &TM = TasksManager::get();
+  TasksManager::TasksSet Tasks;
+
+  for (const auto &Batch : Batches) {
+    auto TID = TM.runTask([&] (TasksManager::TaskContext &TC) {
+      InProcessCompiler::Batch _;
+
+      // Keep going, so that all failures of batch are reported.
+      bool Successful = true;
+      for (const auto *N : Batch)
+        Successful = processDependencyNode(*N) && Successful;
+
+      TC.Successful = Successful;
+    });
+    Tasks.insert(TID);
+  }
+
+  return TM.waitForTasks(Tasks) && TM.allSuccessfull(Tasks);
+}
+
+void LevitationDriverImpl::startStreaming() {
+  Streaming = std::make_unique<StreamingState>();
+
+  for (auto UnitID : Context.ProjectPackages) {
+    auto U = std::make_unique<StreamingState::Unit>();
+    U->UnitID = Strings.getItem(UnitID)->str();
+    U->Files = Context.Files.tryGet(UnitID);
+
+    Streaming->UnitIDs[U->UnitID] = UnitID;
+    Streaming->Units[UnitID] = std::move(U);
+  }
+}
+
+void LevitationDriverImpl::streamLDeps(StringID UnitID) {
+  auto &S = *Streaming;
+
+  StreamingState::Unit *U;
+  with (auto _ = S.lock()) {
+    U = S.get(UnitID);
+    if (!U || S.Stopped)
+      return;
+  }
+
+  DependenciesData Data;
+  bool Loaded = DependenciesSolver::loadDependencies(Data, U->Files->LDeps);
+
+  SmallVector<StringID, 16> ToRun;
+
+  with (auto _ = S.lock()) {
+    U->Loaded = true;
+
+    // Regular solver will report it.
+    if (!Loaded) {
+      U->NotStreamable = true;
+      return;
+    }
+
+    U->IsPublic = Data.IsPublic;
+    U->IsBodyOnly = Data.IsBodyOnly;
+
+    for (const auto &Dep : Data.DeclarationDependencies) {
+      auto Found = S.UnitIDs.find(*Data.Strings->getItem(Dep.UnitIdentifier));
+
+      // External or missing package.
+      if (Found == S.UnitIDs.end()) {
+        U->NotStreamable = true;
+        continue;
+      }
+
+      U->Dependencies.push_back(Found->second);
+    }
+
+    // Each unit brings in all its edges at once, so the only
+    // cycles possible are ones which go through this unit.
+    for (auto DepID : U->Dependencies) {
+      if (streamHasPathLocked(DepID, UnitID)) {
+        Log.log_verbose(
+            "Streaming: found dependencies cycle for '", U->UnitID, "', ",
+            "leaving remaining units for regular build."
+        );
+        S.Stopped = true;
+        return;
+      }
+    }
+
+    // Dependencies now have dependent, so their declarations
+    // are worth building.
+    for (auto DepID : U->Dependencies) {
+      S.get(DepID)->Dependents.push_back(UnitID);
+      streamTryScheduleLocked(DepID, ToRun);
+    }
+
+    streamTryScheduleLocked(UnitID, ToRun);
+  }
+
+  streamRun(ToRun);
+}
+
+bool LevitationDriverImpl::streamHasPathLocked(StringID From, StringID To) {
+  auto &S = *Streaming;
+
+  llvm::DenseSet<StringID> Visited;
+  SmallVector<StringID, 16> Worklist;
+  Worklist.push_back(From);
+
+  while (!Worklist.empty()) {
+    auto ID = Worklist.pop_back_val();
+
+    if (ID == To)
+      return true;
+
+    if (!Visited.insert(ID).second)
+      continue;
+
+    if (auto *U = S.get(ID))
+      Worklist.append(U->Dependencies.begin(), U->Dependencies.end());
+  }
+
+  return false;
+}
+
+void LevitationDriverImpl::streamTryScheduleLocked(
+    StringID UnitID,
+    llvm::SmallVectorImpl<StringID> &ToRun
+) {
+  auto &S = *Streaming;
+  auto *U = S.get(UnitID);
+
+  if (
+    S.Stopped ||
+    !U->Loaded ||
+    U->NotStreamable ||
+    U->IsBodyOnly ||
+    U->Status != StreamingState::UnitStatus::Waiting
+  )
+    return;
+
+  // Nobody needs declaration of private unit so far,
+  // it is scheduled once some dependent comes up.
+  if (!U->IsPublic && U->Dependents.empty())
+    return;
+
+  for (auto DepID : U->Dependencies)
+    if (S.get(DepID)->Status != StreamingState::UnitStatus::Done)
+      return;
+
+  if (!S.PreambleReady) {
+    U->Status = StreamingState::UnitStatus::Held;
+    S.Held.push_back(UnitID);
+    return;
+  }
+
+  U->Status = StreamingState::UnitStatus::Scheduled;
+  ToRun.push_back(UnitID);
+}
+
+void LevitationDriverImpl::streamPreambleReady(bool Successful) {
+  auto &S = *Streaming;
+
+  SmallVector<StringID, 16> ToRun;
+
+  with (auto _ = S.lock()) {
+    S.PreambleReady = true;
+
+    if (!Successful)
+      S.Stopped = true;
+
+    for (auto UnitID : S.Held) {
+      S.get(UnitID)->Status = StreamingState::UnitStatus::Waiting;
+      streamTryScheduleLocked(UnitID, ToRun);
+    }
+    S.Held.clear();
+  }
+
+  streamRun(ToRun);
+}
+
+void LevitationDriverImpl::streamRun(llvm::ArrayRef<StringID> ToRun) {
+  auto &S = *Streaming;
+
+  for (auto UnitID : ToRun) {
+    auto TID = TM.runTask([=] (TasksManager::TaskContext &TC) {
+      TC.Successful = streamDeclaration(UnitID);
+    });
+
+    with (auto _ = S.lock())
+      S.Tasks.insert(TID);
+  }
+}
+
+bool LevitationDriverImpl::streamDeclaration(StringID UnitID) {
+  auto &S = *Streaming;
+
+  StreamingState::Unit *U;
+  Paths FullDeps;
+  Paths FullDepsMetas;
+  bool DepsUpdated = false;
+
+  // Packages unit depends on, directly or indirectly.
+  llvm::DenseSet<StringID> Visited;
+
+  with (auto _ = S.lock()) {
+    U = S.get(UnitID);
+
+    for (auto DepID : U->Dependencies)
+      if (S.get(DepID)->InterfaceUpdated)
+        DepsUpdated = true;
+
+    // Topologically ordered dependencies, dependencies go first.
+    SmallVector<std::pair<StringID, bool>, 16> Stack;
+    for (auto DepID : llvm::reverse(U->Dependencies))
+      Stack.push_back({DepID, false});
+
+    while (!Stack.empty()) {
+      auto Item = Stack.pop_back_val();
+      auto *Dep = S.get(Item.first);
+
+      if (Item.second) {
+        FullDeps.push_back(Dep->Files->DeclAST);
+        FullDepsMetas.push_back(Dep->Files->DeclASTMetaFile);
+        continue;
+      }
+
+      if (!Visited.insert(Item.first).second)
+        continue;
+
+      Stack.push_back({Item.first, true});
+      for (auto DepDepID : llvm::reverse(Dep->Dependencies))
+        if (!Visited.count(DepDepID))
+          Stack.push_back({DepDepID, false});
+    }
+  }
+
+  const auto &Files = *U->Files;
+
+  if (isPreambleUpdated(Files.Source))
+    DepsUpdated = true;
+
+  // Header units go first, same as in getFullDependencies.
+  if (!Context.HeaderUnitsUsed.empty()) {
+    SmallVector<unsigned, 4> HeaderUnits;
+    auto addUsed = [&] (StringID PackageID) {
+      auto Found = Context.HeaderUnitsUsed.find(PackageID);
+      if (Found != Context.HeaderUnitsUsed.end())
+        HeaderUnits.append(Found->second.begin(), Found->second.end());
+    };
+
+    addUsed(UnitID);
+    for (auto DepID : Visited)
+      addUsed(DepID);
+
+    std::sort(HeaderUnits.begin(), HeaderUnits.end());
+    HeaderUnits.erase(
+        std::unique(HeaderUnits.begin(), HeaderUnits.end()), HeaderUnits.end()
+    );
+
+    Paths HeaderUnitsDecls, HeaderUnitsMetas;
+    for (auto HU : HeaderUnits) {
+      const auto &Info = Context.HeaderUnits[HU];
+      HeaderUnitsDecls.push_back(Info.DeclAST);
+      HeaderUnitsMetas.push_back(Info.DeclASTMetaFile);
+      if (Info.Updated)
+        DepsUpdated = true;
+    }
+
+    FullDeps.insert(
+        FullDeps.begin(), HeaderUnitsDecls.begin(), HeaderUnitsDecls.end()
+    );
+    FullDepsMetas.insert(
+        FullDepsMetas.begin(), HeaderUnitsMetas.begin(), HeaderUnitsMetas.end()
+    );
+  }
+
+  DeclASTMeta OldMeta;
+  bool UpToDate =
+      !DepsUpdated &&
+      isUpToDate(
+          OldMeta, Files.DeclAST, Files.DeclASTMetaFile, Files.Source, U->UnitID,
+          /*Reason=*/nullptr,
+          getCommandHash(
+              "decl-ast",
+              getDeclASTArgs(/*HasDefinition=*/true, /*LTOPublic=*/false)
+          )
+      );
+
+  bool Successful = true;
+  bool InterfaceUpdated = false;
+
+  if (!UpToDate) {
+    auto SourceStamp = getFileStamp(Files.Source);
+
+    Successful = runTimed(
+        BuildHistory::StepKind::BuildDecl,
+        U->UnitID,
+        [&] {
+          return buildDeclAST(
+              U->UnitID, Files, FullDeps, FullDepsMetas,
+              // Only units with definitions are streamed.
+              /*HasDefinition=*/true,
+              // Streaming is off with --whole-program-vtables.
+              /*LTOPublic=*/false,
+              // Graph is not solved yet, so units are not assigned.
+              /*Worker=*/-1
+          );
+        }
+    );
+
+    if (Successful) {
+      updateProductState(Files.DeclAST, Files.DeclASTMetaFile, SourceStamp);
+
+      DeclASTMeta NewMeta;
+      Successful = loadMeta(
+          NewMeta, Context.Driver.BuildRoot, Files.DeclASTMetaFile
+      );
+
+      InterfaceUpdated = Successful && isInterfaceUpdated(
+          OldMeta, NewMeta, DepsUpdated, U->UnitID
+      );
+
+      if (InterfaceUpdated)
+        recordInterfaceChange(U->UnitID);
+
+      if (Successful)
+        journalProduct(
+            Files.DeclAST, /*Declaration=*/true, InterfaceUpdated, SourceStamp
+        );
+    }
+  }
+
+  // Dependents might not be rebuilt by interrupted build.
+  if (Context.JournalUpdatedUnits.count(UnitID))
+    InterfaceUpdated = true;
+
+  SmallVector<StringID, 16> ToRun;
+
+  with (auto _ = S.lock()) {
+    if (!Successful) {
+      U->Status = StreamingState::UnitStatus::Failed;
+      S.Stopped = true;
+      S.Status.setFailure()
+      << "Streaming: failed to build declaration for '" << U->UnitID << "'.";
+    } else {
+      U->Status = StreamingState::UnitStatus::Done;
+      U->InterfaceUpdated = InterfaceUpdated;
+
+      if (!UpToDate)
+        S.StreamedOldMetas[UnitID] = OldMeta;
+
+      for (auto DependentID : U->Dependents)
+        streamTryScheduleLocked(DependentID, ToRun);
+    }
+  }
+
+  streamRun(ToRun);
+
+  return Successful;
+}
+
+void LevitationDriverImpl::finishStreaming() {
+  auto &S = *Streaming;
+
+  // Jobs schedule their dependents, so wait until no new jobs appear.
+  while (true) {
+    TasksManager::TasksSet Tasks;
+    with (auto _ = S.lock())
+      Tasks = S.Tasks;
+
+    TM.waitForTasks(Tasks);
+
+    size_t NumTasks;
+    with (auto _ = S.lock())
+      NumTasks = S.Tasks.size();
+
+    if (NumTasks == Tasks.size())
+      break;
+  }
+
+  Log.log_verbose(
+      "Streaming: ", S.StreamedOldMetas.size(),
+      " declaration(s) built ahead of dependencies solving."
+  );
+
+  Status.inheritResult(S.Status, "");
+}
+
+void LevitationDriverImpl::runLinker() {
+  if (!Status.isValid())
+    return;
+
+  assert(Context.Driver.isLinkPhaseEnabled() && "Link phase must be enabled.");
+
+  if (Context.Driver.Targets.size() > 1) {
+    runTargetsLinker();
+    return;
+  }
+
+  if (!prepareSymbolOrdering()) {
+    Status.setFailure()
+    << "Link: failed to prepare symbol ordering";
+    return;
+  }
+
+  Paths ObjectFiles;
+  for (auto PackagePath : getLinkOrder()) {
+    // Only objects needed by targets are built.
+    if (
+      Context.Driver.Targets.size() &&
+      !isSelected(DependenciesGraph::NodeID::get(
+          DependenciesGraph::NodeKind::Definition, PackagePath
+      ))
+    )
+      continue;
+
+    assert(Context.Files.count(PackagePath));
+    appendLinkObjects(PackagePath, ObjectFiles);
+  }
+
+  auto Output = getOutput();
+
+  // Output is also relinked if it was linked from another set
+  // of objects, e.g. built with another profile mode.
+  llvm::MD5 ObjectsMD5Builder;
+  for (const auto &Obj : ObjectFiles)
+    ObjectsMD5Builder.update(Obj);
+  if (Context.SymbolOrderingFile.size())
+    if (auto Stamp = getFileStamp(Context.SymbolOrderingFile))
+      ObjectsMD5Builder.update(std::to_string(Stamp->MTime));
+  llvm::MD5::MD5Result ObjectsMD5;
+  ObjectsMD5Builder.final(ObjectsMD5);
+  HashVectorTy ObjectsHash(ObjectsMD5.Bytes.begin(), ObjectsMD5.Bytes.end());
+
+  const auto *Recorded = Context.PrevState.get(Output);
+  bool SameObjects = Recorded && Recorded->SourceHash == ObjectsHash;
+
+  if (
+    fileExists(Output) &&
+    !Context.ObjectsUpdated &&
+    SameObjects
+  ) {
+    setProductState(Output, *Recorded);
+    if (!packageDwarf(Output)) {
+      Status.setFailure()
+      << "Link: DWARF packaging failed";
+      return;
+    }
+    Status.setWarning("Nothing to build.\n");
+    return;
+  }
+
+  if (Context.Driver.ThinLTO) {
+    Paths NativeFiles;
+    if (!runThinLTO(ObjectFiles, NativeFiles)) {
+      Status.setFailure()
+      << "Link: ThinLTO failed";
+      return;
+    }
+    ObjectFiles.swap(NativeFiles);
+  } else if (Context.Driver.PartialLink || Context.Driver.SharedPackages) {
+    if (!runPackageLinks(ObjectFiles, Context.Driver.SharedPackages)) {
+      Status.setFailure()
+      << "Link: package link failed";
+      return;
+    }
+  }
+
+  auto LinkerArgs = Context.Driver.ExtraLinkerArgs;
+  addSymbolOrderingArgs(LinkerArgs);
+
+  if (Context.Driver.SharedPackages) {
+    auto LibsDir = levitation::Path::getPath<SinglePath>(
+        Context.Driver.BuildRoot, DriverDefaults::SHARED_PACKAGES_DIR
+    );
+    llvm::sys::fs::make_absolute(LibsDir);
+    LinkerArgs.emplace_back(("-Wl,-rpath," + LibsDir).str());
+
+    // Symbols of shared libraries are resolved at run time, so
+    // executable is only relinked if its own objects or set of
+    // libraries are changed.
+    if (!Context.Driver.DryRun) {
+      llvm::MD5 InputsMD5Builder;
+      for (const auto &In : ObjectFiles) {
+        InputsMD5Builder.update(In);
+        if (llvm::sys::path::extension(In).drop_front() ==
+            FileExtensions::SharedLibrary)
+          continue;
+        if (auto Stamp = getFileStamp(In)) {
+          InputsMD5Builder.update(std::to_string(Stamp->MTime));
+          InputsMD5Builder.update(std::to_string(Stamp->Size));
+        }
+      }
+      llvm::MD5::MD5Result InputsMD5;
+      InputsMD5Builder.final(InputsMD5);
+      ObjectsHash.assign(InputsMD5.Bytes.begin(), InputsMD5.Bytes.end());
+
+      auto OutputStamp = getFileStamp(Output);
+      if (
+        Recorded && OutputStamp &&
+        Recorded->SourceHash == ObjectsHash &&
+        Recorded->Product == *OutputStamp
+      ) {
+        setProductState(Output, *Recorded);
+        Status.setWarning("Nothing to link.\n");
+        return;
+      }
+    }
+  }
+
+  auto Res = Commands::link(
+      Context.Driver.BinDir,
+      Output,
+      ObjectFiles,
+      Context.Driver.StdLib,
+      Context.Driver.Linker,
+      Context.Driver.LinkerThreads,
+      LinkerArgs,
+      Context.Driver.isVerbose(),
+      Context.Driver.DryRun,
+      Context.Driver.CanUseLibStdCppForLinker
+  );
+
+  if (!Res) {
+    Status.setFailure()
+    << "Link: phase failed";
+    return;
+  }
+
+  if (!packageDwarf(Output)) {
+    Status.setFailure()
+    << "Link: DWARF packaging failed";
+    return;
+  }
+
+  if (Context.Driver.DryRun)
+    return;
+
+  if (auto OutputStamp = getFileStamp(Output))
+    setProductState(Output, {
+        BuildState::FileStamp(), ObjectsHash, *OutputStamp, HashVectorTy()
+    });
+}
+
+void LevitationDriverImpl::writeArchive() {
+  if (!Status.isValid())
+    return;
+
+  const auto &Driver = Context.Driver;
+  auto Archive = getConfigOutput(Driver.Archive);
+
+  struct Member {
+    SinglePath Object;
+    std::string Name;
+    BuildState::FileStamp Stamp;
+    llvm::NewArchiveMember Contents;
+  };
+
+  // Members are named after units, e.g. foo::bar goes as foo.bar.o,
+  // since GNU archives don't keep directories of members.
+  std::vector<Member> Members;
+  for (auto PackagePath : Context.ProjectPackages) {
+    if (!isSelected(DependenciesGraph::NodeID::get(
+        DependenciesGraph::NodeKind::Definition, PackagePath
+    )))
+      continue;
+
+    assert(Context.Files.count(PackagePath));
+
+    SmallVector<StringRef, 8> Components;
+    Strings.getItem(PackagePath)->split(
+        Components, UnitIDUtils::getComponentSeparator()
+    );
+    auto Name = llvm::join(Components, ".");
+
+    // Partitions go as foo.bar.part1.o and so on.
+    Paths Objects;
+    appendLinkObjects(PackagePath, Objects);
+    for (unsigned i = 0, e = Objects.size(); i != e; ++i) {
+      Member M;
+      M.Object = Objects[i];
+      M.Name = Name;
+      if (i)
+        M.Name += (".part" + Twine(i)).str();
+      M.Name += llvm::sys::path::extension(M.Object);
+
+      Members.push_back(std::move(M));
+    }
+  }
+
+  std::sort(Members.begin(), Members.end(), [] (
+      const Member &L, const Member &R
+  ) {
+    return L.Name < R.Name;
+  });
+
+  if (Driver.DryRun || Driver.isVerbose())
+    Log.log_info(
+        "ARCHIVE ", Driver.ThinArchive ? "(thin) " : "",
+        Members.size(), " object(s) -> ", Archive
+    );
+
+  if (Driver.DryRun)
+    return;
+
+  // Member states are keyed as archive(member).
+  auto getMemberKey = [&] (const Member &M) {
+    return (Archive + "(" + M.Name + ")").str();
+  };
+
+  llvm::MD5 MembersMD5Builder;
+  MembersMD5Builder.update(StringRef(Driver.ThinArchive ? "thin" : "regular"));
+  for (auto &M : Members) {
+    if (auto Stamp = getFileStamp(M.Object))
+      M.Stamp = *Stamp;
+    MembersMD5Builder.update(M.Name);
+    MembersMD5Builder.update(std::to_string(M.Stamp.MTime));
+    MembersMD5Builder.update(std::to_string(M.Stamp.Size));
+  }
+  llvm::MD5::MD5Result MembersMD5;
+  MembersMD5Builder.final(MembersMD5);
+  HashVectorTy MembersHash(MembersMD5.Bytes.begin(), MembersMD5.Bytes.end());
+
+  auto setMemberStates = [&] {
+    for (const auto &M : Members)
+      setProductState(getMemberKey(M), {
+          BuildState::FileStamp(), HashVectorTy(), M.Stamp, HashVectorTy()
+      });
+  };
+
+  const auto *Recorded = Context.PrevState.get(Archive);
+  auto ArchiveStamp = getFileStamp(Archive);
+  if (
+    Recorded && ArchiveStamp &&
+    Recorded->SourceHash == MembersHash &&
+    Recorded->Product == *ArchiveStamp
+  ) {
+    setProductState(Archive, *Recorded);
+    setMemberStates();
+    Log.log_verbose("Archive '", Archive, "' is up-to-date.");
+    return;
+  }
+
+  // Members which were not changed since previous archive was
+  // written are taken from it, rather than read again.
+  std::unique_ptr<llvm::MemoryBuffer> OldArchiveBuf;
+  std::unique_ptr<llvm::object::Archive> OldArchive;
+  llvm::StringMap<llvm::object::Archive::Child> OldMembers;
+
+  if (Recorded && ArchiveStamp && !Driver.ThinArchive) {
+    if (auto Buf = llvm::MemoryBuffer::getFile(Archive, -1, false))
+      OldArchiveBuf = std::move(Buf.get());
+
+    if (OldArchiveBuf) {
+      auto Opened = llvm::object::Archive::create(*OldArchiveBuf);
+      if (Opened)
+        OldArchive = std::move(Opened.get());
+      else
+        llvm::consumeError(Opened.takeError());
+    }
+
+    if (OldArchive) {
+      llvm::Error Err = llvm::Error::success();
+      for (const auto &C : OldArchive->children(Err)) {
+        auto Name = C.getName();
+        if (Name)
+          OldMembers.try_emplace(Name.get(), C);
+        else
+          llvm::consumeError(Name.takeError());
+      }
+      if (Err) {
+        llvm::consumeError(std::move(Err));
+        OldMembers.clear();
+      }
+    }
+  }
+
+  size_t NumReused = 0;
+  TasksManager::TasksSet Tasks;
+  std::mutex ErrorsMutex;
+  std::string Errors;
+
+  for (auto &M : Members) {
+    const auto *MemberState = Context.PrevState.get(getMemberKey(M));
+    auto Old = OldMembers.find(M.Name);
+    if (
+      MemberState && Old != OldMembers.end() &&
+      MemberState->Product == M.Stamp
+    ) {
+      auto Reused = llvm::NewArchiveMember::getOldMember(
+          Old->second, /*Deterministic=*/true
+      );
+      if (Reused) {
+        M.Contents = std::move(Reused.get());
+        ++NumReused;
+        continue;
+      }
+      llvm::consumeError(Reused.takeError());
+    }
+
+    // Changed objects are read in parallel.
+    auto TID = TM.runTask([&, &M = M] (TasksManager::TaskContext &TC) {
+      auto Read = llvm::NewArchiveMember::getFile(
+          M.Object, /*Deterministic=*/true
+      );
+
+      if (!Read) {
+        with (auto _ = lock(ErrorsMutex)) {
+          Errors += "'" + M.Object.str().str() + "': " +
+              llvm::toString(Read.takeError()) + "\n";
+        }
+        TC.Successful = false;
+        return;
+      }
+
+      M.Contents = std::move(Read.get());
+      M.Contents.MemberName = M.Name;
+      TC.Successful = true;
+    });
+    Tasks.insert(TID);
+  }
+
+  if (!TM.waitForTasks(Tasks) || !TM.allSuccessfull(Tasks)) {
+    Status.setFailure()
+    << "Archive: failed to read objects:\n" << Errors;
+    return;
+  }
+
+  std::vector<llvm::NewArchiveMember> NewMembers;
+  NewMembers.reserve(Members.size());
+  for (auto &M : Members) {
+    // Thin archive refers to objects by their paths.
+    if (Driver.ThinArchive)
+      M.Contents.MemberName = M.Object;
+    NewMembers.push_back(std::move(M.Contents));
+  }
+
+#ifdef __APPLE__
+  auto Kind = llvm::object::Archive::K_DARWIN;
+#else
+  auto Kind = llvm::object::Archive::K_GNU;
+#endif
+
+  levitation::Path::createDirsForFile(Archive);
+
+  auto Err = llvm::writeArchive(
+      Archive, NewMembers, /*WriteSymtab=*/true, Kind,
+      /*Deterministic=*/true, Driver.ThinArchive, std::move(OldArchiveBuf)
+  );
+
+  File::notifyChanged(Archive);
+
+  if (Err) {
+    Status.setFailure()
+    << "Archive: failed to write '" << Archive << "': "
+    << llvm::toString(std::move(Err));
+    return;
+  }
+
+  Log.log_verbose(
+      "Archive: ", Members.size() - NumReused, " of ", Members.size(),
+      " member(s) updated."
+  );
+
+  if (auto NewStamp = getFileStamp(Archive))
+    setProductState(Archive, {
+        BuildState::FileStamp(), MembersHash, *NewStamp, HashVectorTy()
+    });
+  setMemberStates();
+}
+
+/// \return path given bundle artifact is extracted to.
+static StringRef getBundledFile(
+    const FilesInfo &Files,
+    LibraryBundle::ArtifactKind Kind
+) {
+  switch (Kind) {
+    case LibraryBundle::Source:
+      return Files.Source;
+    case LibraryBundle::DeclAST:
+      return Files.DeclAST;
+    case LibraryBundle::DeclASTMeta:
+      return Files.DeclASTMetaFile;
+    case LibraryBundle::LDeps:
+      return Files.LDeps;
+    case LibraryBundle::LDepsMeta:
+      return Files.LDepsMeta;
+    default:
+      llvm_unreachable("Unknown bundle artifact");
+  }
+}
+
+void LevitationDriverImpl::writeAmalgamatedHeader() {
+  if (!Status.isValid())
+    return;
+
+  const auto &Driver = Context.Driver;
+  auto Output = getConfigOutput(Driver.AmalgamatedHeader);
+
+  // Headers of external units are shipped by their own libraries,
+  // so they are still included.
+  std::vector<std::pair<StringRef, const FilesInfo*>> Headers;
+  collectPublicHeaders(Headers);
+
+  llvm::StringSet<> Amalgamated;
+  for (const auto &H : Headers)
+    Amalgamated.insert(Path::makeRelative<SinglePath>(
+        H.second->Header, Driver.getOutputHeadersDir()
+    ));
+
+  if (Driver.DryRun || Driver.isVerbose())
+    Log.log_info(
+        "AMALGAMATE ", Headers.size(), " header(s) -> ", Output
+    );
+
+  if (Driver.DryRun)
+    return;
+
+  auto &FM = CreatableSingleton<FileManager>::get();
+  StringRef HeadComment = HeaderGenerator::getHeadComment();
+
+  // Same includes may go in several headers (e.g. preamble), keep
+  // only first of them.
+  llvm::StringSet<> Included;
+
+  std::string Text;
+  llvm::raw_string_ostream OS(Text);
+
+  OS << HeadComment;
+
+  for (const auto &H : Headers) {
+    const auto *Files = H.second;
+    auto Buffer = FM.getBufferForFile(Files->Header);
+    if (!Buffer) {
+      Status.setFailure()
+      << "Failed to read header '" << Files->Header << "'.";
+      return;
+    }
+
+    StringRef Contents = Buffer.get()->getBuffer();
+    if (Contents.startswith(HeadComment))
+      Contents = Contents.drop_front(HeadComment.size());
+
+    OS
+    << "// C++ Levitation: "
+    << Path::makeRelative<SinglePath>(
+        Files->Header, Driver.getOutputHeadersDir()
+    )
+    << "\n\n";
+
+    while (Contents.size()) {
+      StringRef Line;
+      std::tie(Line, Contents) = Contents.split('\n');
+
+      StringRef Directive = Line.trim();
+      if (Directive.startswith("#include")) {
+        StringRef Header = Directive.drop_front(strlen("#include")).trim();
+        if (Header.size() > 2)
+          Header = Header.drop_front().drop_back();
+
+        if (Amalgamated.count(Header) || !Included.insert(Directive).second)
+          continue;
+      }
+
+      OS << Line << "\n";
+    }
+
+    OS << "\n";
+  }
+
+  File F(Output, /*KeepIfUnchanged=*/true);
+  with (auto Scope = F.open())
+    Scope.getOutputStream() << OS.str();
+
+  if (F.hasErrors())
+    Status.setFailure()
+    << "Failed to write amalgamated header '" << Output << "'.";
+}
+
+void LevitationDriverImpl::collectPublicHeaders(
+    std::vector<std::pair<StringRef, const FilesInfo*>> &Headers
+) {
+  const auto &Info = *Context.DependenciesInfo;
+  const auto &Graph = Info.getDependenciesGraph();
+
+  auto Order = Info.getOrderedNodes([&] (
+      const DependenciesGraph::Node &L,
+      const DependenciesGraph::Node &R
+  ) {
+    return
+        *Strings.getItem(L.LevitationUnit->UnitPath) <
+        *Strings.getItem(R.LevitationUnit->UnitPath);
+  });
+
+  for (auto Idx : Order) {
+    const auto &N = Graph.getNodeByIndex(Idx);
+    if (
+      N.Kind != DependenciesGraph::NodeKind::Declaration ||
+      !Graph.isPublic(N.ID) ||
+      Graph.isExternal(N.ID)
+    )
+      continue;
+
+    Headers.emplace_back(
+        *Strings.getItem(N.LevitationUnit->UnitPath), &getFilesInfoFor(N)
+    );
+  }
+}
+
+void LevitationDriverImpl::writeModuleMap() {
+  if (!Status.isValid())
+    return;
+
+  const auto &Driver = Context.Driver;
+  auto Output = levitation::Path::getPath<SinglePath>(
+      Driver.getOutputHeadersDir(), DriverDefaults::MODULE_MAP
+  );
+
+  std::vector<std::pair<StringRef, const FilesInfo*>> Headers;
+  collectPublicHeaders(Headers);
+
+  ModuleMap Map;
+  for (const auto &H : Headers) {
+    SmallVector<StringRef, 8> Components;
+    H.first.split(Components, UnitIDUtils::getComponentSeparator());
+
+    // Module map paths are same on all hosts.
+    Map.add(
+        Components,
+        llvm::sys::path::convert_to_slash(Path::makeRelative<SinglePath>(
+            H.second->Header, Driver.getOutputHeadersDir()
+        ))
+    );
+  }
+
+  if (Driver.DryRun || Driver.isVerbose())
+    Log.log_info("MODULE-MAP ", Headers.size(), " header(s) -> ", Output);
+
+  if (Driver.DryRun)
+    return;
+
+  File F(Output, /*KeepIfUnchanged=*/true);
+  with (auto Scope = F.open())
+    Map.write(Scope.getOutputStream());
+
+  if (F.hasErrors())
+    Status.setFailure()
+    << "Failed to write module map '" << Output << "'.";
+}
+
+void LevitationDriverImpl::buildHeadersPCH() {
+  if (!Status.isValid())
+    return;
+
+  const auto &Driver = Context.Driver;
+  auto Output = getConfigOutput(Driver.HeadersPCH);
+
+  std::vector<std::pair<StringRef, const FilesInfo*>> Headers;
+  collectPublicHeaders(Headers);
+
+  // Umbrella header is only rewritten once set of public
+  // headers is changed.
+  auto Umbrella = levitation::Path::getPath<SinglePath>(
+      Driver.BuildRoot, DriverDefaults::PUBLIC_HEADERS
+  );
+
+  if (!Driver.DryRun) {
+    File F(Umbrella, /*KeepIfUnchanged=*/true);
+    with (auto Scope = F.open()) {
+      auto &Out = Scope.getOutputStream();
+      Out << HeaderGenerator::getHeadComment();
+      for (const auto &H : Headers)
+        Out
+        << "#include \""
+        << llvm::sys::path::convert_to_slash(Path::makeRelative<SinglePath>(
+            H.second->Header, Driver.getOutputHeadersDir()
+        ))
+        << "\"\n";
+    }
+
+    if (F.hasErrors()) {
+      Status.setFailure()
+      << "Failed to write umbrella header '" << Umbrella << "'.";
+      return;
+    }
+
+    // PCH is up-to-date if it is not older than headers it is made of.
+    auto PCHStamp = getFileStamp(Output);
+    auto isOlder = [&] (StringRef Header) {
+      auto Stamp = getFileStamp(Header);
+      return Stamp && Stamp->MTime <= PCHStamp->MTime;
+    };
+
+    bool UpToDate = PCHStamp && isOlder(Umbrella) &&
+        llvm::all_of(Headers, [&] (
+            const std::pair<StringRef, const FilesInfo*> &H
+        ) {
+          return isOlder(H.second->Header);
+        });
+
+    if (UpToDate) {
+      Log.log_verbose("Headers PCH '", Output, "' is up-to-date.");
+      return;
+    }
+  }
+
+  Paths Includes = { Driver.getOutputHeadersDir() };
+
+  if (!Commands::buildHeadersPCH(
+      Driver.BinDir,
+      Includes,
+      Umbrella,
+      Output,
+      Driver.StdLib,
+      Driver.ExtraPreambleArgs,
+      Driver.isVerbose(),
+      Driver.DryRun
+  ))
+    Status.setFailure()
+    << "Failed to precompile public headers into '" << Output << "'.";
+}
+
+void LevitationDriverImpl::writeBundle() {
+  if (!Status.isValid())
+    return;
+
+  const auto &Driver = Context.Driver;
+  auto Bundle = getConfigOutput(Driver.MakeBundle);
+
+  std::vector<StringID> Packages;
+  for (auto PackagePath : Context.ProjectPackages)
+    if (isSelected(DependenciesGraph::NodeID::get(
+        DependenciesGraph::NodeKind::Declaration, PackagePath
+    )))
+      Packages.push_back(PackagePath);
+
+  if (Driver.DryRun || Driver.isVerbose())
+    Log.log_info("BUNDLE ", Packages.size(), " unit(s) -> ", Bundle);
+
+  if (Driver.DryRun)
+    return;
+
+  // Bundled declaration ASTs are final outputs,
+  // see --lazy-cache-fetch.
+  SmallVector<StringRef, 64> BundledFiles;
+  for (auto PackagePath : Packages)
+    BundledFiles.push_back(Context.Files[PackagePath].DeclAST);
+  if (!BuildCache::get().materialize(BundledFiles)) {
+    Status.setFailure()
+    << "Bundle: failed to fetch declaration ASTs from build cache.";
+    return;
+  }
+
+  // Bundle is only rewritten if some of artifacts were changed.
+  llvm::MD5 ArtifactsMD5Builder;
+  for (auto PackagePath : Packages) {
+    const auto &Files = Context.Files[PackagePath];
+    ArtifactsMD5Builder.update(*Strings.getItem(PackagePath));
+
+    for (unsigned k = 0; k != LibraryBundle::NumArtifactKinds; ++k) {
+      BuildState::FileStamp Stamp;
+      auto File = getBundledFile(Files, (LibraryBundle::ArtifactKind)k);
+      if (auto S = getFileStamp(File))
+        Stamp = *S;
+      ArtifactsMD5Builder.update(std::to_string(Stamp.MTime));
+      ArtifactsMD5Builder.update(std::to_string(Stamp.Size));
+    }
+  }
+  llvm::MD5::MD5Result ArtifactsMD5;
+  ArtifactsMD5Builder.final(ArtifactsMD5);
+  HashVectorTy ArtifactsHash(
+      ArtifactsMD5.Bytes.begin(), ArtifactsMD5.Bytes.end()
+  );
+
+  const auto *Recorded = Context.PrevState.get(Bundle);
+  auto BundleStamp = getFileStamp(Bundle);
+  if (
+    Recorded && BundleStamp &&
+    Recorded->SourceHash == ArtifactsHash &&
+    Recorded->Product == *BundleStamp
+  ) {
+    setProductState(Bundle, *Recorded);
+    Log.log_verbose("Bundle '", Bundle, "' is up-to-date.");
+    return;
+  }
+
+  // Metas may be packed, so artifacts are read
+  // through file manager's file system.
+  auto &FM = CreatableSingleton<FileManager>::get();
+
+  std::vector<std::unique_ptr<llvm::MemoryBuffer>> Buffers;
+  std::vector<LibraryBundle::Unit> Units;
+  Units.reserve(Packages.size());
+
+  for (auto PackagePath : Packages) {
+    const auto &Files = Context.Files[PackagePath];
+
+    LibraryBundle::Unit U;
+    U.UnitID = *Strings.getItem(PackagePath);
+
+    for (unsigned k = 0; k != LibraryBundle::NumArtifactKinds; ++k) {
+      auto Kind = (LibraryBundle::ArtifactKind)k;
+
+      // Skipped declarations have no artifacts,
+      // consumers build them from source.
+      auto Buffer = FM.getBufferForFile(getBundledFile(Files, Kind));
+      if (!Buffer)
+        continue;
+
+      U.set(Kind, Buffer.get()->getBuffer());
+      Buffers.push_back(std::move(Buffer.get()));
+    }
+
+    if (!U.Present[LibraryBundle::Source]) {
+      Status.setFailure()
+      << "Bundle: failed to read source of '" << U.UnitID << "'.";
+      return;
+    }
+
+    Units.push_back(U);
+  }
+
+  Status.inheritResult(LibraryBundle::save(Bundle, Units), "Bundle: ");
+  if (!Status.isValid())
+    return;
+
+  if (auto NewStamp = getFileStamp(Bundle))
+    setProductState(Bundle, {
+        BuildState::FileStamp(), ArtifactsHash, *NewStamp, HashVectorTy()
+    });
+}
+
+void LevitationDriverImpl::runTargetsLinker() {
+  using NodeID = DependenciesGraph::NodeID;
+
+  const auto &Driver = Context.Driver;
+  const auto &Graph = Context.DependenciesInfo->getDependenciesGraph();
+
+  SmallVector<NodeID::Type, 4> TargetDefs;
+  if (!findTargets(TargetDefs))
+    return;
+
+  if (!prepareSymbolOrdering()) {
+    Status.setFailure()
+    << "Link: failed to prepare symbol ordering";
+    return;
+  }
+
+  auto LinkerArgs = Driver.ExtraLinkerArgs;
+  addSymbolOrderingArgs(LinkerArgs);
+  auto LinkOrder = getLinkOrder();
+
+  struct TargetLink {
+    StringRef UnitID;
+    SinglePath Output;
+    Paths ObjectFiles;
+    bool Linked = false;
+  };
+
+  // Executables are put into output directory, with paths of
+  // their units, e.g. tests::foo::main goes to <output>/tests/foo/main.
+  auto OutputDir = getOutput();
+
+  std::vector<TargetLink> Links(TargetDefs.size());
+  for (size_t i = 0, e = TargetDefs.size(); i != e; ++i) {
+    auto &L = Links[i];
+
+    DependenciesGraph::NodesSet Closure;
+    collectLinkClosure(TargetDefs[i], Closure);
+
+    for (auto PackagePath : LinkOrder)
+      if (Closure.count(NodeID::get(
+          DependenciesGraph::NodeKind::Definition, PackagePath
+      ))) {
+        assert(Context.Files.count(PackagePath));
+        appendLinkObjects(PackagePath, L.ObjectFiles);
+      }
+
+    auto UnitPath = Graph.getNode(TargetDefs[i]).LevitationUnit->UnitPath;
+    L.UnitID = *Strings.getItem(UnitPath);
+    SmallVector<StringRef, 8> Components;
+    L.UnitID.split(Components, UnitIDUtils::getComponentSeparator());
+
+    L.Output = OutputDir;
+    for (auto C : Components)
+      llvm::sys::path::append(L.Output, C);
+  }
+
+  TasksManager::TasksSet Tasks;
+
+  std::vector<JUnitReport::TestCase> Tests(Driver.RunTests ? Links.size() : 0);
+  std::vector<char> Tested(Tests.size());
+  TasksManager::TasksSet TestTasks;
+
+  for (size_t i = 0, e = Links.size(); i != e; ++i) {
+    auto &Link = Links[i];
+    auto TID = TM.runTask([&, &L = Link] (TasksManager::TaskContext &TC) {
+      HashVectorTy ObjectsHash;
+
+      if (!Driver.DryRun) {
+        llvm::MD5 ObjectsMD5Builder;
+        for (const auto &Obj : L.ObjectFiles) {
+          ObjectsMD5Builder.update(Obj);
+          if (auto Stamp = getFileStamp(Obj)) {
+            ObjectsMD5Builder.update(std::to_string(Stamp->MTime));
+            ObjectsMD5Builder.update(std::to_string(Stamp->Size));
+          }
+        }
+        if (Context.SymbolOrderingFile.size())
+          if (auto Stamp = getFileStamp(Context.SymbolOrderingFile))
+            ObjectsMD5Builder.update(std::to_string(Stamp->MTime));
+        llvm::MD5::MD5Result ObjectsMD5;
+        ObjectsMD5Builder.final(ObjectsMD5);
+        ObjectsHash.assign(ObjectsMD5.Bytes.begin(), ObjectsMD5.Bytes.end());
+
+        const auto *Recorded = Context.PrevState.get(L.Output);
+        auto OutputStamp = getFileStamp(L.Output);
+        if (
+          Recorded && OutputStamp &&
+          Recorded->SourceHash == ObjectsHash &&
+          Recorded->Product == *OutputStamp
+        ) {
+          setProductState(L.Output, *Recorded);
+          TC.Successful = true;
+          return;
+        }
+      }
+
+      L.Linked = true;
+
+      TC.Successful = Commands::link(
+          Driver.BinDir,
+          L.Output,
+          L.ObjectFiles,
+          Driver.StdLib,
+          Driver.Linker,
+          Driver.LinkerThreads,
+          LinkerArgs,
+          Driver.isVerbose(),
+          Driver.DryRun,
+          Driver.CanUseLibStdCppForLinker
+      );
+
+      if (!TC.Successful || Driver.DryRun)
+        return;
+
+      if (auto OutputStamp = getFileStamp(L.Output))
+        setProductState(L.Output, {
+            BuildState::FileStamp(), ObjectsHash, *OutputStamp, HashVectorTy()
+        });
+    });
+    Tasks.insert(TID);
+
+    // Target is tested as soon as it is linked, or found up-to-date,
+    // while other targets are still being linked.
+    if (Driver.RunTests)
+      TestTasks.insert(TID.then([&, i] (TasksManager::TaskContext &TC) {
+        Tests[i].Name = Links[i].UnitID.str();
+        runTest(Links[i].Output, Tests[i]);
+        Tested[i] = true;
+        TC.Successful = true;
+      }));
+  }
+
+  bool Linked = TM.waitForTasks(Tasks) && TM.allSuccessfull(Tasks);
+
+  // Tests of failed links are not run, others refer to links,
+  // so they should be complete anyway.
+  TM.waitForTasks(TestTasks);
+  for (size_t i = 0, e = Tests.size(); i != e; ++i)
+    if (Tested[i])
+      Context.TestResults.push_back(std::move(Tests[i]));
+
+  if (!Linked) {
+    Status.setFailure()
+    << "Link: phase failed";
+    return;
+  }
+
+  Paths Outputs;
+  for (const auto &L : Links)
+    Outputs.push_back(L.Output);
+  if (!packageDwarf(Outputs)) {
+    Status.setFailure()
+    << "Link: DWARF packaging failed";
+    return;
+  }
+
+  size_t NumLinked = llvm::count_if(Links, [] (const TargetLink &L) {
+    return L.Linked;
+  });
+
+  if (!NumLinked) {
+    Status.setWarning("Nothing to link.\n");
+    return;
+  }
+
+  Log.log_verbose(
+      "Link: ", NumLinked, " of ", Links.size(), " target(s) linked."
+  );
+}
+
+void LevitationDriverImpl::runTest(
+    StringRef Executable, JUnitReport::TestCase &R
+) {
+  const auto &Driver = Context.Driver;
+
+  SinglePath LogFile = Executable;
+  LogFile += ".";
+  LogFile += FileExtensions::TestLog;
+
+  std::string ErrorMessage;
+  auto Start = std::chrono::steady_clock::now();
+
+  R.ExitCode = Commands::runTest(
+      Executable, LogFile, Driver.isVerbose(), Driver.DryRun, ErrorMessage
+  );
+
+  R.Duration = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - Start
+  ).count();
+
+  if (Driver.DryRun)
+    return;
+
+  if (auto Buffer = llvm::MemoryBuffer::getFile(LogFile))
+    R.Output = Buffer.get()->getBuffer().str();
+
+  if (ErrorMessage.size()) {
+    R.Output += ErrorMessage;
+    R.Output += "\n";
+  }
+
+  // Results are printed as soon as tests are complete.
+  if (R.failed()) {
+    Log.log_error(
+        "TEST ", R.Name, " FAILED (", R.Duration / 1000, " ms)\n", R.Output
+    );
+    return;
+  }
+
+  Log.log_info("TEST ", R.Name, " PASSED (", R.Duration / 1000, " ms)");
+  if (Driver.isVerbose() && R.Output.size())
+    Log.log_info(R.Output);
+}
+
+void LevitationDriverImpl::runTests() {
+  const auto &Driver = Context.Driver;
+  auto &Results = Context.TestResults;
+
+  if (Driver.Targets.size() <= 1 && Status.isValid()) {
+    auto Output = getOutput();
+    JUnitReport::TestCase R;
+    R.Name = Driver.Targets.size() ?
+        Driver.Targets.front().str() :
+        llvm::sys::path::filename(Output).str();
+    runTest(Output, R);
+    Results.push_back(std::move(R));
+  }
+
+  if (Results.empty() || Driver.DryRun)
+    return;
+
+  size_t NumFailed = llvm::count_if(Results, [] (
+      const JUnitReport::TestCase &R
+  ) {
+    return R.failed();
+  });
+
+  Log.log_info(
+      "Test: ", Results.size() - NumFailed, " of ", Results.size(),
+      " test(s) passed."
+  );
+
+  if (Driver.JUnitFile.size()) {
+    levitation::Path::createDirsForFile(Driver.JUnitFile);
+
+    levitation::File F(Driver.JUnitFile);
+    if (auto OpenedFile = F.open())
+      JUnitReport::write(OpenedFile.getOutputStream(), "levitation", Results);
+
+    if (F.hasErrors()) {
+      Status.setFailure()
+      << "Test: failed to write JUnit report '" << Driver.JUnitFile << "'";
+      return;
+    }
+  }
+
+  if (NumFailed && Status.isValid())
+    Status.setFailure()
+    << "Test: " << NumFailed << " of " << Results.size() << " test(s) failed";
+}
+
+bool LevitationDriverImpl::packageDwarf(ArrayRef<SinglePath> Executables) {
+  const auto &Driver = Context.Driver;
+  if (!Driver.DwarfPackage)
+    return true;
+
+  TasksManager::TasksSet Tasks;
+
+  for (const auto &Executable : Executables) {
+    SinglePath Dwp = Executable;
+    Dwp += ".";
+    Dwp += FileExtensions::DwarfPackage;
+
+    // Package is made of .dwo files executable refers to,
+    // so it is up-to-date if it is not older than executable.
+    if (!Driver.DryRun) {
+      auto ExeStamp = getFileStamp(Executable);
+      auto DwpStamp = getFileStamp(Dwp);
+      if (ExeStamp && DwpStamp && DwpStamp->MTime >= ExeStamp->MTime)
+        continue;
+    }
+
+    auto TID = TM.runTask([&, Executable, Dwp] (
+        TasksManager::TaskContext &TC
+    ) {
+      TC.Successful = Commands::packageDwarf(
+          Driver.BinDir,
+          Dwp,
+          Executable,
+          Driver.isVerbose(),
+          Driver.DryRun
+      );
+    });
+
+    Tasks.insert(TID);
+  }
+
+  return TM.waitForTasks(Tasks) && TM.allSuccessfull(Tasks);
+}
+
+bool LevitationDriverImpl::runThinLTO(
+    const Paths &BitcodeFiles,
+    Paths &NativeFiles
+) {
+  const auto &Driver = Context.Driver;
+
+  if (!Commands::thinLink(
+      Driver.BinDir,
+      getOutput(),
+      BitcodeFiles,
+      Driver.StdLib,
+      Driver.LinkerThreads,
+      Driver.ExtraLinkerArgs,
+      Driver.isVerbose(),
+      Driver.DryRun,
+      Driver.CanUseLibStdCppForLinker
+  ))
+    return false;
+
+  // Backends object only depends on its bitcode and its index,
+  // the latter includes hashes of all modules it imports from.
+  // So unchanged parts of program are not compiled again on relink.
+  auto CacheDir = levitation::Path::getPath<SinglePath>(
+      Driver.BuildRoot, DriverDefaults::THINLTO_CACHE_DIR
+  );
+  LocalDirectoryCacheBackend Cache(CacheDir);
+  auto &FM = CreatableSingleton<FileManager>::get();
+
+  TasksManager::TasksSet Tasks;
+
+  for (const auto &Bitcode : BitcodeFiles) {
+    SinglePath Index = Bitcode;
+    Index += ".thinlto.bc";
+
+    SinglePath Native = Bitcode;
+    Native += ".thinlto.o";
+
+    NativeFiles.push_back(Native);
+
+    auto TID = TM.runTask([&, Bitcode, Index, Native] (
+        TasksManager::TaskContext &TC
+    ) {
+      std::string Key;
+      if (!Driver.DryRun) {
+        HashVectorTy BitcodeHash, IndexHash;
+        if (
+          calcHashFromFile(FM, metaHash(), BitcodeHash, Bitcode) &&
+          calcHashFromFile(FM, metaHash(), IndexHash, Index)
+        ) {
+          Key = BuildCacheKey()
+              .add("thinlto-backend")
+              .add(getClangFullVersion())
+              .add(getHashKindName(metaHash()))
+              .add(BitcodeHash)
+              .add(IndexHash)
+              .addAll(Context.CodeGenArgs)
+              .done();
+        }
+      }
+
+      if (Key.size() && Cache.fetch(Key, Native)) {
+        Log.log_verbose("ThinLTO: reused cached backend object for ", Bitcode);
+        TC.Successful = true;
+        return;
+      }
+
+      TC.Successful = Commands::thinBackend(
+          Driver.BinDir,
+          Native,
+          Bitcode,
+          Index,
+          Context.CodeGenArgs,
+          Driver.ThinLTOExecutor,
+          Driver.isVerbose(),
+          Driver.DryRun,
+          Driver.Execution
+      );
+
+      if (TC.Successful && Key.size())
+        Cache.store(Key, Native);
+    });
+
+    Tasks.insert(TID);
+  }
+
+  return TM.waitForTasks(Tasks) && TM.allSuccessfull(Tasks);
+}
+
+bool LevitationDriverImpl::runPackageLinks(Paths &ObjectFiles, bool Shared) {
+  const auto &Driver = Context.Driver;
+
+  // Group objects by top-level package directory, that is
+  // by first component of unit ID.
+  std::map<std::string, Paths> Groups;
+  Paths RootObjects;
+  for (auto PackagePath : getLinkOrder()) {
+    StringRef UnitID = *Strings.getItem(PackagePath);
+
+    auto Split = UnitID.split(UnitIDUtils::getComponentSeparator());
+    if (Split.second.empty())
+      appendLinkObjects(PackagePath, RootObjects);
+    else
+      appendLinkObjects(PackagePath, Groups[Split.first.str()]);
+  }
+
+  auto Variant = getObjectsVariant();
+
+  auto &TM = TasksManager::get();
+  TasksManager::TasksSet Tasks;
+
+  ObjectFiles.swap(RootObjects);
+
+  for (const auto &G : Groups) {
+    SinglePath Partial = levitation::Path::getPath<SinglePath>(
+        Driver.BuildRoot,
+        Shared ?
+            DriverDefaults::SHARED_PACKAGES_DIR :
+            DriverDefaults::PARTIAL_LINKS_DIR
+    );
+    llvm::sys::path::append(Partial, Shared ? "lib" + G.first : G.first);
+    if (Variant.size()) {
+      Partial += ".";
+      Partial += Variant;
+    }
+    Partial += ".";
+    Partial += Shared ? FileExtensions::SharedLibrary : FileExtensions::Object;
+
+    ObjectFiles.push_back(Partial);
+
+    auto TID = TM.runTask([&, Partial] (TasksManager::TaskContext &TC) {
+      const auto &Objects = G.second;
+
+      auto link = [&] {
+        if (!Shared)
+          return Commands::partialLink(
+              Driver.BinDir,
+              Partial,
+              Objects,
+              Driver.Linker,
+              Driver.LinkerThreads,
+              Driver.isVerbose(),
+              Driver.DryRun
+          );
+
+        return Commands::linkShared(
+            Driver.BinDir,
+            Partial,
+            Objects,
+            Driver.StdLib,
+            Driver.Linker,
+            Driver.LinkerThreads,
+            Driver.ExtraLinkerArgs,
+            Driver.isVerbose(),
+            Driver.DryRun,
+            Driver.CanUseLibStdCppForLinker
+        );
+      };
+
+      if (Driver.DryRun) {
+        TC.Successful = link();
+        return;
+      }
+
+      // Package product depends on set of objects and on their stamps.
+      llvm::MD5 GroupMD5Builder;
+      for (const auto &Obj : Objects) {
+        auto Stamp = getFileStamp(Obj);
+        if (!Stamp) {
+          TC.Successful = false;
+          return;
+        }
+        GroupMD5Builder.update(Obj);
+        GroupMD5Builder.update(std::to_string(Stamp->MTime));
+        GroupMD5Builder.update(std::to_string(Stamp->Size));
+      }
+      llvm::MD5::MD5Result GroupMD5;
+      GroupMD5Builder.final(GroupMD5);
+      HashVectorTy GroupHash(GroupMD5.Bytes.begin(), GroupMD5.Bytes.end());
+
+      const auto *Recorded = Context.PrevState.get(Partial);
+      auto PartialStamp = getFileStamp(Partial);
+      if (
+        Recorded && PartialStamp &&
+        Recorded->SourceHash == GroupHash &&
+        Recorded->Product == *PartialStamp
+      ) {
+        Log.log_verbose("Package link '", Partial, "' is up-to-date.");
+        setProductState(Partial, *Recorded);
+        TC.Successful = true;
+        return;
+      }
+
+      TC.Successful = link();
+
+      if (!TC.Successful)
+        return;
+
+      if (auto NewStamp = getFileStamp(Partial))
+        setProductState(Partial, {
+            BuildState::FileStamp(), GroupHash, *NewStamp, HashVectorTy()
+        });
+    });
+
+    Tasks.insert(TID);
+  }
+
+  return TM.waitForTasks(Tasks) && TM.allSuccessfull(Tasks);
+}
+
+void LevitationDriverImpl::collectSources() {
+  initCompilerFingerprint();
+  collectProjectSources();
+  collectLibrariesSources();
+}
+
+void LevitationDriverImpl::initCompilerFingerprint() {
+  if (Context.CompilerFingerprint.size() || Context.Driver.DryRun)
+    return;
+
+  SinglePath Compiler;
+  if (Context.Driver.BinDir.size()) {
+    Compiler = Context.Driver.BinDir;
+    llvm::sys::path::append(Compiler, "clang");
+  } else if (auto Found = llvm::sys::findProgramByName("clang"))
+    Compiler = *Found;
+
+  Context.CompilerFingerprint = LibraryCache::getCompilerFingerprint(Compiler);
+}
+
+void LevitationDriverImpl::collectProjectSources() {
+
+  Log.log_verbose("Collecting project sources...");
+
+  // Gather all .cppl files
+  Paths ProjectPackages;
+
+  if (Context.Driver.SourcesManifest.size()) {
+    if (!readSourcesManifest(ProjectPackages))
+      return;
+  } else {
+    FileSystem::collectFilesParallel(
+        ProjectPackages,
+        Context.Driver.SourcesRoot,
+        FileExtensions::SourceCode,
+        /*ignore dirs*/ { Context.Driver.getBuildRoot() }
+    );
+  }
+
+  DenseMap<StringID, SinglePath> RelPaths;
+
+  // Normalize all paths to project .cppl files and register them.
+  for (const auto &Src : ProjectPackages) {
+    auto Rel = levitation::Path::makeRelative<SinglePath>(
+        Src, Context.Driver.SourcesRoot
+    );
+
+    auto UnitIdentifier = UnitIDUtils::fromRelPath(Rel);
+    auto UnitID = Strings.addItem(StringRef(UnitIdentifier));
+    RelPaths.try_emplace(UnitID, Rel);
+
+    Context.ProjectPackages.insert(UnitID);
+    Context.AllPackages.insert(UnitID);
+  }
+
+  for (auto UnitID : Context.ProjectPackages) {
+
+    //const auto& UnitPath = *Strings.getItem(UnitID);
+    const auto& PackagePath = RelPaths[UnitID];
+
+    Log.log_trace("  Generating paths for '", PackagePath, "'...");
+
+
+    auto &Files = Context.Files.create(UnitID);
+
+    // In current implementation package path is equal to relative source path.
+
+    Files.Source = Context.Files.intern(Path::getPath<SinglePath>(
+        Context.Driver.SourcesRoot,
+        PackagePath,
+        FileExtensions::SourceCode
+    ));
+
+    Files.Header = Context.Files.intern(Path::getPath<SinglePath>(
+        Context.Driver.getOutputHeadersDir(),
+        PackagePath,
+        FileExtensions::Header
+    ));
+
+    Files.Decl = Context.Files.intern(Path::getPath<SinglePath>(
+        Context.Driver.getOutputDeclsDir(),
+        PackagePath,
+        FileExtensions::SourceCode
+    ));
+
+    SinglePath OutputTemplate = Path::getPath<SinglePath>(
+        Context.Driver.BuildRoot,
+        PackagePath
+    );
+
+    setOutputFilesInfo(Files, OutputTemplate, true);
+
+    Files.dump(Log, log::Level::Trace, 4);
+  }
+
+  Log.log_verbose(
+    "Found ", Context.ProjectPackages.size(),
+    " '.", FileExtensions::SourceCode,
+    "' project files.\n" // it was meant to put extra new line here
+  );
+}
+
+bool LevitationDriverImpl::readSourcesManifest(Paths &Dest) {
+  StringRef ManifestFile = Context.Driver.SourcesManifest;
+
+  Log.log_verbose("Reading sources manifest '", ManifestFile, "'...");
+
+  auto Buffer = llvm::MemoryBuffer::getFile(ManifestFile);
+  if (!Buffer) {
+    Status.setFailure()
+    << "Failed to open sources manifest '" << ManifestFile << "'.";
+    return false;
+  }
+
+  SmallVector<StringRef, 64> Lines;
+  Buffer.get()->getBuffer().split(Lines, '\n', -1, /*KeepEmpty*/false);
+
+  for (auto Line : Lines) {
+    Line = Line.trim();
+    if (Line.empty() || Line.startswith("#"))
+      continue;
+
+    SinglePath Src;
+    if (llvm::sys::path::is_absolute(Line))
+      Src = Line;
+    else
+      Src = Path::getPath<SinglePath>(Context.Driver.SourcesRoot, Line);
+
+    if (!fileExists(Src)) {
+      Status.setFailure()
+      << "Source '" << Src << "' listed in manifest doesn't exist.";
+      return false;
+    }
+
+    Log.log_trace("  Found '", Src, "'...");
+    Dest.push_back(Src);
+  }
+
+  return true;
+}
+
+void LevitationDriverImpl::collectLibrariesSources() {
+
+  collectBundlesSources();
+
+  if (Context.Driver.LevitationLibs.empty())
+    return;
+
+  Log.log_verbose("Collecting libraries (presumable declaration) sources...");
+
+  bool CacheLibraries =
+      LibraryCache::get().isEnabled() && !Context.Driver.DryRun;
+
+  // Register all external packages.
+
+  for (auto &CollectedExtLib : Context.Driver.LevitationLibs) {
+
+    Path::Builder ExtLibPath;
+    ExtLibPath
+      .addComponent(Context.Driver.SourcesRoot)
+      .addComponent(CollectedExtLib)
+      .done();
+
+    auto ExtLibAbsPath = Path::makeAbsolute<SinglePath>(ExtLibPath.str());
+
+    Log.log_verbose("  Checking dir '", CollectedExtLib, "'...");
+    Paths ExternalPackages;
+    FileSystem::collectFilesParallel(
+        ExternalPackages,
+        ExtLibAbsPath,
+        FileExtensions::SourceCode,
+        /*ignore dirs*/ { Context.Driver.getBuildRoot() }
+    );
+
+    // Library version is identified by its contents, so that
+    // projects which use same version share its artifacts.
+    SinglePath LibraryOutDir;
+    Path::Builder PBLibraryOutDir;
+    PBLibraryOutDir
+      .addComponent(Context.Driver.BuildRoot)
+      .addComponent(Context.Driver.LibsOutSubDir)
+      .addComponent(ExtLibAbsPath)
+      .done(LibraryOutDir);
+    auto &LibraryUnits = Context.LibraryUnits[LibraryOutDir.str().str()];
+
+    std::string LibraryHash;
+    if (CacheLibraries) {
+      LibraryHash = LibraryCache::getLibraryHash(ExtLibAbsPath, ExternalPackages);
+      if (LibraryHash.empty())
+        Log.log_warning(
+            "Failed to read library '", CollectedExtLib,
+            "', it won't be shared through library cache."
+        );
+    }
+
+    for (const auto &CollectedPath : ExternalPackages) {
+      auto PackagePath = Path::makeAbsolute<SinglePath>(CollectedPath);
+      auto Package = Path::makeRelative<SinglePath>(PackagePath, ExtLibAbsPath);
+      auto UnitIdentifier = UnitIDUtils::fromRelPath(Package);
+
+      auto UnitID = Strings.addItem(StringRef(UnitIdentifier));
+
+      Context.ExternalPackages.insert(UnitID);
+      Context.AllPackages.insert(UnitID);
+
+      if (LibraryHash.size())
+        Context.LibraryHashes[UnitIdentifier] = LibraryHash;
+
+      Log.log_trace(
+          "Checking lib package '", UnitIdentifier, "' -> '", PackagePath, "'..."
+      );
+
+      auto &Files = Context.Files.create(UnitID);
+
+      // For libraries sources keep absolute source paths
+
+      Files.Source = Context.Files.intern(Path::replaceExtension<SinglePath>(
+          PackagePath,
+          FileExtensions::SourceCode
+      ));
+
+      SinglePath Header;
+      Path::Builder PBHeader;
+      PBHeader
+        .addComponent(Context.Driver.getOutputHeadersDir())
+        .addComponent(Context.Driver.LibsOutSubDir)
+        .addComponent(PackagePath)
+        .replaceExtension(FileExtensions::Header)
+        .done(Header);
+      Files.Header = Context.Files.intern(Header);
+
+      // Note, we don't generate decl .cpp files for levitation libraries.
+      // Source file itself is a decl file.
+
+      SinglePath OutputTemplate;
+
+      Path::Builder PBOutputTemplate;
+      PBOutputTemplate
+        .addComponent(Context.Driver.BuildRoot)
+        .addComponent(Context.Driver.LibsOutSubDir)
+        .addComponent(PackagePath)
+        .done(OutputTemplate);
+
+      setOutputFilesInfo(Files, OutputTemplate, false);
+
+      Context.LibraryMetaFiles.insert(Files.DeclASTMetaFile);
+      LibraryUnits.push_back(UnitID);
+
+      Files.dump(Log, log::Level::Trace, 4);
+    }
+  }
+
+  Log.log_verbose(
+    "Found ", Context.ExternalPackages.size(),
+    " '.", FileExtensions::SourceCode,
+    "' files.\n" // it was meant to put extra new line here.
+  );
+}
+
+void LevitationDriverImpl::collectBundlesSources() {
+
+  for (auto BundleFile : Context.Driver.LevitationBundles) {
+
+    RunContext::BundleInfo Info;
+    Info.Path = Path::makeAbsolute<SinglePath>(BundleFile);
+    Info.Bundle = std::make_shared<LibraryBundle>();
+
+    Log.log_verbose("  Reading bundle '", BundleFile, "'...");
+
+    auto Opened = Info.Bundle->open(Info.Path);
+    if (!Opened.isValid()) {
+      Status.inheritResult(Opened, "Library bundle: ");
+      return;
+    }
+
+    // Bundle units are extracted into directory named after bundle,
+    // next to regular libraries outputs.
+    SinglePath BundleDir;
+    Path::Builder PBBundleDir;
+    PBBundleDir
+      .addComponent(Context.Driver.BuildRoot)
+      .addComponent(Context.Driver.LibsOutSubDir)
+      .addComponent(Info.Path)
+      .done(BundleDir);
+    llvm::sys::path::replace_extension(BundleDir, "");
+
+    for (const auto &U : Info.Bundle->units()) {
+
+      if (!U.Present[LibraryBundle::Source]) {
+        Status.setFailure()
+        << "Library bundle '" << BundleFile << "': unit '"
+        << U.UnitID << "' has no source.";
+        return;
+      }
+
+      auto UnitID = Strings.addItem(U.UnitID);
+
+      if (Context.AllPackages.count(UnitID)) {
+        Log.log_warning(
+            "Unit '", U.UnitID, "' of bundle '", BundleFile,
+            "' is already defined, bundled unit is ignored."
+        );
+        continue;
+      }
+
+      Context.ExternalPackages.insert(UnitID);
+      Context.AllPackages.insert(UnitID);
+      Info.Packages.push_back(UnitID);
+
+      SmallVector<StringRef, 8> Components;
+      U.UnitID.split(Components, UnitIDUtils::getComponentSeparator());
+
+      Path::Builder PBOutputTemplate;
+      PBOutputTemplate.addComponent(BundleDir);
+      for (auto C : Components)
+        PBOutputTemplate.addComponent(C);
+
+      SinglePath OutputTemplate;
+      PBOutputTemplate.done(OutputTemplate);
+
+      auto &Files = Context.Files.create(UnitID);
+
+      Files.Source = Context.Files.intern(Path::replaceExtension<SinglePath>(
+          OutputTemplate,
+          FileExtensions::SourceCode
+      ));
+
+      SinglePath Header;
+      Path::Builder PBHeader;
+      PBHeader
+        .addComponent(Context.Driver.getOutputHeadersDir())
+        .addComponent(Context.Driver.LibsOutSubDir)
+        .addComponent(Files.Source)
+        .replaceExtension(FileExtensions::Header)
+        .done(Header);
+      Files.Header = Context.Files.intern(Header);
+
+      setOutputFilesInfo(Files, OutputTemplate, false);
+
+      Context.LibraryMetaFiles.insert(Files.DeclASTMetaFile);
+
+      Files.dump(Log, log::Level::Trace, 4);
+    }
+
+    Log.log_verbose(
+        "  Found ", Info.Packages.size(), " unit(s) in bundle '",
+        BundleFile, "'."
+    );
+
+    Context.Bundles.push_back(std::move(Info));
+  }
+}
+
+void LevitationDriverImpl::extractBundles() {
+  if (!Status.isValid())
+    return;
+
+  for (const auto &B : Context.Bundles) {
+
+    auto Stamp = getFileStamp(B.Path);
+    if (!Stamp) {
+      Status.setFailure()
+      << "Library bundle '" << B.Path << "' has gone.";
+      return;
+    }
+
+    // Extracted contents are trusted until bundle is replaced,
+    // up-to-date checks of units take care of the rest.
+    const auto *Recorded = Context.PrevState.get(B.Path);
+    bool Extracted = Recorded && Recorded->Product == *Stamp;
+
+    for (auto PackageID : B.Packages)
+      if (!fileExists(Context.Files[PackageID].Source))
+        Extracted = false;
+
+    if (!Extracted) {
+      Log.log_verbose("Extracting bundle '", B.Path, "'...");
+
+      if (Context.Driver.DryRun)
+        continue;
+
+      TasksManager::TasksSet Tasks;
+      std::mutex ErrorsMutex;
+      std::string Errors;
+
+      auto Units = B.Bundle->units();
+      for (size_t i = 0, e = Units.size(), p = 0; i != e; ++i) {
+
+        // Units ignored by collectBundlesSources have no packages.
+        if (p == B.Packages.size() ||
+            *Strings.getItem(B.Packages[p]) != Units[i].UnitID)
+          continue;
+
+        const auto &U = Units[i];
+        const auto &Files = Context.Files[B.Packages[p++]];
+
+        auto TID = TM.runTask([&, &U = U, &Files = Files] (
+            TasksManager::TaskContext &TC
+        ) {
+          TC.Successful = true;
+
+          for (unsigned k = 0; k != LibraryBundle::NumArtifactKinds; ++k) {
+            auto Kind = (LibraryBundle::ArtifactKind)k;
+            auto Dest = getBundledFile(Files, Kind);
+
+            if (!U.Present[k]) {
+              // Missed artifacts are built from source.
+              llvm::sys::fs::remove(Dest);
+              File::notifyChanged(Dest);
+              continue;
+            }
+
+            File F(Dest);
+            with (auto Scope = F.open()) {
+              Scope.getOutputStream() << U.Artifacts[k];
+            }
+
+            if (F.hasErrors()) {
+              with (auto _ = lock(ErrorsMutex)) {
+                Errors += "'" + Dest.str() + "'\n";
+              }
+              TC.Successful = false;
+            }
+          }
+        });
+        Tasks.insert(TID);
+      }
+
+      if (!TM.waitForTasks(Tasks) || !TM.allSuccessfull(Tasks)) {
+        Status.setFailure()
+        << "Library bundle '" << B.Path << "': failed to write:\n"
+        << Errors;
+        return;
+      }
+    }
+
+    setProductState(B.Path, {
+        BuildState::FileStamp(), HashVectorTy(), *Stamp, HashVectorTy()
+    });
+  }
+}
+
+void LevitationDriverImpl::setOutputFilesInfo(
+    FilesInfo &Files,
+    StringRef OutputPathWithoutExt,
+    bool SetObjectRelatedInfo
+) {
+    // In current implementation package path is equal to relative source path.
+
+    auto &Map = Context.Files;
+
+    Files.LDeps = Map.intern(Path::replaceExtension<SinglePath>(
+        OutputPathWithoutExt, FileExtensions::ParsedDependencies
+    ));
+
+    Files.LDepsMeta = Map.intern(Path::replaceExtension<SinglePath>(
+        OutputPathWithoutExt, FileExtensions::ParsedDependenciesMeta
+    ));
+
+    Files.DeclAST = Map.intern(Path::replaceExtension<SinglePath>(
+        OutputPathWithoutExt, FileExtensions::DeclarationAST
+    ));
+
+    // Embedded meta is loaded from declaration AST tail,
+    // see DeclASTMetaLoader.
+    Files.DeclASTMetaFile = Context.Driver.EmbedMeta ?
+        Files.DeclAST :
+        Map.intern(Path::replaceExtension<SinglePath>(
+            OutputPathWithoutExt, FileExtensions::DeclASTMeta
+        ));
+
+    if (SetObjectRelatedInfo)
+      setObjectFilesInfo(Files, OutputPathWithoutExt);
+}
+
+void LevitationDriverImpl::setObjectFilesInfo(
+    FilesInfo &Files,
+    StringRef OutputPathWithoutExt
+) {
+  SinglePath ObjectWithoutExt = OutputPathWithoutExt;
+  auto Variant = getObjectsVariant();
+  if (Variant.size()) {
+    ObjectWithoutExt += ".";
+    ObjectWithoutExt += Variant;
+  }
+
+  auto &Map = Context.Files;
+
+  Files.ObjMetaFile = Map.intern(Path::replaceExtension<SinglePath>(
+      ObjectWithoutExt, FileExtensions::ObjMeta
+  ));
+  Files.Object = Map.intern(Path::replaceExtension<SinglePath>(
+      ObjectWithoutExt, FileExtensions::Object
+  ));
+
+  if (Context.Driver.KeepIR)
+    Files.IR = Map.intern(Path::replaceExtension<SinglePath>(
+        ObjectWithoutExt, FileExtensions::IR
+    ));
+
+  // Same name clang driver gives to .dwo of object.
+  if (Context.Driver.SplitDwarf)
+    Files.SplitDwarf = Map.intern(Path::replaceExtension<SinglePath>(
+        ObjectWithoutExt, FileExtensions::SplitDwarf
+    ));
+}
+
+void LevitationDriverImpl::selectConfig(
+    const LevitationDriver::BuildConfig *Config
+) {
+  Context.Config = Config;
+
+  Context.CodeGenArgs = Context.Driver.ExtraCodeGenArgs;
+  if (Config)
+    Context.CodeGenArgs.append(
+        Config->CodeGenArgs.begin(), Config->CodeGenArgs.end()
+    );
+
+  const auto &FilesMap = Context.Files.getMap();
+  for (auto PackagePath : Context.ProjectPackages) {
+    auto Found = FilesMap.find(PackagePath);
+    assert(Found != FilesMap.end());
+    auto &Files = *Found->second;
+    setObjectFilesInfo(
+        Files, Path::replaceExtension<SinglePath>(Files.DeclAST, "")
+    );
+  }
+
+  // Link phase only needs objects of current configuration.
+  Context.ObjectsUpdated = false;
+}
+
+std::string LevitationDriverImpl::getObjectsVariant() const {
+  std::string Variant;
+  if (Context.Config)
+    Variant = Context.Config->Name;
+
+  auto Profile = Context.Driver.getProfileVariant();
+  if (Profile.size()) {
+    if (Variant.size())
+      Variant += ".";
+    Variant += Profile;
+  }
+
+  // Position independent objects for shared packages.
+  if (Context.Driver.SharedPackages) {
+    if (Variant.size())
+      Variant += ".";
+    Variant += "pic";
+  }
+
+  return Variant;
+}
+
+SinglePath LevitationDriverImpl::getOutput() const {
+  return getConfigOutput(Context.Driver.Output);
+}
+
+SinglePath LevitationDriverImpl::getConfigOutput(StringRef Output) const {
+  if (!Context.Config)
+    return Output;
+
+  // Each configuration gets its own subdirectory,
+  // e.g. a.out for 'debug' is linked into debug/a.out.
+  SinglePath ConfigOutput = llvm::sys::path::parent_path(Output);
+  llvm::sys::path::append(
+      ConfigOutput,
+      Context.Config->Name,
+      llvm::sys::path::filename(Output)
+  );
+  return ConfigOutput;
+}
+
+// TODO Levitation: try to make this method const.
+bool LevitationDriverImpl::processDependencyNode(
+    const DependenciesGraph::Node &N
+) {
+  if (
+    Context.DeclarationsProcessed &&
+    N.Kind == DependenciesGraph::NodeKind::Declaration
+  )
+    return true;
+
+  // Declaration AST is already built by streaming pipeline.
+  if (Streaming && N.Kind == DependenciesGraph::NodeKind::Declaration) {
+    auto Found = Streaming->StreamedOldMetas.find(N.LevitationUnit->UnitPath);
+    if (Found != Streaming->StreamedOldMetas.end())
+      return processDeclaration(Found->second, N, /*AlreadyBuilt=*/true);
+  }
+
+  // Check mode has neither objects, nor IR, definitions
+  // keep their own stamps.
+  if (
+    Context.Driver.Check &&
+    N.Kind == DependenciesGraph::NodeKind::Definition
+  )
+    return processCheck(N);
+
+  if (isCodelessDefinition(N))
+    return skipCodelessDefinition(N);
+
+  // Neither node, nor its dependencies have changed inputs.
+  if (isPrecheckedClean(N.ID)) {
+    ++DriverStats::get().NodesChecked;
+    replayDiagnostics(N);
+    return processIR(N);
+  }
+
+  DeclASTMeta ExistingMeta;
+  if (isUpToDate(ExistingMeta, N)) {
+    noteCodeless(N, ExistingMeta);
+    replayDiagnostics(N);
+    return processIR(N);
+  }
+
+  // Other invocation on same build root may be building same node,
+  // in this case its product is likely up-to-date once it is done.
+  ArtifactLock Lock;
+  StringRef LockedProduct, LockedMeta;
+  if (
+    Context.Driver.SharedBuildRoot &&
+    !Context.Driver.DryRun &&
+    getProductFiles(N, LockedProduct, LockedMeta) &&
+    lockProduct(Lock, LockedProduct, LockedMeta) &&
+    isUpToDate(ExistingMeta, N)
+  ) {
+    noteCodeless(N, ExistingMeta);
+    // Product is new for this invocation, so dependents
+    // should check it, as if it was built here.
+    if (N.Kind == DependenciesGraph::NodeKind::Declaration)
+      setNodeUpdated(N.ID);
+    else
+      setObjectsUpdated();
+    return processIR(N);
+  }
+
+  // Node is going to be compiled, so there is time to
+  // read what comes next.
+  prefetchDependents(N);
+
+  auto SourceStamp = getFileStamp(getFilesInfoFor(N).Source);
+
+  StepSpeculation PrevSpeculation = CurrentStepSpeculation;
+  CurrentStepSpeculation = getSpeculation(N);
+  auto SpeculationScope = llvm::make_scope_exit([&] {
+    CurrentStepSpeculation = PrevSpeculation;
+  });
+
+  bool PrevLowPriority = CurrentStepLowPriority;
+  CurrentStepLowPriority = isLowPriority(N);
+  auto PriorityScope = llvm::make_scope_exit([&] {
+    CurrentStepLowPriority = PrevLowPriority;
+  });
+
+  bool Res = runTimed(
+      getStepKind(N),
+      *Strings.getItem(N.LevitationUnit->UnitPath),
+      [&] {
+        switch (N.Kind) {
+          case DependenciesGraph::NodeKind::Declaration:
+            return processDeclaration(ExistingMeta, N);
+          case DependenciesGraph::NodeKind::Definition: {
+            return processDefinition(N);
+          }
+          default:
+            llvm_unreachable("Unknown dependency kind");
+        }
+      }
+  );
+
+  StringRef ProductFile, MetaFile;
+  if (Res && getProductFiles(N, ProductFile, MetaFile)) {
+    updateProductState(ProductFile, MetaFile, SourceStamp);
+
+    bool Declaration = N.Kind == DependenciesGraph::NodeKind::Declaration;
+    journalProduct(
+        ProductFile,
+        Declaration,
+        !Declaration || Context.UpdatedNodes.count(N.ID),
+        SourceStamp
+    );
+  }
+
+  return Res && processIR(N);
+}
+
+template <typename FnTy>
+bool LevitationDriverImpl::runTimed(
+    BuildHistory::StepKind Kind,
+    StringRef UnitPath,
+    FnTy &&Fn
+) {
+  // Don't start new steps once build is cancelled.
+  if (TM.isCancelled())
+    return false;
+
+  // Steps may be nested, e.g. batch of unity definitions.
+  StepMemory PrevStepMemory = CurrentStepMemory;
+  CurrentStepMemory = StepMemory();
+  CurrentStepMemory.Expected = getExpectedMemory(Kind, UnitPath);
+
+  const auto *Callbacks = Context.Callbacks;
+  if (Callbacks && Callbacks->JobStarted)
+    Callbacks->JobStarted(BuildHistory::getStepKindName(Kind), UnitPath);
+
+  auto Start = std::chrono::steady_clock::now();
+
+  bool Res = Fn();
+
+  if (Callbacks && Callbacks->JobFinished)
+    Callbacks->JobFinished(
+        BuildHistory::getStepKindName(Kind), UnitPath, Res
+    );
+
+  StepMemory Memory = CurrentStepMemory;
+  CurrentStepMemory = PrevStepMemory;
+
+  if (!Res) {
+    onStepFailed();
+    return Res;
+  }
+
+  if (Context.Driver.DryRun)
+    return Res;
+
+  auto Duration = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - Start
+  ).count();
+
+  with (auto _ = lock(Context.TimingsMutex)) {
+    Context.Timings.setDuration(Kind, UnitPath, Duration);
+    if (Memory.Peak)
+      Context.Timings.setPeakMemory(Kind, UnitPath, Memory.Peak);
+  }
+
+  return Res;
+}
+
+template <typename FnTy>
+bool LevitationDriverImpl::runCached(
+    StringRef Key,
+    ArrayRef<BuildCache::Artifact> Artifacts,
+    FnTy &&Fn
+) {
+  auto &Cache = BuildCache::get();
+
+  if (Key.empty() || Context.Driver.DryRun || !Cache.isEnabled())
+    return Fn();
+
+  if (Cache.fetch(Key, Artifacts)) {
+    for (const auto &A : Artifacts)
+      if (A.Name == "diagnostics")
+        replayDiagnostics(A.Path);
+    return true;
+  }
+
+  if (!Fn())
+    return false;
+
+  storeInCache(Key, Artifacts);
+  return true;
+}
+
+void LevitationDriverImpl::replayDiagnostics(StringRef DiagnosticsFile) {
+  if (!diagnosticsReplayEnabled())
+    return;
+
+  // Products built before replay was enabled have no diagnostics.
+  if (!fileExists(DiagnosticsFile))
+    return;
+
+  std::string Text;
+  int NumDiagnostics = DiagnosticsReplay::read(DiagnosticsFile, Text);
+  if (NumDiagnostics < 0) {
+    Log.log_verbose("Failed to read diagnostics '", DiagnosticsFile, "'.");
+    return;
+  }
+
+  if (NumDiagnostics == 0)
+    return;
+
+  ++DriverStats::get().DiagnosticsReplayed;
+  Log.log_info(StringRef(Text).rtrim());
+}
+
+void LevitationDriverImpl::replayDiagnostics(const DependenciesGraph::Node &N) {
+  StringRef ProductFile, MetaFile;
+  if (diagnosticsReplayEnabled() && getProductFiles(N, ProductFile, MetaFile))
+    replayDiagnostics(getDiagnosticsFile(ProductFile));
+}
+
+void LevitationDriverImpl::storeInCache(
+    StringRef Key,
+    ArrayRef<BuildCache::Artifact> Artifacts
+) {
+  std::string KeyCopy = Key.str();
+
+  std::vector<std::pair<std::string, std::string>> ArtifactsCopy;
+  for (const auto &A : Artifacts)
+    ArtifactsCopy.emplace_back(A.Name.str(), A.Path.str());
+
+  ArtifactPublisher::get().publish([KeyCopy, ArtifactsCopy] {
+    std::vector<BuildCache::Artifact> Stored;
+    for (const auto &A : ArtifactsCopy)
+      Stored.push_back({A.first, A.second});
+
+    // Cache is only an optimization, so failed upload
+    // doesn't fail the build.
+    BuildCache::get().store(KeyCopy, Stored);
+    return true;
+  });
+}
+
+void LevitationDriverImpl::waitForPublication() {
+  if (unsigned Failed = ArtifactPublisher::get().wait())
+    Status.setFailure()
+    << "Failed to publish " << Failed << " artifact(s).";
+}
+
+std::string LevitationDriverImpl::getCacheKey(
+    StringRef StepName,
+    StringRef SourceFile,
+    const Paths &DepsMetaFiles,
+    const LevitationDriver::Args &ExtraArgs,
+    bool UsesPreamble
+) {
+  if (Context.Driver.DryRun || !BuildCache::get().isEnabled())
+    return "";
+
+  return getStepKey(
+      StepName, SourceFile, DepsMetaFiles, ExtraArgs, UsesPreamble
+  );
+}
+
+std::string LevitationDriverImpl::getStepKey(
+    StringRef StepName,
+    StringRef SourceFile,
+    const Paths &DepsMetaFiles,
+    const LevitationDriver::Args &ExtraArgs,
+    bool UsesPreamble
+) {
+  const auto &Driver = Context.Driver;
+
+  BuildCacheKey Key;
+  Key.add(StepName).add(getClangFullVersion());
+
+  // Artifacts contain source paths, so they may be only shared between
+  // builds with same source and build roots, unless paths are kept
+  // relative to sources root.
+  if (Driver.PortableSourcesRoot.empty()) {
+    for (auto Root : { Driver.SourcesRoot, Driver.BuildRoot }) {
+      SinglePath AbsRoot = Root;
+      llvm::sys::fs::make_absolute(AbsRoot);
+      Key.add(AbsRoot);
+    }
+  }
+
+  Key.add(getPortablePath(SourceFile));
+
+  // Step artifacts include metas, which are written with
+  // selected algorithm, so it is a part of key as well.
+  HashVectorTy SrcHash;
+  if (!SourceDigests::get().getHash(SourceFile, metaHash(), SrcHash))
+    return "";
+  Key.add(getHashKindName(metaHash())).add(SrcHash);
+
+  auto PreambleOutputMeta = getPreambleOutputMeta(SourceFile);
+  if (UsesPreamble && PreambleOutputMeta.size()) {
+    DeclASTMeta PreambleMeta;
+    if (!loadMeta(
+        PreambleMeta, Driver.BuildRoot, PreambleOutputMeta
+    ))
+      return "";
+    Key.add(PreambleMeta.getDeclASTHash());
+  }
+
+  for (const auto &MetaFile : DepsMetaFiles) {
+    DeclASTMeta DepMeta;
+    if (!loadMeta(DepMeta, Driver.BuildRoot, MetaFile))
+      return "";
+    Key
+    .add(getPortablePath(MetaFile))
+    .add(getDependencyFingerprint(DepMeta, MetaFile));
+  }
+
+  for (const auto &Include : Driver.Includes)
+    Key.add(getPortablePath(Include));
+
+  Key
+  .add(Driver.StdLib)
+  .addAll(ExtraArgs);
+
+  return Key.done();
+}
+
+std::string LevitationDriverImpl::getCommandHash(
+    StringRef StepName,
+    const LevitationDriver::Args &ExtraArgs,
+    const Paths &FullDeps
+) {
+  const auto &Driver = Context.Driver;
+
+  if (Driver.DryRun)
+    return "";
+
+  // Sources and dependencies are checked separately, so only
+  // compiler and flags are fingerprinted.
+  BuildCacheKey Key;
+  Key
+  .add(StepName)
+  .add(getClangFullVersion())
+  .add(Context.CompilerFingerprint);
+
+  for (const auto &Include : Driver.Includes)
+    Key.add(Path::makeAbsolute<SinglePath>(Include));
+
+  Key
+  .add(Driver.StdLib)
+  .add(getHashKindName(metaHash()))
+  .addAll(ExtraArgs);
+
+  // Declaration AST refers to its dependencies, so it is rebuilt
+  // once some import of its closure becomes private.
+  if (Driver.PrivateImports)
+    for (const auto &Dep : FullDeps)
+      Key.add(getPortablePath(Dep));
+
+  return Key.done();
+}
+
+std::string LevitationDriverImpl::getCommandHash(
+    const DependenciesGraph::Node &N
+) {
+  switch (N.Kind) {
+    case DependenciesGraph::NodeKind::Declaration: {
+      Paths FullDeps;
+      if (Context.Driver.PrivateImports)
+        FullDeps = getFullDependencies(
+            N, Context.DependenciesInfo->getDependenciesGraph()
+        );
+
+      return getCommandHash(
+          "decl-ast",
+          getDeclASTArgs(
+              N.LevitationUnit->Definition != nullptr, isLTOPublicUnit(N)
+          ),
+          FullDeps
+      );
+    }
+
+    case DependenciesGraph::NodeKind::Definition: {
+      LevitationDriver::Args CodeGenArgs, BackendArgs;
+      getDefinitionArgs(N, CodeGenArgs, BackendArgs);
+
+      // Same args object build passes, see processDefinition.
+      auto ExtraArgs = Context.Driver.ExtraParseArgs;
+      ExtraArgs.append(CodeGenArgs.begin(), CodeGenArgs.end());
+      if (Context.ProfileUseHash.size() && !Context.Driver.KeepIR)
+        ExtraArgs.emplace_back(Context.ProfileUseHash);
+
+      return getCommandHash(Context.Driver.KeepIR ? "ir" : "object", ExtraArgs);
+    }
+
+    default:
+      return "";
+  }
+}
+
+std::string LevitationDriverImpl::getLibraryCacheKey(
+    StringRef StepName,
+    StringRef UnitID,
+    StringRef SourceFile,
+    const Paths &DepsMetaFiles,
+    const LevitationDriver::Args &ExtraArgs,
+    bool UsesPreamble
+) {
+  const auto &Driver = Context.Driver;
+
+  if (Driver.DryRun || !LibraryCache::get().isEnabled())
+    return "";
+
+  auto Found = Context.LibraryHashes.find(UnitID);
+  if (Found == Context.LibraryHashes.end() || Found->second.empty())
+    return "";
+
+  BuildCacheKey Key;
+  Key
+  .add(StepName)
+  .add(Context.CompilerFingerprint)
+  .add(Found->second)
+  // Artifacts keep library source paths, which are absolute.
+  .add(SourceFile);
+
+  auto PreambleOutputMeta = getPreambleOutputMeta(SourceFile);
+  if (UsesPreamble && PreambleOutputMeta.size()) {
+    DeclASTMeta PreambleMeta;
+    if (!loadMeta(PreambleMeta, Driver.BuildRoot, PreambleOutputMeta))
+      return "";
+    Key.add(PreambleMeta.getDeclASTHash());
+  }
+
+  // Dependencies outputs are under same libraries subdirectory
+  // of any build root.
+  for (const auto &MetaFile : DepsMetaFiles) {
+    DeclASTMeta DepMeta;
+    if (!loadMeta(DepMeta, Driver.BuildRoot, MetaFile))
+      return "";
+    Key
+    .add(Path::makeRelative<SinglePath>(MetaFile, Driver.BuildRoot))
+    .add(getDependencyFingerprint(DepMeta, MetaFile));
+  }
+
+  for (const auto &Include : Driver.Includes)
+    Key.add(Path::makeAbsolute<SinglePath>(Include));
+
+  Key
+  .add(Driver.StdLib)
+  .addAll(ExtraArgs);
+
+  return Key.done();
+}
+
+ArrayRef<uint8_t> LevitationDriverImpl::getDependencyFingerprint(
+    const DeclASTMeta &DepMeta, StringRef MetaFile
+) const {
+  // Keys of dependents cover full dependencies, so interface hashes
+  // of dependencies of library unit are there as well.
+  if (
+    Context.LibraryMetaFiles.count(MetaFile) &&
+    DepMeta.getInterfaceHash().size()
+  )
+    return DepMeta.getInterfaceHash();
+  return DepMeta.getDeclASTHash();
+}
+
+SinglePath LevitationDriverImpl::getPortablePath(StringRef Path) const {
+  StringRef Root = Context.Driver.PortableSourcesRoot;
+  if (Root.empty())
+    return Path;
+  return levitation::Path::makeRelative<SinglePath>(Path, Root);
+}
+
+BuildHistory::StepKind LevitationDriverImpl::getStepKind(
+    const DependenciesGraph::Node &N
+) {
+  switch (N.Kind) {
+    case DependenciesGraph::NodeKind::Declaration:
+      return BuildHistory::StepKind::BuildDecl;
+    case DependenciesGraph::NodeKind::Definition:
+      return BuildHistory::StepKind::BuildObject;
+    default:
+      llvm_unreachable("Unknown dependency kind");
+  }
+}
+
+StepSpeculation LevitationDriverImpl::getSpeculation(
+    const DependenciesGraph::Node &N
+) const {
+  StepSpeculation Speculation;
+
+  // Critical nodes are also known with --job-priorities.
+  if (!Context.Driver.SpeculateAfter || !Context.CriticalNodes.count(N.ID))
+    return Speculation;
+
+  auto Kind = getStepKind(N);
+
+  auto Expected = Context.History.getDuration(
+      Kind, *Strings.getItem(N.LevitationUnit->UnitPath)
+  );
+  if (!Expected)
+    Expected = Context.History.getDurationPercentile(Kind, 95);
+
+  // Job can't be considered straggler, if nothing is known.
+  if (!Expected)
+    return Speculation;
+
+  Speculation.After = std::max<BuildHistory::DurationTy>(
+      Expected.getValue() * Context.Driver.SpeculateAfter / 100, 1
+  );
+
+  int Worker = getWorker(N.ID);
+  if (Worker >= 0)
+    Speculation.Worker = (Worker + 1) % Context.Driver.RemoteWorkers;
+
+  return Speculation;
+}
+
+void LevitationDriverImpl::recordNodeDomain(const DependenciesGraph::Node &N) {
+  auto &TM = TasksManager::get();
+  int Domain = TM.getWorkerDomain(TM.getWorkerID());
+  if (Domain < 0)
+    return;
+
+  with (auto _ = lock(Context.NodeDomainsMutex))
+    Context.NodeDomains[N.ID] = Domain;
+}
+
+int LevitationDriverImpl::getPreferredDomain(const DependenciesGraph::Node &N) {
+  // Dependencies are mostly declaration ASTs, and they are read
+  // by every dependent, so their page cache is where they were written.
+  SmallVector<unsigned, 4> Counts(TasksManager::get().getNumDomains());
+
+  with (auto _ = lock(Context.NodeDomainsMutex))
+    for (auto DepNID : Context.DependenciesInfo->getFullDependencies(N.ID)) {
+      auto Found = Context.NodeDomains.find(DepNID);
+      if (Found != Context.NodeDomains.end())
+        ++Counts[Found->second];
+    }
+
+  auto Best = std::max_element(Counts.begin(), Counts.end());
+  if (Best == Counts.end() || !*Best)
+    return -1;
+
+  return Best - Counts.begin();
+}
+
+BuildHistory::DurationTy LevitationDriverImpl::getExpectedDuration(
+    const DependenciesGraph::Node &N
+) const {
+  auto Kind = getStepKind(N);
+
+  if (auto D = Context.History.getDuration(
+      Kind, *Strings.getItem(N.LevitationUnit->UnitPath)
+  ))
+    return D.getValue();
+
+  if (auto D = Context.History.getAverageDuration(Kind))
+    return D.getValue();
+
+  // Nothing is known, consider all nodes to be equal.
+  return 1;
+}
+
+bool LevitationDriverImpl::startProgress() {
+  const auto &Driver = Context.Driver;
+
+  ShowProgress =
+      Driver.Progress &&
+      !Driver.isVerbose() &&
+      !Driver.DryRun &&
+      Log.isDisplayed();
+
+  if (!ShowProgress && Driver.StatusFD < 0)
+    return false;
+
+  if (Driver.StatusFD >= 0 && !StatusOut)
+    StatusOut = std::make_unique<llvm::raw_fd_ostream>(
+        Driver.StatusFD, /*shouldClose=*/false
+    );
+
+  const auto &Graph = Context.DependenciesInfo->getDependenciesGraph();
+
+  size_t Total = 0;
+  BuildProgress::DurationTy TotalExpected = 0;
+  bool HasHistory = false;
+
+  for (const auto &NodeIt : Graph.allNodes()) {
+    const auto &N = *NodeIt.second;
+    if (
+      !N.LevitationUnit ||
+      !isSelected(N.ID) ||
+      isPrecheckedClean(N.ID) ||
+      (Driver.Unity && N.Kind == DependenciesGraph::NodeKind::Definition)
+    )
+      continue;
+
+    ++Total;
+    TotalExpected += getExpectedDuration(N);
+    HasHistory |= Context.History.getAverageDuration(getStepKind(N)).hasValue();
+  }
+
+  unsigned Parallelism = std::max(TM.getWorkersNumber(), 1);
+  if (TM.getJobsLimit())
+    Parallelism = std::min(Parallelism, TM.getJobsLimit());
+
+  // Without history all nodes weigh the same, which
+  // tells nothing about time.
+  Progress.start(Total, HasHistory ? TotalExpected : 0, Parallelism);
+  return true;
+}
+
+void LevitationDriverImpl::reportProgress(
+    const DependenciesGraph::Node &N,
+    BuildProgress::EventKind Kind
+) {
+  if (!N.LevitationUnit || isPrecheckedClean(N.ID))
+    return;
+
+  auto S = Kind == BuildProgress::EventKind::Started ?
+      Progress.onStarted() :
+      Progress.onFinished(getExpectedDuration(N));
+
+  StringRef Phase =
+      N.Kind == DependenciesGraph::NodeKind::Declaration ? "decl" : "obj";
+  StringRef Unit = *Strings.getItem(N.LevitationUnit->UnitPath);
+
+  if (ShowProgress) {
+    std::string Line;
+    llvm::raw_string_ostream Out(Line);
+    BuildProgress::writeLine(Out, S, Phase, Unit);
+    Log.setStatus(Out.str());
+  }
+
+  if (StatusOut) {
+    auto _ = lock(StatusLocker);
+    BuildProgress::writeEvent(*StatusOut, S, Kind, Phase, Unit);
+    StatusOut->flush();
+  }
+}
+
+void LevitationDriverImpl::onStepFailed() {
+  unsigned NumFailed = ++Context.NumFailedSteps;
+
+  auto Limit = (unsigned)Context.Driver.FailuresLimit;
+  if (!Limit || NumFailed < Limit || TM.isCancelled())
+    return;
+
+  Log.log_info(
+      NumFailed, NumFailed == 1 ? " step" : " steps",
+      " failed, cancelling build."
+  );
+
+  TM.cancel();
+
+  if (Context.Driver.FailFast)
+    RunningSubprocesses::get().killAll();
+}
+
+BuildHistory::MemoryTy LevitationDriverImpl::getExpectedMemory(
+    BuildHistory::StepKind Kind,
+    StringRef UnitPath
+) const {
+  if (!TM.getMemoryBudget())
+    return 0;
+
+  if (auto M = Context.History.getPeakMemory(Kind, UnitPath))
+    return M.getValue();
+
+  if (auto M = Context.History.getAveragePeakMemory(Kind))
+    return M.getValue();
+
+  // First build, nothing to throttle by.
+  return 0;
+}
+
+void LevitationDriverImpl::loadBuildHistory() {
+  if (!Status.isValid())
+    return;
+
+  auto HistoryFile = levitation::Path::getPath<SinglePath>(
+      Context.Driver.BuildRoot,
+      DriverDefaults::BUILD_HISTORY
+  );
+
+  if (!fileExists(HistoryFile))
+    return;
+
+  auto &FM = CreatableSingleton<FileManager>::get();
+
+  auto Buffer = FM.getBufferForFile(HistoryFile);
+  if (!Buffer) {
+    Log.log_warning("Failed to open build history '", HistoryFile, "'.");
+    return;
+  }
+
+  auto Reader = CreateBuildHistoryBitstreamReader(*Buffer.get());
+
+  // Broken history is not a reason to fail the build,
+  // just forget it.
+  if (!Reader->read(Context.History)) {
+    Log.log_warning(
+        "Failed to read build history '", HistoryFile, "': ",
+        Reader->getStatus().getErrorMessage()
+    );
+    Context.History = BuildHistory();
+    return;
+  }
+
+  if (Reader->getStatus().hasWarnings())
+    Log.log_warning(Reader->getStatus().getWarningMessage());
+}
+
+void LevitationDriverImpl::saveBuildHistory() {
+  if (Context.Driver.DryRun || Context.Timings.empty())
+    return;
+
+  Context.History.merge(Context.Timings);
+
+  auto HistoryFile = levitation::Path::getPath<SinglePath>(
+      Context.Driver.BuildRoot,
+      DriverDefaults::BUILD_HISTORY
+  );
+
+  File F(HistoryFile);
+  with (auto Scope = F.open()) {
+    auto Writer = CreateBuildHistoryBitstreamWriter(Scope.getOutputStream());
+    Writer->writeAndFinalize(Context.History);
+  }
+
+  if (F.hasErrors())
+    Log.log_warning("Failed to write build history '", HistoryFile, "'.");
+}
+
+void LevitationDriverImpl::loadBuildState() {
+  if (!Status.isValid())
+    return;
+
+  auto StateFile = levitation::Path::getPath<SinglePath>(
+      Context.Driver.BuildRoot,
+      DriverDefaults::BUILD_STATE
+  );
+
+  if (!fileExists(StateFile))
+    return;
+
+  auto &FM = CreatableSingleton<FileManager>::get();
+
+  auto Buffer = FM.getBufferForFile(StateFile);
+  if (!Buffer) {
+    Log.log_warning("Failed to open build state '", StateFile, "'.");
+    return;
+  }
+
+  auto Reader = CreateBuildStateBitstreamReader(*Buffer.get());
+
+  // Broken state only means that up-to-date checks
+  // will take longer, so just forget it.
+  if (!Reader->read(Context.PrevState)) {
+    Log.log_warning(
+        "Failed to read build state '", StateFile, "': ",
+        Reader->getStatus().getErrorMessage()
+    );
+    Context.PrevState = BuildState();
+    return;
+  }
+
+  if (Reader->getStatus().hasWarnings())
+    Log.log_warning(Reader->getStatus().getWarningMessage());
+}
+
+void LevitationDriverImpl::saveBuildState() {
+  if (Context.Driver.DryRun)
+    return;
+
+  // If build has failed, some of products were not checked at all,
+  // keep their previous states.
+  const BuildState *Saved = &Context.State;
+  if (!Status.isValid()) {
+    Context.PrevState.merge(Context.State);
+    Saved = &Context.PrevState;
+  }
+
+  auto StateFile = levitation::Path::getPath<SinglePath>(
+      Context.Driver.BuildRoot,
+      DriverDefaults::BUILD_STATE
+  );
+
+  File F(StateFile);
+  with (auto Scope = F.open()) {
+    auto Writer = CreateBuildStateBitstreamWriter(Scope.getOutputStream());
+    Writer->writeAndFinalize(*Saved);
+  }
+
+  if (F.hasErrors())
+    Log.log_warning("Failed to write build state '", StateFile, "'.");
+}
+
+void LevitationDriverImpl::loadBuildJournal() {
+  if (!Status.isValid() || Context.Driver.DryRun)
+    return;
+
+  auto JournalFile = levitation::Path::getPath<SinglePath>(
+      Context.Driver.BuildRoot,
+      DriverDefaults::BUILD_JOURNAL
+  );
+
+  BuildJournal::EntriesMap Entries;
+  if (fileExists(JournalFile) && BuildJournal::load(JournalFile, Entries)) {
+    size_t NumResumed = 0;
+
+    // Products recorded in journal are as fresh as recorded states,
+    // so they get states, while metas are still at hand.
+    auto resume = [&] (
+        StringID UnitID, StringRef ProductFile, StringRef MetaFile
+    ) {
+      auto Found = Entries.find(ProductFile);
+      if (Found == Entries.end())
+        return;
+      const auto &E = Found->second;
+      ++NumResumed;
+
+      if (E.Updated) {
+        if (E.Declaration)
+          Context.JournalUpdatedUnits.insert(UnitID);
+        else
+          setObjectsUpdated();
+      }
+
+      auto ProductStamp = getFileStamp(ProductFile);
+      if (!ProductStamp || *ProductStamp != E.Product)
+        return;
+
+      DeclASTMeta Meta;
+      if (
+        !loadMeta(Meta, Context.Driver.BuildRoot, MetaFile) ||
+        Meta.getSourceHash().empty()
+      )
+        return;
+
+      Context.PrevState.set(ProductFile, {
+          E.Source, Meta.getSourceHash(), E.Product, Meta.getDeclASTHash(),
+          getIncludeStates(Meta), Meta.getCommandHash()
+      });
+    };
+
+    for (const auto &kv : Context.Files.getMap()) {
+      const auto &Files = *kv.second;
+      resume(kv.first, Files.DeclAST, Files.DeclASTMetaFile);
+      resume(kv.first, Files.Object, Files.ObjMetaFile);
+      if (Files.IR.size())
+        resume(kv.first, Files.IR, Files.ObjMetaFile);
+    }
+
+    if (NumResumed)
+      Log.log_info(
+          "Resuming interrupted build, ", NumResumed,
+          " nodes were completed by it."
+      );
+  }
+
+  if (!Context.Journal.open(JournalFile, Entries))
+    Log.log_warning("Failed to write build journal '", JournalFile, "'.");
+}
+
+void LevitationDriverImpl::restoreJournalNodes() {
+  if (Context.JournalUpdatedUnits.empty())
+    return;
+
+  const auto &Graph = Context.DependenciesInfo->getDependenciesGraph();
+
+  for (const auto &NodeIt : Graph.allNodes()) {
+    const auto &N = *NodeIt.second;
+    if (
+      N.LevitationUnit &&
+      N.Kind == DependenciesGraph::NodeKind::Declaration &&
+      Context.JournalUpdatedUnits.count(N.LevitationUnit->UnitPath)
+    )
+      setNodeUpdated(N.ID);
+  }
+}
+
+void LevitationDriverImpl::journalProduct(
+    StringRef ProductFile,
+    bool Declaration,
+    bool Updated,
+    llvm::Optional<BuildState::FileStamp> SourceStamp
+) {
+  if (!Context.Journal.isOpen() || !SourceStamp)
+    return;
+
+  auto ProductStamp = getFileStamp(ProductFile);
+  if (!ProductStamp)
+    return;
+
+  BuildJournal::Entry E;
+  E.Declaration = Declaration;
+  E.Updated = Updated;
+  E.Source = *SourceStamp;
+  E.Product = *ProductStamp;
+  Context.Journal.append(ProductFile, E);
+}
+
+void LevitationDriverImpl::findNameIndex() {
+  if (!Context.Driver.NameIndexEnabled)
+    return;
+
+  auto IndexFile = levitation::Path::getPath<SinglePath>(
+      Context.Driver.BuildRoot,
+      DriverDefaults::NAME_INDEX
+  );
+
+  if (fileExists(IndexFile))
+    NameIndex = IndexFile;
+}
+
+void LevitationDriverImpl::buildNameIndex() {
+  if (
+    !Context.Driver.NameIndexEnabled ||
+    Context.Driver.DryRun ||
+    !Status.isValid()
+  )
+    return;
+
+  auto &Graph = Context.DependenciesInfo->getDependenciesGraph();
+
+  std::vector<std::string> DeclASTs;
+  for (const auto &NodeIt : Graph.allNodes()) {
+    const auto &N = *NodeIt.second;
+    if (N.Kind != DependenciesGraph::NodeKind::Declaration)
+      continue;
+
+    const auto &Files = getFilesInfoFor(N);
+
+    // Index reads all declaration ASTs, see --lazy-cache-fetch.
+    if (!BuildCache::get().materialize(StringRef(Files.DeclAST)))
+      continue;
+
+    if (fileExists(Files.DeclAST))
+      DeclASTs.emplace_back(Files.DeclAST.str());
+  }
+
+  auto IndexFile = levitation::Path::getPath<SinglePath>(
+      Context.Driver.BuildRoot,
+      DriverDefaults::NAME_INDEX
+  );
+
+  // Decl ASTs were rebuilt during this build, so we need fresh
+  // file stamps rather than ones cached by driver's file manager.
+  FileManager FM((FileSystemOptions()));
+  RawPCHContainerReader PCHReader;
+
+  if (auto Err = GlobalModuleIndex::writeLevitationIndex(
+      FM, PCHReader, DeclASTs, IndexFile
+  )) {
+    // Index is an optimization only, so don't fail build.
+    Log.log_warning(
+        "Failed to write name index '", IndexFile, "': ",
+        llvm::toString(std::move(Err))
+    );
+    llvm::sys::fs::remove(IndexFile);
+    File::notifyChanged(IndexFile);
+    return;
+  }
+
+  File::notifyChanged(IndexFile);
+
+  Log.log_verbose(
+      "Written name index for ", DeclASTs.size(), " declarations."
+  );
+}
+
+void LevitationDriverImpl::writeLibraryFingerprints() {
+  if (Context.Driver.DryRun || !Status.isValid())
+    return;
+
+  for (const auto &Library : Context.LibraryUnits) {
+    StringRef LibraryOutDir = Library.first;
+
+    // Units are collected in order of sources, which may differ
+    // between file systems, so fingerprint goes in order of IDs.
+    std::vector<std::pair<StringRef, const FilesInfo*>> Units;
+    for (auto UnitID : Library.second)
+      if (const auto *Files = Context.Files.tryGet(UnitID))
+        Units.emplace_back(*Strings.getItem(UnitID), Files);
+    llvm::sort(Units, [] (
+        const std::pair<StringRef, const FilesInfo*> &L,
+        const std::pair<StringRef, const FilesInfo*> &R
+    ) { return L.first < R.first; });
+
+    BuildCacheKey Key;
+    bool Complete = true;
+    for (const auto &U : Units) {
+      DeclASTMeta Meta;
+      if (
+        !loadMeta(Meta, Context.Driver.BuildRoot, U.second->DeclASTMetaFile) ||
+        Meta.getInterfaceHash().empty()
+      ) {
+        Complete = false;
+        break;
+      }
+      Key.add(U.first).add(Meta.getInterfaceHash());
+    }
+
+    auto FingerprintFile = levitation::Path::getPath<SinglePath>(
+        LibraryOutDir, DriverDefaults::LIBRARY_INTERFACE
+    );
+
+    // Consumers can't rely on stale fingerprint.
+    if (!Complete) {
+      llvm::sys::fs::remove(FingerprintFile);
+      File::notifyChanged(FingerprintFile);
+      continue;
+    }
+
+    auto Fingerprint = Key.done();
+
+    auto Prev = llvm::MemoryBuffer::getFile(
+        FingerprintFile, /*FileSize=*/-1, /*RequiresNullTerminator=*/false
+    );
+    if (Prev && Prev.get()->getBuffer().trim() == Fingerprint) {
+      Log.log_verbose(
+          "Interface of library '", LibraryOutDir, "' is same."
+      );
+      continue;
+    }
+
+    Log.log_verbose(
+        "Interface of library '", LibraryOutDir, "' is updated: ",
+        Fingerprint
+    );
+
+    File F(FingerprintFile);
+    with (auto Scope = F.open())
+      Scope.getOutputStream() << Fingerprint << "\n";
+
+    // Fingerprint is an optimization only, so don't fail build.
+    if (F.hasErrors())
+      Log.log_warning(
+          "Failed to write library fingerprint '", FingerprintFile, "'."
+      );
+  }
+}
+
+void LevitationDriverImpl::dumpTimeReport() {
+
+  struct StepInfo {
+    BuildHistory::StepKind Kind;
+    StringRef UnitPath;
+    BuildHistory::DurationTy Duration;
+  };
+
+  std::vector<StepInfo> Steps;
+  BuildHistory::DurationTy Totals[BuildHistory::NumStepKinds] = {};
+  size_t Counts[BuildHistory::NumStepKinds] = {};
+
+  Context.Timings.forEach([&] (
+      BuildHistory::StepKind Kind,
+      StringRef UnitPath,
+      BuildHistory::DurationTy Duration
+  ) {
+    Steps.push_back({Kind, UnitPath, Duration});
+    Totals[(unsigned)Kind] += Duration;
+    ++Counts[(unsigned)Kind];
+  });
+
+  with (auto info = Log.acquire(log::Level::Info)) {
+    auto &Out = info.s;
+
+    Out << "\nTime report:\n";
+
+    if (Steps.empty()) {
+      Out << "  Nothing was rebuilt.\n";
+      return;
+    }
+
+    for (unsigned Kind = 0; Kind != BuildHistory::NumStepKinds; ++Kind) {
+      Out.indent(2)
+      << BuildHistory::getStepKindName((BuildHistory::StepKind)Kind) << ": "
+      << Counts[Kind] << " jobs, "
+      << Totals[Kind] / 1000 << " ms total\n";
+    }
+
+    std::sort(Steps.begin(), Steps.end(), [] (
+        const StepInfo &L, const StepInfo &R
+    ) {
+      return L.Duration > R.Duration;
+    });
+
+    const size_t MaxSlowest = 10;
+
+    Out << "\n  Slowest jobs:\n";
+    for (size_t i = 0, e = std::min(MaxSlowest, Steps.size()); i != e; ++i) {
+      Out.indent(4)
+      << Steps[i].Duration / 1000 << " ms  "
+      << BuildHistory::getStepKindName(Steps[i].Kind) << "  "
+      << Steps[i].UnitPath << "\n";
+    }
+
+    Out << "\n";
+  }
+}
+
+void LevitationDriverImpl::dumpUnitTimeTraceReport() {
+  auto &Report = TimeTraceReport::get();
+  auto &Trace = BuildTrace::get();
+
+  unsigned NumFailed = Report.collect(Trace.isEnabled() ? &Trace : nullptr);
+  if (NumFailed)
+    Log.log_warning("Failed to read ", NumFailed, " unit time trace(s).");
+
+  with (auto info = Log.acquire(log::Level::Info))
+    Report.write(info.s);
+}
+
+bool LevitationDriverImpl::loadDependencyStats(
+    StringRef Output,
+    std::vector<DependencyStats> &Stats
+) {
+  auto StatsFile = (Output + "." + FileExtensions::DependencyStats).str();
+  auto Buffer = llvm::MemoryBuffer::getFile(StatsFile);
+  if (!Buffer)
+    return false;
+
+  if (!DependencyStats::parse(Buffer.get()->getBuffer(), Stats)) {
+    Log.log_warning("Failed to read dependency stats '", StatsFile, "'.");
+    return false;
+  }
+
+  // Frontend writes paths relative to portable sources root, if it is set.
+  StringRef Root = Context.Driver.PortableSourcesRoot;
+  for (auto &S : Stats) {
+    SinglePath P(S.File);
+    if (Root.size() && llvm::sys::path::is_relative(P))
+      P = Path::getPath<SinglePath>(Root, S.File);
+    llvm::sys::fs::make_absolute(P);
+    llvm::sys::path::remove_dots(P, /*remove_dot_dot=*/true);
+    S.File = P.str().str();
+  }
+
+  return true;
+}
+
+void LevitationDriverImpl::dumpUnusedImportsReport() {
+  if (!Context.ParsedDeps)
+    return;
+
+  auto getImports = [&] (
+      const DependenciesData &Data,
+      const DependenciesData::DeclarationsBlock &Block
+  ) {
+    std::vector<UnusedImports::Import> Imports;
+    for (const auto &Dep : Block) {
+      // External packages have no stats.
+      const auto *DepFiles = Context.Files.tryGet(Dep.UnitIdentifier);
+      if (!DepFiles)
+        continue;
+
+      SinglePath DeclAST = DepFiles->DeclAST;
+      llvm::sys::fs::make_absolute(DeclAST);
+      llvm::sys::path::remove_dots(DeclAST, /*remove_dot_dot=*/true);
+
+      Imports.push_back({
+        Data.Strings->getItem(Dep.UnitIdentifier)->str(),
+        DeclAST.str().str()
+      });
+    }
+    return Imports;
+  };
+
+  struct UnitFindings {
+    StringRef UnitID;
+    std::vector<UnusedImports::Finding> Findings;
+  };
+
+  std::vector<UnitFindings> Units;
+  size_t NumUnused = 0, NumBodyOnly = 0;
+
+  for (const auto &Package : *Context.ParsedDeps) {
+    const auto *Files = Context.Files.tryGet(Package.first);
+    if (!Files)
+      continue;
+
+    const auto &Data = *Package.second;
+
+    std::vector<DependencyStats> DeclStats, ObjStats;
+    if (!loadDependencyStats(
+        Context.Driver.KeepIR ? Files->IR : Files->Object, ObjStats
+    ))
+      continue;
+
+    if (!Data.IsBodyOnly)
+      loadDependencyStats(Files->DeclAST, DeclStats);
+
+    auto Findings = UnusedImports::find(
+        DeclStats,
+        ObjStats,
+        getImports(Data, Data.DeclarationDependencies),
+        getImports(Data, Data.DefinitionDependencies)
+    );
+
+    if (Findings.empty())
+      continue;
+
+    for (const auto &F : Findings)
+      ++(F.K == UnusedImports::Kind::Unused ? NumUnused : NumBodyOnly);
+
+    std::sort(Findings.begin(), Findings.end(), [] (
+        const UnusedImports::Finding &L, const UnusedImports::Finding &R
+    ) {
+      return L.UnitID < R.UnitID;
+    });
+
+    Units.push_back({*Strings.getItem(Package.first), std::move(Findings)});
+  }
+
+  std::sort(Units.begin(), Units.end(), [] (
+      const UnitFindings &L, const UnitFindings &R
+  ) {
+    return L.UnitID < R.UnitID;
+  });
+
+  with (auto info = Log.acquire(log::Level::Info)) {
+    auto &Out = info.s;
+
+    Out << "\nUnused imports report:\n";
+
+    if (Units.empty()) {
+      Out << "  No unused imports found.\n\n";
+      return;
+    }
+
+    for (const auto &U : Units) {
+      Out.indent(2) << U.UnitID << ":\n";
+      for (const auto &F : U.Findings) {
+        Out.indent(4) << "#import " << F.UnitID;
+        if (F.K == UnusedImports::Kind::Unused)
+          Out << "  nothing is used\n";
+        else
+          Out << "  used in #body only, could be [bodydep]\n";
+      }
+    }
+
+    Out
+    << "\n  " << NumUnused << " unused, "
+    << NumBodyOnly << " could be [bodydep].\n\n";
+  }
+}
+
+void LevitationDriverImpl::inferPrivateImports(ParsedDependencies &Deps) {
+  std::vector<StringID> PackageIDs;
+  llvm::DenseMap<StringID, unsigned> PackageIdx;
+  llvm::StringMap<unsigned> DeclASTIdx;
+
+  for (const auto &Package : Deps) {
+    // External packages have no stats.
+    const auto *Files = Context.Files.tryGet(Package.first);
+    if (!Files)
+      continue;
+
+    SinglePath DeclAST = Files->DeclAST;
+    llvm::sys::fs::make_absolute(DeclAST);
+    llvm::sys::path::remove_dots(DeclAST, /*remove_dot_dot=*/true);
+
+    PackageIdx[Package.first] = PackageIDs.size();
+    DeclASTIdx[DeclAST] = PackageIDs.size();
+    PackageIDs.push_back(Package.first);
+  }
+
+  std::vector<PrivateImports::Unit> Units(PackageIDs.size());
+
+  for (const auto &Package : Deps) {
+    auto FoundIdx = PackageIdx.find(Package.first);
+    if (FoundIdx == PackageIdx.end())
+      continue;
+
+    const auto &Data = *Package.second;
+    const auto &Files = Context.Files[Package.first];
+    auto &U = Units[FoundIdx->second];
+
+    auto addImports = [&] (
+        const DependenciesData::DeclarationsBlock &Block,
+        SmallVectorImpl<unsigned> &Imports
+    ) {
+      for (const auto &Dep : Block) {
+        auto Found = PackageIdx.find(Dep.UnitIdentifier);
+        if (Found != PackageIdx.end())
+          Imports.push_back(Found->second);
+      }
+    };
+
+    addImports(Data.DeclarationDependencies, U.DeclImports);
+    addImports(Data.DefinitionDependencies, U.BodyImports);
+
+    std::vector<DependencyStats> DeclStats, ObjStats;
+    U.HasStats =
+        loadDependencyStats(
+            Context.Driver.KeepIR ? Files.IR : Files.Object, ObjStats
+        ) &&
+        (Data.IsBodyOnly || loadDependencyStats(Files.DeclAST, DeclStats));
+
+    if (!U.HasStats)
+      continue;
+
+    auto addUsed = [&] (
+        const std::vector<DependencyStats> &Stats,
+        llvm::DenseSet<unsigned> &Used
+    ) {
+      for (const auto &S : Stats) {
+        auto Found = DeclASTIdx.find(S.File);
+        if (Found != DeclASTIdx.end() && !S.isUnused())
+          Used.insert(Found->second);
+      }
+    };
+
+    addUsed(DeclStats, U.UsedByDecl);
+    addUsed(DeclStats, U.Used);
+    addUsed(ObjStats, U.Used);
+
+    // Edited declaration may use its imports now.
+    const auto *Recorded = Context.PrevState.get(Files.DeclAST);
+    auto SourceStamp = getFileStamp(Files.Source);
+    U.Untouched =
+        !Data.IsBodyOnly && Recorded && SourceStamp &&
+        Recorded->Source == *SourceStamp &&
+        !isChangedSource(Files.Source);
+  }
+
+  auto Demoted = PrivateImports::infer(Units);
+
+  for (const auto &D : Demoted) {
+    StringID PackageID = PackageIDs[D.first];
+    StringID DepID = PackageIDs[D.second];
+    if (!Deps.demote(PackageID, DepID))
+      continue;
+
+    LEVITATION_LOG_VERBOSE(
+        Log,
+        "Import of '", *Strings.getItem(DepID), "' by '",
+        *Strings.getItem(PackageID), "' is private."
+    );
+  }
+
+  Log.log_verbose("Inferred ", Demoted.size(), " private imports.");
+}
+
+const FilesInfo& LevitationDriverImpl::getFilesInfoFor(
+    const DependenciesGraph::Node &N
+) const {
+  auto *FoundFiles = Context.Files.tryGet(N.LevitationUnit->UnitPath);
+  if(!FoundFiles) {
+    const auto &SrcRel = *Strings.getItem(N.LevitationUnit->UnitPath);
+    Log.log_error(
+        "Package '",
+        SrcRel,
+        "' is present in dependencies, but not found."
+    );
+    llvm_unreachable("Package not found");
+  }
+  return *FoundFiles;
+}
+
+void LevitationDriverImpl::prefetchDependents(
+    const DependenciesGraph::Node &N
+) {
+  if (!Context.Driver.Prefetch || Context.Driver.DryRun)
+    return;
+
+  const auto &Graph = Context.DependenciesInfo->getDependenciesGraph();
+
+  for (auto DID : N.DependentNodes) {
+    with (auto _ = lock(PrefetchLocker))
+      if (!PrefetchedNodes.insert(DID).second)
+        continue;
+
+    const auto &D = Graph.getNode(DID);
+
+    Paths Files = getFullDependencies(D, Graph);
+    auto Preamble = getPreambleOutput(getFilesInfoFor(D).Source);
+    if (Preamble.size())
+      Files.push_back(Preamble);
+
+    for (const auto &F : Files) {
+      // Dependency of N itself is not built yet.
+      with (auto _ = lock(PrefetchLocker))
+        if (!PrefetchedFiles.insert(F).second)
+          continue;
+
+      Log.log_trace("Prefetching '", F, "'...");
+      prefetchFile(F);
+    }
+  }
+}
+
+Paths LevitationDriverImpl::getFullDependencies(
+    const DependenciesGraph::Node &N,
+    const DependenciesGraph &Graph
+) const {
+  Paths FullDeps;
+
+  // Header units go first, since they don't depend on anything
+  // but preamble.
+  for (auto HU : getHeaderUnits(N))
+    FullDeps.push_back(Context.HeaderUnits[HU].DeclAST);
+
+  for (auto DepNID : Context.DependenciesInfo->getFullDependencies(N.ID)) {
+    auto &DNode = Graph.getNode(DepNID);
+
+    auto &Files = Context.Files[DNode.LevitationUnit->UnitPath];
+
+    FullDeps.push_back(Files.DeclAST);
+  }
+  return FullDeps;
+}
+
+Paths LevitationDriverImpl::getFullDependenciesMetas(
+    const DependenciesGraph::Node &N,
+    const DependenciesGraph &Graph
+) const {
+  Paths Metas;
+
+  for (auto HU : getHeaderUnits(N))
+    Metas.push_back(Context.HeaderUnits[HU].DeclASTMetaFile);
+
+  for (auto DepNID : Context.DependenciesInfo->getFullDependencies(N.ID)) {
+    auto &DNode = Graph.getNode(DepNID);
+    Metas.push_back(Context.Files[DNode.LevitationUnit->UnitPath].DeclASTMetaFile);
+  }
+  return Metas;
+}
+
+Paths LevitationDriverImpl::getIncludeSources(
+    const DependenciesGraph::Node &N,
+    const DependenciesGraph &Graph
+) const {
+  Paths Includes;
+  for (auto DepNID : N.Dependencies) {
+    auto &DNode = Graph.getNode(DepNID);
+    auto DepPath = Context.Files[DNode.LevitationUnit->UnitPath].Header;
+
+    auto Header = Path::makeRelative<SinglePath>(
+        DepPath,
+        Context.Driver.getOutputHeadersDir()
+    );
+
+    Includes.emplace_back(std::move(Header));
+  }
+  return Includes;
+}
+
+Paths LevitationDriverImpl::getImportSources(
+    const DependenciesGraph::Node &N,
+    const DependenciesGraph &Graph
+) const {
+  Paths Imports;
+  for (auto DepNID : N.Dependencies) {
+    auto &DNode = Graph.getNode(DepNID);
+    // Remove extension, A/B/C.cppl -> A/B/C
+    auto DepPackage = Path::replaceExtension<SinglePath>(
+        *Strings.getItem(DNode.LevitationUnit->UnitPath), ""
+    );
+
+    Imports.push_back(DepPackage);
+  }
+  return Imports;
+}
+
+bool LevitationDriverImpl::isSplitCodeGen(StringID UnitPath) const {
+  // ThinLTO objects are bitcode, code is generated by linker.
+  if (!Context.Driver.SplitCodeGenAfter || Context.Driver.ThinLTO)
+    return false;
+
+  const auto *Files = Context.Files.tryGet(UnitPath);
+  if (!Files)
+    return false;
+
+  if (llvm::sys::fs::exists(getCodeGenPartitions(*Files).front()))
+    return true;
+
+  auto Duration = Context.History.getDuration(
+      BuildHistory::StepKind::BuildObject, *Strings.getItem(UnitPath)
+  );
+  return Duration &&
+      Duration.getValue() >=
+          (BuildHistory::DurationTy)Context.Driver.SplitCodeGenAfter * 1000;
+}
+
+Paths LevitationDriverImpl::getCodeGenPartitions(
+    const FilesInfo &Files
+) const {
+  Paths Partitions;
+  // Smaller partitions are more likely to stay same once unit changes.
+  int NumPartitions = Context.Driver.IncrementalCodeGen ?
+      DriverDefaults::INCREMENTAL_CODEGEN_PARTITIONS :
+      DriverDefaults::CODEGEN_PARTITIONS;
+
+  for (int i = 1; i != NumPartitions; ++i)
+    Partitions.push_back(Path::replaceExtension<SinglePath>(
+        Files.Object,
+        ("part" + Twine(i) + "." + FileExtensions::Object).str()
+    ));
+  return Partitions;
+}
+
+void LevitationDriverImpl::appendLinkObjects(
+    StringID UnitPath,
+    Paths &Objects
+) const {
+  if (Context.Driver.SkipEmptyObjects) {
+    auto _ = lock(Context.CodelessUnitsMutex);
+    if (Context.CodelessUnits.count(UnitPath))
+      return;
+  }
+
+  const auto &Files = Context.Files[UnitPath];
+  Objects.push_back(Files.Object);
+  if (isSplitCodeGen(UnitPath)) {
+    auto Partitions = getCodeGenPartitions(Files);
+    Objects.append(Partitions.begin(), Partitions.end());
+  }
+}
+
+std::vector<StringID> LevitationDriverImpl::getLinkOrder() {
+  std::vector<StringID> Order;
+  Order.reserve(Context.ProjectPackages.size());
+
+  auto PathLess = [&] (StringID L, StringID R) {
+    return *Strings.getItem(L) < *Strings.getItem(R);
+  };
+
+  if (Context.DependenciesInfo) {
+    const auto &Info = *Context.DependenciesInfo;
+    const auto &Graph = Info.getDependenciesGraph();
+
+    auto Nodes = Info.getOrderedNodes([&] (
+        const DependenciesGraph::Node &L,
+        const DependenciesGraph::Node &R
+    ) {
+      return PathLess(L.LevitationUnit->UnitPath, R.LevitationUnit->UnitPath);
+    });
+
+    for (auto Idx : Nodes) {
+      const auto &N = Graph.getNodeByIndex(Idx);
+      if (N.Kind != DependenciesGraph::NodeKind::Definition)
+        continue;
+      auto UnitPath = N.LevitationUnit->UnitPath;
+      if (Context.ProjectPackages.count(UnitPath))
+        Order.push_back(UnitPath);
+    }
+  }
+
+  // Units out of graph order, e.g. ones of cycles, go last.
+  if (Order.size() != Context.ProjectPackages.size()) {
+    PathIDsSet Ordered(Order.begin(), Order.end());
+    std::vector<StringID> Rest;
+    for (auto UnitPath : Context.ProjectPackages)
+      if (!Ordered.count(UnitPath))
+        Rest.push_back(UnitPath);
+    std::sort(Rest.begin(), Rest.end(), PathLess);
+    Order.insert(Order.end(), Rest.begin(), Rest.end());
+  }
+
+  return Order;
+}
+
+/// Writes lld symbol ordering file made of instrumented profile.
+/// Functions are ordered by their entry counts, hottest first.
+static bool writeSymbolOrdering(StringRef ProfileFile, StringRef OrderingFile) {
+  auto ReaderOrErr = llvm::IndexedInstrProfReader::create(ProfileFile);
+  if (!ReaderOrErr) {
+    log::Logger::get().log_error(
+        "Failed to read profile '", ProfileFile, "': ",
+        llvm::toString(ReaderOrErr.takeError())
+    );
+    return false;
+  }
+  auto &Reader = *ReaderOrErr.get();
+
+  std::vector<std::pair<uint64_t, std::string>> Functions;
+  for (const auto &Record : Reader) {
+    if (Record.Counts.empty() || !Record.Counts.front())
+      continue;
+
+    // Names of local functions are prefixed with their source file.
+    StringRef Name = Record.Name;
+    auto Colon = Name.rfind(':');
+    if (Colon != StringRef::npos)
+      Name = Name.drop_front(Colon + 1);
+
+    Functions.emplace_back(Record.Counts.front(), Name.str());
+  }
+
+  if (auto E = Reader.getError()) {
+    log::Logger::get().log_error(
+        "Failed to read profile '", ProfileFile, "': ",
+        llvm::toString(std::move(E))
+    );
+    return false;
+  }
+
+  std::sort(Functions.begin(), Functions.end(), [] (
+      const std::pair<uint64_t, std::string> &L,
+      const std::pair<uint64_t, std::string> &R
+  ) {
+    return L.first != R.first ? L.first > R.first : L.second < R.second;
+  });
+
+  levitation::Path::createDirsForFile(OrderingFile);
+
+  levitation::File F(OrderingFile);
+  if (auto OpenedFile = F.open()) {
+    auto &Out = OpenedFile.getOutputStream();
+    llvm::StringSet<> Written;
+    for (const auto &Func : Functions)
+      if (Written.insert(Func.second).second)
+        Out << Func.second << "\n";
+  }
+
+  if (F.hasErrors()) {
+    log::Logger::get().log_error(
+        "Failed to write symbol ordering file '", OrderingFile, "'"
+    );
+    return false;
+  }
+
+  return true;
+}
+
+bool LevitationDriverImpl::prepareSymbolOrdering() {
+  const auto &Driver = Context.Driver;
+  if (Driver.SymbolOrdering.empty() || Context.SymbolOrderingFile.size())
+    return true;
+
+  auto Buffer = llvm::MemoryBuffer::getFile(Driver.SymbolOrdering);
+  if (!Buffer) {
+    Log.log_error(
+        "Failed to read symbol ordering '", Driver.SymbolOrdering, "'"
+    );
+    return false;
+  }
+
+  // Ordering file made by other tools, e.g. of perf samples,
+  // is passed as is.
+  if (!llvm::IndexedInstrProfReader::hasFormat(*Buffer.get())) {
+    Context.SymbolOrderingFile = Driver.SymbolOrdering.str().str();
+    return true;
+  }
+
+  auto Output = levitation::Path::getPath<SinglePath>(
+      Driver.BuildRoot, DriverDefaults::SYMBOL_ORDERING
+  );
+  llvm::sys::fs::make_absolute(Output);
+
+  auto ProfileStamp = getFileStamp(Driver.SymbolOrdering);
+  auto OutputStamp = getFileStamp(Output);
+  bool UpToDate =
+      ProfileStamp && OutputStamp && OutputStamp->MTime >= ProfileStamp->MTime;
+
+  if (!UpToDate) {
+    if (Driver.DryRun || Driver.isVerbose())
+      Log.log_info(
+          "SYMBOL-ORDERING ", Driver.SymbolOrdering, " -> ", Output
+      );
+
+    if (!Driver.DryRun && !writeSymbolOrdering(Driver.SymbolOrdering, Output))
+      return false;
+  }
+
+  Context.SymbolOrderingFile = Output.str().str();
+  return true;
+}
+
+void LevitationDriverImpl::addSymbolOrderingArgs(
+    LevitationDriver::Args &LinkerArgs
+) const {
+  if (Context.SymbolOrderingFile.empty())
+    return;
+
+  LinkerArgs.emplace_back(
+      ("-Wl,--symbol-ordering-file=" + Context.SymbolOrderingFile)
+  );
+
+  // Profile names functions of libraries, and of previous versions
+  // of program, which are not there.
+  LinkerArgs.emplace_back("-Wl,--no-warn-symbol-ordering");
+}
+
+bool LevitationDriverImpl::writeHotUnits(
+    StringRef ProfileFile, StringRef Output
+) {
+  llvm::StringMap<StringRef> SymbolUnits, SourceUnits;
+  llvm::StringMap<HotUnits::WeightTy> Weights;
+
+  for (auto PackagePath : Context.ProjectPackages) {
+    const auto &Files = Context.Files[PackagePath];
+    StringRef UnitID = *Strings.getItem(PackagePath);
+
+    SinglePath Source = Files.Source;
+    llvm::sys::fs::make_absolute(Source);
+    llvm::sys::path::remove_dots(Source, /*remove_dot_dot=*/true);
+    SourceUnits[Source] = UnitID;
+
+    // New units are not classified until they have objects.
+    auto Bin = llvm::object::createBinary(Files.Object);
+    if (!Bin) {
+      llvm::consumeError(Bin.takeError());
+      continue;
+    }
+
+    const auto *Symbolic =
+        dyn_cast<llvm::object::SymbolicFile>(Bin->getBinary());
+    if (!Symbolic)
+      continue;
+
+    Weights[UnitID] = 0;
+
+    for (const auto &Sym : Symbolic->symbols()) {
+      auto Flags = Sym.getFlags();
+      if (!Flags) {
+        llvm::consumeError(Flags.takeError());
+        continue;
+      }
+      if (*Flags & llvm::object::BasicSymbolRef::SF_Undefined)
+        continue;
+
+      std::string Name;
+      llvm::raw_string_ostream OS(Name);
+      if (auto E = Sym.printName(OS)) {
+        llvm::consumeError(std::move(E));
+        continue;
+      }
+      OS.flush();
+
+      // Mach-O symbols have extra underscore.
+      StringRef NameRef = Name;
+      if (NameRef.startswith("__Z"))
+        NameRef = NameRef.drop_front();
+
+      SymbolUnits[NameRef] = UnitID;
+    }
+  }
+
+  auto ReaderOrErr = llvm::IndexedInstrProfReader::create(ProfileFile);
+  if (!ReaderOrErr) {
+    Log.log_error(
+        "Failed to read profile '", ProfileFile, "': ",
+        llvm::toString(ReaderOrErr.takeError())
+    );
+    return false;
+  }
+  auto &Reader = *ReaderOrErr.get();
+
+  for (const auto &Record : Reader) {
+    HotUnits::WeightTy Weight = 0;
+    for (auto C : Record.Counts)
+      Weight += C;
+    if (!Weight)
+      continue;
+
+    StringRef Name = Record.Name;
+    StringRef UnitID;
+
+    // Names of local functions are prefixed with their source file.
+    auto Colon = Name.rfind(':');
+    if (Colon != StringRef::npos) {
+      SinglePath Source = Name.take_front(Colon);
+      llvm::sys::fs::make_absolute(Source);
+      llvm::sys::path::remove_dots(Source, /*remove_dot_dot=*/true);
+      UnitID = SourceUnits.lookup(Source);
+      Name = Name.drop_front(Colon + 1);
+    }
+
+    if (UnitID.empty())
+      UnitID = SymbolUnits.lookup(Name);
+
+    if (UnitID.size())
+      Weights[UnitID] += Weight;
+  }
+
+  if (auto E = Reader.getError()) {
+    Log.log_error(
+        "Failed to read profile '", ProfileFile, "': ",
+        llvm::toString(std::move(E))
+    );
+    return false;
+  }
+
+  llvm::StringMap<HotUnits::Temperature> Units;
+  HotUnits::classify(Weights, DriverDefaults::HOT_UNITS_PERCENT, Units);
+
+  levitation::Path::createDirsForFile(Output);
+
+  levitation::File F(Output);
+  if (auto OpenedFile = F.open())
+    HotUnits::write(
+        OpenedFile.getOutputStream(), Units, HotUnits::Temperature::Warm
+    );
+
+  if (F.hasErrors()) {
+    Log.log_error("Failed to write hot units '", Output, "'");
+    return false;
+  }
+
+  return true;
+}
+
+bool LevitationDriverImpl::prepareHotUnits() {
+  const auto &Driver = Context.Driver;
+  if (Driver.HotUnitsFile.empty())
+    return true;
+
+  auto load = [&] (StringRef File) {
+    Context.UnitTemperatures.clear();
+
+    auto Buffer = llvm::MemoryBuffer::getFile(File);
+    if (!Buffer) {
+      Log.log_error("Failed to read hot units '", File, "'");
+      return false;
+    }
+
+    if (!HotUnits::parse(
+        Buffer.get()->getBuffer(),
+        Context.UnitTemperatures,
+        Context.DefaultTemperature
+    )) {
+      Log.log_error("Malformed hot units list '", File, "'");
+      return false;
+    }
+
+    return true;
+  };
+
+  auto Buffer = llvm::MemoryBuffer::getFile(Driver.HotUnitsFile);
+  if (!Buffer) {
+    Log.log_error("Failed to read hot units '", Driver.HotUnitsFile, "'");
+    return false;
+  }
+
+  if (!llvm::IndexedInstrProfReader::hasFormat(*Buffer.get()))
+    return load(Driver.HotUnitsFile);
+
+  auto Output = levitation::Path::getPath<SinglePath>(
+      Driver.BuildRoot, DriverDefaults::HOT_UNITS
+  );
+
+  auto ProfileStamp = getFileStamp(Driver.HotUnitsFile);
+  auto OutputStamp = getFileStamp(Output);
+  bool UpToDate =
+      ProfileStamp && OutputStamp && OutputStamp->MTime >= ProfileStamp->MTime &&
+      load(Output);
+
+  // Units are classified once they have objects, levels of others
+  // are kept as long as profile is same, so objects are not rebuilt
+  // back and forth.
+  if (UpToDate)
+    for (auto PackagePath : Context.ProjectPackages)
+      if (
+        !Context.UnitTemperatures.count(*Strings.getItem(PackagePath)) &&
+        llvm::sys::fs::exists(Context.Files[PackagePath].Object)
+      ) {
+        UpToDate = false;
+        break;
+      }
+
+  if (!UpToDate) {
+    if (Driver.DryRun || Driver.isVerbose())
+      Log.log_info("HOT-UNITS ", Driver.HotUnitsFile, " -> ", Output);
+
+    if (Driver.DryRun)
+      return true;
+
+    if (!writeHotUnits(Driver.HotUnitsFile, Output) || !load(Output))
+      return false;
+  }
+
+  return true;
+}
+
+std::string LevitationDriverImpl::getOptLevel(
+    const DependenciesGraph::Node &N
+) {
+  const auto &Driver = Context.Driver;
+  StringRef UnitID = *Strings.getItem(N.LevitationUnit->UnitPath);
+
+  auto T = HotUnits::Temperature::Warm;
+  if (Driver.HotUnitsFile.size()) {
+    auto Found = Context.UnitTemperatures.find(UnitID);
+    T = Found != Context.UnitTemperatures.end() ?
+        Found->second : Context.DefaultTemperature;
+  }
+
+  // Pragma of unit overrides its class.
+  auto &FM = CreatableSingleton<FileManager>::get();
+  if (auto Buffer = FM.getBufferForFile(getFilesInfoFor(N).Source)) {
+    auto Pragma = HotUnits::scanPragma(Buffer.get()->getBuffer());
+    if (Pragma.size() && !HotUnits::parseName(Pragma, T)) {
+      auto Level = HotUnits::parseLevel(Pragma);
+      if (Level.size())
+        return Level.str();
+
+      Log.log_warning(
+          "Unknown optimization level '", Pragma, "' of unit '", UnitID,
+          "', #pragma cppl optimize is ignored."
+      );
+    }
+  }
+
+  switch (T) {
+    case HotUnits::Temperature::Hot:
+      return Driver.HotOptLevel.str();
+    case HotUnits::Temperature::Cold:
+      return Driver.ColdOptLevel.str();
+    default:
+      return "";
+  }
+}
+
+bool LevitationDriverImpl::isLTOPublicUnit(
+    const DependenciesGraph::Node &N
+) const {
+  if (Context.Driver.ExportAllUnits)
+    return true;
+
+  // Public nodes include units exposed by public ones, e.g. ones
+  // which declare bases of public classes.
+  const auto &Graph = Context.DependenciesInfo->getDependenciesGraph();
+  return Graph.isPublic(
+      DependenciesGraph::NodeID::get(
+          DependenciesGraph::NodeKind::Declaration,
+          N.LevitationUnit->UnitPath
+      )
+  );
+}
+
+void LevitationDriverImpl::addLTOVisibilityArgs(
+    LevitationDriver::Args &Args, bool LTOPublic
+) const {
+  if (!Context.Driver.WholeProgramVTables)
+    return;
+
+  Args.emplace_back("-cppl-hidden-lto-visibility");
+  if (LTOPublic)
+    Args.emplace_back("-cppl-public-unit");
+}
+
+void LevitationDriverImpl::getDefinitionArgs(
+    const DependenciesGraph::Node &N,
+    LevitationDriver::Args &FrontendArgs,
+    LevitationDriver::Args &BackendArgs
+) {
+  const auto &Graph = Context.DependenciesInfo->getDependenciesGraph();
+  bool KeepIR = Context.Driver.KeepIR;
+
+  FrontendArgs = Context.CodeGenArgs;
+
+  // Object is considered outdated if it is older than profile,
+  // so it always should be replaced when profile is used.
+  if (Context.Driver.ProfileUse.empty() || KeepIR)
+    FrontendArgs.emplace_back("-cppl-keep-unchanged-outputs");
+
+  // Optimization pipeline, including instrumentation and ThinLTO
+  // summary, is run by backend. Frontend still needs optimization level,
+  // otherwise it marks everything as optnone.
+  auto &PipelineArgs = KeepIR ? BackendArgs : FrontendArgs;
+  if (KeepIR) {
+    FrontendArgs.insert(FrontendArgs.begin(), "-O2");
+    FrontendArgs.emplace_back("-emit-llvm");
+    FrontendArgs.emplace_back("-Xclang");
+    FrontendArgs.emplace_back("-disable-llvm-passes");
+
+    BackendArgs = Context.CodeGenArgs;
+    BackendArgs.append(
+        Context.Driver.ExtraBackendArgs.begin(),
+        Context.Driver.ExtraBackendArgs.end()
+    );
+  }
+
+  if (Context.Driver.SharedPackages) {
+    FrontendArgs.emplace_back("-fPIC");
+    if (KeepIR)
+      BackendArgs.emplace_back("-fPIC");
+  }
+
+  if (Context.Driver.ModulesCodegen)
+    FrontendArgs.emplace_back("-cppl-modules-codegen");
+  if (Context.Driver.ModulesDebugInfo)
+    FrontendArgs.emplace_back("-cppl-modules-debuginfo");
+  if (Context.Driver.EarlyCutoff)
+    FrontendArgs.emplace_back("-cppl-early-cutoff");
+  if (Context.Driver.ReleaseAST)
+    FrontendArgs.emplace_back("-cppl-release-ast");
+  if (Context.Driver.ThinLTO)
+    PipelineArgs.emplace_back("-flto=thin");
+
+  // Type metadata is emitted by frontend, whereas clang driver only
+  // accepts -fwhole-program-vtables along with -flto.
+  if (Context.Driver.WholeProgramVTables) {
+    PipelineArgs.emplace_back("-fwhole-program-vtables");
+    if (KeepIR)
+      for (const char *Arg : {"-flto-unit", "-fwhole-program-vtables"}) {
+        FrontendArgs.emplace_back("-Xclang");
+        FrontendArgs.emplace_back(Arg);
+      }
+    addLTOVisibilityArgs(FrontendArgs, isLTOPublicUnit(N));
+  }
+
+  // Clang driver doesn't know partitions, so they go to frontend as is.
+  if (isSplitCodeGen(N.LevitationUnit->UnitPath))
+    for (const auto &Partition : getCodeGenPartitions(getFilesInfoFor(N))) {
+      PipelineArgs.emplace_back("-Xclang");
+      PipelineArgs.emplace_back(
+          ("-levitation-codegen-partition=" + Partition).str()
+      );
+    }
+  // Debug info is split by code generator.
+  if (Context.Driver.SplitDwarf)
+    PipelineArgs.emplace_back("-gsplit-dwarf");
+  if (Context.Driver.ProfileGenerate)
+    PipelineArgs.emplace_back("-fprofile-generate");
+  if (Context.Driver.ProfileUse.size())
+    PipelineArgs.emplace_back(
+        ("-fprofile-use=" + Context.Driver.ProfileUse).str()
+    );
+
+  // Goes after extra codegen args, so that it wins over their level,
+  // cache keys and command hashes include it same way.
+  auto OptLevel = getOptLevel(N);
+  if (OptLevel.size())
+    PipelineArgs.emplace_back("-O" + OptLevel);
+
+  // Symbols of units out of public interface are never referenced
+  // outside of program or library, so they don't need to be exported.
+  // Libraries with #public units export only them by default.
+  bool HidePrivateUnits =
+      Context.Driver.HidePrivateUnits || (
+        !Context.Driver.isLinkPhaseEnabled() &&
+        !Context.Driver.ExportAllUnits &&
+        Graph.hasPublicNodes()
+      );
+
+  if (HidePrivateUnits && !Graph.isPublic(
+      DependenciesGraph::NodeID::get(
+          DependenciesGraph::NodeKind::Declaration,
+          N.LevitationUnit->UnitPath
+      )
+  )) {
+    FrontendArgs.emplace_back("-fvisibility=hidden");
+    FrontendArgs.emplace_back("-fvisibility-inlines-hidden");
+  }
+
+}
+
+bool LevitationDriverImpl::processIR(const DependenciesGraph::Node &N) {
+  if (
+    !Context.Driver.KeepIR ||
+    N.Kind != DependenciesGraph::NodeKind::Definition ||
+    isCodelessDefinition(N)
+  )
+    return true;
+
+  const auto &Files = getFilesInfoFor(N);
+  StringRef UnitID = *Strings.getItem(N.LevitationUnit->UnitPath);
+
+  LevitationDriver::Args FrontendArgs, BackendArgs;
+  getDefinitionArgs(N, FrontendArgs, BackendArgs);
+
+  if (Context.Driver.DryRun)
+    return Commands::compileIR(
+        Context.Driver.BinDir, Files.Object, Files.IR, UnitID, BackendArgs,
+        Context.Driver.isVerbose(), true, Context.Driver.Execution
+    );
+
+  // Object depends on IR and backend args only.
+  BuildCacheKey ArgsKey;
+  ArgsKey
+  .add(getClangFullVersion())
+  .addAll(BackendArgs)
+  .add(Context.ProfileUseHash);
+  auto ArgsKeyStr = ArgsKey.done();
+  HashVectorTy ArgsHash(ArgsKeyStr.begin(), ArgsKeyStr.end());
+
+  auto IRStamp = getFileStamp(Files.IR);
+  if (!IRStamp)
+    return false;
+
+  // IR hash is recorded by its meta, see updateProductState.
+  HashVectorTy IRHash;
+  with (auto _ = lock(Context.StateMutex)) {
+    if (const auto *IRState = Context.State.get(Files.IR))
+      IRHash = IRState->ProductHash;
+  }
+
+  if (IRHash.empty()) {
+    auto &FM = CreatableSingleton<FileManager>::get();
+    if (!calcHashFromFile(FM, metaHash(), IRHash, Files.IR))
+      return false;
+  }
+
+  const auto *Recorded = Context.PrevState.get(Files.Object);
+  auto ObjectStamp = getFileStamp(Files.Object);
+
+  if (
+    Recorded && ObjectStamp &&
+    Recorded->Product == *ObjectStamp &&
+    Recorded->SourceHash == IRHash &&
+    Recorded->ProductHash == ArgsHash
+  ) {
+    setProductState(Files.Object, *Recorded);
+    Log.log_verbose("Object for '", UnitID, "' is up-to-date.");
+    return true;
+  }
+
+  setObjectsUpdated();
+
+  bool Res = runTimed(
+      BuildHistory::StepKind::BuildObject,
+      UnitID,
+      [&] {
+        return Commands::compileIR(
+            Context.Driver.BinDir,
+            Files.Object,
+            Files.IR,
+            UnitID,
+            BackendArgs,
+            Context.Driver.isVerbose(),
+            Context.Driver.DryRun,
+            Context.Driver.Execution
+        );
+      }
+  );
+
+  if (!Res)
+    return false;
+
+  if (auto NewObjectStamp = getFileStamp(Files.Object))
+    setProductState(
+        Files.Object, {*IRStamp, IRHash, *NewObjectStamp, ArgsHash}
+    );
+
+  return true;
+}
+
+bool LevitationDriverImpl::processDefinition(
+    const DependenciesGraph::Node &N
+) {
+  assert(
+      N.Kind == DependenciesGraph::NodeKind::Definition &&
+      "Only definition nodes expected here"
+  );
+
+  const auto &Graph = Context.DependenciesInfo->getDependenciesGraph();
+  const auto &Files = getFilesInfoFor(N);
+
+  Paths fullDependencies = getFullDependencies(N, Graph);
+
+  setObjectsUpdated();
+
+  StringRef UnitID = *Strings.getItem(N.LevitationUnit->UnitPath);
+
+  LevitationDriver::Args CodeGenArgs, BackendArgs;
+  getDefinitionArgs(N, CodeGenArgs, BackendArgs);
+
+  auto ExtraArgs = Context.Driver.ExtraParseArgs;
+  ExtraArgs.append(CodeGenArgs.begin(), CodeGenArgs.end());
+
+  // Same profile path may refer to different profiles.
+  if (Context.ProfileUseHash.size() && !Context.Driver.KeepIR)
+    ExtraArgs.emplace_back(Context.ProfileUseHash);
+
+  bool KeepIR = Context.Driver.KeepIR;
+  StringRef Output = KeepIR ? Files.IR : Files.Object;
+
+  auto Key = getCacheKey(
+      KeepIR ? "ir" : "object",
+      Files.Source,
+      getFullDependenciesMetas(N, Graph),
+      ExtraArgs
+  );
+
+  auto CommandHash = getCommandHash(KeepIR ? "ir" : "object", ExtraArgs);
+  if (CommandHash.size())
+    CodeGenArgs.emplace_back("-cppl-command-hash=" + CommandHash);
+
+  // Code generator flags don't all go into IR, so partitions
+  // are only shared by jobs with same command.
+  if (
+    Context.Driver.IncrementalCodeGen && CommandHash.size() && !KeepIR &&
+    isSplitCodeGen(N.LevitationUnit->UnitPath)
+  ) {
+    auto CacheDir = Path::getPath<SinglePath>(
+        Context.Driver.BuildRoot, DriverDefaults::CODEGEN_CACHE_DIR
+    );
+    llvm::sys::path::append(CacheDir, CommandHash);
+    CodeGenArgs.emplace_back("-Xclang");
+    CodeGenArgs.emplace_back(
+        ("-levitation-codegen-cache=" + CacheDir).str()
+    );
+  }
+
+  std::vector<BuildCache::Artifact> Artifacts {
+      {KeepIR ? "ir" : "object", Output}, {"meta", Files.ObjMetaFile}
+  };
+
+  // In keep IR mode split DWARF is produced by backend.
+  if (!KeepIR && Files.SplitDwarf.size())
+    Artifacts.push_back({"dwo", Files.SplitDwarf});
+
+  auto DiagnosticsFile = getDiagnosticsFile(Output);
+  if (diagnosticsReplayEnabled())
+    Artifacts.push_back({"diagnostics", DiagnosticsFile});
+
+  // In keep IR mode partitions are produced by backend.
+  Paths Partitions;
+  std::vector<std::string> PartitionNames;
+  if (!KeepIR && isSplitCodeGen(N.LevitationUnit->UnitPath)) {
+    Partitions = getCodeGenPartitions(Files);
+    for (unsigned i = 0, e = Partitions.size(); i != e; ++i)
+      PartitionNames.push_back(("part" + Twine(i + 1)).str());
+    for (unsigned i = 0, e = Partitions.size(); i != e; ++i)
+      Artifacts.push_back({PartitionNames[i], Partitions[i]});
+  }
+
+  return runCached(
+      Key,
+      Artifacts,
+      [&] {
+        return Commands::buildObject(
+          Context.Driver.BinDir,
+          Context.Driver.Includes,
+          getPreambleOutput(Files.Source),
+          Output,
+          Files.ObjMetaFile,
+          KeepIR ? StringRef() : Files.SplitDwarf,
+          Files.Source,
+          UnitID,
+          fullDependencies,
+          NameIndex,
+          Context.Driver.PortableSourcesRoot,
+          Context.Driver.StdLib,
+          Context.Driver.ExtraParseArgs,
+          CodeGenArgs,
+          Context.Driver.RemoteExecutor,
+          getWorker(N.ID),
+          Context.Driver.isVerbose(),
+          Context.Driver.DryRun,
+          Context.Driver.Execution
+        );
+      }
+  );
+}
+
+bool LevitationDriverImpl::processDeclaration(
+    const DeclASTMeta &OldMeta,
+    const DependenciesGraph::Node &N,
+    bool AlreadyBuilt
+) {
+  const auto &Graph = Context.DependenciesInfo->getDependenciesGraph();
+  const auto &Files = getFilesInfoFor(N);
+  Paths fullDependencies = getFullDependencies(N, Graph);
+
+  // Nobody is going to load declaration AST of a private unit
+  // nobody depends on. If unit also has a definition, then the definition
+  // build parses and diagnoses the whole source anyway, so the
+  // declaration build can be skipped entirely. See #48.
+  bool NeedDeclAST =
+      !N.DependentNodes.empty() ||
+      Graph.isPublic(N.ID) ||
+      N.LevitationUnit->Definition == nullptr;
+
+  if (!NeedDeclAST) {
+    with (auto verb = Log.acquireIfEnabled(log::Level::Verbose)) {
+      auto &Verbose = verb.s;
+      Verbose << "Skip building unused declaration for ";
+      Graph.dumpNodeShort(Verbose, N.ID, Strings);
+      Verbose << "\n";
+    }
+    return true;
+  }
+
+  StringRef UnitID = *Strings.getItem(N.LevitationUnit->UnitPath);
+
+  // Check whether we also will compile a definition,
+  // in this case both phases may produce same warnings,
+  // so suppress warnings for declaration.
+  // Definition object also provides unit's inline functions.
+  //
+  // NOTE: this is only actual unless we change parsing workflow.
+  // In future I hope to parse definition with preincluded
+  // parsed declaratino AST, in this case we should change this behaviour.
+  // See L-28 in lib/Levitation/BugTracking.txt.
+  bool HasDefinition = N.LevitationUnit->Definition != nullptr;
+
+  bool MustGenerateHeaders =
+      Context.Driver.shouldCreateHeaders() &&
+      Graph.isPublic(N.ID);
+
+  bool MustGenerateDecl =
+      Context.Driver.shouldCreateDecls() &&
+      Graph.isPublic(N.ID) &&
+      !Graph.isExternal(N.ID);
+
+  StringRef Preamble =
+      N.Dependencies.empty() ? getPreambleSource(Files.Source) : "";
+
+  // decl-ast job generates .h and .decl files itself, from
+  // fragments it keeps in memory. Driver only generates them if
+  // declaration AST was built by someone else, or taken from cache.
+  GeneratedSources Generated;
+  if (MustGenerateHeaders) {
+    assert(!Files.Header.empty());
+    Generated.Header = Files.Header;
+    Generated.Includes = getIncludeSources(N, Graph);
+  }
+  if (MustGenerateDecl) {
+    assert(!Files.Decl.empty());
+    Generated.Decl = Files.Decl;
+    Generated.Imports = getImportSources(N, Graph);
+  }
+  Generated.Preamble = Preamble;
+
+  bool GeneratedEmitted = false;
+
+  bool buildDeclSuccessfull = AlreadyBuilt || buildDeclAST(
+      UnitID,
+      Files,
+      fullDependencies,
+      getFullDependenciesMetas(N, Graph),
+      HasDefinition,
+      isLTOPublicUnit(N),
+      getWorker(N.ID),
+      Generated,
+      &GeneratedEmitted
+  );
+
+  if (!buildDeclSuccessfull)
+    return false;
+
+  // Nothing was built, so there is no meta to compare with,
+  // dependents are supposed to be affected.
+  if (Context.Driver.DryRun) {
+    setNodeUpdated(N.ID);
+    return true;
+  }
+
+  DeclASTMeta Meta;
+  if (!loadMeta(
+      Meta, Context.Driver.BuildRoot, Files.DeclASTMetaFile
+  ))
+    return false;
+
+  noteCodeless(N, Meta);
+
+  // Nobody within the build reads generated sources, so they are
+  // generated in background, and dependents are released right away.
+  if (!GeneratedEmitted && (MustGenerateHeaders || MustGenerateDecl)) {
+    struct Job {
+      std::string UnitID;
+      std::string Header;
+      std::string Decl;
+      std::string Source;
+      std::string Preamble;
+      GeneratedSources Generated;
+      DeclASTMeta::FragmentsVectorTy SkippedBytes;
+    };
+
+    auto J = std::make_shared<Job>();
+    J->UnitID = UnitID.str();
+    J->Header = Files.Header.str();
+    J->Decl = Files.Decl.str();
+    J->Source = Files.Source.str();
+    J->Preamble = Preamble.str();
+    J->Generated = std::move(Generated);
+    J->SkippedBytes = Meta.getFragmentsToSkip();
+
+    bool Verbose = Context.Driver.isVerbose();
+
+    ArtifactPublisher::get().publish([=] {
+      HeaderGenerator Header(
+          J->UnitID,
+          J->Header,
+          J->Source,
+          J->Preamble,
+          J->Generated.Includes,
+          J->SkippedBytes,
+          Verbose,
+          /*DryRun=*/false
+      );
+
+      HeaderGenerator Decl(
+          J->UnitID,
+          J->Decl,
+          J->Source,
+          J->Preamble,
+          J->Generated.Imports,
+          J->SkippedBytes,
+          Verbose,
+          /*DryRun=*/false,
+          /*import*/true
+      );
+
+      if (MustGenerateHeaders && MustGenerateDecl)
+        return HeaderGenerator::execute(Header, Decl);
+      return MustGenerateHeaders ? Header.execute() : Decl.execute();
+    });
+  }
+
+  // Mark that node was updated, if it was updated
+
+  if (isInterfaceUpdated(OldMeta, Meta, N)) {
+    if (Context.Driver.EarlyCutoff)
+      recordChangedDecls(N.ID, OldMeta, Meta);
+    setNodeUpdated(N.ID);
+    recordInterfaceChange(*Strings.getItem(N.LevitationUnit->UnitPath));
+  } else {
+    with (auto verb = Log.acquireIfEnabled(log::Level::Verbose)) {
+      auto &Verbose = verb.s;
+      Verbose << "Node ";
+      Graph.dumpNodeShort(Verbose, N.ID, Strings);
+      Verbose << " is up-to-date.\n";
+    }
+  }
+
+  return true;
+}
+
+LevitationDriver::Args LevitationDriverImpl::getDeclASTArgs(
+    bool HasDefinition,
+    bool LTOPublic
+) {
+  auto ExtraArgs = Context.Driver.ExtraParseArgs;
+
+  // Definition build diagnoses same source, so suppress warnings.
+  // Definition object is also a home for unit's inline functions
+  // and types debug info.
+  if (HasDefinition) {
+    ExtraArgs.emplace_back("-Wno-everything");
+    if (Context.Driver.ModulesCodegen)
+      ExtraArgs.emplace_back("-cppl-modules-codegen");
+    if (Context.Driver.ModulesDebugInfo)
+      ExtraArgs.emplace_back("-cppl-modules-debuginfo");
+  }
+
+  if (Context.Driver.InstantiateInterface)
+    ExtraArgs.emplace_back("-cppl-instantiate-interface");
+
+  if (Context.Driver.ExportBodies)
+    ExtraArgs.emplace_back(
+        "-cppl-export-bodies=" + std::to_string(Context.Driver.ExportBodies)
+    );
+
+  if (Context.Driver.EarlyCutoff)
+    ExtraArgs.emplace_back("-cppl-early-cutoff");
+
+  if (Context.Driver.CompactDeclAST)
+    ExtraArgs.emplace_back("-cppl-compact-decl-ast");
+
+  if (Context.Driver.EmbedMeta)
+    ExtraArgs.emplace_back("-cppl-embed-meta");
+
+  addLTOVisibilityArgs(ExtraArgs, LTOPublic);
+
+  // Unchanged declaration AST keeps its timestamp, so
+  // dependents which recorded it still find it valid.
+  ExtraArgs.emplace_back("-cppl-keep-unchanged-outputs");
+
+  return ExtraArgs;
+}
+
+bool LevitationDriverImpl::buildDeclAST(
+    StringRef UnitID,
+    const FilesInfo &Files,
+    const Paths &FullDeps,
+    const Paths &FullDepsMetas,
+    bool HasDefinition,
+    bool LTOPublic,
+    int Worker,
+    const GeneratedSources &Generated,
+    bool *GeneratedEmitted
+) {
+  auto ExtraArgs = getDeclASTArgs(HasDefinition, LTOPublic);
+
+  auto Key = getCacheKey("decl-ast", Files.Source, FullDepsMetas, ExtraArgs);
+  auto LibraryKey = getLibraryCacheKey(
+      "decl-ast", UnitID, Files.Source, FullDepsMetas, ExtraArgs
+  );
+
+  auto CommandHash = getCommandHash("decl-ast", ExtraArgs, FullDeps);
+  if (CommandHash.size())
+    ExtraArgs.emplace_back("-cppl-command-hash=" + CommandHash);
+
+  SmallVector<BuildCache::Artifact, 3> Artifacts {{"decl-ast", Files.DeclAST}};
+  if (!Context.Driver.EmbedMeta)
+    Artifacts.push_back({"meta", Files.DeclASTMetaFile});
+
+  auto DiagnosticsFile = getDiagnosticsFile(Files.DeclAST);
+  if (diagnosticsReplayEnabled())
+    Artifacts.push_back({"diagnostics", DiagnosticsFile});
+
+  // Driver itself only reads meta, and library cache
+  // is filled with all artifacts.
+  if (Context.Driver.LazyCacheFetch && LibraryKey.empty())
+    Artifacts.front().Deferred = true;
+
+  return LibraryCache::get().fetchOrFill(LibraryKey, Artifacts, [&] {
+    return runCached(
+        Key,
+        Artifacts,
+        [&] {
+          bool Res = Commands::buildDecl(
+              Context.Driver.BinDir,
+              Context.Driver.Includes,
+              getPreambleOutput(Files.Source),
+              Files.DeclAST,
+              Files.DeclASTMetaFile,
+              Files.Source,
+              UnitID,
+              FullDeps,
+              NameIndex,
+              Context.Driver.PortableSourcesRoot,
+              Context.Driver.StdLib,
+              ExtraArgs,
+              Generated,
+              Context.Driver.RemoteExecutor,
+              Worker,
+              Context.Driver.isVerbose(),
+              Context.Driver.DryRun,
+              Context.Driver.Execution
+          );
+
+          if (Res && GeneratedEmitted && !Context.Driver.DryRun)
+            *GeneratedEmitted = !Generated.empty();
+
+          return Res;
+        }
+    );
+  });
+}
+
+bool LevitationDriverImpl::isInterfaceUpdated(
+    const DeclASTMeta &OldMeta,
+    const DeclASTMeta &NewMeta,
+    const DependenciesGraph::Node &N
+) {
+  bool DepsUpdated = isPreambleUpdated(getFilesInfoFor(N).Source);
+  for (auto D : N.Dependencies)
+    if (Context.UpdatedNodes.count(D))
+      DepsUpdated = true;
+
+  return isInterfaceUpdated(
+      OldMeta,
+      NewMeta,
+      DepsUpdated,
+      Context.DependenciesInfo->getDependenciesGraph()
+          .nodeDescrShort(N.ID, Strings)
+  );
+}
+
+bool LevitationDriverImpl::isInterfaceUpdated(
+    const DeclASTMeta &OldMeta,
+    const DeclASTMeta &NewMeta,
+    bool DepsUpdated,
+    StringRef ItemDescr
+) {
+  if (equal(OldMeta.getDeclASTHash(), NewMeta.getDeclASTHash()))
+    return false;
+
+  // Decl AST may also change due to updated dependencies,
+  // in this case we can't rely on interface hash.
+  if (Context.PreambleUpdated || DepsUpdated)
+    return true;
+
+  // Decl AST contains source locations, so any change in source
+  // changes decl AST. Interface hash only covers declarations themselves,
+  // thus changes inside bodies don't cause dependent chains rebuild.
+  const auto &OldHash = OldMeta.getInterfaceHash();
+  if (OldHash.empty() || !equal(OldHash, NewMeta.getInterfaceHash()))
+    return true;
+
+  Log.log_verbose(
+      "Interface of ", ItemDescr, " is same, dependents are not affected."
+  );
+
+  return false;
+}
+
+bool LevitationDriverImpl::isUpToDate(
+    DeclASTMeta &Meta,
+    const DependenciesGraph::Node &N
+) {
+  const auto &Files = getFilesInfoFor(N);
+
+  auto &Stats = DriverStats::get();
+  ++Stats.NodesChecked;
+
+  auto rebuild = [&] (RebuildReason &&R) {
+    ++Stats.NodesRebuilt;
+    explainRebuild(N, std::move(R));
+    return false;
+  };
+
+  if (isPreambleUpdated(Files.Source))
+    return rebuild({RebuildReason::Kind::PreambleUpdated});
+
+  for (auto HU : getHeaderUnits(N))
+    if (Context.HeaderUnits[HU].Updated) {
+      RebuildReason R {RebuildReason::Kind::HeaderUnitUpdated};
+      R.HeaderUnit = Context.Driver.HeaderUnits[HU].str();
+      return rebuild(std::move(R));
+    }
+
+  RebuildReason DepsReason {RebuildReason::Kind::DependencyUpdated};
+  bool DepsUpdated = false;
+  for (auto D : N.Dependencies)
+    if (Context.UpdatedNodes.count(D)) {
+      if (!DepsUpdated)
+        DepsReason.Dependency = D;
+      DepsUpdated = true;
+    }
+
+  if (DepsUpdated && !areUsedDeclsUnchanged(N))
+    return rebuild(std::move(DepsReason));
+
+  if (isProfileUpdated(N))
+    return rebuild({RebuildReason::Kind::ProfileUpdated});
+
+  StringRef MetaFile;
+  StringRef ProductFile;
+
+  if (!getProductFiles(N, ProductFile, MetaFile))
+    return rebuild({RebuildReason::Kind::NoProduct});
+
+  auto NodeDescr = Context.DependenciesInfo->getDependenciesGraph()
+      .nodeDescrShort(N.ID, Strings);
+
+  RebuildReason::Kind Reason = RebuildReason::Kind::SourceChanged;
+  if (isUpToDate(
+      Meta, ProductFile, MetaFile, Files.Source, NodeDescr, &Reason,
+      getCommandHash(N)
+  ))
+    return true;
+
+  ++Stats.NodesRebuilt;
+
+  // Plan covers every step, so there is nothing to explain.
+  if (!NinjaPlan::get().isRecording())
+    explainRebuild(N, {Reason});
+  return false;
+}
+
+bool LevitationDriverImpl::isProfileUpdated(const DependenciesGraph::Node &N) {
+  // Profile is object's input as well, rebuild object
+  // if profile was updated after it.
+  if (
+    N.Kind != DependenciesGraph::NodeKind::Definition ||
+    Context.Driver.ProfileUse.empty() ||
+    Context.Driver.KeepIR
+  )
+    return false;
+
+  auto ProfileStamp = getFileStamp(Context.Driver.ProfileUse);
+  auto ObjectStamp = getFileStamp(getFilesInfoFor(N).Object);
+  return !ProfileStamp || !ObjectStamp ||
+         ObjectStamp->MTime < ProfileStamp->MTime;
+}
+
+bool LevitationDriverImpl::areOwnInputsUpToDate(
+    const DependenciesGraph::Node &N,
+    DeclASTMeta *LoadedMeta
+) {
+  const auto &Files = getFilesInfoFor(N);
+
+  // Codeless definition has no object, its declaration
+  // tells whether it is still codeless.
+  if (
+    Context.Driver.SkipEmptyObjects &&
+    N.Kind == DependenciesGraph::NodeKind::Definition &&
+    N.LevitationUnit->Declaration &&
+    !llvm::sys::fs::exists(Context.Driver.KeepIR ? Files.IR : Files.Object)
+  ) {
+    DeclASTMeta DeclMeta;
+    return
+        areOwnInputsUpToDate(*N.LevitationUnit->Declaration, &DeclMeta) &&
+        DeclMeta.isCodeless();
+  }
+
+  if (isPreambleUpdated(Files.Source))
+    return false;
+
+  for (auto HU : getHeaderUnits(N))
+    if (Context.HeaderUnits[HU].Updated)
+      return false;
+
+  if (isProfileUpdated(N))
+    return false;
+
+  StringRef MetaFile;
+  StringRef ProductFile;
+  if (!getProductFiles(N, ProductFile, MetaFile))
+    return false;
+
+  DeclASTMeta Meta;
+  bool UpToDate = isUpToDate(
+      Meta, ProductFile, MetaFile, Files.Source, Files.Source,
+      /*Reason=*/nullptr, getCommandHash(N)
+  );
+
+  if (UpToDate && LoadedMeta)
+    *LoadedMeta = std::move(Meta);
+
+  return UpToDate;
+}
+
+void LevitationDriverImpl::noteCodeless(
+    const DependenciesGraph::Node &N,
+    const DeclASTMeta &Meta
+) {
+  if (
+    !Context.Driver.SkipEmptyObjects ||
+    N.Kind != DependenciesGraph::NodeKind::Declaration ||
+    !Meta.isCodeless()
+  )
+    return;
+
+  auto _ = lock(Context.CodelessUnitsMutex);
+  Context.CodelessUnits.insert(N.LevitationUnit->UnitPath);
+}
+
+bool LevitationDriverImpl::isCodelessDefinition(
+    const DependenciesGraph::Node &N
+) const {
+  if (
+    !Context.Driver.SkipEmptyObjects ||
+    N.Kind != DependenciesGraph::NodeKind::Definition
+  )
+    return false;
+
+  auto _ = lock(Context.CodelessUnitsMutex);
+  return Context.CodelessUnits.count(N.LevitationUnit->UnitPath);
+}
+
+bool LevitationDriverImpl::skipCodelessDefinition(
+    const DependenciesGraph::Node &N
+) {
+  const auto &Files = getFilesInfoFor(N);
+
+  with (auto verb = Log.acquireIfEnabled(log::Level::Verbose)) {
+    auto &Verbose = verb.s;
+    Verbose << "Skip object of codeless ";
+    Context.DependenciesInfo->getDependenciesGraph()
+        .dumpNodeShort(Verbose, N.ID, Strings);
+    Verbose << "\n";
+  }
+
+  if (Context.Driver.DryRun)
+    return true;
+
+  // Object left by previous build was linked,
+  // so executable is to be linked again.
+  bool Removed = false;
+  for (StringRef F : { Files.Object, Files.IR, Files.ObjMetaFile })
+    if (F.size() && llvm::sys::fs::exists(F) && !llvm::sys::fs::remove(F))
+      Removed = true;
+
+  if (Removed)
+    setObjectsUpdated();
+
+  return true;
+}
+
+void LevitationDriverImpl::precheckNodes() {
+  Context.NodesPrechecked = false;
+  Context.DirtyNodes.clear();
+
+  // Products of other invocations may appear while we build,
+  // so nodes are checked as they are scheduled.
+  if (
+    Context.Driver.DryRun ||
+    Context.Driver.Check ||
+    Context.Driver.SharedBuildRoot ||
+    NinjaPlan::get().isRecording()
+  )
+    return;
+
+  const auto &Graph = Context.DependenciesInfo->getDependenciesGraph();
+
+  std::vector<const DependenciesGraph::Node *> Nodes;
+  for (const auto &NodeIt : Graph.allNodes()) {
+    const auto &N = *NodeIt.second;
+    if (!N.LevitationUnit || !isSelected(N.ID))
+      continue;
+
+    // Declarations were already processed by other pipeline,
+    // updated ones are kept in UpdatedNodes.
+    if (N.Kind == DependenciesGraph::NodeKind::Declaration) {
+      if (Context.DeclarationsProcessed)
+        continue;
+      if (
+        Streaming &&
+        Streaming->StreamedOldMetas.count(N.LevitationUnit->UnitPath)
+      )
+        continue;
+    }
+
+    Nodes.push_back(&N);
+  }
+
+  Log.log_verbose("Checking ", Nodes.size(), " nodes...");
+
+  std::vector<char> Fresh(Nodes.size(), false);
+  std::vector<char> Codeless(Nodes.size(), false);
+
+  TasksManager::TasksSet Tasks;
+  for (size_t i = 0, e = Nodes.size(); i != e; ++i) {
+    auto TID = TM.runTask([&, i] (TasksManager::TaskContext &TC) {
+      DeclASTMeta Meta;
+      Fresh[i] = areOwnInputsUpToDate(*Nodes[i], &Meta);
+      Codeless[i] =
+          Nodes[i]->Kind == DependenciesGraph::NodeKind::Declaration &&
+          Fresh[i] && Meta.isCodeless();
+      TC.Successful = true;
+    });
+    Tasks.insert(TID);
+  }
+
+  if (!TM.waitForTasks(Tasks))
+    return;
+
+  // Dependents of dirty nodes, and of nodes updated by
+  // previous phases may be affected as well.
+  SmallVector<DependenciesGraph::NodeID::Type, 64> Worklist(
+      Context.UpdatedNodes.begin(), Context.UpdatedNodes.end()
+  );
+  for (size_t i = 0, e = Nodes.size(); i != e; ++i)
+    if (!Fresh[i])
+      Worklist.push_back(Nodes[i]->ID);
+
+  while (!Worklist.empty()) {
+    auto NID = Worklist.pop_back_val();
+    if (!Context.DirtyNodes.insert(NID).second)
+      continue;
+
+    for (auto DependentID : Graph.getNode(NID).DependentNodes)
+      if (!Context.DirtyNodes.count(DependentID))
+        Worklist.push_back(DependentID);
+  }
+
+  Context.NodesPrechecked = true;
+
+  // Clean declarations won't be checked again, so their
+  // metas are only seen here.
+  for (size_t i = 0, e = Nodes.size(); i != e; ++i)
+    if (Codeless[i] && !Context.DirtyNodes.count(Nodes[i]->ID)) {
+      auto _ = lock(Context.CodelessUnitsMutex);
+      Context.CodelessUnits.insert(Nodes[i]->LevitationUnit->UnitPath);
+    }
+
+  size_t NumDirty = 0;
+  for (const auto *N : Nodes)
+    NumDirty += Context.DirtyNodes.count(N->ID);
+
+  Log.log_verbose(
+      NumDirty, " of ", Nodes.size(), " nodes may be rebuilt."
+  );
+}
+
+void LevitationDriverImpl::exportGraph() {
+  StringRef Output = Context.Driver.ExportGraph;
+
+  DependenciesGraphExport::Format Format;
+  if (!DependenciesGraphExport::getFormat(Output, Format)) {
+    Log.log_warning(
+        "Unknown graph export format of '", Output, "', ",
+        "use .dot, .gv or .json extension."
+    );
+    return;
+  }
+
+  const auto &Graph = Context.DependenciesInfo->getDependenciesGraph();
+
+  // Steps run by this build go first, others were run by previous ones.
+  DependenciesGraphExport Export(Graph, Strings, [&] (
+      const DependenciesGraph::Node &N
+  ) {
+    DependenciesGraphExport::NodeCosts Costs;
+    if (!N.LevitationUnit)
+      return Costs;
+
+    auto Kind = getStepKind(N);
+    StringRef UnitPath = *Strings.getItem(N.LevitationUnit->UnitPath);
+
+    if (auto D = Context.Timings.getDuration(Kind, UnitPath))
+      Costs.Duration = *D;
+    else if (auto D = Context.History.getDuration(Kind, UnitPath))
+      Costs.Duration = *D;
+
+    if (auto M = Context.Timings.getPeakMemory(Kind, UnitPath))
+      Costs.PeakMemory = *M;
+    else if (auto M = Context.History.getPeakMemory(Kind, UnitPath))
+      Costs.PeakMemory = *M;
+
+    return Costs;
+  });
+
+  File F(Output);
+  with (auto Scope = F.open())
+    Export.write(Scope.getOutputStream(), Format);
+
+  if (F.hasErrors())
+    Log.log_warning("Failed to export graph into '", Output, "'.");
+  else
+    Log.log_verbose("Dependencies graph is exported into '", Output, "'.");
+}
+
+void LevitationDriverImpl::runTidy() {
+  if (!Status.isValid())
+    return;
+
+  const auto &Graph = Context.DependenciesInfo->getDependenciesGraph();
+  auto &TM = TasksManager::get();
+
+  TasksManager::TasksSet TidyTasks;
+
+  for (size_t Idx = 0, e = Graph.getNumNodes(); Idx != e; ++Idx) {
+    const auto &N = Graph.getNodeByIndex(Idx);
+    if (
+      N.Kind != DependenciesGraph::NodeKind::Definition ||
+      !N.LevitationUnit ||
+      Graph.isExternal(N.ID)
+    )
+      continue;
+
+    auto TID = TM.runTask([this, &N] (TasksManager::TaskContext &TC) {
+      TC.Successful = processTidy(N);
+      if (!TC.Successful)
+        onStepFailed();
+    });
+
+    TidyTasks.insert(TID);
+  }
+
+  if (!TM.waitForTasks(TidyTasks) || !TM.allSuccessfull(TidyTasks))
+    Status.setFailure()
+    << "Tidy: phase failed.";
+}
+
+bool LevitationDriverImpl::processTidy(const DependenciesGraph::Node &N) {
+  const auto &Graph = Context.DependenciesInfo->getDependenciesGraph();
+  const auto &Files = getFilesInfoFor(N);
+  StringRef UnitID = *Strings.getItem(N.LevitationUnit->UnitPath);
+
+  auto FixesFile = Path::replaceExtension<SinglePath>(
+      Files.DeclAST, FileExtensions::TidyFixes
+  );
+
+  LevitationDriver::Args KeyArgs = Context.Driver.ExtraParseArgs;
+  KeyArgs.emplace_back(Context.Driver.TidyChecks);
+
+  auto DepsMetas = getFullDependenciesMetas(N, Graph);
+
+  // Fixes are up-to-date, if neither source, nor dependencies,
+  // nor checks have changed since they were exported.
+  HashVectorTy KeyHash;
+  if (!Context.Driver.DryRun) {
+    auto KeyStr = getStepKey("tidy", Files.Source, DepsMetas, KeyArgs);
+    KeyHash.assign(KeyStr.begin(), KeyStr.end());
+  }
+
+  const auto *Recorded = Context.PrevState.get(FixesFile);
+  auto FixesStamp = getFileStamp(FixesFile);
+
+  if (
+    KeyHash.size() && Recorded && FixesStamp &&
+    Recorded->Product == *FixesStamp &&
+    Recorded->ProductHash == KeyHash
+  ) {
+    setProductState(FixesFile, *Recorded);
+    Log.log_verbose("Tidy fixes for '", UnitID, "' are up-to-date.");
+    return true;
+  }
+
+  auto SourceStamp = getFileStamp(Files.Source);
+
+  bool Res = runCached(
+      getCacheKey("tidy", Files.Source, DepsMetas, KeyArgs),
+      {{"tidy", FixesFile}},
+      [&] {
+        if (!Commands::runTidy(
+            Context.Driver.BinDir,
+            Context.Driver.Includes,
+            getPreambleOutput(Files.Source),
+            FixesFile,
+            Files.Source,
+            UnitID,
+            getFullDependencies(N, Graph),
+            NameIndex,
+            Context.Driver.StdLib,
+            Context.Driver.TidyChecks,
+            Context.Driver.ExtraParseArgs,
+            Context.Driver.isVerbose(),
+            Context.Driver.DryRun
+        ))
+          return false;
+
+        // clang-tidy exports nothing if there is nothing to fix,
+        // but unit still should be considered as checked.
+        if (!Context.Driver.DryRun && !llvm::sys::fs::exists(FixesFile)) {
+          File F(FixesFile);
+          with (auto Scope = F.open()) {}
+          return !F.hasErrors();
+        }
+        return true;
+      }
+  );
+
+  if (!Res || Context.Driver.DryRun)
+    return Res;
+
+  auto NewFixesStamp = getFileStamp(FixesFile);
+  if (SourceStamp && NewFixesStamp && KeyHash.size())
+    setProductState(
+        FixesFile, {*SourceStamp, HashVectorTy(), *NewFixesStamp, KeyHash}
+    );
+
+  return true;
+}
+
+bool LevitationDriverImpl::processCheck(const DependenciesGraph::Node &N) {
+  const auto &Graph = Context.DependenciesInfo->getDependenciesGraph();
+  const auto &Files = getFilesInfoFor(N);
+  StringRef UnitID = *Strings.getItem(N.LevitationUnit->UnitPath);
+
+  if (Graph.isExternal(N.ID))
+    return true;
+
+  auto StampFile = Path::replaceExtension<SinglePath>(
+      Files.Object, FileExtensions::CheckStamp
+  );
+
+  auto DepsMetas = getFullDependenciesMetas(N, Graph);
+
+  // Unit is checked already, if neither source, nor dependencies,
+  // nor parser arguments have changed since last successful check.
+  HashVectorTy KeyHash;
+  if (!Context.Driver.DryRun) {
+    auto KeyStr = getStepKey(
+        "check", Files.Source, DepsMetas, Context.Driver.ExtraParseArgs
+    );
+    KeyHash.assign(KeyStr.begin(), KeyStr.end());
+  }
+
+  const auto *Recorded = Context.PrevState.get(StampFile);
+  auto Stamp = getFileStamp(StampFile);
+
+  if (
+    KeyHash.size() && Recorded && Stamp &&
+    Recorded->Product == *Stamp &&
+    Recorded->ProductHash == KeyHash
+  ) {
+    setProductState(StampFile, *Recorded);
+    Log.log_verbose("Check of '", UnitID, "' is up-to-date.");
+    return true;
+  }
+
+  auto SourceStamp = getFileStamp(Files.Source);
+
+  if (!Commands::checkDefinition(
+      Context.Driver.BinDir,
+      Context.Driver.Includes,
+      getPreambleOutput(Files.Source),
+      Files.Source,
+      UnitID,
+      getFullDependencies(N, Graph),
+      NameIndex,
+      Context.Driver.StdLib,
+      Context.Driver.ExtraParseArgs,
+      Context.Driver.RemoteExecutor,
+      getWorker(N.ID),
+      Context.Driver.isVerbose(),
+      Context.Driver.DryRun,
+      Context.Driver.Execution
+  ))
+    return false;
+
+  if (Context.Driver.DryRun)
+    return true;
+
+  levitation::Path::createDirsForFile(StampFile);
+  File F(StampFile);
+  with (auto Scope = F.open()) {}
+  if (F.hasErrors())
+    return false;
+
+  auto NewStamp = getFileStamp(StampFile);
+  if (SourceStamp && NewStamp && KeyHash.size())
+    setProductState(
+        StampFile, {*SourceStamp, HashVectorTy(), *NewStamp, KeyHash}
+    );
+
+  return true;
+}
+
+void LevitationDriverImpl::writeCompileCommands() {
+  StringRef Output = Context.Driver.CompileCommands;
+  const auto &Graph = Context.DependenciesInfo->getDependenciesGraph();
+
+  // Commands are recorded in dry run mode, so that nothing is executed
+  // or traced, and command lines don't depend on current sources.
+  auto &Database = CompileCommands::get();
+  Database.startRecording();
+
+  for (size_t Idx = 0, e = Graph.getNumNodes(); Idx != e; ++Idx) {
+    const auto &N = Graph.getNodeByIndex(Idx);
+    if (
+      N.Kind != DependenciesGraph::NodeKind::Definition ||
+      !N.LevitationUnit ||
+      Graph.isExternal(N.ID)
+    )
+      continue;
+
+    const auto &Files = getFilesInfoFor(N);
+    StringRef UnitID = *Strings.getItem(N.LevitationUnit->UnitPath);
+
+    LevitationDriver::Args CodeGenArgs, BackendArgs;
+    getDefinitionArgs(N, CodeGenArgs, BackendArgs);
+
+    Commands::buildObject(
+        Context.Driver.BinDir,
+        Context.Driver.Includes,
+        getPreambleOutput(Files.Source),
+        Context.Driver.KeepIR ? Files.IR : Files.Object,
+        Files.ObjMetaFile,
+        Context.Driver.KeepIR ? StringRef() : Files.SplitDwarf,
+        Files.Source,
+        UnitID,
+        getFullDependencies(N, Graph),
+        NameIndex,
+        Context.Driver.PortableSourcesRoot,
+        Context.Driver.StdLib,
+        Context.Driver.ExtraParseArgs,
+        CodeGenArgs,
+        Context.Driver.RemoteExecutor,
+        0,
+        /*Verbose=*/false,
+        /*DryRun=*/true,
+        Context.Driver.Execution
+    );
+  }
+
+  // Phase commands are recorded after object ones, so that for each
+  // source object command goes first.
+  if (Context.Driver.CompileCommandsPhases) {
+    for (size_t Idx = 0, e = Graph.getNumNodes(); Idx != e; ++Idx) {
+      const auto &N = Graph.getNodeByIndex(Idx);
+      if (
+        N.Kind != DependenciesGraph::NodeKind::Declaration ||
+        !N.LevitationUnit ||
+        Graph.isExternal(N.ID)
+      )
+        continue;
+
+      const auto &Files = getFilesInfoFor(N);
+      StringRef UnitID = *Strings.getItem(N.LevitationUnit->UnitPath);
+
+      Commands::buildDecl(
+          Context.Driver.BinDir,
+          Context.Driver.Includes,
+          getPreambleOutput(Files.Source),
+          Files.DeclAST,
+          Files.DeclASTMetaFile,
+          Files.Source,
+          UnitID,
+          getFullDependencies(N, Graph),
+          NameIndex,
+          Context.Driver.PortableSourcesRoot,
+          Context.Driver.StdLib,
+          getDeclASTArgs(
+              N.LevitationUnit->Definition != nullptr, isLTOPublicUnit(N)
+          ),
+          GeneratedSources(),
+          Context.Driver.RemoteExecutor,
+          0,
+          /*Verbose=*/false,
+          /*DryRun=*/true,
+          Context.Driver.Execution
+      );
+    }
+
+    for (auto PackagePath : Context.AllPackages) {
+      auto &Files = Context.Files[PackagePath];
+      Commands::parseImport(
+          Context.Driver.BinDir,
+          Files.LDeps,
+          Files.LDepsMeta,
+          Files.Source,
+          Context.Driver.SourcesRoot,
+          Context.Driver.ExtraParseImportArgs,
+          /*Verbose=*/false,
+          /*DryRun=*/true,
+          Context.Driver.Execution
+      );
+    }
+  }
+
+  Database.stopRecording();
+
+  if (!Database.write())
+    Log.log_warning("Failed to write compile commands into '", Output, "'.");
+  else
+    Log.log_verbose("Compile commands are written into '", Output, "'.");
+}
+
+void LevitationDriverImpl::explainRebuild(
+    const DependenciesGraph::Node &N,
+    RebuildReason &&R
+) {
+  if (!Context.Driver.Explain)
+    return;
+
+  with (auto _ = lock(Context.RebuildReasonsMutex))
+    Context.RebuildReasons.emplace_back(N.ID, std::move(R));
+}
+
+void LevitationDriverImpl::dumpRebuildReasons() {
+  const auto &Graph = Context.DependenciesInfo->getDependenciesGraph();
+
+  llvm::DenseMap<DependenciesGraph::NodeID::Type, const RebuildReason*> Reasons;
+  for (const auto &R : Context.RebuildReasons)
+    Reasons.insert({R.first, &R.second});
+
+  auto describe = [&] (const RebuildReason &R) {
+    std::string Descr = RebuildReason::getKindDescr(R.K).str();
+    if (R.K == RebuildReason::Kind::DependencyUpdated)
+      Descr += ": " + Graph.nodeDescrShort(R.Dependency, Strings);
+    else if (R.K == RebuildReason::Kind::HeaderUnitUpdated)
+      Descr += ": <" + R.HeaderUnit + ">";
+    return Descr;
+  };
+
+  // Follows updated dependencies back to node
+  // which was rebuilt on its own.
+  auto getChain = [&] (
+      DependenciesGraph::NodeID::Type NID,
+      const RebuildReason *&Root
+  ) {
+    std::vector<DependenciesGraph::NodeID::Type> Chain { NID };
+    llvm::DenseSet<DependenciesGraph::NodeID::Type> Visited { NID };
+    Root = Reasons.lookup(NID);
+
+    while (Root && Root->K == RebuildReason::Kind::DependencyUpdated) {
+      auto Dep = Root->Dependency;
+      if (!Visited.insert(Dep).second)
+        break;
+
+      Chain.push_back(Dep);
+
+      // Dependency is updated, but it wasn't checked by
+      // this build (e.g. it was streamed).
+      const auto *DepReason = Reasons.lookup(Dep);
+      if (!DepReason)
+        break;
+      Root = DepReason;
+    }
+    return Chain;
+  };
+
+  with (auto info = Log.acquire(log::Level::Info)) {
+    auto &Out = info.s;
+
+    Out << "\nRebuild reasons:\n";
+
+    if (Context.RebuildReasons.empty())
+      Out << "  Nothing was rebuilt.\n";
+
+    for (const auto &R : Context.RebuildReasons) {
+      Out.indent(2)
+      << Graph.nodeDescrShort(R.first, Strings) << ": "
+      << describe(R.second) << "\n";
+
+      if (R.second.K != RebuildReason::Kind::DependencyUpdated)
+        continue;
+
+      const RebuildReason *Root;
+      auto Chain = getChain(R.first, Root);
+
+      Out.indent(4) << "chain: ";
+      for (size_t i = 0, e = Chain.size(); i != e; ++i)
+        Out << (i ? " <- " : "") << Graph.nodeDescrShort(Chain[i], Strings);
+      if (Root && Root->K != RebuildReason::Kind::DependencyUpdated)
+        Out << " (" << describe(*Root) << ")";
+      Out << "\n";
+    }
+
+    Out << "\n";
+  }
+
+  if (Context.Driver.ExplainOutput.empty())
+    return;
+
+  File F(Context.Driver.ExplainOutput);
+  with (auto Scope = F.open()) {
+    llvm::json::OStream J(Scope.getOutputStream(), /*IndentSize=*/2);
+
+    J.object([&] {
+      J.attributeArray("rebuilt", [&] {
+        for (const auto &R : Context.RebuildReasons) {
+          const RebuildReason *Root;
+          auto Chain = getChain(R.first, Root);
+
+          J.object([&] {
+            J.attribute("node", Graph.nodeDescrShort(R.first, Strings));
+            J.attribute("reason", RebuildReason::getKindName(R.second.K));
+
+            if (R.second.K == RebuildReason::Kind::DependencyUpdated)
+              J.attribute(
+                  "dependency",
+                  Graph.nodeDescrShort(R.second.Dependency, Strings)
+              );
+
+            if (R.second.K == RebuildReason::Kind::HeaderUnitUpdated)
+              J.attribute("header_unit", R.second.HeaderUnit);
+
+            J.attributeArray("chain", [&] {
+              for (auto NID : Chain)
+                J.value(Graph.nodeDescrShort(NID, Strings));
+            });
+
+            if (Root)
+              J.attribute("root_cause", RebuildReason::getKindName(Root->K));
+          });
+        }
+      });
+    });
+  }
+
+  if (F.hasErrors())
+    Log.log_warning(
+        "Failed to write rebuild reasons '", Context.Driver.ExplainOutput, "'."
+    );
+}
+
+void LevitationDriverImpl::dumpStats() {
+  const auto &Stats = DriverStats::get();
+  auto &Cache = BuildCache::get();
+  auto &Files = FilesCache::get();
+  auto &TM = TasksManager::get();
+
+  // Counters are accumulated since driver start,
+  // so in watch mode they cover all builds.
+  with (auto info = Log.acquire(log::Level::Info)) {
+    auto &Out = info.s;
+
+    Out
+    << "\nDriver stats:\n"
+    << "  Nodes checked: " << Stats.NodesChecked << "\n"
+    << "  Nodes rebuilt: " << Stats.NodesRebuilt << "\n"
+    << "  Build cache: " << Cache.getHits() << " hits, "
+    << Cache.getMisses() << " misses\n"
+    << "  Deferred artifacts: " << Cache.getNumDeferred() << ", "
+    << Cache.getNumMaterialized() << " of them fetched\n"
+    << "  Units with replayed diagnostics: " << Stats.DiagnosticsReplayed << "\n"
+    << "  Files cache: " << Files.getNumHits() << " hits, "
+    << Files.getNumMisses() << " misses\n"
+    << "  Bytes hashed: " << Stats.BytesHashed << "\n"
+    << "  Metas loaded: " << Stats.MetasLoaded << "\n"
+    << "  Processes spawned: " << Stats.ProcessesSpawned << "\n"
+    << "  Time blocked in waitForTasks: " << TM.getWaitTime() / 1000 << " ms\n"
+    << "  Workers idle time: " << TM.getIdleTime() / 1000 << " ms\n";
+  }
+}
+
+void LevitationDriverImpl::checkBudgets() {
+  using NodeKind = DependenciesGraph::NodeKind;
+  using Metric = PerformanceBudgets::Metric;
+  using StepKind = BuildHistory::StepKind;
+
+  const auto &Driver = Context.Driver;
+  if (Driver.DryRun || !Context.DependenciesInfo)
+    return;
+
+  auto Buffer = llvm::MemoryBuffer::getFile(Driver.BudgetsFile);
+  if (!Buffer) {
+    Status.setFailure()
+    << "Budgets: failed to read '" << Driver.BudgetsFile << "'";
+    return;
+  }
+
+  PerformanceBudgets Budgets;
+  std::string Error;
+  if (!Budgets.parse(Buffer.get()->getBuffer(), Error)) {
+    Status.setFailure()
+    << "Budgets: '" << Driver.BudgetsFile << "', " << Error;
+    return;
+  }
+
+  const auto &Graph = Context.DependenciesInfo->getDependenciesGraph();
+  size_t NumNodes = Graph.getNumNodes();
+
+  // Graph metrics are taken of nodes, since external
+  // packages may have no declaration or definition.
+  llvm::StringMap<PerformanceBudgets::MetricsTy> Units;
+
+  // Closures are quadratic, so they are only calculated on demand.
+  std::vector<size_t> ClosureSizes;
+  if (Budgets.limits(Metric::Closure))
+    ClosureSizes = Graph.calcClosureSizes(/*ByDependents=*/false);
+
+  for (DependenciesGraph::NodeIndex Idx = 0; Idx != NumNodes; ++Idx) {
+    const auto &N = Graph.getNodeByIndex(Idx);
+    if (!N.LevitationUnit)
+      continue;
+
+    StringRef UnitID = *Strings.getItem(N.LevitationUnit->UnitPath);
+    if (!Budgets.matchesAny(UnitID))
+      continue;
+
+    auto &Values = Units[UnitID];
+
+    if (ClosureSizes.size()) {
+      // Definition needs its own declaration too.
+      size_t Closure = ClosureSizes[Idx];
+      if (N.Kind == NodeKind::Definition && Closure)
+        --Closure;
+
+      auto &V = Values[(unsigned)Metric::Closure];
+      V = std::max<PerformanceBudgets::ValueTy>(V ? *V : 0, Closure);
+    }
+
+    if (N.Kind != NodeKind::Declaration)
+      continue;
+
+    llvm::DenseSet<StringID> Importers;
+    for (auto DependentIdx : Graph.getDependentNodes(Idx)) {
+      const auto &Dependent = Graph.getNodeByIndex(DependentIdx);
+      if (
+        Dependent.LevitationUnit &&
+        Dependent.LevitationUnit->UnitPath != N.LevitationUnit->UnitPath
+      )
+        Importers.insert(Dependent.LevitationUnit->UnitPath);
+    }
+    Values[(unsigned)Metric::FanIn] = Importers.size();
+  }
+
+  std::vector<PerformanceBudgets::Violation> Violations;
+
+  for (auto PackagePath : Context.ProjectPackages) {
+    StringRef UnitID = *Strings.getItem(PackagePath);
+    auto Found = Units.find(UnitID);
+    if (Found == Units.end())
+      continue;
+
+    auto &Values = Found->second;
+
+    // History is saved already, so it has steps of this build,
+    // and of previous ones for up-to-date units.
+    auto DeclTime = Context.History.getDuration(StepKind::BuildDecl, UnitID);
+    auto ObjTime = Context.History.getDuration(StepKind::BuildObject, UnitID);
+    if (DeclTime || ObjTime)
+      Values[(unsigned)Metric::CompileTime] =
+          (DeclTime ? *DeclTime : 0) + (ObjTime ? *ObjTime : 0);
+
+    for (unsigned k = 0; k != BuildHistory::NumStepKinds; ++k)
+      if (auto M = Context.History.getPeakMemory((StepKind)k, UnitID)) {
+        auto &V = Values[(unsigned)Metric::PeakRSS];
+        V = std::max<PerformanceBudgets::ValueTy>(V ? *V : 0, *M);
+      }
+
+    const auto &Files = Context.Files[PackagePath];
+    uint64_t DeclASTSize;
+    if (!llvm::sys::fs::file_size(Files.DeclAST, DeclASTSize))
+      Values[(unsigned)Metric::DeclASTSize] = DeclASTSize;
+
+    Budgets.check(UnitID, Values, Violations);
+  }
+
+  for (const auto &V : Violations) {
+    std::string Message;
+    llvm::raw_string_ostream Out(Message);
+    Out
+    << "Budget of '" << V.Pattern << "' is exceeded by '" << V.UnitID
+    << "', " << PerformanceBudgets::getMetricName(V.M) << " is ";
+    PerformanceBudgets::writeValue(Out, V.M, V.Value);
+    Out << ", limit is ";
+    PerformanceBudgets::writeValue(Out, V.M, V.Limit);
+    Out << ".";
+    Log.log_warning(Out.str());
+  }
+
+  if (Violations.empty()) {
+    Log.log_verbose("Budgets: all units are within budgets.");
+    return;
+  }
+
+  if (Driver.EnforceBudgets)
+    Status.setFailure()
+    << "Budgets: " << Violations.size() << " budget(s) exceeded";
+  else
+    Log.log_warning(
+        "Budgets: ", Violations.size(), " budget(s) exceeded."
+    );
+}
+
+void LevitationDriverImpl::writeMetrics() {
+  StringRef Output = Context.Driver.MetricsOutput;
+  const auto &Stats = DriverStats::get();
+  auto &Cache = BuildCache::get();
+
+  BuildMetrics Metrics;
+
+  double Elapsed = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - Context.BuildStart
+  ).count();
+
+  Metrics
+  .add("build_duration_seconds", "Wall time of build.", "s", Elapsed)
+  .add(
+      "build_success", "Whether build has succeeded.", "1",
+      Status.isValid() ? 1 : 0
+  );
+
+  BuildHistory::DurationTy Totals[BuildHistory::NumStepKinds] = {};
+  size_t Counts[BuildHistory::NumStepKinds] = {};
+  BuildHistory::MemoryTy Peaks[BuildHistory::NumStepKinds] = {};
+
+  Context.Timings.forEach([&] (
+      BuildHistory::StepKind Kind,
+      StringRef,
+      BuildHistory::DurationTy Duration
+  ) {
+    Totals[(unsigned)Kind] += Duration;
+    ++Counts[(unsigned)Kind];
+  });
+
+  Context.Timings.forEachPeakMemory([&] (
+      BuildHistory::StepKind Kind,
+      StringRef,
+      BuildHistory::MemoryTy Memory
+  ) {
+    Peaks[(unsigned)Kind] = std::max(Peaks[(unsigned)Kind], Memory);
+  });
+
+  for (unsigned Kind = 0; Kind != BuildHistory::NumStepKinds; ++Kind) {
+    auto Name = BuildHistory::getStepKindName((BuildHistory::StepKind)Kind);
+    BuildMetrics::LabelsTy Labels = {{"step", Name.str()}};
+
+    Metrics
+    .add(
+        "step_duration_seconds", "Total duration of steps run by build.",
+        "s", Totals[Kind] / 1e6, Labels
+    )
+    .add("steps", "Number of steps run by build.", "1", Counts[Kind], Labels)
+    .add(
+        "step_peak_memory_bytes", "Peak memory of steps run in subprocesses.",
+        "By", Peaks[Kind], Labels
+    );
+  }
+
+  unsigned Hits = Cache.getHits() - Context.BaseCacheHits;
+  unsigned Misses = Cache.getMisses() - Context.BaseCacheMisses;
+
+  Metrics
+  .add(
+      "nodes_checked", "Number of graph nodes checked.", "1",
+      Stats.NodesChecked - Context.BaseNodesChecked
+  )
+  .add(
+      "nodes_rebuilt", "Number of graph nodes rebuilt.", "1",
+      Stats.NodesRebuilt - Context.BaseNodesRebuilt
+  )
+  .add("cache_hits", "Build cache hits.", "1", Hits)
+  .add("cache_misses", "Build cache misses.", "1", Misses)
+  .add(
+      "cache_hit_ratio", "Share of build cache lookups which have hit.", "1",
+      Hits + Misses ? (double)Hits / (Hits + Misses) : 0
+  )
+  .add(
+      "processes_spawned", "Number of subprocesses launched.", "1",
+      Stats.ProcessesSpawned - Context.BaseProcessesSpawned
+  );
+
+  // Critical path through steps this build has actually run,
+  // up-to-date nodes cost nothing.
+  if (Context.DependenciesInfo) {
+    const auto &Graph = Context.DependenciesInfo->getDependenciesGraph();
+    auto Paths = Graph.calcCriticalPaths(
+        [&] (const DependenciesGraph::Node &N) {
+          if (!N.LevitationUnit)
+            return (BuildHistory::DurationTy)0;
+          auto D = Context.Timings.getDuration(
+              getStepKind(N), *Strings.getItem(N.LevitationUnit->UnitPath)
+          );
+          return D ? *D : 0;
+        }
+    );
+
+    uint64_t Longest = 0;
+    for (const auto &NP : Paths)
+      Longest = std::max(Longest, NP.second);
+
+    Metrics.add(
+        "critical_path_seconds",
+        "Length of longest dependencies chain of steps run by build.",
+        "s", Longest / 1e6
+    );
+  }
+
+  uint64_t Now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::system_clock::now().time_since_epoch()
+  ).count();
+
+  File F(Output);
+  with (auto Scope = F.open())
+    Metrics.write(Scope.getOutputStream(), BuildMetrics::getFormat(Output), Now);
+
+  if (F.hasErrors()) {
+    Log.log_warning("Failed to write metrics '", Output, "'.");
+    return;
+  }
+
+  if (
+    Context.Driver.MetricsPushCommand.size() &&
+    !Commands::pushMetrics(
+        Context.Driver.MetricsPushCommand, Output,
+        Context.Driver.isVerbose(), Context.Driver.DryRun
+    )
+  )
+    Log.log_warning("Failed to push metrics '", Output, "'.");
+}
+
+void LevitationDriverImpl::recordChangedDecls(
+    DependenciesGraph::NodeID::Type NID,
+    const DeclASTMeta &OldMeta,
+    const DeclASTMeta &NewMeta
+) {
+  llvm::StringSet<> Changed;
+  if (!DeclASTMeta::diffDeclHashes(OldMeta, NewMeta, Changed))
+    return;
+
+  // Macros and unnamed declarations (e.g. using directives)
+  // are not tracked by objects.
+  if (Changed.count(""))
+    return;
+
+  with (auto _ = lock(Context.ChangedDeclsMutex)) {
+    Context.ChangedDecls[NID] = std::move(Changed);
+  }
+}
+
+/// Checks whether object may ignore updates of its dependencies,
+/// that is all updated dependencies have known set of changed
+/// declarations, and object doesn't use any of them.
+/// Meta files may be packed, so their existence is checked
+/// through file manager's file system.
+static bool metaExists(llvm::StringRef MetaFile) {
+  auto &FM = CreatableSingleton<FileManager>::get();
+  return FM.getVirtualFileSystem().exists(MetaFile);
+}
+
+bool LevitationDriverImpl::areUsedDeclsUnchanged(
+    const DependenciesGraph::Node &N
+) {
+  // Declaration AST refers to dependencies declarations
+  // by their IDs, so it must be rebuilt anyway.
+  if (!Context.Driver.EarlyCutoff ||
+      N.Kind != DependenciesGraph::NodeKind::Definition)
+    return false;
+
+  const auto &Files = getFilesInfoFor(N);
+
+  DeclASTMeta ObjMeta;
+  if (!metaExists(Files.ObjMetaFile) ||
+      !loadMeta(
+          ObjMeta, Context.Driver.BuildRoot, Files.ObjMetaFile
+      ) ||
+      !ObjMeta.hasUsedDecls())
+    return false;
+
+  llvm::StringMap<const DeclASTMeta::UsedDeclsTy*> UsedByDeclAST;
+  for (const auto &Used : ObjMeta.getUsedDecls())
+    UsedByDeclAST[Used.DeclAST] = &Used;
+
+  const auto &Graph = Context.DependenciesInfo->getDependenciesGraph();
+
+  for (auto DepID : Context.DependenciesInfo->getFullDependencies(N.ID)) {
+    if (!Context.UpdatedNodes.count(DepID))
+      continue;
+
+    const auto &DNode = Graph.getNode(DepID);
+    // In reproducible mode frontend keeps paths relative to sources root.
+    auto Used = UsedByDeclAST.find(getPortablePath(
+        Context.Files[DNode.LevitationUnit->UnitPath].DeclAST
+    ));
+
+    // Object was built with different dependencies.
+    if (Used == UsedByDeclAST.end())
+      return false;
+
+    with (auto _ = lock(Context.ChangedDeclsMutex)) {
+      auto Changed = Context.ChangedDecls.find(DepID);
+      if (Changed == Context.ChangedDecls.end())
+        return false;
+
+      for (const auto &Name : Used->second->Names)
+        if (Changed->second.count(Name))
+          return false;
+    }
+  }
+
+  LEVITATION_LOG_VERBOSE(
+      Log,
+      "Declarations used by ", Graph.nodeDescrShort(N.ID, Strings),
+      " are same, dependencies updates are ignored."
+  );
+
+  return true;
+}
+
+bool LevitationDriverImpl::isUpToDate(
+    DeclASTMeta &Meta,
+    llvm::StringRef ProductFile,
+    llvm::StringRef MetaFile,
+    llvm::StringRef SourceFile,
+    llvm::StringRef ItemDescr,
+    RebuildReason::Kind *Reason,
+    llvm::StringRef CommandHash
+) {
+  // Plan covers every step, whatever is up-to-date at the moment.
+  if (NinjaPlan::get().isRecording())
+    return false;
+
+  auto rebuild = [&] (RebuildReason::Kind K) {
+    if (Reason)
+      *Reason = K;
+    return false;
+  };
+
+  auto ProductStamp = getFileStamp(ProductFile);
+  if (!ProductStamp)
+    return rebuild(RebuildReason::Kind::ProductMissing);
+
+  if (!metaExists(MetaFile))
+    return rebuild(RebuildReason::Kind::MetaMissing);
+
+  auto SourceStamp = getFileStamp(SourceFile);
+
+  const auto *Recorded = Context.PrevState.get(ProductFile);
+
+  bool SourceUntouched =
+      Recorded && SourceStamp && Recorded->Source == *SourceStamp &&
+      !isChangedSource(SourceFile);
+
+  HashVectorTy CmdHash(CommandHash.begin(), CommandHash.end());
+
+  // Neither source, nor product, nor headers were touched since
+  // previous build, so there is no need to load meta and rehash source.
+  if (
+    SourceUntouched &&
+    Recorded->Product == *ProductStamp &&
+    (CmdHash.empty() || Recorded->CommandHash == CmdHash) &&
+    areIncludesUntouched(*Recorded)
+  ) {
+    setProductState(ProductFile, *Recorded);
+    Log.log_verbose("Source  for item '", ItemDescr, "' is up-to-date.");
+    return true;
+  }
+
+  if (!loadMeta(
+      Meta, Context.Driver.BuildRoot, MetaFile
+  )) {
+    Log.log_warning(
+      "Failed to load existing meta file for '",
+      SourceFile, "'\n",
+      "  Must rebuild dependent chains."
+    );
+    return rebuild(RebuildReason::Kind::MetaUnreadable);
+  }
+
+  // Metas written by older versions have no fingerprint, so
+  // it is unknown what they were built with.
+  if (CmdHash.size() && !equal(Meta.getCommandHash(), CmdHash))
+    return rebuild(RebuildReason::Kind::CommandChanged);
+
+  // Get source hash, with same algorithm meta was written with.
+
+  HashVectorTy SrcHash;
+
+  auto &Digests = SourceDigests::get();
+
+  // Recorded hash may be calculated by other algorithm,
+  // if meta was rebuilt with other --hash since then.
+  bool RecordedHashMatches =
+      SourceUntouched &&
+      Recorded->SourceHash.size() == Meta.getSourceHash().size();
+
+  if (RecordedHashMatches) {
+    SrcHash = Recorded->SourceHash;
+    Digests.remember(SourceFile, *SourceStamp, Meta.getHashKind(), SrcHash);
+  } else if (!Digests.getHash(SourceFile, Meta.getHashKind(), SrcHash)) {
+    Log.log_warning(
+      "Failed to load source '",
+      SourceFile ,"' during up-to-date checks.\n",
+      "  Must rebuild dependent chains. But I think I'll fail, dude..."
+    );
+    return rebuild(RebuildReason::Kind::SourceUnreadable);
+  }
+
+#if 0
+  auto &Verbose = Log.verbose();
+  Verbose << "Old Hash: ";
+  for (auto b : Meta.getSourceHash()) {
+    Verbose.write_hex(b);
+    Verbose << " ";
+  }
+
+  Verbose << "\n";
+
+  Verbose << "Src Hash: ";
+  for (auto b : SrcHash) {
+    Verbose.write_hex(b);
+    Verbose << " ";
+  }
+
+  Verbose << "\n";
+#endif
+
+  // Note: each time you change source, you change source locations.
+  // So, even though declaration itself may remain same, .decl-ast
+  // will be different. Whether dependents are affected is decided
+  // by interface hash, see isInterfaceUpdated.
+  bool Res = equal(Meta.getSourceHash(), SrcHash);
+
+  if (!Res)
+    return rebuild(RebuildReason::Kind::SourceChanged);
+
+  std::vector<BuildState::IncludeState> Includes;
+  if (!areIncludesUnchanged(Meta, ItemDescr, Includes))
+    return rebuild(RebuildReason::Kind::IncludeChanged);
+
+  if (SourceStamp)
+    setProductState(ProductFile, {
+        *SourceStamp, SrcHash, *ProductStamp, Meta.getDeclASTHash(),
+        std::move(Includes), Meta.getCommandHash()
+    });
+
+  Log.log_verbose("Source  for item '", ItemDescr, "' is up-to-date.");
+  return true;
+}
+
+bool LevitationDriverImpl::areIncludesUnchanged(
+    const DeclASTMeta &Meta,
+    StringRef ItemDescr,
+    std::vector<BuildState::IncludeState> &States
+) {
+  auto &Digests = SourceDigests::get();
+
+  for (const auto &Inc : Meta.getIncludes()) {
+    auto Stamp = getFileStamp(Inc.Path);
+    if (!Stamp) {
+      Log.log_verbose(
+          "Header '", Inc.Path, "' of item '", ItemDescr, "' is removed."
+      );
+      return false;
+    }
+
+    if (!isIncludeUntouched(Inc, *Stamp)) {
+      HashVectorTy Hash;
+      if (
+        !Digests.getHash(Inc.Path, Meta.getHashKind(), Hash) ||
+        !equal(Hash, Inc.Hash)
+      ) {
+        Log.log_verbose(
+            "Header '", Inc.Path, "' of item '", ItemDescr, "' is changed."
+        );
+        return false;
+      }
+    }
+
+    States.push_back({Inc.Path, *Stamp});
+  }
+
+  return true;
+}
+
+bool LevitationDriverImpl::getProductFiles(
+    const DependenciesGraph::Node &N,
+    StringRef &ProductFile,
+    StringRef &MetaFile
+) const {
+  const auto &Files = getFilesInfoFor(N);
+
+  switch (N.Kind) {
+    case DependenciesGraph::NodeKind::Declaration:
+      MetaFile = Files.DeclASTMetaFile;
+      ProductFile = Files.DeclAST;
+      return true;
+    case DependenciesGraph::NodeKind::Definition:
+      MetaFile = Files.ObjMetaFile;
+      ProductFile = Context.Driver.KeepIR ? Files.IR : Files.Object;
+      return true;
+    default:
+      return false;
+  }
+}
+
+void LevitationDriverImpl::setProductState(
+    StringRef ProductFile,
+    BuildState::ProductState S
+) {
+  with (auto _ = lock(Context.StateMutex)) {
+    Context.State.set(ProductFile, std::move(S));
+  }
+}
+
+void LevitationDriverImpl::updateProductState(
+    StringRef ProductFile,
+    StringRef MetaFile,
+    llvm::Optional<BuildState::FileStamp> SourceStamp
+) {
+  if (Context.Driver.DryRun || !SourceStamp)
+    return;
+
+  // Some steps may decide not to produce anything,
+  // e.g. declaration nobody depends on.
+  auto ProductStamp = getFileStamp(ProductFile);
+  if (!ProductStamp || !metaExists(MetaFile))
+    return;
+
+  DeclASTMeta Meta;
+  bool Loaded =
+      loadMeta(Meta, Context.Driver.BuildRoot, MetaFile);
+
+  // Meta has been stored into cache already, so it is not
+  // needed on disk anymore. Embedded meta goes with its product.
+  auto &Pack = ArtifactPack::get();
+  if (Pack.isEnabled() && MetaFile != ProductFile && fileExists(MetaFile))
+    Pack.addFile(MetaFile);
+
+  if (!Loaded || Meta.getSourceHash().empty())
+    return;
+
+  setProductState(ProductFile, {
+      *SourceStamp, Meta.getSourceHash(), *ProductStamp, Meta.getDeclASTHash(),
+      getIncludeStates(Meta), Meta.getCommandHash()
+  });
+}
+
+bool LevitationDriverImpl::lockProduct(
+    ArtifactLock &Lock,
+    StringRef ProductFile,
+    StringRef MetaFile
+) {
+  if (!Lock.acquire(ProductFile))
+    return false;
+
+  // Stamps and metas seen before are stale now.
+  File::notifyChanged(ProductFile);
+  if (MetaFile != ProductFile)
+    File::notifyChanged(MetaFile);
+
+  return true;
+}
+
+void LevitationDriverImpl::setPreambleUpdated() {
+  Context.PreambleUpdated = true;
+}
+
+void LevitationDriverImpl::setNodeUpdated(DependenciesGraph::NodeID::Type NID) {
+  Context.UpdatedNodes.insert(NID);
+}
+
+void LevitationDriverImpl::recordInterfaceChange(StringRef UnitPath) {
+  if (Context.Driver.DryRun)
+    return;
+  auto _ = lock(Context.TimingsMutex);
+  Context.Timings.addInterfaceChanges(UnitPath);
+}
+
+
+void LevitationDriverImpl::setObjectsUpdated() {
+  Context.ObjectsUpdated = true;
+}
+
+//-----------------------------------------------------------------------------
+//  LevitationDriver
+
+LevitationDriver::LevitationDriver(StringRef CommandPath)
+{
+  SinglePath P = CommandPath;
+  if (auto Err = llvm::sys::fs::make_absolute(P)) {
+    log::Logger::get().log_warning(
+      "Failed to make absolute path. System message: ",
+      Err.message()
+    );
+    P = CommandPath;
+  }
+
+  LevitationDriver::CommandPath = P;
+  BinDir = llvm::sys::path::parent_path(P);
+
+#ifdef LEVITATION_DEFAULT_INCLUDES
+  StringRef DefaultIncludes(LEVITATION_DEFAULT_INCLUDES);
+  if (!DefaultIncludes.empty()) {
+
+    SmallVector<StringRef, 16> DefaultIncludesItems;
+    DefaultIncludes.split(DefaultIncludesItems, ';');
+
+    for (auto DefaultInclude : DefaultIncludesItems)
+      Includes.push_back(DefaultInclude.trim());
+  }
+#endif
+
+  OutputHeadersDir = levitation::Path::getPath<SinglePath>(
+      BuildRoot, DriverDefaults::HEADER_DIR_SUFFIX
+  );
+
+  OutputDeclsDir = levitation::Path::getPath<SinglePath>(
+      BuildRoot, DriverDefaults::DECLS_DIR_SUFFIX
+  );
+}
+
+void LevitationDriver::setExtraPreambleArgs(StringRef Args) {
+  ExtraPreambleArgs = ArgsUtils::parse(Args);
+}
+
+void LevitationDriver::setExtraParserArgs(StringRef Args) {
+  ExtraParseArgs = ArgsUtils::parse(Args);
+}
+
+void LevitationDriver::setExtraCodeGenArgs(StringRef Args) {
+  ExtraCodeGenArgs = ArgsUtils::parse(Args);
+}
+
+void LevitationDriver::addConfig(StringRef NameAndArgs) {
+  auto Parts = NameAndArgs.split(':');
+  Configs.push_back({Parts.first.str(), ArgsUtils::parse(Parts.second)});
+}
+
+void LevitationDriver::setExtraBackendArgs(StringRef Args) {
+  ExtraBackendArgs = ArgsUtils::parse(Args);
+}
+
+void LevitationDriver::setExtraLinkerArgs(StringRef Args) {
+  ExtraLinkerArgs = ArgsUtils::parse(Args);
+}
+
+/// Fills fresh build root with artifacts of other one, see --seed-build-root.
+/// Build root is fresh if it has no build state, otherwise its own
+/// artifacts are at least as good. Seed may be in use by other build,
+/// so lock markers and temporary files are skipped.
+static void seedBuildRoot(StringRef Seed, StringRef BuildRoot) {
+  auto &Log = log::Logger::get();
+  auto &TM = TasksManager::get();
+
+  auto StateFile = levitation::Path::getPath<SinglePath>(
+      BuildRoot, DriverDefaults::BUILD_STATE
+  );
+  if (llvm::sys::fs::exists(StateFile)) {
+    Log.log_verbose(
+        "Build root '", BuildRoot, "' was already built, seed is skipped."
+    );
+    return;
+  }
+
+  std::vector<SinglePath> Files;
+  std::error_code EC;
+  for (
+    llvm::sys::fs::recursive_directory_iterator I(Seed, EC), E;
+    I != E && !EC;
+    I.increment(EC)
+  ) {
+    if (I->type() != llvm::sys::fs::file_type::regular_file)
+      continue;
+    StringRef File = I->path();
+    if (File.endswith(".lock") || File.contains(".tmp-"))
+      continue;
+    Files.emplace_back(File);
+  }
+
+  if (EC) {
+    Log.log_warning(
+        "Failed to read seed build root '", Seed, "': ", EC.message()
+    );
+    return;
+  }
+
+  Log.log_info("Seeding build root from '", Seed, "'...");
+
+  std::atomic<unsigned> NumSeeded { 0 };
+  std::atomic<unsigned> NumCloned { 0 };
+  std::atomic<unsigned> NumFailed { 0 };
+
+  TasksManager::TasksSet Tasks;
+  for (const auto &File : Files) {
+    auto TID = TM.runTask([&] (TasksManager::TaskContext &TC) {
+      auto Dest = levitation::Path::getPath<SinglePath>(
+          BuildRoot,
+          levitation::Path::makeRelative<SinglePath>(File, Seed)
+      );
+
+      TC.Successful = true;
+
+      if (llvm::sys::fs::exists(Dest))
+        return;
+
+      FileClone::Method Used;
+      if (!FileClone::materialize(
+          File, Dest, /*AllowHardlink=*/false, /*PreserveTime=*/true, &Used
+      )) {
+        ++NumFailed;
+        return;
+      }
+
+      ++NumSeeded;
+      if (Used != FileClone::Method::Copy)
+        ++NumCloned;
+    });
+    Tasks.insert(TID);
+  }
+
+  TM.waitForTasks(Tasks);
+
+  Log.log_verbose(
+      "Seeded ", NumSeeded, " artifacts, ",
+      NumCloned, " of them without copying data."
+  );
+
+  if (NumFailed)
+    Log.log_warning(
+        "Failed to seed ", NumFailed, " artifacts, they will be rebuilt."
+    );
+}
+
+bool LevitationDriver::init() {
+  if (Initialized)
+    return true;
+
+  auto &Log = log::Logger::createLogger(log::Level::Info);
+  if (LogSink)
+    Log.setSink(LogSink);
+
+  if (JobsNumber < 1) {
+    log::Logger::get().log_error(
+        "-j should be positive number or 'auto'."
+    );
+    return false;
+  }
+
+  // Workers are only upper bound for auto jobs, so that I/O bound
+  // jobs may be run above number of cores.
+  unsigned NumCores = std::max(std::thread::hardware_concurrency(), 1u);
+  if (AutoJobs)
+    JobsNumber = 2 * NumCores;
+
+  WorkerPlacement Placement;
+  if (Numa || PinWorkers)
+    Placement = WorkerPlacement::detect(PinWorkers);
+
+  auto &TM = TasksManager::create(
+      JobsNumber-1, TasksManager::QueueKind::WorkStealing, Placement
+  );
+
+  if (AutoJobs && !DryRun)
+    Concurrency = std::make_shared<ConcurrencyController>(
+        TM, /*Min=*/1, /*Max=*/JobsNumber, /*Initial=*/NumCores
+    );
+  auto &Files = FileSystem ?
+      FilesCache::create(FileSystem) : FilesCache::create();
+  File::observer() = [] (StringRef Path) {
+    FilesCache::get().invalidate(Path);
+  };
+  CreatableSingleton<FileManager>::create(
+      FileSystemOptions { std::string(StringRef()) },
+      Files.getFileSystem()
+  );
+  CreatableSingleton<DependenciesStringsPool >::create();
+  BuildTrace::create(TraceOutput);
+  TimeTraceReport::create(UnitTimeTrace && !DryRun);
+  dependencyStatsEnabled() = DependencyStats || PrivateImports;
+  diagnosticsReplayEnabled() = ReplayDiagnostics && !DryRun;
+  NinjaPlan::create(EmitNinja);
+  tools::CompileCommands::create(CompileCommands);
+  auto &Cache = BuildCache::create();
+  LibraryCache::create(LibraryCacheDir);
+  auto &Pack = ArtifactPack::create();
+  Jobserver::create();
+  ProcessReaper::create();
+
+  if (CacheDir.size())
+    Cache.addBackend(
+        std::make_unique<LocalDirectoryCacheBackend>(CacheDir, CacheHardlinks)
+    );
+
+  if (RemoteCacheCommand.size())
+    Cache.addBackend(
+        std::make_unique<CommandCacheBackend>(RemoteCacheCommand)
+    );
+
+  if (Shard.size()) {
+    StringRef Index, Number;
+    std::tie(Index, Number) = Shard.split('/');
+    if (
+      Index.getAsInteger(10, ShardIndex) ||
+      Number.getAsInteger(10, NumShards) ||
+      !ShardIndex || ShardIndex > NumShards
+    ) {
+      log::Logger::get().log_error(
+          "--shard should be '<i>/<n>', where 1 <= i <= n."
+      );
+      return false;
+    }
+
+    if (!Cache.isEnabled())
+      log::Logger::get().log_warning(
+          "Build cache is not set, so objects built by shard "
+          "won't be available to final build."
+      );
+  }
+
+  for (auto &P : SubtreePreambles) {
+    if (P.Dir.empty() || P.Source.empty()) {
+      log::Logger::get().log_error(
+          "--subtree-preamble should be '<dir>=<path>'."
+      );
+      return false;
+    }
+
+    P.AbsDir = levitation::Path::makeAbsolute<SinglePath>(
+        levitation::Path::getPath<SinglePath>(SourcesRoot, P.Dir)
+    );
+    llvm::sys::path::remove_dots(P.AbsDir, /*remove_dot_dot=*/true);
+    while (
+      P.AbsDir.size() > 1 &&
+      llvm::sys::path::is_separator(P.AbsDir.back())
+    )
+      P.AbsDir.pop_back();
+  }
+
+  if (Archive.size() && isLinkPhaseEnabled())
+    log::Logger::get().log_warning(
+        "--archive is ignored, since it is only applicable with -c."
+    );
+
+  if (MakeBundle.size() && isLinkPhaseEnabled())
+    log::Logger::get().log_warning(
+        "--make-bundle is ignored, since it is only applicable with -c."
+    );
+
+  if (AmalgamatedHeader.size() && isLinkPhaseEnabled())
+    log::Logger::get().log_warning(
+        "--amalgamated-header is ignored, since it is only applicable with -c."
+    );
+
+  if (EmitModuleMap && isLinkPhaseEnabled())
+    log::Logger::get().log_warning(
+        "--module-map is ignored, since it is only applicable with -c."
+    );
+
+  if (HeadersPCH.size() && isLinkPhaseEnabled())
+    log::Logger::get().log_warning(
+        "--headers-pch is ignored, since it is only applicable with -c."
+    );
+
+  // IR-only frontend doesn't run optimizations, backend process
+  // never has AST.
+  if (ReleaseAST && KeepIR) {
+    log::Logger::get().log_warning(
+        "--release-ast is ignored, since with --keep-ir objects are "
+        "built by separate backend process."
+    );
+    ReleaseAST = false;
+  }
+
+  // Streamed declarations are built before all imports are known,
+  // so it is unknown which of them are private.
+  if (Streaming && PrivateImports) {
+    log::Logger::get().log_warning(
+        "--streaming is ignored, since it is not compatible with "
+        "--private-imports."
+    );
+    Streaming = false;
+  }
+
+  if (MainUnit.size() && !LinkReachable)
+    log::Logger::get().log_warning(
+        "--main-unit is ignored, since --link-reachable is not set."
+    );
+
+  if (LinkReachable) {
+    if (!LinkPhaseEnabled)
+      log::Logger::get().log_warning(
+          "--link-reachable is ignored, since there is no link phase."
+      );
+    else if (Targets.size())
+      log::Logger::get().log_warning(
+          "--link-reachable is ignored, since targets are set."
+      );
+    else
+      Targets.push_back(
+          MainUnit.size() ? MainUnit : StringRef(DriverDefaults::MAIN_UNIT)
+      );
+  }
+
+  if (JUnitFile.size()) {
+    RunTests = true;
+    llvm::sys::fs::make_absolute(JUnitFile);
+  }
+
+  if (RunTests && (!LinkPhaseEnabled || Check)) {
+    log::Logger::get().log_error("--test requires link phase.");
+    return false;
+  }
+
+  if (Targets.size() > 1 && (ThinLTO || PartialLink || SharedPackages)) {
+    log::Logger::get().log_error(
+        "Multiple targets can't be linked with ThinLTO, partial link "
+        "or shared packages."
+    );
+    return false;
+  }
+
+  if (SpeculateAfter < 0) {
+    log::Logger::get().log_error(
+        "--speculate-after should be positive percent of expected duration."
+    );
+    return false;
+  }
+
+  if (CacheCompression < 0 || CacheCompression > 9) {
+    log::Logger::get().log_error(
+        "Cache compression level should be in range 1-9."
+    );
+    return false;
+  }
+
+  if (!Cache.setCompressionLevel(CacheCompression))
+    log::Logger::get().log_warning(
+        "zlib is not available, cache entries won't be compressed."
+    );
+
+  if (!parseHashKind(Hash, metaHash())) {
+    log::Logger::get().log_error(
+        "Unknown hash algorithm '", Hash, "', should be md5 or xxh64."
+    );
+    return false;
+  }
+
+  if (CacheMaxSize < 0 || CacheMaxAge < 0) {
+    log::Logger::get().log_error(
+        "--cache-max-size and --cache-max-age should not be negative."
+    );
+    return false;
+  }
+
+  if (PublishQueueDepth < 0) {
+    log::Logger::get().log_error(
+        "--publish-queue-depth should not be negative."
+    );
+    return false;
+  }
+
+  ArtifactPublisher::create(DryRun ? 0 : PublishQueueDepth);
+
+  if (!initParameters())
+    return false;
+
+  // Artifacts pack is opened further, so it is seeded first.
+  if (SeedBuildRoot.size() && !DryRun)
+    seedBuildRoot(SeedBuildRoot, BuildRoot);
+
+  if (PackArtifacts && !DryRun) {
+    Failable Opened = Pack.open(BuildRoot);
+    if (Opened.isValid())
+      CreatableSingleton<FileManager>::create(
+          FileSystemOptions { std::string(StringRef()) },
+          Pack.createFileSystem(Files.getFileSystem())
+      );
+    else
+      log::Logger::get().log_warning(
+          Opened.getErrorMessage(), " Artifacts won't be packed."
+      );
+  }
+
+  Initialized = true;
+  return true;
+}
+
+bool LevitationDriver::run() {
+  if (!init())
+    return false;
+
+  auto &TM = TasksManager::get();
+
+  auto Context = std::make_unique<RunContext>(*this);
+
+  if (AffectedQuery)
+    return LevitationDriverImpl(*Context).queryAffected();
+
+  if (SuggestPreamble.size())
+    return LevitationDriverImpl(*Context).suggestPreamble();
+
+  if (Advise)
+    return LevitationDriverImpl(*Context).advise();
+
+  if (PrewarmCache)
+    return LevitationDriverImpl(*Context).prewarmCache();
+
+  if (EmitNinja.size())
+    return LevitationDriverImpl(*Context).emitNinja();
+
+  if (GC)
+    return LevitationDriverImpl(*Context).collectGarbage();
+
+  bool Res = LevitationDriverImpl(*Context).build();
+
+  if (!Watch)
+    return Res;
+
+  auto &Log = log::Logger::get();
+
+  SourcesWatcher Watcher(SourcesRoot, BuildRoot);
+
+  // Builds run in their own thread, while this one keeps watching
+  // sources. Build which is made stale by new changes is cancelled:
+  // jobs which haven't started are skipped, running subprocesses are
+  // terminated. Outputs only replace artifacts once job succeeds,
+  // so cancelled jobs leave nothing behind, and their nodes are
+  // rebuilt by next build.
+  std::thread Builder;
+  std::atomic<bool> Building { false };
+
+  auto logWatching = [&] {
+    Log.log_info("Watching for changes in '", SourcesRoot, "'...");
+  };
+
+  logWatching();
+
+  while (true) {
+    SourcesWatcher::Changes Changes;
+    if (!Watcher.wait(Changes)) {
+      if (Builder.joinable())
+        Builder.join();
+      Log.log_error("Failed to watch sources.");
+      return false;
+    }
+
+    if (Building) {
+      Log.log_info(
+          "Detected changes in ", Changes.Files.size(), " file(s), "
+          "cancelling stale build..."
+      );
+      Context->Superseded = true;
+      TM.cancel();
+      RunningSubprocesses::get().killAll();
+    } else
+      Log.log_info(
+          "Detected changes in ", Changes.Files.size(),
+          " file(s), rebuilding..."
+      );
+
+    if (Builder.joinable())
+      Builder.join();
+
+    // Manifest is not a source, so watcher doesn't know that sources
+    // set depends on it.
+    bool ManifestChanged = SourcesManifest.size() && Changes.Files.count(
+        Path::makeAbsolute<SinglePath>(SourcesManifest)
+    );
+
+    auto Next = std::make_unique<RunContext>(*this);
+    Next->inherit(
+        *Context,
+        /*KeepSources=*/!Changes.SourcesSetChanged && !ManifestChanged
+    );
+    for (const auto &F : Changes.Files)
+      Next->ChangedSources.insert(F.first());
+
+    // Changes cancelled build was started for are not built yet.
+    if (Context->Superseded)
+      for (const auto &F : Context->ChangedSources)
+        Next->ChangedSources.insert(F.first());
+
+    Context = std::move(Next);
+
+    Building = true;
+    Builder = std::thread([&] {
+      LevitationDriverImpl(*Context).build();
+      Building = false;
+      if (!Context->Superseded)
+        logWatching();
+    });
+  }
+}
+
+bool LevitationDriver::initJobserver() {
+  if (JobserverMode == "off")
+    return true;
+
+  if (JobserverMode != "auto" && JobserverMode != "serve") {
+    log::Logger::get().log_error(
+        "Unknown jobserver mode '", JobserverMode, "'."
+    );
+    return false;
+  }
+
+  if (!Jobserver::isSupported()) {
+    if (JobserverMode == "serve")
+      log::Logger::get().log_warning(
+          "Jobserver is not supported on this host."
+      );
+    return true;
+  }
+
+  auto &JS = Jobserver::get();
+
+  // Parent jobserver takes precedence, since serving own slots
+  // would oversubscribe machine anyway. Nested tools inherit
+  // parent MAKEFLAGS as well.
+  bool Found;
+  Failable Status = JS.connect(Found);
+  if (!Status.isValid())
+    log::Logger::get().log_warning(
+        Status.getErrorMessage(), " Running without jobserver."
+    );
+
+  if (Found || JobserverMode != "serve" || DryRun)
+    return true;
+
+  Status = JS.serve((unsigned)JobsNumber);
+  if (!Status.isValid()) {
+    log::Logger::get().log_error(Status.getErrorMessage());
+    return false;
+  }
+
+  return true;
+}
+
+bool LevitationDriver::initPools() {
+  for (StringRef Limits : Pools) {
+    SmallVector<StringRef, 8> Items;
+    Limits.split(Items, ',', -1, /*KeepEmpty=*/false);
+
+    for (StringRef Item : Items) {
+      StringRef Name, Value;
+      std::tie(Name, Value) = Item.split('=');
+
+      unsigned Limit;
+      if (Value.getAsInteger(10, Limit) || !Limit) {
+        log::Logger::get().log_error(
+            "-pool should be '<pool>=<N>', where N is positive number."
+        );
+        return false;
+      }
+
+      if (!isKnownPool(Name)) {
+        log::Logger::get().log_error("Unknown pool '", Name, "'.");
+        return false;
+      }
+
+      TasksManager::get().setPoolLimit(Name, Limit);
+    }
+  }
+
+  return true;
+}
+
+/// Parses memory size, e.g. "48G".
+/// \param Bytes parsed size in bytes.
+/// \return false if size is malformed.
+static bool parseMemorySize(StringRef Size, uint64_t &Bytes) {
+  unsigned Shift = llvm::StringSwitch<unsigned>(Size.take_back().lower())
+      .Case("k", 10)
+      .Case("m", 20)
+      .Case("g", 30)
+      .Case("t", 40)
+      .Default(0);
+
+  if (Shift)
+    Size = Size.drop_back();
+
+  uint64_t Value;
+  if (Size.getAsInteger(10, Value) || !Value)
+    return false;
+
+  if (Value > (UINT64_MAX >> Shift))
+    return false;
+
+  Bytes = Value << Shift;
+  return true;
+}
+
+bool LevitationDriver::initParameters() {
+  if (Output.empty()) {
+    Output = isLinkPhaseEnabled() ?
+        DriverDefaults::OUTPUT_EXECUTABLE :
+        DriverDefaults::OUTPUT_OBJECTS_DIR;
+  }
+
+  switch (Verbose) {
+    case VerboseLevel0:
+      log::Logger::get().setLogLevel(log::Level::Info);
+      break;
+    case VerboseLevel1:
+      log::Logger::get().setLogLevel(log::Level::Verbose);
+      break;
+    case VerboseLevel2:
+      // Trace is written by all workers, buffer it so that
+      // they don't wait for each other.
+      log::Logger::get().setLogLevel(log::Level::Trace);
+      log::Logger::get().setBuffered(true);
+      break;
+  }
+
+  Schedule = llvm::StringSwitch<SchedulingMode>(ScheduleName)
+      .Case("dsf", SchedulingMode::DepthFirst)
+      .Case("ready-queue", SchedulingMode::ReadyQueue)
+      .Case("critical-path", SchedulingMode::CriticalPath)
+      .Default(SchedulingMode::Unknown);
+
+  if (Schedule == SchedulingMode::Unknown) {
+    log::Logger::get().log_error(
+        "Unknown scheduling mode '", ScheduleName, "'."
+    );
+    return false;
+  }
+
+  if (
+    (FocusUnits.size() || FocusFile.size()) &&
+    Schedule == SchedulingMode::DepthFirst
+  )
+    log::Logger::get().log_warning(
+        "--focus is ignored, since depth first scheduling is used."
+    );
+
+  if (LTOName.size()) {
+    if (LTOName != "thin") {
+      log::Logger::get().log_error(
+          "Unsupported LTO mode '", LTOName, "', only 'thin' is supported."
+      );
+      return false;
+    }
+    ThinLTO = true;
+  }
+
+  // Classes of private units may only be considered final, if
+  // driver links whole program itself.
+  if (WholeProgramVTables && (!ThinLTO || !isLinkPhaseEnabled())) {
+    log::Logger::get().log_warning(
+        "--whole-program-vtables is ignored, since it requires ThinLTO "
+        "and link phase."
+    );
+    WholeProgramVTables = false;
+  }
+
+  // Streamed declarations are built before public units are known.
+  if (Streaming && WholeProgramVTables) {
+    log::Logger::get().log_warning(
+        "--streaming is ignored, since it is not compatible with "
+        "--whole-program-vtables."
+    );
+    Streaming = false;
+  }
+
+  if (StdLibPreamble.size()) {
+    if (PreambleSource.empty()) {
+      log::Logger::get().log_warning(
+          "--stdlib-preamble is ignored, since there is no preamble "
+          "to chain on it."
+      );
+    } else if (StdLibPreamble == "auto") {
+      // Installed preambles are built without extra preamble flags,
+      // and flags which affect language options make them unusable.
+      StringRef Lib = StdLib.size() ? StdLib : StringRef("default");
+      SinglePath P = BinDir;
+      llvm::sys::path::append(
+          P, DriverDefaults::STDLIB_PREAMBLES_DIR, Lib + ".pch"
+      );
+      llvm::sys::path::remove_dots(P, /*remove_dot_dot=*/true);
+      if (ExtraPreambleArgs.empty() && llvm::sys::fs::exists(P))
+        StdLibPreambleFile = P;
+      else
+        log::Logger::get().log_verbose(
+            "No prebuilt preamble for standard library '", Lib,
+            "' is installed, or it can't be used."
+        );
+    } else if (!llvm::sys::fs::exists(StdLibPreamble)) {
+      log::Logger::get().log_error(
+          "Standard library preamble '", StdLibPreamble, "' is not found."
+      );
+      return false;
+    } else
+      StdLibPreambleFile = StdLibPreamble;
+  }
+
+  if (ExportBodies < 0) {
+    log::Logger::get().log_error(
+        "--export-bodies should be positive number of tokens."
+    );
+    return false;
+  }
+
+  if (SplitCodeGenAfter < 0) {
+    log::Logger::get().log_error(
+        "--split-codegen should be positive number of milliseconds."
+    );
+    return false;
+  }
+
+  if (SplitCodeGenAfter && ThinLTO) {
+    log::Logger::get().log_warning(
+        "--split-codegen is ignored, since with ThinLTO code is generated "
+        "by linker."
+    );
+    SplitCodeGenAfter = 0;
+  }
 
-  if (!llvm::sys::fs::exists(ProductFile))
-    return false;
+  if (SplitDwarf && ThinLTO) {
+    log::Logger::get().log_warning(
+        "--split-dwarf is ignored, since with ThinLTO code is generated "
+        "by linker."
+    );
+    SplitDwarf = false;
+  }
 
-  if (!DeclASTMetaLoader::fromFile(
-      Meta, Context.Driver.BuildRoot, MetaFile
-  )) {
-    Log.log_warning(
-      "Failed to load existing meta file for '",
-      SourceFile, "'\n",
-      "  Must rebuild dependent chains."
+  // All partitions of object would share same .dwo.
+  if (SplitCodeGenAfter && SplitDwarf) {
+    log::Logger::get().log_warning(
+        "--split-codegen is ignored, since it is not compatible with "
+        "--split-dwarf."
     );
-    return false;
+    SplitCodeGenAfter = 0;
   }
 
-  // Get source MD5
+  if (IncrementalCodeGen && !SplitCodeGenAfter) {
+    log::Logger::get().log_warning(
+        "--incremental-codegen is ignored, since objects are not split, "
+        "see --split-codegen."
+    );
+    IncrementalCodeGen = false;
+  }
 
-  auto &FM = CreatableSingleton<FileManager>::get();
+  if (DwarfPackage && (!SplitDwarf || !isLinkPhaseEnabled())) {
+    log::Logger::get().log_warning(
+        "--dwp is ignored, since it requires --split-dwarf and link phase."
+    );
+    DwarfPackage = false;
+  }
 
-  if (auto Buffer = FM.getBufferForFile(SourceFile)) {
-    auto SrcMD5 = calcMD5(Buffer->get()->getBuffer());
+  llvm::StringSet<> ConfigNames;
+  for (const auto &Config : Configs) {
+    if (
+      Config.Name.empty() ||
+      Config.Name.find_first_of("/\\.") != std::string::npos
+    ) {
+      log::Logger::get().log_error(
+          "Bad configuration name '", Config.Name, "'."
+      );
+      return false;
+    }
 
-#if 0
-    auto &Verbose = Log.verbose();
-    Verbose << "Old Hash: ";
-    for (auto b : Meta.getSourceHash()) {
-      Verbose.write_hex(b);
-      Verbose << " ";
+    if (!ConfigNames.insert(Config.Name).second) {
+      log::Logger::get().log_error(
+          "Configuration '", Config.Name, "' is defined twice."
+      );
+      return false;
     }
+  }
 
-    Verbose << "\n";
+  if (ProfileGenerate && ProfileUse.size()) {
+    log::Logger::get().log_error(
+        "-profile-generate and -profile-use can't be used together."
+    );
+    return false;
+  }
+
+  if (ProfileUse.size())
+    llvm::sys::fs::make_absolute(ProfileUse);
 
-    Verbose << "Src Hash: ";
-    for (auto b : SrcMD5.Bytes) {
-      Verbose.write_hex(b);
-      Verbose << " ";
+  for (auto *Level : {&HotOptLevel, &ColdOptLevel}) {
+    auto Parsed = HotUnits::parseLevel(*Level);
+    if (Parsed.empty()) {
+      log::Logger::get().log_error(
+          "Unknown optimization level '", *Level, "'."
+      );
+      return false;
     }
+    *Level = Parsed;
+  }
 
-    Verbose << "\n";
-#endif
+  if (HotUnitsFile.size())
+    llvm::sys::fs::make_absolute(HotUnitsFile);
 
-    // FIXME Levitation: we either should give up and remove this check
-    //  or somehow separation md5 for source locations block
-    //  and rest of decl-ast file.
-    // Currently each time you change source, you change source locations.
-    // So, even though declaration itself may remain same, .decl-ast
-    // will be different.
-    bool Res = equal(Meta.getSourceHash(), SrcMD5.Bytes);
+  if (Reproducible) {
+    PortableSourcesRoot = Path::makeAbsolute<SinglePath>(SourcesRoot);
 
-    if (Res) {
-      Log.log_verbose("Source  for item '", ItemDescr, "' is up-to-date.");
-    }
-    return Res;
-  } else
-    Log.log_warning(
-      "Failed to load source '",
-      SourceFile ,"' during up-to-date checks.\n",
-      "  Must rebuild dependent chains. But I think I'll fail, dude..."
+    if (!Path::hasParent(BuildRoot, SourcesRoot))
+      log::Logger::get().log_warning(
+          "Build root is not within sources root, so artifacts "
+          "still refer to it by absolute path."
+      );
+  }
+
+  // Instrumented objects need profile runtime.
+  if (ProfileGenerate)
+    ExtraLinkerArgs.emplace_back("-fprofile-generate");
+
+  if (HidePrivateUnits && ExportAllUnits) {
+    log::Logger::get().log_error(
+        "--hide-private-units and --export-all-units can't be used together."
     );
-  return false;
-}
+    return false;
+  }
 
-void LevitationDriverImpl::setPreambleUpdated() {
-  Context.PreambleUpdated = true;
-}
+  if (ThinLTOExecutor.size() && !ThinLTO)
+    log::Logger::get().log_warning(
+        "--thinlto-executor is ignored, since ThinLTO is not enabled."
+    );
 
-void LevitationDriverImpl::setNodeUpdated(DependenciesGraph::NodeID::Type NID) {
-  Context.UpdatedNodes.insert(NID);
-}
+  if (RemoteWorkers && RemoteExecutor.empty())
+    log::Logger::get().log_warning(
+        "--remote-workers is ignored, since --remote-executor is not set."
+    );
 
+  if (SpeculateAfter && RemoteExecutor.empty())
+    log::Logger::get().log_warning(
+        "--speculate-after is ignored, since --remote-executor is not set."
+    );
 
-void LevitationDriverImpl::setObjectsUpdated() {
-  Context.ObjectsUpdated = true;
-}
+  if (PrewarmCache && CacheDir.empty() && RemoteCacheCommand.empty()) {
+    log::Logger::get().log_error(
+        "--prewarm-cache requires --cache-dir or --remote-cache."
+    );
+    return false;
+  }
 
-//-----------------------------------------------------------------------------
-//  LevitationDriver
+  if (PrewarmCache && DryRun) {
+    log::Logger::get().log_error(
+        "--prewarm-cache can't be used with -###."
+    );
+    return false;
+  }
 
-LevitationDriver::LevitationDriver(StringRef CommandPath)
-{
-  SinglePath P = CommandPath;
-  if (auto Err = llvm::sys::fs::make_absolute(P)) {
+  if (LazyCacheFetch && CacheDir.empty() && RemoteCacheCommand.empty()) {
     log::Logger::get().log_warning(
-      "Failed to make absolute path. System message: ",
-      Err.message()
+        "--lazy-cache-fetch is ignored, since build cache is not set."
     );
-    P = CommandPath;
+    LazyCacheFetch = false;
   }
 
-  BinDir = llvm::sys::path::parent_path(P);
-
-#ifdef LEVITATION_DEFAULT_INCLUDES
-  StringRef DefaultIncludes(LEVITATION_DEFAULT_INCLUDES);
-  if (!DefaultIncludes.empty()) {
+  if (LazyCacheFetch && EmbedMeta) {
+    log::Logger::get().log_warning(
+        "--lazy-cache-fetch is ignored, since embedded meta can't be "
+        "fetched without declaration AST."
+    );
+    LazyCacheFetch = false;
+  }
 
-    SmallVector<StringRef, 16> DefaultIncludesItems;
-    DefaultIncludes.split(DefaultIncludesItems, ';');
+  if (CacheHardlinks && CacheDir.empty()) {
+    log::Logger::get().log_warning(
+        "--cache-hardlinks is ignored, since --cache-dir is not set."
+    );
+    CacheHardlinks = false;
+  }
 
-    for (auto DefaultInclude : DefaultIncludesItems)
-      Includes.push_back(DefaultInclude.trim());
+  if (
+    SeedBuildRoot.size() &&
+    levitation::Path::makeAbsolute<SinglePath>(SeedBuildRoot) ==
+    levitation::Path::makeAbsolute<SinglePath>(BuildRoot)
+  ) {
+    log::Logger::get().log_warning(
+        "--seed-build-root is ignored, since it is build root itself."
+    );
+    SeedBuildRoot = "";
   }
-#endif
 
-  OutputHeadersDir = levitation::Path::getPath<SinglePath>(
-      BuildRoot, DriverDefaults::HEADER_DIR_SUFFIX
-  );
+  if (BudgetsFile.size())
+    llvm::sys::fs::make_absolute(BudgetsFile);
+  else if (EnforceBudgets) {
+    log::Logger::get().log_error("--enforce-budgets requires --budgets.");
+    return false;
+  }
 
-  OutputDeclsDir = levitation::Path::getPath<SinglePath>(
-      BuildRoot, DriverDefaults::DECLS_DIR_SUFFIX
-  );
-}
+  if (StatusFD < -1) {
+    log::Logger::get().log_error(
+        "--status-fd should be valid file descriptor."
+    );
+    return false;
+  }
 
-void LevitationDriver::setExtraPreambleArgs(StringRef Args) {
-  ExtraPreambleArgs = ArgsUtils::parse(Args);
-}
+  if (MetricsPushCommand.size() && MetricsOutput.empty()) {
+    log::Logger::get().log_warning(
+        "--metrics-push is ignored, since --metrics is not set."
+    );
+    MetricsPushCommand = "";
+  }
 
-void LevitationDriver::setExtraParserArgs(StringRef Args) {
-  ExtraParseArgs = ArgsUtils::parse(Args);
-}
+  if (LinkerThreads < 0) {
+    log::Logger::get().log_error(
+        "--link-threads should be positive number."
+    );
+    return false;
+  }
 
-void LevitationDriver::setExtraCodeGenArgs(StringRef Args) {
-  ExtraCodeGenArgs = ArgsUtils::parse(Args);
-}
+  if (SharedPackages && (PartialLink || ThinLTO)) {
+    log::Logger::get().log_error(
+        "--shared-packages can't be used with --partial-link or ThinLTO."
+    );
+    return false;
+  }
 
-void LevitationDriver::setExtraLinkerArgs(StringRef Args) {
-  ExtraLinkerArgs = ArgsUtils::parse(Args);
-}
+  // Private units are still referenced across packages.
+  if (SharedPackages && HidePrivateUnits) {
+    log::Logger::get().log_error(
+        "--shared-packages and --hide-private-units can't be used together."
+    );
+    return false;
+  }
 
-bool LevitationDriver::run() {
+  if (PartialLink && ThinLTO)
+    log::Logger::get().log_warning(
+        "--partial-link is ignored, since ThinLTO links bitcode objects."
+    );
 
-  log::Logger::createLogger(log::Level::Info);
-  TasksManager::create(JobsNumber-1);
-  CreatableSingleton<FileManager>::create( FileSystemOptions { std::string(StringRef()) });
-  CreatableSingleton<DependenciesStringsPool >::create();
+  if (LinkerThreads && Linker != "lld")
+    log::Logger::get().log_warning(
+        "--link-threads is ignored, since linker is not lld."
+    );
 
-  initParameters();
+  if (SymbolOrdering.size()) {
+    if (Linker != "lld") {
+      log::Logger::get().log_warning(
+          "--symbol-ordering is ignored, since linker is not lld."
+      );
+      SymbolOrdering.clear();
+    } else
+      llvm::sys::fs::make_absolute(SymbolOrdering);
+  }
 
-  RunContext Context(*this);
-  LevitationDriverImpl Impl(Context);
+  if (ParseImportBatchSize < 1) {
+    log::Logger::get().log_error(
+        "--parse-import-batch should be positive number."
+    );
+    return false;
+  }
 
-  Impl.collectSources();
-  Impl.buildPreamble();
-  Impl.runParseImport();
-  Impl.solveDependencies();
-  Impl.codeGen();
+  if (UnitySize < 1) {
+    log::Logger::get().log_error(
+        "--unity-size should be positive number."
+    );
+    return false;
+  }
 
-  if (LinkPhaseEnabled)
-    Impl.runLinker();
+  if (FailuresLimit < 0) {
+    log::Logger::get().log_error(
+        "-k should be non-negative number."
+    );
+    return false;
+  }
 
-  if (Context.Status.hasWarnings()) {
-    log::Logger::get().log_warning(Context.Status.getWarningMessage());
+  if (FailFast) {
+    if (FailuresLimit != DriverDefaults::FAILURES_LIMIT)
+      log::Logger::get().log_warning(
+          "-k is ignored, since -fail-fast stops on first failure."
+      );
+    FailuresLimit = 1;
   }
 
-  if (!Context.Status.isValid()) {
-    log::Logger::get().log_error(Context.Status.getErrorMessage());
+  if (!initJobserver())
+    return false;
+
+  if (!initPools())
     return false;
+
+  if (MaxMemory.size()) {
+    uint64_t MaxMemoryBytes;
+    if (!parseMemorySize(MaxMemory, MaxMemoryBytes)) {
+      log::Logger::get().log_error(
+          "-max-mem should be positive size, e.g. '48G'."
+      );
+      return false;
+    }
+    TasksManager::get().setMemoryBudget(MaxMemoryBytes);
   }
 
-  return true;
-}
+  // Unity batch shares state between frontend jobs of driver process.
+  if (SkipEmptyObjects && Unity) {
+    log::Logger::get().log_warning(
+        "--skip-empty-objects is ignored with --unity, since units "
+        "are compiled in batches."
+    );
+    SkipEmptyObjects = false;
+  }
 
-void LevitationDriver::initParameters() {
-  if (Output.empty()) {
-    Output = isLinkPhaseEnabled() ?
-        DriverDefaults::OUTPUT_EXECUTABLE :
-        DriverDefaults::OUTPUT_OBJECTS_DIR;
+  if (Unity && Execution != ExecutionMode::InProcess) {
+    if (Execution == ExecutionMode::CompileServer)
+      log::Logger::get().log_warning(
+          "--unity uses in-process compilation instead of compile servers."
+      );
+    Execution = ExecutionMode::InProcess;
   }
 
-  switch (Verbose) {
-    case VerboseLevel0:
-      log::Logger::get().setLogLevel(log::Level::Info);
-      break;
-    case VerboseLevel1:
-      log::Logger::get().setLogLevel(log::Level::Verbose);
-      break;
-    case VerboseLevel2:
-      log::Logger::get().setLogLevel(log::Level::Trace);
-      break;
+  if (Execution == ExecutionMode::CompileServer) {
+    if (!CompileServersPool::isSupported()) {
+      log::Logger::get().log_warning(
+          "Compile servers are not supported on this host, "
+          "in-process compilation will be used instead."
+      );
+      Execution = ExecutionMode::InProcess;
+    } else if (!DryRun) {
+      CompileServersPool::create(
+          CommandPath, (unsigned)JobsNumber, WarmPreamble
+      );
+    }
   }
 
+  // Each clang process maps and reads preamble on its own anyway.
+  if (WarmPreamble && Execution == ExecutionMode::Subprocess)
+    log::Logger::get().log_warning(
+        "--warm-preamble only has effect with --in-process "
+        "or --compile-servers."
+    );
+
+  if (WarmPreamble && Execution == ExecutionMode::InProcess)
+    InProcessCompiler::setWarmPreamble(true);
+
   if (isVerbose())
     dumpParameters();
+
+  return true;
+}
+
+static StringRef getExecutionModeName(LevitationDriver::ExecutionMode Mode) {
+  switch (Mode) {
+    case LevitationDriver::ExecutionMode::Subprocess:
+      return "subprocess";
+    case LevitationDriver::ExecutionMode::InProcess:
+      return "in-process";
+    case LevitationDriver::ExecutionMode::CompileServer:
+      return "compile-server";
+  }
+  llvm_unreachable("Unknown execution mode");
 }
 
 void LevitationDriver::dumpParameters() {
@@ -1937,17 +13788,151 @@ void LevitationDriver::dumpParameters() {
     << "    BuildRoot: " << BuildRoot << "\n"
     << "    PreambleSource: " << (PreambleSource.empty() ? "<preamble compilation not requested>" : PreambleSource)
     << "\n"
+    << "    PreambleChain: " << (PreambleChainSources.empty() ? "<not set>" : "")
+    << "\n";
+
+    for (auto Src : PreambleChainSources)
+      Out << "        " << Src << "\n";
+
+    Out
+    << "    StdLibPreamble: "
+    << (StdLibPreambleFile.empty() ? "<not used>" : StdLibPreambleFile.str())
+    << "\n";
+
+    Out
+    << "    SubtreePreambles: " << (SubtreePreambles.empty() ? "<not set>" : "")
+    << "\n";
+
+    for (const auto &P : SubtreePreambles)
+      Out << "        " << P.Dir << " -> " << P.Source << "\n";
+
+    Out
+    << "    HeaderUnits: " << (HeaderUnits.empty() ? "<not set>" : "")
+    << "\n";
+
+    for (auto Header : HeaderUnits)
+      Out << "        " << Header << "\n";
+
+    Out
     << "    JobsNumber (including main thread): " << JobsNumber << "\n"
+    << "    AutoJobs: " << (AutoJobs ? "yes" : "no") << "\n"
+    << "    MaxMemory: " << (MaxMemory.empty() ? "<unlimited>" : MaxMemory) << "\n"
+    << "    Pools: " << (Pools.empty() ? "<none>" : llvm::join(Pools, ",")) << "\n"
+    << "    FailuresLimit: " << FailuresLimit << "\n"
+    << "    FailFast: " << (FailFast ? "yes" : "no") << "\n"
+    << "    Jobserver: " << JobserverMode
+    << (Jobserver::get().isEnabled() ? " (enabled)" : "") << "\n"
+    << "    Schedule: " << ScheduleName << "\n"
+    << "    Numa: " << (Numa ? "yes" : "no") << "\n"
+    << "    PinWorkers: " << (PinWorkers ? "yes" : "no") << "\n"
+    << "    JobPriorities: " << (JobPriorities ? "yes" : "no") << "\n"
     << "    Output: " << Output << "\n"
     << "    OutputHeadersDir: " << (isLinkPhaseEnabled() ? "<n/a>" : OutputHeadersDir.c_str()) << "\n"
     << "    OutputDeclsDir: " << (isLinkPhaseEnabled() ? "<n/a>" : OutputDeclsDir.c_str()) << "\n"
     << "    DryRun: " << (DryRun ? "yes" : "no") << "\n"
+    << "    Watch: " << (Watch ? "yes" : "no") << "\n"
+    << "    Focus: " << (FocusUnits.empty() ? "<not set>" : llvm::join(FocusUnits, ", ")) << "\n"
+    << "    FocusFile: " << (FocusFile.empty() ? "<not set>" : FocusFile) << "\n"
+    << "    SourcesManifest: " << (SourcesManifest.empty() ? "<not set>" : SourcesManifest) << "\n"
+    << "    Execution: " << getExecutionModeName(Execution) << "\n"
+    << "    WarmPreamble: " << (WarmPreamble ? "yes" : "no") << "\n"
+    << "    ImportScanner: " << (ImportScannerEnabled ? "yes" : "no") << "\n"
+    << "    Streaming: " << (Streaming ? "yes" : "no") << "\n"
+    << "    Prefetch: " << (Prefetch ? "yes" : "no") << "\n"
+    << "    UnitTimeTrace: " << (UnitTimeTrace ? "yes" : "no") << "\n"
+    << "    DependencyStats: " << (DependencyStats ? "yes" : "no") << "\n"
+    << "    ReplayDiagnostics: " << (ReplayDiagnostics ? "yes" : "no") << "\n"
+    << "    PrivateImports: " << (PrivateImports ? "yes" : "no") << "\n"
+    << "    SkipEmptyObjects: " << (SkipEmptyObjects ? "yes" : "no") << "\n"
+    << "    Stats: " << (Stats ? "yes" : "no") << "\n"
+    << "    Explain: " << (Explain ? "yes" : "no") << "\n"
+    << "    ExportGraph: " << (ExportGraph.empty() ? "<not set>" : ExportGraph) << "\n"
+    << "    Metrics: " << (MetricsOutput.empty() ? "<not set>" : MetricsOutput) << "\n"
+    << "    Budgets: " << (BudgetsFile.empty() ? "<not set>" : BudgetsFile.str()) << (EnforceBudgets ? " (enforced)" : "") << "\n"
+    << "    Progress: " << (Progress ? "yes" : "no") << "\n"
+    << "    StatusFD: " << (StatusFD < 0 ? "<not set>" : std::to_string(StatusFD)) << "\n"
+    << "    MetricsPush: " << (MetricsPushCommand.empty() ? "<not set>" : MetricsPushCommand) << "\n"
+    << "    CompileCommands: " << (CompileCommands.empty() ? "<not set>" : CompileCommands) << "\n"
+    << "    CompileCommandsPhases: " << (CompileCommandsPhases ? "yes" : "no") << "\n"
+    << "    Tidy: " << (Tidy ? "yes" : "no") << "\n"
+    << "    TidyChecks: " << (TidyChecks.empty() ? "<default>" : TidyChecks) << "\n"
+    << "    Check: " << (Check ? "yes" : "no") << "\n"
+    << "    ExplainOutput: " << (ExplainOutput.empty() ? "<not set>" : ExplainOutput) << "\n"
+    << "    NameIndex: " << (NameIndexEnabled ? "yes" : "no") << "\n"
+    << "    ModulesCodegen: " << (ModulesCodegen ? "yes" : "no") << "\n"
+    << "    ModulesDebugInfo: " << (ModulesDebugInfo ? "yes" : "no") << "\n"
+    << "    InstantiateInterface: " << (InstantiateInterface ? "yes" : "no") << "\n"
+    << "    ExportBodies: " << ExportBodies << " tokens\n"
+    << "    EarlyCutoff: " << (EarlyCutoff ? "yes" : "no") << "\n"
+    << "    CompactDeclAST: " << (CompactDeclAST ? "yes" : "no") << "\n"
+    << "    EmbedMeta: " << (EmbedMeta ? "yes" : "no") << "\n"
+    << "    PackArtifacts: " << (PackArtifacts ? "yes" : "no") << "\n"
+    << "    Reproducible: " << (Reproducible ? "yes" : "no") << "\n"
+    << "    ThinLTO: " << (ThinLTO ? "yes" : "no") << "\n"
+    << "    WholeProgramVTables: " << (WholeProgramVTables ? "yes" : "no") << "\n"
+    << "    HidePrivateUnits: " << (HidePrivateUnits ? "yes" : "no") << "\n"
+    << "    ExportAllUnits: " << (ExportAllUnits ? "yes" : "no") << "\n"
+    << "    KeepIR: " << (KeepIR ? "yes" : "no") << "\n"
+    << "    ReleaseAST: " << (ReleaseAST ? "yes" : "no") << "\n"
+    << "    SplitCodeGenAfter: " << SplitCodeGenAfter << " ms\n"
+    << "    IncrementalCodeGen: " << (IncrementalCodeGen ? "yes" : "no") << "\n"
+    << "    ProfileGenerate: " << (ProfileGenerate ? "yes" : "no") << "\n"
+    << "    ProfileUse: " << (ProfileUse.empty() ? "<not set>" : ProfileUse.c_str()) << "\n"
+    << "    HotUnits: " << (HotUnitsFile.empty() ? "<not set>" : HotUnitsFile.c_str()) << "\n"
+    << "    HotOptLevel: " << HotOptLevel << "\n"
+    << "    ColdOptLevel: " << ColdOptLevel << "\n"
+    << "    SplitDwarf: " << (SplitDwarf ? "yes" : "no") << "\n"
+    << "    DwarfPackage: " << (DwarfPackage ? "yes" : "no") << "\n"
+    << "    SymbolOrdering: " << (SymbolOrdering.empty() ? "<not set>" : SymbolOrdering.c_str()) << "\n"
+    << "    ThinLTOExecutor: " << (ThinLTOExecutor.empty() ? "<not set>" : ThinLTOExecutor) << "\n"
+    << "    RemoteExecutor: " << (RemoteExecutor.empty() ? "<not set>" : RemoteExecutor) << "\n"
+    << "    RemoteWorkers: " << RemoteWorkers << "\n"
+    << "    SpeculateAfter: " << SpeculateAfter << "\n"
+    << "    Shard: " << (Shard.empty() ? "<not set>" : Shard) << "\n"
+    << "    AmalgamatedHeader: " << (AmalgamatedHeader.empty() ? "<not set>" : AmalgamatedHeader) << "\n"
+    << "    EmitModuleMap: " << (EmitModuleMap ? "yes" : "no") << "\n"
+    << "    HeadersPCH: " << (HeadersPCH.empty() ? "<not set>" : HeadersPCH) << "\n"
+    << "    Archive: " << (Archive.empty() ? "<not set>" : Archive) << (ThinArchive ? " (thin)" : "") << "\n"
+    << "    MakeBundle: " << (MakeBundle.empty() ? "<not set>" : MakeBundle) << "\n"
+    << "    Targets: " << (Targets.empty() ? "<all>" : llvm::join(Targets, ", ")) << "\n"
+    << "    LinkReachable: " << (LinkReachable ? "yes" : "no") << "\n"
+    << "    RunTests: " << (RunTests ? "yes" : "no") << "\n"
+    << "    JUnit: " << (JUnitFile.empty() ? "<not set>" : JUnitFile.str()) << "\n"
+    << "    SuggestPreamble: " << (SuggestPreamble.empty() ? "<not set>" : SuggestPreamble) << "\n"
+    << "    Advise: " << (Advise ? "yes" : "no") << "\n"
+    << "    PrewarmCache: " << (PrewarmCache ? "yes" : "no") << "\n"
+    << "    EmitNinja: " << (EmitNinja.empty() ? "<not set>" : EmitNinja) << "\n"
+    << "    GC: " << (GC ? "yes" : "no") << "\n"
+    << "    AutoGC: " << (AutoGC ? "yes" : "no") << "\n"
+    << "    AffectedQuery: " << (AffectedQuery ? llvm::join(ChangedFiles, ", ") : "<not set>") << "\n"
+    << "    Linker: " << (Linker.empty() ? "<system>" : Linker) << "\n"
+    << "    LinkerThreads: " << LinkerThreads << "\n"
+    << "    PartialLink: " << (PartialLink ? "yes" : "no") << "\n"
+    << "    SharedPackages: " << (SharedPackages ? "yes" : "no") << "\n"
+    << "    ParseImportBatchSize: " << ParseImportBatchSize << "\n"
+    << "    Unity: " << (Unity ? "yes" : "no") << "\n"
+    << "    UnitySize: " << UnitySize << "\n"
+    << "    CacheDir: " << (CacheDir.empty() ? "<not set>" : CacheDir) << "\n"
+    << "    CacheHardlinks: " << (CacheHardlinks ? "yes" : "no") << "\n"
+    << "    LazyCacheFetch: " << (LazyCacheFetch ? "yes" : "no") << "\n"
+    << "    SeedBuildRoot: " << (SeedBuildRoot.empty() ? "<not set>" : SeedBuildRoot) << "\n"
+    << "    RemoteCache: " << (RemoteCacheCommand.empty() ? "<not set>" : RemoteCacheCommand) << "\n"
+    << "    LibraryCache: " << (LibraryCacheDir.empty() ? "<not set>" : LibraryCacheDir) << "\n"
+    << "    SharedBuildRoot: " << (SharedBuildRoot ? "yes" : "no") << "\n"
+    << "    CacheCompression: " << CacheCompression << "\n"
+    << "    Hash: " << Hash << "\n"
+    << "    PublishQueueDepth: " << PublishQueueDepth << "\n"
+    << "    CacheMaxSize: " << CacheMaxSize << " MB\n"
+    << "    CacheMaxAge: " << CacheMaxAge << " days\n"
     << "\n";
 
     dumpIncludes(Out);
     dumpExtraFlags(Out, "Preamble", ExtraPreambleArgs);
     dumpExtraFlags(Out, "Parse", ExtraParseArgs);
     dumpExtraFlags(Out, "CodeGen", ExtraCodeGenArgs);
+    dumpExtraFlags(Out, "Backend", ExtraBackendArgs);
+    for (const auto &Config : Configs)
+      dumpExtraFlags(Out, "Config " + Config.Name, Config.CodeGenArgs);
     dumpExtraFlags(Out, "Link", ExtraLinkerArgs);
 
     Out << "\n";
@@ -1990,5 +13975,141 @@ void LevitationDriver::dumpIncludes(llvm::raw_ostream &Out) {
   Out << "\n";
 }
 
+//-----------------------------------------------------------------------------
+//  LevitationDriverSession
+
+class LevitationDriverSession::Impl {
+public:
+  LevitationDriver &Driver;
+  Callbacks CB;
+  llvm::IntrusiveRefCntPtr<UnsavedFiles> Unsaved;
+
+  /// Context of last build, kept so that next one inherits it,
+  /// same as in watch mode.
+  std::unique_ptr<RunContext> Context;
+  std::mutex ContextMutex;
+
+  /// Changes reported since last build.
+  llvm::StringSet<> Changed;
+  bool SourcesSetChanged = false;
+  std::mutex ChangesMutex;
+
+  Impl(LevitationDriver &driver, Callbacks cb)
+  : Driver(driver), CB(std::move(cb))
+  {}
+};
+
+LevitationDriverSession::LevitationDriverSession(
+    LevitationDriver &Driver, Callbacks CB
+) : Session(std::make_unique<Impl>(Driver, std::move(CB))) {
+  auto &S = *Session;
+
+  S.Unsaved = new UnsavedFiles(
+      Driver.FileSystem ? Driver.FileSystem : llvm::vfs::getRealFileSystem()
+  );
+  Driver.FileSystem = S.Unsaved;
+  Driver.LogSink = S.CB.Diagnostic;
+}
+
+LevitationDriverSession::~LevitationDriverSession() {
+  auto &Driver = Session->Driver;
+  Driver.LogSink = nullptr;
+  if (Driver.Initialized)
+    log::Logger::get().setSink(nullptr);
+  Commands::CommandInfo::vfsOverlay().clear();
+}
+
+bool LevitationDriverSession::build() {
+  auto &S = *Session;
+  auto &Driver = S.Driver;
+
+  if (!Driver.init())
+    return false;
+
+  auto Next = std::make_unique<RunContext>(Driver);
+  Next->Callbacks = &S.CB;
+
+  with (auto _ = lock(S.ChangesMutex)) {
+    if (S.Context) {
+      Next->inherit(*S.Context, /*KeepSources=*/!S.SourcesSetChanged);
+
+      // Changes cancelled build was started for are not built yet.
+      if (S.Context->Superseded)
+        for (const auto &F : S.Context->ChangedSources)
+          Next->ChangedSources.insert(F.first());
+    }
+
+    for (const auto &F : S.Changed)
+      Next->ChangedSources.insert(F.first());
+
+    S.Changed.clear();
+    S.SourcesSetChanged = false;
+  }
+
+  auto &Overlay = Commands::CommandInfo::vfsOverlay();
+  Overlay.clear();
+
+  if (!S.Unsaved->empty() && !Driver.DryRun) {
+    auto Dir = levitation::Path::makeAbsolute<SinglePath>(
+        levitation::Path::getPath<SinglePath>(
+            Driver.BuildRoot, DriverDefaults::UNSAVED_FILES_DIR
+        )
+    );
+    auto File = levitation::Path::getPath<SinglePath>(
+        Dir, DriverDefaults::UNSAVED_FILES_OVERLAY
+    );
+
+    if (!S.Unsaved->writeOverlay(Dir, File)) {
+      log::Logger::get().log_error(
+          "Failed to write unsaved files into '", Dir, "'."
+      );
+      return false;
+    }
+
+    Overlay = File;
+  }
+
+  with (auto _ = lock(S.ContextMutex))
+    S.Context = std::move(Next);
+
+  return LevitationDriverImpl(*S.Context).build();
+}
+
+void LevitationDriverSession::cancel() {
+  auto &S = *Session;
+  auto _ = lock(S.ContextMutex);
+
+  if (!S.Context)
+    return;
+
+  S.Context->Superseded = true;
+  TasksManager::get().cancel();
+  RunningSubprocesses::get().killAll();
+}
+
+void LevitationDriverSession::notifyChanged(StringRef Path) {
+  auto &S = *Session;
+  auto _ = lock(S.ChangesMutex);
+  S.Changed.insert(levitation::Path::makeAbsolute<SinglePath>(Path));
+}
+
+void LevitationDriverSession::notifySourcesSetChanged() {
+  auto &S = *Session;
+  auto _ = lock(S.ChangesMutex);
+  S.SourcesSetChanged = true;
+}
+
+void LevitationDriverSession::setUnsavedFile(
+    StringRef Path, StringRef Contents
+) {
+  Session->Unsaved->set(Path, Contents);
+  notifyChanged(Path);
+}
+
+void LevitationDriverSession::removeUnsavedFile(StringRef Path) {
+  if (Session->Unsaved->remove(Path))
+    notifyChanged(Path);
+}
+
 
 }}}
@@ -20,10 +20,41 @@ namespace clang { namespace levitation { namespace tools {
   constexpr char DriverDefaults::SOURCES_ROOT[];
   constexpr char DriverDefaults::BUILD_ROOT[];
   constexpr char DriverDefaults::LIBS_OUTPUT_SUBDIR[];
+  constexpr char DriverDefaults::HEADER_UNITS_SUBDIR[];
   constexpr char DriverDefaults::STDLIB[];
   constexpr int DriverDefaults::JOBS_NUMBER;
+  constexpr int DriverDefaults::UNITY_SIZE;
+  constexpr int DriverDefaults::FAILURES_LIMIT;
+  constexpr int DriverDefaults::CODEGEN_PARTITIONS;
+  constexpr int DriverDefaults::INCREMENTAL_CODEGEN_PARTITIONS;
+  constexpr int DriverDefaults::ADVISED_UNITS;
+  constexpr int DriverDefaults::WORKER_WARM_REQUESTS;
+  constexpr char DriverDefaults::HOT_OPT_LEVEL[];
+  constexpr char DriverDefaults::COLD_OPT_LEVEL[];
+  constexpr int DriverDefaults::HOT_UNITS_PERCENT;
+  constexpr char DriverDefaults::HOT_UNITS[];
+  constexpr char DriverDefaults::LINKER[];
   constexpr char DriverDefaults::OUTPUT_EXECUTABLE[];
   constexpr char DriverDefaults::OUTPUT_OBJECTS_DIR[];
+  constexpr char DriverDefaults::MAIN_UNIT[];
   constexpr char DriverDefaults::PREAMBLE_OUT[];
   constexpr char DriverDefaults::PREAMBLE_OUT_META[];
+  constexpr char DriverDefaults::SCHEDULE[];
+  constexpr char DriverDefaults::JOBSERVER[];
+  constexpr char DriverDefaults::BUILD_HISTORY[];
+  constexpr char DriverDefaults::BUILD_STATE[];
+  constexpr char DriverDefaults::BUILD_JOURNAL[];
+  constexpr char DriverDefaults::NAME_INDEX[];
+  constexpr char DriverDefaults::DEPENDENCIES_INDEX[];
+  constexpr char DriverDefaults::THINLTO_CACHE_DIR[];
+  constexpr char DriverDefaults::PARTIAL_LINKS_DIR[];
+  constexpr char DriverDefaults::SYMBOL_ORDERING[];
+  constexpr char DriverDefaults::UNSAVED_FILES_DIR[];
+  constexpr char DriverDefaults::UNSAVED_FILES_OVERLAY[];
+  constexpr char DriverDefaults::LIBRARY_INTERFACE[];
+  constexpr char DriverDefaults::STDLIB_PREAMBLES_DIR[];
+  constexpr char DriverDefaults::CODEGEN_CACHE_DIR[];
+  constexpr char DriverDefaults::MODULE_MAP[];
+  constexpr char DriverDefaults::PUBLIC_HEADERS[];
+  constexpr char DriverDefaults::SHARED_PACKAGES_DIR[];
 }}}
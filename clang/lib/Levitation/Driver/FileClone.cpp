@@ -0,0 +1,177 @@
+//===--- C++ Levitation FileClone.cpp ---------------------------*- C++ -*-===//
+//
+// Part of the C++ Levitation Project,
+// under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file contains implementation of artifacts materialization.
+//
+//===----------------------------------------------------------------------===//
+
+#include "clang/Levitation/Common/Path.h"
+#include "clang/Levitation/Driver/FileClone.h"
+
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Process.h"
+
+#ifdef __linux__
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Older libc headers don't know FICLONE, though kernel (4.5+) may have it.
+#ifndef FICLONE
+#define FICLONE _IOW(0x94, 9, int)
+#endif
+#endif
+
+#if defined(__APPLE__) && defined(__has_include)
+#if __has_include(<sys/clonefile.h>)
+#include <sys/clonefile.h>
+#define LEVITATION_HAS_CLONEFILE
+#endif
+#endif
+
+namespace clang { namespace levitation { namespace tools {
+
+namespace {
+#ifdef __linux__
+  /// Copies data within kernel. Some file systems share extents
+  /// in this case too (e.g. NFS 4.2 server side copy, XFS).
+  bool copyRange(int SrcFD, int DestFD, uint64_t Size) {
+#ifdef SYS_copy_file_range
+    while (Size) {
+      auto N = syscall(
+          SYS_copy_file_range, SrcFD, nullptr, DestFD, nullptr, Size, 0
+      );
+      if (N < 0) {
+        if (errno == EINTR)
+          continue;
+        return false;
+      }
+      // Source got shorter meanwhile.
+      if (N == 0)
+        return false;
+      Size -= N;
+    }
+    return true;
+#else
+    return false;
+#endif
+  }
+#endif
+
+  /// Copies modification time of Src to file opened as FD.
+  void copyTime(llvm::StringRef Src, int FD) {
+    llvm::sys::fs::file_status Status;
+    if (!llvm::sys::fs::status(Src, Status))
+      llvm::sys::fs::setLastAccessAndModificationTime(
+          FD, Status.getLastAccessedTime(), Status.getLastModificationTime()
+      );
+  }
+}
+
+std::error_code FileClone::copy(
+    llvm::StringRef Src, int DestFD, Method &Used
+) {
+#ifdef __linux__
+  int SrcFD;
+  if (!llvm::sys::fs::openFileForRead(Src, SrcFD)) {
+    bool Done = false;
+
+    if (ioctl(DestFD, FICLONE, SrcFD) == 0) {
+      Used = Method::Reflink;
+      Done = true;
+    } else {
+      llvm::sys::fs::file_status Status;
+      if (
+        !llvm::sys::fs::status(SrcFD, Status) &&
+        copyRange(SrcFD, DestFD, Status.getSize())
+      ) {
+        Used = Method::CopyRange;
+        Done = true;
+      }
+    }
+
+    llvm::sys::Process::SafelyCloseFileDescriptor(SrcFD);
+
+    if (Done)
+      return std::error_code();
+
+    // Partial copy_file_range results are dropped.
+    if (ftruncate(DestFD, 0) < 0 || lseek(DestFD, 0, SEEK_SET) < 0)
+      return std::error_code(errno, std::generic_category());
+  }
+#endif
+
+  Used = Method::Copy;
+  return llvm::sys::fs::copy_file(Src, DestFD);
+}
+
+bool FileClone::materialize(
+    llvm::StringRef Src,
+    llvm::StringRef Dest,
+    bool AllowHardlink,
+    bool PreserveTime,
+    Method *Used
+) {
+  Path::createDirsForFile(Dest);
+
+  Method M;
+  SinglePath Tmp;
+
+  if (AllowHardlink) {
+    llvm::sys::fs::createUniquePath(
+        Dest + ".tmp-%%%%%%%%", Tmp, /*MakeAbsolute=*/false
+    );
+    if (!llvm::sys::fs::create_hard_link(Src, Tmp)) {
+      if (!llvm::sys::fs::rename(Tmp, Dest)) {
+        if (Used)
+          *Used = Method::Hardlink;
+        return true;
+      }
+      llvm::sys::fs::remove(Tmp);
+    }
+  }
+
+#ifdef LEVITATION_HAS_CLONEFILE
+  // clonefile creates destination itself, and keeps source attributes,
+  // including modification time.
+  llvm::sys::fs::createUniquePath(
+      Dest + ".tmp-%%%%%%%%", Tmp, /*MakeAbsolute=*/false
+  );
+  SinglePath SrcZ = Src;
+  if (clonefile(SrcZ.c_str(), Tmp.c_str(), 0) == 0) {
+    if (!llvm::sys::fs::rename(Tmp, Dest)) {
+      if (Used)
+        *Used = Method::Reflink;
+      return true;
+    }
+    llvm::sys::fs::remove(Tmp);
+  }
+#endif
+
+  int FD;
+  if (llvm::sys::fs::createUniqueFile(Dest + ".tmp-%%%%%%%%", FD, Tmp))
+    return false;
+
+  auto CopyErr = copy(Src, FD, M);
+  if (!CopyErr && PreserveTime)
+    copyTime(Src, FD);
+  llvm::sys::Process::SafelyCloseFileDescriptor(FD);
+
+  if (CopyErr || llvm::sys::fs::rename(Tmp, Dest)) {
+    llvm::sys::fs::remove(Tmp);
+    return false;
+  }
+
+  if (Used)
+    *Used = M;
+  return true;
+}
+
+}}}
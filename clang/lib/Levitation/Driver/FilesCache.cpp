@@ -0,0 +1,224 @@
+//===--- C++ Levitation FilesCache.cpp --------------------------*- C++ -*-===//
+//
+// Part of the C++ Levitation Project,
+// under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file contains implementation of files cache shared by all
+//  driver phases.
+//
+//===----------------------------------------------------------------------===//
+
+#include "clang/Levitation/Common/Thread.h"
+#include "clang/Levitation/Driver/FilesCache.h"
+
+#include "llvm/ADT/Hashing.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+
+namespace clang { namespace levitation { namespace tools {
+
+namespace {
+
+  /// Buffer which refers to cached contents, and keeps them alive.
+  class SharedBuffer : public llvm::MemoryBuffer {
+    std::shared_ptr<llvm::MemoryBuffer> Contents;
+  public:
+    SharedBuffer(std::shared_ptr<llvm::MemoryBuffer> contents)
+    : Contents(std::move(contents)) {
+      init(
+          Contents->getBufferStart(),
+          Contents->getBufferEnd(),
+          /*RequiresNullTerminator=*/false
+      );
+    }
+
+    llvm::StringRef getBufferIdentifier() const override {
+      return Contents->getBufferIdentifier();
+    }
+
+    BufferKind getBufferKind() const override {
+      return Contents->getBufferKind();
+    }
+  };
+
+  class CachedFile : public llvm::vfs::File {
+    llvm::vfs::Status S;
+    std::shared_ptr<llvm::MemoryBuffer> Contents;
+
+  public:
+    CachedFile(llvm::vfs::Status S, std::shared_ptr<llvm::MemoryBuffer> C)
+    : S(std::move(S)), Contents(std::move(C)) {}
+
+    llvm::ErrorOr<llvm::vfs::Status> status() override { return S; }
+
+    llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> getBuffer(
+        const llvm::Twine &Name,
+        int64_t FileSize,
+        bool RequiresNullTerminator,
+        bool IsVolatile
+    ) override {
+      // Contents are always read with null terminator.
+      return std::unique_ptr<llvm::MemoryBuffer>(new SharedBuffer(Contents));
+    }
+
+    std::error_code close() override { return std::error_code(); }
+  };
+
+  class CachingFileSystem : public llvm::vfs::ProxyFileSystem {
+    FilesCache &Cache;
+  public:
+    CachingFileSystem(
+        FilesCache &cache,
+        llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> FS
+    )
+    : ProxyFileSystem(std::move(FS)), Cache(cache) {}
+
+    llvm::ErrorOr<llvm::vfs::Status> status(const llvm::Twine &Path) override {
+      return Cache.status(Path);
+    }
+
+    llvm::ErrorOr<std::unique_ptr<llvm::vfs::File>>
+    openFileForRead(const llvm::Twine &Path) override {
+      auto S = Cache.status(Path);
+      if (!S)
+        return S.getError();
+
+      auto Contents = Cache.getContents(Path);
+      if (!Contents)
+        return Contents.getError();
+
+      return std::unique_ptr<llvm::vfs::File>(
+          new CachedFile(std::move(*S), std::move(*Contents))
+      );
+    }
+  };
+}
+
+FilesCache::FilesCache(
+    llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> underlying
+)
+: Underlying(std::move(underlying)),
+  FS(new CachingFileSystem(*this, Underlying))
+{}
+
+FilesCache::~FilesCache() = default;
+
+std::string FilesCache::getKey(const llvm::Twine &Path) {
+  llvm::SmallString<256> Key;
+  Path.toVector(Key);
+  llvm::sys::fs::make_absolute(Key);
+  llvm::sys::path::remove_dots(Key, /*remove_dot_dot=*/true);
+  return Key.str().str();
+}
+
+FilesCache::Shard &FilesCache::getShard(llvm::StringRef Key) {
+  return Shards[llvm::hash_value(Key) % NUM_SHARDS];
+}
+
+llvm::ErrorOr<llvm::vfs::Status> FilesCache::status(const llvm::Twine &Path) {
+  auto Key = getKey(Path);
+  auto &S = getShard(Key);
+  uint64_t Generation;
+
+  {
+    auto _ = lock(S.Locker);
+    auto Found = S.Entries.find(Key);
+    if (Found != S.Entries.end() && Found->second.HasStatus) {
+      ++StatHits;
+      const auto &E = Found->second;
+      if (E.StatusError)
+        return E.StatusError;
+      return llvm::vfs::Status::copyWithNewName(E.Status, Path);
+    }
+    Generation = S.Generation;
+  }
+
+  ++StatMisses;
+
+  // Stat is done without lock, so other files of the shard
+  // are not blocked.
+  auto Res = Underlying->status(Key);
+
+  {
+    auto _ = lock(S.Locker);
+
+    // Some file of the shard was written meanwhile, it might be this one.
+    if (S.Generation == Generation) {
+      auto &E = S.Entries[Key];
+      E.HasStatus = true;
+      E.StatusError = Res.getError();
+      if (Res)
+        E.Status = *Res;
+    }
+  }
+
+  if (!Res)
+    return Res.getError();
+  return llvm::vfs::Status::copyWithNewName(*Res, Path);
+}
+
+llvm::ErrorOr<std::shared_ptr<llvm::MemoryBuffer>>
+FilesCache::getContents(const llvm::Twine &Path) {
+  auto Key = getKey(Path);
+  auto &S = getShard(Key);
+  uint64_t Generation;
+
+  {
+    auto _ = lock(S.Locker);
+    auto Found = S.Entries.find(Key);
+    if (Found != S.Entries.end() && Found->second.Contents) {
+      ++ReadHits;
+      return Found->second.Contents;
+    }
+    Generation = S.Generation;
+  }
+
+  ++ReadMisses;
+
+  auto Buffer = Underlying->getBufferForFile(Key);
+  if (!Buffer)
+    return Buffer.getError();
+
+  std::shared_ptr<llvm::MemoryBuffer> Contents(std::move(*Buffer));
+
+  {
+    auto _ = lock(S.Locker);
+    if (S.Generation == Generation) {
+      auto &E = S.Entries[Key];
+
+      // Someone else has read it while we were reading, so keep
+      // contents readers got first.
+      if (E.Contents)
+        return E.Contents;
+
+      E.Contents = Contents;
+    }
+  }
+
+  return Contents;
+}
+
+void FilesCache::invalidate(llvm::StringRef Path) {
+  auto Key = getKey(Path);
+  auto &S = getShard(Key);
+
+  auto _ = lock(S.Locker);
+  S.Entries.erase(Key);
+  ++S.Generation;
+}
+
+void FilesCache::clear() {
+  for (auto &S : Shards) {
+    auto _ = lock(S.Locker);
+    S.Entries.clear();
+    ++S.Generation;
+  }
+}
+
+}}}
@@ -0,0 +1,375 @@
+//===--- C++ Levitation InProcessCompiler.cpp -------------------*- C++ -*-===//
+//
+// Part of the C++ Levitation Project,
+// under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file contains implementation of in-process compiler.
+//
+//===----------------------------------------------------------------------===//
+
+#include "clang/Basic/Diagnostic.h"
+#include "clang/Basic/DiagnosticOptions.h"
+#include "clang/Basic/FileManager.h"
+#include "clang/CodeGen/ObjectFilePCHContainerOperations.h"
+#include "clang/Driver/Compilation.h"
+#include "clang/Driver/Driver.h"
+#include "clang/Driver/Job.h"
+#include "clang/Driver/Tool.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/CompilerInvocation.h"
+#include "clang/Frontend/TextDiagnosticPrinter.h"
+#include "clang/FrontendTool/Utils.h"
+#include "clang/Serialization/InMemoryModuleCache.h"
+
+#include "clang/Levitation/Common/Thread.h"
+#include "clang/Levitation/Driver/InProcessCompiler.h"
+
+#include "llvm/ADT/IntrusiveRefCntPtr.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/TimeProfiler.h"
+#include "llvm/Support/VirtualFileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace clang { namespace levitation { namespace tools {
+
+struct InProcessCompiler::Batch::State {
+  llvm::IntrusiveRefCntPtr<FileManager> FileMgr;
+  llvm::IntrusiveRefCntPtr<InMemoryModuleCache> ModuleCache;
+
+  State()
+  : FileMgr(
+      new FileManager(FileSystemOptions(), llvm::vfs::getRealFileSystem())
+    ),
+    ModuleCache(new InMemoryModuleCache())
+  {}
+};
+
+namespace {
+  thread_local InProcessCompiler::Batch::State *CurrentBatch = nullptr;
+
+  std::atomic<bool> WarmPreambleEnabled(false);
+
+  /// Preamble PCH shared by frontend jobs of process,
+  /// see InProcessCompiler::setWarmPreamble.
+  class WarmPreamble {
+    std::mutex Locker;
+    std::string Path;
+    llvm::sys::TimePoint<> ModTime;
+    uint64_t Size = 0;
+    std::shared_ptr<llvm::MemoryBuffer> Buffer;
+
+  public:
+    static WarmPreamble &get() {
+      static WarmPreamble Preamble;
+      return Preamble;
+    }
+
+    /// \return preamble buffer, or nullptr if preamble can't be read.
+    /// Buffer is owned by caller too, so it is kept alive until job
+    /// is finished, even if preamble is reloaded by other job meanwhile.
+    std::shared_ptr<llvm::MemoryBuffer> acquire(llvm::StringRef File) {
+      llvm::sys::fs::file_status Status;
+      if (llvm::sys::fs::status(File, Status))
+        return nullptr;
+
+      MutexLock _(Locker);
+
+      if (
+        Buffer && Path == File &&
+        Size == Status.getSize() &&
+        ModTime == Status.getLastModificationTime()
+      )
+        return Buffer;
+
+      auto Res = llvm::MemoryBuffer::getFile(
+          File, /*FileSize=*/-1, /*RequiresNullTerminator=*/false
+      );
+
+      if (!Res)
+        return nullptr;
+
+      Path = File.str();
+      Size = Status.getSize();
+      ModTime = Status.getLastModificationTime();
+      Buffer = std::move(Res.get());
+
+      return Buffer;
+    }
+  };
+
+  /// Puts warm preamble into module cache of compiler instance,
+  /// so that AST reader takes it from cache rather than from disk.
+  /// \return preamble buffer, which should be kept alive while
+  /// compiler instance is alive.
+  std::shared_ptr<llvm::MemoryBuffer> warmUpPreamble(CompilerInstance &Clang) {
+    llvm::StringRef File = Clang.getFrontendOpts().LevitationPreambleFileName;
+    if (File.empty())
+      return nullptr;
+
+    auto Buffer = WarmPreamble::get().acquire(File);
+    if (Buffer)
+      Clang.getModuleCache().addPCM(
+          File,
+          llvm::MemoryBuffer::getMemBuffer(
+              Buffer->getMemBufferRef(), /*RequiresNullTerminator=*/false
+          )
+      );
+
+    return Buffer;
+  }
+
+  void initializeTargets() {
+    static std::once_flag Initialized;
+    std::call_once(Initialized, [] {
+      llvm::InitializeAllTargets();
+      llvm::InitializeAllTargetMCs();
+      llvm::InitializeAllAsmPrinters();
+      llvm::InitializeAllAsmParsers();
+    });
+  }
+
+  /// Diagnostics engine which collects all messages into string,
+  /// so that messages from different worker threads are not mixed up.
+  class BufferedDiagnostics {
+    std::string Messages;
+    llvm::raw_string_ostream Out;
+    llvm::IntrusiveRefCntPtr<DiagnosticOptions> DiagOpts;
+
+    /// Where messages go instead of stderr, if set.
+    std::string *Dest;
+
+  public:
+    BufferedDiagnostics(std::string *Dest = nullptr)
+    : Out(Messages),
+      DiagOpts(new DiagnosticOptions()),
+      Dest(Dest)
+    {}
+
+    DiagnosticConsumer *createConsumer() {
+      return new TextDiagnosticPrinter(Out, DiagOpts.get());
+    }
+
+    std::unique_ptr<DiagnosticsEngine> createEngine() {
+      return std::make_unique<DiagnosticsEngine>(
+          llvm::IntrusiveRefCntPtr<DiagnosticIDs>(new DiagnosticIDs()),
+          DiagOpts.get(),
+          createConsumer(),
+          /*ShouldOwnClient=*/true
+      );
+    }
+
+    void flush() {
+      Out.flush();
+      if (Messages.empty())
+        return;
+
+      if (Dest) {
+        *Dest += Messages;
+        Messages.clear();
+        return;
+      }
+
+      // Print messages the same way as child clang process would do.
+      static std::mutex Locker;
+      {
+        MutexLock _(Locker);
+        llvm::errs() << Messages;
+        llvm::errs().flush();
+      }
+
+      Messages.clear();
+    }
+  };
+
+  bool isFrontendJob(const driver::Command &Cmd) {
+    return llvm::StringRef(Cmd.getCreator().getName()) == "clang" &&
+           !Cmd.getArguments().empty() &&
+           llvm::StringRef(Cmd.getArguments()[0]) == "-cc1";
+  }
+
+  bool runFrontend(
+      llvm::ArrayRef<const char*> CC1Args,
+      BufferedDiagnostics &Diag
+  ) {
+    auto *Batch = InProcessCompiler::Batch::getCurrent();
+
+    std::unique_ptr<CompilerInstance> Clang(
+        Batch ?
+        new CompilerInstance(
+            std::make_shared<PCHContainerOperations>(),
+            Batch->ModuleCache.get()
+        ) :
+        new CompilerInstance()
+    );
+
+    auto PCHOps = Clang->getPCHContainerOperations();
+    PCHOps->registerWriter(std::make_unique<ObjectFilePCHContainerWriter>());
+    PCHOps->registerReader(std::make_unique<ObjectFilePCHContainerReader>());
+
+    auto ArgsDiags = Diag.createEngine();
+
+    bool Success = CompilerInvocation::CreateFromArgs(
+        Clang->getInvocation(), CC1Args, *ArgsDiags
+    );
+
+    if (!Success)
+      return false;
+
+    // Driver passes -disable-free, since it expects process to die.
+    // We're going to live, so free everything we have allocated.
+    Clang->getFrontendOpts().DisableFree = false;
+
+    Clang->createDiagnostics(Diag.createConsumer(), /*ShouldOwnClient=*/true);
+    if (!Clang->hasDiagnostics())
+      return false;
+
+    // Batch file manager reads real files, so jobs which overlay
+    // them (unsaved files) create their own one.
+    if (Batch && Clang->getHeaderSearchOpts().VFSOverlayFiles.empty())
+      Clang->setFileManager(Batch->FileMgr.get());
+
+    // Batch keeps its AST files anyway, and its module cache outlives
+    // job, so it can't refer to buffer owned by job.
+    std::shared_ptr<llvm::MemoryBuffer> Preamble;
+    if (WarmPreambleEnabled && !Batch)
+      Preamble = warmUpPreamble(*Clang);
+
+    // Same as cc1_main does. Profiler is per thread,
+    // so traces of concurrent jobs are not mixed.
+    const auto &FrontendOpts = Clang->getFrontendOpts();
+    if (!FrontendOpts.TimeTrace)
+      return ExecuteCompilerInvocation(Clang.get());
+
+    llvm::timeTraceProfilerInitialize(
+        FrontendOpts.TimeTraceGranularity, "clang"
+    );
+
+    {
+      llvm::TimeTraceScope TimeScope("ExecuteCompiler");
+      Success = ExecuteCompilerInvocation(Clang.get());
+    }
+
+    SmallString<128> Path(FrontendOpts.OutputFile);
+    llvm::sys::path::replace_extension(Path, "json");
+    if (!FrontendOpts.LevitationTimeTraceOutput.empty())
+      Path = FrontendOpts.LevitationTimeTraceOutput;
+
+    std::error_code EC;
+    llvm::raw_fd_ostream Out(Path, EC, llvm::sys::fs::OF_Text);
+    if (!EC)
+      llvm::timeTraceProfilerWrite(Out);
+
+    llvm::timeTraceProfilerCleanup();
+
+    return Success;
+  }
+
+  bool runFrontendJob(const driver::Command &Cmd, BufferedDiagnostics &Diag) {
+    // Skip "-cc1", it is not a part of invocation arguments.
+    return runFrontend(llvm::makeArrayRef(Cmd.getArguments()).slice(1), Diag);
+  }
+}
+
+Failable InProcessCompiler::run(
+    llvm::ArrayRef<llvm::StringRef> Args,
+    std::string *Diagnostics
+) {
+
+  initializeTargets();
+
+  Failable Status;
+
+  assert(Args.size() && "Executable path is expected");
+
+  std::vector<std::string> ArgsStorage(Args.begin(), Args.end());
+  llvm::SmallVector<const char*, 64> Argv;
+  Argv.reserve(ArgsStorage.size());
+  for (const auto &A : ArgsStorage)
+    Argv.push_back(A.c_str());
+
+  BufferedDiagnostics Diag(Diagnostics);
+
+  // Frontend command line, no need in driver.
+  if (Argv.size() > 1 && llvm::StringRef(Argv[1]) == "-cc1") {
+    bool Successful = runFrontend(llvm::makeArrayRef(Argv).slice(2), Diag);
+    Diag.flush();
+    if (!Successful)
+      Status.setFailure() << "Frontend job '" << Argv[0] << "' failed.";
+    return Status;
+  }
+
+  auto DriverDiags = Diag.createEngine();
+
+  driver::Driver TheDriver(
+      Argv[0], llvm::sys::getDefaultTargetTriple(), *DriverDiags
+  );
+
+  std::unique_ptr<driver::Compilation> C(TheDriver.BuildCompilation(Argv));
+
+  if (!C || C->containsError()) {
+    Diag.flush();
+    Status.setFailure() << "Failed to build compilation for '"
+                        << Argv[0] << "'.";
+    return Status;
+  }
+
+  for (const auto &Job : C->getJobs()) {
+
+    bool Successful;
+    std::string ErrorMessage;
+
+    if (isFrontendJob(Job)) {
+      Successful = runFrontendJob(Job, Diag);
+    } else {
+      bool ExecutionFailed = false;
+      int Res = Job.Execute(/*Redirects*/{}, &ErrorMessage, &ExecutionFailed);
+      Successful = Res == 0 && !ExecutionFailed;
+    }
+
+    if (!Successful) {
+      Diag.flush();
+      Status.setFailure()
+      << "Job '" << Job.getExecutable() << "' failed. "
+      << ErrorMessage;
+      return Status;
+    }
+  }
+
+  Diag.flush();
+
+  return Status;
+}
+
+void InProcessCompiler::setWarmPreamble(bool Enabled) {
+  WarmPreambleEnabled = Enabled;
+}
+
+InProcessCompiler::Batch::Batch()
+: S(new State()), Prev(CurrentBatch) {
+  CurrentBatch = S.get();
+}
+
+InProcessCompiler::Batch::~Batch() {
+  CurrentBatch = Prev;
+}
+
+InProcessCompiler::Batch::State *InProcessCompiler::Batch::getCurrent() {
+  return CurrentBatch;
+}
+
+}}}
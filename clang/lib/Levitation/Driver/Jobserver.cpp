@@ -0,0 +1,244 @@
+//===--- C++ Levitation Jobserver.cpp ---------------------------*- C++ -*-===//
+//
+// Part of the C++ Levitation Project,
+// under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file contains implementation of GNU make jobserver
+//  client and server.
+//
+//===----------------------------------------------------------------------===//
+
+#include "clang/Levitation/Common/SimpleLogger.h"
+#include "clang/Levitation/Common/Thread.h"
+#include "clang/Levitation/Driver/Jobserver.h"
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Config/llvm-config.h"
+
+#include <string>
+
+#ifdef LLVM_ON_UNIX
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <unistd.h>
+#endif
+
+namespace clang { namespace levitation { namespace tools {
+
+namespace {
+  /// Interval of checking whether implicit slot was released,
+  /// while waiting for jobserver slot.
+  const int IMPLICIT_SLOT_POLL_MS = 50;
+
+#ifdef LLVM_ON_UNIX
+  /// Parses "<R>,<W>" descriptors pair.
+  bool parseFDs(llvm::StringRef Value, int &R, int &W) {
+    auto Parts = Value.split(',');
+    return !Parts.first.getAsInteger(10, R) &&
+           !Parts.second.getAsInteger(10, W);
+  }
+
+  bool isValidFD(int FD) {
+    return FD >= 0 && fcntl(FD, F_GETFD) != -1;
+  }
+#endif
+}
+
+Jobserver::~Jobserver() {
+#ifdef LLVM_ON_UNIX
+  if (!OwnsFDs)
+    return;
+
+  if (ReadFD >= 0)
+    close(ReadFD);
+
+  if (WriteFD >= 0 && WriteFD != ReadFD)
+    close(WriteFD);
+#endif
+}
+
+bool Jobserver::isSupported() {
+#ifdef LLVM_ON_UNIX
+  return true;
+#else
+  return false;
+#endif
+}
+
+Failable Jobserver::connect(bool &Found) {
+  Failable Status;
+  Found = false;
+
+#ifdef LLVM_ON_UNIX
+  const char *MakeFlags = getenv("MAKEFLAGS");
+  if (!MakeFlags)
+    return Status;
+
+  llvm::SmallVector<llvm::StringRef, 16> Flags;
+  llvm::StringRef(MakeFlags).split(Flags, ' ', -1, /*KeepEmpty=*/false);
+
+  // Last occurrence wins, same as for make itself.
+  llvm::StringRef Auth;
+  for (auto Flag : Flags) {
+    if (Flag.consume_front("--jobserver-auth=") ||
+        Flag.consume_front("--jobserver-fds="))
+      Auth = Flag;
+  }
+
+  if (Auth.empty())
+    return Status;
+
+  Found = true;
+
+  if (Auth.consume_front("fifo:")) {
+    std::string FifoPath = Auth.str();
+
+    // Own file description, so we may read it without blocking,
+    // and without affecting other jobserver clients.
+    int FD = open(FifoPath.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (FD < 0) {
+      Status.setFailure()
+      << "Failed to open jobserver fifo '" << FifoPath << "'.";
+      return Status;
+    }
+
+    ReadFD = WriteFD = FD;
+    OwnsFDs = true;
+    return Status;
+  }
+
+  int R, W;
+  if (!parseFDs(Auth, R, W)) {
+    Status.setFailure()
+    << "Malformed jobserver descriptors '" << Auth << "' in MAKEFLAGS.";
+    return Status;
+  }
+
+  // Make only passes descriptors to recipes it considers recursive.
+  if (!isValidFD(R) || !isValidFD(W)) {
+    Status.setFailure()
+    << "Jobserver descriptors are not inherited, "
+    << "prefix make recipe with '+' or use $(MAKE) in it.";
+    return Status;
+  }
+
+  ReadFD = R;
+  WriteFD = W;
+#endif
+
+  return Status;
+}
+
+Failable Jobserver::serve(unsigned Jobs) {
+  Failable Status;
+
+#ifdef LLVM_ON_UNIX
+  int FDs[2];
+
+  // Descriptors should be inherited by child processes.
+  if (pipe(FDs) != 0) {
+    Status.setFailure() << "Failed to create jobserver pipe.";
+    return Status;
+  }
+
+  ReadFD = FDs[0];
+  WriteFD = FDs[1];
+  OwnsFDs = true;
+
+  for (unsigned i = 1; i < Jobs; ++i) {
+    if (write(WriteFD, "+", 1) != 1) {
+      Status.setFailure() << "Failed to fill jobserver pipe.";
+      return Status;
+    }
+  }
+
+  std::string Auth = std::to_string(ReadFD) + "," + std::to_string(WriteFD);
+
+  std::string MakeFlags;
+  if (const char *Existing = getenv("MAKEFLAGS")) {
+    MakeFlags = Existing;
+    MakeFlags += " ";
+  }
+
+  MakeFlags +=
+      "-j" + std::to_string(Jobs) +
+      " --jobserver-auth=" + Auth +
+      " --jobserver-fds=" + Auth;
+
+  setenv("MAKEFLAGS", MakeFlags.c_str(), /*overwrite=*/1);
+#else
+  Status.setFailure() << "Jobserver is not supported on this host.";
+#endif
+
+  return Status;
+}
+
+bool Jobserver::takeImplicitSlot() {
+  auto _ = lock(Locker);
+  if (!ImplicitSlotFree)
+    return false;
+  ImplicitSlotFree = false;
+  return true;
+}
+
+void Jobserver::releaseSlot(bool Implicit, char Value) {
+  if (Implicit) {
+    auto _ = lock(Locker);
+    ImplicitSlotFree = true;
+    return;
+  }
+
+#ifdef LLVM_ON_UNIX
+  while (write(WriteFD, &Value, 1) < 0 && errno == EINTR);
+#endif
+}
+
+Jobserver::Slot Jobserver::acquire() {
+  if (!isEnabled())
+    return Slot(nullptr, /*Implicit=*/true, 0);
+
+  if (takeImplicitSlot())
+    return Slot(this, /*Implicit=*/true, 0);
+
+#ifdef LLVM_ON_UNIX
+  // While we wait for the pipe, implicit slot may be released
+  // by our own job, so we poll for both of them.
+  while (true) {
+    pollfd PFD = { ReadFD, POLLIN, 0 };
+    int Res = ::poll(&PFD, 1, IMPLICIT_SLOT_POLL_MS);
+
+    if (Res > 0) {
+      // Read end of inherited pipe is shared with make, and we
+      // can't switch it into non-blocking mode. So another client
+      // may steal the byte after poll, then read blocks until
+      // next slot is released.
+      char Value;
+      ssize_t Len = read(ReadFD, &Value, 1);
+      if (Len == 1)
+        return Slot(this, /*Implicit=*/false, Value);
+
+      if (Len == 0 || (errno != EINTR && errno != EAGAIN)) {
+        log::Logger::get().log_warning(
+            "Jobserver pipe is closed, running without jobserver."
+        );
+        return Slot(nullptr, /*Implicit=*/true, 0);
+      }
+    } else if (Res < 0 && errno != EINTR) {
+      return Slot(nullptr, /*Implicit=*/true, 0);
+    }
+
+    if (takeImplicitSlot())
+      return Slot(this, /*Implicit=*/true, 0);
+  }
+#else
+  return Slot(nullptr, /*Implicit=*/true, 0);
+#endif
+}
+
+}}}
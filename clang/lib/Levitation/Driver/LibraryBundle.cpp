@@ -0,0 +1,218 @@
+//===--- C++ Levitation LibraryBundle.cpp -----------------------*- C++ -*-===//
+//
+// Part of the C++ Levitation Project,
+// under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file contains implementation of prebuilt library bundle.
+//
+//===----------------------------------------------------------------------===//
+
+#include "clang/Levitation/Common/File.h"
+#include "clang/Levitation/Common/WithOperator.h"
+#include "clang/Levitation/Driver/LibraryBundle.h"
+
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/EndianStream.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+
+namespace clang { namespace levitation { namespace tools {
+
+namespace {
+  const char BUNDLE_MAGIC[4] = { 'L', 'B', 'N', 'D' };
+  const uint32_t BUNDLE_VERSION = 1;
+
+  /// Magic, version, number of units and reserved.
+  const uint64_t HEADER_SIZE = 16;
+
+  /// Unit ID and artifacts.
+  const unsigned NUM_ITEMS = LibraryBundle::NumArtifactKinds + 1;
+
+  /// Mask, reserved, then offset and size of each item.
+  const uint64_t UNIT_RECORD_SIZE = 8 + NUM_ITEMS * 16;
+
+  uint64_t alignTo8(uint64_t Size) {
+    return (Size + 7) & ~uint64_t(7);
+  }
+}
+
+LibraryBundle::LibraryBundle() = default;
+LibraryBundle::LibraryBundle(LibraryBundle &&) = default;
+LibraryBundle &LibraryBundle::operator=(LibraryBundle &&) = default;
+LibraryBundle::~LibraryBundle() = default;
+
+Failable LibraryBundle::open(llvm::StringRef BundleFile) {
+  // Declaration ASTs are large, so bundle is mapped rather than read.
+  auto Buf = llvm::MemoryBuffer::getFile(
+      BundleFile, /*FileSize=*/-1, /*RequiresNullTerminator=*/false
+  );
+
+  if (!Buf) {
+    Failable Status;
+    Status.setFailure()
+    << "Failed to open library bundle '" << BundleFile << "'.";
+    return Status;
+  }
+
+  return read(std::move(Buf.get()));
+}
+
+Failable LibraryBundle::read(std::unique_ptr<llvm::MemoryBuffer> Buf) {
+  Failable Status;
+
+  Units.clear();
+  Buffer = std::move(Buf);
+
+  llvm::StringRef Data = Buffer->getBuffer();
+  const char *Start = Data.data();
+
+  if (
+    Data.size() < HEADER_SIZE ||
+    Data.take_front(sizeof(BUNDLE_MAGIC)) !=
+        llvm::StringRef(BUNDLE_MAGIC, sizeof(BUNDLE_MAGIC))
+  ) {
+    Status.setFailure("Not a library bundle.");
+    return Status;
+  }
+
+  using namespace llvm::support::endian;
+
+  if (read32le(Start + 4) != BUNDLE_VERSION) {
+    Status.setFailure("Unsupported library bundle version.");
+    return Status;
+  }
+
+  uint64_t NumUnits = read32le(Start + 8);
+
+  if (NumUnits > (Data.size() - HEADER_SIZE) / UNIT_RECORD_SIZE) {
+    Status.setFailure("Library bundle is truncated.");
+    return Status;
+  }
+
+  Units.resize(NumUnits);
+
+  const char *Record = Start + HEADER_SIZE;
+  for (auto &U : Units) {
+    uint32_t Mask = read32le(Record);
+
+    for (unsigned i = 0; i != NUM_ITEMS; ++i) {
+      uint64_t Offset = read64le(Record + 8 + i * 16);
+      uint64_t Size = read64le(Record + 16 + i * 16);
+
+      if (Offset > Data.size() || Size > Data.size() - Offset) {
+        Units.clear();
+        Status.setFailure("Library bundle is truncated.");
+        return Status;
+      }
+
+      llvm::StringRef Item = Data.substr(Offset, Size);
+
+      if (i == 0)
+        U.UnitID = Item;
+      else if (Mask & (1u << (i - 1)))
+        U.set((ArtifactKind)(i - 1), Item);
+    }
+
+    if (U.UnitID.empty()) {
+      Units.clear();
+      Status.setFailure("Library bundle has unit without ID.");
+      return Status;
+    }
+
+    Record += UNIT_RECORD_SIZE;
+  }
+
+  return Status;
+}
+
+Failable LibraryBundle::save(
+    llvm::StringRef BundleFile,
+    llvm::ArrayRef<Unit> Units
+) {
+  Failable Status;
+
+  File F(BundleFile);
+  with (auto Scope = F.open()) {
+    write(Scope.getOutputStream(), Units);
+  }
+
+  if (F.hasErrors()) {
+    Status.setFailure()
+    << "Failed to write library bundle '" << BundleFile << "'.";
+  }
+
+  return Status;
+}
+
+void LibraryBundle::write(llvm::raw_ostream &OS, llvm::ArrayRef<Unit> Units) {
+  llvm::support::endian::Writer W(OS, llvm::support::little);
+
+  // Units are written in order of their IDs, so that
+  // same units always give same bundle.
+  std::vector<const Unit*> Sorted;
+  Sorted.reserve(Units.size());
+  for (const auto &U : Units)
+    Sorted.push_back(&U);
+
+  std::sort(Sorted.begin(), Sorted.end(), [] (const Unit *L, const Unit *R) {
+    return L->UnitID < R->UnitID;
+  });
+
+  auto getItem = [] (const Unit &U, unsigned i) {
+    return i == 0 ? U.UnitID : U.Artifacts[i - 1];
+  };
+
+  auto isPresent = [] (const Unit &U, unsigned i) {
+    return i == 0 || U.Present[i - 1];
+  };
+
+  OS.write(BUNDLE_MAGIC, sizeof(BUNDLE_MAGIC));
+  W.write<uint32_t>(BUNDLE_VERSION);
+  W.write<uint32_t>(Sorted.size());
+  W.write<uint32_t>(0);
+
+  uint64_t Offset = HEADER_SIZE + Sorted.size() * UNIT_RECORD_SIZE;
+
+  for (const auto *U : Sorted) {
+    uint32_t Mask = 0;
+    for (unsigned k = 0; k != NumArtifactKinds; ++k)
+      if (U->Present[k])
+        Mask |= 1u << k;
+
+    W.write<uint32_t>(Mask);
+    W.write<uint32_t>(0);
+
+    for (unsigned i = 0; i != NUM_ITEMS; ++i) {
+      if (!isPresent(*U, i)) {
+        W.write<uint64_t>(0);
+        W.write<uint64_t>(0);
+        continue;
+      }
+
+      auto Item = getItem(*U, i);
+      W.write<uint64_t>(Offset);
+      W.write<uint64_t>(Item.size());
+      Offset += alignTo8(Item.size());
+    }
+  }
+
+  for (const auto *U : Sorted) {
+    for (unsigned i = 0; i != NUM_ITEMS; ++i) {
+      if (!isPresent(*U, i))
+        continue;
+
+      auto Item = getItem(*U, i);
+      OS << Item;
+      for (uint64_t p = Item.size(), e = alignTo8(Item.size()); p != e; ++p)
+        W.write<uint8_t>(0);
+    }
+  }
+}
+
+}}}
@@ -0,0 +1,180 @@
+//===--- C++ Levitation LibraryCache.cpp ------------------------*- C++ -*-===//
+//
+// Part of the C++ Levitation Project,
+// under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file contains implementation of libraries artifacts cache.
+//
+//===----------------------------------------------------------------------===//
+
+#include "clang/Basic/Version.h"
+#include "clang/Levitation/Common/File.h"
+#include "clang/Levitation/Common/Path.h"
+#include "clang/Levitation/Common/SimpleLogger.h"
+#include "clang/Levitation/Driver/LibraryCache.h"
+
+#include "llvm/ADT/ScopeExit.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/LockFileManager.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace clang { namespace levitation { namespace tools {
+
+bool LibraryCache::fetch(
+    llvm::StringRef Key,
+    llvm::ArrayRef<BuildCache::Artifact> Artifacts
+) {
+  auto NotifyScope = llvm::make_scope_exit([&] {
+    for (const auto &A : Artifacts)
+      File::notifyChanged(A.Path);
+  });
+
+  for (const auto &A : Artifacts)
+    if (!Backend.fetch((Key + "." + A.Name).str(), A.Path))
+      return false;
+
+  return true;
+}
+
+bool LibraryCache::store(
+    llvm::StringRef Key,
+    llvm::ArrayRef<BuildCache::Artifact> Artifacts
+) {
+  for (const auto &A : Artifacts)
+    if (!Backend.store((Key + "." + A.Name).str(), A.Path))
+      return false;
+  return true;
+}
+
+bool LibraryCache::fetchOrFill(
+    llvm::StringRef Key,
+    llvm::ArrayRef<BuildCache::Artifact> Artifacts,
+    llvm::function_ref<bool()> Fn
+) {
+  if (!isEnabled() || Key.empty())
+    return Fn();
+
+  if (fetch(Key, Artifacts)) {
+    ++Hits;
+    return true;
+  }
+
+  auto Build = [&] {
+    ++Misses;
+    if (!Fn())
+      return false;
+
+    // Cache is only an optimization, failed store doesn't fail the build.
+    if (!store(Key, Artifacts))
+      log::Logger::get().log_verbose(
+          "Library cache: failed to store '", Key, "'."
+      );
+    return true;
+  };
+
+  SinglePath LockPath = Directory;
+  llvm::sys::path::append(LockPath, "locks", Key);
+  Path::createDirsForFile(LockPath);
+
+  // Lock is kept while entry is filled. Invocation which has failed
+  // to get lock waits for owner and takes its entry, or fills entry
+  // itself, if owner has died or has failed.
+  while (true) {
+    llvm::LockFileManager Lock(LockPath);
+
+    switch (Lock.getState()) {
+      case llvm::LockFileManager::LFS_Error:
+        log::Logger::get().log_verbose(
+            "Library cache: failed to lock '", Key, "', ",
+            Lock.getErrorMessage()
+        );
+        return Build();
+
+      case llvm::LockFileManager::LFS_Owned:
+        // Entry may have been filled while lock was taken.
+        if (fetch(Key, Artifacts)) {
+          ++Hits;
+          return true;
+        }
+
+        return Build();
+
+      case llvm::LockFileManager::LFS_Shared:
+        switch (Lock.waitForUnlock()) {
+          case llvm::LockFileManager::Res_Success:
+            if (fetch(Key, Artifacts)) {
+              ++Hits;
+              return true;
+            }
+            // Owner has failed, try to fill entry ourselves.
+            continue;
+
+          case llvm::LockFileManager::Res_OwnerDied:
+            continue;
+
+          case llvm::LockFileManager::Res_Timeout:
+            // Owner is taking too long, don't block the build.
+            Lock.unsafeRemoveLockFile();
+            return Build();
+        }
+    }
+  }
+}
+
+std::string LibraryCache::getLibraryHash(
+    llvm::StringRef LibraryRoot,
+    const Paths &Sources
+) {
+  std::vector<SinglePath> Sorted;
+  for (const auto &Src : Sources)
+    Sorted.push_back(Path::makeRelative<SinglePath>(
+        Path::makeAbsolute<SinglePath>(Src), LibraryRoot
+    ));
+
+  std::sort(Sorted.begin(), Sorted.end(), [] (
+      const SinglePath &L, const SinglePath &R
+  ) {
+    return L.str() < R.str();
+  });
+
+  BuildCacheKey Key;
+  for (const auto &Rel : Sorted) {
+    SinglePath Src = LibraryRoot;
+    llvm::sys::path::append(Src, Rel);
+
+    auto Buffer = llvm::MemoryBuffer::getFile(
+        Src, /*FileSize=*/-1, /*RequiresNullTerminator=*/false
+    );
+    if (!Buffer)
+      return "";
+
+    Key.add(Rel).add(Buffer.get()->getBuffer());
+  }
+
+  return Key.done();
+}
+
+std::string LibraryCache::getCompilerFingerprint(llvm::StringRef CompilerPath) {
+  BuildCacheKey Key;
+  Key.add(getClangFullVersion());
+
+  llvm::sys::fs::file_status Status;
+  if (!llvm::sys::fs::status(CompilerPath, Status)) {
+    Key.add(std::to_string(Status.getSize()));
+    Key.add(std::to_string(
+        Status.getLastModificationTime().time_since_epoch().count()
+    ));
+  }
+
+  return Key.done();
+}
+
+}}}
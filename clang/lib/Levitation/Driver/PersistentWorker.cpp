@@ -0,0 +1,143 @@
+//===--- C++ Levitation PersistentWorker.cpp --------------------*- C++ -*-===//
+//
+// Part of the C++ Levitation Project,
+// under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file contains implementation of persistent worker.
+//
+//===----------------------------------------------------------------------===//
+
+#include "clang/Levitation/Driver/DriverDefaults.h"
+#include "clang/Levitation/Driver/InProcessCompiler.h"
+#include "clang/Levitation/Driver/PersistentWorker.h"
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <iostream>
+#include <memory>
+#include <string>
+
+#ifdef LLVM_ON_UNIX
+#include <unistd.h>
+#endif
+
+namespace clang { namespace levitation { namespace tools {
+
+namespace {
+
+  /// Keeps files loaded by requests, while they are not changed.
+  class WarmFiles {
+    std::unique_ptr<InProcessCompiler::Batch> Batch;
+    unsigned NumRequests = 0;
+
+    /// Last known digests of request inputs.
+    llvm::StringMap<std::string> Digests;
+
+  public:
+
+    /// Drops loaded files if request inputs were changed, and makes
+    /// sure batch is alive for request.
+    void prepare(const WorkRequest &R) {
+      // Without digests there is no way to tell whether
+      // loaded files are still valid.
+      bool Stale =
+          R.Inputs.empty() ||
+          NumRequests >= DriverDefaults::WORKER_WARM_REQUESTS;
+
+      for (const auto &I : R.Inputs) {
+        auto Res = Digests.try_emplace(I.Path, I.Digest);
+        if (!Res.second && Res.first->second != I.Digest) {
+          Res.first->second = I.Digest;
+          Stale = true;
+        }
+      }
+
+      // Old batch should be gone before new one is created,
+      // since batches are stacked.
+      if (Stale) {
+        Batch.reset();
+        NumRequests = 0;
+      }
+
+      if (!Batch)
+        Batch = std::make_unique<InProcessCompiler::Batch>();
+
+      ++NumRequests;
+    }
+  };
+}
+
+int PersistentWorker::serve(
+    WorkerProtocol::Format F, llvm::StringRef ClangPath
+) {
+  // Stdout belongs to protocol, so anything else is sent to stderr,
+  // including output of subprocesses.
+  int ResponsesFD = 1;
+#ifdef LLVM_ON_UNIX
+  ResponsesFD = dup(1);
+  if (ResponsesFD < 0 || dup2(2, 1) < 0)
+    return 1;
+#endif
+
+  llvm::raw_fd_ostream Out(ResponsesFD, /*shouldClose=*/ResponsesFD != 1);
+  std::ios::sync_with_stdio(false);
+
+  InProcessCompiler::setWarmPreamble(true);
+
+  WarmFiles Files;
+  WorkRequest Request;
+
+  while (WorkerProtocol::read(F, std::cin, Request)) {
+    // Requests are executed one by one, so once cancellation
+    // comes, request is done anyway.
+    if (Request.Cancel)
+      continue;
+
+    WorkResponse Response;
+    Response.RequestID = Request.RequestID;
+
+    if (Request.Arguments.empty()) {
+      Response.ExitCode = 1;
+      Response.Output = "Empty work request.\n";
+      WorkerProtocol::write(F, Out, Response);
+      continue;
+    }
+
+    if (Request.SandboxDir.size()) {
+      Response.ExitCode = 1;
+      Response.Output = "Sandboxed work requests are not supported.\n";
+      WorkerProtocol::write(F, Out, Response);
+      continue;
+    }
+
+    Files.prepare(Request);
+
+    llvm::SmallVector<llvm::StringRef, 64> Args;
+    if (llvm::StringRef(Request.Arguments.front()) == "-cc1")
+      Args.push_back(ClangPath);
+    Args.append(Request.Arguments.begin(), Request.Arguments.end());
+
+    auto Status = InProcessCompiler::run(Args, &Response.Output);
+
+    if (!Status.isValid()) {
+      Response.ExitCode = 1;
+      Response.Output += Status.getErrorMessage();
+      Response.Output += "\n";
+    } else if (Status.hasWarnings()) {
+      Response.Output += Status.getWarningMessage();
+    }
+
+    WorkerProtocol::write(F, Out, Response);
+  }
+
+  return 0;
+}
+
+}}}
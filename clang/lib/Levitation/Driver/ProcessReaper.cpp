@@ -0,0 +1,297 @@
+//===--- C++ Levitation ProcessReaper.cpp -----------------------*- C++ -*-===//
+//
+// Part of the C++ Levitation Project,
+// under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file contains implementation of subprocesses reaper.
+//
+//===----------------------------------------------------------------------===//
+
+#include "clang/Levitation/Common/Thread.h"
+#include "clang/Levitation/Driver/ProcessReaper.h"
+
+#include "llvm/ADT/None.h"
+#include "llvm/Support/Program.h"
+
+#include <condition_variable>
+#include <utility>
+
+#ifdef __linux__
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Older libc headers don't know pidfd_open, though kernel may have it.
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+#endif
+
+namespace clang { namespace levitation { namespace tools {
+
+namespace {
+#ifdef __linux__
+  int openPidFD(int Pid) {
+    return (int)syscall(SYS_pidfd_open, Pid, 0);
+  }
+#endif
+}
+
+ProcessReaper::ProcessReaper() {
+#ifdef __linux__
+  int SelfFD = openPidFD(getpid());
+  if (SelfFD < 0)
+    return;
+  close(SelfFD);
+
+  WakeFD = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (WakeFD < 0)
+    return;
+
+  EpollFD = epoll_create1(EPOLL_CLOEXEC);
+  if (EpollFD < 0) {
+    close(WakeFD);
+    WakeFD = -1;
+    return;
+  }
+
+  epoll_event Event {};
+  Event.events = EPOLLIN;
+  Event.data.fd = WakeFD;
+  if (epoll_ctl(EpollFD, EPOLL_CTL_ADD, WakeFD, &Event) < 0) {
+    close(EpollFD);
+    close(WakeFD);
+    EpollFD = WakeFD = -1;
+    return;
+  }
+
+  Thread = std::thread([this] { run(); });
+#endif
+}
+
+ProcessReaper::~ProcessReaper() {
+#ifdef __linux__
+  if (!isEnabled())
+    return;
+
+  {
+    auto _ = lock(Locker);
+    StopRequested = true;
+  }
+
+  uint64_t One = 1;
+  while (write(WakeFD, &One, sizeof(One)) < 0 && errno == EINTR);
+
+  Thread.join();
+
+  // Children still running are left to init.
+  for (auto &C : Children)
+    close(C.first);
+
+  close(EpollFD);
+  close(WakeFD);
+#endif
+}
+
+void ProcessReaper::run() {
+#ifdef __linux__
+  const int MaxEvents = 32;
+  epoll_event Events[MaxEvents];
+
+  while (true) {
+    int N = epoll_wait(EpollFD, Events, MaxEvents, -1);
+    if (N < 0) {
+      if (errno == EINTR)
+        continue;
+      return;
+    }
+
+    for (int i = 0; i != N; ++i) {
+      int FD = Events[i].data.fd;
+
+      if (FD == WakeFD) {
+        uint64_t Value;
+        while (read(WakeFD, &Value, sizeof(Value)) < 0 && errno == EINTR);
+
+        auto _ = lock(Locker);
+        if (StopRequested)
+          return;
+        continue;
+      }
+
+      Child C;
+      {
+        auto _ = lock(Locker);
+        auto Found = Children.find(FD);
+        if (Found == Children.end())
+          continue;
+        C = std::move(Found->second);
+        Children.erase(Found);
+      }
+
+      epoll_ctl(EpollFD, EPOLL_CTL_DEL, FD, nullptr);
+      reap(FD, std::move(C));
+    }
+  }
+#endif
+}
+
+void ProcessReaper::reap(int PidFD, Child &&C) {
+#ifdef __linux__
+  ExitInfo Info;
+
+  // Wait for exit without reaping, so that PID is still reserved
+  // while exit is reported.
+  siginfo_t SigInfo;
+  int Res;
+  do {
+    Res = waitid(P_PID, C.Pid, &SigInfo, WEXITED | WNOWAIT);
+  } while (Res < 0 && errno == EINTR);
+
+  if (C.OnExiting)
+    C.OnExiting(C.Pid);
+
+  // Unlike getrusage(RUSAGE_CHILDREN), which reports maximum
+  // over all children, wait4 reports usage of particular child.
+  int WaitStatus;
+  struct rusage Usage;
+  pid_t Waited;
+  do {
+    Waited = wait4(C.Pid, &WaitStatus, 0, &Usage);
+  } while (Waited < 0 && errno == EINTR);
+
+  if (PidFD >= 0)
+    close(PidFD);
+
+  if (Res < 0 || Waited < 0) {
+    Info.ErrorMessage = "Error waiting for child process";
+  } else {
+    // Linux reports ru_maxrss in kilobytes.
+    Info.PeakMemory = (uint64_t)Usage.ru_maxrss * 1024;
+
+    if (WIFEXITED(WaitStatus)) {
+      Info.Code = WEXITSTATUS(WaitStatus);
+      if (Info.Code == 127)
+        Info.ErrorMessage = "Program could not be executed";
+    } else {
+      Info.Code = -2;
+      Info.ErrorMessage = "Program crashed";
+    }
+  }
+
+  if (C.OnExit)
+    C.OnExit(std::move(Info));
+#endif
+}
+
+int ProcessReaper::spawn(
+    llvm::StringRef Program,
+    llvm::ArrayRef<llvm::StringRef> Args,
+    std::string &ErrorMessage,
+    SpawnedFn OnSpawned,
+    ExitingFn OnExiting,
+    ExitFn OnExit
+) {
+  if (!isEnabled()) {
+    ErrorMessage = "Process reaper is not supported on this host";
+    return -1;
+  }
+
+#ifdef __linux__
+  bool ExecutionFailed = false;
+  auto PI = llvm::sys::ExecuteNoWait(
+      Program, Args, /*Env*/llvm::None, /*Redirects*/{},
+      /*memoryLimit*/0, &ErrorMessage, &ExecutionFailed
+  );
+  if (ExecutionFailed)
+    return -1;
+
+  int Pid = PI.Pid;
+
+  // Exit can't be reported before child is registered in reaper.
+  if (OnSpawned)
+    OnSpawned(Pid);
+
+  Child C { Pid, std::move(OnExiting), std::move(OnExit) };
+
+  // Child is not reaped by anybody else, so pidfd may be opened
+  // even if it has already exited.
+  int PidFD = openPidFD(Pid);
+  if (PidFD < 0) {
+    // E.g. out of descriptors, child is reaped by caller then.
+    reap(-1, std::move(C));
+    return Pid;
+  }
+
+  {
+    auto _ = lock(Locker);
+    Children[PidFD] = std::move(C);
+  }
+
+  epoll_event Event {};
+  Event.events = EPOLLIN;
+  Event.data.fd = PidFD;
+  if (epoll_ctl(EpollFD, EPOLL_CTL_ADD, PidFD, &Event) < 0) {
+    Child Taken;
+    {
+      auto _ = lock(Locker);
+      Taken = std::move(Children[PidFD]);
+      Children.erase(PidFD);
+    }
+    reap(PidFD, std::move(Taken));
+  }
+
+  return Pid;
+#else
+  return -1;
+#endif
+}
+
+int ProcessReaper::execute(
+    llvm::StringRef Program,
+    llvm::ArrayRef<llvm::StringRef> Args,
+    std::string &ErrorMessage,
+    uint64_t &PeakMemory,
+    SpawnedFn OnSpawned,
+    ExitingFn OnExiting
+) {
+  PeakMemory = 0;
+
+  std::mutex DoneLocker;
+  std::condition_variable DoneNotifier;
+  bool Done = false;
+  ExitInfo Result;
+
+  int Pid = spawn(
+      Program, Args, ErrorMessage,
+      std::move(OnSpawned), std::move(OnExiting),
+      [&] (ExitInfo &&Info) {
+        // Notified under lock, since waiter destroys notifier
+        // as soon as it sees Done.
+        auto _ = lock(DoneLocker);
+        Result = std::move(Info);
+        Done = true;
+        DoneNotifier.notify_one();
+      }
+  );
+
+  if (Pid < 0)
+    return -1;
+
+  auto locker = lock(DoneLocker);
+  DoneNotifier.wait(locker, [&] { return Done; });
+
+  PeakMemory = Result.PeakMemory;
+  ErrorMessage = std::move(Result.ErrorMessage);
+  return Result.Code;
+}
+
+}}}
@@ -0,0 +1,264 @@
+//===--- C++ Levitation SourcesWatcher.cpp ----------------------*- C++ -*-===//
+//
+// Part of the C++ Levitation Project,
+// under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file contains implementation of sources watcher.
+//
+//===----------------------------------------------------------------------===//
+
+#include "clang/Levitation/Common/SimpleLogger.h"
+#include "clang/Levitation/Driver/SourcesWatcher.h"
+#include "clang/Levitation/FileExtensions.h"
+
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+
+#include <chrono>
+#include <thread>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace clang { namespace levitation { namespace tools {
+
+namespace {
+  /// Time to wait for subsequent changes after first one.
+  const int BATCH_TIMEOUT_MS = 100;
+
+  /// Polling interval for hosts without file events support.
+  const int POLL_INTERVAL_MS = 500;
+
+  bool isSourceFile(llvm::StringRef Path) {
+    auto Ext = llvm::sys::path::extension(Path);
+    return Ext.size() && Ext.drop_front() == FileExtensions::SourceCode;
+  }
+
+  /// Editors create plenty of swap and backup files,
+  /// they are not worth a rebuild.
+  bool isTemporary(llvm::StringRef Path) {
+    auto Name = llvm::sys::path::filename(Path);
+    return Name.startswith(".") || Name.endswith("~");
+  }
+}
+
+SourcesWatcher::SourcesWatcher(llvm::StringRef root, llvm::StringRef ignoreDir)
+: Root(Path::makeAbsolute<SinglePath>(root)),
+  IgnoreDir(Path::makeAbsolute<SinglePath>(ignoreDir))
+{
+#ifdef __linux__
+  InotifyFD = inotify_init1(IN_CLOEXEC);
+  if (InotifyFD < 0) {
+    log::Logger::get().log_warning(
+        "Failed to initialize inotify, falling back to polling."
+    );
+  } else {
+    addWatches(Root);
+    return;
+  }
+#endif
+
+  takeSnapshot(Stamps);
+}
+
+SourcesWatcher::~SourcesWatcher() {
+#ifdef __linux__
+  if (InotifyFD >= 0)
+    close(InotifyFD);
+#endif
+}
+
+bool SourcesWatcher::isIgnored(llvm::StringRef AbsPath) const {
+  return AbsPath == IgnoreDir || isTemporary(AbsPath);
+}
+
+void SourcesWatcher::addChange(
+    Changes &C,
+    llvm::StringRef AbsPath,
+    bool SetChanged
+) const {
+  if (isIgnored(AbsPath))
+    return;
+
+  C.Files.insert(AbsPath);
+
+  if (SetChanged && isSourceFile(AbsPath))
+    C.SourcesSetChanged = true;
+}
+
+bool SourcesWatcher::wait(Changes &C) {
+  if (InotifyFD < 0)
+    return poll(C);
+
+  // Wait for first change, then collect everything what comes
+  // during batch timeout.
+  while (C.empty())
+    if (!readEvents(C, /*infinite*/-1))
+      return false;
+
+  while (readEvents(C, BATCH_TIMEOUT_MS));
+
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+// inotify
+
+void SourcesWatcher::addWatches(llvm::StringRef Dir) {
+#ifdef __linux__
+  if (isIgnored(Dir) && Dir != Root)
+    return;
+
+  int WD = inotify_add_watch(
+      InotifyFD,
+      SinglePath(Dir).c_str(),
+      IN_CREATE | IN_DELETE | IN_CLOSE_WRITE |
+      IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF
+  );
+
+  if (WD < 0) {
+    log::Logger::get().log_warning(
+        "Failed to watch directory '", Dir, "'."
+    );
+    return;
+  }
+
+  WatchedDirs[WD] = Dir;
+
+  std::error_code EC;
+  for (
+    llvm::sys::fs::directory_iterator It(Dir, EC), e;
+    It != e && !EC;
+    It.increment(EC)
+  ) {
+    if (It->type() == llvm::sys::fs::file_type::directory_file)
+      addWatches(It->path());
+  }
+#endif
+}
+
+/// Reads available events.
+/// \return false if no events were read during timeout.
+bool SourcesWatcher::readEvents(Changes &C, int TimeoutMs) {
+#ifdef __linux__
+  pollfd PFD = { InotifyFD, POLLIN, 0 };
+  int Res = ::poll(&PFD, 1, TimeoutMs);
+  if (Res <= 0)
+    return false;
+
+  alignas(inotify_event) char Buffer[16 * 1024];
+  ssize_t Len = read(InotifyFD, Buffer, sizeof(Buffer));
+  if (Len <= 0)
+    return false;
+
+  for (char *Ptr = Buffer; Ptr < Buffer + Len;) {
+    const auto *Event = reinterpret_cast<const inotify_event*>(Ptr);
+    Ptr += sizeof(inotify_event) + Event->len;
+
+    // Kernel has dropped some events, so we don't know what has changed.
+    if (Event->mask & IN_Q_OVERFLOW) {
+      C.SourcesSetChanged = true;
+      continue;
+    }
+
+    auto Found = WatchedDirs.find(Event->wd);
+    if (Found == WatchedDirs.end())
+      continue;
+
+    if (Event->mask & (IN_DELETE_SELF | IN_IGNORED)) {
+      WatchedDirs.erase(Found);
+      continue;
+    }
+
+    SinglePath FilePath = Found->second;
+    if (Event->len)
+      llvm::sys::path::append(FilePath, Event->name);
+
+    bool SetChanged =
+        Event->mask & (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO);
+
+    if (Event->mask & IN_ISDIR) {
+      if (isIgnored(FilePath))
+        continue;
+
+      if (Event->mask & (IN_CREATE | IN_MOVED_TO))
+        addWatches(FilePath);
+
+      // Whole directory with sources may be moved in or out.
+      if (SetChanged)
+        C.SourcesSetChanged = true;
+      continue;
+    }
+
+    addChange(C, FilePath, SetChanged);
+  }
+
+  return true;
+#else
+  return false;
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// Polling
+
+void SourcesWatcher::takeSnapshot(
+    llvm::StringMap<BuildState::FileStamp> &Snapshot
+) const {
+  Snapshot.clear();
+
+  std::error_code EC;
+  for (
+    llvm::sys::fs::recursive_directory_iterator It(Root, EC), e;
+    It != e && !EC;
+    It.increment(EC)
+  ) {
+    llvm::StringRef P = It->path();
+    if (isIgnored(P)) {
+      if (It->type() == llvm::sys::fs::file_type::directory_file)
+        It.no_push();
+      continue;
+    }
+
+    if (It->type() != llvm::sys::fs::file_type::regular_file)
+      continue;
+
+    if (auto Stamp = BuildState::getStamp(P))
+      Snapshot[P] = *Stamp;
+  }
+}
+
+bool SourcesWatcher::poll(Changes &C) {
+  llvm::StringMap<BuildState::FileStamp> NewStamps;
+
+  while (C.empty()) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(POLL_INTERVAL_MS));
+
+    takeSnapshot(NewStamps);
+
+    for (const auto &New : NewStamps) {
+      auto Old = Stamps.find(New.first());
+      if (Old == Stamps.end())
+        addChange(C, New.first(), /*SetChanged=*/true);
+      else if (Old->second != New.second)
+        addChange(C, New.first(), /*SetChanged=*/false);
+    }
+
+    for (const auto &Old : Stamps)
+      if (!NewStamps.count(Old.first()))
+        addChange(C, Old.first(), /*SetChanged=*/true);
+
+    std::swap(Stamps, NewStamps);
+  }
+
+  return true;
+}
+
+}}}
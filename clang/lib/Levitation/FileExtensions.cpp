@@ -21,11 +21,21 @@ namespace levitation {
   constexpr char FileExtensions::DeclASTMeta[];
   constexpr char FileExtensions::ObjMeta[];
   constexpr char FileExtensions::Object[];
+  constexpr char FileExtensions::IR[];
+  constexpr char FileExtensions::SplitDwarf[];
+  constexpr char FileExtensions::DwarfPackage[];
   constexpr char FileExtensions::DeclarationAST[];
   constexpr char FileExtensions::ParsedDependencies[];
   constexpr char FileExtensions::ParsedDependenciesMeta[];
   constexpr char FileExtensions::DirectDependencies[];
   constexpr char FileExtensions::FullDependencies[];
+  constexpr char FileExtensions::ResponseFile[];
+  constexpr char FileExtensions::TimeTrace[];
+  constexpr char FileExtensions::DependencyStats[];
+  constexpr char FileExtensions::SharedLibrary[];
+  constexpr char FileExtensions::TidyFixes[];
+  constexpr char FileExtensions::CheckStamp[];
+  constexpr char FileExtensions::TestLog[];
 
 }
 }
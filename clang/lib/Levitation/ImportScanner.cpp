@@ -0,0 +1,438 @@
+//===--- C++ Levitation ImportScanner.cpp -----------------------*- C++ -*-===//
+//
+// Part of the C++ Levitation Project,
+// under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file contains implementation of C++ Levitation import scanner.
+//
+//===----------------------------------------------------------------------===//
+
+#include "clang/Levitation/ImportScanner.h"
+#include "clang/Levitation/UnitID.h"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/Support/ErrorHandling.h"
+
+#include <algorithm>
+
+namespace clang { namespace levitation {
+
+namespace {
+  bool isHorizontalSpace(char C) {
+    return C == ' ' || C == '\t' || C == '\f' || C == '\v' || C == '\r';
+  }
+
+  bool isDigit(char C) {
+    return C >= '0' && C <= '9';
+  }
+
+  bool isIdentifierHead(char C) {
+    return (C >= 'a' && C <= 'z') || (C >= 'A' && C <= 'Z') ||
+           C == '_' || C == '$';
+  }
+
+  bool isIdentifierBody(char C) {
+    return isIdentifierHead(C) || isDigit(C);
+  }
+
+  bool isIdentifier(llvm::StringRef Tok) {
+    return Tok.size() && isIdentifierHead(Tok.front());
+  }
+
+  enum class DirectiveKind {
+    Import,
+    Public,
+    Body,
+    Include,
+    Define,
+    If,
+    Else,
+    EndIf,
+    Error,
+    Other,
+    Unknown
+  };
+
+  DirectiveKind getDirectiveKind(llvm::StringRef Name) {
+    return llvm::StringSwitch<DirectiveKind>(Name)
+        .Case("import", DirectiveKind::Import)
+        .Case("public", DirectiveKind::Public)
+        .Case("body", DirectiveKind::Body)
+        .Cases("include", "include_next", "__include_macros",
+               DirectiveKind::Include)
+        .Case("define", DirectiveKind::Define)
+        .Cases("if", "ifdef", "ifndef", DirectiveKind::If)
+        .Cases("elif", "else", DirectiveKind::Else)
+        .Case("endif", DirectiveKind::EndIf)
+        .Case("error", DirectiveKind::Error)
+        .Cases("undef", "line", "warning", "pragma", DirectiveKind::Other)
+        .Cases("ident", "sccs", "assert", "unassert", DirectiveKind::Other)
+        .Default(DirectiveKind::Unknown);
+  }
+}
+
+bool ImportScanner::unsupported(llvm::StringRef Reason) {
+  unsigned Line = 1 + Source.take_front(Cur - Source.begin()).count('\n');
+  setFailure()
+  << "line " << Line << ": " << Reason;
+  return false;
+}
+
+/// Skips backslash-newline sequence if it starts at current position.
+bool ImportScanner::skipSplice() {
+  if (*Cur != '\\')
+    return false;
+
+  const char *Next = Cur + 1;
+  if (Next != End && *Next == '\r')
+    ++Next;
+
+  if (Next == End || *Next != '\n')
+    return false;
+
+  Cur = Next + 1;
+  return true;
+}
+
+void ImportScanner::skipLineComment() {
+  while (Cur != End) {
+    if (skipSplice())
+      continue;
+    if (*Cur == '\n')
+      return;
+    ++Cur;
+  }
+}
+
+void ImportScanner::skipBlockComment() {
+  Cur += 2;
+  for (; Cur != End; ++Cur) {
+    if (*Cur == '*' && Cur + 1 != End && Cur[1] == '/') {
+      Cur += 2;
+      return;
+    }
+  }
+}
+
+void ImportScanner::skipQuoted(char Quote) {
+  ++Cur;
+  while (Cur != End) {
+    char C = *Cur;
+
+    // Skips escape sequences and splices as well.
+    if (C == '\\') {
+      Cur = std::min(Cur + 2, End);
+      continue;
+    }
+
+    // Unterminated literal, let clang complain about it.
+    if (C == '\n')
+      return;
+
+    ++Cur;
+
+    if (C == Quote)
+      return;
+  }
+}
+
+/// Skips raw string literal, current position should point to
+/// opening quote.
+void ImportScanner::skipRawString() {
+  const char *DelimBegin = ++Cur;
+
+  while (Cur != End && *Cur != '(' && *Cur != '"' && *Cur != '\n')
+    ++Cur;
+
+  if (Cur == End || *Cur != '(')
+    return;
+
+  llvm::SmallString<20> Terminator(")");
+  Terminator += llvm::StringRef(DelimBegin, Cur - DelimBegin);
+  Terminator += "\"";
+
+  llvm::StringRef Rest(Cur + 1, End - Cur - 1);
+  auto Pos = Rest.find(Terminator);
+
+  Cur = Pos == llvm::StringRef::npos ?
+      End : Rest.begin() + Pos + Terminator.size();
+}
+
+void ImportScanner::skipIdentifier() {
+  const char *Begin = Cur;
+  while (Cur != End && isIdentifierBody(*Cur))
+    ++Cur;
+
+  if (Cur == End || *Cur != '"')
+    return;
+
+  llvm::StringRef Prefix(Begin, Cur - Begin);
+  if (Prefix == "R" || Prefix == "u8R" || Prefix == "uR" ||
+      Prefix == "UR" || Prefix == "LR")
+    skipRawString();
+}
+
+/// Skips preprocessing number, it may contain digit separators,
+/// which should not be treated as char literal quotes.
+void ImportScanner::skipNumber() {
+  char Prev = 0;
+  while (Cur != End) {
+    char C = *Cur;
+    bool IsPart =
+        isIdentifierBody(C) || C == '.' ||
+        (C == '\'' && Cur + 1 != End && isIdentifierBody(Cur[1])) ||
+        ((C == '+' || C == '-') &&
+         (Prev == 'e' || Prev == 'E' || Prev == 'p' || Prev == 'P'));
+
+    if (!IsPart)
+      return;
+
+    Prev = C;
+    ++Cur;
+  }
+}
+
+/// Reads logical directive line, with splices and comments removed.
+/// Stops at the end of line, newline itself is not consumed.
+void ImportScanner::readDirectiveLine(llvm::SmallVectorImpl<char> &Line) {
+  while (Cur != End) {
+    if (skipSplice())
+      continue;
+
+    char C = *Cur;
+
+    if (C == '\n')
+      return;
+
+    if (C == '/' && Cur + 1 != End) {
+      if (Cur[1] == '/') {
+        skipLineComment();
+        return;
+      }
+      if (Cur[1] == '*') {
+        skipBlockComment();
+        Line.push_back(' ');
+        continue;
+      }
+    }
+
+    if (C == '"' || C == '\'') {
+      const char *Begin = Cur;
+      skipQuoted(C);
+      Line.append(Begin, Cur);
+      continue;
+    }
+
+    Line.push_back(C);
+    ++Cur;
+  }
+}
+
+void ImportScanner::tokenizeDirective(llvm::StringRef Line, TokensTy &Tokens) {
+  size_t Pos = 0, Size = Line.size();
+  while (Pos != Size) {
+    char C = Line[Pos];
+
+    if (isHorizontalSpace(C)) {
+      ++Pos;
+      continue;
+    }
+
+    size_t Begin = Pos++;
+
+    if (isIdentifierHead(C))
+      while (Pos != Size && isIdentifierBody(Line[Pos]))
+        ++Pos;
+    else if (C == ':' && Pos != Size && Line[Pos] == ':')
+      ++Pos;
+
+    Tokens.push_back(Line.slice(Begin, Pos));
+  }
+}
+
+bool ImportScanner::handleImport(
+    const TokensTy &Tokens,
+    PackageDependencies &Deps
+) {
+  if (ConditionalDepth)
+    return unsupported("#import within conditional block.");
+
+  // Clang reports an error for that case.
+  if (IncludeMet)
+    return unsupported("#import after #include.");
+
+  size_t I = 1, N = Tokens.size();
+
+  bool BodyDep = false;
+  if (I != N && Tokens[I] == "[") {
+    if (I + 2 >= N || Tokens[I + 1] != "bodydep" || Tokens[I + 2] != "]")
+      return unsupported("unknown #import attribute.");
+    BodyDep = true;
+    I += 3;
+  }
+
+  if (I != N && Tokens[I] == "::")
+    ++I;
+
+  llvm::SmallVector<llvm::StringRef, 16> Parts;
+  while (I != N) {
+    auto Part = Tokens[I++];
+
+    if (!isIdentifier(Part))
+      return unsupported("malformed #import identifier.");
+
+    if (DefinedMacros.count(Part))
+      return unsupported("#import identifier part is a macro.");
+
+    Parts.push_back(Part);
+
+    if (I == N)
+      break;
+
+    if (Tokens[I++] != "::" || I == N)
+      return unsupported("malformed #import identifier.");
+  }
+
+  if (Parts.empty())
+    return unsupported("#import without identifier.");
+
+  auto UnitID = UnitIDUtils::fromComponents(Parts);
+
+  if (!BodyDep && !BodyDirectiveMet)
+    Deps.addDeclarationPath(UnitID);
+  else
+    Deps.addDefinitionPath(UnitID);
+
+  return true;
+}
+
+bool ImportScanner::handleDirective(PackageDependencies &Deps) {
+  llvm::SmallString<128> Line;
+  readDirectiveLine(Line);
+
+  TokensTy Tokens;
+  tokenizeDirective(Line, Tokens);
+
+  bool IsFirst = FirstDirective;
+  FirstDirective = false;
+
+  // Null directive, or line marker.
+  if (Tokens.empty() || isDigit(Tokens.front().front()))
+    return true;
+
+  switch (getDirectiveKind(Tokens.front())) {
+    case DirectiveKind::Import:
+      return handleImport(Tokens, Deps);
+
+    case DirectiveKind::Public:
+      if (ConditionalDepth)
+        return unsupported("#public within conditional block.");
+      Deps.IsPublic = true;
+      return true;
+
+    case DirectiveKind::Body:
+      if (ConditionalDepth)
+        return unsupported("#body within conditional block.");
+      if (IsFirst && !HasTokens)
+        Deps.IsBodyOnly = true;
+      BodyDirectiveMet = true;
+      return true;
+
+    case DirectiveKind::Include:
+      IncludeMet = true;
+      return true;
+
+    case DirectiveKind::Define:
+      if (Tokens.size() > 1 && isIdentifier(Tokens[1]))
+        DefinedMacros.insert(Tokens[1]);
+      return true;
+
+    case DirectiveKind::If:
+      ++ConditionalDepth;
+      return true;
+
+    case DirectiveKind::Else:
+      return true;
+
+    case DirectiveKind::EndIf:
+      if (!ConditionalDepth)
+        return unsupported("#endif without #if.");
+      --ConditionalDepth;
+      return true;
+
+    case DirectiveKind::Error:
+      if (!ConditionalDepth)
+        return unsupported("#error directive.");
+      return true;
+
+    case DirectiveKind::Other:
+      return true;
+
+    case DirectiveKind::Unknown:
+      return unsupported("unknown directive.");
+  }
+
+  llvm_unreachable("Unknown directive kind");
+}
+
+bool ImportScanner::scan(PackageDependencies &Deps) {
+  while (Cur != End) {
+    char C = *Cur;
+
+    if (C == '\n') {
+      AtLineStart = true;
+      ++Cur;
+      continue;
+    }
+
+    if (isHorizontalSpace(C)) {
+      ++Cur;
+      continue;
+    }
+
+    if (skipSplice())
+      continue;
+
+    if (C == '/' && Cur + 1 != End) {
+      if (Cur[1] == '/') {
+        skipLineComment();
+        continue;
+      }
+      if (Cur[1] == '*') {
+        skipBlockComment();
+        continue;
+      }
+    }
+
+    if (C == '#' && AtLineStart) {
+      ++Cur;
+      if (!handleDirective(Deps))
+        return false;
+      continue;
+    }
+
+    AtLineStart = false;
+    HasTokens = true;
+
+    if (C == '"' || C == '\'')
+      skipQuoted(C);
+    else if (isIdentifierHead(C))
+      skipIdentifier();
+    else if (isDigit(C))
+      skipNumber();
+    else
+      ++Cur;
+  }
+
+  if (ConditionalDepth)
+    return unsupported("unterminated conditional block.");
+
+  return true;
+}
+
+}}
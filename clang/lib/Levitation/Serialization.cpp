@@ -1104,10 +1104,15 @@ namespace levitation {
 #define BLOCK(X) EmitBlockID(X ## _ID, #X, Writer, Record)
 #define RECORD(X) EmitRecordID(X ## _ID, #X, Writer, Record)
 
-        //  At current moment we should store only three arrays:
+        //  At current moment we should store only these arrays:
         //  0. Source hash
         //  1. Decl AST hash
-        //  2. Skipped bytes ranges.
+        //  2. Interface hash
+        //  3. Skipped bytes ranges.
+        //  4. Declaration hashes (optional).
+        //  5. Used declarations (optional).
+        //  6. Included legacy headers (optional).
+        //  7. Codeless unit flag (optional).
         //  So there is no reason in main block itself.
         //
         //  BLOCK(META_MAIN_BLOCK);
@@ -1119,10 +1124,25 @@ namespace levitation {
         BLOCK(META_ARRAYS_BLOCK);
         RECORD(META_SOURCE_HASH_RECORD);
         RECORD(META_DECL_AST_HASH_RECORD);
+        RECORD(META_INTERFACE_HASH_RECORD);
+        RECORD(META_HASH_KIND_RECORD);
 
         BLOCK(META_SKIPPED_FRAGMENT_BLOCK);
         RECORD(META_SKIPPED_FRAGMENT_RECORD);
 
+        BLOCK(META_DECL_HASHES_BLOCK);
+        RECORD(META_DECL_HASH_RECORD);
+
+        BLOCK(META_USED_DECLS_BLOCK);
+        RECORD(META_USED_DECLS_DEPENDENCY_RECORD);
+        RECORD(META_USED_DECL_RECORD);
+
+        BLOCK(META_INCLUDES_BLOCK);
+        RECORD(META_INCLUDE_RECORD);
+        RECORD(META_INCLUDE_HASH_RECORD);
+        RECORD(META_COMMAND_HASH_RECORD);
+        RECORD(META_CODELESS_RECORD);
+
 #undef RECORD
 #undef BLOCK
       }
@@ -1130,19 +1150,42 @@ namespace levitation {
 
     void write(const DeclASTMeta &Meta) {
 
-      with (auto MainBlockScope = enterBlock(META_ARRAYS_BLOCK_ID)) {
+      // Block has more than four abbreviations, so 3 bits are not enough.
+      with (auto MainBlockScope = enterBlock(META_ARRAYS_BLOCK_ID, 4)) {
         writeArrays(
             Meta.getSourceHash(),
-            Meta.getDeclASTHash()
+            Meta.getDeclASTHash(),
+            Meta.getInterfaceHash()
         );
 
+        // MD5 metas are kept same as before, so that they
+        // remain readable by older versions.
+        if (Meta.getHashKind() != HashKind::MD5)
+          writeHashKind(Meta.getHashKind());
+
         writeSkippedFragments(Meta.getFragmentsToSkip());
+
+        if (Meta.hasDeclHashes())
+          writeDeclHashes(Meta.getDeclHashes());
+
+        if (Meta.hasUsedDecls())
+          writeUsedDecls(Meta.getUsedDecls());
+
+        if (Meta.getIncludes().size())
+          writeIncludes(Meta.getIncludes());
+
+        if (Meta.getCommandHash().size())
+          writeCommandHash(Meta.getCommandHash());
+
+        if (Meta.isCodeless())
+          writeCodeless();
       }
     }
 
     void writeArrays(
         ArrayRef<uint8_t> SourceHash,
-        ArrayRef<uint8_t> DeclASTHash
+        ArrayRef<uint8_t> DeclASTHash,
+        ArrayRef<uint8_t> InterfaceHash
     ) {
       unsigned SourceHashRecordAbbrev = AbbrevsBuilder(META_SOURCE_HASH_RECORD_ID, Writer)
           .addArrayType<uint8_t>()
@@ -1162,6 +1205,54 @@ namespace levitation {
           DeclASTHash,
           DeclAstRecordAbbrev
       );
+
+      if (InterfaceHash.empty())
+        return;
+
+      unsigned InterfaceRecordAbbrev = AbbrevsBuilder(META_INTERFACE_HASH_RECORD_ID, Writer)
+          .addArrayType<uint8_t>()
+      .done();
+
+      Writer.EmitRecord(
+          META_INTERFACE_HASH_RECORD_ID,
+          InterfaceHash,
+          InterfaceRecordAbbrev
+      );
+    }
+
+    void writeCommandHash(ArrayRef<uint8_t> CommandHash) {
+      unsigned CommandHashAbbrev = AbbrevsBuilder(META_COMMAND_HASH_RECORD_ID, Writer)
+          .addArrayType<uint8_t>()
+      .done();
+
+      Writer.EmitRecord(
+          META_COMMAND_HASH_RECORD_ID,
+          CommandHash,
+          CommandHashAbbrev
+      );
+    }
+
+    void writeCodeless() {
+      unsigned CodelessAbbrev = AbbrevsBuilder(META_CODELESS_RECORD_ID, Writer)
+          .addFieldType<uint8_t>()
+      .done();
+
+      RecordData::value_type Record[] = { META_CODELESS_RECORD_ID, 1 };
+      Writer.EmitRecordWithAbbrev(CodelessAbbrev, Record);
+    }
+
+    void writeHashKind(HashKind Kind) {
+      unsigned HashKindAbbrev = AbbrevsBuilder(META_HASH_KIND_RECORD_ID, Writer)
+          .addFieldType<uint32_t>()
+          .addFieldType<uint8_t>()
+      .done();
+
+      RecordData::value_type Record[] = {
+          META_HASH_KIND_RECORD_ID,
+          META_HASH_KIND_VERSION,
+          (RecordData::value_type)Kind
+      };
+      Writer.EmitRecordWithAbbrev(HashKindAbbrev, Record);
     }
 
     void writeSkippedFragments(const DeclASTMeta::FragmentsVectorTy &SkippedFragments) {
@@ -1182,7 +1273,88 @@ namespace levitation {
       }
     }
 
+    void writeDeclHashes(const DeclASTMeta::DeclHashesVectorTy &DeclHashes) {
+
+      with (auto DeclHashesBlock = enterBlock(META_DECL_HASHES_BLOCK_ID)) {
+
+        // Hash (as low and high 32 bits), declaration name.
+        unsigned DeclHashAbbrev = AbbrevsBuilder(META_DECL_HASH_RECORD_ID, Writer)
+            .addFieldType<size_t>()
+            .addBlobType()
+        .done();
+
+        for (const auto &DeclHash : DeclHashes) {
+          RecordData::value_type Record[] = {
+              META_DECL_HASH_RECORD_ID,
+              low(DeclHash.Hash), high(DeclHash.Hash)
+          };
+          Writer.EmitRecordWithBlob(DeclHashAbbrev, Record, DeclHash.Name);
+        }
+      }
+    }
+
+    void writeUsedDecls(const DeclASTMeta::UsedDeclsVectorTy &UsedDecls) {
+
+      with (auto UsedDeclsBlock = enterBlock(META_USED_DECLS_BLOCK_ID)) {
+
+        unsigned DependencyAbbrev =
+            AbbrevsBuilder(META_USED_DECLS_DEPENDENCY_RECORD_ID, Writer)
+                .addBlobType()
+            .done();
+
+        unsigned UsedDeclAbbrev = AbbrevsBuilder(META_USED_DECL_RECORD_ID, Writer)
+            .addBlobType()
+        .done();
+
+        for (const auto &Used : UsedDecls) {
+          RecordData::value_type DependencyRecord[] = {
+              META_USED_DECLS_DEPENDENCY_RECORD_ID
+          };
+          Writer.EmitRecordWithBlob(
+              DependencyAbbrev, DependencyRecord, Used.DeclAST
+          );
+
+          for (const auto &Name : Used.Names) {
+            RecordData::value_type UsedDeclRecord[] = {
+                META_USED_DECL_RECORD_ID
+            };
+            Writer.EmitRecordWithBlob(UsedDeclAbbrev, UsedDeclRecord, Name);
+          }
+        }
+      }
+    }
+
+    void writeIncludes(const DeclASTMeta::IncludesVectorTy &Includes) {
+
+      with (auto IncludesBlock = enterBlock(META_INCLUDES_BLOCK_ID)) {
+
+        // MTime, size (each as low and high 32 bits), header path.
+        unsigned IncludeAbbrev = AbbrevsBuilder(META_INCLUDE_RECORD_ID, Writer)
+            .addFieldType<size_t>()
+            .addFieldType<size_t>()
+            .addBlobType()
+        .done();
+
+        unsigned HashAbbrev = AbbrevsBuilder(META_INCLUDE_HASH_RECORD_ID, Writer)
+            .addArrayType<uint8_t>()
+        .done();
+
+        for (const auto &Inc : Includes) {
+          RecordData::value_type Record[] = {
+              META_INCLUDE_RECORD_ID,
+              low(Inc.MTime), high(Inc.MTime),
+              low(Inc.Size), high(Inc.Size)
+          };
+          Writer.EmitRecordWithBlob(IncludeAbbrev, Record, Inc.Path);
+          Writer.EmitRecord(META_INCLUDE_HASH_RECORD_ID, Inc.Hash, HashAbbrev);
+        }
+      }
+    }
+
   private:
+    static uint64_t low(uint64_t V) { return V & ((1L << 32) - 1L); }
+    static uint64_t high(uint64_t V) { return V >> 32; }
+
     BlockScope enterBlock(unsigned BlockID, unsigned CodeLen = 3) {
       return BlockScope(Writer, BlockID, CodeLen);
     }
@@ -1254,6 +1426,128 @@ namespace levitation {
       );
     }
 
+    bool readDeclHashesBlock(DeclASTMeta &Meta) {
+      Log.log_trace("Reading declaration hashes block...");
+
+      // Block may be empty, still it means that hashes are present.
+      Meta.setDeclHashes({});
+
+      return parse(
+        {},
+        {
+          {
+            META_DECL_HASH_RECORD_ID,
+            [&](const RecordTy &Record, StringRef Name) {
+              size_t Hash;
+
+              RecordReader<RecordTy>(Record)
+                .read(Hash)
+                .done();
+
+              Meta.addDeclHash({Name.str(), Hash});
+              return true;
+            }
+          }
+        }
+      );
+    }
+
+    bool readUsedDeclsBlock(DeclASTMeta &Meta) {
+      Log.log_trace("Reading used declarations block...");
+
+      Meta.setUsedDecls({});
+
+      DeclASTMeta::UsedDeclsTy *Current = nullptr;
+
+      return parse(
+        {},
+        {
+          {
+            META_USED_DECLS_DEPENDENCY_RECORD_ID,
+            [&](const RecordTy &Record, StringRef DeclAST) {
+              Current = &Meta.addUsedDeclsDependency(DeclAST);
+              return true;
+            }
+          },
+          {
+            META_USED_DECL_RECORD_ID,
+            [&](const RecordTy &Record, StringRef Name) {
+              if (!Current) {
+                setFailure()
+                << "Used declaration record without dependency record.";
+                return false;
+              }
+              Current->Names.push_back(Name.str());
+              return true;
+            }
+          }
+        }
+      );
+    }
+
+    bool readIncludesBlock(DeclASTMeta &Meta) {
+      Log.log_trace("Reading includes block...");
+
+      DeclASTMeta::IncludeTy *Current = nullptr;
+
+      return parse(
+        {},
+        {
+          {
+            META_INCLUDE_RECORD_ID,
+            [&](const RecordTy &Record, StringRef Path) {
+              size_t MTime, Size;
+
+              RecordReader<RecordTy>(Record)
+                .read(MTime)
+                .read(Size)
+                .done();
+
+              Current = &Meta.addInclude(Path);
+              Current->MTime = MTime;
+              Current->Size = Size;
+              return true;
+            }
+          },
+          {
+            META_INCLUDE_HASH_RECORD_ID,
+            [&](const RecordTy &Record, StringRef _) {
+              if (!Current) {
+                setFailure()
+                << "Include hash record without include record.";
+                return false;
+              }
+              Current->Hash.assign(Record.begin(), Record.end());
+              return true;
+            }
+          }
+        }
+      );
+    }
+
+    bool readHashKind(DeclASTMeta &Meta, const RecordTy &Record) {
+      unsigned Version = 0, Kind = 0;
+
+      RecordReader<RecordTy>(Record)
+        .readcb([&](unsigned v) { Version = v; })
+        .readcb([&](unsigned v) { Kind = v; })
+        .done();
+
+      if (Version != META_HASH_KIND_VERSION) {
+        setFailure()
+        << "Unsupported hash record version " << Version << ".";
+        return false;
+      }
+
+      if (Kind > (unsigned)HashKind::XXH64) {
+        setFailure() << "Unknown hash algorithm " << Kind << ".";
+        return false;
+      }
+
+      Meta.setHashKind((HashKind)Kind);
+      return true;
+    }
+
     bool readData(DeclASTMeta &Meta) {
       if (!readBlockInfo())
         return false;
@@ -1267,6 +1561,18 @@ namespace levitation {
                 {
                   META_SKIPPED_FRAGMENT_BLOCK_ID,
                   [&] { return readSkippedFragmentBlock(Meta); }
+                },
+                {
+                  META_DECL_HASHES_BLOCK_ID,
+                  [&] { return readDeclHashesBlock(Meta); }
+                },
+                {
+                  META_USED_DECLS_BLOCK_ID,
+                  [&] { return readUsedDeclsBlock(Meta); }
+                },
+                {
+                  META_INCLUDES_BLOCK_ID,
+                  [&] { return readIncludesBlock(Meta); }
                 }
               },
               {
@@ -1285,6 +1591,37 @@ namespace levitation {
                     Meta.setDeclASTHash(Record);
                     return true;
                   }
+                },
+                {
+                  META_INTERFACE_HASH_RECORD_ID,
+                  [&](const RecordTy &Record, StringRef _) {
+                    Log.log_trace("Interface hash record...");
+                    Meta.setInterfaceHash(Record);
+                    return true;
+                  }
+                },
+                {
+                  META_HASH_KIND_RECORD_ID,
+                  [&](const RecordTy &Record, StringRef _) {
+                    Log.log_trace("Hash kind record...");
+                    return readHashKind(Meta, Record);
+                  }
+                },
+                {
+                  META_COMMAND_HASH_RECORD_ID,
+                  [&](const RecordTy &Record, StringRef _) {
+                    Log.log_trace("Command hash record...");
+                    Meta.setCommandHash(Record);
+                    return true;
+                  }
+                },
+                {
+                  META_CODELESS_RECORD_ID,
+                  [&](const RecordTy &Record, StringRef _) {
+                    Log.log_trace("Codeless record...");
+                    Meta.setCodeless(Record.size() && Record[0]);
+                    return true;
+                  }
                 }
               }
             );}
@@ -1302,6 +1639,613 @@ namespace levitation {
   ) {
     return std::make_unique<DeclASTMetaBitstreamReader>(MB);
   }
+
+  // ==========================================================================
+  // Build History Bitstream Writer
+
+  class BuildHistoryBitstreamWriter : public BuildHistoryWriter {
+  private:
+    static const size_t BUFFER_DEFAULT_SIZE = 4096;
+
+    llvm::raw_ostream &OutputStream;
+
+    SmallVector<char, BUFFER_DEFAULT_SIZE> Buffer;
+    BitstreamWriter Writer;
+
+    bool Finalized;
+
+  public:
+    BuildHistoryBitstreamWriter(llvm::raw_ostream &OS)
+        : OutputStream(OS),
+          Writer(Buffer),
+          Finalized(false) {}
+
+    ~BuildHistoryBitstreamWriter() override = default;
+
+    void writeAndFinalize(const BuildHistory &History) override {
+      if (Finalized)
+        llvm_unreachable("Can't write build history twice.");
+
+      writeSignature();
+
+      write(History);
+
+      OutputStream << Buffer;
+
+      Finalized = true;
+    }
+
+  private:
+
+    void writeSignature() {
+
+      // Note: only 4 first bytes can be used for magic number.
+      Writer.Emit((unsigned)'L', 8);
+      Writer.Emit((unsigned)'H', 8);
+      Writer.Emit((unsigned)'I', 8);
+      Writer.Emit((unsigned)'S', 8);
+
+      RecordData Record;
+
+      Writer.EnterBlockInfoBlock();
+      with (auto BlockInfoScope = make_scope_exit([&] { Writer.ExitBlock(); })) {
+
+#define BLOCK(X) EmitBlockID(X ## _ID, #X, Writer, Record)
+#define RECORD(X) EmitRecordID(X ## _ID, #X, Writer, Record)
+
+        BLOCK(HISTORY_MAIN_BLOCK);
+        RECORD(HISTORY_STEP_RECORD);
+        RECORD(HISTORY_PEAK_MEMORY_RECORD);
+        RECORD(HISTORY_INTERFACE_CHANGES_RECORD);
+
+#undef RECORD
+#undef BLOCK
+      }
+    }
+
+    void write(const BuildHistory &History) {
+      with (auto MainBlockScope = enterBlock(HISTORY_MAIN_BLOCK_ID)) {
+
+        // Step kind, duration (low and high 32 bits), unit path.
+        unsigned StepAbbrev = AbbrevsBuilder(HISTORY_STEP_RECORD_ID, Writer)
+            .addFieldType<uint8_t>()
+            .addFieldType<size_t>()
+            .addBlobType()
+        .done();
+
+        History.forEach([&] (
+            BuildHistory::StepKind Kind,
+            StringRef UnitPath,
+            BuildHistory::DurationTy Duration
+        ) {
+          RecordData::value_type Record[] = {
+              HISTORY_STEP_RECORD_ID,
+              (uint64_t)Kind,
+              Duration & ((1L << 32) - 1L),
+              Duration >> 32
+          };
+
+          Writer.EmitRecordWithBlob(StepAbbrev, Record, UnitPath);
+        });
+
+        // Step kind, peak memory (low and high 32 bits), unit path.
+        unsigned MemoryAbbrev =
+            AbbrevsBuilder(HISTORY_PEAK_MEMORY_RECORD_ID, Writer)
+            .addFieldType<uint8_t>()
+            .addFieldType<size_t>()
+            .addBlobType()
+        .done();
+
+        History.forEachPeakMemory([&] (
+            BuildHistory::StepKind Kind,
+            StringRef UnitPath,
+            BuildHistory::MemoryTy Memory
+        ) {
+          RecordData::value_type Record[] = {
+              HISTORY_PEAK_MEMORY_RECORD_ID,
+              (uint64_t)Kind,
+              Memory & ((1L << 32) - 1L),
+              Memory >> 32
+          };
+
+          Writer.EmitRecordWithBlob(MemoryAbbrev, Record, UnitPath);
+        });
+
+        // Number of interface changes, unit path.
+        unsigned ChangesAbbrev =
+            AbbrevsBuilder(HISTORY_INTERFACE_CHANGES_RECORD_ID, Writer)
+            .addFieldType<uint32_t>()
+            .addBlobType()
+        .done();
+
+        History.forEachInterfaceChanges([&] (
+            StringRef UnitPath,
+            unsigned N
+        ) {
+          RecordData::value_type Record[] = {
+              HISTORY_INTERFACE_CHANGES_RECORD_ID,
+              N
+          };
+
+          Writer.EmitRecordWithBlob(ChangesAbbrev, Record, UnitPath);
+        });
+      }
+    }
+
+    BlockScope enterBlock(unsigned BlockID, unsigned CodeLen = 3) {
+      return BlockScope(Writer, BlockID, CodeLen);
+    }
+  };
+
+  std::unique_ptr<BuildHistoryWriter> CreateBuildHistoryBitstreamWriter(
+      llvm::raw_ostream &OS
+  ) {
+    return std::make_unique<BuildHistoryBitstreamWriter>(OS);
+  }
+
+  // ==========================================================================
+  // Build History Bitstream Reader
+
+  class BuildHistoryBitstreamReader
+      : public LevitationBitstreamReader<
+          BuildHistory,
+          'L', 'H', 'I', 'S',
+          HISTORY_MAIN_BLOCK_ID
+        >,
+        public BuildHistoryReader
+  {
+    using RecordTy = SmallVector<uint64_t, 64>;
+  public:
+    BuildHistoryBitstreamReader(const llvm::MemoryBuffer &MemoryBuffer)
+        : LevitationBitstreamReader(MemoryBuffer) {}
+
+    ~BuildHistoryBitstreamReader() override = default;
+
+    bool read(BuildHistory &History) override {
+      if (!readSignature())
+        return false;
+
+      if (!readBlockInfo())
+        return false;
+
+      return parse(
+        {
+          {
+            HISTORY_MAIN_BLOCK_ID,
+            [&] { return parse(
+              {},
+              {
+                {
+                  HISTORY_STEP_RECORD_ID,
+                  [&](const RecordTy &Record, StringRef UnitPath) {
+                    unsigned Kind;
+                    size_t Duration;
+
+                    RecordReader<RecordTy>(Record)
+                      .read(Kind)
+                      .read(Duration)
+                      .done();
+
+                    if (Kind >= BuildHistory::NumStepKinds) {
+                      setWarning()
+                      << "Unknown build step kind " << Kind
+                      << " for '" << UnitPath << "', skipped.\n";
+                      return true;
+                    }
+
+                    History.setDuration(
+                        (BuildHistory::StepKind)Kind, UnitPath, Duration
+                    );
+                    return true;
+                  }
+                },
+                {
+                  HISTORY_PEAK_MEMORY_RECORD_ID,
+                  [&](const RecordTy &Record, StringRef UnitPath) {
+                    unsigned Kind;
+                    size_t Memory;
+
+                    RecordReader<RecordTy>(Record)
+                      .read(Kind)
+                      .read(Memory)
+                      .done();
+
+                    if (Kind >= BuildHistory::NumStepKinds) {
+                      setWarning()
+                      << "Unknown build step kind " << Kind
+                      << " for '" << UnitPath << "', skipped.\n";
+                      return true;
+                    }
+
+                    History.setPeakMemory(
+                        (BuildHistory::StepKind)Kind, UnitPath, Memory
+                    );
+                    return true;
+                  }
+                },
+                {
+                  HISTORY_INTERFACE_CHANGES_RECORD_ID,
+                  [&](const RecordTy &Record, StringRef UnitPath) {
+                    unsigned N;
+
+                    RecordReader<RecordTy>(Record)
+                      .read(N)
+                      .done();
+
+                    History.addInterfaceChanges(UnitPath, N);
+                    return true;
+                  }
+                }
+              }
+            );}
+          }
+        });
+    }
+
+    const Failable &getStatus() const override {
+      return *this;
+    }
+  };
+
+  std::unique_ptr<BuildHistoryReader> CreateBuildHistoryBitstreamReader(
+      const llvm::MemoryBuffer &MB
+  ) {
+    return std::make_unique<BuildHistoryBitstreamReader>(MB);
+  }
+
+  // ==========================================================================
+  // Build State Bitstream Writer
+
+  class BuildStateBitstreamWriter : public BuildStateWriter {
+  private:
+    static const size_t BUFFER_DEFAULT_SIZE = 4096;
+
+    llvm::raw_ostream &OutputStream;
+
+    SmallVector<char, BUFFER_DEFAULT_SIZE> Buffer;
+    BitstreamWriter Writer;
+
+    bool Finalized;
+
+  public:
+    BuildStateBitstreamWriter(llvm::raw_ostream &OS)
+        : OutputStream(OS),
+          Writer(Buffer),
+          Finalized(false) {}
+
+    ~BuildStateBitstreamWriter() override = default;
+
+    void writeAndFinalize(const BuildState &State) override {
+      if (Finalized)
+        llvm_unreachable("Can't write build state twice.");
+
+      writeSignature();
+
+      write(State);
+
+      OutputStream << Buffer;
+
+      Finalized = true;
+    }
+
+  private:
+
+    void writeSignature() {
+
+      // Note: only 4 first bytes can be used for magic number.
+      Writer.Emit((unsigned)'L', 8);
+      Writer.Emit((unsigned)'S', 8);
+      Writer.Emit((unsigned)'T', 8);
+      Writer.Emit((unsigned)'A', 8);
+
+      RecordData Record;
+
+      Writer.EnterBlockInfoBlock();
+      with (auto BlockInfoScope = make_scope_exit([&] { Writer.ExitBlock(); })) {
+
+#define BLOCK(X) EmitBlockID(X ## _ID, #X, Writer, Record)
+#define RECORD(X) EmitRecordID(X ## _ID, #X, Writer, Record)
+
+        BLOCK(STATE_MAIN_BLOCK);
+        RECORD(STATE_PRODUCT_RECORD);
+        RECORD(STATE_SOURCE_HASH_RECORD);
+        RECORD(STATE_PRODUCT_HASH_RECORD);
+        RECORD(STATE_INCLUDE_RECORD);
+        RECORD(STATE_COMMAND_HASH_RECORD);
+
+#undef RECORD
+#undef BLOCK
+      }
+    }
+
+    static uint64_t low(uint64_t V) { return V & ((1L << 32) - 1L); }
+    static uint64_t high(uint64_t V) { return V >> 32; }
+
+    void write(const BuildState &State) {
+      // Block has more than four abbreviations, so 3 bits are not enough.
+      with (auto MainBlockScope = enterBlock(STATE_MAIN_BLOCK_ID, 4)) {
+
+        // Source mtime, source size, product mtime, product size
+        // (each as low and high 32 bits), product path.
+        unsigned ProductAbbrev = AbbrevsBuilder(STATE_PRODUCT_RECORD_ID, Writer)
+            .addFieldType<size_t>()
+            .addFieldType<size_t>()
+            .addFieldType<size_t>()
+            .addFieldType<size_t>()
+            .addBlobType()
+        .done();
+
+        unsigned SourceHashAbbrev = AbbrevsBuilder(STATE_SOURCE_HASH_RECORD_ID, Writer)
+            .addArrayType<uint8_t>()
+        .done();
+
+        unsigned ProductHashAbbrev = AbbrevsBuilder(STATE_PRODUCT_HASH_RECORD_ID, Writer)
+            .addArrayType<uint8_t>()
+        .done();
+
+        unsigned CommandHashAbbrev = AbbrevsBuilder(STATE_COMMAND_HASH_RECORD_ID, Writer)
+            .addArrayType<uint8_t>()
+        .done();
+
+        // Header mtime, header size (each as low and high 32 bits),
+        // header path.
+        unsigned IncludeAbbrev = AbbrevsBuilder(STATE_INCLUDE_RECORD_ID, Writer)
+            .addFieldType<size_t>()
+            .addFieldType<size_t>()
+            .addBlobType()
+        .done();
+
+        State.forEach([&] (
+            StringRef ProductPath,
+            const BuildState::ProductState &S
+        ) {
+          RecordData::value_type Record[] = {
+              STATE_PRODUCT_RECORD_ID,
+              low(S.Source.MTime), high(S.Source.MTime),
+              low(S.Source.Size), high(S.Source.Size),
+              low(S.Product.MTime), high(S.Product.MTime),
+              low(S.Product.Size), high(S.Product.Size)
+          };
+
+          Writer.EmitRecordWithBlob(ProductAbbrev, Record, ProductPath);
+
+          Writer.EmitRecord(
+              STATE_SOURCE_HASH_RECORD_ID, S.SourceHash, SourceHashAbbrev
+          );
+          Writer.EmitRecord(
+              STATE_PRODUCT_HASH_RECORD_ID, S.ProductHash, ProductHashAbbrev
+          );
+
+          for (const auto &Inc : S.Includes) {
+            RecordData::value_type IncludeRecord[] = {
+                STATE_INCLUDE_RECORD_ID,
+                low(Inc.Stamp.MTime), high(Inc.Stamp.MTime),
+                low(Inc.Stamp.Size), high(Inc.Stamp.Size)
+            };
+            Writer.EmitRecordWithBlob(IncludeAbbrev, IncludeRecord, Inc.Path);
+          }
+
+          if (S.CommandHash.size())
+            Writer.EmitRecord(
+                STATE_COMMAND_HASH_RECORD_ID, S.CommandHash, CommandHashAbbrev
+            );
+        });
+      }
+    }
+
+    BlockScope enterBlock(unsigned BlockID, unsigned CodeLen = 3) {
+      return BlockScope(Writer, BlockID, CodeLen);
+    }
+  };
+
+  std::unique_ptr<BuildStateWriter> CreateBuildStateBitstreamWriter(
+      llvm::raw_ostream &OS
+  ) {
+    return std::make_unique<BuildStateBitstreamWriter>(OS);
+  }
+
+  // ==========================================================================
+  // Build State Bitstream Reader
+
+  class BuildStateBitstreamReader
+      : public LevitationBitstreamReader<
+          BuildState,
+          'L', 'S', 'T', 'A',
+          STATE_MAIN_BLOCK_ID
+        >,
+        public BuildStateReader
+  {
+    using RecordTy = SmallVector<uint64_t, 64>;
+  public:
+    BuildStateBitstreamReader(const llvm::MemoryBuffer &MemoryBuffer)
+        : LevitationBitstreamReader(MemoryBuffer) {}
+
+    ~BuildStateBitstreamReader() override = default;
+
+    bool read(BuildState &State) override {
+      if (!readSignature())
+        return false;
+
+      if (!readBlockInfo())
+        return false;
+
+      BuildState::ProductState *Current = nullptr;
+
+      auto readHash = [&] (
+          const RecordTy &Record,
+          HashVectorTy BuildState::ProductState::*Field
+      ) {
+        if (!Current) {
+          setFailure()
+          << "Hash record without product record.";
+          return false;
+        }
+        (Current->*Field).assign(Record.begin(), Record.end());
+        return true;
+      };
+
+      return parse(
+        {
+          {
+            STATE_MAIN_BLOCK_ID,
+            [&] { return parse(
+              {},
+              {
+                {
+                  STATE_PRODUCT_RECORD_ID,
+                  [&](const RecordTy &Record, StringRef ProductPath) {
+                    size_t SourceMTime, SourceSize, ProductMTime, ProductSize;
+
+                    RecordReader<RecordTy>(Record)
+                      .read(SourceMTime)
+                      .read(SourceSize)
+                      .read(ProductMTime)
+                      .read(ProductSize)
+                      .done();
+
+                    BuildState::ProductState S;
+                    S.Source.MTime = SourceMTime;
+                    S.Source.Size = SourceSize;
+                    S.Product.MTime = ProductMTime;
+                    S.Product.Size = ProductSize;
+
+                    Current = &State.set(ProductPath, std::move(S));
+                    return true;
+                  }
+                },
+                {
+                  STATE_SOURCE_HASH_RECORD_ID,
+                  [&](const RecordTy &Record, StringRef _) {
+                    return readHash(
+                        Record, &BuildState::ProductState::SourceHash
+                    );
+                  }
+                },
+                {
+                  STATE_PRODUCT_HASH_RECORD_ID,
+                  [&](const RecordTy &Record, StringRef _) {
+                    return readHash(
+                        Record, &BuildState::ProductState::ProductHash
+                    );
+                  }
+                },
+                {
+                  STATE_INCLUDE_RECORD_ID,
+                  [&](const RecordTy &Record, StringRef Path) {
+                    if (!Current) {
+                      setFailure()
+                      << "Include record without product record.";
+                      return false;
+                    }
+
+                    size_t MTime, Size;
+
+                    RecordReader<RecordTy>(Record)
+                      .read(MTime)
+                      .read(Size)
+                      .done();
+
+                    BuildState::IncludeState Inc;
+                    Inc.Path = Path.str();
+                    Inc.Stamp.MTime = MTime;
+                    Inc.Stamp.Size = Size;
+                    Current->Includes.push_back(std::move(Inc));
+                    return true;
+                  }
+                },
+                {
+                  STATE_COMMAND_HASH_RECORD_ID,
+                  [&](const RecordTy &Record, StringRef _) {
+                    return readHash(
+                        Record, &BuildState::ProductState::CommandHash
+                    );
+                  }
+                }
+              }
+            );}
+          }
+        });
+    }
+
+    const Failable &getStatus() const override {
+      return *this;
+    }
+  };
+
+  std::unique_ptr<BuildStateReader> CreateBuildStateBitstreamReader(
+      const llvm::MemoryBuffer &MB
+  ) {
+    return std::make_unique<BuildStateBitstreamReader>(MB);
+  }
+
+  //===--------------------------------------------------------------------===//
+  // Embedded meta
+
+  static const char EmbeddedMetaMagic[] = {'L', 'M', 'E', 'B'};
+  static const char MetaMagic[] = {'L', 'M', 'E', 'T'};
+
+  // Meta size and magic.
+  static const size_t EmbeddedMetaTrailerSize = 8;
+
+  // END_BLOCK abbreviation, aligned to 32 bits.
+  static const size_t EndBlockSize = 4;
+
+  void writeEmbeddedMeta(llvm::raw_ostream &OS, StringRef MetaBytes) {
+    SmallString<256> Blob(MetaBytes);
+    Blob.append(llvm::alignTo(MetaBytes.size(), 4) - MetaBytes.size(), '\0');
+
+    uint32_t Size = MetaBytes.size();
+    for (unsigned i = 0; i != 4; ++i)
+      Blob.push_back((char)(Size >> (i * 8)));
+    Blob.append(std::begin(EmbeddedMetaMagic), std::end(EmbeddedMetaMagic));
+
+    SmallVector<char, 256> Buffer;
+    llvm::BitstreamWriter Writer(Buffer);
+
+    Writer.EnterSubblock(EMBEDDED_META_BLOCK_ID, 3);
+
+    auto Abbrev = std::make_shared<llvm::BitCodeAbbrev>();
+    Abbrev->Add(llvm::BitCodeAbbrevOp(EMBEDDED_META_RECORD_ID));
+    Abbrev->Add(llvm::BitCodeAbbrevOp(llvm::BitCodeAbbrevOp::Blob));
+    unsigned AbbrevID = Writer.EmitAbbrev(std::move(Abbrev));
+
+    uint64_t Record[] = {EMBEDDED_META_RECORD_ID};
+    Writer.EmitRecordWithBlob(AbbrevID, Record, Blob);
+
+    Writer.ExitBlock();
+
+    OS.write(Buffer.data(), Buffer.size());
+  }
+
+  bool findEmbeddedMeta(StringRef Buffer, StringRef &MetaBytes) {
+    if (Buffer.startswith(StringRef(MetaMagic, sizeof(MetaMagic))))
+      return false;
+
+    if (Buffer.size() < EmbeddedMetaTrailerSize + EndBlockSize)
+      return false;
+
+    size_t TrailerEnd = Buffer.size() - EndBlockSize;
+    size_t TrailerStart = TrailerEnd - EmbeddedMetaTrailerSize;
+
+    StringRef Magic = Buffer.substr(TrailerStart + 4, sizeof(EmbeddedMetaMagic));
+    if (Magic != StringRef(EmbeddedMetaMagic, sizeof(EmbeddedMetaMagic)))
+      return false;
+
+    uint32_t Size = 0;
+    for (unsigned i = 0; i != 4; ++i)
+      Size |= (uint32_t)(uint8_t)Buffer[TrailerStart + i] << (i * 8);
+
+    uint64_t AlignedSize = llvm::alignTo(Size, 4);
+    if (AlignedSize > TrailerStart)
+      return false;
+
+    StringRef Found = Buffer.substr(TrailerStart - AlignedSize, Size);
+    if (!Found.startswith(StringRef(MetaMagic, sizeof(MetaMagic))))
+      return false;
+
+    MetaBytes = Found;
+    return true;
+  }
 }
 }
 
@@ -1906,6 +1906,12 @@ void Preprocessor::RegisterBuiltinPragmas() {
     AddPragmaHandler(new PragmaHdrstopHandler());
   }
 
+  // C++ Levitation
+  // #pragma cppl ... is read by levitation driver, see --hot-units.
+  if (LangOpts.LevitationMode)
+    AddPragmaHandler("cppl", new EmptyPragmaHandler());
+  // end of C++ Levitation
+
   // Pragmas added by plugins
   for (PragmaHandlerRegistry::iterator it = PragmaHandlerRegistry::begin(),
                                        ie = PragmaHandlerRegistry::end();
@@ -103,7 +103,7 @@ NamedDecl *Parser::ParseCXXInlineMethodDef(
   //  for we consider it as part of pure declaration.
   bool LevitationInlineFunction = false;
 
-  if (Actions.getLangOpts().LevitationMode) {
+  if (Actions.getLangOpts().LevitationMode && FnD) {
     if (auto F = dyn_cast<FunctionDecl>(FnD))
       // Note, that in C++ Levitation mode
       // F->isInlined is formed in a bit different way,
@@ -115,6 +115,12 @@ NamedDecl *Parser::ParseCXXInlineMethodDef(
       LevitationInlineFunction = true;
   }
 
+  // Small body is kept for dependents, so that they could inline it.
+  SourceLocation LevitationBodyStart = Tok.getLocation();
+  bool LevitationExportBody =
+      !LevitationInlineFunction && FnD &&
+      LevitationMayExportFunctionBody(FnD, LevitationBodyStart);
+
 
   // C++ Levitation: customize case when we skip function bodies.
   // Legacy code:
@@ -134,9 +140,12 @@ NamedDecl *Parser::ParseCXXInlineMethodDef(
       return FnD;
     }
   } else if (
-      !LevitationInlineFunction && (!FnD || Actions.canSkipFunctionBody(FnD)) &&
+      !LevitationInlineFunction && !LevitationExportBody &&
+      (!FnD || Actions.canSkipFunctionBody(FnD)) &&
       !PP.isCodeCompletionEnabled() /* here we expand trySkippingFunctionBody */ &&
-      Actions.getSourceManager().isInMainFile(FnD->getLocation())
+      Actions.getSourceManager().isInMainFile(
+          FnD ? FnD->getLocation() : Tok.getLocation()
+      )
   ) {
     // C++ Levitation: keep track of skipped source fragments, start
     SourceLocation LevitationStartSkip = Tok.getLocation();
@@ -224,6 +233,14 @@ NamedDecl *Parser::ParseCXXInlineMethodDef(
     }
   }
 
+  // C++ Levitation: body is parsed once class is complete,
+  // but its source fragment goes in order.
+  if (LevitationExportBody)
+    Actions.levitationAddExportedFunctionBody(
+        FnD, LevitationBodyStart, PrevTokLocation,
+        /*ReplaceWithSemicolon=*/true
+    );
+
   if (FnD) {
     FunctionDecl *FD = FnD->getAsFunction();
     // Track that this function will eventually have a body; Sema needs
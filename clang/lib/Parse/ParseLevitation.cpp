@@ -9,6 +9,7 @@
 //===----------------------------------------------------------------------===//
 
 #include "clang/AST/ASTConsumer.h"
+#include "clang/AST/Attr.h"
 #include "clang/Parse/Parser.h"
 #include "clang/Levitation/UnitID.h"
 #include "clang/Lex/Preprocessor.h"
@@ -17,6 +18,7 @@
 #include "clang/Sema/Sema.h"
 
 #include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/TimeProfiler.h"
 
 namespace clang {
   class Scope;
@@ -49,6 +51,10 @@ static SourceLocation getLastLoc(const Sema &Actions) {
 /// we're in unit's namespace.
 void Parser::LevitationEnterUnit(SourceLocation Start, SourceLocation End) {
 
+  llvm::TimeTraceScope TimeScope("LevitationEnterUnit", [&] {
+    return getPreprocessor().getPreprocessorOpts().LevitationUnitID;
+  });
+
   bool AtTUBounds = false;
 
   if (Start.isInvalid()) {
@@ -111,6 +117,10 @@ void Parser::LevitationEnterUnit(SourceLocation Start, SourceLocation End) {
 
 bool Parser::LevitationLeaveUnit(SourceLocation Start, SourceLocation End) {
 
+  llvm::TimeTraceScope TimeScope("LevitationLeaveUnit", [&] {
+    return getPreprocessor().getPreprocessorOpts().LevitationUnitID;
+  });
+
   bool AtTUBounds = false;
 
   if (Start.isInvalid()) {
@@ -165,6 +175,40 @@ bool Parser::LevitationOnParseEnd() {
   return true;
 }
 
+bool Parser::LevitationMayExportFunctionBody(Decl *D, SourceLocation Start) {
+  // Constructor initializers and function-try-blocks are not supported.
+  if (Tok.isNot(tok::l_brace) ||
+      !Actions.levitationMayExportFunctionBody(D, Start))
+    return false;
+
+  // Inlining was requested explicitly, whatever body size is.
+  if (D->getAsFunction()->hasAttr<AlwaysInlineAttr>())
+    return true;
+
+  unsigned MaxTokens = getLangOpts().LevitationExportBodies;
+
+  // Count body tokens and then put them back.
+  TentativeParsingAction PA(*this);
+
+  unsigned Depth = 0;
+  unsigned NumTokens = 0;
+  bool Small = false;
+
+  while (Tok.isNot(tok::eof) && NumTokens <= MaxTokens) {
+    if (Tok.is(tok::l_brace))
+      ++Depth;
+    else if (Tok.is(tok::r_brace) && --Depth == 0) {
+      Small = true;
+      break;
+    }
+    ++NumTokens;
+    ConsumeAnyToken();
+  }
+
+  PA.Revert();
+  return Small;
+}
+
 /// ParseLevitationGlobal - we're about to parse global namespace declaration
 ///
 ///       global-scope-definition: [C++: namespace.def]
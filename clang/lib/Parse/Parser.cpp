@@ -1337,10 +1337,12 @@ Decl *Parser::ParseFunctionDefinition(ParsingDeclarator &D,
   }
   else
   // Levitation altered
-  if (!Res || (
+  // Same as trySkippingFunctionBody, we can't skip bodies if code completion
+  // point may be inside.
+  if (!PP.isCodeCompletionEnabled() && (!Res || (
       Actions.canSkipFunctionBody(Res) &&
       Actions.levitationMayBeSkipFunctionDefinition(Res)
-  )) {
+  ))) {
     SourceLocation SkipStart;
     bool BurnWithSemicolon = false;
     if (Res) {
@@ -1363,6 +1365,15 @@ Decl *Parser::ParseFunctionDefinition(ParsingDeclarator &D,
       SkipStart = Tok.getLocation();
     }
 
+    // Small body is kept for dependents, so that they could inline it.
+    if (Res && LevitationMayExportFunctionBody(Res, SkipStart)) {
+      Decl *Parsed = ParseFunctionStatementBody(Res, BodyScope);
+      Actions.levitationAddExportedFunctionBody(
+          Res, SkipStart, PrevTokLocation, BurnWithSemicolon
+      );
+      return Parsed;
+    }
+
     levitation::SkipFunctionBody(PP, [&] { SkipFunctionBody(); });
 
     SourceLocation EndLoc = Tok.getLocation();
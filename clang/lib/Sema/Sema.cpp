@@ -927,6 +927,12 @@ void Sema::ActOnEndOfTranslationUnitFragment(TUFragmentKind Kind) {
                                LateParsedInstantiations.end());
   LateParsedInstantiations.clear();
 
+  // C++ Levitation
+  levitationInstantiateInterfaceSpecializations();
+  levitationCheckExportedBodies();
+  levitationEvaluateInterfaceConstants();
+  // end of C++ Levitation
+
   // If DefinedUsedVTables ends up marking any virtual member functions it
   // might lead to more pending template instantiations, which we then need
   // to instantiate.
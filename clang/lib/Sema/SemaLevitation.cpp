@@ -20,7 +20,11 @@
 #include "clang/Sema/SemaInternal.h"
 #include "clang/Sema/Template.h"
 #include "clang/Lex/Preprocessor.h"
+#include "clang/Lex/PreprocessorOptions.h"
 #include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SetVector.h"
+#include "llvm/Support/TimeProfiler.h"
 
 #include <iterator>
 #include <utility>
@@ -197,6 +201,8 @@ StringRef sourceFragmentActionToStr(levitation::SourceFragmentAction Action) {
       return "EndUnit";
     case levitation::SourceFragmentAction::EndUnitEOF:
       return "EndUnitEOF";
+    case levitation::SourceFragmentAction::ReplaceWithSemicolonInHeaderOnly:
+      return "ReplaceWithSemicolonInHeaderOnly";
   }
 }
 
@@ -224,6 +230,10 @@ void Sema::levitationAddSourceFragmentAction(
     levitation::SourceFragmentAction Action
 ) {
 
+  llvm::TimeTraceScope TimeScope("LevitationAddSourceFragment", [&] {
+    return getPreprocessor().getPreprocessorOpts().LevitationUnitID;
+  });
+
   auto StartSLoc = getSourceManager().getDecomposedLoc(Start);
   auto EndSLoc = getSourceManager().getDecomposedLoc(End);
 
@@ -402,6 +412,10 @@ void checkSortedNotOverlapped(const levitation::DeclASTMeta::FragmentsVectorTy&
 levitation::DeclASTMeta::FragmentsVectorTy
 Sema::levitationGetSourceFragments() const {
 
+  llvm::TimeTraceScope TimeScope("LevitationSourceFragments", [&] {
+    return getPreprocessor().getPreprocessorOpts().LevitationUnitID;
+  });
+
   checkSortedNotOverlapped(getPreprocessor().getLevitationSkippedFragments());
   checkSortedNotOverlapped(LevitationSkippedFragments);
 
@@ -461,3 +475,302 @@ void Sema::levitationActOnLeaveUnit(
 bool Sema::levitationUnitScopeNotEmpty() const {
   return LevitationUnitScope && !LevitationUnitScope->decls_empty();
 }
+
+// C++ Levitation Interface Specializations
+
+namespace {
+  /// Collects specializations which unit declarations use by value,
+  /// that is, those any user of declaration has to instantiate:
+  /// return and parameter types of functions, types of variables
+  /// and fields, and bases. Specializations only referred to through
+  /// pointers or references, or only named by typedefs, are skipped,
+  /// since a regular build might never instantiate them. Bodies and
+  /// initializers are not part of interface, and are not visited.
+  class InterfaceSpecializationsCollector
+  : public RecursiveASTVisitor<InterfaceSpecializationsCollector> {
+  public:
+    llvm::SetVector<
+        std::pair<ClassTemplateSpecializationDecl*, SourceLocation>
+    > Specializations;
+
+    void addType(QualType T, SourceLocation Loc) {
+      const Type *Ty = T->getBaseElementTypeUnsafe();
+      if (Ty->isDependentType())
+        return;
+
+      auto *Spec = dyn_cast_or_null<ClassTemplateSpecializationDecl>(
+          Ty->getAsCXXRecordDecl()
+      );
+
+      if (Spec && !Spec->hasDefinition() &&
+          Spec->getSpecializationKind() == TSK_Undeclared)
+        Specializations.insert({Spec, Loc});
+    }
+
+    bool TraverseStmt(Stmt *S, DataRecursionQueue *Queue = nullptr) {
+      return true;
+    }
+
+    bool VisitFunctionDecl(FunctionDecl *FD) {
+      if (FD->isDependentContext())
+        return true;
+
+      addType(FD->getReturnType(), FD->getLocation());
+      for (auto *P : FD->parameters())
+        addType(P->getType(), P->getLocation());
+
+      return true;
+    }
+
+    bool VisitVarDecl(VarDecl *VD) {
+      if (!isa<ParmVarDecl>(VD) && !VD->getDeclContext()->isDependentContext())
+        addType(VD->getType(), VD->getLocation());
+      return true;
+    }
+
+    bool VisitFieldDecl(FieldDecl *FD) {
+      if (!FD->getDeclContext()->isDependentContext())
+        addType(FD->getType(), FD->getLocation());
+      return true;
+    }
+
+    bool VisitCXXRecordDecl(CXXRecordDecl *RD) {
+      if (RD->isDependentContext() || !RD->isThisDeclarationADefinition())
+        return true;
+
+      for (const auto &Base : RD->bases())
+        addType(Base.getType(), Base.getBeginLoc());
+
+      return true;
+    }
+  };
+
+  /// Whether instantiation with such arguments won't fail
+  /// just because some argument is not complete yet.
+  /// Specializations not instantiated yet are fine, as long as
+  /// their own arguments are: they are instantiated on demand.
+  bool areArgumentsComplete(ArrayRef<TemplateArgument> Args) {
+    for (const auto &Arg : Args) {
+      switch (Arg.getKind()) {
+        case TemplateArgument::Type: {
+          const Type *Ty = Arg.getAsType().getTypePtr();
+          if (!Ty->isIncompleteType())
+            break;
+
+          auto *Spec = dyn_cast_or_null<ClassTemplateSpecializationDecl>(
+              Ty->getAsCXXRecordDecl()
+          );
+          if (Spec && Spec->getSpecializationKind() == TSK_Undeclared &&
+              areArgumentsComplete(Spec->getTemplateArgs().asArray()))
+            break;
+
+          return false;
+        }
+        case TemplateArgument::Pack:
+          if (!areArgumentsComplete(Arg.pack_elements()))
+            return false;
+          break;
+        default:
+          break;
+      }
+    }
+    return true;
+  }
+}
+
+void Sema::levitationInstantiateInterfaceSpecializations() {
+  if (!isLevitationMode(LangOptions::LBSK_BuildDeclAST) ||
+      !getLangOpts().LevitationInstantiateInterface)
+    return;
+
+  InterfaceSpecializationsCollector Collector;
+
+  for (auto *D : Context.getTranslationUnitDecl()->decls())
+    if (getSourceManager().isInMainFile(D->getLocation()))
+      Collector.TraverseDecl(D);
+
+  for (const auto &SpecLoc : Collector.Specializations) {
+    auto *Spec = SpecLoc.first;
+
+    if (Spec->hasDefinition() ||
+        !areArgumentsComplete(Spec->getTemplateArgs().asArray()))
+      continue;
+
+    isCompleteType(SpecLoc.second, Context.getRecordType(Spec));
+  }
+}
+
+namespace {
+  /// Evaluates initializer of D, if it is constexpr variable, and
+  /// initializers of constexpr variables declared within D, including
+  /// static data members of classes. Values are kept by variables,
+  /// and stored in Declaration AST along with them.
+  void evaluateConstants(Decl *D) {
+    if (auto *VD = dyn_cast<VarDecl>(D)) {
+      const Expr *Init = VD->getInit();
+      if (VD->isConstexpr() && VD->getStorageDuration() == SD_Static &&
+          Init && !VD->isInvalidDecl() &&
+          !VD->getType()->isDependentType() && !Init->isValueDependent())
+        VD->evaluateValue();
+      return;
+    }
+
+    if (auto *RD = dyn_cast<CXXRecordDecl>(D))
+      if (RD->isDependentContext())
+        return;
+
+    if (isa<NamespaceDecl>(D) || isa<LinkageSpecDecl>(D) ||
+        isa<CXXRecordDecl>(D))
+      for (auto *Inner : cast<DeclContext>(D)->decls())
+        evaluateConstants(Inner);
+  }
+}
+
+void Sema::levitationEvaluateInterfaceConstants() {
+  if (!isLevitationMode(LangOptions::LBSK_BuildDeclAST))
+    return;
+
+  for (auto *D : Context.getTranslationUnitDecl()->decls())
+    if (getSourceManager().isInMainFile(D->getLocation()))
+      evaluateConstants(D);
+}
+
+void Sema::levitationSetLTOVisibility(CXXRecordDecl *Record) {
+  if (!isLevitationMode(
+        LangOptions::LBSK_BuildDeclAST,
+        LangOptions::LBSK_BuildObjectFile
+      ) ||
+      !getLangOpts().LevitationHiddenLTOVisibility ||
+      !getLangOpts().LevitationPublicUnit)
+    return;
+
+  // Classes of dependencies are marked by their own units,
+  // and attribute is stored in declaration AST.
+  if (!Record->isDynamicClass() ||
+      Record->hasAttr<LTOVisibilityPublicAttr>() ||
+      !getSourceManager().isInMainFile(Record->getLocation()))
+    return;
+
+  Record->addAttr(LTOVisibilityPublicAttr::CreateImplicit(Context));
+}
+
+// C++ Levitation Exported Bodies
+
+namespace {
+  /// Checks whether dependents' copy of function body would behave
+  /// same as the one of unit's object.
+  class ExportedBodyChecker
+  : public RecursiveASTVisitor<ExportedBodyChecker> {
+  public:
+    bool Exportable = true;
+
+    bool reject() {
+      Exportable = false;
+      return false;
+    }
+
+    bool checkRef(const ValueDecl *D) {
+      if (!D || (!isa<FunctionDecl>(D) && !isa<VarDecl>(D)))
+        return true;
+
+      // Locals and parameters.
+      if (D->getDeclContext()->isFunctionOrMethod())
+        return true;
+
+      // Dependents can't link against symbols private to unit.
+      return D->isExternallyVisible() || reject();
+    }
+
+    bool VisitDeclRefExpr(DeclRefExpr *E) {
+      return checkRef(E->getDecl());
+    }
+
+    bool VisitMemberExpr(MemberExpr *E) {
+      return checkRef(E->getMemberDecl());
+    }
+
+    bool VisitCXXConstructExpr(CXXConstructExpr *E) {
+      return checkRef(E->getConstructor());
+    }
+
+    // Static locals and local types would be duplicated by each
+    // dependent, whereas they should be unique.
+    bool VisitVarDecl(VarDecl *VD) {
+      if (VD->isStaticLocal() ||
+          !isExternallyVisible(VD->getType()->getLinkage()))
+        return reject();
+      return true;
+    }
+
+    bool VisitTagDecl(TagDecl *) { return reject(); }
+    bool VisitLambdaExpr(LambdaExpr *) { return reject(); }
+    bool VisitBlockExpr(BlockExpr *) { return reject(); }
+  };
+}
+
+bool Sema::levitationMayExportFunctionBody(
+    const Decl *D,
+    SourceLocation Start
+) {
+  if (!isLevitationMode(LangOptions::LBSK_BuildDeclAST) ||
+      !getLangOpts().LevitationExportBodies)
+    return false;
+
+  const auto *FD = D ? D->getAsFunction() : nullptr;
+  if (!FD || FD->isMain() || !FD->isExternallyVisible())
+    return false;
+
+  auto &SM = getSourceManager();
+  if (!Start.isFileID() || !SM.isInMainFile(Start))
+    return false;
+
+  // Header-only fragment can't be merged with previous skipped
+  // fragment, e.g. with skipped initializer on same line.
+  return
+      LevitationSkippedFragments.empty() ||
+      LevitationSkippedFragments.back().End <= SM.getFileOffset(Start);
+}
+
+void Sema::levitationAddExportedFunctionBody(
+    Decl *D,
+    SourceLocation Start,
+    SourceLocation RBraceLoc,
+    bool ReplaceWithSemicolon
+) {
+  LevitationExportedBodies.push_back(D->getAsFunction());
+
+  auto End = getLocForEndOfToken(SourceMgr.getExpansionLoc(RBraceLoc));
+
+  // Body is not a part of generated header, but dependents are built
+  // against it, so unlike skipped one, it is a part of interface hash.
+  levitationAddSourceFragmentAction(
+      Start, End,
+      ReplaceWithSemicolon ?
+        levitation::SourceFragmentAction::ReplaceWithSemicolonInHeaderOnly :
+        levitation::SourceFragmentAction::SkipInHeaderOnly
+  );
+}
+
+void Sema::levitationCheckExportedBodies() {
+  for (auto *FD : LevitationExportedBodies) {
+    if (!FD->doesThisDeclarationHaveABody())
+      continue;
+
+    ExportedBodyChecker Checker;
+    if (auto *CD = dyn_cast<CXXConstructorDecl>(FD))
+      for (auto *Init : CD->inits())
+        Checker.TraverseStmt(Init->getInit());
+    Checker.TraverseStmt(FD->getBody());
+
+    if (Checker.Exportable) {
+      Context.addLevitationExportedBody(FD);
+      continue;
+    }
+
+    // Make it look as if body was skipped, as it is by default.
+    FD->setBody(nullptr);
+    FD->setHasSkippedBody();
+  }
+
+  LevitationExportedBodies.clear();
+}
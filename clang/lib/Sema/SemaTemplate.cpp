@@ -9310,6 +9310,10 @@ DeclResult Sema::ActOnExplicitInstantiation(
     TemplateTy TemplateD, SourceLocation TemplateNameLoc,
     SourceLocation LAngleLoc, ASTTemplateArgsPtr TemplateArgsIn,
     SourceLocation RAngleLoc, const ParsedAttributesView &Attr) {
+  // C++ Levitation
+  if (ExternLoc.isInvalid())
+    LevitationHasExplicitInstantiations = true;
+
   // Find the class template we're specializing
   TemplateName Name = TemplateD.get();
   TemplateDecl *TD = Name.getAsTemplateDecl();
@@ -9609,6 +9613,9 @@ Sema::ActOnExplicitInstantiation(Scope *S, SourceLocation ExternLoc,
                                  SourceLocation KWLoc, CXXScopeSpec &SS,
                                  IdentifierInfo *Name, SourceLocation NameLoc,
                                  const ParsedAttributesView &Attr) {
+  // C++ Levitation
+  if (ExternLoc.isInvalid())
+    LevitationHasExplicitInstantiations = true;
 
   bool Owned = false;
   bool IsDependent = false;
@@ -9722,6 +9729,10 @@ DeclResult Sema::ActOnExplicitInstantiation(Scope *S,
                                             SourceLocation ExternLoc,
                                             SourceLocation TemplateLoc,
                                             Declarator &D) {
+  // C++ Levitation
+  if (ExternLoc.isInvalid())
+    LevitationHasExplicitInstantiations = true;
+
   // Explicit instantiations always require a name.
   // TODO: check if/when DNInfo should replace Name.
   DeclarationNameInfo NameInfo = GetNameForDeclarator(D);
@@ -3101,6 +3101,7 @@ ASTReader::ReadASTBlock(ModuleFile &F, unsigned ClientLoadCapabilities) {
       case HEADER_SEARCH_TABLE:
       case IMPORTED_MODULES:
       case MACRO_OFFSET:
+      case LEVITATION_MACRO_NAMES:
         break;
       default:
         continue;
@@ -3237,6 +3238,17 @@ ASTReader::ReadASTBlock(ModuleFile &F, unsigned ClientLoadCapabilities) {
     case EAGERLY_DESERIALIZED_DECLS:
       // FIXME: Skip reading this record if our ASTConsumer doesn't care
       // about "interesting" decls (for instance, if we're building a module).
+
+      // C++ Levitation
+      // Declarations of Levitation dependency which must be emitted are
+      // emitted into dependency's own object file. Dependent units
+      // deserialize them only when name lookup touches them, otherwise
+      // every unit would load (and emit) them for its whole transitive
+      // closure.
+      if (F.Kind == MK_LevitationDependency)
+        break;
+      // end of C++ Levitation
+
       for (unsigned I = 0, N = Record.size(); I != N; ++I)
         EagerlyDeserializedDecls.push_back(getGlobalDeclID(F, Record[I]));
       break;
@@ -3278,11 +3290,26 @@ ASTReader::ReadASTBlock(ModuleFile &F, unsigned ClientLoadCapabilities) {
       break;
 
     case UNUSED_FILESCOPED_DECLS:
+      // C++ Levitation
+      // This record, and others referring to it, are only used to
+      // diagnose dependency's own code, which is done by dependency's
+      // own jobs. Sema of dependent unit
+      // would deserialize every listed declaration at the end of
+      // translation unit, and so it would touch every file of its
+      // transitive closure, whether unit uses it or not.
+      if (F.Kind == MK_LevitationDependency)
+        break;
+      // end of C++ Levitation
+
       for (unsigned I = 0, N = Record.size(); I != N; ++I)
         UnusedFileScopedDecls.push_back(getGlobalDeclID(F, Record[I]));
       break;
 
     case DELEGATING_CTORS:
+      // C++ Levitation: see UNUSED_FILESCOPED_DECLS.
+      if (F.Kind == MK_LevitationDependency)
+        break;
+
       for (unsigned I = 0, N = Record.size(); I != N; ++I)
         DelegatingCtorDecls.push_back(getGlobalDeclID(F, Record[I]));
       break;
@@ -3659,6 +3686,10 @@ ASTReader::ReadASTBlock(ModuleFile &F, unsigned ClientLoadCapabilities) {
       break;
 
     case UNDEFINED_BUT_USED:
+      // C++ Levitation: see UNUSED_FILESCOPED_DECLS.
+      if (F.Kind == MK_LevitationDependency)
+        break;
+
       if (UndefinedButUsed.size() % 2 != 0) {
         Error("Invalid existing UndefinedButUsed");
         return Failure;
@@ -3676,6 +3707,10 @@ ASTReader::ReadASTBlock(ModuleFile &F, unsigned ClientLoadCapabilities) {
       break;
 
     case DELETE_EXPRS_TO_ANALYZE:
+      // C++ Levitation: see UNUSED_FILESCOPED_DECLS.
+      if (F.Kind == MK_LevitationDependency)
+        break;
+
       for (unsigned I = 0, N = Record.size(); I != N;) {
         DelayedDeleteExprs.push_back(getGlobalDeclID(F, Record[I++]));
         const uint64_t Count = Record[I++];
@@ -3760,6 +3795,10 @@ ASTReader::ReadASTBlock(ModuleFile &F, unsigned ClientLoadCapabilities) {
       break;
 
     case UNUSED_LOCAL_TYPEDEF_NAME_CANDIDATES:
+      // C++ Levitation: see UNUSED_FILESCOPED_DECLS.
+      if (F.Kind == MK_LevitationDependency)
+        break;
+
       for (unsigned I = 0, N = Record.size(); I != N; ++I)
         UnusedLocalTypedefNameCandidates.push_back(
             getGlobalDeclID(F, Record[I]));
@@ -3819,6 +3858,11 @@ ASTReader::ReadASTBlock(ModuleFile &F, unsigned ClientLoadCapabilities) {
       break;
     }
 
+    case LEVITATION_MACRO_NAMES:
+      F.HasLevitationMacroNames = true;
+      F.LevitationMacroNames = Blob;
+      break;
+
     case DECLS_TO_CHECK_FOR_DEFERRED_DIAGS:
       for (unsigned I = 0, N = Record.size(); I != N; ++I)
         DeclsToCheckForDeferredDiags.push_back(getGlobalDeclID(F, Record[I]));
@@ -4788,10 +4832,6 @@ ASTReader::ReadASTCore(StringRef FileName,
                                             << FileName << !ErrorStr.empty()
                                             << ErrorStr;
     return Failure;
-
-  case ModuleManager::LevitationOutOfIDs:
-    Diag(diag::err_levitation_module_out_of_ids);
-    return Failure;
   }
 
   assert(M && "Missing module file");
@@ -8017,6 +8057,24 @@ void ASTReader::PrintStats() {
     GlobalIndex->printStats();
   }
 
+  // C++ Levitation
+  if (LevitationMode) {
+    MemoryBufferSizes Sizes(0, 0);
+    getMemoryBufferSizes(Sizes);
+    std::fprintf(stderr,
+                 "  %zu bytes of AST files mmapped (shared between jobs)\n",
+                 Sizes.mmap_bytes);
+    std::fprintf(stderr,
+                 "  %zu bytes of AST files in heap (private to this job)\n",
+                 Sizes.malloc_bytes);
+
+    if (LevitationNameIndex) {
+      std::fprintf(stderr, "\n");
+      LevitationNameIndex->printStats();
+    }
+  }
+  // end of C++ Levitation
+
   std::fprintf(stderr, "\n");
   dump();
   std::fprintf(stderr, "\n");
@@ -8191,6 +8249,34 @@ void ASTReader::UpdateSema() {
   }
 }
 
+void ASTReader::updateLevitationMacroModules() {
+  auto &Modules = ModuleMgr.LevitationModules;
+
+  // Modules are only removed on read failure, start over then.
+  if (NumLevitationModulesIndexed > Modules.size()) {
+    LevitationMacroModules.clear();
+    LevitationModulesWithoutMacroNames.clear();
+    NumLevitationModulesIndexed = 0;
+  }
+
+  for (auto e = Modules.size(); NumLevitationModulesIndexed != e;
+       ++NumLevitationModulesIndexed) {
+    ModuleFile *F = Modules[NumLevitationModulesIndexed];
+
+    if (!F->HasLevitationMacroNames) {
+      LevitationModulesWithoutMacroNames.push_back(F);
+      continue;
+    }
+
+    StringRef Names = F->LevitationMacroNames;
+    while (Names.size()) {
+      StringRef Name;
+      std::tie(Name, Names) = Names.split('\0');
+      LevitationMacroModules[Name].push_back(F);
+    }
+  }
+}
+
 IdentifierInfo *ASTReader::get(StringRef Name) {
   // Note that we are loading an identifier.
   Deserializing AnIdentifier(this);
@@ -8217,7 +8303,43 @@ IdentifierInfo *ASTReader::get(StringRef Name) {
       LangOptions::LBSK_BuildDeclAST,
       LangOptions::LBSK_BuildObjectFile
     )) {
-      for (auto F : ModuleMgr.LevitationModules)
+      updateLevitationMacroModules();
+
+      // Only files with macros of that name, and files without
+      // macro names record are visited. Latter ones are also skipped
+      // if name index knows they have nothing for this name.
+      // Name index knows nothing about files it doesn't have,
+      // or about files changed since it was built, so such files
+      // are visited anyway.
+      SmallVector<ModuleFile *, 4> Candidates;
+
+      auto Found = LevitationMacroModules.find(Name);
+      if (Found != LevitationMacroModules.end())
+        Candidates.append(Found->second.begin(), Found->second.end());
+
+      if (LevitationModulesWithoutMacroNames.size()) {
+        GlobalModuleIndex::HitSet Hits;
+        bool UseHits =
+            LevitationNameIndex &&
+            LevitationNameIndex->lookupIdentifier(Name, Hits);
+
+        for (auto F : LevitationModulesWithoutMacroNames) {
+          if (
+            UseHits &&
+            !Hits.count(F) &&
+            LevitationNameIndex->hasModuleFile(F)
+          )
+            continue;
+          Candidates.push_back(F);
+        }
+
+        // Keep loading order, as before.
+        llvm::sort(Candidates, [] (ModuleFile *L, ModuleFile *R) {
+          return L->LevitationModuleID < R->LevitationModuleID;
+        });
+      }
+
+      for (auto F : Candidates)
         if (Visitor(*F))
           break;
     }
@@ -8860,11 +8982,17 @@ bool ASTReader::DeclIsFromPCHWithObjectFile(const Decl *D) {
 ModuleFile *ASTReader::getLocalModuleFile(ModuleFile &F, unsigned ID) {
 
   if (LevitationMode) {
-    if (ID >= LEVITATION_NUM_RESERVED_NON_MODULES) {
-      return getModuleManager().LevitationModules[ID - LEVITATION_NUM_RESERVED_NON_MODULES];
-    }
+    // See getModuleFileID for encoding.
+    if (ID & 1)
+      return getModuleManager().LevitationModules[ID >> 1];
 
-    return getModuleManager().pch_modules().end()[-ID];
+    unsigned IndexFromEnd = ID >> 1;
+    assert(
+        IndexFromEnd &&
+        IndexFromEnd <= getModuleManager().pch_modules().size() &&
+        "got reference to unknown module file"
+    );
+    return getModuleManager().pch_modules().end()[-IndexFromEnd];
   }
 
   if (ID & 1) {
@@ -8892,14 +9020,18 @@ unsigned ASTReader::getModuleFileID(ModuleFile *F) {
   if (F->isModule())
     return ((F->BaseSubmoduleID + NUM_PREDEF_SUBMODULE_IDS) << 1) | 1;
 
+  // In Levitation mode low bit distinguishes Levitation modules from
+  // preamble PCHs, so that any number of chained preambles may be loaded:
+  //   (LevitationModuleID << 1) | 1 for Levitation modules,
+  //   (index from the end of PCH chain) << 1 for preambles.
   if (LevitationMode) {
     if (F->isLevitationModule())
-      return F->LevitationModuleID + LEVITATION_NUM_RESERVED_NON_MODULES;
+      return (F->LevitationModuleID << 1) | 1;
 
     auto PCHModules = getModuleManager().pch_modules();
     auto I = llvm::find(PCHModules, F);
     assert(I != PCHModules.end() && "emitting reference to unknown file");
-    return PCHModules.end() - I;
+    return (PCHModules.end() - I) << 1;
   }
 
   auto PCHModules = getModuleManager().pch_modules();
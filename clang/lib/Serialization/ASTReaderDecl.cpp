@@ -61,6 +61,7 @@
 #include "llvm/Support/Casting.h"
 #include "llvm/Support/ErrorHandling.h"
 #include "llvm/Support/SaveAndRestore.h"
+#include "llvm/Support/TimeProfiler.h"
 #include <algorithm>
 #include <cassert>
 #include <cstdint>
@@ -1400,6 +1401,52 @@ void ASTDeclReader::VisitIndirectFieldDecl(IndirectFieldDecl *FD) {
   mergeMergeable(FD);
 }
 
+// C++ Levitation: reads constant value stored by unit which
+// declares variable, see addConstantValue in ASTWriterDecl.cpp.
+static APValue readConstantValue(ASTRecordReader &Record) {
+  switch (static_cast<APValue::ValueKind>(Record.peekInt())) {
+  case APValue::Vector: {
+    Record.skipInts(1);
+    unsigned N = Record.readInt();
+    SmallVector<APValue, 4> Elts;
+    for (unsigned i = 0; i != N; ++i)
+      Elts.push_back(readConstantValue(Record));
+    return APValue(Elts.data(), N);
+  }
+  case APValue::Array: {
+    Record.skipInts(1);
+    unsigned InitElts = Record.readInt();
+    unsigned Size = Record.readInt();
+    APValue Res(APValue::UninitArray(), InitElts, Size);
+    for (unsigned i = 0; i != InitElts; ++i)
+      Res.getArrayInitializedElt(i) = readConstantValue(Record);
+    if (Res.hasArrayFiller())
+      Res.getArrayFiller() = readConstantValue(Record);
+    return Res;
+  }
+  case APValue::Struct: {
+    Record.skipInts(1);
+    unsigned NumBases = Record.readInt();
+    unsigned NumFields = Record.readInt();
+    APValue Res(APValue::UninitStruct(), NumBases, NumFields);
+    for (unsigned i = 0; i != NumBases; ++i)
+      Res.getStructBase(i) = readConstantValue(Record);
+    for (unsigned i = 0; i != NumFields; ++i)
+      Res.getStructField(i) = readConstantValue(Record);
+    return Res;
+  }
+  case APValue::Union: {
+    Record.skipInts(1);
+    auto *Field = Record.readDeclAs<FieldDecl>();
+    return APValue(Field, readConstantValue(Record));
+  }
+  default:
+    // Scalars are written by ASTRecordWriter::AddAPValue,
+    // kind is read along with them.
+    return Record.readAPValue();
+  }
+}
+
 ASTDeclReader::RedeclarableResult ASTDeclReader::VisitVarDeclImpl(VarDecl *VD) {
   RedeclarableResult Redecl = VisitRedeclarable(VD);
   VisitDeclaratorDecl(VD);
@@ -1438,6 +1485,14 @@ ASTDeclReader::RedeclarableResult ASTDeclReader::VisitVarDeclImpl(VarDecl *VD) {
       Eval->CheckedICE = true;
       Eval->IsICE = (Val & 1) != 0;
       Eval->HasConstantDestruction = (Val & 4) != 0;
+
+      // C++ Levitation: value evaluated by unit which declares variable.
+      if (Val & 8) {
+        Eval->Evaluated = readConstantValue(Record);
+        Eval->WasEvaluated = true;
+        if (Eval->Evaluated.needsCleanup())
+          Reader.getContext().addDestruction(&Eval->Evaluated);
+      }
     }
   }
 
@@ -2585,7 +2640,14 @@ void ASTDeclReader::mergeRedeclarable(Redeclarable<T> *DBase, T *Existing,
 
   // C++ Levitation extension:
   // Quit merging if we're not ready to.
+  llvm::Optional<llvm::TimeTraceScope> LevitationTimeScope;
   if (Reader.getContext().getLangOpts().LevitationMode) {
+    if (llvm::timeTraceProfilerEnabled())
+      LevitationTimeScope.emplace("LevitationMergeRedeclarable", [&] {
+        if (const auto *ND = dyn_cast<NamedDecl>(D))
+          return ND->getQualifiedNameAsString();
+        return std::string();
+      });
     if (const auto *ExistingND = dyn_cast<NamedDecl>(Existing))
       if (const auto *NewND = dyn_cast<NamedDecl>(D)) {
         if (!levitationCanMerge(ExistingND, NewND))
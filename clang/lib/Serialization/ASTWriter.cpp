@@ -98,6 +98,7 @@
 #include "llvm/Support/OnDiskHashTable.h"
 #include "llvm/Support/Path.h"
 #include "llvm/Support/SHA1.h"
+#include "llvm/Support/ThreadPool.h"
 #include "llvm/Support/VersionTuple.h"
 #include "llvm/Support/raw_ostream.h"
 #include <algorithm>
@@ -787,6 +788,7 @@ void ASTWriter::WriteBlockInfoBlock() {
   RECORD(CUDA_PRAGMA_FORCE_HOST_DEVICE_DEPTH);
   RECORD(PP_CONDITIONAL_STACK);
   RECORD(DECLS_TO_CHECK_FOR_DEFERRED_DIAGS);
+  RECORD(LEVITATION_MACRO_NAMES);
 
   // SourceManager Block.
   BLOCK(SOURCE_MANAGER_BLOCK);
@@ -1937,11 +1939,94 @@ void ASTWriter::WriteHeaderSearch(const HeaderSearch &HS) {
     free(const_cast<char *>(SavedStrings[I]));
 }
 
+// C++ Levitation
+namespace {
+
+/// Buffer blob, compressed before source manager block is written.
+struct PrecompressedBlob {
+  StringRef Blob;
+  SmallString<0> Compressed;
+  bool Succeeded = false;
+};
+
+} // end anonymous namespace
+
+/// Compresses blobs of local source location entries in parallel.
+/// Compression is the only part of source manager block, which doesn't
+/// depend on writer state, so the block itself is still written serially,
+/// and it is same as if blobs were compressed in place.
+static void precompressBlobs(SourceManager &SourceMgr, const Preprocessor &PP,
+                             std::vector<PrecompressedBlob> &Blobs,
+                             llvm::DenseMap<unsigned, unsigned> &Indices) {
+  if (!llvm::zlib::isAvailable())
+    return;
+
+  for (unsigned I = 1, N = SourceMgr.local_sloc_entry_size(); I != N; ++I) {
+    const SrcMgr::SLocEntry &SLoc = SourceMgr.getLocalSLocEntry(I);
+    if (!SLoc.isFile())
+      continue;
+
+    // Same entries WriteSourceManagerBlock emits blobs for.
+    const SrcMgr::ContentCache *Content = SLoc.getFile().getContentCache();
+    if (Content->OrigEntry && !Content->BufferOverridden &&
+        !Content->IsTransient)
+      continue;
+
+    // Buffers are loaded by writer thread only.
+    const llvm::MemoryBuffer *Buffer =
+        Content->getBuffer(PP.getDiagnostics(), PP.getFileManager());
+
+    Indices[I] = Blobs.size();
+    Blobs.emplace_back();
+    Blobs.back().Blob =
+        StringRef(Buffer->getBufferStart(), Buffer->getBufferSize() + 1);
+  }
+
+  // Declaration AST jobs run in parallel anyway, so single blob
+  // is not worth a thread, and few threads are enough.
+  const unsigned MaxThreads = 4;
+  if (Blobs.size() < 2) {
+    Blobs.clear();
+    Indices.clear();
+    return;
+  }
+
+  llvm::ThreadPool Pool(llvm::hardware_concurrency(
+      std::min<unsigned>(Blobs.size(), MaxThreads)));
+
+  for (auto &B : Blobs)
+    Pool.async([&B] {
+      llvm::Error E = llvm::zlib::compress(B.Blob.drop_back(1), B.Compressed);
+      B.Succeeded = !E;
+      llvm::consumeError(std::move(E));
+    });
+
+  Pool.wait();
+}
+// end of C++ Levitation
+
 static void emitBlob(llvm::BitstreamWriter &Stream, StringRef Blob,
                      unsigned SLocBufferBlobCompressedAbbrv,
-                     unsigned SLocBufferBlobAbbrv) {
+                     unsigned SLocBufferBlobAbbrv,
+                     const PrecompressedBlob *Precompressed = nullptr) {
   using RecordDataType = ASTWriter::RecordData::value_type;
 
+  // C++ Levitation
+  if (Precompressed) {
+    if (Precompressed->Succeeded) {
+      RecordDataType Record[] = {SM_SLOC_BUFFER_BLOB_COMPRESSED,
+                                 Blob.size() - 1};
+      Stream.EmitRecordWithBlob(SLocBufferBlobCompressedAbbrv, Record,
+                                Precompressed->Compressed);
+      return;
+    }
+
+    RecordDataType Record[] = {SM_SLOC_BUFFER_BLOB};
+    Stream.EmitRecordWithBlob(SLocBufferBlobAbbrv, Record, Blob);
+    return;
+  }
+  // end of C++ Levitation
+
   // Compress the buffer if possible. We expect that almost all PCM
   // consumers will not want its contents.
   SmallString<0> CompressedBuffer;
@@ -1984,6 +2069,15 @@ void ASTWriter::WriteSourceManagerBlock(SourceManager &SourceMgr,
       CreateSLocBufferBlobAbbrev(Stream, true);
   unsigned SLocExpansionAbbrv = CreateSLocExpansionAbbrev(Stream);
 
+  // C++ Levitation
+  // Declaration AST keeps buffers of remapped (e.g. in-process builds)
+  // and generated files, each of them is compressed.
+  std::vector<PrecompressedBlob> Precompressed;
+  llvm::DenseMap<unsigned, unsigned> PrecompressedIndices;
+  if (PP.getLangOpts().LevitationMode)
+    precompressBlobs(SourceMgr, PP, Precompressed, PrecompressedIndices);
+  // end of C++ Levitation
+
   // Write out the source location entry table. We skip the first
   // entry, which is always the same dummy entry.
   std::vector<uint32_t> SLocEntryOffsets;
@@ -2082,8 +2176,14 @@ void ASTWriter::WriteSourceManagerBlock(SourceManager &SourceMgr,
         const llvm::MemoryBuffer *Buffer =
             Content->getBuffer(PP.getDiagnostics(), PP.getFileManager());
         StringRef Blob(Buffer->getBufferStart(), Buffer->getBufferSize() + 1);
+
+        // C++ Levitation
+        auto FoundPrecompressed = PrecompressedIndices.find(I);
         emitBlob(Stream, Blob, SLocBufferBlobCompressedAbbrv,
-                 SLocBufferBlobAbbrv);
+                 SLocBufferBlobAbbrv,
+                 FoundPrecompressed != PrecompressedIndices.end() ?
+                     &Precompressed[FoundPrecompressed->second] : nullptr);
+        // end of C++ Levitation
       }
     } else {
       // The source location entry is a macro expansion.
@@ -2432,6 +2532,33 @@ void ASTWriter::WritePreprocessor(const Preprocessor &PP, bool IsModule) {
   }
 }
 
+/// Writes names of macros written by WritePreprocessor, so that
+/// dependents only probe identifier tables of files which have
+/// macros with looked up name.
+void ASTWriter::WriteLevitationMacroNames() {
+  SmallVector<StringRef, 64> Names;
+  for (const auto &Id : IdentMacroDirectivesOffsetMap)
+    Names.push_back(Id.first->getName());
+  llvm::sort(Names);
+
+  SmallString<1024> Blob;
+  for (StringRef Name : Names) {
+    Blob += Name;
+    Blob.push_back('\0');
+  }
+
+  using namespace llvm;
+
+  auto Abbrev = std::make_shared<BitCodeAbbrev>();
+  Abbrev->Add(BitCodeAbbrevOp(LEVITATION_MACRO_NAMES));
+  Abbrev->Add(BitCodeAbbrevOp(BitCodeAbbrevOp::VBR, 32)); // # of names
+  Abbrev->Add(BitCodeAbbrevOp(BitCodeAbbrevOp::Blob));
+  unsigned MacroNamesAbbrev = Stream.EmitAbbrev(std::move(Abbrev));
+
+  RecordData::value_type Record[] = {LEVITATION_MACRO_NAMES, Names.size()};
+  Stream.EmitRecordWithBlob(MacroNamesAbbrev, Record, Blob);
+}
+
 void ASTWriter::WritePreprocessorDetail(PreprocessingRecord &PPRec,
                                         uint64_t MacroOffsetsBase) {
   if (PPRec.local_begin() == PPRec.local_end())
@@ -4869,6 +4996,8 @@ ASTFileSignature ASTWriter::WriteASTCore(Sema &SemaRef, StringRef isysroot,
   WriteSourceManagerBlock(Context.getSourceManager(), PP);
   WriteComments();
   WritePreprocessor(PP, isModule);
+  if (PP.getLangOpts().LevitationMode)
+    WriteLevitationMacroNames();
   WriteHeaderSearch(PP.getHeaderSearchInfo());
   WriteSelectors(SemaRef);
   WriteReferencedSelectorsPool(SemaRef);
@@ -5772,6 +5901,14 @@ void ASTRecordWriter::AddCXXDefinitionData(const CXXRecordDecl *D) {
   Record->push_back(D->getODRHash());
   bool ModulesDebugInfo = Writer->Context->getLangOpts().ModulesDebugInfo &&
                           Writer->WritingModule && !D->isDependentType();
+
+  // C++ Levitation: dependents rely on our object to provide debug info.
+  if (!ModulesDebugInfo &&
+      Writer->Context->getLangOpts().isLevitationMode(
+          LangOptions::LBSK_BuildDeclAST))
+    ModulesDebugInfo = Writer->Context->isLevitationHomeRecord(D);
+  // end of C++ Levitation
+
   Record->push_back(ModulesDebugInfo);
   if (ModulesDebugInfo)
     Writer->ModularCodegenDecls.push_back(Writer->GetDeclRef(D));
@@ -974,6 +974,105 @@ void ASTDeclWriter::VisitIndirectFieldDecl(IndirectFieldDecl *D) {
   Code = serialization::DECL_INDIRECTFIELD;
 }
 
+// C++ Levitation: evaluated values of constants
+
+/// Whether value may be stored in declaration AST. Values which refer
+/// to declarations or labels are evaluated by dependents themselves.
+static bool isStorableConstantValue(const APValue &Value) {
+  switch (Value.getKind()) {
+  case APValue::None:
+  case APValue::Indeterminate:
+  case APValue::Int:
+  case APValue::Float:
+  case APValue::FixedPoint:
+  case APValue::ComplexInt:
+  case APValue::ComplexFloat:
+    return true;
+  case APValue::Vector:
+    for (unsigned i = 0, e = Value.getVectorLength(); i != e; ++i)
+      if (!isStorableConstantValue(Value.getVectorElt(i)))
+        return false;
+    return true;
+  case APValue::Array:
+    for (unsigned i = 0, e = Value.getArrayInitializedElts(); i != e; ++i)
+      if (!isStorableConstantValue(Value.getArrayInitializedElt(i)))
+        return false;
+    return !Value.hasArrayFiller() ||
+           isStorableConstantValue(Value.getArrayFiller());
+  case APValue::Struct:
+    for (unsigned i = 0, e = Value.getStructNumBases(); i != e; ++i)
+      if (!isStorableConstantValue(Value.getStructBase(i)))
+        return false;
+    for (unsigned i = 0, e = Value.getStructNumFields(); i != e; ++i)
+      if (!isStorableConstantValue(Value.getStructField(i)))
+        return false;
+    return true;
+  case APValue::Union:
+    return isStorableConstantValue(Value.getUnionValue());
+  case APValue::LValue:
+  case APValue::MemberPointer:
+  case APValue::AddrLabelDiff:
+    return false;
+  }
+  llvm_unreachable("Invalid APValue::ValueKind");
+}
+
+/// Same as ASTRecordWriter::AddAPValue, but aggregates are written too.
+/// Value should be storable, see isStorableConstantValue.
+static void addConstantValue(ASTRecordWriter &Record, const APValue &Value) {
+  Record.push_back(static_cast<uint64_t>(Value.getKind()));
+  switch (Value.getKind()) {
+  case APValue::Vector:
+    Record.push_back(Value.getVectorLength());
+    for (unsigned i = 0, e = Value.getVectorLength(); i != e; ++i)
+      addConstantValue(Record, Value.getVectorElt(i));
+    return;
+  case APValue::Array:
+    Record.push_back(Value.getArrayInitializedElts());
+    Record.push_back(Value.getArraySize());
+    for (unsigned i = 0, e = Value.getArrayInitializedElts(); i != e; ++i)
+      addConstantValue(Record, Value.getArrayInitializedElt(i));
+    if (Value.hasArrayFiller())
+      addConstantValue(Record, Value.getArrayFiller());
+    return;
+  case APValue::Struct:
+    Record.push_back(Value.getStructNumBases());
+    Record.push_back(Value.getStructNumFields());
+    for (unsigned i = 0, e = Value.getStructNumBases(); i != e; ++i)
+      addConstantValue(Record, Value.getStructBase(i));
+    for (unsigned i = 0, e = Value.getStructNumFields(); i != e; ++i)
+      addConstantValue(Record, Value.getStructField(i));
+    return;
+  case APValue::Union:
+    Record.AddDeclRef(Value.getUnionField());
+    addConstantValue(Record, Value.getUnionValue());
+    return;
+  default:
+    Record.AddAPValue(Value);
+    return;
+  }
+}
+
+/// Value of constexpr variable declared by unit, evaluated by Sema,
+/// so that dependents read it instead of evaluating it again.
+/// \return null if value is not going to be stored.
+static const APValue *getLevitationConstantValue(
+    const ASTContext &Context, const VarDecl *D
+) {
+  if (!Context.getLangOpts().isLevitationMode(LangOptions::LBSK_BuildDeclAST) ||
+      !D->isConstexpr() || D->getStorageDuration() != SD_Static ||
+      !D->isInitKnownICE())
+    return nullptr;
+
+  const APValue *Value = D->getEvaluatedValue();
+  if (!Value || Value->isAbsent() || !isStorableConstantValue(*Value))
+    return nullptr;
+
+  return Value;
+}
+
+// end of C++ Levitation
+
 void ASTDeclWriter::VisitVarDecl(VarDecl *D) {
   VisitRedeclarable(D);
   VisitDeclaratorDecl(D);
@@ -1001,15 +1100,20 @@ void ASTDeclWriter::VisitVarDecl(VarDecl *D) {
   Record.push_back(D->getLinkageInternal());
 
   if (D->getInit()) {
+    // C++ Levitation
+    const APValue *Value = getLevitationConstantValue(*Writer.Context, D);
     if (!D->isInitKnownICE())
       Record.push_back(1);
     else {
       Record.push_back(
           2 |
           (D->isInitICE() ? 1 : 0) |
-          (D->ensureEvaluatedStmt()->HasConstantDestruction ? 4 : 0));
+          (D->ensureEvaluatedStmt()->HasConstantDestruction ? 4 : 0) |
+          (Value ? 8 : 0));
     }
     Record.AddStmt(D->getInit());
+    if (Value)
+      addConstantValue(Record, *Value);
   } else {
     Record.push_back(0);
   }
@@ -2481,6 +2585,17 @@ void ASTRecordWriter::AddFunctionDefinition(const FunctionDecl *FD) {
       }
     }
   }
+
+  // C++ Levitation: dependents rely on our object to provide definition.
+  // Exported bodies are only there for inlining, so dependents emit them
+  // as available_externally.
+  if (!ModulesCodegen &&
+      Writer->Context->getLangOpts().isLevitationMode(
+          LangOptions::LBSK_BuildDeclAST))
+    ModulesCodegen = Writer->Context->isLevitationHomeDefinition(FD) ||
+                     Writer->Context->isLevitationExportedBody(FD);
+  // end of C++ Levitation
+
   Record->push_back(ModulesCodegen);
   if (ModulesCodegen)
     Writer->ModularCodegenDecls.push_back(Writer->GetDeclRef(FD));
@@ -127,9 +127,9 @@ typedef llvm::OnDiskIterableChainedHashTable<IdentifierIndexReaderTrait>
 
 GlobalModuleIndex::GlobalModuleIndex(
     std::unique_ptr<llvm::MemoryBuffer> IndexBuffer,
-    llvm::BitstreamCursor Cursor)
+    llvm::BitstreamCursor Cursor, bool LevitationIndex)
     : Buffer(std::move(IndexBuffer)), IdentifierIndex(), NumIdentifierLookups(),
-      NumIdentifierLookupHits() {
+      NumIdentifierLookupHits(), LevitationIndex(LevitationIndex) {
   auto Fail = [&](llvm::Error &&Err) {
     report_fatal_error("Module index '" + Buffer->getBufferIdentifier() +
                        "' failed: " + toString(std::move(Err)));
@@ -222,6 +222,13 @@ GlobalModuleIndex::GlobalModuleIndex(
       // Make sure we're at the end of the record.
       assert(Idx == Record.size() && "More module info?");
 
+      // C++ Levitation: dependencies are identified by their paths.
+      if (LevitationIndex) {
+        UnresolvedModules[Modules[ID].FileName] = ID;
+        break;
+      }
+      // end of C++ Levitation
+
       // Record this module as an unresolved module.
       // FIXME: this doesn't work correctly for module names containing path
       // separators.
@@ -256,8 +263,18 @@ GlobalModuleIndex::readIndex(StringRef Path) {
   IndexPath += Path;
   llvm::sys::path::append(IndexPath, IndexFileName);
 
+  return readIndexFile(IndexPath, /*LevitationIndex=*/false);
+}
+
+std::pair<GlobalModuleIndex *, llvm::Error>
+GlobalModuleIndex::readLevitationIndex(StringRef IndexPath) {
+  return readIndexFile(IndexPath, /*LevitationIndex=*/true);
+}
+
+std::pair<GlobalModuleIndex *, llvm::Error>
+GlobalModuleIndex::readIndexFile(StringRef IndexPath, bool LevitationIndex) {
   llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> BufferOrErr =
-      llvm::MemoryBuffer::getFile(IndexPath.c_str());
+      llvm::MemoryBuffer::getFile(IndexPath);
   if (!BufferOrErr)
     return std::make_pair(nullptr,
                           llvm::errorCodeToError(BufferOrErr.getError()));
@@ -277,8 +294,9 @@ GlobalModuleIndex::readIndex(StringRef Path) {
       return std::make_pair(nullptr, Res.takeError());
   }
 
-  return std::make_pair(new GlobalModuleIndex(std::move(Buffer), Cursor),
-                        llvm::Error::success());
+  return std::make_pair(
+      new GlobalModuleIndex(std::move(Buffer), Cursor, LevitationIndex),
+      llvm::Error::success());
 }
 
 void
@@ -336,7 +354,8 @@ bool GlobalModuleIndex::lookupIdentifier(StringRef Name, HitSet &Hits) {
 
 bool GlobalModuleIndex::loadedModuleFile(ModuleFile *File) {
   // Look for the module in the global module index based on the module name.
-  StringRef Name = File->ModuleName;
+  // C++ Levitation: or based on file name for Levitation index.
+  StringRef Name = LevitationIndex ? File->FileName : File->ModuleName;
   llvm::StringMap<unsigned>::iterator Known = UnresolvedModules.find(Name);
   if (Known == UnresolvedModules.end()) {
     return true;
@@ -919,6 +938,42 @@ GlobalModuleIndex::writeIndex(FileManager &FileMgr,
       llvm::StringRef(OutputBuffer.data(), OutputBuffer.size()));
 }
 
+// C++ Levitation
+llvm::Error
+GlobalModuleIndex::writeLevitationIndex(FileManager &FileMgr,
+                                        const PCHContainerReader &PCHContainerRdr,
+                                        ArrayRef<std::string> ASTFiles,
+                                        StringRef IndexPath) {
+  // Levitation driver is the only writer, and it writes index after
+  // all the dependencies were built, so no locking is required here.
+
+  GlobalModuleIndexBuilder Builder(FileMgr, PCHContainerRdr);
+
+  for (const auto &ASTFile : ASTFiles) {
+    auto ModuleFile = FileMgr.getFile(ASTFile);
+    if (!ModuleFile)
+      return llvm::createStringError(std::errc::no_such_file_or_directory,
+                                     "AST file \"%s\" not found",
+                                     ASTFile.c_str());
+
+    if (llvm::Error Err = Builder.loadModuleFile(*ModuleFile))
+      return Err;
+  }
+
+  SmallVector<char, 16> OutputBuffer;
+  {
+    llvm::BitstreamWriter OutputStream(OutputBuffer);
+    if (Builder.writeIndex(OutputStream))
+      return llvm::createStringError(std::errc::io_error,
+                                     "failed writing index");
+  }
+
+  return llvm::writeFileAtomically(
+      (IndexPath + "-%%%%%%%%").str(), IndexPath,
+      llvm::StringRef(OutputBuffer.data(), OutputBuffer.size()));
+}
+// end of C++ Levitation
+
 namespace {
   class GlobalIndexIdentifierIterator : public IdentifierIterator {
     /// The current position within the identifier lookup table.
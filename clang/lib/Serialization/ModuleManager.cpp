@@ -195,7 +195,18 @@ ModuleManager::addModule(StringRef FileName, ModuleKind Type,
       Buf = llvm::MemoryBuffer::getSTDIN();
     } else {
       // Get a buffer of the file and close the file descriptor when done.
-      Buf = FileMgr.getBufferForFile(NewModule->File, /*isVolatile=*/false);
+
+      // C++ Levitation
+      // Same dependencies are loaded by many parallel jobs. AST readers
+      // don't need null terminator, and without it buffer is always
+      // mmapped (unless file is too small), so jobs share page cache
+      // instead of having private copies.
+      bool RequiresNullTerminator = !LevitationMode;
+      // end of C++ Levitation
+
+      Buf = FileMgr.getBufferForFile(
+          NewModule->File, /*isVolatile=*/false, RequiresNullTerminator
+      );
     }
 
     if (!Buf) {
@@ -220,14 +231,9 @@ ModuleManager::addModule(StringRef FileName, ModuleKind Type,
 
   updateModuleImports(*NewModule, ImportedBy, ImportLoc);
 
-  if (LevitationMode) {
-    if (NewModule->isLevitationModule()) {
-      NewModule->LevitationModuleID = LevitationModules.size();
-      LevitationModules.push_back(NewModule.get());
-    } else {
-      if (++LevitationNumNonModules > serialization::LEVITATION_NUM_RESERVED_NON_MODULES)
-        return LevitationOutOfIDs;
-    }
+  if (LevitationMode && NewModule->isLevitationModule()) {
+    NewModule->LevitationModuleID = LevitationModules.size();
+    LevitationModules.push_back(NewModule.get());
   }
 
   if (!NewModule->isModule() && !NewModule->isLevitationModule())
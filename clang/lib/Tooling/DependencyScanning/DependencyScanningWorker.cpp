@@ -145,6 +145,10 @@ public:
       Compiler.addDependencyCollector(std::make_shared<ModuleDepCollector>(
           std::move(Opts), Compiler, Consumer));
       break;
+    // C++ Levitation
+    case ScanningOutputFormat::P1689:
+      llvm_unreachable("P1689 dependencies are not collected by workers");
+    // end of C++ Levitation
     }
 
     // Consider different header search and diagnostic options to create
@@ -7,19 +7,29 @@
 //===----------------------------------------------------------------------===//
 
 #include "clang/Frontend/CompilerInstance.h"
+#include "clang/Levitation/Dependencies.h"
+#include "clang/Levitation/FileExtensions.h"
+#include "clang/Levitation/ImportScanner.h"
+#include "clang/Levitation/Serialization.h"
+#include "clang/Levitation/UnitID.h"
 #include "clang/Tooling/CommonOptionsParser.h"
 #include "clang/Tooling/DependencyScanning/DependencyScanningService.h"
 #include "clang/Tooling/DependencyScanning/DependencyScanningTool.h"
 #include "clang/Tooling/DependencyScanning/DependencyScanningWorker.h"
 #include "clang/Tooling/JSONCompilationDatabase.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
 #include "llvm/Support/FileUtilities.h"
+#include "llvm/Support/FormatVariadic.h"
 #include "llvm/Support/InitLLVM.h"
 #include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
 #include "llvm/Support/Program.h"
 #include "llvm/Support/Signals.h"
 #include "llvm/Support/ThreadPool.h"
 #include "llvm/Support/Threading.h"
+#include <atomic>
 #include <mutex>
 #include <thread>
 
@@ -127,7 +137,11 @@ static llvm::cl::opt<ScanningOutputFormat> Format(
                      clEnumValN(ScanningOutputFormat::Full, "experimental-full",
                                 "Full dependency graph suitable"
                                 " for explicitly building modules. This format "
-                                "is experimental and will change.")),
+                                "is experimental and will change."),
+                     clEnumValN(ScanningOutputFormat::P1689, "p1689",
+                                "P1689 style dependencies of C++ Levitation "
+                                "units, which are found without running "
+                                "preprocessor whenever possible")),
     llvm::cl::init(ScanningOutputFormat::Make),
     llvm::cl::cat(DependencyScannerCategory));
 
@@ -390,6 +404,177 @@ static bool handleFullDependencyToolResult(
   return false;
 }
 
+// C++ Levitation
+
+/// \returns value of "-name=value" or "-name value" argument, or empty
+/// string if there is no such argument.
+static StringRef getArgValue(const std::vector<std::string> &Args,
+                             StringRef Name) {
+  for (size_t I = 0, E = Args.size(); I != E; ++I) {
+    StringRef Arg = Args[I];
+    if (Arg == Name && I + 1 != E)
+      return Args[I + 1];
+    if (Arg.consume_front(Name) && Arg.consume_front("="))
+      return Arg;
+  }
+  return "";
+}
+
+/// Runs parse-import of the compiler command uses, for sources import
+/// scanner can't handle, e.g. ones with imports under conditional blocks.
+static bool parseImport(const tooling::CompileCommand &Cmd, StringRef Source,
+                        std::vector<std::string> &Requires,
+                        bool &IsInterface) {
+  llvm::SmallString<128> LDeps, Meta;
+  llvm::sys::fs::createTemporaryFile(
+      "cppl-scan-deps", levitation::FileExtensions::ParsedDependencies, LDeps);
+  llvm::sys::fs::createTemporaryFile(
+      "cppl-scan-deps", levitation::FileExtensions::ParsedDependenciesMeta,
+      Meta);
+  llvm::FileRemover LDepsRemover(LDeps.c_str());
+  llvm::FileRemover MetaRemover(Meta.c_str());
+
+  std::string DepsOut = ("-cppl-deps-out=" + LDeps).str();
+  std::string MetaOut = ("-cppl-meta=" + Meta).str();
+  StringRef SrcRoot = getArgValue(Cmd.CommandLine, "-cppl-src-root");
+  std::string SrcRootArg = ("-cppl-src-root=" + SrcRoot).str();
+
+  llvm::SmallVector<StringRef, 8> Args = {Cmd.CommandLine.front(),
+                                          "-std=c++17", "-cppl-import",
+                                          DepsOut, MetaOut};
+  if (SrcRoot.size())
+    Args.push_back(SrcRootArg);
+  Args.push_back(Source);
+
+  if (llvm::sys::ExecuteAndWait(Cmd.CommandLine.front(), Args))
+    return false;
+
+  auto Buffer = llvm::MemoryBuffer::getFile(LDeps);
+  if (!Buffer)
+    return false;
+
+  levitation::DependenciesData Data;
+  if (!levitation::CreateBitstreamReader(*Buffer.get())->read(Data))
+    return false;
+
+  for (const auto *Block :
+       {&Data.DeclarationDependencies, &Data.DefinitionDependencies})
+    for (const auto &D : *Block)
+      Requires.push_back(Data.Strings->getItem(D.UnitIdentifier)->str());
+
+  IsInterface = !Data.IsBodyOnly;
+  return true;
+}
+
+/// Produces P1689 rule for given command. Imports of .cppl sources are
+/// found by import scanner, same one cppl uses, so source is neither
+/// preprocessed nor parsed, unless scanner can't handle it.
+static bool scanLevitationRule(const tooling::CompileCommand &Cmd,
+                               llvm::json::Object &Rule, SharedStream &Errs) {
+  llvm::SmallString<128> Source(Cmd.Filename);
+  llvm::sys::fs::make_absolute(Cmd.Directory, Source);
+
+  StringRef Output = Cmd.Output;
+  if (Output.empty())
+    Output = getArgValue(Cmd.CommandLine, "-o");
+  if (Output.size())
+    Rule["primary-output"] = Output;
+
+  if (llvm::sys::path::extension(Source) !=
+      (Twine(".") + levitation::FileExtensions::SourceCode).str())
+    return true;
+
+  auto Buffer = llvm::MemoryBuffer::getFile(Source);
+  if (!Buffer) {
+    Errs.applyLocked([&](raw_ostream &OS) {
+      OS << "Error while scanning dependencies for " << Source
+         << ": can't read file.\n";
+    });
+    return false;
+  }
+
+  // Unit ID is either given by cppl, or is the path relative to
+  // sources root.
+  std::string UnitID = getArgValue(Cmd.CommandLine, "-cppl-unit-id").str();
+  if (UnitID.empty()) {
+    llvm::SmallString<128> Root(
+        getArgValue(Cmd.CommandLine, "-cppl-src-root"));
+    if (Root.empty())
+      Root = Cmd.Directory;
+    llvm::sys::fs::make_absolute(Cmd.Directory, Root);
+
+    StringRef Rel = Source;
+    if (Rel.consume_front(Root))
+      UnitID = levitation::UnitIDUtils::fromRelPath(
+          Rel.ltrim(llvm::sys::path::get_separator()));
+  }
+
+  std::vector<std::string> Requires;
+  bool IsInterface = true;
+
+  levitation::PackageDependencies Deps;
+  levitation::ImportScanner Scanner(Buffer.get()->getBuffer());
+  if (Scanner.scan(Deps)) {
+    for (const auto *Block :
+         {&Deps.DeclarationDependencies, &Deps.DefinitionDependencies})
+      for (auto ID : *Block)
+        Requires.push_back(Deps.PathsPool.getItem(ID)->str());
+    IsInterface = !Deps.IsBodyOnly;
+  } else if (!parseImport(Cmd, Source, Requires, IsInterface)) {
+    Errs.applyLocked([&](raw_ostream &OS) {
+      OS << "Error while scanning dependencies for " << Source
+         << ": parse-import failed.\n";
+    });
+    return false;
+  }
+
+  llvm::sort(Requires);
+  Requires.erase(std::unique(Requires.begin(), Requires.end()),
+                 Requires.end());
+
+  if (UnitID.size())
+    Rule["provides"] = llvm::json::Array{llvm::json::Object{
+        {"logical-name", UnitID},
+        {"source-path", Source.str()},
+        {"is-interface", IsInterface}}};
+
+  llvm::json::Array RequiresArr;
+  for (auto &R : Requires)
+    RequiresArr.push_back(llvm::json::Object{{"logical-name", std::move(R)}});
+  Rule["requires"] = std::move(RequiresArr);
+  return true;
+}
+
+/// Writes P1689 dependencies of all commands, in order of database.
+static int scanLevitationDeps(const tooling::CompilationDatabase &CDB) {
+  std::vector<tooling::CompileCommand> Commands = CDB.getAllCompileCommands();
+  std::vector<llvm::json::Object> Rules(Commands.size());
+
+  SharedStream Errs(llvm::errs());
+  std::atomic<bool> HadErrors(false);
+
+  llvm::ThreadPool Pool(llvm::hardware_concurrency(NumThreads));
+  for (size_t I = 0, E = Commands.size(); I != E; ++I)
+    Pool.async([&, I] {
+      if (!scanLevitationRule(Commands[I], Rules[I], Errs))
+        HadErrors = true;
+    });
+  Pool.wait();
+
+  llvm::json::Array RulesArr;
+  for (auto &R : Rules)
+    RulesArr.push_back(std::move(R));
+
+  llvm::outs() << llvm::formatv(
+      "{0:2}\n", llvm::json::Value(llvm::json::Object{
+                      {"version", 1},
+                      {"revision", 0},
+                      {"rules", std::move(RulesArr)}}));
+  return HadErrors;
+}
+
+// end of C++ Levitation
+
 int main(int argc, const char **argv) {
   llvm::InitLLVM X(argc, argv);
   llvm::cl::HideUnrelatedOptions(DependencyScannerCategory);
@@ -408,13 +593,19 @@ int main(int argc, const char **argv) {
 
   llvm::cl::PrintOptionValues();
 
+  // C++ Levitation
+  // Commands are used as is, they are not run in preprocessor mode.
+  if (Format == ScanningOutputFormat::P1689)
+    return scanLevitationDeps(*Compilations);
+  // end of C++ Levitation
+
   // The command options are rewritten to run Clang in preprocessor only mode.
   auto AdjustingCompilations =
       std::make_unique<tooling::ArgumentsAdjustingCompilations>(
           std::move(Compilations));
   ResourceDirectoryCache ResourceDirCache;
   AdjustingCompilations->appendArgumentsAdjuster(
-      [&ResourceDirCache](const tooling::CommandLineArguments &Args,
+      [&ResourceDirCache](const std::vector<std::string> &Args,
                           StringRef FileName) {
         std::string LastO = "";
         bool HasMT = false;
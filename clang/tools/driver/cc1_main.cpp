@@ -248,6 +248,11 @@ int cc1_main(ArrayRef<const char *> Argv, const char *Argv0, void *MainAddr) {
   if (llvm::timeTraceProfilerEnabled()) {
     SmallString<128> Path(Clang->getFrontendOpts().OutputFile);
     llvm::sys::path::replace_extension(Path, "json");
+
+    // C++ Levitation: decl-ast and object of same unit have
+    // same stem, so driver gives them different trace files.
+    if (!Clang->getFrontendOpts().LevitationTimeTraceOutput.empty())
+      Path = Clang->getFrontendOpts().LevitationTimeTraceOutput;
     if (auto profilerOutput =
             Clang->createOutputFile(Path.str(),
                                     /*Binary=*/false,
@@ -0,0 +1,165 @@
+//===--- C++ Levitation levitation-ast-diff.cpp ----------------*- C++ -*-===//
+//
+// Part of the C++ Levitation Project,
+// under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file defines tool, which compares two declaration ASTs of same unit
+//  at declaration level, by declaration hashes recorded in their metas.
+//  Hashes don't depend on source locations, so only declarations which
+//  may affect dependents are reported.
+//
+//===----------------------------------------------------------------------===//
+
+#include "clang/Levitation/CommandLineTool/CommandLineTool.h"
+#include "clang/Levitation/DeclASTMeta/DeclASTMeta.h"
+#include "clang/Levitation/DeclASTMeta/DeclASTMetaLoader.h"
+#include "clang/Levitation/FileExtensions.h"
+#include "clang/Levitation/Common/Path.h"
+#include "clang/Levitation/Common/SimpleLogger.h"
+#include "clang/Levitation/Serialization.h"
+
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+using namespace clang;
+using namespace clang::levitation;
+using namespace clang::levitation::command_line_tool;
+
+// Same as diff(1) does.
+static const int RES_SAME = 0;
+static const int RES_DIFFERENT = 1;
+static const int RES_FAILED = 2;
+
+/// Loads meta of declaration AST. File is either declaration AST, with
+/// embedded meta or with stand-alone meta next to it, or meta itself,
+/// e.g. 'meta' entry of build cache, which is always stored as is.
+static bool loadMeta(StringRef File, DeclASTMeta &Meta) {
+  auto &Log = log::Logger::get();
+
+  auto Buffer = MemoryBuffer::getFile(
+      File, /*FileSize=*/-1, /*RequiresNullTerminator=*/false
+  );
+  if (!Buffer) {
+    Log.log_error("Failed to open file '", File, "'.");
+    return false;
+  }
+
+  StringRef Embedded;
+  if (findEmbeddedMeta((*Buffer)->getBuffer(), Embedded))
+    return DeclASTMetaLoader::fromBuffer(
+        Meta, *MemoryBuffer::getMemBuffer(Embedded, File, false)
+    );
+
+  if (File.endswith(FileExtensions::DeclarationAST)) {
+    auto MetaFile = Path::replaceExtension<SinglePath>(
+        File, FileExtensions::DeclASTMeta
+    );
+    auto MetaBuffer = MemoryBuffer::getFile(
+        MetaFile, /*FileSize=*/-1, /*RequiresNullTerminator=*/false
+    );
+    if (!MetaBuffer) {
+      Log.log_error(
+          "'", File, "' has neither embedded meta, nor '", MetaFile, "'."
+      );
+      return false;
+    }
+    return DeclASTMetaLoader::fromBuffer(Meta, **MetaBuffer);
+  }
+
+  return DeclASTMetaLoader::fromBuffer(Meta, **Buffer);
+}
+
+static int diff(StringRef OldFile, StringRef NewFile) {
+  auto &Log = log::Logger::get();
+
+  DeclASTMeta Old, New;
+  if (!loadMeta(OldFile, Old) || !loadMeta(NewFile, New))
+    return RES_FAILED;
+
+  auto &Out = llvm::outs();
+
+  bool SameInterface =
+      Old.getInterfaceHash().size() &&
+      Old.getInterfaceHash() == New.getInterfaceHash();
+
+  DeclASTMeta::DeclsDiffTy Diff;
+  if (!DeclASTMeta::diffDecls(Old, New, Diff)) {
+    // Nothing but hashes of whole unit is known.
+    Log.log_warning(
+        "Declaration hashes are missing, declaration AST was built "
+        "without early cutoff."
+    );
+
+    bool Same = SameInterface || Old.getDeclASTHash() == New.getDeclASTHash();
+    Out << (Same ? "Declarations are same.\n" : "Declarations differ.\n");
+    return Same ? RES_SAME : RES_DIFFERENT;
+  }
+
+  if (Diff.empty()) {
+    Out << "Declarations are same";
+    if (!SameInterface)
+      Out << ", only bodies or source locations differ";
+    Out << ".\n";
+    return RES_SAME;
+  }
+
+  auto printNames = [&] (char Mark, const std::vector<std::string> &Names) {
+    for (const auto &Name : Names)
+      Out << Mark << " "
+          << (Name.empty() ? "<unnamed declarations and macros>" : Name)
+          << "\n";
+  };
+
+  printNames('+', Diff.Added);
+  printNames('-', Diff.Removed);
+  printNames('~', Diff.Changed);
+
+  Out << "Added: " << Diff.Added.size()
+      << ", removed: " << Diff.Removed.size()
+      << ", changed: " << Diff.Changed.size() << "\n";
+
+  return RES_DIFFERENT;
+}
+
+int main(int argc, char **argv) {
+  log::Logger::createLogger(log::Level::Warning);
+
+  std::string OldFile, NewFile;
+
+  return CommandLineTool<KeyEqValueParser>(argc, argv)
+      .description(
+          "Compares two declaration ASTs of same unit by declaration "
+          "hashes, and prints added (+), removed (-) and changed (~) "
+          "namespace level declarations. Source locations don't affect "
+          "hashes, so only changes which may rebuild dependents are "
+          "printed. Hashes are only recorded by builds with early cutoff "
+          "enabled. Each file is either .decl-ast, or its meta, e.g. "
+          "'meta' entry of build cache. Exit code is 0 if declarations "
+          "are same, 1 if they differ, 2 if comparison has failed."
+      )
+      .registerParser<KeySpaceValueParser>()
+      .parameter()
+          .name("-old")
+          .valueHint("<file>")
+          .description("Declaration AST or meta before change.")
+          .action([&](StringRef v) { OldFile = v.str(); })
+      .done()
+      .parameter()
+          .name("-new")
+          .valueHint("<file>")
+          .description("Declaration AST or meta after change.")
+          .action([&](StringRef v) { NewFile = v.str(); })
+      .done()
+      .helpParameter("--help", "Shows this help text.")
+      .onWrongArgsReturn(RES_FAILED)
+      .run([&] {
+        return diff(OldFile, NewFile);
+      });
+}
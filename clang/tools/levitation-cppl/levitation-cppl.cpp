@@ -12,7 +12,9 @@
 //===----------------------------------------------------------------------===//
 
 #include "clang/Levitation/CommandLineTool/CommandLineTool.h"
+#include "clang/Levitation/Driver/CompileServer.h"
 #include "clang/Levitation/Driver/Driver.h"
+#include "clang/Levitation/Driver/PersistentWorker.h"
 #include "clang/Levitation/FileExtensions.h"
 #include "clang/Levitation/Common/SimpleLogger.h"
 #include "clang/Levitation/Serialization.h"
@@ -71,12 +73,60 @@ int levitation_driver_main(int argc, char **argv) {
           "Build root directory.",
           [&](StringRef v) { Driver.setBuildRoot(v); }
       )
-      .optional(
-          "-preamble", "<path>",
-          "Path to preamble. If specified, then preamble compilation stage "
-          "will be enabled.",
-          [&](StringRef v) { Driver.setPreambleSource(v); }
-      )
+      .optional()
+          .multi()
+          .name("-preamble")
+          .valueHint("<path>")
+          .description(
+              "Path to preamble. If specified, then preamble compilation "
+              "stage will be enabled. May be specified several times, "
+              "then preambles are chained: each one is built on top of "
+              "previous one and has its own up-to-date check. Last one "
+              "is included into all units."
+          )
+          .action([&](StringRef v) { Driver.addPreambleSource(v); })
+      .done()
+      .optional()
+          .name("--stdlib-preamble")
+          .valueHint("<auto|path>")
+          .description(
+              "Chain preambles on top of prebuilt standard library "
+              "preamble, so that standard headers are not compiled by "
+              "each project. 'auto' picks preamble installed along with "
+              "toolchain for selected -stdlib (see install-cppl-preambles "
+              "target), if there is one. Prebuilt preamble should be "
+              "compiled with same flags as project preambles."
+          )
+          .action([&](StringRef v) { Driver.setStdLibPreamble(v); })
+      .done()
+      .optional()
+          .multi()
+          .name("--subtree-preamble")
+          .valueHint("<dir>=<path>")
+          .description(
+              "Preamble for units of given directory (relative to sources "
+              "root), it is included into them instead of main preamble. "
+              "Subtree preamble is built on top of main preamble, if any, "
+              "and has its own up-to-date check, so units of directory "
+              "may only depend on units of same directory or units "
+              "which use main preamble. For nested directories "
+              "the innermost one wins."
+          )
+          .action([&](StringRef v) { Driver.addSubtreePreamble(v); })
+      .done()
+      .optional()
+          .multi()
+          .name("--header-unit")
+          .valueHint("<header>")
+          .description(
+              "Build legacy header, as it is written in #include directive, "
+              "into its own declaration AST on top of main preamble. "
+              "Header unit is only loaded by units which include it, "
+              "directly or through their dependencies, and it is rebuilt "
+              "when header found in include directories is changed."
+          )
+          .action([&](StringRef v) { Driver.addHeaderUnit(v); })
+      .done()
       .optional(
           "-h", "<path>",
           "Path to headers root directory. If specified, then headers "
@@ -96,11 +146,246 @@ int levitation_driver_main(int argc, char **argv) {
       )
       .optional()
           .name("-j")
-          .valueHint("<N>")
-          .description("Maximum jobs number.")
-          .action<int>([&](int v) { Driver.setJobsNumber(v); })
+          .valueHint("<N>|auto")
+          .description(
+              "Maximum jobs number. With 'auto' number of running jobs "
+              "is adjusted at runtime: it goes down on memory and I/O "
+              "pressure, before host starts swapping, and goes up while "
+              "cores are idle and jobs complete faster."
+          )
+          .action([&](StringRef v) {
+            int N;
+            if (v == "auto")
+              Driver.setAutoJobs();
+            else
+              Driver.setJobsNumber(v.getAsInteger(10, N) ? 0 : N);
+          })
           .useParser<KeyValueInOneWordParser>()
       .done()
+      .flag()
+          .name("--numa")
+          .description(
+              "Split workers between NUMA nodes of host, and run each "
+              "job on the node where most of its dependencies were "
+              "built, so that their declaration ASTs are read from "
+              "local memory. Only works with 'ready-queue' and "
+              "'critical-path' schedules, and only on Linux."
+          )
+          .action([&](StringRef) { Driver.setNuma(); })
+      .done()
+      .flag()
+          .name("--pin-workers")
+          .description(
+              "Pin workers to CPUs of their NUMA nodes. Jobs launched "
+              "by worker inherit its affinity. Only works on Linux."
+          )
+          .action([&](StringRef) { Driver.setPinWorkers(); })
+      .done()
+      .flag()
+          .name("--job-priorities")
+          .description(
+              "Run object jobs which are not on critical path with "
+              "lower CPU and I/O priority, so that build in background "
+              "keeps desktop responsive, while critical path jobs still "
+              "run at normal priority. Critical path is estimated from "
+              "build history. Cache uploads and header generation "
+              "always run with lower priority."
+          )
+          .action([&](StringRef) { Driver.setJobPriorities(); })
+      .done()
+      .optional()
+          .name("-max-mem")
+          .valueHint("<size>")
+          .description(
+              "Memory budget for all jobs, e.g. '48G', 'K', 'M', 'G' and "
+              "'T' suffixes are accepted. Jobs are admitted against peak "
+              "memory their units used during previous builds, so that "
+              "heavy units don't run together. Job which alone exceeds "
+              "budget is still run, but without other jobs. "
+              "By default memory is not limited."
+          )
+          .action([&](StringRef v) { Driver.setMaxMemory(v); })
+      .done()
+      .optional(
+          "-pool", "<pool>=<N>[,<pool>=<N>...]",
+          "Limits number of jobs of given kind which run at once, "
+          "in addition to -j, e.g. '-pool preamble=2,link=2'. Pools are "
+          "'parse' (parse-import and header parsing), 'decl', 'preamble', "
+          "'obj' (objects and codegen backends), 'link', 'check', "
+          "'tidy' and 'test'. By default only -j is applied.",
+          [&](StringRef v) { Driver.addPools(v); }
+      )
+      .optional()
+          .name("-k")
+          .valueHint("<N>")
+          .description(
+              "Keep going until N steps fail. Failed step still prevents "
+              "steps which depend on it, but other branches are built. "
+              "0 means build never stops. Default value: 1, that is once "
+              "some step fails, no new steps are started, and build stops "
+              "as soon as running steps are done."
+          )
+          .action<int>([&](int v) { Driver.setFailuresLimit(v); })
+          .useParser<KeySpaceValueParser>()
+      .done()
+      .flag()
+          .name("-fail-fast")
+          .description(
+              "Stop on first failure: cancel pending steps and kill "
+              "running subprocesses. In-process jobs can't be interrupted, "
+              "so they still run to completion."
+          )
+          .action([&](StringRef) { Driver.setFailFast(); })
+      .done()
+      .optional(
+          "--jobserver", "<auto|serve|off>",
+          "GNU make jobserver mode. With 'auto' cppl acquires job slot "
+          "from jobserver passed through MAKEFLAGS before it runs each "
+          "job, so that it doesn't oversubscribe machine when called "
+          "from make. 'serve' does the same, but if there is no parent "
+          "jobserver, creates one with -j slots and exports it through "
+          "MAKEFLAGS, so that nested tools share cppl's slots. "
+          "Default value: 'auto'.",
+          [&](StringRef v) { Driver.setJobserverMode(v); }
+      )
+      .optional(
+          "-schedule", "<dsf|ready-queue|critical-path>",
+          "Jobs scheduling mode. 'dsf' runs recursive deep search first walk, "
+          "where each job waits for its dependencies. 'ready-queue' starts "
+          "node as soon as all its dependencies are complete. "
+          "'critical-path' is same as 'ready-queue', but it starts "
+          "nodes with longest remaining dependent chain first. "
+          "Default value: 'ready-queue'.",
+          [&](StringRef v) { Driver.setSchedule(v); }
+      )
+      .optional(
+          "--trace-out", "<file.json>",
+          "Record build trace in Chrome trace event format. "
+          "It can be inspected with chrome://tracing or Perfetto.",
+          [&](StringRef v) { Driver.setTraceOutput(v); }
+      )
+      .optional(
+          "--sources-manifest", "<file>",
+          "Take project sources from given file instead of scanning "
+          "sources root. File lists one source per line, paths "
+          "are relative to sources root unless absolute. Empty lines "
+          "and lines starting with '#' are ignored.",
+          [&](StringRef v) { Driver.setSourcesManifest(v); }
+      )
+      .optional(
+          "--cache-dir", "<directory>",
+          "Keep build artifacts in content-addressed cache "
+          "within given directory. Artifacts are reused across "
+          "build directories and clean builds.",
+          [&](StringRef v) { Driver.setCacheDir(v); }
+      )
+      .optional(
+          "--remote-cache", "<program>",
+          "Use remote build cache through given program. "
+          "It is called as '<program> get <key> <file>' to fetch entry "
+          "and as '<program> put <key> <file>' to store it, and should "
+          "return zero exit code on success.",
+          [&](StringRef v) { Driver.setRemoteCacheCommand(v); }
+      )
+      .flag()
+          .name("--cache-hardlinks")
+          .description(
+              "Hard link artifacts with entries of --cache-dir, instead of "
+              "copying them, if both are on same file system. Artifacts are "
+              "never written in place, so entries stay intact. Otherwise "
+              "entries are reflinked where file system supports it."
+          )
+          .action([&](StringRef) { Driver.setCacheHardlinks(); })
+      .done()
+      .flag()
+          .name("--lazy-cache-fetch")
+          .description(
+              "Don't fetch declaration ASTs found in build cache, only "
+              "their metas, until some job which runs locally reads them, "
+              "or they're put into bundle. With remote cache most of "
+              "declaration ASTs then never leave it. Not compatible with "
+              "--embed-meta."
+          )
+          .action([&](StringRef) { Driver.setLazyCacheFetch(); })
+      .done()
+      .optional(
+          "--seed-build-root", "<directory>",
+          "If build root has never been built yet, fill it with artifacts "
+          "of given build root first, e.g. one of other git worktree. "
+          "Artifacts are reflinked where file system supports it and keep "
+          "their modification times, so that only units which differ "
+          "between both trees are rebuilt.",
+          [&](StringRef v) { Driver.setSeedBuildRoot(v); }
+      )
+      .optional(
+          "--library-cache", "<directory>",
+          "Share .ldeps and declaration ASTs of Levitation libraries "
+          "(see -L) between projects, through given directory. Entries "
+          "are keyed by library contents and compiler, and are filled "
+          "under file locks, so several cppl invocations may use same "
+          "directory at once.",
+          [&](StringRef v) { Driver.setLibraryCacheDir(v); }
+      )
+      .flag()
+          .name("--shared-build-root")
+          .description(
+              "Allow several cppl invocations to use same build root at "
+              "once, e.g. parallel CI steps. Each .ldeps, declaration AST "
+              "and object is locked while built, with '.lock' marker next "
+              "to it. Invocation which needs artifact other one is building "
+              "waits for it, and reuses it if it is up-to-date."
+          )
+          .action([&](StringRef) { Driver.setSharedBuildRoot(); })
+      .done()
+      .optional()
+          .name("--cache-compression")
+          .valueHint("<1-9>")
+          .description(
+              "Compress declaration ASTs and objects put into build cache "
+              "with given zlib level. Build directory keeps them "
+              "uncompressed."
+          )
+          .action<int>([&](int v) { Driver.setCacheCompression(v); })
+      .done()
+      .optional(
+          "--hash", "<md5|xxh64>",
+          "Hash algorithm sources and outputs are hashed with for "
+          "up-to-date checks and build cache keys. xxh64 is several "
+          "times faster, which is noticeable for large declaration ASTs. "
+          "Existing meta files are checked with algorithm they were "
+          "written with. Default is md5.",
+          [&](StringRef v) { Driver.setHash(v); }
+      )
+      .optional()
+          .name("--publish-queue-depth")
+          .valueHint("<N>")
+          .description(
+              "Cache uploads and generated headers are written in "
+              "background, so that dependent jobs don't wait for them. "
+              "Specifies how many of them may be pending, before jobs "
+              "wait for free slot. 0 makes them synchronous. "
+              "Default is 64."
+          )
+          .action<int>([&](int v) { Driver.setPublishQueueDepth(v); })
+      .done()
+      .optional()
+          .name("--cache-max-size")
+          .valueHint("<MB>")
+          .description(
+              "Once garbage is collected, least recently used entries "
+              "are removed from local build cache until it fits given size."
+          )
+          .action<int>([&](int v) { Driver.setCacheMaxSize(v); })
+      .done()
+      .optional()
+          .name("--cache-max-age")
+          .valueHint("<days>")
+          .description(
+              "Once garbage is collected, entries which were not used "
+              "for given number of days are removed from local build cache."
+          )
+          .action<int>([&](int v) { Driver.setCacheMaxAge(v); })
+      .done()
       .optional()
           .name("-o")
           .valueHint("<directory>")
@@ -129,6 +414,860 @@ int levitation_driver_main(int argc, char **argv) {
           .description("Enables trace mode.")
           .action([&](llvm::StringRef) { Driver.setTrace(); })
       .done()
+      .flag()
+          .name("--watch")
+          .description(
+              "Keep running after build, watch sources root for changes "
+              "and rebuild affected units. Collected sources, build "
+              "history and build state are kept in memory between builds."
+          )
+          .action([&](llvm::StringRef) { Driver.setWatchMode(); })
+      .done()
+      .optional()
+          .multi()
+          .name("--focus")
+          .valueHint("<unit-id>")
+          .description(
+              "Start declaration AST and object of given unit, and "
+              "everything they depend on, before the rest of the project, "
+              "so that diagnostics for unit being edited come first. "
+              "May be repeated. In watch mode units whose sources were "
+              "just changed are focused too. Ignored with '-sched=dsf'."
+          )
+          .action([&](StringRef v) { Driver.addFocus(v); })
+      .done()
+      .optional(
+          "--focus-file", "<file>",
+          "Same as --focus, for IDs of units listed in file, one per line. "
+          "File is read again by each build, so that editor or IDE may "
+          "rewrite it whenever other unit is opened.",
+          [&](StringRef v) { Driver.setFocusFile(v); }
+      )
+      .flag()
+          .name("--in-process")
+          .description(
+              "Run compiler jobs within driver process, "
+              "instead of spawning clang process for each unit."
+          )
+          .action([&](llvm::StringRef) {
+            Driver.setExecutionMode(
+                tools::LevitationDriver::ExecutionMode::InProcess
+            );
+          })
+      .done()
+      .flag()
+          .name("--compile-servers")
+          .description(
+              "Start long-lived compile server processes, one per job, "
+              "and send compiler jobs to them. Unlike --in-process, "
+              "compiler crash only affects the job it was running."
+          )
+          .action([&](llvm::StringRef) {
+            Driver.setExecutionMode(
+                tools::LevitationDriver::ExecutionMode::CompileServer
+            );
+          })
+      .done()
+      .flag()
+          .name("--warm-preamble")
+          .description(
+              "Keep preamble loaded by driver process (--in-process) "
+              "or by compile servers (--compile-servers) between "
+              "compiler jobs, instead of reading it for each job. "
+              "With --watch and --in-process preamble also stays "
+              "loaded between rebuilds, until it is changed."
+          )
+          .action([&](llvm::StringRef) { Driver.setWarmPreamble(); })
+      .done()
+      .flag()
+          .name("--streaming")
+          .description(
+              "Build declaration of unit as soon as its dependencies are "
+              "parsed and built, without waiting for parse-import of "
+              "whole project."
+          )
+          .action([&](llvm::StringRef) { Driver.setStreaming(); })
+      .done()
+      .flag()
+          .name("--prefetch")
+          .description(
+              "Once job is started, ask OS to read declaration ASTs "
+              "and preambles its dependents need into page cache, so that "
+              "storage latency is hidden behind compilation. "
+              "Useful with slow or network disks."
+          )
+          .action([&](llvm::StringRef) { Driver.setPrefetch(); })
+      .done()
+      .flag()
+          .name("--no-import-scanner")
+          .description(
+              "Always run clang to parse #import directives. By default "
+              "dependencies are collected by in-driver scanner, and clang "
+              "is only used for sources scanner can't handle."
+          )
+          .action([&](llvm::StringRef) { Driver.disableImportScanner(); })
+      .done()
+      .optional()
+          .name("--parse-import-batch")
+          .valueHint("<N>")
+          .description(
+              "Parse #import directives of up to N sources by single "
+              "clang invocation, so that process startup is paid once "
+              "per batch. Only applies to sources import scanner "
+              "can't handle, or to all sources with --no-import-scanner."
+          )
+          .action<int>([&](int v) { Driver.setParseImportBatchSize(v); })
+      .done()
+      .flag()
+          .name("--no-name-index")
+          .description(
+              "Don't build and use name index of declaration ASTs. By "
+              "default index is written after each build, and it lets "
+              "compiler skip dependencies which know nothing about "
+              "looked up identifier."
+          )
+          .action([&](llvm::StringRef) { Driver.disableNameIndex(); })
+      .done()
+      .flag()
+          .name("--modules-codegen")
+          .description(
+              "Similar to clang's -fmodules-codegen. Inline functions and "
+              "implicit template instantiations are emitted once, "
+              "by object of unit they belong to. Other objects refer "
+              "to them as to external symbols."
+          )
+          .action([&](llvm::StringRef) { Driver.setModulesCodegen(); })
+      .done()
+      .flag()
+          .name("--modules-debuginfo")
+          .description(
+              "Similar to clang's -fmodules-debuginfo. Complete debug info "
+              "for classes is emitted once, by object of unit they "
+              "belong to. Other objects only refer to it."
+          )
+          .action([&](llvm::StringRef) { Driver.setModulesDebugInfo(); })
+      .done()
+      .flag()
+          .name("--instantiate-interface")
+          .description(
+              "Instantiate class template specializations used by value "
+              "in unit declarations, e.g. as return or parameter types, "
+              "and keep them in unit's declaration AST, "
+              "so that dependents reuse them instead of instantiating "
+              "them again."
+          )
+          .action([&](llvm::StringRef) { Driver.setInstantiateInterface(); })
+      .done()
+      .optional()
+          .name("--export-bodies")
+          .valueHint("<tokens>")
+          .description(
+              "Keep bodies of non-inline functions of given number of "
+              "tokens or less in unit's declaration AST, functions marked "
+              "always_inline are kept whatever their size is. Dependents "
+              "emit them as available_externally, so that optimizer may "
+              "inline them without LTO. Only declaration part of unit is "
+              "affected, since #body section is never parsed for "
+              "declaration AST. 0 disables it, this is default."
+          )
+          .action<int>([&](int v) { Driver.setExportBodies(v); })
+      .done()
+      .flag()
+          .name("--early-cutoff")
+          .description(
+              "Track declarations each object uses from its dependencies. "
+              "Object is not rebuilt when its dependencies are changed, "
+              "unless some of these declarations were changed."
+          )
+          .action([&](llvm::StringRef) { Driver.setEarlyCutoff(); })
+      .done()
+      .flag()
+          .name("--compact-decl-ast")
+          .description(
+              "Don't keep comments in declaration ASTs, so that they are "
+              "smaller and faster to load and cache. Comments are still "
+              "kept if -fparse-all-comments is passed to frontend."
+          )
+          .action([&](llvm::StringRef) { Driver.setCompactDeclAST(); })
+      .done()
+      .flag()
+          .name("--embed-meta")
+          .description(
+              "Store meta of declaration AST in declaration AST itself, "
+              "rather than in separate .decl-ast-meta file, so that there "
+              "is one file less to create, stat and cache per unit."
+          )
+          .action([&](llvm::StringRef) { Driver.setEmbedMeta(); })
+      .done()
+      .flag()
+          .name("--pack-artifacts")
+          .description(
+              "Keep meta files of build artifacts in single pack file "
+              "in build root, instead of one file per artifact."
+          )
+          .action([&](llvm::StringRef) { Driver.setPackArtifacts(); })
+      .done()
+      .flag()
+          .name("--reproducible")
+          .description(
+              "Keep paths within sources root relative to it in declaration "
+              "ASTs, object metas and debug info, so that artifacts and "
+              "build cache entries don't depend on sources location."
+          )
+          .action([&](llvm::StringRef) { Driver.setReproducible(); })
+      .done()
+      .flag()
+          .name("--hide-private-units")
+          .description(
+              "Compile units which are not part of public interface "
+              "(see #public) with hidden visibility, so that their symbols "
+              "are not exported. It is default for libraries "
+              "with #public units. Allows optimizer to drop and inline more, "
+              "and shrinks dynamic symbols table. Inline functions "
+              "of public units emitted by private objects become hidden "
+              "as well, unless --modules-codegen is used."
+          )
+          .action([&](llvm::StringRef) { Driver.setHidePrivateUnits(); })
+      .done()
+      .flag()
+          .name("--export-all-units")
+          .description(
+              "Export symbols of all units when building library. "
+              "By default, if library has #public units, then only "
+              "they are exported, and other units are compiled "
+              "with hidden visibility."
+          )
+          .action([&](llvm::StringRef) { Driver.setExportAllUnits(); })
+      .done()
+      .flag()
+          .name("-profile-generate")
+          .description(
+              "Build instrumented objects, which write execution profile. "
+              "Profile may be merged with llvm-profdata and passed "
+              "to -profile-use. Only objects are affected, they are kept "
+              "apart from regular ones, so switching between modes "
+              "doesn't reparse anything."
+          )
+          .action([&](llvm::StringRef) { Driver.setProfileGenerate(); })
+      .done()
+      .flag()
+          .name("--keep-ir")
+          .description(
+              "Keep unoptimized bitcode of each unit next to its object. "
+              "Objects are compiled from it with -FC and -FB args, "
+              "so that changes of optimization level (pass it with -FB) "
+              "or LLVM options only rerun backend, without parsing "
+              "and Sema."
+          )
+          .action([&](llvm::StringRef) { Driver.setKeepIR(); })
+      .done()
+      .flag()
+          .name("--release-ast")
+          .description(
+              "Release AST of unit and its dependencies once object job has "
+              "generated IR, before optimizations and code generation are "
+              "run, so that peak memory of job is not AST plus IR. "
+              "Redundant with --keep-ir, where backend is separate process."
+          )
+          .action([&](llvm::StringRef) { Driver.enableReleaseAST(); })
+      .done()
+      .optional()
+          .name("--split-codegen")
+          .valueHint("<ms>")
+          .description(
+              "Compile objects of units, whose object job took longer than "
+              "given number of milliseconds in previous build, with module "
+              "splitting. Module is split once optimized, and partitions "
+              "are code generated on several threads, each into its own "
+              "object, all of them are linked. Unit stays split once it "
+              "was. 0 disables splitting, this is default. Not applicable "
+              "with ThinLTO."
+          )
+          .action<int>([&](int v) { Driver.setSplitCodeGenAfter(v); })
+      .done()
+      .flag()
+          .name("--incremental-codegen")
+          .description(
+              "Experimental. Split objects (see --split-codegen) into "
+              "smaller partitions, and keep code of each partition in "
+              "build root by hash of its IR, so that once unit is "
+              "changed, only partitions with changed functions are code "
+              "generated again, others are copied. Optimization pipeline "
+              "still runs for whole unit."
+          )
+          .action([&](llvm::StringRef) { Driver.enableIncrementalCodeGen(); })
+      .done()
+      .optional(
+          "-profile-use", "<profdata>",
+          "Optimize objects using given profile. Objects are rebuilt "
+          "whenever profile is updated, declaration ASTs are reused.",
+          [&](StringRef v) { Driver.setProfileUse(v); }
+      )
+      .optional(
+          "--hot-units", "<file>",
+          "Compile objects of hot units with --hot-opt optimization "
+          "level, and objects of cold ones with --cold-opt level, other "
+          "units keep level of -FC args. File is either indexed "
+          "instrumented profile (.profdata), or list of hot unit IDs, "
+          "one per line (lines 'cold <unit>', 'warm <unit>' and "
+          "'default <hot|cold|warm>' are accepted as well, unlisted "
+          "units are cold by default). Units which run 90% of profile "
+          "counts are hot, units which never run are cold, functions "
+          "are matched to units by objects of previous build. Unit may "
+          "override it with '#pragma cppl optimize(hot|cold|warm|<level>)'.",
+          [&](StringRef v) { Driver.setHotUnits(v); }
+      )
+      .optional(
+          "--hot-opt", "<level>",
+          "Optimization level of hot units, e.g. 2 or 3, see --hot-units. "
+          "Default is 3.",
+          [&](StringRef v) { Driver.setHotOptLevel(v); }
+      )
+      .optional(
+          "--cold-opt", "<level>",
+          "Optimization level of cold units, e.g. 1, s or z, see "
+          "--hot-units. Default is s.",
+          [&](StringRef v) { Driver.setColdOptLevel(v); }
+      )
+      .flag()
+          .name("--split-dwarf")
+          .description(
+              "Emit debug info of objects into .dwo files next to them "
+              "(-gsplit-dwarf), so that linker only gets skeleton units. "
+              ".dwo files are cached along with objects. Not applicable "
+              "with ThinLTO, and disables --split-codegen."
+          )
+          .action([&](llvm::StringRef) { Driver.setSplitDwarf(); })
+      .done()
+      .flag()
+          .name("--dwp")
+          .description(
+              "Package .dwo files of each linked executable into "
+              "<executable>.dwp with llvm-dwp, once it is linked. "
+              "Packages of several targets are made in parallel. "
+              "Requires --split-dwarf."
+          )
+          .action([&](llvm::StringRef) { Driver.setDwarfPackage(); })
+      .done()
+      .optional(
+          "--symbol-ordering", "<file>",
+          "Lay out functions of linked executables in given order. "
+          "File is either lld symbol ordering file, e.g. made of perf "
+          "samples, or indexed instrumented profile (.profdata), then "
+          "ordering file is generated of it, hottest functions first. "
+          "Requires lld.",
+          [&](StringRef v) { Driver.setSymbolOrdering(v); }
+      )
+      .optional(
+          "-flto", "<thin>",
+          "Link time optimization mode, only 'thin' is supported. "
+          "Objects are emitted as bitcode, after thin-link step "
+          "backends are run in parallel, and their results are cached "
+          "in build root, so that relink only compiles changed parts "
+          "of program. Requires lld.",
+          [&](StringRef v) { Driver.setLTO(v); }
+      )
+      .flag()
+          .name("--whole-program-vtables")
+          .description(
+              "Devirtualize virtual calls with ThinLTO. Driver links whole "
+              "program, so classes of units which are not part of public "
+              "interface (see #public) get hidden LTO visibility, that is, "
+              "their hierarchies are known to be closed. Classes of "
+              "included headers, and of public units, keep regular rules. "
+              "Requires -flto=thin and link phase."
+          )
+          .action([&](llvm::StringRef) { Driver.setWholeProgramVTables(); })
+      .done()
+      .optional(
+          "--linker", "<lld|bfd|gold|system>",
+          "Linker used for link phase. Default is lld, which links "
+          "in parallel. 'system' stands for default linker of clang driver.",
+          [&](StringRef v) { Driver.setLinker(v); }
+      )
+      .optional()
+          .name("--link-threads")
+          .valueHint("<N>")
+          .description(
+              "Number of lld threads. By default all hardware "
+              "threads are used."
+          )
+          .action<int>([&](int v) { Driver.setLinkerThreads(v); })
+      .done()
+      .flag()
+          .name("--partial-link")
+          .description(
+              "Link objects of each top-level package directory into "
+              "relocatable object first, and relink it only when some of "
+              "its objects change. Final link then deals with few partial "
+              "objects instead of all program objects. Ignored with ThinLTO."
+          )
+          .action([&](StringRef) { Driver.setPartialLink(); })
+      .done()
+      .flag()
+          .name("--shared-packages")
+          .description(
+              "Developer build mode. Link each top-level package directory "
+              "into its own shared library, and link executable against "
+              "them. Change of package only relinks its library. "
+              "Objects are built as position independent code."
+          )
+          .action([&](StringRef) { Driver.setSharedPackages(); })
+      .done()
+      .optional(
+          "--archive", "<file>",
+          "In library mode (-c) put project objects into static archive. "
+          "Archive is only rewritten if some of objects were changed, "
+          "and unchanged members are taken from previous archive.",
+          [&](StringRef v) { Driver.setArchive(v); }
+      )
+      .flag()
+          .name("--thin-archive")
+          .description(
+              "Make --archive a thin archive, which refers to objects "
+              "in build directory instead of keeping their copies."
+          )
+          .action([&](StringRef) { Driver.setThinArchive(); })
+      .done()
+      .optional(
+          "--amalgamated-header", "<file>",
+          "In library mode (-c) put headers of all public project units "
+          "into single header, in order of their dependencies. "
+          "Includes of amalgamated headers are removed, and other "
+          "includes are only kept once.",
+          [&](StringRef v) { Driver.setAmalgamatedHeader(v); }
+      )
+      .flag()
+          .name("--module-map")
+          .description(
+              "In library mode (-c) write module.modulemap into output "
+              "headers directory, so that headers of public units may be "
+              "imported as clang modules. Each unit is submodule of its "
+              "package, e.g. 'net::http' is module 'net.http'."
+          )
+          .action([&](StringRef) { Driver.setEmitModuleMap(); })
+      .done()
+      .optional(
+          "--headers-pch", "<file>",
+          "In library mode (-c) precompile headers of all public project "
+          "units into given PCH, with -FH args, for consumers which "
+          "include them with -include-pch.",
+          [&](StringRef v) { Driver.setHeadersPCH(v); }
+      )
+      .optional(
+          "--make-bundle", "<file>",
+          "In library mode (-c) put sources, declaration ASTs and "
+          "dependencies of project units into single library bundle, "
+          "which may be used by other projects with +B.",
+          [&](StringRef v) { Driver.setMakeBundle(v); }
+      )
+      .flag()
+          .name("--unity")
+          .description(
+              "Build definitions of sibling units with overlapping "
+              "dependencies in batches. Batch is compiled by single "
+              "worker in-process, and dependencies common for batch are "
+              "loaded once. Each unit still gets its own object."
+          )
+          .action([&](StringRef) { Driver.setUnity(); })
+      .done()
+      .optional()
+          .name("--unity-size")
+          .valueHint("<N>")
+          .description("Maximum number of definitions in unity batch.")
+          .action<int>([&](int v) { Driver.setUnitySize(v); })
+      .done()
+      .optional(
+          "--thinlto-executor", "<program>",
+          "Run ThinLTO backend jobs through given program, e.g. to "
+          "dispatch them to remote workers. It is called as "
+          "'<program> thinlto-backend <command...>'. Besides object and "
+          "its .thinlto.bc index, backend reads bitcode objects listed "
+          "in <object>.imports. Program should produce output object "
+          "and return zero exit code on success.",
+          [&](StringRef v) { Driver.setThinLTOExecutor(v); }
+      )
+      .optional(
+          "--remote-executor", "<program>",
+          "Run declaration AST and object jobs through given program, "
+          "e.g. a Remote Execution API client. It is called as "
+          "'<program> <decl-ast|object> <command...>'. Files job reads "
+          "(source, preamble, declaration ASTs of all dependencies) are "
+          "listed in <output>.inputs, and files it should produce are "
+          "listed in <output>.outputs, one per line. Program should "
+          "place outputs locally and return zero exit code on success.",
+          [&](StringRef v) { Driver.setRemoteExecutor(v); }
+      )
+      .optional()
+          .name("--remote-workers")
+          .valueHint("<N>")
+          .description(
+              "Number of workers behind remote executor. Jobs are split "
+              "between workers, so that jobs which share declaration "
+              "ASTs go to same worker, and workers are balanced by "
+              "jobs durations recorded in build history. Worker of job "
+              "is written into <output>.worker."
+          )
+          .action<int>([&](int v) { Driver.setRemoteWorkers(v); })
+      .done()
+      .optional()
+          .name("--speculate-after")
+          .valueHint("<percent>")
+          .description(
+              "Once delegated job on critical path runs longer than given "
+              "percent of its expected duration, launch its duplicate, on "
+              "another worker if --remote-workers is set, and take result "
+              "of whichever succeeds first. Expected duration is duration "
+              "of unit step in previous build, or 95th percentile of same "
+              "steps durations for new units. Executor should place "
+              "outputs atomically, since both copies write same files. "
+              "0 disables duplicates, this is default."
+          )
+          .action<int>([&](int v) { Driver.setSpeculateAfter(v); })
+      .done()
+      .optional(
+          "--shard", "<i>/<n>",
+          "Compile only i-th of n parts of objects, i is counted from 1. "
+          "Objects are split deterministically, so that objects which "
+          "share declaration ASTs go to same shard, and each shard "
+          "only builds or fetches declaration ASTs its objects depend "
+          "on. Link phase is skipped. Shards are expected to share "
+          "build cache, so that final build without --shard fetches "
+          "all objects and links them.",
+          [&](StringRef v) { Driver.setShard(v); }
+      )
+      .optional()
+          .multi()
+          .name("-target")
+          .valueHint("<unit-id>")
+          .description(
+              "Build and link only given main unit, that is its definition, "
+              "definitions of units it uses, directly or indirectly, and "
+              "their declaration ASTs. Unit ID is unit path relative to "
+              "sources root, without extension and with '::' as separator, "
+              "e.g. 'tools::server::main'. May be repeated, in this case "
+              "each target is linked into its own executable, in parallel, "
+              "and -o specifies output directory, e.g. 'tools::server::main' "
+              "is linked into '<output>/tools/server/main'."
+          )
+          .action([&](StringRef v) { Driver.addTarget(v); })
+      .done()
+      .flag()
+          .name("--test")
+          .description(
+              "Run linked executables as tests, without arguments, in "
+              "current directory. With several -target, each target is run "
+              "as soon as it is linked, while other targets are still being "
+              "linked. Tests run in 'test' pool (see -pool), output of "
+              "failed tests is printed, and build fails if any test fails."
+          )
+          .action([&](StringRef) { Driver.setRunTests(); })
+      .done()
+      .optional(
+          "--junit", "<file>",
+          "Write results of --test as JUnit XML report, implies --test.",
+          [&](StringRef v) { Driver.setJUnitFile(v); }
+      )
+      .flag()
+          .name("--link-reachable")
+          .description(
+              "Compile and link only units reachable from main unit (see "
+              "--main-unit), that is main unit definition, definitions "
+              "of units it uses, directly or indirectly, and their "
+              "declaration ASTs. Same as '-target <main unit>'. "
+              "Note: units which are only referred to by static "
+              "initializers of their own, e.g. self-registering plugins, "
+              "are dropped too, so they should be imported by some "
+              "reachable unit."
+          )
+          .action([&](StringRef) { Driver.setLinkReachable(); })
+      .done()
+      .optional(
+          "--main-unit", "<unit-id>",
+          "ID of unit which defines main, for --link-reachable. "
+          "Default is 'main', that is main.cppl in sources root.",
+          [&](StringRef v) { Driver.setMainUnit(v); }
+      )
+      .optional()
+          .multi()
+          .name("--affected")
+          .valueHint("<file>[,<file>...]")
+          .description(
+              "Don't build anything, but print IDs of units whose objects "
+              "depend on given changed files, one per line. If -target is "
+              "set, only affected targets are printed. Dependencies are "
+              "taken from previous build, so project should be built "
+              "first. Changes of preamble or files in include directories "
+              "affect everything. May be repeated."
+          )
+          .action([&](StringRef v) { Driver.addChangedFiles(v); })
+      .done()
+      .optional(
+          "--suggest-preamble", "<file>",
+          "Don't build anything, but write preamble which covers "
+          "<...> headers worth to be precompiled. Each header is parsed "
+          "alone to measure its cost, and it is suggested if time units "
+          "spend to parse it exceeds time all units would spend "
+          "to load it from preamble. Dependencies are taken from previous "
+          "build, so project should be built first. Includes of current "
+          "preamble are kept.",
+          [&](StringRef v) { Driver.setSuggestPreamble(v); }
+      )
+      .flag()
+          .name("--advise")
+          .description(
+              "Don't build anything, but print units ranked by rebuild "
+              "impact, that is how often unit interface has changed, "
+              "times time its dependents take to rebuild, and by load "
+              "cost, that is how much dependents read from its "
+              "declaration. For top units tells which imports could be "
+              "[bodydep], and which units are worth to be split. "
+              "Dependencies and timings are taken from previous builds, "
+              "load cost needs --dependency-stats. With -v all units "
+              "are printed."
+          )
+          .action([&](StringRef) { Driver.setAdvise(); })
+      .done()
+      .flag()
+          .name("--prewarm-cache")
+          .description(
+              "Don't build anything, but parse imports of current sources, "
+              "solve dependencies and fetch declaration ASTs and objects "
+              "of dirty units from build cache in parallel, so that next "
+              "build mostly finds them up-to-date. Units which are not "
+              "in cache, and their dependents, are left for the build. "
+              "Meant to be run after branch switch, e.g. from git "
+              "post-checkout hook. If build may start meanwhile, use "
+              "--shared-build-root for both.")
+          .action([&](StringRef) { Driver.setPrewarmCache(); })
+      .done()
+      .optional(
+          "--emit-ninja", "<file>",
+          "Don't build anything, but parse imports, solve dependencies "
+          "and write ninja file with preamble, declaration, object "
+          "and link commands. Paths are same as driver uses, so ninja "
+          "should be run from same directory. File is kept untouched "
+          "if build plan is same.",
+          [&](StringRef v) { Driver.setEmitNinja(v); }
+      )
+      .flag()
+          .name("--gc")
+          .description(
+              "Don't build anything, but remove declaration ASTs, objects "
+              "and their metas left by units which were removed or "
+              "renamed, and trim local build cache, see "
+              "--cache-max-size and --cache-max-age."
+          )
+          .action([&](llvm::StringRef) { Driver.setGC(); })
+      .done()
+      .flag()
+          .name("--auto-gc")
+          .description(
+              "Same as --gc, but done after each successful build."
+          )
+          .action([&](llvm::StringRef) { Driver.setAutoGC(); })
+      .done()
+      .flag()
+          .name("--time-report")
+          .description(
+              "Print summary of time spent in each build phase, "
+              "and list of slowest jobs."
+          )
+          .action([&](llvm::StringRef) { Driver.enableTimeReport(); })
+      .done()
+      .flag()
+          .name("--unit-time-trace")
+          .description(
+              "Run decl-ast and object jobs with -ftime-trace, and print "
+              "units which spent most time in frontend, in template "
+              "instantiation, and in loading dependencies. "
+              "Traces are merged into --trace output, if it is set."
+          )
+          .action([&](llvm::StringRef) { Driver.enableUnitTimeTrace(); })
+      .done()
+      .flag()
+          .name("--dependency-stats")
+          .description(
+              "Make decl-ast and object jobs write how many declarations, "
+              "types and identifiers they deserialized from each "
+              "dependency, and time spent on loading it. Stats are "
+              "written as JSON next to job output, "
+              "in <output>.stats.json file. After build, imports "
+              "nothing was used from, and declaration imports used "
+              "in #body only, are reported."
+          )
+          .action([&](llvm::StringRef) { Driver.enableDependencyStats(); })
+      .done()
+      .flag()
+          .name("--replay-diagnostics")
+          .description(
+              "Make decl-ast and object jobs write their diagnostics "
+              "next to job output, in <output>.dia file (clang's "
+              "--serialize-diagnostics format), and keep them in build "
+              "cache along with output. Diagnostics of units which are "
+              "up-to-date or taken from cache are printed again, so "
+              "warnings don't disappear from incremental builds."
+          )
+          .action([&](llvm::StringRef) { Driver.enableReplayDiagnostics(); })
+      .done()
+      .flag()
+          .name("--private-imports")
+          .description(
+              "Treat declaration level imports, unit declaration uses "
+              "nothing from, as [bodydep] ones, so that they are not "
+              "propagated to dependents. Imports are inferred from "
+              "dependencies stats of previous build, which are enabled "
+              "by this option, see --dependency-stats. Import is kept, "
+              "if some dependent has used anything it brings."
+          )
+          .action([&](llvm::StringRef) { Driver.enablePrivateImports(); })
+      .done()
+      .flag()
+          .name("--skip-empty-objects")
+          .description(
+              "Don't compile and link objects of units which emit no code, "
+              "that is units which only have declarations, inline "
+              "functions, templates and internal constants. Units are "
+              "recognized by their declaration AST builds, so unit whose "
+              "declaration AST is not built (nobody imports it) is "
+              "compiled as usual."
+          )
+          .action([&](llvm::StringRef) { Driver.setSkipEmptyObjects(); })
+      .done()
+      .flag()
+          .name("--stats")
+          .description(
+              "After build, print driver counters: nodes checked and "
+              "rebuilt, build and files cache hits and misses, bytes "
+              "hashed, metas loaded, processes spawned, time spent "
+              "waiting for tasks, and workers idle time. Counters "
+              "are always collected, so this flag costs nothing."
+          )
+          .action([&](llvm::StringRef) { Driver.enableStats(); })
+      .done()
+      .flag()
+          .name("--explain")
+          .description(
+              "Print why each rebuilt declaration or object was rebuilt: "
+              "preamble or header unit updated, dependency updated, "
+              "source changed, or meta missing or unreadable. "
+              "Rebuilds caused by dependencies are followed back "
+              "to the node which started the chain."
+          )
+          .action([&](llvm::StringRef) { Driver.enableExplain(); })
+      .done()
+      .optional(
+          "--explain-json", "<file>",
+          "Same as --explain, but rebuild reasons are also written "
+          "into given file as JSON.",
+          [&](StringRef v) { Driver.setExplainOutput(v); }
+      )
+      .optional(
+          "--export-graph", "<file.dot|file.json>",
+          "After build, export dependencies graph into DOT or JSON file. "
+          "Each node comes with its kind, public and external flags, "
+          "fan-in and fan-out, number of nodes it affects and needs "
+          "transitively, last compile time and peak memory, and its "
+          "position on critical path.",
+          [&](StringRef v) { Driver.setExportGraph(v); }
+      )
+      .optional(
+          "--metrics", "<file.prom|file.json>",
+          "After each build, write build metrics: build and steps "
+          "durations, nodes checked and rebuilt, build cache hit ratio, "
+          "processes spawned, steps peak memory and critical path "
+          "length. File is in Prometheus text format, or OTLP/JSON "
+          "metrics export request if it has .json extension.",
+          [&](StringRef v) { Driver.setMetricsOutput(v); }
+      )
+      .optional(
+          "--metrics-push", "<program>",
+          "Push metrics written with --metrics through given program. "
+          "It is called as '<program> <file>' after file is written, "
+          "e.g. a script which posts it to Prometheus pushgateway or "
+          "OpenTelemetry collector. Failed push is only a warning.",
+          [&](StringRef v) { Driver.setMetricsPushCommand(v); }
+      )
+      .optional(
+          "--budgets", "<file>",
+          "After each build, check units against performance budgets. "
+          "Each line of file is unit ID, or '<package>::*', or '*', "
+          "followed by limits, e.g. 'net::* compile-time=20s "
+          "peak-rss=1G decl-ast=4M closure=400 fan-in=50'. Closure is "
+          "number of declarations unit needs directly or indirectly, "
+          "fan-in is number of units which import it directly. Exceeded "
+          "budgets are reported as warnings.",
+          [&](StringRef v) { Driver.setBudgetsFile(v); }
+      )
+      .flag()
+          .name("--enforce-budgets")
+          .description("Fail build if any of --budgets is exceeded.")
+          .action([&](StringRef) { Driver.setEnforceBudgets(); })
+      .done()
+      .flag()
+          .name("--no-progress")
+          .description(
+              "Don't show '[done/total] phase unit, ETA' status line. "
+              "It is only shown on terminal, and never in verbose mode.")
+          .action([&](StringRef) { Driver.disableProgress(); })
+      .done()
+      .optional(
+          "--status-fd", "<fd>",
+          "Write progress of declaration and object jobs into given file "
+          "descriptor, one JSON object per line: event ('started' or "
+          "'finished'), phase, unit, done, total, running, elapsed_ms "
+          "and eta_ms. ETA is based on durations from build history. "
+          "Meant for CI logs and IDEs, e.g. '--status-fd 3 3>status.jsonl'.",
+          [&](StringRef v) {
+            int FD;
+            Driver.setStatusFD(v.getAsInteger(10, FD) ? -2 : FD);
+          }
+      )
+      .optional(
+          "--compile-commands", "<compile_commands.json>",
+          "After build, write compilation database with object command "
+          "of each unit. Commands load preamble and declaration ASTs "
+          "built by cppl, so clangd can parse .cppl units with "
+          "their imports resolved.",
+          [&](StringRef v) { Driver.setCompileCommands(v); }
+      )
+      .flag()
+          .name("--compile-commands-phases")
+          .description(
+              "Also write parse-import and decl-ast commands of each unit "
+              "into compilation database, so that it describes all "
+              "compiler invocations of the build. Object commands go "
+              "first for each file, tools which pick single command "
+              "per file still get object one.")
+          .action([&](StringRef) { Driver.setCompileCommandsPhases(); })
+      .done()
+      .flag()
+          .name("--tidy")
+          .description(
+              "After declarations are built, run clang-tidy once per unit "
+              "definition, in parallel. Dependencies are loaded from "
+              "declaration ASTs, and unit is checked again only if "
+              "it or its dependencies have changed. Fixes are exported "
+              "next to unit declaration AST, with '.tidy.yaml' extension."
+          )
+          .action([&](StringRef) { Driver.setTidy(); })
+      .done()
+      .flag()
+          .name("--check")
+          .description(
+              "Check units without building them. Declarations are built "
+              "as usual, then each unit definition is parsed with "
+              "declaration ASTs of its dependencies, but neither IR, "
+              "nor object is generated, and nothing is linked. Unit is "
+              "checked again only if it or its dependencies have changed."
+          )
+          .action([&](StringRef) { Driver.setCheck(); })
+      .done()
+      .optional(
+          "--tidy-checks", "<checks>",
+          "Same as --tidy, but clang-tidy is run with given checks.",
+          [&](StringRef v) { Driver.setTidyChecks(v); }
+      )
       .flag()
           .name("-###")
           .description(
@@ -180,6 +1319,30 @@ int levitation_driver_main(int argc, char **argv) {
           .useParser<KeySpaceValueParser>()
           .action([&](StringRef v) { Driver.setExtraCodeGenArgs(v); })
       .done()
+      .optional()
+          .name("-FB")
+          .valueHint("<args>")
+          .description(
+              "Extra args for backend phase, used with --keep-ir only. "
+              "Those flags are passed to clang, when it compiles "
+              "unoptimized bitcode into object."
+          )
+          .useParser<KeySpaceValueParser>()
+          .action([&](StringRef v) { Driver.setExtraBackendArgs(v); })
+      .done()
+      .optional()
+          .multi()
+          .name("--config")
+          .valueHint("<name>:<args>")
+          .description(
+              "Add build configuration with extra codegen args, e.g. "
+              "--config 'debug:-O0 -g'. Declaration ASTs are shared "
+              "between configurations, and each configuration "
+              "builds its own objects and links <name>/<output>."
+          )
+          .useParser<KeySpaceValueParser>()
+          .action([&](StringRef v) { Driver.addConfig(v); })
+      .done()
       .optional()
           .name("-FL")
           .valueHint("<args>")
@@ -200,6 +1363,18 @@ int levitation_driver_main(int argc, char **argv) {
           .useParser<KeyValueInOneWordParser>()
           .action([&](StringRef v) { Driver.addLevitationLibPath(v); })
       .done()
+      .optional()
+          .multi()
+          .name("+B")
+          .valueHint("<file>")
+          .description(
+              "Add prebuilt levitation library bundle (see --make-bundle). "
+              "Bundled declarations are used as is, unless preamble "
+              "has been changed."
+          )
+          .useParser<KeyValueInOneWordParser>()
+          .action([&](StringRef v) { Driver.addLevitationBundle(v); })
+      .done()
       .optional()
           .multi()
           .name("-I")
@@ -225,6 +1400,42 @@ int levitation_driver_main(int argc, char **argv) {
 }
 
 int main(int argc, char **argv) {
+  // Compile server mode is internal, and is used by driver itself,
+  // so we don't expose it among regular options.
+  if (
+    (argc == 4 || argc == 5) &&
+    tools::CompileServer::getServerOption() == argv[1]
+  )
+    return tools::CompileServer::serve(
+        argv[2], argv[3],
+        argc == 5 && tools::CompileServer::getWarmPreambleOption() == argv[4]
+    );
+
+  // Build systems pass their worker option among other
+  // startup options.
+  for (int i = 1; i != argc; ++i)
+    if (tools::PersistentWorker::getWorkerOption() == argv[i]) {
+      auto Format = tools::WorkerProtocol::Format::Proto;
+      for (int j = 1; j != argc; ++j) {
+        StringRef Arg = argv[j];
+        if (!Arg.consume_front(tools::PersistentWorker::getProtocolOption()))
+          continue;
+        if (Arg == "json")
+          Format = tools::WorkerProtocol::Format::JSON;
+        else if (Arg != "proto") {
+          llvm::errs() << "Unknown worker protocol '" << Arg << "'.\n";
+          return RES_WRONG_ARGUMENTS;
+        }
+      }
+
+      SinglePath ClangPath = llvm::sys::path::parent_path(
+          getCommandPath(argv[0])
+      );
+      llvm::sys::path::append(ClangPath, "clang++");
+
+      return tools::PersistentWorker::serve(Format, ClangPath);
+    }
+
   return levitation_driver_main(argc, argv);
 }
 
@@ -13,16 +13,59 @@
 
 #define LEVITATION_ENABLE_TASK_MANAGER_LOGS
 
+#include "clang/Levitation/BuildHistory/BuildHistory.h"
+#include "clang/Levitation/BuildState/BuildState.h"
+#include "clang/Levitation/Common/DependencyStats.h"
+#include "clang/Levitation/Common/HashingStream.h"
 #include "clang/Levitation/Common/SimpleLogger.h"
+#include "clang/Levitation/DeclASTMeta/DeclASTMeta.h"
+#include "clang/Levitation/DependenciesSolver/DependenciesGraph.h"
+#include "clang/Levitation/DependenciesSolver/DependenciesGraphExport.h"
+#include "clang/Levitation/DependenciesSolver/DependenciesIndex.h"
+#include "clang/Levitation/DependenciesSolver/ParsedDependencies.h"
+#include "clang/Levitation/DependenciesSolver/SolvedDependenciesInfo.h"
+#include "clang/Levitation/Driver/ArtifactPublisher.h"
+#include "clang/Levitation/Driver/BuildCache.h"
+#include "clang/Levitation/Driver/BuildJournal.h"
+#include "clang/Levitation/Driver/BuildProgress.h"
+#include "clang/Levitation/Driver/BuildMetrics.h"
+#include "clang/Levitation/Driver/CompileCommands.h"
+#include "clang/Levitation/Driver/GraphAdvisor.h"
+#include "clang/Levitation/Driver/HotUnits.h"
+#include "clang/Levitation/Driver/JUnitReport.h"
+#include "clang/Levitation/Driver/ModuleMap.h"
+#include "clang/Levitation/Driver/NinjaPlan.h"
+#include "clang/Levitation/Driver/PerformanceBudgets.h"
+#include "clang/Levitation/Driver/PersistentWorker.h"
+#include "clang/Levitation/Driver/PrivateImports.h"
+#include "clang/Levitation/Driver/TimeTraceReport.h"
+#include "clang/Levitation/Driver/UnsavedFiles.h"
+#include "clang/Levitation/Driver/UnusedImports.h"
+#include "clang/Levitation/ImportScanner.h"
+#include "clang/Levitation/Serialization.h"
 #include "clang/Levitation/TasksManager/TasksManager.h"
+#include "clang/Levitation/TasksManager/ConcurrencyController.h"
+#include "clang/Levitation/TasksManager/WorkerPlacement.h"
+#include "llvm/Bitstream/BitstreamReader.h"
+#include "llvm/Bitstream/BitstreamWriter.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/FileUtilities.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/raw_ostream.h"
 #include "gtest/gtest.h"
 
+#include <atomic>
 #include <chrono>
+#include <future>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <thread>
 
 using namespace llvm;
 using namespace clang;
 using namespace levitation;
+using namespace levitation::dependencies_solver;
 
 namespace {
 class LevitationUnitTests : public ::testing::Test {
@@ -165,4 +208,2310 @@ TEST_F(LevitationUnitTests, RunTask) {
   EXPECT_EQ(TS11, tasks::TasksManager::TaskStatus::Successful);
 }
 
+TEST_F(LevitationUnitTests, TaskSlotsRecycling) {
+
+  tasks::TasksManager TM(2);
+
+  std::vector<tasks::TasksManager::TaskID> TIDs;
+  for (int i = 0; i != 1000; ++i)
+    TIDs.push_back(TM.addTask([=] (tasks::TasksManager::TaskContext &TC) {
+      TC.Successful = i % 3 != 0;
+    }));
+
+  EXPECT_TRUE(TM.waitForTasks());
+
+  // Statuses are kept after task slots are reused.
+  for (int i = 0; i != 1000; ++i)
+    EXPECT_EQ(
+        TM.getTaskStatus(TIDs[i]),
+        i % 3 ?
+            tasks::TasksManager::TaskStatus::Successful :
+            tasks::TasksManager::TaskStatus::Failed
+    );
+
+  EXPECT_TRUE(TM.allSuccessfull({TIDs[1], TIDs[2]}));
+  EXPECT_FALSE(TM.allSuccessfull({TIDs[1], TIDs[3]}));
+}
+
+TEST_F(LevitationUnitTests, TaskContinuations) {
+
+  // Without workers continuations are executed by caller.
+  for (int NumWorkers : {0, 2}) {
+    tasks::TasksManager TM(NumWorkers);
+
+    std::atomic<int> A { 0 }, B { 0 }, C { 0 };
+
+    auto FA = TM.runTask([&] (tasks::TasksManager::TaskContext &TC) {
+      A = 1;
+    });
+
+    auto FB = TM.runTask([&] (tasks::TasksManager::TaskContext &TC) {
+      B = 2;
+    });
+
+    auto FC = TM.whenAll({FA, FB}, [&] (tasks::TasksManager::TaskContext &TC) {
+      C = A + B;
+    }).then([&] (tasks::TasksManager::TaskContext &TC) {
+      C = C * 10;
+    });
+
+    EXPECT_TRUE(FC.get());
+    EXPECT_EQ(C, 30);
+
+    // Failure is propagated through the chain, skipping its actions.
+    bool Executed = false;
+
+    auto FFailed = TM.runTask([&] (tasks::TasksManager::TaskContext &TC) {
+      TC.Successful = false;
+    });
+
+    auto FSkipped = FFailed.then([&] (tasks::TasksManager::TaskContext &TC) {
+      Executed = true;
+    }).then([&] (tasks::TasksManager::TaskContext &TC) {
+      Executed = true;
+    });
+
+    auto FBarrier = TM.whenAll({FSkipped, FC});
+
+    EXPECT_FALSE(FBarrier.get());
+    EXPECT_FALSE(Executed);
+    EXPECT_EQ(
+        TM.getTaskStatus(FSkipped),
+        tasks::TasksManager::TaskStatus::Failed
+    );
+
+    EXPECT_TRUE(TM.waitForTasks());
+  }
+}
+
+TEST_F(LevitationUnitTests, WorkStealing) {
+
+  const int NumTasks = 100;
+  std::atomic<int> Counter { 0 };
+
+  {
+    tasks::TasksManager TM(4, tasks::TasksManager::QueueKind::WorkStealing);
+
+    for (int i = 0; i != NumTasks; ++i) {
+      TM.addTask([&] (tasks::TasksManager::TaskContext &Context) {
+        ++Counter;
+
+        // Inner task goes into the worker's own queue,
+        // and may be stolen by its peers.
+        TM.addTask([&] (tasks::TasksManager::TaskContext &Context) {
+          ++Counter;
+        });
+      });
+
+      TM.runTask([&] (tasks::TasksManager::TaskContext &Context) {
+        ++Counter;
+      });
+    }
+
+    EXPECT_TRUE(TM.waitForTasks());
+  }
+
+  EXPECT_EQ(Counter, 3 * NumTasks);
+}
+
+TEST_F(LevitationUnitTests, TasksManagerWaitAndIdleTime) {
+
+  using QueueKind = tasks::TasksManager::QueueKind;
+
+  for (auto Kind : { QueueKind::Shared, QueueKind::WorkStealing }) {
+    tasks::TasksManager TM(2, Kind);
+
+    // Let workers fall asleep, so that they are idle for a while.
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+    auto TID = TM.addTask([] (tasks::TasksManager::TaskContext &) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    });
+
+    EXPECT_TRUE(TM.waitForTasks({TID}));
+    EXPECT_GE(TM.getWaitTime(), 1000u);
+    EXPECT_GE(TM.getIdleTime(), 1000u);
+  }
+}
+
+TEST_F(LevitationUnitTests, WorkerPlacement) {
+  using tasks::WorkerPlacement;
+
+  std::vector<unsigned> CPUs;
+  EXPECT_TRUE(WorkerPlacement::parseCPUList("0-2,8,10-11\n", CPUs));
+  EXPECT_EQ(CPUs, std::vector<unsigned>({0, 1, 2, 8, 10, 11}));
+
+  CPUs.clear();
+  EXPECT_FALSE(WorkerPlacement::parseCPUList("3-1", CPUs));
+  EXPECT_FALSE(WorkerPlacement::parseCPUList("a", CPUs));
+
+  WorkerPlacement Placement;
+  Placement.Domains = {{0, 1}, {2, 3}};
+
+  // Workers are split round robin, and workers of
+  // domain are picked round robin too.
+  EXPECT_EQ(Placement.getDomain(0), 0u);
+  EXPECT_EQ(Placement.getDomain(3), 1u);
+  EXPECT_EQ(Placement.getWorkerOfDomain(1, 0, 5), 1);
+  EXPECT_EQ(Placement.getWorkerOfDomain(1, 1, 5), 3);
+  EXPECT_EQ(Placement.getWorkerOfDomain(1, 2, 5), 1);
+  EXPECT_EQ(Placement.getWorkerOfDomain(0, 2, 5), 4);
+  EXPECT_EQ(Placement.getWorkerOfDomain(1, 0, 1), -1);
+
+  // Without domains, all workers are in single one.
+  EXPECT_EQ(WorkerPlacement().getDomain(7), 0u);
+}
+
+TEST_F(LevitationUnitTests, ConcurrencyController) {
+  using tasks::ConcurrencyController;
+
+  ConcurrencyController::Pressure P;
+  EXPECT_TRUE(ConcurrencyController::parsePressure(
+      "some avg10=1.50 avg60=0.90 avg300=0.20 total=12345\n"
+      "full avg10=0.25 avg60=0.10 avg300=0.00 total=678\n",
+      P
+  ));
+  EXPECT_EQ(P.Some, 1.5);
+  EXPECT_EQ(P.Full, 0.25);
+
+  // Older kernels have no "full" line for cpu.
+  EXPECT_TRUE(ConcurrencyController::parsePressure(
+      "some avg10=3.00 avg60=0.00 avg300=0.00 total=0\n", P
+  ));
+  EXPECT_EQ(P.Full, 0.);
+
+  EXPECT_FALSE(ConcurrencyController::parsePressure("", P));
+  EXPECT_FALSE(ConcurrencyController::parsePressure("some avg10=x", P));
+
+  ConcurrencyController::State S;
+  S.Min = 1;
+  S.Max = 8;
+  S.Limit = 4;
+
+  ConcurrencyController::Sample Smp;
+  Smp.HasPSI = true;
+  Smp.Throttled = true;
+  Smp.Throughput = 2;
+
+  // Idle cores and throttled jobs, probe one more job.
+  EXPECT_EQ(ConcurrencyController::adjust(S, Smp), 5u);
+
+  // Throughput has grown, keep it and probe further.
+  Smp.Throughput = 3;
+  EXPECT_EQ(ConcurrencyController::adjust(S, Smp), 6u);
+
+  // Probe has made things worse, roll it back and hold.
+  Smp.Throughput = 2;
+  EXPECT_EQ(ConcurrencyController::adjust(S, Smp), 5u);
+  for (unsigned i = 0; i != ConcurrencyController::CooldownSamples; ++i)
+    EXPECT_EQ(ConcurrencyController::adjust(S, Smp), 5u);
+  EXPECT_EQ(ConcurrencyController::adjust(S, Smp), 6u);
+
+  // Busy cores, nothing to gain.
+  S.Probing = false;
+  Smp.CPU.Some = 90;
+  EXPECT_EQ(ConcurrencyController::adjust(S, Smp), 6u);
+
+  // Memory stalls lower limit at once, but not below minimum.
+  Smp.Memory.Full = 5;
+  EXPECT_EQ(ConcurrencyController::adjust(S, Smp), 4u);
+  EXPECT_EQ(ConcurrencyController::adjust(S, Smp), 3u);
+  EXPECT_EQ(ConcurrencyController::adjust(S, Smp), 2u);
+  EXPECT_EQ(ConcurrencyController::adjust(S, Smp), 1u);
+  EXPECT_EQ(ConcurrencyController::adjust(S, Smp), 1u);
+}
+
+TEST_F(LevitationUnitTests, TasksManagerJobsLimit) {
+  tasks::TasksManager TM(4);
+  TM.setJobsLimit(2);
+
+  std::atomic<int> Running { 0 };
+  std::atomic<int> MaxRunning { 0 };
+
+  tasks::TasksManager::TasksSet Tasks;
+  for (int i = 0; i != 8; ++i)
+    Tasks.insert(TM.addTask([&] (tasks::TasksManager::TaskContext &) {
+      TM.acquireJob();
+      int N = ++Running;
+      int Max = MaxRunning;
+      while (N > Max && !MaxRunning.compare_exchange_weak(Max, N)) {}
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+      --Running;
+      TM.releaseJob();
+    }));
+
+  EXPECT_TRUE(TM.waitForTasks(Tasks));
+  EXPECT_LE(MaxRunning, 2);
+  EXPECT_EQ(TM.getNumCompletedJobs(), 8u);
+}
+
+TEST_F(LevitationUnitTests, TasksManagerPools) {
+  tasks::TasksManager TM(4);
+  TM.setPoolLimit("link", 1);
+
+  std::atomic<int> RunningLinks { 0 };
+  std::atomic<int> MaxRunningLinks { 0 };
+  std::atomic<int> NumObjects { 0 };
+
+  tasks::TasksManager::TasksSet Tasks;
+  for (int i = 0; i != 8; ++i) {
+    bool IsLink = i % 2;
+    Tasks.insert(TM.addTask([&, IsLink] (tasks::TasksManager::TaskContext &) {
+      if (!IsLink) {
+        // Jobs of pools without limit only obey jobs limit.
+        TM.acquireJob("obj");
+        ++NumObjects;
+        TM.releaseJob("obj");
+        return;
+      }
+
+      TM.acquireJob("link");
+      int N = ++RunningLinks;
+      int Max = MaxRunningLinks;
+      while (N > Max && !MaxRunningLinks.compare_exchange_weak(Max, N)) {}
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+      --RunningLinks;
+      TM.releaseJob("link");
+    }));
+  }
+
+  EXPECT_TRUE(TM.waitForTasks(Tasks));
+  EXPECT_EQ(MaxRunningLinks, 1);
+  EXPECT_EQ(NumObjects, 4);
+
+  // Pool limits are not throttling by jobs limit.
+  EXPECT_EQ(TM.getNumThrottledJobs(), 0u);
+}
+
+TEST_F(LevitationUnitTests, TasksManagerRandomGraphs) {
+
+  using TaskID = tasks::TasksManager::TaskID;
+  using TaskStatus = tasks::TasksManager::TaskStatus;
+  using QueueKind = tasks::TasksManager::QueueKind;
+
+  const int NumTasks = 200;
+
+  for (unsigned Seed = 0; Seed != 16; ++Seed) {
+    std::mt19937 Rnd(Seed);
+
+    // Without workers tasks are only run by caller.
+    int NumWorkers = Rnd() % 5;
+    auto Kind = Seed % 2 ? QueueKind::WorkStealing : QueueKind::Shared;
+
+    std::vector<std::vector<int>> Predecessors(NumTasks);
+    std::vector<bool> Fails(NumTasks), Succeeds(NumTasks), Runs(NumTasks);
+    std::vector<int> NumChildren(NumTasks);
+
+    for (int i = 0; i != NumTasks; ++i) {
+      for (int p = 0, e = i ? Rnd() % 4 : 0; p != e; ++p)
+        Predecessors[i].push_back(Rnd() % i);
+
+      Fails[i] = Rnd() % 10 == 0;
+      NumChildren[i] = Rnd() % 3;
+
+      Runs[i] = true;
+      for (auto P : Predecessors[i])
+        Runs[i] = Runs[i] && Succeeds[P];
+      Succeeds[i] = Runs[i] && !Fails[i];
+    }
+
+    std::vector<std::atomic<int>> Executed(NumTasks);
+    std::vector<TaskID> IDs(NumTasks);
+    std::vector<TaskStatus> Statuses(NumTasks);
+
+    // Deadlock is only seen as hanging, so graph is run by separate
+    // thread, and we give up if it doesn't finish in time.
+    std::promise<void> Done;
+    std::thread Runner([&] {
+      tasks::TasksManager TM(NumWorkers, Kind);
+
+      for (int i = 0; i != NumTasks; ++i) {
+        auto Action = [&, i] (tasks::TasksManager::TaskContext &TC) {
+          ++Executed[i];
+
+          // Children are run and waited for from inside of task.
+          tasks::TasksManager::TasksSet Children;
+          for (int c = 0; c != NumChildren[i]; ++c)
+            Children.insert(
+                TM.runTask([] (tasks::TasksManager::TaskContext &) {})
+            );
+          TM.waitForTasks(Children);
+
+          TC.Successful = !Fails[i];
+        };
+
+        if (!Predecessors[i].empty()) {
+          tasks::TasksManager::TasksSet Preds;
+          for (auto P : Predecessors[i])
+            Preds.insert(IDs[P]);
+          IDs[i] = TM.whenAll(Preds, std::move(Action));
+        } else if (NumWorkers && i % 2) {
+          IDs[i] = TM.addTask(std::move(Action));
+        } else {
+          IDs[i] = TM.runTask(std::move(Action));
+        }
+      }
+
+      TM.waitForTasks();
+
+      for (int i = 0; i != NumTasks; ++i)
+        Statuses[i] = TM.getTaskStatus(IDs[i]);
+
+      Done.set_value();
+    });
+
+    auto Status = Done.get_future().wait_for(std::chrono::seconds(60));
+    if (Status != std::future_status::ready) {
+      llvm::errs() << "Tasks graph with seed " << Seed << " hangs.\n";
+      std::abort();
+    }
+    Runner.join();
+
+    for (int i = 0; i != NumTasks; ++i) {
+      EXPECT_EQ(Executed[i], Runs[i] ? 1 : 0)
+          << "seed " << Seed << ", task " << i;
+      EXPECT_EQ(
+          Statuses[i], Succeeds[i] ? TaskStatus::Successful : TaskStatus::Failed
+      ) << "seed " << Seed << ", task " << i;
+    }
+  }
+}
+
+void addTestUnit(
+    ParsedDependencies &Parsed,
+    DependenciesStringsPool &Strings,
+    StringRef Unit,
+    std::initializer_list<StringRef> Deps
+) {
+  DependenciesData Data;
+  Data.IsPublic = false;
+  Data.IsBodyOnly = false;
+  for (auto Dep : Deps)
+    Data.DeclarationDependencies.insert(
+        Declaration(Data.Strings->addItem(Dep))
+    );
+  Parsed.add(Strings.addItem(Unit), Data);
+}
+
+// Units graph:
+//   A <- B <- C
+//   A <- D
+std::shared_ptr<DependenciesGraph> buildTestGraph(
+    DependenciesStringsPool &Strings
+) {
+  ParsedDependencies Parsed(Strings);
+
+  auto addUnit = [&] (StringRef Unit, std::initializer_list<StringRef> Deps) {
+    addTestUnit(Parsed, Strings, Unit, Deps);
+  };
+
+  addUnit("A", {});
+  addUnit("B", {"A"});
+  addUnit("C", {"B"});
+  addUnit("D", {"A"});
+
+  return DependenciesGraph::build(Parsed, {});
+}
+
+DependenciesGraph::NodeID::Type getDeclNodeID(
+    DependenciesStringsPool &Strings,
+    StringRef Unit
+) {
+  return DependenciesGraph::NodeID::get(
+      DependenciesGraph::NodeKind::Declaration, Strings.addItem(Unit)
+  );
+}
+
+TEST_F(LevitationUnitTests, DependenciesGraphCompactForm) {
+
+  DependenciesStringsPool Strings;
+  auto Graph = buildTestGraph(Strings);
+  ASSERT_FALSE(Graph->isInvalid());
+  ASSERT_TRUE(Graph->isFinalized());
+
+  // 4 declaration and 4 definition nodes.
+  ASSERT_EQ(Graph->getNumNodes(), 8u);
+
+  using NodeFlag = DependenciesGraph::NodeFlag;
+
+  for (DependenciesGraph::NodeIndex Idx = 0; Idx != 8; ++Idx) {
+    const auto &N = Graph->getNodeByIndex(Idx);
+    EXPECT_EQ(Graph->getNodeIndex(N.ID), Idx);
+
+    auto Deps = Graph->getDependencies(Idx);
+    EXPECT_EQ(Deps.size(), N.Dependencies.size());
+    for (auto DepIdx : Deps)
+      EXPECT_TRUE(N.Dependencies.count(Graph->getNodeByIndex(DepIdx).ID));
+
+    auto Dependents = Graph->getDependentNodes(Idx);
+    EXPECT_EQ(Dependents.size(), N.DependentNodes.size());
+    for (auto DependentIdx : Dependents)
+      EXPECT_TRUE(
+          N.DependentNodes.count(Graph->getNodeByIndex(DependentIdx).ID)
+      );
+
+    EXPECT_EQ(Graph->hasFlag(Idx, NodeFlag::Root), N.Dependencies.empty());
+    EXPECT_EQ(
+        Graph->hasFlag(Idx, NodeFlag::Terminal), N.DependentNodes.empty()
+    );
+  }
+
+  auto AIdx = Graph->getNodeIndex(getDeclNodeID(Strings, "A"));
+  EXPECT_EQ(Graph->getDependentNodes(AIdx).size(), 4u);
+}
+
+TEST_F(LevitationUnitTests, SolvedFullDependencies) {
+
+  // Solver traces nodes with global strings pool.
+  auto &Strings = CreatableSingleton<DependenciesStringsPool>::create();
+  auto Graph = buildTestGraph(Strings);
+  ASSERT_FALSE(Graph->isInvalid());
+
+  auto Info = SolvedDependenciesInfo::build(Graph);
+  ASSERT_TRUE(Info->isValid());
+
+  auto A = getDeclNodeID(Strings, "A");
+  auto B = getDeclNodeID(Strings, "B");
+  auto C = getDeclNodeID(Strings, "C");
+  auto D = getDeclNodeID(Strings, "D");
+
+  EXPECT_TRUE(Info->getFullDependencies(A).empty());
+
+  // Dependencies go before their dependent nodes.
+  auto CDeps = Info->getFullDependencies(C);
+  ASSERT_EQ(CDeps.size(), 2u);
+  EXPECT_EQ(CDeps[0], A);
+  EXPECT_EQ(CDeps[1], B);
+
+  auto DDeps = Info->getFullDependencies(D);
+  ASSERT_EQ(DDeps.size(), 1u);
+  EXPECT_EQ(DDeps[0], A);
+}
+
+TEST_F(LevitationUnitTests, SolvedFullDependenciesParallel) {
+
+  auto &Strings = CreatableSingleton<DependenciesStringsPool>::create();
+  ParsedDependencies Parsed(Strings);
+
+  // Root, two wide levels, and unit which depends on everything,
+  // so that level closures are built by workers.
+  const unsigned Width = 100;
+  std::vector<std::string> Mid, Top;
+  for (unsigned i = 0; i != Width; ++i) {
+    Mid.push_back("M" + std::to_string(i));
+    Top.push_back("T" + std::to_string(i));
+  }
+
+  addTestUnit(Parsed, Strings, "R", {});
+  for (unsigned i = 0; i != Width; ++i)
+    addTestUnit(Parsed, Strings, Mid[i], {"R"});
+  for (unsigned i = 0; i != Width; ++i)
+    addTestUnit(Parsed, Strings, Top[i], {Mid[i], Mid[(i + 1) % Width]});
+
+  DependenciesData Z;
+  Z.IsPublic = false;
+  Z.IsBodyOnly = false;
+  for (const auto &T : Top)
+    Z.DeclarationDependencies.insert(Declaration(Z.Strings->addItem(T)));
+  Parsed.add(Strings.addItem("Z"), Z);
+
+  auto Graph = DependenciesGraph::build(Parsed, {});
+  ASSERT_FALSE(Graph->isInvalid());
+
+  tasks::TasksManager::create(4);
+
+  auto Info = SolvedDependenciesInfo::build(Graph);
+  ASSERT_TRUE(Info->isValid());
+
+  auto R = getDeclNodeID(Strings, "R");
+  for (unsigned i = 0; i != Width; ++i) {
+    auto Deps = Info->getFullDependencies(getDeclNodeID(Strings, Top[i]));
+    ASSERT_EQ(Deps.size(), 3u);
+    EXPECT_EQ(Deps[0], R);
+  }
+
+  auto ZDeps = Info->getFullDependencies(getDeclNodeID(Strings, "Z"));
+  EXPECT_EQ(ZDeps.size(), 2 * Width + 1);
+  EXPECT_EQ(ZDeps[0], R);
+}
+
+TEST_F(LevitationUnitTests, SolvedWorkersPartition) {
+
+  DependenciesStringsPool Strings;
+  auto Graph = buildTestGraph(Strings);
+  ASSERT_FALSE(Graph->isInvalid());
+
+  auto Info = SolvedDependenciesInfo::build(Graph);
+  ASSERT_TRUE(Info->isValid());
+
+  auto Workers = Info->partitionWorkers(
+      2, [] (const DependenciesGraph::Node &) { return 1; }
+  );
+  ASSERT_EQ(Workers.size(), 8u);
+
+  unsigned Loads[2] = { 0, 0 };
+  for (auto &NW : Workers) {
+    ASSERT_LT(NW.second, 2u);
+    ++Loads[NW.second];
+  }
+
+  // Capacity is average load and 10%, rounded up.
+  EXPECT_LE(Loads[0], 5u);
+  EXPECT_LE(Loads[1], 5u);
+
+  EXPECT_GT(Loads[0], 0u);
+  EXPECT_GT(Loads[1], 0u);
+
+  // All other dependent nodes depend on declaration of A, so
+  // without balancing they stay where it is.
+  auto Unbalanced = Info->partitionWorkers(
+      2, [] (const DependenciesGraph::Node &) { return 1; }, 1.0
+  );
+  auto A = getDeclNodeID(Strings, "A");
+  for (auto &NW : Unbalanced) {
+    if (!Graph->getNode(NW.first).Dependencies.empty()) {
+      EXPECT_EQ(NW.second, Unbalanced[A]);
+    }
+  }
+
+  auto Single = Info->partitionWorkers(
+      1, [] (const DependenciesGraph::Node &) { return 1; }
+  );
+  ASSERT_EQ(Single.size(), 8u);
+  for (auto &NW : Single)
+    EXPECT_EQ(NW.second, 0u);
+}
+
+TEST_F(LevitationUnitTests, SolvedShardsPartition) {
+
+  DependenciesStringsPool Strings;
+  auto Graph = buildTestGraph(Strings);
+  ASSERT_FALSE(Graph->isInvalid());
+
+  auto Info = SolvedDependenciesInfo::build(Graph);
+  ASSERT_TRUE(Info->isValid());
+
+  using Node = DependenciesGraph::Node;
+
+  auto isDefinition = [] (const Node &N) {
+    return N.Kind == DependenciesGraph::NodeKind::Definition;
+  };
+
+  auto Less = [&] (const Node &L, const Node &R) {
+    auto LPath = *Strings.getItem(L.LevitationUnit->UnitPath);
+    auto RPath = *Strings.getItem(R.LevitationUnit->UnitPath);
+    if (LPath != RPath)
+      return LPath < RPath;
+    return L.Kind < R.Kind;
+  };
+
+  // Nodes go in topological order, and then by path.
+  auto Order = Info->getOrderedNodes(Less);
+  ASSERT_EQ(Order.size(), 8u);
+  EXPECT_EQ(Graph->getNodeByIndex(Order[0]).ID, getDeclNodeID(Strings, "A"));
+  for (size_t i = 0; i != Order.size(); ++i)
+    for (auto DepIdx : Graph->getDependencies(Order[i]))
+      EXPECT_NE(
+          std::find(Order.begin(), Order.begin() + i, DepIdx),
+          Order.begin() + i
+      );
+
+  // Declarations are not placed, only definitions are.
+  auto Shards = Info->partitionWorkers(
+      2,
+      [&] (const Node &N) { return isDefinition(N) ? 1 : 0; },
+      0.1,
+      Less
+  );
+  ASSERT_EQ(Shards.size(), 4u);
+
+  unsigned Loads[2] = { 0, 0 };
+  for (auto &NS : Shards) {
+    EXPECT_TRUE(isDefinition(Graph->getNode(NS.first)));
+    ++Loads[NS.second];
+  }
+  EXPECT_LE(Loads[0], 3u);
+  EXPECT_LE(Loads[1], 3u);
+
+  // C definition shares declarations of A and B with B definition.
+  auto getDefNodeID = [&] (StringRef Unit) {
+    return DependenciesGraph::NodeID::get(
+        DependenciesGraph::NodeKind::Definition, Strings.addItem(Unit)
+    );
+  };
+  EXPECT_EQ(Shards[getDefNodeID("B")], Shards[getDefNodeID("C")]);
+}
+
+TEST_F(LevitationUnitTests, DependenciesGraphCycles) {
+
+  DependenciesStringsPool Strings;
+  ParsedDependencies Parsed(Strings);
+
+  // Units graph:
+  //   A <- B <-> C <- D
+  //   E <-> F (isolated)
+  addTestUnit(Parsed, Strings, "A", {});
+  addTestUnit(Parsed, Strings, "B", {"A", "C"});
+  addTestUnit(Parsed, Strings, "C", {"B"});
+  addTestUnit(Parsed, Strings, "D", {"C"});
+  addTestUnit(Parsed, Strings, "E", {"F"});
+  addTestUnit(Parsed, Strings, "F", {"E"});
+
+  auto Graph = DependenciesGraph::build(Parsed, {});
+  EXPECT_TRUE(Graph->isInvalid());
+  ASSERT_TRUE(Graph->isFinalized());
+
+  // Edges inside of cycles are cut, so graph is acyclic after build.
+  using NodeIndex = DependenciesGraph::NodeIndex;
+  DependenciesGraph::StronglyConnectedComponents SCC(*Graph);
+  size_t NumComponents = 0;
+  for (NodeIndex Idx = 0, e = Graph->getNumNodes(); Idx != e; ++Idx)
+    SCC.walk(Idx, [&] (llvm::ArrayRef<NodeIndex> C) {
+      EXPECT_FALSE(SCC.isCycle(C));
+      ++NumComponents;
+    });
+  EXPECT_EQ(NumComponents, Graph->getNumNodes());
+
+  auto Info = SolvedDependenciesInfo::build(Graph);
+  EXPECT_TRUE(Info->isValid());
+
+  auto A = getDeclNodeID(Strings, "A");
+  auto D = getDeclNodeID(Strings, "D");
+  EXPECT_TRUE(Graph->getNode(A).Dependencies.empty());
+  EXPECT_EQ(Graph->getNode(D).Dependencies.size(), 1u);
+}
+
+TEST_F(LevitationUnitTests, ReadyQueueJobs) {
+
+  DependenciesStringsPool Strings;
+  auto Graph = buildTestGraph(Strings);
+  ASSERT_FALSE(Graph->isInvalid());
+
+  tasks::TasksManager::create(2);
+
+  std::mutex OrderMutex;
+  DenseMap<DependenciesGraph::NodeID::Type, size_t> Order;
+
+  bool Res = Graph->readyQueueJobs([&] (const DependenciesGraph::Node &N) {
+    auto _ = lock(OrderMutex);
+    for (auto Dep : N.Dependencies)
+      EXPECT_TRUE(Order.count(Dep));
+    Order.insert({N.ID, Order.size()});
+    return true;
+  });
+
+  EXPECT_TRUE(Res);
+
+  // 4 declaration and 4 definition nodes.
+  EXPECT_EQ(Order.size(), 8u);
+
+  // If job fails, then its dependent nodes should not be started.
+  auto FailedNID = getDeclNodeID(Strings, "B");
+
+  Order.clear();
+  Res = Graph->readyQueueJobs([&] (const DependenciesGraph::Node &N) {
+    auto _ = lock(OrderMutex);
+    EXPECT_FALSE(N.Dependencies.count(FailedNID));
+    Order.insert({N.ID, Order.size()});
+    return N.ID != FailedNID;
+  });
+
+  EXPECT_FALSE(Res);
+
+  // Everything but C's declaration and C's definition, for both of them
+  // depend on B's declaration.
+  EXPECT_EQ(Order.size(), 6u);
+}
+
+TEST_F(LevitationUnitTests, DsfJobs) {
+
+  DependenciesStringsPool Strings;
+  auto Graph = buildTestGraph(Strings);
+  ASSERT_FALSE(Graph->isInvalid());
+
+  tasks::TasksManager::create(2);
+
+  std::mutex OrderMutex;
+  DenseMap<DependenciesGraph::NodeID::Type, size_t> Order;
+
+  bool Res = Graph->dsfJobs([&] (const DependenciesGraph::Node &N) {
+    auto _ = lock(OrderMutex);
+    for (auto Dep : N.Dependencies)
+      EXPECT_TRUE(Order.count(Dep));
+    EXPECT_TRUE(Order.insert({N.ID, Order.size()}).second);
+    return true;
+  });
+
+  EXPECT_TRUE(Res);
+  EXPECT_EQ(Order.size(), 8u);
+
+  auto FailedNID = getDeclNodeID(Strings, "B");
+
+  Order.clear();
+  Res = Graph->dsfJobs([&] (const DependenciesGraph::Node &N) {
+    auto _ = lock(OrderMutex);
+    EXPECT_FALSE(N.Dependencies.count(FailedNID));
+    Order.insert({N.ID, Order.size()});
+    return N.ID != FailedNID;
+  });
+
+  EXPECT_FALSE(Res);
+  EXPECT_EQ(Order.size(), 6u);
+}
+
+TEST_F(LevitationUnitTests, CriticalPaths) {
+
+  DependenciesStringsPool Strings;
+  auto Graph = buildTestGraph(Strings);
+  ASSERT_FALSE(Graph->isInvalid());
+
+  auto Paths = Graph->calcCriticalPaths(
+      [] (const DependenciesGraph::Node &N) { return 1; }
+  );
+
+  EXPECT_EQ(Paths[getDeclNodeID(Strings, "A")], 3u);
+  EXPECT_EQ(Paths[getDeclNodeID(Strings, "B")], 2u);
+  EXPECT_EQ(Paths[getDeclNodeID(Strings, "C")], 1u);
+  EXPECT_EQ(Paths[getDeclNodeID(Strings, "D")], 1u);
+
+  tasks::TasksManager::create(0);
+
+  // With single thread nodes are started strictly by priority,
+  // so B's declaration must go before D's one.
+  SmallVector<DependenciesGraph::NodeID::Type, 8> Order;
+  bool Res = Graph->readyQueueJobs(
+      [&] (const DependenciesGraph::Node &N) {
+        Order.push_back(N.ID);
+        return true;
+      },
+      &Paths
+  );
+
+  EXPECT_TRUE(Res);
+  ASSERT_EQ(Order.size(), 8u);
+  EXPECT_EQ(Order[0], getDeclNodeID(Strings, "A"));
+  EXPECT_EQ(Order[1], getDeclNodeID(Strings, "B"));
+}
+
+TEST_F(LevitationUnitTests, DependenciesGraphExport) {
+
+  DependenciesStringsPool Strings;
+  auto Graph = buildTestGraph(Strings);
+  ASSERT_FALSE(Graph->isInvalid());
+
+  auto Dependents = Graph->calcClosureSizes(/*ByDependents=*/true);
+  auto Dependencies = Graph->calcClosureSizes(/*ByDependents=*/false);
+
+  auto AIdx = Graph->getNodeIndex(getDeclNodeID(Strings, "A"));
+  auto BIdx = Graph->getNodeIndex(getDeclNodeID(Strings, "B"));
+  auto CIdx = Graph->getNodeIndex(getDeclNodeID(Strings, "C"));
+
+  EXPECT_EQ(Dependents[AIdx], 6u);
+  EXPECT_EQ(Dependents[BIdx], 2u);
+  EXPECT_EQ(Dependents[CIdx], 0u);
+  EXPECT_EQ(Dependencies[CIdx], 2u);
+
+  DependenciesGraphExport Export(*Graph, Strings, [&] (
+      const DependenciesGraph::Node &N
+  ) {
+    DependenciesGraphExport::NodeCosts Costs;
+    Costs.Duration = N.ID == getDeclNodeID(Strings, "A") ? 5000 : 1000;
+    return Costs;
+  });
+
+  auto Records = Export.getRecords();
+  ASSERT_EQ(Records.size(), 8u);
+  EXPECT_EQ(Records[AIdx].Unit, "A");
+  EXPECT_EQ(Records[AIdx].NumDependents, 4u);
+  EXPECT_EQ(Records[AIdx].NumTransitiveDependents, 6u);
+  EXPECT_EQ(Records[AIdx].CriticalPathPosition, 0);
+  EXPECT_EQ(Records[BIdx].CriticalPathPosition, 1);
+  EXPECT_EQ(Export.getCriticalPathLength(), 7000u);
+
+  DependenciesGraphExport::Format Format;
+  ASSERT_TRUE(DependenciesGraphExport::getFormat("graph.json", Format));
+  EXPECT_EQ(Format, DependenciesGraphExport::Format::Json);
+  EXPECT_FALSE(DependenciesGraphExport::getFormat("graph.txt", Format));
+
+  std::string Json;
+  llvm::raw_string_ostream JsonOut(Json);
+  Export.write(JsonOut, Format);
+  JsonOut.flush();
+
+  auto Parsed = llvm::json::parse(Json);
+  ASSERT_TRUE((bool)Parsed);
+  const auto *Nodes = Parsed->getAsObject()->getArray("nodes");
+  ASSERT_TRUE(Nodes);
+  EXPECT_EQ(Nodes->size(), 8u);
+
+  std::string Dot;
+  llvm::raw_string_ostream DotOut(Dot);
+  Export.write(DotOut, DependenciesGraphExport::Format::Dot);
+  DotOut.flush();
+  EXPECT_TRUE(StringRef(Dot).startswith("digraph levitation {"));
+  EXPECT_NE(Dot.find("color=red"), std::string::npos);
+}
+
+TEST_F(LevitationUnitTests, BuildHistorySerialization) {
+
+  BuildHistory History;
+  History.setDuration(BuildHistory::StepKind::ParseImport, "A.cppl", 10);
+  History.setDuration(BuildHistory::StepKind::BuildDecl, "A.cppl", 20);
+  History.setDuration(BuildHistory::StepKind::BuildObject, "B/C.cppl", 1ULL << 40);
+  History.setPeakMemory(BuildHistory::StepKind::BuildObject, "B/C.cppl", 3ULL << 33);
+  History.addInterfaceChanges("A.cppl", 3);
+
+  std::string Buffer;
+  {
+    raw_string_ostream OS(Buffer);
+    CreateBuildHistoryBitstreamWriter(OS)->writeAndFinalize(History);
+  }
+
+  auto MemBuf = MemoryBuffer::getMemBuffer(Buffer, "", false);
+
+  BuildHistory Loaded;
+  auto Reader = CreateBuildHistoryBitstreamReader(*MemBuf);
+  ASSERT_TRUE(Reader->read(Loaded));
+
+  EXPECT_EQ(
+      Loaded.getDuration(BuildHistory::StepKind::ParseImport, "A.cppl"),
+      Optional<uint64_t>(10)
+  );
+  EXPECT_EQ(
+      Loaded.getDuration(BuildHistory::StepKind::BuildDecl, "A.cppl"),
+      Optional<uint64_t>(20)
+  );
+  EXPECT_EQ(
+      Loaded.getDuration(BuildHistory::StepKind::BuildObject, "B/C.cppl"),
+      Optional<uint64_t>(1ULL << 40)
+  );
+  EXPECT_FALSE(
+      Loaded.getDuration(BuildHistory::StepKind::BuildObject, "A.cppl")
+  );
+  EXPECT_EQ(
+      Loaded.getPeakMemory(BuildHistory::StepKind::BuildObject, "B/C.cppl"),
+      Optional<uint64_t>(3ULL << 33)
+  );
+  EXPECT_FALSE(
+      Loaded.getPeakMemory(BuildHistory::StepKind::BuildDecl, "A.cppl")
+  );
+  EXPECT_EQ(Loaded.getInterfaceChanges("A.cppl"), 3u);
+  EXPECT_EQ(Loaded.getInterfaceChanges("B/C.cppl"), 0u);
+
+  // Interface changes are accumulated rather than overridden.
+  BuildHistory Timings;
+  Timings.addInterfaceChanges("A.cppl");
+  Loaded.merge(Timings);
+  EXPECT_EQ(Loaded.getInterfaceChanges("A.cppl"), 4u);
+}
+
+
+TEST_F(LevitationUnitTests, BuildStateSerialization) {
+
+  BuildState::ProductState A;
+  A.Source = { 1ULL << 40, 100 };
+  A.SourceHash = { 1, 2, 3 };
+  A.Product = { 5, 1ULL << 33 };
+  A.ProductHash = { 4, 5 };
+  A.Includes = {{"inc/a.h", { 3, 1ULL << 35 }}, {"inc/b.h", {}}};
+  A.CommandHash = { 6, 7 };
+
+  BuildState::ProductState B;
+  B.Source = { 7, 8 };
+  B.SourceHash = { 9 };
+
+  BuildState State;
+  State.set("A.decl-ast", A);
+  State.set("B/C.o", B);
+
+  std::string Buffer;
+  {
+    raw_string_ostream OS(Buffer);
+    CreateBuildStateBitstreamWriter(OS)->writeAndFinalize(State);
+  }
+
+  auto MemBuf = MemoryBuffer::getMemBuffer(Buffer, "", false);
+
+  BuildState Loaded;
+  auto Reader = CreateBuildStateBitstreamReader(*MemBuf);
+  ASSERT_TRUE(Reader->read(Loaded));
+
+  const auto *LoadedA = Loaded.get("A.decl-ast");
+  ASSERT_TRUE(LoadedA);
+  EXPECT_TRUE(LoadedA->Source == A.Source);
+  EXPECT_TRUE(LoadedA->Product == A.Product);
+  EXPECT_TRUE(equal(LoadedA->SourceHash, A.SourceHash));
+  EXPECT_TRUE(equal(LoadedA->ProductHash, A.ProductHash));
+  ASSERT_EQ(LoadedA->Includes.size(), 2u);
+  EXPECT_EQ(LoadedA->Includes[0].Path, "inc/a.h");
+  EXPECT_TRUE(LoadedA->Includes[0].Stamp == A.Includes[0].Stamp);
+  EXPECT_TRUE(LoadedA->Includes[1].Stamp == BuildState::FileStamp());
+  EXPECT_TRUE(equal(LoadedA->CommandHash, A.CommandHash));
+
+  const auto *LoadedB = Loaded.get("B/C.o");
+  ASSERT_TRUE(LoadedB);
+  EXPECT_TRUE(LoadedB->Source == B.Source);
+  EXPECT_TRUE(equal(LoadedB->SourceHash, B.SourceHash));
+  EXPECT_TRUE(LoadedB->ProductHash.empty());
+  EXPECT_TRUE(LoadedB->Includes.empty());
+  EXPECT_TRUE(LoadedB->CommandHash.empty());
+
+  EXPECT_FALSE(Loaded.get("A.o"));
+}
+
+TEST_F(LevitationUnitTests, BuildJournalParse) {
+  using namespace clang::levitation::tools;
+
+  BuildJournal::Entry A;
+  A.Declaration = true;
+  A.Updated = true;
+  A.Source = { 1ULL << 40, 100 };
+  A.Product = { 5, 1ULL << 33 };
+
+  BuildJournal::Entry A2 = A;
+  A2.Updated = false;
+  A2.Product = { 6, 7 };
+
+  BuildJournal::Entry B;
+  B.Source = { 7, 8 };
+  B.Product = { 9, 10 };
+
+  std::string Buffer;
+  {
+    raw_string_ostream OS(Buffer);
+    BuildJournal::write(OS, "A.decl-ast", A);
+    OS << "D 1 garbage\n";
+    BuildJournal::write(OS, "dir with spaces/B.o", B);
+    BuildJournal::write(OS, "A.decl-ast", A2);
+
+    // Record torn by interruption.
+    OS << "O 1 1 2 3";
+  }
+
+  BuildJournal::EntriesMap Entries;
+  BuildJournal::parse(Buffer, Entries);
+  ASSERT_EQ(Entries.size(), 2u);
+
+  // Last stamps win, while updates are kept.
+  const auto &LoadedA = Entries["A.decl-ast"];
+  EXPECT_TRUE(LoadedA.Declaration);
+  EXPECT_TRUE(LoadedA.Updated);
+  EXPECT_TRUE(LoadedA.Source == A2.Source);
+  EXPECT_TRUE(LoadedA.Product == A2.Product);
+
+  ASSERT_TRUE(Entries.count("dir with spaces/B.o"));
+  const auto &LoadedB = Entries["dir with spaces/B.o"];
+  EXPECT_FALSE(LoadedB.Declaration);
+  EXPECT_FALSE(LoadedB.Updated);
+  EXPECT_TRUE(LoadedB.Source == B.Source);
+  EXPECT_TRUE(LoadedB.Product == B.Product);
+}
+
+TEST_F(LevitationUnitTests, UnsavedFilesOverlay) {
+  using namespace clang::levitation::tools;
+
+  llvm::IntrusiveRefCntPtr<llvm::vfs::InMemoryFileSystem> Disk(
+      new llvm::vfs::InMemoryFileSystem()
+  );
+  Disk->addFile("/src/A.cppl", 0, MemoryBuffer::getMemBuffer("saved A"));
+  Disk->addFile("/src/B.cppl", 0, MemoryBuffer::getMemBuffer("saved B"));
+
+  llvm::IntrusiveRefCntPtr<UnsavedFiles> FS(new UnsavedFiles(Disk));
+
+  auto read = [&] (StringRef Path) -> std::string {
+    auto Buffer = FS->getBufferForFile(Path);
+    return Buffer ? (*Buffer)->getBuffer().str() : "<none>";
+  };
+
+  FS->set("/src/dir/../A.cppl", "unsaved A buffer");
+  EXPECT_FALSE(FS->empty());
+  EXPECT_EQ(read("/src/A.cppl"), "unsaved A buffer");
+  EXPECT_EQ(read("/src/B.cppl"), "saved B");
+
+  auto Status = FS->status("/src/A.cppl");
+  ASSERT_TRUE((bool)Status);
+  EXPECT_EQ(Status->getSize(), 16u);
+  EXPECT_TRUE(Status->isRegularFile());
+
+  // Each set is seen as new file version.
+  FS->set("/src/A.cppl", "edited");
+  auto Edited = FS->status("/src/A.cppl");
+  ASSERT_TRUE((bool)Edited);
+  EXPECT_EQ(Edited->getSize(), 6u);
+  EXPECT_NE(Edited->getUniqueID(), Status->getUniqueID());
+
+  auto Paths = FS->getPaths();
+  ASSERT_EQ(Paths.size(), 1u);
+  EXPECT_EQ(Paths[0], "/src/A.cppl");
+
+  EXPECT_TRUE(FS->remove("/src/A.cppl"));
+  EXPECT_FALSE(FS->remove("/src/A.cppl"));
+  EXPECT_TRUE(FS->empty());
+  EXPECT_EQ(read("/src/A.cppl"), "saved A");
+}
+
+TEST_F(LevitationUnitTests, DependenciesIndexSerialization) {
+
+  DependenciesData B;
+  B.IsPublic = true;
+  B.IsBodyOnly = false;
+  B.DeclarationDependencies.insert(Declaration(B.Strings->addItem("A")));
+  B.DefinitionDependencies.insert(Declaration(B.Strings->addItem("C")));
+
+  DependenciesData C;
+  C.IsPublic = false;
+  C.IsBodyOnly = true;
+  C.DefinitionDependencies.insert(Declaration(C.Strings->addItem("A")));
+
+  DependenciesIndex Index;
+  Index.setDependencies("B", {1, 2, 3}, B);
+  Index.setDependencies("C", {4}, C);
+  Index.setDependencies("D", {5}, C);
+  EXPECT_TRUE(Index.isChanged());
+
+  Index.removeUnits([] (StringRef Unit) { return Unit == "D"; });
+  EXPECT_EQ(Index.size(), 2u);
+
+  std::string Buffer;
+  {
+    raw_string_ostream OS(Buffer);
+    Index.write(OS);
+  }
+
+  auto MemBuf = MemoryBuffer::getMemBuffer(Buffer, "", false);
+
+  DependenciesIndex Loaded;
+  ASSERT_TRUE(Loaded.read(*MemBuf).isValid());
+  EXPECT_EQ(Loaded.size(), 2u);
+  EXPECT_FALSE(Loaded.isChanged());
+
+  uint8_t BHash[] = {1, 2, 3};
+  uint8_t OtherHash[] = {1, 2};
+
+  DependenciesData LoadedB;
+  ASSERT_TRUE(Loaded.getDependencies(LoadedB, "B", BHash));
+  EXPECT_TRUE(LoadedB.IsPublic);
+  EXPECT_FALSE(LoadedB.IsBodyOnly);
+  ASSERT_EQ(LoadedB.DeclarationDependencies.size(), 1u);
+  EXPECT_EQ(
+      *LoadedB.Strings->getItem(
+          LoadedB.DeclarationDependencies.begin()->UnitIdentifier
+      ),
+      "A"
+  );
+  ASSERT_EQ(LoadedB.DefinitionDependencies.size(), 1u);
+  EXPECT_EQ(
+      *LoadedB.Strings->getItem(
+          LoadedB.DefinitionDependencies.begin()->UnitIdentifier
+      ),
+      "C"
+  );
+
+  // Source was changed since record was made.
+  DependenciesData Stale;
+  EXPECT_FALSE(Loaded.getDependencies(Stale, "B", OtherHash));
+  EXPECT_FALSE(Loaded.getDependencies(Stale, "D", OtherHash));
+
+  // Same dependencies don't change index.
+  Loaded.setDependencies("B", BHash, B);
+  EXPECT_FALSE(Loaded.isChanged());
+
+  auto Truncated = MemoryBuffer::getMemBuffer(
+      StringRef(Buffer).drop_back(4), "", false
+  );
+  DependenciesIndex Broken;
+  EXPECT_FALSE(Broken.read(*Truncated).isValid());
+  EXPECT_EQ(Broken.size(), 0u);
+}
+
+TEST_F(LevitationUnitTests, DeclASTMetaInterfaceHash) {
+
+  // Body fragment covers "{ return 1; }" and "{ return 22; }" respectively.
+  StringRef SrcA = "int f() { return 1; }";
+  StringRef SrcB = "int f() { return 22; }";
+  StringRef SrcC = "long f() { return 1; }";
+
+  auto getBodyFragment = [] (StringRef Src) {
+    DeclASTMeta::FragmentsVectorTy Fragments;
+    Fragments.push_back({
+      Src.find('{'), Src.size(), SourceFragmentAction::ReplaceWithSemicolon
+    });
+    return Fragments;
+  };
+
+  auto HashA = DeclASTMeta::calcInterfaceHash(SrcA, getBodyFragment(SrcA));
+  auto HashB = DeclASTMeta::calcInterfaceHash(SrcB, getBodyFragment(SrcB));
+  auto HashC = DeclASTMeta::calcInterfaceHash(SrcC, getBodyFragment(SrcC));
+
+  EXPECT_TRUE(HashA == HashB);
+  EXPECT_FALSE(HashA == HashC);
+
+  // Exported body is only kept out of header, dependents inline it.
+  auto getExportedFragment = [] (StringRef Src) {
+    DeclASTMeta::FragmentsVectorTy Fragments;
+    Fragments.push_back({
+      Src.find('{'), Src.size(),
+      SourceFragmentAction::ReplaceWithSemicolonInHeaderOnly
+    });
+    return Fragments;
+  };
+
+  EXPECT_FALSE(
+      DeclASTMeta::calcInterfaceHash(SrcA, getExportedFragment(SrcA)) ==
+      DeclASTMeta::calcInterfaceHash(SrcB, getExportedFragment(SrcB))
+  );
+
+  DeclASTMeta Meta(HashC.Bytes, HashB.Bytes, getBodyFragment(SrcA));
+  Meta.setInterfaceHash(HashA.Bytes);
+
+  std::string Buffer;
+  {
+    raw_string_ostream OS(Buffer);
+    CreateMetaBitstreamWriter(OS)->writeAndFinalize(Meta);
+  }
+
+  auto MemBuf = MemoryBuffer::getMemBuffer(Buffer, "", false);
+
+  DeclASTMeta Loaded;
+  auto Reader = CreateMetaBitstreamReader(*MemBuf);
+  ASSERT_TRUE(Reader->read(Loaded));
+
+  EXPECT_TRUE(equal(Loaded.getInterfaceHash(), HashA.Bytes));
+  EXPECT_TRUE(equal(Loaded.getDeclASTHash(), HashB.Bytes));
+  EXPECT_TRUE(equal(Loaded.getSourceHash(), HashC.Bytes));
+  EXPECT_EQ(Loaded.getFragmentsToSkip().size(), 1u);
+}
+
+TEST_F(LevitationUnitTests, DeclASTMetaHashKind) {
+  StringRef Src = "int f();";
+
+  auto roundTrip = [] (const DeclASTMeta &Meta, DeclASTMeta &Loaded) {
+    std::string Buffer;
+    {
+      raw_string_ostream OS(Buffer);
+      CreateMetaBitstreamWriter(OS)->writeAndFinalize(Meta);
+    }
+    auto MemBuf = MemoryBuffer::getMemBuffer(Buffer, "", false);
+    return CreateMetaBitstreamReader(*MemBuf)->read(Loaded);
+  };
+
+  auto MD5 = calcHash(HashKind::MD5, Src);
+  auto XXH = calcHash(HashKind::XXH64, Src);
+  EXPECT_EQ(MD5.size(), 16u);
+  EXPECT_EQ(XXH.size(), 8u);
+  EXPECT_TRUE(equal(MD5, calcMD5(Src).Bytes));
+  EXPECT_TRUE(equal(XXH, calcHash(HashKind::XXH64, Src)));
+
+  // Metas without hash record are MD5 ones.
+  DeclASTMeta Old(MD5, MD5, {});
+  DeclASTMeta LoadedOld;
+  ASSERT_TRUE(roundTrip(Old, LoadedOld));
+  EXPECT_EQ(LoadedOld.getHashKind(), HashKind::MD5);
+
+  DeclASTMeta New(XXH, XXH, {});
+  New.setHashKind(HashKind::XXH64);
+  DeclASTMeta LoadedNew;
+  ASSERT_TRUE(roundTrip(New, LoadedNew));
+  EXPECT_EQ(LoadedNew.getHashKind(), HashKind::XXH64);
+  EXPECT_TRUE(equal(LoadedNew.getSourceHash(), XXH));
+
+  HashKind Kind;
+  EXPECT_TRUE(parseHashKind("xxh64", Kind));
+  EXPECT_EQ(Kind, HashKind::XXH64);
+  EXPECT_FALSE(parseHashKind("sha1", Kind));
+}
+
+TEST_F(LevitationUnitTests, DeclASTMetaCodeless) {
+  auto roundTrip = [] (const DeclASTMeta &Meta, DeclASTMeta &Loaded) {
+    std::string Buffer;
+    {
+      raw_string_ostream OS(Buffer);
+      CreateMetaBitstreamWriter(OS)->writeAndFinalize(Meta);
+    }
+    auto MemBuf = MemoryBuffer::getMemBuffer(Buffer, "", false);
+    return CreateMetaBitstreamReader(*MemBuf)->read(Loaded);
+  };
+
+  auto Hash = calcMD5("inline int f() { return 1; }").Bytes;
+
+  // Units may emit code, unless meta tells otherwise.
+  DeclASTMeta Plain(Hash, Hash, {});
+  DeclASTMeta LoadedPlain;
+  ASSERT_TRUE(roundTrip(Plain, LoadedPlain));
+  EXPECT_FALSE(LoadedPlain.isCodeless());
+
+  DeclASTMeta Codeless(Hash, Hash, {});
+  Codeless.setCodeless();
+  Codeless.setCommandHash(Hash);
+  DeclASTMeta LoadedCodeless;
+  ASSERT_TRUE(roundTrip(Codeless, LoadedCodeless));
+  EXPECT_TRUE(LoadedCodeless.isCodeless());
+  EXPECT_TRUE(equal(LoadedCodeless.getCommandHash(), Hash));
+}
+
+TEST_F(LevitationUnitTests, DeclASTMetaEmbedded) {
+  auto Hash = calcMD5("int f();").Bytes;
+  DeclASTMeta Meta(Hash, Hash, {});
+  Meta.addDeclHash({"f", 1});
+
+  std::string MetaBytes;
+  {
+    raw_string_ostream OS(MetaBytes);
+    CreateMetaBitstreamWriter(OS)->writeAndFinalize(Meta);
+  }
+
+  StringRef Found;
+  EXPECT_FALSE(findEmbeddedMeta(MetaBytes, Found));
+
+  // Some AST-like bitstream with own magic and single top level block.
+  SmallVector<char, 256> AST;
+  {
+    BitstreamWriter Writer(AST);
+    for (char C : {'C', 'P', 'C', 'H'})
+      Writer.Emit((unsigned)C, 8);
+    Writer.EnterSubblock(bitc::FIRST_APPLICATION_BLOCKID + 1, 3);
+    Writer.EmitRecord(1, SmallVector<unsigned, 2>{1, 2});
+    Writer.ExitBlock();
+  }
+
+  std::string File(AST.begin(), AST.end());
+  EXPECT_FALSE(findEmbeddedMeta(File, Found));
+  {
+    raw_string_ostream OS(File);
+    writeEmbeddedMeta(OS, MetaBytes);
+  }
+
+  ASSERT_TRUE(findEmbeddedMeta(File, Found));
+  EXPECT_EQ(Found, StringRef(MetaBytes));
+
+  auto MemBuf = MemoryBuffer::getMemBuffer(Found, "", false);
+  DeclASTMeta Loaded;
+  ASSERT_TRUE(CreateMetaBitstreamReader(*MemBuf)->read(Loaded));
+  ASSERT_EQ(Loaded.getDeclHashes().size(), 1u);
+  EXPECT_EQ(Loaded.getDeclHashes()[0].Name, "f");
+
+  // File is still well formed bitstream, with meta as last block.
+  BitstreamCursor Cursor(File);
+  ASSERT_TRUE(bool(Cursor.Read(32)));
+
+  unsigned LastBlockID = 0;
+  while (!Cursor.AtEndOfStream()) {
+    auto Entry = Cursor.advance();
+    ASSERT_TRUE(bool(Entry));
+    ASSERT_EQ(Entry->Kind, BitstreamEntry::SubBlock);
+    LastBlockID = Entry->ID;
+    ASSERT_FALSE(Cursor.SkipBlock());
+  }
+  EXPECT_EQ(LastBlockID, (unsigned)EMBEDDED_META_BLOCK_ID);
+}
+
+TEST_F(LevitationUnitTests, IncrementalHash) {
+  std::string Data;
+  for (unsigned i = 0; i != 1000; ++i)
+    Data += (char)(i * 7 + i / 13);
+
+  for (auto Kind : { HashKind::MD5, HashKind::XXH64 }) {
+    for (size_t Len : { 0, 3, 31, 32, 33, 100, 1000 }) {
+      StringRef Part(Data.data(), Len);
+      auto Expected = calcHash(Kind, Part);
+
+      for (size_t Chunk : { 1, 5, 32, 64, 1000 }) {
+        IncrementalHash H(Kind);
+        for (size_t Pos = 0; Pos < Len; Pos += Chunk)
+          H.update(Part.substr(Pos, Chunk));
+        EXPECT_TRUE(equal(H.final(), Expected))
+            << getHashKindName(Kind) << " " << Len << " " << Chunk;
+      }
+    }
+  }
+
+  SmallString<64> Written;
+  auto State = std::make_shared<HashingOStreamState>(HashKind::XXH64);
+  {
+    HashingOStream Out(
+        std::make_unique<raw_svector_ostream>(Written), State
+    );
+    Out << "int f();" << 42;
+  }
+
+  EXPECT_EQ(Written, "int f();42");
+  EXPECT_TRUE(State->Valid);
+  EXPECT_TRUE(equal(State->Hash.final(), calcHash(HashKind::XXH64, Written)));
+
+  // Output patched after it was written can't be hashed on the fly.
+  auto Patched = std::make_shared<HashingOStreamState>(HashKind::MD5);
+  {
+    HashingOStream Out(
+        std::make_unique<raw_svector_ostream>(Written), Patched
+    );
+    Out << "abc";
+    Out.pwrite("x", 1, 0);
+  }
+  EXPECT_FALSE(Patched->Valid);
+}
+
+TEST_F(LevitationUnitTests, SourceDigest) {
+  SmallString<128> Source;
+  ASSERT_FALSE(llvm::sys::fs::createTemporaryFile("digest", "cpp", Source));
+  llvm::FileRemover Remover(Source);
+
+  {
+    std::error_code EC;
+    raw_fd_ostream Out(Source, EC);
+    ASSERT_FALSE(EC);
+    Out << "int f();";
+  }
+
+  auto Stamp = BuildState::getStamp(Source);
+  ASSERT_TRUE(Stamp.hasValue());
+
+  auto Hash = calcHash(HashKind::MD5, "int f();");
+  auto Digest = formatSourceDigest(Hash, Stamp->Size, Stamp->MTime);
+
+  HashVectorTy Parsed;
+  EXPECT_TRUE(parseSourceDigest(Digest, Source, HashKind::MD5, Parsed));
+  EXPECT_TRUE(equal(Parsed, Hash));
+
+  // Digest of other algorithm, or of file with other stamp
+  // should be ignored.
+  EXPECT_FALSE(parseSourceDigest(Digest, Source, HashKind::XXH64, Parsed));
+
+  auto Touched = formatSourceDigest(Hash, Stamp->Size + 1, Stamp->MTime);
+  EXPECT_FALSE(parseSourceDigest(Touched, Source, HashKind::MD5, Parsed));
+
+  EXPECT_FALSE(parseSourceDigest("zz:1:1", Source, HashKind::MD5, Parsed));
+  EXPECT_FALSE(parseSourceDigest("", Source, HashKind::MD5, Parsed));
+}
+
+TEST_F(LevitationUnitTests, DeclASTMetaEarlyCutoff) {
+
+  DeclASTMeta Meta;
+  Meta.setDeclHashes({{"", 1}, {"Core::Widget", 1ULL << 40 | 7}});
+
+  auto &Used = Meta.addUsedDeclsDependency("Core/Widget.decl-ast");
+  Used.Names = {"Core::Widget", "Core::makeWidget"};
+  Meta.addUsedDeclsDependency("Core/Empty.decl-ast");
+
+  auto &Inc = Meta.addInclude("/usr/include/legacy.h");
+  Inc.MTime = 1ULL << 33;
+  Inc.Size = 42;
+  Inc.Hash = { 1, 2, 3 };
+
+  Meta.setCommandHash(StringRef("0123abcd"));
+
+  std::string Buffer;
+  {
+    raw_string_ostream OS(Buffer);
+    CreateMetaBitstreamWriter(OS)->writeAndFinalize(Meta);
+  }
+
+  auto MemBuf = MemoryBuffer::getMemBuffer(Buffer, "", false);
+
+  DeclASTMeta Loaded;
+  auto Reader = CreateMetaBitstreamReader(*MemBuf);
+  ASSERT_TRUE(Reader->read(Loaded));
+
+  ASSERT_TRUE(Loaded.hasDeclHashes());
+  ASSERT_EQ(Loaded.getDeclHashes().size(), 2u);
+  EXPECT_EQ(Loaded.getDeclHashes()[0].Name, "");
+  EXPECT_EQ(Loaded.getDeclHashes()[1].Name, "Core::Widget");
+  EXPECT_EQ(Loaded.getDeclHashes()[1].Hash, 1ULL << 40 | 7);
+
+  ASSERT_TRUE(Loaded.hasUsedDecls());
+  ASSERT_EQ(Loaded.getUsedDecls().size(), 2u);
+  EXPECT_EQ(Loaded.getUsedDecls()[0].DeclAST, "Core/Widget.decl-ast");
+  EXPECT_EQ(Loaded.getUsedDecls()[0].Names.size(), 2u);
+  EXPECT_EQ(Loaded.getUsedDecls()[0].Names[1], "Core::makeWidget");
+  EXPECT_TRUE(Loaded.getUsedDecls()[1].Names.empty());
+
+  ASSERT_EQ(Loaded.getIncludes().size(), 1u);
+  EXPECT_EQ(Loaded.getIncludes()[0].Path, "/usr/include/legacy.h");
+  EXPECT_EQ(Loaded.getIncludes()[0].MTime, 1ULL << 33);
+  EXPECT_EQ(Loaded.getIncludes()[0].Size, 42u);
+  EXPECT_TRUE(equal(Loaded.getIncludes()[0].Hash, Inc.Hash));
+
+  EXPECT_TRUE(equal(Loaded.getCommandHash(), Meta.getCommandHash()));
+
+  // Metas without early cutoff info must stay distinguishable.
+  DeclASTMeta Plain;
+  Buffer.clear();
+  {
+    raw_string_ostream OS(Buffer);
+    CreateMetaBitstreamWriter(OS)->writeAndFinalize(Plain);
+  }
+
+  MemBuf = MemoryBuffer::getMemBuffer(Buffer, "", false);
+  DeclASTMeta LoadedPlain;
+  Reader = CreateMetaBitstreamReader(*MemBuf);
+  ASSERT_TRUE(Reader->read(LoadedPlain));
+  EXPECT_FALSE(LoadedPlain.hasDeclHashes());
+  EXPECT_FALSE(LoadedPlain.hasUsedDecls());
+  EXPECT_TRUE(LoadedPlain.getIncludes().empty());
+  EXPECT_TRUE(LoadedPlain.getCommandHash().empty());
+}
+
+TEST_F(LevitationUnitTests, DeclASTMetaDiffDeclHashes) {
+
+  DeclASTMeta Old;
+  Old.setDeclHashes({{"", 1}, {"Core::Widget", 2}, {"Core::make", 3}});
+
+  DeclASTMeta New;
+  New.setDeclHashes({{"", 1}, {"Core::Widget", 5}, {"Core::make", 3}});
+
+  llvm::StringSet<> Changed;
+  ASSERT_TRUE(DeclASTMeta::diffDeclHashes(Old, New, Changed));
+  EXPECT_EQ(Changed.size(), 1u);
+  EXPECT_TRUE(Changed.count("Core::Widget"));
+
+  // Added declaration makes difference unknown.
+  DeclASTMeta Added;
+  Added.setDeclHashes({{"", 1}, {"Core::Widget", 2}, {"Core::other", 3}});
+
+  Changed.clear();
+  EXPECT_FALSE(DeclASTMeta::diffDeclHashes(Old, Added, Changed));
+
+  // So does meta without hashes.
+  DeclASTMeta Plain;
+  Changed.clear();
+  EXPECT_FALSE(DeclASTMeta::diffDeclHashes(Old, Plain, Changed));
+}
+
+TEST_F(LevitationUnitTests, DeclASTMetaDiffDecls) {
+  auto Hash = calcMD5("").Bytes;
+
+  DeclASTMeta Old(Hash, Hash, {});
+  Old.setDeclHashes({{"", 1}, {"a", 1}, {"b", 2}, {"d", 4}});
+
+  DeclASTMeta New(Hash, Hash, {});
+  New.setDeclHashes({{"", 1}, {"b", 3}, {"c", 3}, {"d", 4}, {"e", 5}});
+
+  DeclASTMeta::DeclsDiffTy Diff;
+  ASSERT_TRUE(DeclASTMeta::diffDecls(Old, New, Diff));
+  EXPECT_EQ(Diff.Added, std::vector<std::string>({"c", "e"}));
+  EXPECT_EQ(Diff.Removed, std::vector<std::string>({"a"}));
+  EXPECT_EQ(Diff.Changed, std::vector<std::string>({"b"}));
+
+  DeclASTMeta::DeclsDiffTy Same;
+  ASSERT_TRUE(DeclASTMeta::diffDecls(New, New, Same));
+  EXPECT_TRUE(Same.empty());
+
+  // Metas written by older versions have no declaration hashes.
+  DeclASTMeta::DeclsDiffTy Unknown;
+  EXPECT_FALSE(DeclASTMeta::diffDecls(DeclASTMeta(Hash, Hash, {}), New, Unknown));
+}
+
+TEST_F(LevitationUnitTests, BuildCacheKey) {
+  using namespace clang::levitation::tools;
+
+  auto getKey = [] (StringRef A, StringRef B) {
+    return BuildCacheKey().add(A).add(B).done();
+  };
+
+  EXPECT_EQ(getKey("ab", "c"), getKey("ab", "c"));
+  EXPECT_NE(getKey("ab", "c"), getKey("a", "bc"));
+  EXPECT_NE(getKey("ab", "c"), getKey("ab", "d"));
+  EXPECT_EQ(getKey("ab", "c").size(), 32u);
+
+  std::vector<std::string> Args = { "ab", "c" };
+  EXPECT_EQ(BuildCacheKey().addAll(Args).done(), getKey("ab", "c"));
+}
+
+TEST_F(LevitationUnitTests, NinjaPlanWrite) {
+  using namespace clang::levitation::tools;
+
+  std::vector<NinjaPlan::Edge> Edges = {
+    { "object", {"clang++", "-c", "b.cpp"},
+      {"b.cpp", "a.decl-ast"}, {"b.o"}, "" },
+    { "decl-ast", {"clang++", "a b.cpp"}, {"a b.cpp"}, {"a.decl-ast"}, "a.rsp" },
+    { "parse", {"clang++"}, {"c.cpp"}, {}, "" }
+  };
+
+  std::string Res;
+  llvm::raw_string_ostream Out(Res);
+  NinjaPlan::write(Out, Edges);
+  Out.flush();
+
+  // Rules and edges are sorted, edges without outputs are skipped.
+  EXPECT_LT(Res.find("rule decl-ast\n"), Res.find("rule object\n"));
+  EXPECT_EQ(Res.find("rule parse"), std::string::npos);
+  EXPECT_LT(
+      Res.find("build a.decl-ast: decl-ast a$ b.cpp\n"),
+      Res.find("build b.o: object b.cpp a.decl-ast\n")
+  );
+
+  EXPECT_NE(Res.find("  cmd = clang++ -c b.cpp\n"), std::string::npos);
+  EXPECT_NE(Res.find("  rspfile = a.rsp\n"), std::string::npos);
+  EXPECT_NE(Res.find("  rspfile_content = 'a b.cpp'\n"), std::string::npos);
+  EXPECT_NE(Res.find("  cmd = clang++ @a.rsp\n"), std::string::npos);
+
+  EXPECT_EQ(NinjaPlan::quoteArg("it's"), "'it'\\''s'");
+  EXPECT_EQ(NinjaPlan::escapePath("c:/$x"), "c$:/$$x");
+}
+
+TEST_F(LevitationUnitTests, CompileCommandsWrite) {
+  using namespace clang::levitation::tools;
+
+  std::vector<CompileCommands::Entry> Entries = {
+    { "/root", "/root/b.cppl", {"clang++", "-c", "b.cppl"}, "b.o" },
+    { "/root", "/root/a.cppl", {"clang++", "a \"x\".cppl"}, "" },
+    { "/root", "/root/b.cppl", {"clang++", "-cppl-decl"}, "b.decl-ast" }
+  };
+
+  std::string Res;
+  llvm::raw_string_ostream Out(Res);
+  CompileCommands::write(Out, Entries);
+  Out.flush();
+
+  // Entries are sorted by file, arguments are escaped.
+  EXPECT_LT(
+      Res.find("\"file\": \"/root/a.cppl\""),
+      Res.find("\"file\": \"/root/b.cppl\"")
+  );
+  EXPECT_NE(Res.find("\"a \\\"x\\\".cppl\""), std::string::npos);
+  EXPECT_NE(Res.find("\"output\": \"b.o\""), std::string::npos);
+  EXPECT_EQ(Res.find("\"output\": \"\""), std::string::npos);
+
+  // Commands of same file keep their order.
+  EXPECT_LT(
+      Res.find("\"output\": \"b.o\""),
+      Res.find("\"output\": \"b.decl-ast\"")
+  );
+}
+
+TEST_F(LevitationUnitTests, BuildMetricsWrite) {
+  using namespace clang::levitation::tools;
+
+  BuildMetrics Metrics;
+  Metrics
+  .add("build_duration_seconds", "Wall time of build.", "s", 1.5)
+  .add("steps", "Number of steps.", "1", 3, {{"step", "decl-ast"}})
+  .add("steps", "Ignored.", "1", 4, {{"step", "a\"b"}});
+
+  ASSERT_EQ(Metrics.getMetrics().size(), 2u);
+  EXPECT_EQ(BuildMetrics::getFormat("m.json"), BuildMetrics::Format::OTLP);
+  EXPECT_EQ(BuildMetrics::getFormat("m.prom"), BuildMetrics::Format::Prometheus);
+
+  std::string Prom;
+  llvm::raw_string_ostream PromOut(Prom);
+  Metrics.writePrometheus(PromOut);
+  PromOut.flush();
+
+  // Samples of same metric share single header, label values are escaped.
+  EXPECT_EQ(
+      Prom,
+      "# HELP cppl_build_duration_seconds Wall time of build.\n"
+      "# TYPE cppl_build_duration_seconds gauge\n"
+      "cppl_build_duration_seconds 1.5\n"
+      "# HELP cppl_steps Number of steps.\n"
+      "# TYPE cppl_steps gauge\n"
+      "cppl_steps{step=\"decl-ast\"} 3\n"
+      "cppl_steps{step=\"a\\\"b\"} 4\n"
+  );
+
+  std::string OTLP;
+  llvm::raw_string_ostream OTLPOut(OTLP);
+  Metrics.writeOTLP(OTLPOut, 1234);
+  OTLPOut.flush();
+
+  auto Parsed = llvm::json::parse(OTLP);
+  ASSERT_TRUE((bool)Parsed);
+
+  auto *Resources = Parsed->getAsObject()->getArray("resourceMetrics");
+  ASSERT_TRUE(Resources && Resources->size() == 1);
+  auto *Scopes = (*Resources)[0].getAsObject()->getArray("scopeMetrics");
+  ASSERT_TRUE(Scopes && Scopes->size() == 1);
+  auto *Items = (*Scopes)[0].getAsObject()->getArray("metrics");
+  ASSERT_TRUE(Items && Items->size() == 2);
+
+  auto *Steps = (*Items)[1].getAsObject();
+  EXPECT_EQ(Steps->getString("name"), llvm::Optional<llvm::StringRef>("cppl.steps"));
+  auto *Points = Steps->getObject("gauge")->getArray("dataPoints");
+  ASSERT_TRUE(Points && Points->size() == 2);
+  auto *Point = (*Points)[1].getAsObject();
+  EXPECT_EQ(Point->getNumber("asDouble"), llvm::Optional<double>(4));
+  EXPECT_EQ(
+      Point->getString("timeUnixNano"), llvm::Optional<llvm::StringRef>("1234")
+  );
+}
+
+TEST_F(LevitationUnitTests, ArtifactPublisherDrain) {
+  using namespace clang::levitation::tools;
+
+  for (unsigned Depth : { 0u, 2u }) {
+    auto &Publisher = ArtifactPublisher::create(Depth);
+
+    std::atomic<int> Done(0);
+    for (int i = 0; i != 20; ++i)
+      Publisher.publish([&, i] {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+        ++Done;
+        return i % 5 != 0;
+      });
+
+    // Wait returns once all actions are done,
+    // and only reports failures once.
+    EXPECT_EQ(Publisher.wait(), 4u);
+    EXPECT_EQ(Done, 20);
+    EXPECT_EQ(Publisher.wait(), 0u);
+  }
+}
+
+TEST_F(LevitationUnitTests, TimeTraceReportParse) {
+  using namespace clang::levitation::tools;
+
+  StringRef Trace = R"({"traceEvents": [
+    {"ph": "X", "name": "ExecuteCompiler", "ts": 0, "dur": 9000},
+    {"ph": "X", "name": "InstantiateClass", "ts": 10, "dur": 2000,
+     "args": {"detail": "A<int>"}},
+    {"ph": "X", "name": "Total ExecuteCompiler", "ts": 0, "dur": 9000},
+    {"ph": "X", "name": "Total InstantiateClass", "ts": 0, "dur": 2000},
+    {"ph": "X", "name": "Total InstantiateFunction", "ts": 0, "dur": 500},
+    {"ph": "X", "name": "Total LevitationLoadDependencies", "ts": 0, "dur": 4000},
+    {"ph": "M", "name": "process_name", "args": {"name": "clang"}}
+  ]})";
+
+  TimeTraceReport::UnitTimes T;
+  ASSERT_TRUE(TimeTraceReport::parse(Trace, T));
+  EXPECT_EQ(T.Frontend, 9000u);
+  EXPECT_EQ(T.Templates, 2500u);
+  EXPECT_EQ(T.Dependencies, 4000u);
+
+  TimeTraceReport::UnitTimes Malformed;
+  EXPECT_FALSE(TimeTraceReport::parse("{\"traceEvents\": [", Malformed));
+  EXPECT_FALSE(TimeTraceReport::parse("[]", Malformed));
+}
+
+TEST_F(LevitationUnitTests, DependencyStatsSerialization) {
+  std::vector<DependencyStats> Stats(2);
+  Stats[0].File = "A.decl-ast";
+  Stats[0].Decls = 10;
+  Stats[0].Types = 3;
+  Stats[0].Identifiers = 20;
+  Stats[0].Bytes = 4096;
+  Stats[0].LoadTime = 150;
+  Stats[1].File = "B.decl-ast";
+  Stats[1].Identifiers = 2;
+
+  std::string Json;
+  llvm::raw_string_ostream Out(Json);
+  DependencyStats::write(Out, Stats);
+  Out.flush();
+
+  std::vector<DependencyStats> Read;
+  ASSERT_TRUE(DependencyStats::parse(Json, Read));
+  ASSERT_EQ(Read.size(), 2u);
+  EXPECT_EQ(Read[0].File, "A.decl-ast");
+  EXPECT_EQ(Read[0].Decls, 10u);
+  EXPECT_EQ(Read[0].Types, 3u);
+  EXPECT_EQ(Read[0].Identifiers, 20u);
+  EXPECT_EQ(Read[0].Bytes, 4096u);
+  EXPECT_EQ(Read[0].LoadTime, 150u);
+  EXPECT_FALSE(Read[0].isUnused());
+  EXPECT_EQ(Read[1].File, "B.decl-ast");
+  EXPECT_TRUE(Read[1].isUnused());
+
+  std::vector<DependencyStats> Malformed;
+  EXPECT_FALSE(DependencyStats::parse("{\"dependencies\": [{}]}", Malformed));
+  EXPECT_FALSE(DependencyStats::parse("[]", Malformed));
+}
+
+TEST_F(LevitationUnitTests, UnusedImports) {
+  using namespace clang::levitation::tools;
+
+  auto stats = [] (StringRef File, uint64_t Decls) {
+    DependencyStats S;
+    S.File = File.str();
+    S.Decls = Decls;
+    return S;
+  };
+
+  std::vector<DependencyStats> DeclStats = {
+    stats("A.decl-ast", 5), stats("B.decl-ast", 0), stats("C.decl-ast", 0)
+  };
+  std::vector<DependencyStats> ObjStats = {
+    stats("A.decl-ast", 7), stats("B.decl-ast", 2), stats("C.decl-ast", 0),
+    stats("D.decl-ast", 0), stats("E.decl-ast", 1)
+  };
+
+  std::vector<UnusedImports::Import> DeclImports = {
+    {"A", "A.decl-ast"}, {"B", "B.decl-ast"}, {"C", "C.decl-ast"},
+    {"X", "X.decl-ast"}
+  };
+  std::vector<UnusedImports::Import> BodyImports = {
+    {"D", "D.decl-ast"}, {"E", "E.decl-ast"}
+  };
+
+  auto Findings = UnusedImports::find(
+      DeclStats, ObjStats, DeclImports, BodyImports
+  );
+
+  ASSERT_EQ(Findings.size(), 3u);
+  EXPECT_EQ(Findings[0].UnitID, "B");
+  EXPECT_EQ(Findings[0].K, UnusedImports::Kind::BodyOnly);
+  EXPECT_EQ(Findings[1].UnitID, "C");
+  EXPECT_EQ(Findings[1].K, UnusedImports::Kind::Unused);
+  EXPECT_EQ(Findings[2].UnitID, "D");
+  EXPECT_EQ(Findings[2].K, UnusedImports::Kind::Unused);
+
+  // Without decl-ast stats declaration imports are not checked.
+  auto BodyFindings = UnusedImports::find({}, ObjStats, DeclImports, {});
+  EXPECT_TRUE(BodyFindings.empty());
+}
+
+TEST_F(LevitationUnitTests, PrivateImports) {
+  using namespace clang::levitation::tools;
+
+  enum { Y, P, X, Z };
+
+  // X declaration uses P, and Y is only used by X #body.
+  std::vector<PrivateImports::Unit> Units(4);
+  Units[Y].HasStats = Units[Y].Untouched = true;
+  Units[P].HasStats = Units[P].Untouched = true;
+
+  Units[X].DeclImports = {Y, P};
+  Units[X].HasStats = Units[X].Untouched = true;
+  Units[X].UsedByDecl = {P};
+  Units[X].Used = {Y, P};
+
+  Units[Z].DeclImports = {X};
+  Units[Z].HasStats = Units[Z].Untouched = true;
+  Units[Z].UsedByDecl = {X};
+  Units[Z].Used = {X};
+
+  auto Demoted = PrivateImports::infer(Units);
+  ASSERT_EQ(Demoted.size(), 1u);
+  EXPECT_EQ(Demoted[0], PrivateImports::Demotion(X, Y));
+
+  // Z uses Y it doesn't import, so Y is kept in its closure.
+  auto UsesY = Units;
+  UsesY[Z].Used.insert(Y);
+  EXPECT_TRUE(PrivateImports::infer(UsesY).empty());
+
+  // Z without stats may use anything.
+  auto NoStats = Units;
+  NoStats[Z].HasStats = false;
+  EXPECT_TRUE(PrivateImports::infer(NoStats).empty());
+
+  // Edited X may use Y in its declaration now.
+  auto Edited = Units;
+  Edited[X].Untouched = false;
+  EXPECT_TRUE(PrivateImports::infer(Edited).empty());
+}
+
+TEST_F(LevitationUnitTests, GraphAdvisor) {
+  using namespace clang::levitation::tools;
+
+  enum { ADecl, AObj, BDecl, BObj, CDecl, CObj, NumNodes };
+  enum { A, B, C };
+
+  // B imports A, C imports B, yet B declaration uses nothing from A.
+  std::vector<GraphAdvisor::Node> Nodes(NumNodes);
+  Nodes[ADecl].Dependents = {BDecl, BObj};
+  Nodes[BDecl].Dependents = {CDecl, CObj};
+  Nodes[BDecl].Duration = 100;
+  Nodes[BObj].Duration = 200;
+  Nodes[CDecl].Duration = 10;
+  Nodes[CObj].Duration = 20;
+
+  std::vector<GraphAdvisor::Unit> Units(3);
+  Units[A].Decl = ADecl;
+  Units[A].InterfaceChanges = 2;
+  Units[A].BodyOnlyDependents = {BDecl};
+
+  Units[B].Decl = BDecl;
+  Units[B].InterfaceChanges = 1;
+  Units[B].DeclASTSize = 1000;
+  Units[B].LoadedBytes = 300;
+  Units[B].NumLoads = 3;
+
+  // C has no dependents and nothing changed it.
+  Units[C].Decl = CDecl;
+
+  auto Advices = GraphAdvisor::advise(Nodes, Units);
+  ASSERT_EQ(Advices.size(), 2u);
+
+  EXPECT_EQ(Advices[0].U, (unsigned)A);
+  EXPECT_EQ(Advices[0].NumAffected, 4u);
+  EXPECT_EQ(Advices[0].AffectedTime, 330u);
+  EXPECT_EQ(Advices[0].Impact, 660u);
+  // Only B object would be rebuilt.
+  EXPECT_EQ(Advices[0].BodyDepSavedTime, 130u);
+  EXPECT_FALSE(Advices[0].SuggestSplit);
+
+  EXPECT_EQ(Advices[1].U, (unsigned)B);
+  EXPECT_EQ(Advices[1].NumAffected, 2u);
+  EXPECT_EQ(Advices[1].Impact, 30u);
+  EXPECT_EQ(Advices[1].BodyDepSavedTime, 0u);
+  EXPECT_EQ(Advices[1].LoadedPercent, 10u);
+  EXPECT_TRUE(Advices[1].SuggestSplit);
+}
+
+TEST_F(LevitationUnitTests, HotUnits) {
+  using namespace clang::levitation::tools;
+  using T = HotUnits::Temperature;
+
+  EXPECT_EQ(HotUnits::parseLevel("O3"), "3");
+  EXPECT_EQ(HotUnits::parseLevel("s"), "s");
+  EXPECT_EQ(HotUnits::parseLevel("O4"), "");
+  EXPECT_EQ(HotUnits::parseLevel("hot"), "");
+
+  EXPECT_EQ(
+      HotUnits::scanPragma(
+          "#pragma once\n"
+          "void f();\n"
+          "  #  pragma cppl optimize( cold )\n"
+      ),
+      "cold"
+  );
+  EXPECT_EQ(HotUnits::scanPragma("#pragma clang optimize(off)\n"), "");
+
+  llvm::StringMap<HotUnits::WeightTy> Weights;
+  Weights["A"] = 800;
+  Weights["B"] = 150;
+  Weights["C"] = 50;
+  Weights["D"] = 0;
+
+  llvm::StringMap<T> Units;
+  HotUnits::classify(Weights, 90, Units);
+
+  // A and B run 95% together, but A alone is below 90%.
+  EXPECT_EQ(Units["A"], T::Hot);
+  EXPECT_EQ(Units["B"], T::Hot);
+  EXPECT_EQ(Units["C"], T::Warm);
+  EXPECT_EQ(Units["D"], T::Cold);
+
+  std::string List;
+  llvm::raw_string_ostream Out(List);
+  HotUnits::write(Out, Units, T::Warm);
+  Out.flush();
+
+  EXPECT_EQ(List, "default warm\nhot A\nhot B\nwarm C\ncold D\n");
+
+  llvm::StringMap<T> Parsed;
+  T Default;
+  ASSERT_TRUE(HotUnits::parse(List, Parsed, Default));
+  EXPECT_EQ(Default, T::Warm);
+  EXPECT_EQ(Parsed.size(), 4u);
+  EXPECT_EQ(Parsed["B"], T::Hot);
+  EXPECT_EQ(Parsed["D"], T::Cold);
+
+  // Plain list of hot units.
+  Parsed.clear();
+  ASSERT_TRUE(HotUnits::parse("# Hot ones.\nA/B\ncold C\n", Parsed, Default));
+  EXPECT_EQ(Default, T::Cold);
+  EXPECT_EQ(Parsed["A/B"], T::Hot);
+  EXPECT_EQ(Parsed["C"], T::Cold);
+
+  EXPECT_FALSE(HotUnits::parse("lukewarm A\n", Parsed, Default));
+}
+
+TEST_F(LevitationUnitTests, JUnitReport) {
+  using namespace clang::levitation::tools;
+
+  std::vector<JUnitReport::TestCase> Cases(2);
+  Cases[0].Name = "tests::a::main";
+  Cases[0].Duration = 1500000;
+  Cases[1].Name = "tests::b::main";
+  Cases[1].ExitCode = 3;
+  Cases[1].Duration = 250;
+  Cases[1].Output = "expected <1> & got \x01<2>\n";
+
+  std::string Report;
+  llvm::raw_string_ostream Out(Report);
+  JUnitReport::write(Out, "suite", Cases);
+  Out.flush();
+
+  EXPECT_EQ(
+      Report,
+      "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+      "<testsuites tests=\"2\" failures=\"1\" time=\"1.500\">\n"
+      "  <testsuite name=\"suite\" tests=\"2\" failures=\"1\" time=\"1.500\">\n"
+      "    <testcase name=\"tests::a::main\" classname=\"suite\" time=\"1.500\">\n"
+      "    </testcase>\n"
+      "    <testcase name=\"tests::b::main\" classname=\"suite\" time=\"0.000\">\n"
+      "      <failure message=\"exit code 3\"/>\n"
+      "      <system-out>expected &lt;1&gt; &amp; got &lt;2&gt;\n</system-out>\n"
+      "    </testcase>\n"
+      "  </testsuite>\n"
+      "</testsuites>\n"
+  );
+}
+
+TEST_F(LevitationUnitTests, ModuleMap) {
+  using namespace clang::levitation::tools;
+
+  EXPECT_EQ(ModuleMap::getModuleName("http"), "http");
+  EXPECT_EQ(ModuleMap::getModuleName("my-lib"), "my_lib");
+  EXPECT_EQ(ModuleMap::getModuleName("2d"), "_2d");
+  EXPECT_EQ(ModuleMap::getModuleName("header"), "header_");
+
+  ModuleMap Map;
+  EXPECT_TRUE(Map.empty());
+
+  Map.add({"net", "http", "server"}, "net/http/server.h");
+  Map.add({"net", "http"}, "net/http.h");
+  Map.add({"core"}, "core.h");
+  EXPECT_FALSE(Map.empty());
+
+  std::string Text;
+  llvm::raw_string_ostream Out(Text);
+  Map.write(Out);
+  Out.flush();
+
+  EXPECT_EQ(
+      Text,
+      "// Generated by C++ Levitation, do not edit.\n"
+      "\n"
+      "module core {\n"
+      "  header \"core.h\"\n"
+      "  export *\n"
+      "}\n"
+      "\n"
+      "module net {\n"
+      "  module http {\n"
+      "    header \"net/http.h\"\n"
+      "    export *\n"
+      "    module server {\n"
+      "      header \"net/http/server.h\"\n"
+      "      export *\n"
+      "    }\n"
+      "  }\n"
+      "}\n"
+  );
+}
+
+TEST_F(LevitationUnitTests, PerformanceBudgets) {
+  using namespace clang::levitation::tools;
+  using Metric = PerformanceBudgets::Metric;
+
+  PerformanceBudgets::ValueTy V;
+  EXPECT_TRUE(PerformanceBudgets::parseValue(Metric::CompileTime, "1500ms", V));
+  EXPECT_EQ(V, 1500000u);
+  EXPECT_TRUE(PerformanceBudgets::parseValue(Metric::CompileTime, "2", V));
+  EXPECT_EQ(V, 2000000u);
+  EXPECT_TRUE(PerformanceBudgets::parseValue(Metric::PeakRSS, "2G", V));
+  EXPECT_EQ(V, 2ULL << 30);
+  EXPECT_FALSE(PerformanceBudgets::parseValue(Metric::Closure, "4M", V));
+  EXPECT_FALSE(PerformanceBudgets::parseValue(Metric::DeclASTSize, "s", V));
+
+  EXPECT_TRUE(PerformanceBudgets::matches("*", "a::b"));
+  EXPECT_TRUE(PerformanceBudgets::matches("net::*", "net::http::server"));
+  EXPECT_FALSE(PerformanceBudgets::matches("net::*", "network::x"));
+  EXPECT_FALSE(PerformanceBudgets::matches("net::http", "net::http::server"));
+
+  PerformanceBudgets Budgets;
+  std::string Error;
+
+  EXPECT_FALSE(Budgets.parse("net::* closure=1 size=2\n", Error));
+  EXPECT_EQ(Error, "line 1: unknown metric 'size'");
+  EXPECT_FALSE(Budgets.parse("# Budgets.\nnet::*\n", Error));
+  EXPECT_EQ(Error, "line 2: no limits for 'net::*'");
+
+  ASSERT_TRUE(Budgets.parse(
+      "# Budgets.\n"
+      "net::http::server  compile-time=20s\n"
+      "net::*  closure=400 fan-in=50\n",
+      Error
+  ));
+  EXPECT_TRUE(Budgets.limits(Metric::Closure));
+  EXPECT_FALSE(Budgets.limits(Metric::PeakRSS));
+  EXPECT_FALSE(Budgets.matchesAny("core::x"));
+
+  PerformanceBudgets::MetricsTy Values;
+  Values[(unsigned)Metric::CompileTime] = 25000000;
+  Values[(unsigned)Metric::Closure] = 412;
+  Values[(unsigned)Metric::FanIn] = 50;
+
+  std::vector<PerformanceBudgets::Violation> Violations;
+  Budgets.check("net::http::server", Values, Violations);
+
+  ASSERT_EQ(Violations.size(), 2u);
+  EXPECT_EQ(Violations[0].M, Metric::CompileTime);
+  EXPECT_EQ(Violations[0].Limit, 20000000u);
+  EXPECT_EQ(Violations[1].M, Metric::Closure);
+  EXPECT_EQ(Violations[1].Value, 412u);
+  EXPECT_EQ(Violations[1].Pattern, "net::*");
+
+  // Unknown metrics are not checked.
+  Violations.clear();
+  Budgets.check("net::x", PerformanceBudgets::MetricsTy(), Violations);
+  EXPECT_TRUE(Violations.empty());
+}
+
+TEST_F(LevitationUnitTests, BuildProgress) {
+  using namespace clang::levitation::tools;
+
+  // No history, no ETA.
+  EXPECT_FALSE(BuildProgress::estimate(0, 0, 0, 4));
+
+  // Nothing is done yet, remaining work is split between workers.
+  EXPECT_EQ(*BuildProgress::estimate(8000000, 0, 0, 4), 2000000u);
+
+  // Expected work is done twice as slow as history says.
+  EXPECT_EQ(*BuildProgress::estimate(8000000, 2000000, 4000000, 4), 12000000u);
+
+  // Work took longer than expected.
+  EXPECT_EQ(*BuildProgress::estimate(8000000, 8000000, 100, 4), 0u);
+
+  auto duration = [] (BuildProgress::DurationTy D) {
+    std::string Text;
+    llvm::raw_string_ostream Out(Text);
+    BuildProgress::writeDuration(Out, D);
+    return Out.str();
+  };
+
+  EXPECT_EQ(duration(0), "0s");
+  EXPECT_EQ(duration(12400000), "12s");
+  EXPECT_EQ(duration(80000000), "1m20s");
+  EXPECT_EQ(duration(3900000000ULL), "1h05m");
+
+  BuildProgress Progress;
+  Progress.start(2, 0, 0);
+
+  auto S = Progress.onStarted();
+  EXPECT_EQ(S.Done, 0u);
+  EXPECT_EQ(S.Total, 2u);
+  EXPECT_EQ(S.Running, 1u);
+
+  S = Progress.onFinished(0);
+  EXPECT_EQ(S.Done, 1u);
+  EXPECT_EQ(S.Running, 0u);
+  EXPECT_FALSE(S.ETA);
+
+  S.ETA = 80000000;
+  std::string Line;
+  llvm::raw_string_ostream LineOut(Line);
+  BuildProgress::writeLine(LineOut, S, "obj", "net::http");
+  EXPECT_EQ(LineOut.str(), "[1/2] obj net::http, ETA 1m20s");
+
+  // Jobs besides dirty set extend total.
+  Progress.onFinished(0);
+  S = Progress.onFinished(0);
+  EXPECT_EQ(S.Done, 3u);
+  EXPECT_EQ(S.Total, 3u);
+
+  S.Elapsed = 5120000;
+  S.ETA = 80000000;
+  std::string Event;
+  llvm::raw_string_ostream EventOut(Event);
+  BuildProgress::writeEvent(
+      EventOut, S, BuildProgress::EventKind::Finished, "decl", "a"
+  );
+  EXPECT_EQ(
+      EventOut.str(),
+      "{\"event\":\"finished\",\"phase\":\"decl\",\"unit\":\"a\","
+      "\"done\":3,\"total\":3,\"running\":0,\"elapsed_ms\":5120,"
+      "\"eta_ms\":80000}\n"
+  );
+}
+
+TEST_F(LevitationUnitTests, WorkerProtocol) {
+  using namespace clang::levitation::tools;
+  using Format = WorkerProtocol::Format;
+
+  // arguments: "-cc1", "a.cppl"; inputs: {"a.cppl", "d1"}; request_id: 300.
+  const char ProtoRequest[] =
+      "\x1f"
+      "\x0a\x04-cc1"
+      "\x0a\x06" "a.cppl"
+      "\x12\x0c\x0a\x06" "a.cppl\x12\x02" "d1"
+      "\x18\xac\x02";
+
+  std::istringstream ProtoIn(
+      std::string(ProtoRequest, sizeof(ProtoRequest) - 1)
+  );
+
+  WorkRequest R;
+  ASSERT_TRUE(WorkerProtocol::read(Format::Proto, ProtoIn, R));
+  ASSERT_EQ(R.Arguments.size(), 2u);
+  EXPECT_EQ(R.Arguments[0], "-cc1");
+  EXPECT_EQ(R.Arguments[1], "a.cppl");
+  ASSERT_EQ(R.Inputs.size(), 1u);
+  EXPECT_EQ(R.Inputs[0].Path, "a.cppl");
+  EXPECT_EQ(R.Inputs[0].Digest, "d1");
+  EXPECT_EQ(R.RequestID, 300);
+  EXPECT_FALSE(WorkerProtocol::read(Format::Proto, ProtoIn, R));
+
+  std::istringstream JSONIn(
+      "{\"arguments\": [\"-cc1\", \"{b}.cppl\"], \"requestId\": 7}\n"
+      "{\"arguments\": [], \"cancel\": true}\n"
+  );
+  ASSERT_TRUE(WorkerProtocol::read(Format::JSON, JSONIn, R));
+  ASSERT_EQ(R.Arguments.size(), 2u);
+  EXPECT_EQ(R.Arguments[1], "{b}.cppl");
+  EXPECT_EQ(R.RequestID, 7);
+  EXPECT_TRUE(R.Inputs.empty());
+  ASSERT_TRUE(WorkerProtocol::read(Format::JSON, JSONIn, R));
+  EXPECT_TRUE(R.Cancel);
+  EXPECT_FALSE(WorkerProtocol::read(Format::JSON, JSONIn, R));
+
+  WorkResponse Response;
+  Response.ExitCode = 1;
+  Response.Output = "err";
+  Response.RequestID = 300;
+
+  std::string Proto;
+  {
+    raw_string_ostream OS(Proto);
+    WorkerProtocol::write(Format::Proto, OS, Response);
+  }
+  EXPECT_EQ(Proto, std::string("\x0a\x08\x01\x12\x03" "err\x18\xac\x02", 11));
+
+  std::string JSON;
+  {
+    raw_string_ostream OS(JSON);
+    WorkerProtocol::write(Format::JSON, OS, Response);
+  }
+  EXPECT_EQ(JSON, "{\"exitCode\":1,\"output\":\"err\",\"requestId\":300}\n");
+}
+
+TEST_F(LevitationUnitTests, StringsPoolFreeze) {
+  DependenciesStringsPool Strings;
+
+  auto A = Strings.addItem(StringRef("A"));
+  auto BC = Strings.addItem(StringRef("B/C"));
+  auto Empty = Strings.addItem(StringRef(""));
+
+  Strings.freeze();
+  EXPECT_TRUE(Strings.isFrozen());
+
+  EXPECT_EQ(*Strings.getItem(A), "A");
+  EXPECT_EQ(*Strings.getItem(BC), "B/C");
+  EXPECT_EQ(*Strings.getItem(Empty), "");
+  EXPECT_EQ(Strings.getItem(StringID()), nullptr);
+  EXPECT_EQ(Strings.getItem(BC + 100), nullptr);
+
+  // Adding strings thaws pool, IDs are kept.
+  EXPECT_EQ(Strings.addItem(StringRef("B/C")), BC);
+  EXPECT_FALSE(Strings.isFrozen());
+
+  auto D = Strings.addItem(StringRef("D"));
+  EXPECT_NE(D, A);
+  EXPECT_EQ(*Strings.getItem(A), "A");
+  EXPECT_EQ(*Strings.getItem(D), "D");
+
+  size_t NumItems = 0;
+  for (const auto &Item : Strings.items()) {
+    EXPECT_EQ(*Strings.getItem(Item.first), Item.second);
+    ++NumItems;
+  }
+  EXPECT_EQ(NumItems, 4u);
+}
+
+TEST_F(LevitationUnitTests, StringsPoolExplicitIDs) {
+  DependenciesStringsPool Strings;
+
+  // Deserialization restores IDs, which may have gaps.
+  EXPECT_TRUE(Strings.addItem(5, "A"));
+  EXPECT_TRUE(Strings.addItem(2, "B"));
+  EXPECT_FALSE(Strings.addItem(7, "A"));
+
+  EXPECT_EQ(Strings.getItem(3), nullptr);
+  EXPECT_EQ(Strings.getItem(7), nullptr);
+  EXPECT_EQ(*Strings.getItem(5), "A");
+
+  EXPECT_EQ(Strings.addItem(StringRef("A")), 5u);
+
+  auto C = Strings.addItem(StringRef("C"));
+  EXPECT_GT(C, 5u);
+
+  std::vector<std::pair<StringID, std::string>> Items;
+  for (const auto &Item : Strings.items())
+    Items.push_back({Item.first, Item.second.str()});
+
+  ASSERT_EQ(Items.size(), 3u);
+  EXPECT_EQ(Items[0], std::make_pair(StringID(2), std::string("B")));
+  EXPECT_EQ(Items[1], std::make_pair(StringID(5), std::string("A")));
+  EXPECT_EQ(Items[2], std::make_pair(C, std::string("C")));
+}
+
+TEST_F(LevitationUnitTests, ParsedDependenciesReplace) {
+  DependenciesStringsPool Strings;
+  ParsedDependencies Parsed(Strings);
+
+  auto makeData = [] (std::initializer_list<StringRef> Deps) {
+    DependenciesData Data;
+    Data.IsPublic = false;
+    Data.IsBodyOnly = false;
+    for (auto Dep : Deps)
+      Data.DeclarationDependencies.insert(
+          Declaration(Data.Strings->addItem(Dep))
+      );
+    return Data;
+  };
+
+  auto B = Strings.addItem(StringRef("B"));
+
+  EXPECT_FALSE(Parsed.contains(B));
+  EXPECT_TRUE(Parsed.replace(B, makeData({"A"})));
+  EXPECT_TRUE(Parsed.contains(B));
+
+  // Same dependencies, but represented with different strings pool.
+  EXPECT_FALSE(Parsed.replace(B, makeData({"A"})));
+
+  EXPECT_TRUE(Parsed.replace(B, makeData({"A", "C"})));
+  EXPECT_TRUE(Parsed.replace(B, makeData({"C"})));
+
+  auto Public = makeData({"C"});
+  Public.IsPublic = true;
+  EXPECT_TRUE(Parsed.replace(B, Public));
+
+  Parsed.remove(B);
+  EXPECT_FALSE(Parsed.contains(B));
+}
+
+TEST_F(LevitationUnitTests, ImportScanner) {
+  auto hasPaths = [] (
+      StringRef Expected,
+      PackageDependencies &D,
+      const PathIDsSet &IDs
+  ) {
+    SmallVector<StringRef, 8> Paths;
+    for (auto ID : IDs)
+      Paths.push_back(*D.PathsPool.getItem(ID));
+    llvm::sort(Paths);
+
+    std::string Joined;
+    for (auto P : Paths)
+      Joined += (Joined.empty() ? "" : " ") + P.str();
+    return Expected == Joined;
+  };
+
+  PackageDependencies Deps;
+  ImportScanner Scanner(
+      "// #import commented::Out\n"
+      "/* #import commented::Out */\n"
+      "#public\n"
+      "#import A::B // comment\n"
+      "  #  import \\\n"
+      "     C::D\n"
+      "#import [bodydep] E\n"
+      "\n"
+      "namespace A { const char *S = \"\\n#import F\"; }\n"
+      "const char *R = R\"x(\n#import G\n)x\";\n"
+      "int N = 1'000;\n"
+      "#body\n"
+      "#import H\n"
+  );
+
+  EXPECT_TRUE(Scanner.scan(Deps));
+  EXPECT_TRUE(Deps.IsPublic);
+  EXPECT_FALSE(Deps.IsBodyOnly);
+  EXPECT_TRUE(hasPaths("A::B C::D", Deps, Deps.DeclarationDependencies));
+  EXPECT_TRUE(hasPaths("E H", Deps, Deps.DefinitionDependencies));
+
+  PackageDependencies BodyOnly;
+  EXPECT_TRUE(ImportScanner("// Comment\n#body\n#import A\n").scan(BodyOnly));
+  EXPECT_TRUE(BodyOnly.IsBodyOnly);
+  EXPECT_TRUE(hasPaths("A", BodyOnly, BodyOnly.DefinitionDependencies));
+
+  // Cases that must be handled by clang.
+  PackageDependencies Unused;
+  EXPECT_FALSE(ImportScanner("#ifdef X\n#import A\n#endif\n").scan(Unused));
+  EXPECT_FALSE(ImportScanner("#include <a>\n#import A\n").scan(Unused));
+  EXPECT_FALSE(ImportScanner("#define A B\n#import A\n").scan(Unused));
+  EXPECT_FALSE(ImportScanner("#import A::\n").scan(Unused));
+  EXPECT_FALSE(ImportScanner("#import [other] A\n").scan(Unused));
+}
+
 }
@@ -0,0 +1,259 @@
+#!/usr/bin/env python3
+#
+#===- bench.py - C++ Levitation end-to-end build benchmark --*- python -*--===#
+#
+# Part of the C++ Levitation Project,
+# under the Apache License v2.0 with LLVM Exceptions.
+# See https://llvm.org/LICENSE.txt for license information.
+# SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+#
+#===------------------------------------------------------------------------===#
+
+"""
+Runs end-to-end build benchmark of C++ Levitation project, generated
+by gen-project.py.
+
+Following scenarios are measured:
+
+  clean             build from scratch
+  noop              nothing changed since previous build
+  touch-leaf        body of unit nobody depends on is changed
+  touch-root-body   body of most imported unit is changed
+  touch-root-decl   declaration of most imported unit is changed
+
+Each build is run with --trace-out, and driver phases recorded in trace
+(runParseImport, solveDependencies, codeGen, etc.) are reported with
+their wall time. CPU time is taken from resource usage of cppl and all
+its jobs, job time is sum of job durations by job kind.
+
+Example:
+
+  gen-project.py -units=500 -depth=8 my-project
+  bench.py -cppl=path/to/cppl -j8 my-project
+"""
+
+from __future__ import absolute_import, division, print_function
+
+import argparse
+import json
+import os
+import resource
+import shutil
+import subprocess
+import sys
+import time
+
+SCENARIOS = [
+  'clean', 'noop', 'touch-leaf', 'touch-root-body', 'touch-root-decl'
+]
+
+
+class Build(object):
+  def __init__(self, args):
+    self.args = args
+    self.root = os.path.abspath(args.root)
+    self.build_root = os.path.abspath(
+        args.build_root or self.root + '.build')
+    self.trace = os.path.join(self.build_root, 'bench-trace.json')
+    self.revision = 0
+
+  def clean(self):
+    if os.path.isdir(self.build_root):
+      shutil.rmtree(self.build_root)
+
+  def run(self):
+    if not os.path.isdir(self.build_root):
+      os.makedirs(self.build_root)
+
+    cmd = [
+      self.args.cppl,
+      '-root=%s' % self.root,
+      '-buildRoot=%s' % self.build_root,
+      '-j%d' % self.args.jobs,
+      '-o', os.path.join(self.build_root, 'a.out'),
+      '--trace-out=%s' % self.trace,
+    ]
+    preamble = os.path.join(self.root, 'Preamble.h')
+    if os.path.isfile(preamble):
+      cmd.append('-preamble=%s' % preamble)
+    cmd += self.args.extra
+
+    before = resource.getrusage(resource.RUSAGE_CHILDREN)
+    start = time.monotonic()
+
+    with open(os.devnull, 'w') as devnull:
+      res = subprocess.call(
+          cmd, stdout=None if self.args.verbose else devnull)
+
+    wall = time.monotonic() - start
+    after = resource.getrusage(resource.RUSAGE_CHILDREN)
+
+    if res != 0:
+      raise RuntimeError('build failed: %s' % ' '.join(cmd))
+
+    cpu = (after.ru_utime - before.ru_utime) + \
+          (after.ru_stime - before.ru_stime)
+
+    phases, jobs = read_trace(self.trace)
+    return { 'wall': wall, 'cpu': cpu, 'phases': phases, 'jobs': jobs }
+
+  def touch(self, rel_path, marker):
+    """Replaces marker line with new contents, so that part of unit
+    marker belongs to is changed."""
+    self.revision += 1
+    path = os.path.join(self.root, rel_path)
+    with open(path) as f:
+      lines = f.readlines()
+
+    for i, l in enumerate(lines):
+      if marker not in l:
+        continue
+      if marker == 'BENCH-DECL':
+        lines[i] = '  static const int BenchDecl = %d; // %s\n' % (
+            self.revision, marker)
+      else:
+        lines[i] = '  Res += %d; // %s\n' % (self.revision, marker)
+      break
+    else:
+      raise RuntimeError('%s: no %s marker' % (path, marker))
+
+    with open(path, 'w') as f:
+      f.writelines(lines)
+
+
+def read_trace(path):
+  """Returns wall time of driver phases, and sum of job durations
+  per job kind, both in seconds."""
+  phases = {}
+  jobs = {}
+
+  with open(path) as f:
+    trace = json.load(f)
+
+  for e in trace.get('traceEvents', []):
+    if e.get('ph') != 'X':
+      continue
+    dur = e.get('dur', 0) / 1e6
+    cat = e.get('cat', '')
+    if cat == 'driver':
+      phases[e['name']] = phases.get(e['name'], 0) + dur
+    else:
+      jobs[cat] = jobs.get(cat, 0) + dur
+
+  return phases, jobs
+
+
+def median(values):
+  values = sorted(values)
+  n = len(values)
+  if n % 2:
+    return values[n // 2]
+  return (values[n // 2 - 1] + values[n // 2]) / 2
+
+
+def summarize(runs):
+  """Takes median of each measurement over repeated runs."""
+  def merge(key):
+    names = set(n for r in runs for n in r[key])
+    return dict(
+        (n, median([r[key].get(n, 0) for r in runs])) for n in names)
+
+  return {
+    'wall': median([r['wall'] for r in runs]),
+    'cpu': median([r['cpu'] for r in runs]),
+    'phases': merge('phases'),
+    'jobs': merge('jobs'),
+  }
+
+
+def run_scenario(build, project, scenario):
+  if scenario == 'clean':
+    build.clean()
+  elif scenario == 'touch-leaf':
+    build.touch(project['leaves'][0], 'BENCH-BODY')
+  elif scenario == 'touch-root-body':
+    build.touch(project['roots'][0], 'BENCH-BODY')
+  elif scenario == 'touch-root-decl':
+    build.touch(project['roots'][0], 'BENCH-DECL')
+  return build.run()
+
+
+def write_report(out, results):
+  for scenario, r in results:
+    out.write('%s: %.3f s wall, %.3f s cpu\n' % (
+        scenario, r['wall'], r['cpu']))
+
+    for name, dur in sorted(r['phases'].items(), key=lambda p: -p[1]):
+      out.write('  %-28s %10.3f s\n' % (name, dur))
+
+    if r['jobs']:
+      out.write('  jobs:\n')
+      for name, dur in sorted(r['jobs'].items(), key=lambda p: -p[1]):
+        out.write('    %-26s %10.3f s\n' % (name, dur))
+
+    out.write('\n')
+
+
+def main():
+  parser = argparse.ArgumentParser(
+      description=__doc__,
+      formatter_class=argparse.RawDescriptionHelpFormatter)
+  parser.add_argument('-cppl', default='cppl',
+                      help='path to cppl (default: %(default)s)')
+  parser.add_argument('-j', type=int, default=os.cpu_count() or 1,
+                      dest='jobs', help='number of parallel jobs')
+  parser.add_argument('-buildRoot', dest='build_root',
+                      help='build directory, <root>.build by default')
+  parser.add_argument('-repeat', type=int, default=1,
+                      help='runs per scenario, median is reported '
+                           '(default: %(default)s)')
+  parser.add_argument('-scenarios', default=','.join(SCENARIOS),
+                      help='comma separated scenarios to run '
+                           '(default: all)')
+  parser.add_argument('-json', dest='json_out',
+                      help='also write results as JSON into given file')
+  parser.add_argument('-verbose', action='store_true',
+                      help='show cppl output')
+  parser.add_argument('root', help='project generated by gen-project.py')
+  parser.add_argument('extra', nargs='*',
+                      help='extra cppl arguments, after --')
+  args = parser.parse_args()
+
+  with open(os.path.join(args.root, 'project.json')) as f:
+    project = json.load(f)
+
+  scenarios = [s for s in args.scenarios.split(',') if s]
+  for s in scenarios:
+    if s not in SCENARIOS:
+      print('error: unknown scenario \'%s\'' % s, file=sys.stderr)
+      return 1
+
+  build = Build(args)
+
+  # Every scenario but clean one measures incremental build, so tree
+  # has to be built first.
+  if scenarios and scenarios[0] != 'clean':
+    build.clean()
+    build.run()
+
+  results = []
+  for s in scenarios:
+    runs = []
+    for _ in range(args.repeat):
+      runs.append(run_scenario(build, project, s))
+    results.append((s, summarize(runs)))
+
+  write_report(sys.stdout, results)
+
+  if args.json_out:
+    with open(args.json_out, 'w') as f:
+      json.dump({
+        'project': project,
+        'results': [dict(r, scenario=s) for s, r in results],
+      }, f, indent=2)
+
+  return 0
+
+
+if __name__ == '__main__':
+  sys.exit(main())
@@ -0,0 +1,263 @@
+#!/usr/bin/env python3
+#
+#===- gen-project.py - C++ Levitation synthetic project ------*- python -*--===#
+#
+# Part of the C++ Levitation Project,
+# under the Apache License v2.0 with LLVM Exceptions.
+# See https://llvm.org/LICENSE.txt for license information.
+# SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+#
+#===------------------------------------------------------------------------===#
+
+"""
+Generates synthetic C++ Levitation project for build benchmarks.
+
+Units are spread over layers, unit of each layer imports units of lower
+layers, so depth of layers is the depth of dependencies graph. Part of
+imports goes after #body, so they only add definition dependencies.
+Some units define class templates, which are instantiated by dependents.
+
+Each unit has two markers, used by bench.py to change its declaration
+or its body:
+
+  // BENCH-DECL
+  // BENCH-BODY
+
+Generator also writes project.json with list of roots (layer 0 units,
+most imported first) and leaves (units nobody depends on).
+
+Example:
+
+  gen-project.py -units=500 -depth=8 -fan-out=4 my-project
+"""
+
+from __future__ import absolute_import, division, print_function
+
+import argparse
+import json
+import os
+import random
+import sys
+
+PACKAGE = 'Bench'
+
+STD_HEADERS = [
+  'vector', 'string', 'map', 'unordered_map', 'memory', 'algorithm',
+  'functional', 'utility', 'set', 'list', 'deque', 'tuple', 'sstream',
+  'iostream', 'array', 'numeric', 'iterator', 'limits', 'type_traits',
+  'chrono',
+]
+
+
+class Unit(object):
+  def __init__(self, layer, index):
+    self.layer = layer
+    self.index = index
+    self.decl_imports = []
+    self.body_imports = []
+    self.has_template = False
+    self.num_dependents = 0
+
+  @property
+  def name(self):
+    return 'U%d' % self.index
+
+  @property
+  def unit_id(self):
+    return '%s::L%d::%s' % (PACKAGE, self.layer, self.name)
+
+  @property
+  def path(self):
+    return os.path.join(PACKAGE, 'L%d' % self.layer, self.name + '.cppl')
+
+
+def build_units(args, rnd):
+  layers = [[] for _ in range(args.depth)]
+
+  # Each layer gets at least one unit, rest is spread evenly.
+  for i in range(args.units):
+    layer = i % args.depth if i < args.depth else rnd.randrange(args.depth)
+    layers[layer].append(Unit(layer, len(layers[layer])))
+
+  for layer in layers[1:]:
+    for u in layer:
+      lower = [d for l in layers[:u.layer] for d in l]
+
+      # Always import something from previous layer, so that
+      # graph really is as deep as requested.
+      deps = [rnd.choice(layers[u.layer - 1])]
+      rest = [d for d in lower if d is not deps[0]]
+      deps += rnd.sample(rest, min(len(rest), args.fan_out - 1))
+
+      for d in deps:
+        d.num_dependents += 1
+        if rnd.random() < args.body_ratio:
+          u.body_imports.append(d)
+        else:
+          u.decl_imports.append(d)
+
+  for layer in layers:
+    for u in layer:
+      u.has_template = rnd.random() < args.template_density
+
+  return layers
+
+
+def write_unit(root, u):
+  lines = []
+  for d in u.decl_imports:
+    lines.append('#import %s' % d.unit_id)
+  lines.append('')
+
+  lines.append('class C {')
+  lines.append('public:')
+  for i, d in enumerate(u.decl_imports):
+    lines.append('  %s::C *Dep%d = nullptr;' % (d.unit_id, i))
+  lines.append('  int Value = %d;' % u.index)
+  lines.append('  // BENCH-DECL')
+  lines.append('  int get() const;')
+  lines.append('  static int compute(int v);')
+  lines.append('};')
+  lines.append('')
+
+  if u.has_template:
+    lines.append('template <typename T>')
+    lines.append('class Box {')
+    lines.append('public:')
+    lines.append('  T Item;')
+    lines.append('  T get() const { return Item; }')
+    lines.append('  template <typename F> T apply(F Fn) const {')
+    lines.append('    return Fn(Item);')
+    lines.append('  }')
+    lines.append('};')
+    lines.append('')
+
+  lines.append('#body')
+  for d in u.body_imports:
+    lines.append('#import %s' % d.unit_id)
+  lines.append('')
+
+  lines.append('int C::get() const {')
+  lines.append('  int Res = Value;')
+  for i, d in enumerate(u.decl_imports):
+    lines.append('  if (Dep%d) Res += Dep%d->get();' % (i, i))
+  lines.append('  return Res;')
+  lines.append('}')
+  lines.append('')
+
+  lines.append('int C::compute(int v) {')
+  lines.append('  if (v <= 0)')
+  lines.append('    return 0;')
+  lines.append('  int Res = v;')
+  for i, d in enumerate(u.decl_imports + u.body_imports):
+    if d.has_template:
+      lines.append('  %s::Box<int> B%d { v };' % (d.unit_id, i))
+      lines.append(
+          '  Res += B%d.apply([] (int x) { return x * 2; });' % i)
+    lines.append('  Res += %s::C::compute(v - 1);' % d.unit_id)
+  lines.append('  // BENCH-BODY')
+  lines.append('  return Res;')
+  lines.append('}')
+
+  path = os.path.join(root, u.path)
+  if not os.path.isdir(os.path.dirname(path)):
+    os.makedirs(os.path.dirname(path))
+  with open(path, 'w') as f:
+    f.write('\n'.join(lines) + '\n')
+
+
+def write_main(root, leaves):
+  lines = ['#import %s' % u.unit_id for u in leaves]
+  lines.append('')
+  lines.append('namespace :: {')
+  lines.append('  int main() {')
+  lines.append('    int Res = 0;')
+  for u in leaves:
+    lines.append('    Res += %s::C::compute(1);' % u.unit_id)
+  lines.append('    return Res == 0;')
+  lines.append('  }')
+  lines.append('}')
+
+  with open(os.path.join(root, 'main.cppl'), 'w') as f:
+    f.write('\n'.join(lines) + '\n')
+
+
+def write_preamble(root, size):
+  lines = []
+  for i in range(size):
+    if i < len(STD_HEADERS):
+      lines.append('#include <%s>' % STD_HEADERS[i])
+    else:
+      # Past standard headers preamble grows with own declarations.
+      lines.append('inline int preambleHelper%d(int v) { return v + %d; }'
+                   % (i, i))
+
+  with open(os.path.join(root, 'Preamble.h'), 'w') as f:
+    f.write('\n'.join(lines) + '\n')
+
+
+def main():
+  parser = argparse.ArgumentParser(
+      description=__doc__,
+      formatter_class=argparse.RawDescriptionHelpFormatter)
+  parser.add_argument('-units', type=int, default=100,
+                      help='number of units (default: %(default)s)')
+  parser.add_argument('-depth', type=int, default=5,
+                      help='number of layers (default: %(default)s)')
+  parser.add_argument('-fan-out', type=int, default=3, dest='fan_out',
+                      help='imports per unit (default: %(default)s)')
+  parser.add_argument('-template-density', type=float, default=0.2,
+                      dest='template_density',
+                      help='fraction of units which define templates '
+                           '(default: %(default)s)')
+  parser.add_argument('-body-ratio', type=float, default=0.3,
+                      dest='body_ratio',
+                      help='fraction of imports placed after #body '
+                           '(default: %(default)s)')
+  parser.add_argument('-preamble-size', type=int, default=5,
+                      dest='preamble_size',
+                      help='number of preamble entries, standard headers '
+                           'first (default: %(default)s)')
+  parser.add_argument('-seed', type=int, default=0,
+                      help='random seed (default: %(default)s)')
+  parser.add_argument('root', help='project directory to create')
+  args = parser.parse_args()
+
+  if args.depth < 1 or args.units < args.depth:
+    print('error: -units should be not less than -depth >= 1',
+          file=sys.stderr)
+    return 1
+
+  if args.fan_out < 1:
+    print('error: -fan-out should be at least 1', file=sys.stderr)
+    return 1
+
+  rnd = random.Random(args.seed)
+  layers = build_units(args, rnd)
+
+  if not os.path.isdir(args.root):
+    os.makedirs(args.root)
+
+  units = [u for l in layers for u in l]
+  for u in units:
+    write_unit(args.root, u)
+
+  leaves = [u for u in units if not u.num_dependents]
+  write_main(args.root, leaves)
+  write_preamble(args.root, args.preamble_size)
+
+  project = {
+    'units': len(units),
+    'parameters': vars(args),
+    'roots': [u.path for u in sorted(
+        layers[0], key=lambda u: -u.num_dependents)],
+    'leaves': [u.path for u in leaves],
+  }
+  with open(os.path.join(args.root, 'project.json'), 'w') as f:
+    json.dump(project, f, indent=2)
+
+  return 0
+
+
+if __name__ == '__main__':
+  sys.exit(main())